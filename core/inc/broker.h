@@ -24,10 +24,12 @@ typedef struct BROKER_HANDLE_DATA_TAG* BROKER_HANDLE;
 
 #ifdef __cplusplus
 #include <cstddef>
+#include <cstdint>
 extern "C"
 {
 #else
 #include <stddef.h>
+#include <stdint.h>
 #endif
 
 /** @brief    Link Data with #MODULE_HANDLE for source and sink. 
@@ -41,24 +43,246 @@ typedef struct BROKER_LINK_DATA_TAG {
     MODULE_HANDLE module_sink_handle;
 } BROKER_LINK_DATA;
 
+/** @brief    A condition on one property of a message, see
+*            #BROKER_LINK_FILTER.
+*/
+typedef struct BROKER_PROPERTY_MATCH_TAG
+{
+    /** @brief    Name of the property. */
+    const char* name;
+
+    /** @brief    Value the property must have. A @c * in the pattern matches
+    *            any number of characters, so @c "AA:*" matches every value
+    *            starting with @c "AA:" and @c "*" only requires the property
+    *            to be present.
+    */
+    const char* pattern;
+} BROKER_PROPERTY_MATCH;
+
+/** @brief    Predicate on the properties of the messages of a link, see
+*            ::Broker_AddLinkWithFilter. A message goes through the link
+*            only if every one of the matches holds.
+*/
+typedef struct BROKER_LINK_FILTER_TAG
+{
+    /** @brief    Number of entries in @c matches. */
+    size_t match_count;
+
+    /** @brief    The conditions, all of which a message has to meet. */
+    const BROKER_PROPERTY_MATCH* matches;
+} BROKER_LINK_FILTER;
+
 #define BROKER_RESULT_VALUES \
     BROKER_OK, \
     BROKER_ERROR, \
     BROKER_ADD_LINK_ERROR, \
     BROKER_REMOVE_LINK_ERROR, \
-    BROKER_INVALIDARG
+    BROKER_INVALIDARG, \
+    BROKER_MESSAGE_DROPPED
 
 /** @brief    Enumeration describing the result of ::Broker_Publish, 
 *            ::Broker_AddModule, ::Broker_AddLink, and ::Broker_RemoveModule.
+*            #BROKER_MESSAGE_DROPPED is returned by ::Broker_Publish when the
+*            mailbox of a sink was full and its overflow policy rejected the
+*            message.
 */
 DEFINE_ENUM(BROKER_RESULT, BROKER_RESULT_VALUES);
 
+#define BROKER_SCHEDULER_VALUES \
+    BROKER_SCHEDULER_THREAD_PER_MODULE, \
+    BROKER_SCHEDULER_WORKER_POOL
+
+/** @brief    Enumeration describing how the broker calls the modules'
+*            receive functions.
+*/
+DEFINE_ENUM(BROKER_SCHEDULER, BROKER_SCHEDULER_VALUES);
+
+/** @brief    Options for ::Broker_CreateWithOptions.
+*/
+typedef struct BROKER_OPTIONS_TAG
+{
+    /** @brief    #BROKER_SCHEDULER_THREAD_PER_MODULE gives every module its
+    *            own thread. #BROKER_SCHEDULER_WORKER_POOL shares a fixed
+    *            number of threads among all the modules.
+    */
+    BROKER_SCHEDULER scheduler;
+
+    /** @brief    Number of threads of the worker pool, 0 for the default.
+    *            Ignored by #BROKER_SCHEDULER_THREAD_PER_MODULE.
+    */
+    size_t worker_count;
+} BROKER_OPTIONS;
+
+#define BROKER_OVERFLOW_POLICY_VALUES \
+    BROKER_OVERFLOW_BLOCK, \
+    BROKER_OVERFLOW_DROP_OLDEST, \
+    BROKER_OVERFLOW_DROP_NEWEST, \
+    BROKER_OVERFLOW_COALESCE
+
+/** @brief    Enumeration describing what ::Broker_Publish does with a message
+*            for a module whose mailbox is full.
+*/
+DEFINE_ENUM(BROKER_OVERFLOW_POLICY, BROKER_OVERFLOW_POLICY_VALUES);
+
+/** @brief    Limits of the mailbox in which the broker queues the messages
+*            of a module, see ::Broker_AddModuleWithOptions.
+*/
+typedef struct BROKER_MAILBOX_OPTIONS_TAG
+{
+    /** @brief    Maximum number of messages waiting in the mailbox, 0 for
+    *            no limit.
+    */
+    size_t capacity;
+
+    /** @brief    What happens to a message published while the mailbox is
+    *            full. #BROKER_OVERFLOW_BLOCK makes the publisher wait for
+    *            room, up to a second before the message is dropped,
+    *            #BROKER_OVERFLOW_DROP_OLDEST discards the oldest waiting
+    *            message, #BROKER_OVERFLOW_DROP_NEWEST rejects the new message
+    *            and #BROKER_OVERFLOW_COALESCE replaces the waiting message
+    *            that has the same value for the coalesce_key property,
+    *            rejecting the new message if there is none.
+    */
+    BROKER_OVERFLOW_POLICY overflow;
+
+    /** @brief    Name of the property compared by #BROKER_OVERFLOW_COALESCE.
+    *            The broker keeps a copy.
+    */
+    const char* coalesce_key;
+} BROKER_MAILBOX_OPTIONS;
+
+/** @brief    Counters of a module's mailbox, see ::Broker_GetModuleStats.
+*/
+typedef struct BROKER_MODULE_STATS_TAG
+{
+    /** @brief    Number of messages waiting in the mailbox. */
+    size_t depth;
+
+    /** @brief    Number of messages the overflow policy discarded since the
+    *            module was added, whether rejected or dropped.
+    */
+    size_t dropped;
+
+    /** @brief    Number of queued messages #BROKER_OVERFLOW_COALESCE replaced
+    *            by a newer one since the module was added.
+    */
+    size_t coalesced;
+} BROKER_MODULE_STATS;
+
+/** @brief    Number of buckets of a #BROKER_HISTOGRAM. */
+#define BROKER_HISTOGRAM_BUCKETS 128
+
+/** @brief    Distribution of durations in microseconds.
+*
+*    @details  Values below 4 have a bucket each. Above that, every power of
+*              two is split in 4 buckets of the same width, so a value is
+*              known within 25% whatever its magnitude. Values of 2^33
+*              microseconds and more share the last bucket. Use
+*              ::Broker_HistogramPercentile to read a percentile.
+*/
+typedef struct BROKER_HISTOGRAM_TAG
+{
+    /** @brief    Number of values recorded. */
+    size_t count;
+
+    /** @brief    Sum of the values recorded. */
+    uint64_t total;
+
+    /** @brief    Largest value recorded. */
+    uint64_t max;
+
+    /** @brief    Number of values recorded in every bucket. */
+    size_t buckets[BROKER_HISTOGRAM_BUCKETS];
+} BROKER_HISTOGRAM;
+
+/** @brief    What went through a module since it was added to the broker,
+*            see ::Broker_GetModuleMetrics.
+*/
+typedef struct BROKER_MODULE_METRICS_TAG
+{
+    /** @brief    Number of messages taken out of the mailbox and handed to
+    *            the module.
+    */
+    size_t received;
+
+    /** @brief    Size in bytes of the content of the received messages. */
+    uint64_t bytes_received;
+
+    /** @brief    Number of messages the module published while it was the
+    *            source of at least one link.
+    */
+    size_t published;
+
+    /** @brief    Size in bytes of the content of the published messages. */
+    uint64_t bytes_published;
+
+    /** @brief    Number of messages waiting in the mailbox. */
+    size_t depth;
+
+    /** @brief    Number of messages the overflow policy discarded. */
+    size_t dropped;
+
+    /** @brief    Number of queued messages replaced by a newer one. */
+    size_t coalesced;
+
+    /** @brief    Time spent in every call to the module's @c Module_Receive
+    *            (or @c Module_ReceiveBatch), in microseconds.
+    */
+    BROKER_HISTOGRAM receive_time;
+
+    /** @brief    Time every received message waited in the mailbox, in
+    *            microseconds. A message that coalesced with a waiting one
+    *            is timed from its own publish.
+    */
+    BROKER_HISTOGRAM queue_wait;
+} BROKER_MODULE_METRICS;
+
+/** @brief    What went through a link since it was added to the broker, see
+*            ::Broker_GetLinkMetrics.
+*/
+typedef struct BROKER_LINK_METRICS_TAG
+{
+    /** @brief    Number of messages of the source queued in the mailbox of
+    *            the sink.
+    */
+    size_t delivered;
+
+    /** @brief    Size in bytes of the content of the delivered messages. */
+    uint64_t bytes_delivered;
+
+    /** @brief    Number of messages of the source the overflow policy of
+    *            the sink rejected.
+    */
+    size_t dropped;
+
+    /** @brief    Number of messages of the source the filter of the link
+    *            kept from the sink.
+    */
+    size_t filtered;
+} BROKER_LINK_METRICS;
+
 /** @brief        Creates a new message broker.
-*   
+*
+*    @details    The broker gives every module its own thread, this is the
+*                same as calling ::Broker_CreateWithOptions with @c NULL.
+*
 *    @return        A valid #BROKER_HANDLE upon success, or @c NULL upon failure.
 */
 GATEWAY_EXPORT BROKER_HANDLE Broker_Create(void);
 
+/** @brief        Creates a new message broker using the provided options.
+*
+*    @details    Whatever the scheduler, a module's receive function is never
+*                called concurrently and receives the messages in the order
+*                in which they were published.
+*
+*    @param        options    The #BROKER_OPTIONS of the broker. (optional, may
+*                        be NULL for the defaults)
+*
+*    @return        A valid #BROKER_HANDLE upon success, or @c NULL upon failure.
+*/
+GATEWAY_EXPORT BROKER_HANDLE Broker_CreateWithOptions(const BROKER_OPTIONS* options);
+
 /** @brief        Increments the reference count of a message broker.
 *
 *    @details    This function will simply increment the internal reference
@@ -96,6 +320,25 @@ GATEWAY_EXPORT void Broker_DecRef(BROKER_HANDLE broker);
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE message);
 
+/** @brief        Publishes several messages to the message broker at once.
+*
+*    @details    Does what ::Broker_Publish does for every message, in order,
+*                but looks up the route of source once and locks the mailbox
+*                of every sink once per group of messages instead of once per
+*                message.
+*
+*    @param        broker    The #BROKER_HANDLE onto which the messages will be
+*                        published.
+*    @param        source    The #MODULE_HANDLE from which the messages will be
+*                        published.
+*    @param        messages  Array of the #MESSAGE_HANDLE of the messages to be
+*                        published.
+*    @param        count     Number of entries in messages.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_PublishBatch(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE* messages, size_t count);
+
 /** @brief        Adds a module to the message broker.
 *
 *    @details    For details about threading with regard to the message broker
@@ -111,6 +354,90 @@ GATEWAY_EXPORT BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_AddModule(BROKER_HANDLE broker, const MODULE* module);
 
+/** @brief        Adds a module to the message broker with a bounded mailbox.
+*
+*    @details    A publisher that is made to wait by #BROKER_OVERFLOW_BLOCK
+*                holds up its own module, so modules linked in a cycle must
+*                not all use it. A module using it cannot be linked to
+*                itself, nor added to a broker with a worker pool, where it
+*                would hold up a worker shared by other modules.
+*
+*    @param        broker              The #BROKER_HANDLE onto which the module
+*                                    will be added.
+*    @param        module              The #MODULE for the module that will be
+*                                    added to this message broker.
+*    @param        mailbox_options     The #BROKER_MAILBOX_OPTIONS of the
+*                                    module's mailbox. (optional, may be NULL
+*                                    for an unbounded mailbox)
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_AddModuleWithOptions(BROKER_HANDLE broker, const MODULE* module, const BROKER_MAILBOX_OPTIONS* mailbox_options);
+
+/** @brief        Reads the counters of the mailbox of a module.
+*
+*    @param        broker    The #BROKER_HANDLE the module was added to.
+*    @param        module    The #MODULE_HANDLE of the module.
+*    @param        stats     Receives the #BROKER_MODULE_STATS of the module.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetModuleStats(BROKER_HANDLE broker, MODULE_HANDLE module, BROKER_MODULE_STATS* stats);
+
+/** @brief        Reads the limits the mailbox of a module was given by
+*                ::Broker_AddModuleWithOptions.
+*
+*    @details    A module that queues the messages it receives before it
+*                handles them can apply the same limits to its own queue.
+*                The coalesce_key belongs to the broker and stays valid until
+*                the module is removed.
+*
+*    @param        broker    The #BROKER_HANDLE the module was added to.
+*    @param        module    The #MODULE_HANDLE of the module.
+*    @param        options   Receives the #BROKER_MAILBOX_OPTIONS of the module,
+*                          a capacity of 0 for an unbounded mailbox.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetModuleMailbox(BROKER_HANDLE broker, MODULE_HANDLE module, BROKER_MAILBOX_OPTIONS* options);
+
+/** @brief        Reads the counters and the latency histograms of a module.
+*
+*    @details    The counters are kept by the threads that publish and
+*                deliver the messages, reading them does not stop the
+*                module. The values are consistent for the mailbox of the
+*                module, the publish counters may be a message ahead.
+*
+*    @param        broker    The #BROKER_HANDLE the module was added to.
+*    @param        module    The #MODULE_HANDLE of the module.
+*    @param        metrics   Receives the #BROKER_MODULE_METRICS of the module.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetModuleMetrics(BROKER_HANDLE broker, MODULE_HANDLE module, BROKER_MODULE_METRICS* metrics);
+
+/** @brief        Reads the counters of a link.
+*
+*    @param        broker    The #BROKER_HANDLE the link was added to.
+*    @param        link      The #BROKER_LINK_DATA of the link.
+*    @param        metrics   Receives the #BROKER_LINK_METRICS of the link.
+*
+*    @return        A #BROKER_RESULT describing the result of the function,
+*                #BROKER_ERROR if the link does not exist.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetLinkMetrics(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, BROKER_LINK_METRICS* metrics);
+
+/** @brief        Reads a percentile of a histogram.
+*
+*    @param        histogram   The #BROKER_HISTOGRAM.
+*    @param        percentile  The percentile, between 0 and 100.
+*
+*    @return        The upper bound of the bucket holding the percentile,
+*                never more than the largest value recorded, or 0 if the
+*                histogram is NULL or empty.
+*/
+GATEWAY_EXPORT uint64_t Broker_HistogramPercentile(const BROKER_HISTOGRAM* histogram, double percentile);
+
 /** @brief        Removes a module from the message broker.
 *   
 *    @param        broker    The #BROKER_HANDLE from which the module will be removed.
@@ -135,6 +462,27 @@ GATEWAY_EXPORT BROKER_RESULT Broker_RemoveModule(BROKER_HANDLE broker, const MOD
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link);
 
+/** @brief        Adds a route to the message broker that only carries the
+*                messages whose properties match a filter.
+*
+*    @details    The filter is compiled when the link is added and evaluated by
+*                ::Broker_Publish before a message is queued, so the sink's
+*                thread is not woken up for the messages it would discard. A
+*                source and a sink have at most one filtered link; a link
+*                added between them with ::Broker_AddLink lets every message
+*                through again.
+*
+*    @param        broker          The #BROKER_HANDLE onto which the link will be
+*                                added.
+*    @param        link            The #BROKER_LINK_DATA for the link that will be added
+*                                to this message broker.
+*    @param        filter          The #BROKER_LINK_FILTER of the link, NULL for
+*                                none. The broker keeps a copy.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_AddLinkWithFilter(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, const BROKER_LINK_FILTER* filter);
+
 /** @brief        Removes a route from the message broker.
 *
 *    @param        broker    The #BROKER_HANDLE from which the link will be removed.
@@ -144,6 +492,35 @@ GATEWAY_EXPORT BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_L
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_RemoveLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link);
 
+/** @brief        Adds a route from every module of the message broker to
+*                @c sink, including the modules added later.
+*
+*    @details    The broker keeps the modules linked this way in a bucket of
+*                its routing table: every other module gets a route to them
+*                when it is added, without a link per module. A module does
+*                not receive the messages it publishes itself. A module linked
+*                to a source both ways receives its messages once, unfiltered.
+*
+*    @param        broker          The #BROKER_HANDLE onto which the link will be
+*                                added.
+*    @param        sink            The #MODULE_HANDLE of the module receiving
+*                                the messages.
+*    @param        filter          The #BROKER_LINK_FILTER of the link, NULL for
+*                                none. The broker keeps a copy.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_AddAnySourceLink(BROKER_HANDLE broker, MODULE_HANDLE sink, const BROKER_LINK_FILTER* filter);
+
+/** @brief        Removes the route added by ::Broker_AddAnySourceLink.
+*
+*    @param        broker    The #BROKER_HANDLE from which the link will be removed.
+*    @param        sink      The #MODULE_HANDLE of the module receiving the messages.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_RemoveAnySourceLink(BROKER_HANDLE broker, MODULE_HANDLE sink);
+
 /** @brief      Disposes of resources allocated by a message broker.
 *
 *    @param      broker  The #BROKER_HANDLE to be destroyed.
@@ -32,6 +32,31 @@ typedef struct GATEWAY_MODULE_INFO_TAG
     VECTOR_HANDLE module_sources;
 } GATEWAY_MODULE_INFO;
 
+/** @brief      Struct representing the metrics of a link into a module */
+typedef struct GATEWAY_LINK_METRICS_TAG
+{
+    /** @brief  The name of the module the link carries messages from */
+    const char* source_name;
+
+    /** @brief  The counters of the link */
+    BROKER_LINK_METRICS metrics;
+} GATEWAY_LINK_METRICS;
+
+/** @brief      Struct representing the metrics of a single module */
+typedef struct GATEWAY_MODULE_METRICS_TAG
+{
+    /** @brief  The name of the module */
+    const char* module_name;
+
+    /** @brief  The counters and latency histograms of the module */
+    BROKER_MODULE_METRICS metrics;
+
+    /** @brief  A vector of @c GATEWAY_LINK_METRICS, one for every module this
+     *          module receives data from.
+     */
+    VECTOR_HANDLE links;
+} GATEWAY_MODULE_METRICS;
+
 /** @brief      Enum representing different gateway events that have support
  *              for callbacks.
  */
@@ -52,6 +77,13 @@ typedef enum GATEWAY_EVENT_TAG
     /** @brief  Called when the gateway is destroyed. */
     GATEWAY_DESTROYED,
 
+    /** @brief  Called every time #Gateway_ReportMetrics is called.
+     *
+     *  The VECTOR_HANDLE from #Gateway_GetMetrics will be provided as the
+     *  context to the callback, and be later cleaned-up automatically.
+     */
+    GATEWAY_METRICS,
+
     /* @brief   Not an actual event, used to keep track of count of different
      *          events
      */
@@ -113,6 +145,36 @@ VECTOR_HANDLE Gateway_GetModuleList(GATEWAY_HANDLE gw);
  */
 void Gateway_DestroyModuleList(VECTOR_HANDLE module_list);
 
+/** @brief      Returns a snapshot of the metrics of the running modules and of
+ *              their links.
+ *
+ *              Since this function allocates new memory for the snapshot, the
+ *              vector handle should be later destroyed with
+ *              @c Gateway_DestroyMetrics.
+ *
+ *  @param      gw      Pointer to a #GATEWAY_HANDLE from which the metrics
+ *                      should be snapshoted
+ *
+ *  @return     A #VECTOR_HANDLE of #GATEWAY_MODULE_METRICS on success.
+ *              NULL on failure.
+ */
+VECTOR_HANDLE Gateway_GetMetrics(GATEWAY_HANDLE gw);
+
+/** @brief      Destroys the list returned by @c Gateway_GetMetrics
+ *
+ *  @param      metrics A vector handle as returned from
+ *              @c Gateway_GetMetrics
+ */
+void Gateway_DestroyMetrics(VECTOR_HANDLE metrics);
+
+/** @brief      Reports the #GATEWAY_METRICS event, so that the callbacks
+ *              registered for it receive a snapshot of the metrics.
+ *
+ *  @param      gw      Pointer to a #GATEWAY_HANDLE whose metrics should be
+ *                      reported
+ */
+void Gateway_ReportMetrics(GATEWAY_HANDLE gw);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
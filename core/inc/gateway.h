@@ -18,6 +18,7 @@
 
 #include "module.h"
 #include "module_loader.h"
+#include "broker.h"
 #include "gateway_export.h"
 
 #ifdef __cplusplus
@@ -54,6 +55,12 @@ typedef struct GATEWAY_LINK_ENTRY_TAG
 
     /** @brief  The name of the module which is going to receive messages. */
     const char* module_sink;
+
+    /** @brief  Only the messages whose properties match this filter go
+     *          through the link, NULL to let every message through. The
+     *          gateway keeps a copy.
+     */
+    const BROKER_LINK_FILTER* filter;
 } GATEWAY_LINK_ENTRY;
 
 /** @brief      Struct representing a particular gateway. */
@@ -86,6 +93,11 @@ typedef struct GATEWAY_MODULES_ENTRY_TAG
 
     /** @brief  The user-defined configuration object for the module */
     const void* module_configuration;
+
+    /** @brief  Limits of the module's mailbox in the broker, a zero capacity
+     *          (the default) leaves it unbounded.
+     */
+    BROKER_MAILBOX_OPTIONS mailbox_options;
 } GATEWAY_MODULES_ENTRY;
 
 /** @brief      Struct representing the properties that should be used when
@@ -136,6 +148,10 @@ typedef struct GATEWAY_PROPERTIES_DATA_TAG
                             },
                             "args": {
                                 "filename": "/var/logs/gateway-log.json"
+                            },
+                            "mailbox": {
+                                "capacity": 1000,
+                                "overflow": "drop_oldest"
                             }
                         }
  *                  ],
@@ -145,9 +161,24 @@ typedef struct GATEWAY_PROPERTIES_DATA_TAG
  *                          "source": "sensor",
  *                          "sink": "logger"
  *                      }
- *                  ]
+ *                  ],
+ *                  "broker":
+ *                  {
+ *                      "scheduler": "worker_pool",
+ *                      "workers": 4
+ *                  }
  *              }
  *
+ *              The "broker" object is optional, by default every module
+ *              gets its own thread (see ::Broker_CreateWithOptions).
+ *
+ *              The "mailbox" object of a module is optional, by default the
+ *              broker queues any number of messages for the module. Its
+ *              "overflow" is one of "block" (the default), "drop_oldest",
+ *              "drop_newest" or "coalesce"; "coalesce" also needs a
+ *              "coalesce_key" naming the message property to compare (see
+ *              ::Broker_AddModuleWithOptions).
+ *
  * @return      A non-NULL #GATEWAY_HANDLE that can be used to manage the
  *              gateway or @c NULL on failure.
  */
@@ -0,0 +1,108 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/** @file       gateway_trace.h
+ *
+ *  @brief      Tracing of the message path of the gateway.
+ *
+ *  @details    When the gateway is built with the @c enable_gateway_trace
+ *              CMake option, the broker, the messages and the outprocess
+ *              modules record a timestamped event at every step a message
+ *              goes through: publish, enqueue, dequeue, the call to
+ *              @c Module_Receive, serialization and the send to a remote
+ *              module. Every thread records into a ring of its own, without
+ *              taking a lock, and the oldest events are overwritten once the
+ *              ring is full. Recording starts when #GatewayTrace_Enable is
+ *              called and #Gateway_DumpTrace writes the events to a file in
+ *              the Chrome trace event format, which chrome://tracing and
+ *              Perfetto open.
+ *
+ *              Without the CMake option the trace points compile to nothing
+ *              and the trace stays empty. With it, a disabled trace costs a
+ *              function call and a test per trace point.
+ */
+
+#ifndef GATEWAY_TRACE_H
+#define GATEWAY_TRACE_H
+
+#include "azure_c_shared_utility/macro_utils.h"
+#include "gateway_export.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief  The number of events a thread keeps, the oldest are overwritten. */
+#define GATEWAY_TRACE_RING_SIZE     4096
+
+/** @brief  The number of threads that can record events at once. A thread
+ *          releases its ring when it exits, and the ring keeps the events of
+ *          the thread until a new thread takes it over.
+ */
+#define GATEWAY_TRACE_MAX_THREADS   128
+
+#define GATEWAY_TRACE_EVENT_VALUES \
+    GATEWAY_TRACE_PUBLISH, \
+    GATEWAY_TRACE_ENQUEUE, \
+    GATEWAY_TRACE_DEQUEUE, \
+    GATEWAY_TRACE_RECEIVE_BEGIN, \
+    GATEWAY_TRACE_RECEIVE_END, \
+    GATEWAY_TRACE_SERIALIZE_BEGIN, \
+    GATEWAY_TRACE_SERIALIZE_END, \
+    GATEWAY_TRACE_DESERIALIZE_BEGIN, \
+    GATEWAY_TRACE_DESERIALIZE_END, \
+    GATEWAY_TRACE_SEND_BEGIN, \
+    GATEWAY_TRACE_SEND_END
+
+/** @brief  The steps of the message path that are traced.
+ *
+ *  The @c _BEGIN and @c _END events of a thread are paired into slices, the
+ *  other events are instants. Enqueue and dequeue events of the same message
+ *  and mailbox are joined by an arrow between the threads.
+ */
+DEFINE_ENUM(GATEWAY_TRACE_EVENT, GATEWAY_TRACE_EVENT_VALUES);
+
+#ifdef GATEWAY_TRACE_ENABLED
+/** @brief  Records @c event for @c object (usually the message) and
+ *          @c context (usually the module or mailbox).
+ */
+#define GATEWAY_TRACE(event, object, context) GatewayTrace_Record((event), (const void*)(object), (const void*)(context))
+#else
+#define GATEWAY_TRACE(event, object, context) ((void)0)
+#endif
+
+/** @brief      Starts recording. Events recorded before the call are left out
+ *              of the next dump.
+ */
+GATEWAY_EXPORT void GatewayTrace_Enable(void);
+
+/** @brief      Stops recording. The events recorded so far can still be
+ *              dumped.
+ */
+GATEWAY_EXPORT void GatewayTrace_Disable(void);
+
+/** @brief      Records an event in the ring of the calling thread if recording
+ *              is enabled. Use the #GATEWAY_TRACE macro rather than calling it
+ *              directly.
+ */
+GATEWAY_EXPORT void GatewayTrace_Record(GATEWAY_TRACE_EVENT event, const void* object, const void* context);
+
+/** @brief      Writes the events recorded since #GatewayTrace_Enable to a file
+ *              in the Chrome trace event (JSON) format.
+ *
+ *  @details    The trace covers the whole process: every gateway and every
+ *              outprocess module in it. Events recorded while the dump runs
+ *              may be left out; disable the trace first for an exact dump.
+ *
+ *  @param      file_path   The file to write, overwritten if it exists.
+ *
+ *  @return     0 on success, non-zero otherwise.
+ */
+GATEWAY_EXPORT int Gateway_DumpTrace(const char* file_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*GATEWAY_TRACE_H*/
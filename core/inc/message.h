@@ -87,6 +87,20 @@ typedef struct MESSAGE_BUFFER_CONFIG_TAG
     MAP_HANDLE sourceProperties;
 }MESSAGE_BUFFER_CONFIG;
 
+/** @brief  Struct defining a property that a message derived with
+ *          #Message_CreateDerived changes or removes.
+ */
+typedef struct MESSAGE_PROPERTY_OVERLAY_TAG
+{
+    /** @brief  The name of the property. This field must not be @c NULL. */
+    const char* name;
+
+    /** @brief  The new value of the property, or @c NULL to remove the
+     *          property from the derived message.
+     */
+    const char* value;
+}MESSAGE_PROPERTY_OVERLAY;
+
 #include "azure_c_shared_utility/umock_c_prod.h"
 
 /** @brief      Creates a new reference counted message from a #MESSAGE_CONFIG
@@ -109,7 +123,9 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_Create, const MESSAGE
  *              containing the serialized form of a message.
  *
  *  @details    The newly created message shall have all the properties of the
- *              original message and the same content.
+ *              original message and the same content. The message keeps a
+ *              single copy of @c source, its properties and its content are
+ *              read in place from that copy.
  *
  *  @param      source  Pointer to a byte array.
  *  @param      size    size in bytes of the array
@@ -119,6 +135,25 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_Create, const MESSAGE
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromByteArray, const unsigned char *, source, int32_t, size);
 
+/** @brief      Creates a new reference counted message from a nanomsg buffer
+ *              containing the serialized form of a message, without copying
+ *              the buffer.
+ *
+ *  @details    @c source must have been returned by @c nn_recv with
+ *              @c NN_MSG (or by @c nn_allocmsg). On success the message takes
+ *              ownership of @c source: its properties and its content are
+ *              read in place from it and @c nn_freemsg is called on it when
+ *              the last reference to the message is destroyed. On failure
+ *              the caller still owns @c source.
+ *
+ *  @param      source  Pointer to a nanomsg buffer.
+ *  @param      size    size in bytes of the serialized message
+ *
+ *  @return     A non-NULL #MESSAGE_HANDLE for the newly created message, or
+ *              NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromByteArrayNoCopy, unsigned char *, source, int32_t, size);
+
 /** @brief      Creates a byte array representation of a MESSAGE_HANDLE. 
  *
  *  @details    The byte array created can be used with function
@@ -153,6 +188,28 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT int32_t, Message_ToByteArray, MESSAGE_HANDLE,
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromBuffer, const MESSAGE_BUFFER_CONFIG *, cfg);
 
+/** @brief      Creates a new message that has the content and the properties
+ *              of another message, except for a few changed or removed
+ *              properties.
+ *
+ *  @details    The new message keeps a reference to @c original and a copy of
+ *              @c overlay only, it copies neither the content nor the
+ *              properties of @c original. #Message_GetProperty reads the
+ *              overlay and then @c original; the full set of properties is
+ *              only built if #Message_GetProperties or #Message_ToByteArray
+ *              is called on the new message. The message will be created
+ *              with the reference count initialized to 1.
+ *
+ *  @param      original    The #MESSAGE_HANDLE the new message derives from.
+ *  @param      overlay     Array of the properties to change or remove. Can
+ *                          be @c NULL when @c overlaySize is zero.
+ *  @param      overlaySize Number of entries in @c overlay.
+ *
+ *  @return     A non-NULL #MESSAGE_HANDLE for the newly created message, or
+ *              @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateDerived, MESSAGE_HANDLE, original, const MESSAGE_PROPERTY_OVERLAY*, overlay, size_t, overlaySize);
+
 /** @brief      Creates a clone of the message.
  *
  *  @details    Since messages are immutable, this function only increments the 
@@ -179,6 +236,23 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT CONSTMAP_HANDLE, Message_GetProperties, MESSAGE_HANDLE, message);
 
+/** @brief      Gets the value of one property of a message.
+ *
+ *  @details    The properties of a message are kept sorted by name, so the
+ *              lookup is a binary search. Unlike #Message_GetProperties this
+ *              does not clone anything: the returned string belongs to the
+ *              message and is valid for as long as the caller holds a
+ *              reference to the message.
+ *
+ *  @param      message     The #MESSAGE_HANDLE from which the property will
+ *                          be fetched.
+ *  @param      key         The name of the property.
+ *
+ *  @return     The value of the property, or @c NULL if the message has no
+ *              such property or upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT const char*, Message_GetProperty, MESSAGE_HANDLE, message, const char*, key);
+
 /** @brief      Gets the content of a message.
  *
  *  @details    The returned @c CONSTBUFFER need not be freed by the caller.
@@ -20,10 +20,17 @@ extern "C"
 #endif
 
 typedef struct MESSAGE_QUEUE_TAG* MESSAGE_QUEUE_HANDLE;
+typedef bool(*MESSAGE_QUEUE_MATCH_FUNCTION)(MESSAGE_HANDLE message, const void* match_context);
 
 /* creation */
 MOCKABLE_FUNCTION(, MESSAGE_QUEUE_HANDLE, MESSAGE_QUEUE_create);
 
+/* creation of a queue many threads may push to while one thread pops: pushes
+   store the message in a lock-free ring of capacity (rounded up to a power of
+   2) messages and only allocate and lock once the ring is full, pops take no
+   lock. MESSAGE_QUEUE_replace_if is not supported on such a queue. */
+MOCKABLE_FUNCTION(, MESSAGE_QUEUE_HANDLE, MESSAGE_QUEUE_create_concurrent, size_t, capacity);
+
 /* destruction */
 MOCKABLE_FUNCTION(, void, MESSAGE_QUEUE_destroy, MESSAGE_QUEUE_HANDLE, handle);
 
@@ -32,6 +39,12 @@ MOCKABLE_FUNCTION(, int, MESSAGE_QUEUE_push, MESSAGE_QUEUE_HANDLE, handle, MESSA
 
 /* removal */
 MOCKABLE_FUNCTION(, MESSAGE_HANDLE, MESSAGE_QUEUE_pop, MESSAGE_QUEUE_HANDLE, handle);
+MOCKABLE_FUNCTION(, size_t, MESSAGE_QUEUE_pop_many, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_HANDLE*, messages, size_t, max_count);
+/* waits up to timeout_ms for a message on a concurrent queue, does not wait on other queues */
+MOCKABLE_FUNCTION(, MESSAGE_HANDLE, MESSAGE_QUEUE_pop_wait, MESSAGE_QUEUE_HANDLE, handle, int, timeout_ms);
+
+/* replacement */
+MOCKABLE_FUNCTION(, MESSAGE_HANDLE, MESSAGE_QUEUE_replace_if, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_QUEUE_MATCH_FUNCTION, match_function, const void*, match_context, MESSAGE_HANDLE, element);
 
 /* access */
 MOCKABLE_FUNCTION(, bool,  MESSAGE_QUEUE_is_empty, MESSAGE_QUEUE_HANDLE, handle);
@@ -107,6 +107,25 @@ extern "C"
      */
     typedef void(*pfModule_Receive)(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle);
 
+    /** @brief      Receives several messages from the broker at once.
+     *
+     *  @details    This function is optional. When a module implements it,
+     *              the broker hands the module all the messages waiting in
+     *              its mailbox (up to a limit) in a single call instead of
+     *              calling #Module_Receive once per message. The messages are
+     *              in the order they were published. As with #Module_Receive,
+     *              the broker keeps ownership of the messages; the module
+     *              must clone the ones it wants to keep.
+     *
+     *  @param      moduleHandle    The #MODULE_HANDLE of the module receiving
+     *                              the messages.
+     *  @param      messageHandles  Array of the #MESSAGE_HANDLE of the
+     *                              messages being sent to the module.
+     *  @param      messageCount    Number of entries in messageHandles, never
+     *                              0.
+     */
+    typedef void(*pfModule_ReceiveBatch)(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE* messageHandles, size_t messageCount);
+
     /** @brief      Signals to the module that the broker is ready to send and
      *              receive messages.
      *
@@ -121,11 +140,12 @@ extern "C"
     /** @brief  Module API version. */
     typedef enum MODULE_API_VERSION_TAG
     {
-        MODULE_API_VERSION_1
+        MODULE_API_VERSION_1,
+        MODULE_API_VERSION_2
     } MODULE_API_VERSION;
 
     /** @brief  Current gateway module API version */
-    static const MODULE_API_VERSION Module_ApiGatewayVersion = MODULE_API_VERSION_1;
+    static const MODULE_API_VERSION Module_ApiGatewayVersion = MODULE_API_VERSION_2;
 
     /** @brief  Structure returned by ::Module_GetApi containing the API
      *          version. By convention, the module returns a compound structure 
@@ -171,6 +191,41 @@ extern "C"
         pfModule_Start Module_Start;
     } MODULE_API_1;
 
+    /** @brief  The module interface, version 2. It has the same layout as
+     *          #MODULE_API_1 followed by the functions added in version 2, so
+     *          a version 2 module can be used wherever a version 1 module is
+     *          expected.
+     */
+    typedef struct MODULE_API_2_TAG
+    {
+        MODULE_API base;
+
+        /** @brief  Function pointer to the #Module_ParseConfigurationFromJson
+         *          function. */
+        pfModule_ParseConfigurationFromJson Module_ParseConfigurationFromJson;
+
+        /** @brief  Function pointer to the #Module_FreeConfiguration
+         *          function. */
+        pfModule_FreeConfiguration Module_FreeConfiguration;
+
+        /** @brief  Function pointer to the #Module_Create function. */
+        pfModule_Create Module_Create;
+
+        /** @brief  Function pointer to the #Module_Destroy function. */
+        pfModule_Destroy Module_Destroy;
+
+        /** @brief  Function pointer to the #Module_Receive function. */
+        pfModule_Receive Module_Receive;
+
+        /** @brief  Function pointer to the #Module_Start function (optional).
+         */
+        pfModule_Start Module_Start;
+
+        /** @brief  Function pointer to the #Module_ReceiveBatch function
+         *          (optional). */
+        pfModule_ReceiveBatch Module_ReceiveBatch;
+    } MODULE_API_2;
+
     /** @brief  This is the only function exported by a module. Using the
      *          exported function, the caller learns the functions for the 
      *          particular module.
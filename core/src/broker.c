@@ -3,480 +3,1452 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#ifndef WIN32
+#include <time.h>
+#endif
 
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/vector.h"
-#include "azure_c_shared_utility/strings.h"
 #include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
 #include "azure_c_shared_utility/threadapi.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/refcount.h"
 #include "azure_c_shared_utility/singlylinkedlist.h"
-#include "azure_c_shared_utility/uniqueid.h"
-
-#include "nanomsg/nn.h"
-#include "nanomsg/pubsub.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
 
 #include "message.h"
+#include "message_queue.h"
 #include "module.h"
 #include "module_access.h"
 #include "broker.h"
+#include "gateway_atomic.h"
+#include "gateway_trace.h"
+
+/*number of reader counters per phase, publishers are spread over them by source*/
+#define BROKER_READER_STRIPES   16
+#define BROKER_CACHE_LINE_SIZE  64
+
+/*number of threads of the worker pool when the options leave it to the broker*/
+#define BROKER_DEFAULT_WORKER_COUNT 4
+/*messages a pool worker delivers to a module before it lets the other ready modules run*/
+#define BROKER_WORKER_POOL_BATCH    16
+/*most messages handed to Module_ReceiveBatch in one call*/
+#define BROKER_RECEIVE_BATCH        16
+/*most messages Broker_PublishBatch queues in a mailbox under one lock*/
+#define BROKER_PUBLISH_BATCH        16
+/*queued messages whose time and size fit in the module info, the ring moves
+to the heap when more are waiting*/
+#define BROKER_QUEUED_INLINE        16
+/*longest a publisher waits for room in a BROKER_OVERFLOW_BLOCK mailbox during
+one publish. It stays a reader of the routing table meanwhile, so this also
+bounds how long a link or module change waits for it*/
+#define BROKER_BLOCK_TIMEOUT_MS     1000
+/*values below this have a histogram bucket each, every power of two above is
+split in that many buckets*/
+#define BROKER_HISTOGRAM_SUB_BUCKETS 4
+
+#define BROKER_MODULE_STATE_VALUES \
+    BROKER_MODULE_IDLE, \
+    BROKER_MODULE_READY, \
+    BROKER_MODULE_RUNNING
+
+/*where a module of the worker pool is: nowhere, in a ready queue or on a worker*/
+DEFINE_ENUM(BROKER_MODULE_STATE, BROKER_MODULE_STATE_VALUES);
+
+#define BROKER_MATCH_KIND_VALUES \
+    BROKER_MATCH_EXACT, \
+    BROKER_MATCH_PREFIX, \
+    BROKER_MATCH_PRESENT, \
+    BROKER_MATCH_WILDCARD
+
+/*how the pattern of a property match is compared: as a whole, up to its only
+'*' at the end, not at all, or with '*' anywhere*/
+DEFINE_ENUM(BROKER_MATCH_KIND, BROKER_MATCH_KIND_VALUES);
+
+typedef struct BROKER_MODULEINFO_TAG BROKER_MODULEINFO;
+typedef struct BROKER_WORKER_POOL_TAG BROKER_WORKER_POOL;
+
+/*A thread of the worker pool and the modules queued for it*/
+typedef struct BROKER_WORKER_TAG
+{
+    /** The pool the worker belongs to */
+    BROKER_WORKER_POOL*     pool;
+    /** Position of the worker in the pool, its ready queue is searched first */
+    size_t                  index;
+    THREAD_HANDLE           thread;
+    /** Lock guarding the ready queue */
+    LOCK_HANDLE             ready_lock;
+    /** Modules with queued messages waiting for a worker, oldest first */
+    BROKER_MODULEINFO*      ready_head;
+    BROKER_MODULEINFO*      ready_tail;
+}BROKER_WORKER;
+
+/*Fixed set of threads delivering the messages of all the modules. Every module
+is assigned to a worker and queued to it when a message arrives; a worker whose
+queue is empty takes modules from the queues of the other workers.*/
+struct BROKER_WORKER_POOL_TAG
+{
+    size_t                  worker_count;
+    /** The workers, allocated with the pool */
+    BROKER_WORKER*          workers;
+    /** Number of modules in all the ready queues */
+    volatile long           ready_count;
+    /** Number of workers waiting on idle_cond */
+    volatile long           idle_count;
+    /** Set when the workers have to stop */
+    volatile long           quit;
+    /** Lock and condition the workers wait on when there is nothing to do */
+    LOCK_HANDLE             idle_lock;
+    COND_HANDLE             idle_cond;
+    /** Worker the next module added to the broker is assigned to (modules_lock) */
+    size_t                  next_worker;
+};
+
+/*A BROKER_PROPERTY_MATCH compiled when the link is added*/
+typedef struct BROKER_COMPILED_MATCH_TAG
+{
+    const char*             name;
+    const char*             pattern;
+    /** Number of characters of pattern before its first '*' */
+    size_t                  prefix_length;
+    BROKER_MATCH_KIND       kind;
+}BROKER_COMPILED_MATCH;
+
+/*The filter of the link from source to the module owning it. The matches and
+their strings live in the same allocation as the filter.*/
+typedef struct BROKER_FILTER_TAG
+{
+    MODULE_HANDLE               source;
+    struct BROKER_FILTER_TAG*   next;
+    size_t                      match_count;
+    BROKER_COMPILED_MATCH*      matches;
+}BROKER_FILTER;
 
-/* minimum size for a guid string, 36 characters + null terminator */
-#define BROKER_GUID_SIZE 37
-#define INPROC_URL_HEAD "inproc://"
-#define INPROC_URL_HEAD_SIZE 9
-#define URL_SIZE (INPROC_URL_HEAD_SIZE + BROKER_GUID_SIZE +1)
+/*When a message was queued in a mailbox and the size of its content*/
+typedef struct BROKER_QUEUED_MESSAGE_TAG
+{
+    uint64_t                queued_at;
+    size_t                  size;
+}BROKER_QUEUED_MESSAGE;
+
+/*How long the calls of a worker to a module took. They are measured without
+the mailbox lock and recorded once the worker holds it again.*/
+typedef struct BROKER_RECEIVE_TIMES_TAG
+{
+    size_t                  count;
+    uint64_t                durations[BROKER_RECEIVE_BATCH];
+}BROKER_RECEIVE_TIMES;
+
+/*A link of the routing table and the messages that went through it. The
+counters are carried over to the routing table that replaces this one.*/
+typedef struct BROKER_ROUTE_SINK_TAG
+{
+    /** The module receiving the messages */
+    BROKER_MODULEINFO*      module;
+    /** The messages have to match this filter to be delivered, NULL for all */
+    const BROKER_FILTER*    filter;
+    /** Messages queued in the mailbox of module and the size of their content */
+    volatile long           delivered;
+    volatile int64_t        bytes_delivered;
+    /** Messages the overflow policy of module rejected */
+    volatile long           dropped;
+    /** Messages filter kept from module */
+    volatile long           filtered;
+}BROKER_ROUTE_SINK;
+
+/*All the modules linked to one source*/
+typedef struct BROKER_ROUTE_TAG
+{
+    /** The module publishing the messages */
+    MODULE_HANDLE           source;
+    /** The broker's information about source, it counts the messages published */
+    BROKER_MODULEINFO*      source_info;
+    /** Number of entries in sinks */
+    size_t                  sink_count;
+    /** The links to the modules that receive the messages published by source */
+    BROKER_ROUTE_SINK*      sinks;
+}BROKER_ROUTE;
+
+/*Immutable snapshot of the links, read by Broker_Publish without any lock.
+The routes, their index and the sinks live in the same allocation as the
+table.*/
+typedef struct BROKER_ROUTING_TABLE_TAG
+{
+    size_t                  route_count;
+    BROKER_ROUTE*           routes;
+    /** Open addressing index of the routes by source: the number of the
+     *  route plus one, 0 for a free slot. It has index_mask + 1 slots.
+     */
+    size_t                  index_mask;
+    size_t*                 index;
+    /** The modules linked to "*". They are already in the routes of every
+     *  other module, the bucket gives the route of a module added later
+     *  without going through the links of all the modules. Only the module
+     *  and the filter of its sinks are used.
+     */
+    BROKER_ROUTE            any_source;
+}BROKER_ROUTING_TABLE;
+
+/*Number of publishers currently reading a routing table. Every counter sits on
+its own cache line so that publishers running on different cores do not share
+it.*/
+typedef struct BROKER_READER_COUNT_TAG
+{
+    volatile long           count;
+    char                    padding[BROKER_CACHE_LINE_SIZE - sizeof(long)];
+}BROKER_READER_COUNT;
 
 /*The structure backing the message broker handle*/
 typedef struct BROKER_HANDLE_DATA_TAG
 {
     SINGLYLINKEDLIST_HANDLE modules;
     LOCK_HANDLE             modules_lock;
-    int                     publish_socket;
-    STRING_HANDLE           url;
+    /** Current routing table, replaced (never modified) under modules_lock */
+    BROKER_ROUTING_TABLE*   routing_table;
+    /** Selects the row of reader counters new publishers register in */
+    volatile long           reader_phase;
+    BROKER_READER_COUNT     readers[2][BROKER_READER_STRIPES];
+    /** Threads delivering the messages, NULL when every module has its own */
+    BROKER_WORKER_POOL*     worker_pool;
+    /** Number of modules linked to "*" (modules_lock) */
+    size_t                  any_source_count;
 }BROKER_HANDLE_DATA;
 
 DEFINE_REFCOUNT_TYPE(BROKER_HANDLE_DATA);
 
-typedef struct BROKER_MODULEINFO_TAG
+struct BROKER_MODULEINFO_TAG
 {
     /** Handle to the module that's associated with the broker */
-    MODULE*         module;
+    MODULE*                 module;
     /** Handle to the thread on which this module's message processing loop is
-     *  running
+     *  running (thread per module only)
      */
-    THREAD_HANDLE   thread;
-    /** Socket this module will receive messages on */
-    int             receive_socket;
-    /** Lock to prevent nanomsg race condition */
-    LOCK_HANDLE     socket_lock;
-    /** Guid sent to module worker thread to close task */
-    STRING_HANDLE   quit_message_guid;
-
-}BROKER_MODULEINFO;
+    THREAD_HANDLE           thread;
+    /** The worker pool delivering this module's messages, NULL when the
+     *  module has its own thread
+     */
+    BROKER_WORKER_POOL*     worker_pool;
+    /** Index of the pool worker the module is queued to */
+    size_t                  home_worker;
+    /** Whether the module is queued or running in the pool (mailbox_lock) */
+    BROKER_MODULE_STATE     state;
+    /** Next module in the same ready queue */
+    BROKER_MODULEINFO*      next_ready;
+    /** Messages waiting to be delivered to this module. Published messages
+     *  are queued here as cloned handles, they are never serialized.
+     */
+    MESSAGE_QUEUE_HANDLE    mailbox;
+    /** Lock guarding the mailbox and the quit flag */
+    LOCK_HANDLE             mailbox_lock;
+    /** Signalled when a message is queued or when the worker has to quit. With
+     *  a worker pool, signalled when a stopping module leaves its worker.
+     */
+    COND_HANDLE             mailbox_cond;
+    /** Set when the module has to stop receiving messages */
+    bool                    quit_worker;
+    /** Maximum number of messages in the mailbox, 0 when it is unbounded */
+    size_t                  capacity;
+    /** What to do with a message published while the mailbox is full */
+    BROKER_OVERFLOW_POLICY  overflow;
+    /** Property compared by BROKER_OVERFLOW_COALESCE, owned by the broker */
+    char*                   coalesce_key;
+    /** Signalled when a message leaves a full mailbox, only created for
+     *  BROKER_OVERFLOW_BLOCK
+     */
+    COND_HANDLE             space_cond;
+    /** Number of messages in the mailbox (mailbox_lock) */
+    size_t                  depth;
+    /** Number of messages discarded by the overflow policy (mailbox_lock) */
+    size_t                  dropped;
+    /** Number of queued messages replaced by BROKER_OVERFLOW_COALESCE (mailbox_lock) */
+    size_t                  coalesced;
+    /** Time and size of the messages in the mailbox, oldest first at
+     *  queued_head, as many as depth (mailbox_lock). Points to queued_inline
+     *  until more than BROKER_QUEUED_INLINE messages are waiting.
+     */
+    BROKER_QUEUED_MESSAGE*  queued;
+    size_t                  queued_capacity;
+    size_t                  queued_head;
+    BROKER_QUEUED_MESSAGE   queued_inline[BROKER_QUEUED_INLINE];
+    /** Messages handed to the module and the size of their content (mailbox_lock) */
+    size_t                  received;
+    uint64_t                bytes_received;
+    /** Time spent in the module's receive function and time the messages
+     *  waited in the mailbox, in microseconds (mailbox_lock)
+     */
+    BROKER_HISTOGRAM        receive_time;
+    BROKER_HISTOGRAM        queue_wait;
+    /** Messages published by this module on its links and the size of their
+     *  content, counted by the publishing threads without a lock
+     */
+    volatile long           published;
+    volatile int64_t        bytes_published;
+    /** Handles of the modules this module is linked to (MODULE_HANDLEs) */
+    VECTOR_HANDLE           sources;
+    /** Filters of the links to this module that have one, the filter of
+     *  the link from "*" has a NULL source (modules_lock)
+     */
+    BROKER_FILTER*          filters;
+    /** Set when the module receives the messages of every other module (modules_lock) */
+    bool                    any_source;
+};
 
-static STRING_HANDLE construct_url()
+/*microseconds since an arbitrary point, from a clock that never goes back*/
+static uint64_t broker_now_us(void)
 {
-    STRING_HANDLE result;
+#ifdef WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    (void)QueryPerformanceFrequency(&frequency);
+    (void)QueryPerformanceCounter(&counter);
+    return ((uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000u) +
+        (uint64_t)(((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+#else
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000u) + ((uint64_t)now.tv_nsec / 1000u);
+#endif
+}
 
-    /*Codes_SRS_BROKER_17_002: [ Broker_Create shall create a unique id. ]*/
-    char uuid[BROKER_GUID_SIZE];
-    memset(uuid, 0, BROKER_GUID_SIZE);
-    if (UniqueId_Generate(uuid, BROKER_GUID_SIZE) != UNIQUEID_OK)
+static size_t histogram_bucket(uint64_t value)
+{
+    size_t result;
+    if (value < BROKER_HISTOGRAM_SUB_BUCKETS)
     {
-        LogError("Unable to generate unique Id.");
-        result = NULL;
+        result = (size_t)value;
     }
     else
     {
-        /*Codes_SRS_BROKER_17_003: [ Broker_Create shall initialize a url consisting of "inproc://" + unique id. ]*/
-        result = STRING_construct(INPROC_URL_HEAD);
-        if (result == NULL)
+        /* the power of two below value picks the row, the next two bits the bucket in it */
+        size_t magnitude = 2;
+        while ((value >> (magnitude + 1)) != 0)
         {
-            LogError("Unable to construct url.");
+            magnitude++;
         }
-        else
+        result = (BROKER_HISTOGRAM_SUB_BUCKETS * (magnitude - 1)) + (size_t)((value >> (magnitude - 2)) & (BROKER_HISTOGRAM_SUB_BUCKETS - 1));
+        if (result >= BROKER_HISTOGRAM_BUCKETS)
         {
-            if (STRING_concat(result, uuid) != 0)
-            {
-                /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                STRING_delete(result);
-                LogError("Unable to append uuid to url.");
-                result = NULL;
-            }
+            result = BROKER_HISTOGRAM_BUCKETS - 1;
         }
     }
     return result;
 }
 
-BROKER_HANDLE Broker_Create(void)
+/*largest value that falls in bucket*/
+static uint64_t histogram_bucket_limit(size_t bucket)
 {
-    BROKER_HANDLE_DATA* result;
+    uint64_t result;
+    if (bucket < BROKER_HISTOGRAM_SUB_BUCKETS)
+    {
+        result = bucket;
+    }
+    else
+    {
+        size_t magnitude = (bucket / BROKER_HISTOGRAM_SUB_BUCKETS) + 1;
+        uint64_t next = BROKER_HISTOGRAM_SUB_BUCKETS + (bucket % BROKER_HISTOGRAM_SUB_BUCKETS) + 1;
+        result = (next << (magnitude - 2)) - 1;
+    }
+    return result;
+}
 
-    /*Codes_SRS_BROKER_13_067: [Broker_Create shall malloc a new instance of BROKER_HANDLE_DATA and return NULL if it fails.]*/
-    result = REFCOUNT_TYPE_CREATE(BROKER_HANDLE_DATA);
-    if (result == NULL)
+static void histogram_record(BROKER_HISTOGRAM* histogram, uint64_t value)
+{
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max)
+    {
+        histogram->max = value;
+    }
+}
+
+/*makes room for one more entry in the ring of queued messages. The caller
+holds module_info->mailbox_lock. Returns 0 if success, otherwise __LINE__*/
+static int queued_reserve(BROKER_MODULEINFO* module_info)
+{
+    int result;
+
+    if (module_info->depth < module_info->queued_capacity)
     {
-        LogError("malloc returned NULL");
-        /*return as is*/
+        result = 0;
     }
     else
     {
-        /*Codes_SRS_BROKER_13_007: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules with a valid VECTOR_HANDLE.]*/
-        result->modules = singlylinkedlist_create();
-        if (result->modules == NULL)
+        size_t capacity = module_info->queued_capacity * 2;
+        BROKER_QUEUED_MESSAGE* queued = (BROKER_QUEUED_MESSAGE*)malloc(capacity * sizeof(BROKER_QUEUED_MESSAGE));
+        if (queued == NULL)
         {
-            /*Codes_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]*/
-            LogError("VECTOR_create failed");
-            free(result);
-            result = NULL;
+            LogError("unable to grow the queued messages of module [%p] to %lu entries", module_info, (unsigned long)capacity);
+            result = __LINE__;
         }
         else
         {
-            /*Codes_SRS_BROKER_13_023: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules_lock with a valid LOCK_HANDLE.]*/
-            result->modules_lock = Lock_Init();
-            if (result->modules_lock == NULL)
+            size_t i;
+            for (i = 0; i < module_info->depth; i++)
             {
-                /*Codes_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]*/
-                LogError("Lock_Init failed");
-                singlylinkedlist_destroy(result->modules);
-                free(result);
-                result = NULL;
+                queued[i] = module_info->queued[(module_info->queued_head + i) % module_info->queued_capacity];
             }
-            else
+            if (module_info->queued != module_info->queued_inline)
             {
-                /*Codes_SRS_BROKER_17_001: [ Broker_Create shall initialize a socket for publishing messages. ]*/
-                result->publish_socket = nn_socket(AF_SP, NN_PUB);
-                if (result->publish_socket < 0)
-                {
-                    /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                    LogError("nanomsg puclish socket create failedL %d", result->publish_socket);
-                    singlylinkedlist_destroy(result->modules);
-                    Lock_Deinit(result->modules_lock);
-                    free(result);
-                    result = NULL;
-                }
-                else
-                {
-                    result->url = construct_url();
-                    if (result->url == NULL)
-                    {
-                        /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                        singlylinkedlist_destroy(result->modules);
-                        Lock_Deinit(result->modules_lock);
-                        nn_close(result->publish_socket);
-                        free(result);
-                        LogError("Unable to generate unique url.");
-                        result = NULL;
-                    }
-                    else
-                    {
-                        /*Codes_SRS_BROKER_17_004: [ Broker_Create shall bind the socket to the BROKER_HANDLE_DATA::url. ]*/
-                        if (nn_bind(result->publish_socket, STRING_c_str(result->url)) < 0)
-                        {
-                            /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                            LogError("nanomsg bind failed");
-                            singlylinkedlist_destroy(result->modules);
-                            Lock_Deinit(result->modules_lock);
-                            nn_close(result->publish_socket);
-                            STRING_delete(result->url);                
-                            free(result);
-                            result = NULL;
-                        }
-                    }
-                }
+                free(module_info->queued);
             }
+            module_info->queued = queued;
+            module_info->queued_capacity = capacity;
+            module_info->queued_head = 0;
+            result = 0;
         }
     }
 
-    /*Codes_SRS_BROKER_13_001: [This API shall yield a BROKER_HANDLE representing the newly created message broker. This handle value shall not be equal to NULL when the API call is successful.]*/
     return result;
 }
 
-void Broker_IncRef(BROKER_HANDLE broker)
+/*records a message queued at the end of the mailbox. The caller holds
+module_info->mailbox_lock, has reserved the entry and increments the depth
+afterwards.*/
+static void queued_push(BROKER_MODULEINFO* module_info, uint64_t queued_at, size_t size)
 {
-    /*Codes_SRS_BROKER_13_108: [If `broker` is NULL then Broker_IncRef shall do nothing.]*/
-    if (broker == NULL)
+    BROKER_QUEUED_MESSAGE* entry = &(module_info->queued[(module_info->queued_head + module_info->depth) % module_info->queued_capacity]);
+    entry->queued_at = queued_at;
+    entry->size = size;
+}
+
+/*records the message that took the place of the message at index, counted
+from the oldest, of the mailbox. The caller holds module_info->mailbox_lock.*/
+static void queued_replace(BROKER_MODULEINFO* module_info, size_t index, uint64_t queued_at, size_t size)
+{
+    BROKER_QUEUED_MESSAGE* entry = &(module_info->queued[(module_info->queued_head + index) % module_info->queued_capacity]);
+    entry->queued_at = queued_at;
+    entry->size = size;
+}
+
+/*forgets the oldest message of the mailbox. The caller holds
+module_info->mailbox_lock and decrements the depth afterwards.*/
+static BROKER_QUEUED_MESSAGE queued_pop(BROKER_MODULEINFO* module_info)
+{
+    BROKER_QUEUED_MESSAGE result = module_info->queued[module_info->queued_head];
+    module_info->queued_head = (module_info->queued_head + 1) % module_info->queued_capacity;
+    return result;
+}
+
+/*records the durations measured by a worker. The caller holds
+module_info->mailbox_lock.*/
+static void receive_times_record(BROKER_MODULEINFO* module_info, BROKER_RECEIVE_TIMES* times)
+{
+    size_t i;
+    /*Codes_SRS_BROKER_30_082: [ The next time the worker holds module_info->mailbox_lock, it shall record the time every call to the module took in BROKER_MODULEINFO::receive_time. ]*/
+    for (i = 0; i < times->count; i++)
     {
-        LogError("invalid arg: broker is NULL");
+        histogram_record(&(module_info->receive_time), times->durations[i]);
     }
-    else
+    times->count = 0;
+}
+
+/*accounts for a message taken out of the mailbox and lets a publisher waiting
+for room go on. The caller holds module_info->mailbox_lock.*/
+static void mailbox_popped(BROKER_MODULEINFO* module_info)
+{
+    /*Codes_SRS_BROKER_30_051: [ Whenever a message is removed from the mailbox, the worker shall decrement the depth of the mailbox and signal BROKER_MODULEINFO::space_cond if the module blocks its publishers. ]*/
+    module_info->depth--;
+    if (module_info->space_cond != NULL)
     {
-        /*Codes_SRS_BROKER_13_109: [Otherwise, Broker_IncRef shall increment the internal ref count.]*/
-        INC_REF(BROKER_HANDLE_DATA, broker);
+        (void)Condition_Post(module_info->space_cond);
     }
 }
 
-/**
-* This function runs for each module. It receives a pointer to a MODULE_INFO
-* object that describes the module. Its job is to call the Receive function on
-* the associated module whenever it receives a message.
-*/
-static int module_worker(void * user_data)
+/*takes up to max_count messages out of the mailbox, only the first one unless
+the module receives batches. The caller holds module_info->mailbox_lock and has
+checked that the mailbox is not empty. Returns the number of messages taken.*/
+static size_t mailbox_pop(BROKER_MODULEINFO* module_info, MESSAGE_HANDLE* messages, size_t max_count)
 {
-    /*Codes_SRS_BROKER_13_026: [This function shall assign `user_data` to a local variable called `module_info` of type `BROKER_MODULEINFO*`.]*/
-    BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)user_data;
+    bool receives_batches = (MODULE_RECEIVE_BATCH(module_info->module->module_apis) != NULL);
+    uint64_t now = broker_now_us();
+    size_t count = 0;
 
-    int should_continue = 1;
-    while (should_continue)
+    do
     {
-        /*Codes_SRS_BROKER_13_089: [ This function shall acquire the lock on module_info->socket_lock. ]*/
-        if (Lock(module_info->socket_lock))
-        {
-            /*Codes_SRS_BROKER_02_004: [ If acquiring the lock fails, then module_worker shall return. ]*/
-            LogError("unable to Lock");
-            should_continue = 0;
-            break;
-        }
-        int nn_fd = module_info->receive_socket;
-        int nbytes;
-        unsigned char *buf = NULL;
+        BROKER_QUEUED_MESSAGE queued;
+        messages[count] = MESSAGE_QUEUE_pop(module_info->mailbox);
+        GATEWAY_TRACE(GATEWAY_TRACE_DEQUEUE, messages[count], module_info);
+        /*Codes_SRS_BROKER_30_083: [ For every message removed from the mailbox, the worker shall count the message and the size of its content as received and record the time it waited in the mailbox in BROKER_MODULEINFO::queue_wait. ]*/
+        queued = queued_pop(module_info);
+        module_info->received++;
+        module_info->bytes_received += queued.size;
+        histogram_record(&(module_info->queue_wait), (now > queued.queued_at) ? (now - queued.queued_at) : 0);
+        mailbox_popped(module_info);
+        count++;
+    } while (receives_batches && count < max_count && !MESSAGE_QUEUE_is_empty(module_info->mailbox));
 
-        /*Codes_SRS_BROKER_17_005: [ For every iteration of the loop, the function shall wait on the receive_socket for messages. ]*/
-        nbytes = nn_recv(nn_fd, (void *)&buf, NN_MSG, 0);
-        /*Codes_SRS_BROKER_13_091: [ The function shall unlock module_info->socket_lock. ]*/
-        if (Unlock(module_info->socket_lock) != LOCK_OK)
-        {
-            /*Codes_SRS_BROKER_17_016: [ If releasing the lock fails, then module_worker shall return. ]*/
-            should_continue = 0;
-            if (nbytes > 0)
-            {
-                /*Codes_SRS_BROKER_17_019: [ The function shall free the buffer received on the receive_socket. ]*/
-                nn_freemsg(buf);
-            }
-            break;
-        }
+    return count;
+}
+
+/*hands the messages taken out of the mailbox to the module, adds how long every
+call took to times and destroys the messages. The caller does not hold
+module_info->mailbox_lock.*/
+static void module_receive(BROKER_MODULEINFO* module_info, MESSAGE_HANDLE* messages, size_t count, BROKER_RECEIVE_TIMES* times)
+{
+    pfModule_ReceiveBatch receive_batch = MODULE_RECEIVE_BATCH(module_info->module->module_apis);
+    uint64_t start = broker_now_us();
+    size_t i;
 
-        if (nbytes < 0)
+    if (receive_batch != NULL)
+    {
+        GATEWAY_TRACE(GATEWAY_TRACE_RECEIVE_BEGIN, messages[0], module_info);
+        receive_batch(module_info->module->module_handle, messages, count);
+        GATEWAY_TRACE(GATEWAY_TRACE_RECEIVE_END, messages[0], module_info);
+        times->durations[times->count] = broker_now_us() - start;
+        times->count++;
+    }
+    else
+    {
+        for (i = 0; i < count; i++)
         {
-            /*Codes_SRS_BROKER_17_006: [ An error on receiving a message shall terminate the loop. ]*/
-            should_continue = 0;
+            uint64_t end;
+            GATEWAY_TRACE(GATEWAY_TRACE_RECEIVE_BEGIN, messages[i], module_info);
+            MODULE_RECEIVE(module_info->module->module_apis)(module_info->module->module_handle, messages[i]);
+            GATEWAY_TRACE(GATEWAY_TRACE_RECEIVE_END, messages[i], module_info);
+            end = broker_now_us();
+            times->durations[times->count] = end - start;
+            times->count++;
+            start = end;
         }
-        else
-        {
-            if (nbytes == BROKER_GUID_SIZE &&
-                (strncmp(STRING_c_str(module_info->quit_message_guid), (const char *)buf, BROKER_GUID_SIZE-1)==0))
-            {
-                /*Codes_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_message_guid is sent to the thread. ]*/
-                /* received special quit message for this module */
-                should_continue = 0;
-            }
-            else
-            {
-                /*Codes_SRS_BROKER_17_024: [ The function shall strip off the topic from the message. ]*/
-                const unsigned char*buf_bytes = (const unsigned char*)buf;
-                buf_bytes += sizeof(MODULE_HANDLE);
-                /*Codes_SRS_BROKER_17_017: [ The function shall deserialize the message received. ]*/
-                MESSAGE_HANDLE msg = Message_CreateFromByteArray(buf_bytes, nbytes - sizeof(MODULE_HANDLE));
-                /*Codes_SRS_BROKER_17_018: [ If the deserialization is not successful, the message loop shall continue. ]*/
-                if (msg != NULL)
-                {
-                    /*Codes_SRS_BROKER_13_092: [The function shall deliver the message to the module's callback function via module_info->module_apis. ]*/
-                    MODULE_RECEIVE(module_info->module->module_apis)(module_info->module->module_handle, msg);
-                    /*Codes_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]*/
-                    Message_Destroy(msg);
-                }
-            }
-            /*Codes_SRS_BROKER_17_019: [ The function shall free the buffer received on the receive_socket. ]*/
-            nn_freemsg(buf);
-        }    
     }
 
-    return 0;
+    for (i = 0; i < count; i++)
+    {
+        Message_Destroy(messages[i]);
+    }
 }
 
-static BROKER_RESULT init_module(BROKER_MODULEINFO* module_info, const MODULE* module)
+/*queues module_info to its worker and wakes up a worker if they are all
+sleeping. The caller holds module_info->mailbox_lock and has marked the module
+ready. Returns 0 if success, otherwise __LINE__*/
+static int worker_pool_schedule(BROKER_WORKER_POOL* pool, BROKER_MODULEINFO* module_info)
 {
-    BROKER_RESULT result;
+    int result;
+    BROKER_WORKER* worker = &(pool->workers[module_info->home_worker]);
 
-    /*Codes_SRS_BROKER_13_107: The function shall assign the `module` handle to `BROKER_MODULEINFO::module`.*/
-    module_info->module = (MODULE*)malloc(sizeof(MODULE));
-    if (module_info->module == NULL)
+    if (Lock(worker->ready_lock) != LOCK_OK)
     {
-        LogError("Allocate module failed");
-        result = BROKER_ERROR;
+        LogError("unable to lock the ready queue of worker %d", (int)module_info->home_worker);
+        result = __LINE__;
     }
     else
     {
-        module_info->module->module_apis = module->module_apis;
-        module_info->module->module_handle = module->module_handle;
-
-        /*Codes_SRS_BROKER_13_099: [The function shall initialize BROKER_MODULEINFO::socket_lock with a valid lock handle.]*/
-        module_info->socket_lock = Lock_Init();
-        if (module_info->socket_lock == NULL)
+        module_info->next_ready = NULL;
+        if (worker->ready_tail == NULL)
         {
-            /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-            LogError("Lock_Init for socket lock failed");
-            result = BROKER_ERROR;
+            worker->ready_head = module_info;
         }
         else
         {
-            char uuid[BROKER_GUID_SIZE];
-            memset(uuid, 0, BROKER_GUID_SIZE);
-            /*Codes_SRS_BROKER_17_020: [ The function shall create a unique ID used as a quit signal. ]*/
-            if (UniqueId_Generate(uuid, BROKER_GUID_SIZE) != UNIQUEID_OK)
+            worker->ready_tail->next_ready = module_info;
+        }
+        worker->ready_tail = module_info;
+        (void)ATOMIC_INCREMENT(pool->ready_count);
+        (void)Unlock(worker->ready_lock);
+
+        /* a worker announces it is idle before it checks ready_count, so if
+        none is idle here the next one to run out of work sees this module */
+        if (ATOMIC_READ(pool->idle_count) != 0)
+        {
+            if (Lock(pool->idle_lock) != LOCK_OK)
             {
-                /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                LogError("Lock_Init for socket lock failed");
-                Lock_Deinit(module_info->socket_lock);
-                result = BROKER_ERROR;
+                LogError("unable to lock the worker pool, the module waits for a busy worker");
             }
             else
             {
-                module_info->quit_message_guid = STRING_construct(uuid);
-                if (module_info->quit_message_guid == NULL)
-                {
-                    /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                    LogError("String construct failed for module guid");
-                    Lock_Deinit(module_info->socket_lock);
-                    result = BROKER_ERROR;
-                }
-                else
-                {
-                    result = BROKER_OK;
-                }
+                (void)Condition_Post(pool->idle_cond);
+                (void)Unlock(pool->idle_lock);
             }
         }
+        result = 0;
     }
-    return result;
-}
 
-static void deinit_module(BROKER_MODULEINFO* module_info)
-{
-    /*Codes_SRS_BROKER_13_057: [The function shall free all members of the MODULE_INFO object.]*/
-    Lock_Deinit(module_info->socket_lock);
-    STRING_delete(module_info->quit_message_guid);
-    free(module_info->module);
+    return result;
 }
 
-static BROKER_RESULT start_module(BROKER_MODULEINFO* module_info, STRING_HANDLE url)
+/*takes module_info out of its worker's ready queue. The caller holds
+module_info->mailbox_lock. Returns false if a worker has taken it already.*/
+static bool worker_pool_unschedule(BROKER_WORKER_POOL* pool, BROKER_MODULEINFO* module_info)
 {
-    BROKER_RESULT result;
+    bool result = false;
+    BROKER_WORKER* worker = &(pool->workers[module_info->home_worker]);
 
-    /* Connect to pub/sub */
-    /*Codes_SRS_BROKER_17_013: [ The function shall create a nanomsg socket for reception. ]*/
-    module_info->receive_socket = nn_socket(AF_SP, NN_SUB);
-    if (module_info->receive_socket < 0)
+    if (Lock(worker->ready_lock) != LOCK_OK)
     {
-        /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-        LogError("module receive socket create failed");
-        result = BROKER_ERROR;
+        LogError("unable to lock the ready queue of worker %d", (int)module_info->home_worker);
     }
     else
     {
-        /*Codes_SRS_BROKER_17_014: [ The function shall bind the socket to the the BROKER_HANDLE_DATA::url. ]*/
-        int connect_result = nn_connect(module_info->receive_socket, STRING_c_str(url));
-        if (connect_result < 0)
+        BROKER_MODULEINFO* previous = NULL;
+        BROKER_MODULEINFO* current = worker->ready_head;
+        while (current != NULL && current != module_info)
         {
-            /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-            LogError("nn_connect failed");
-            nn_close(module_info->receive_socket);
-            module_info->receive_socket = -1;
-            result = BROKER_ERROR;
+            previous = current;
+            current = current->next_ready;
         }
-        else
+
+        if (current != NULL)
         {
-            /* Codes_SRS_BROKER_17_028: [ The function shall subscribe BROKER_MODULEINFO::receive_socket to the quit signal GUID. ]*/
-            if (nn_setsockopt(
-                module_info->receive_socket, NN_SUB, NN_SUB_SUBSCRIBE, STRING_c_str(module_info->quit_message_guid), STRING_length(module_info->quit_message_guid)) < 0)
+            if (previous == NULL)
             {
-                /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                LogError("nn_setsockopt failed");
-                nn_close(module_info->receive_socket);
-                module_info->receive_socket = -1;
-                result = BROKER_ERROR;
+                worker->ready_head = current->next_ready;
             }
             else
             {
-                /*Codes_SRS_BROKER_13_102: [The function shall create a new thread for the module by calling ThreadAPI_Create using module_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.*/
-                if (ThreadAPI_Create(
-                    &(module_info->thread),
-                    module_worker,
-                    (void*)module_info
-                ) != THREADAPI_OK)
-                {
-                    /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                    LogError("ThreadAPI_Create failed");
-                    nn_close(module_info->receive_socket);
-                    result = BROKER_ERROR;
-                }
-                else
-                {
-                    result = BROKER_OK;
-                }
+                previous->next_ready = current->next_ready;
             }
+            if (worker->ready_tail == current)
+            {
+                worker->ready_tail = previous;
+            }
+            current->next_ready = NULL;
+            (void)ATOMIC_DECREMENT(pool->ready_count);
+            result = true;
         }
+        (void)Unlock(worker->ready_lock);
     }
 
     return result;
 }
 
-/*stop module means: stop the thread that feeds messages to Module_Receive function + deletion of all queued messages */
-/*returns 0 if success, otherwise __LINE__*/
-static int stop_module(int publish_socket, BROKER_MODULEINFO* module_info)
+/*takes the oldest ready module from the queue of worker `first` or, when that
+one is empty, from the queues of the other workers. Returns NULL if no module
+is ready.*/
+static BROKER_MODULEINFO* worker_pool_take(BROKER_WORKER_POOL* pool, size_t first)
 {
-    int  quit_result, close_result, thread_result, result;
+    BROKER_MODULEINFO* result = NULL;
+    size_t i;
 
-    /*Codes_SRS_BROKER_17_021: [ This function shall send a quit signal to the worker thread by sending BROKER_MODULEINFO::quit_message_guid to the publish_socket. ]*/
-    /* send the unique quite id for this module */
-    if ((quit_result = nn_send(publish_socket, STRING_c_str(module_info->quit_message_guid), BROKER_GUID_SIZE, 0)) < 0)
+    for (i = 0; (result == NULL) && (i < pool->worker_count) && (ATOMIC_READ(pool->ready_count) != 0); i++)
     {
-        /*Codes_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]*/
-        /* at the cost of a data race, we will close the socket to terminate the thread */
-        nn_close(module_info->receive_socket);
-        LogError("unable to peacefully close thread for module [%p], nn_send error [%d], taking harsher methods", module_info, quit_result);
-    }
-    else
-    {
-        /*Codes_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::socket_lock. ]*/
-        if (Lock(module_info->socket_lock) != LOCK_OK)
+        BROKER_WORKER* worker = &(pool->workers[(first + i) % pool->worker_count]);
+        if (Lock(worker->ready_lock) != LOCK_OK)
         {
-            /*Codes_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]*/
-            /* at the cost of a data race, we will close the socket to terminate the thread */
-            nn_close(module_info->receive_socket);
-            LogError("unable to peacefully close thread for module [%p], Lock error, taking harsher methods", module_info );
+            LogError("unable to lock the ready queue of worker %d", (int)worker->index);
         }
         else
         {
-            /*Codes_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]*/
-            close_result = nn_close(module_info->receive_socket);
-            if (close_result < 0)
-            {
-                LogError("Receive socket close failed for module at  item [%p] failed", module_info);
-            }
-            else
-            {
-                /*all is fine, thread will eventually stop and be joined*/
-            }
-            /*Codes_SRS_BROKER_02_003: [ After closing the socket, Broker_RemoveModule shall unlock BROKER_MODULEINFO::info_lock. ]*/
-            if (Unlock(module_info->socket_lock) != LOCK_OK)
+            result = worker->ready_head;
+            if (result != NULL)
             {
-                LogError("unable to unlock socket lock");
+                worker->ready_head = result->next_ready;
+                if (worker->ready_head == NULL)
+                {
+                    worker->ready_tail = NULL;
+                }
+                result->next_ready = NULL;
+                (void)ATOMIC_DECREMENT(pool->ready_count);
             }
+            (void)Unlock(worker->ready_lock);
         }
     }
-    /*Codes_SRS_BROKER_13_104: [The function shall wait for the module's thread to exit by joining BROKER_MODULEINFO::thread via ThreadAPI_Join. ]*/
-    if (ThreadAPI_Join(module_info->thread, &thread_result) != THREADAPI_OK)
-    {
-        result = __LINE__;
-        LogError("ThreadAPI_Join() returned an error.");
-    }
-    else
-    {
-        result = 0;
-    }
+
     return result;
 }
 
-BROKER_RESULT Broker_AddModule(BROKER_HANDLE broker, const MODULE* module)
+/**
+* Delivers the messages waiting in the mailbox of a module taken from a ready
+* queue. After BROKER_WORKER_POOL_BATCH messages the module goes back to its
+* ready queue so that a busy module cannot keep a worker to itself. Once the
+* module is marked idle the worker does not touch it anymore.
+*/
+static void worker_pool_run_module(BROKER_MODULEINFO* module_info)
 {
-    BROKER_RESULT result;
+    BROKER_RECEIVE_TIMES times;
+    size_t delivered = 0;
+    int should_continue = 1;
 
-    /*Codes_SRS_BROKER_99_013: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
-    if (broker == NULL || module == NULL)
-    {
-        result = BROKER_INVALIDARG;
-        LogError("invalid parameter (NULL).");
-    }
-    /*Codes_SRS_BROKER_99_014: [If `module_handle` or `module_apis` are `NULL` the function shall return `BROKER_INVALIDARG`.]*/
-    else if (module->module_apis == NULL || module->module_handle == NULL)
-    {
-        result = BROKER_INVALIDARG;
-        LogError("invalid parameter (NULL).");
-    }
-    else
+    times.count = 0;
+
+    while (should_continue)
     {
-        BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)malloc(sizeof(BROKER_MODULEINFO));
-        if (module_info == NULL)
+        MESSAGE_HANDLE msgs[BROKER_RECEIVE_BATCH];
+        size_t msg_count = 0;
+
+        /*Codes_SRS_BROKER_30_038: [ The pool worker shall acquire the lock on module_info->mailbox_lock before every message. ]*/
+        if (Lock(module_info->mailbox_lock) != LOCK_OK)
         {
-            LogError("Allocate module info failed");
-            result = BROKER_ERROR;
+            /* the module stays marked as running, nothing else can be done with it */
+            LogError("unable to lock the mailbox of module [%p]", module_info);
+            break;
         }
-        else
+
+        receive_times_record(module_info, &times);
+
+        if (module_info->quit_worker)
         {
-            if (init_module(module_info, module) != BROKER_OK)
-            {
+            /*Codes_SRS_BROKER_30_039: [ If module_info->quit_worker is set, the pool worker shall mark the module idle and signal module_info->mailbox_cond. ]*/
+            module_info->state = BROKER_MODULE_IDLE;
+            (void)Condition_Post(module_info->mailbox_cond);
+            should_continue = 0;
+        }
+        else if (MESSAGE_QUEUE_is_empty(module_info->mailbox))
+        {
+            /*Codes_SRS_BROKER_30_040: [ If the mailbox is empty, the pool worker shall mark the module idle. ]*/
+            module_info->state = BROKER_MODULE_IDLE;
+            should_continue = 0;
+        }
+        else if (delivered == BROKER_WORKER_POOL_BATCH)
+        {
+            /*Codes_SRS_BROKER_30_041: [ After delivering BROKER_WORKER_POOL_BATCH messages, the pool worker shall queue the module to its worker again. ]*/
+            module_info->state = BROKER_MODULE_READY;
+            if (worker_pool_schedule(module_info->worker_pool, module_info) != 0)
+            {
+                /* the messages are delivered after the next one is published */
+                LogError("unable to queue module [%p] again", module_info);
+                module_info->state = BROKER_MODULE_IDLE;
+            }
+            should_continue = 0;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_30_042: [ Otherwise the pool worker shall mark the module running and remove the oldest message from module_info->mailbox. ]*/
+            module_info->state = BROKER_MODULE_RUNNING;
+            /*Codes_SRS_BROKER_30_071: [ If the module implements Module_ReceiveBatch, the pool worker shall remove up to BROKER_RECEIVE_BATCH messages, without going over BROKER_WORKER_POOL_BATCH messages for the turn. ]*/
+            msg_count = BROKER_WORKER_POOL_BATCH - delivered;
+            msg_count = mailbox_pop(module_info, msgs, (msg_count < BROKER_RECEIVE_BATCH) ? msg_count : BROKER_RECEIVE_BATCH);
+        }
+
+        (void)Unlock(module_info->mailbox_lock);
+
+        if (msg_count != 0)
+        {
+            /*Codes_SRS_BROKER_30_043: [ The pool worker shall deliver the message to the module's callback function without holding module_info->mailbox_lock and destroy it afterwards. ]*/
+            module_receive(module_info, msgs, msg_count, &times);
+            delivered += msg_count;
+        }
+    }
+}
+
+/**
+* This function runs on every thread of the worker pool. It runs the modules
+* queued to its worker, or to the other workers when its own queue is empty,
+* and sleeps when no module is ready.
+*/
+static int worker_pool_worker(void* user_data)
+{
+    BROKER_WORKER* worker = (BROKER_WORKER*)user_data;
+    BROKER_WORKER_POOL* pool = worker->pool;
+
+    int should_continue = 1;
+    while (should_continue)
+    {
+        /*Codes_SRS_BROKER_30_044: [ The pool worker shall take the oldest module from its own ready queue or, if it is empty, from the ready queues of the other workers. ]*/
+        BROKER_MODULEINFO* module_info = worker_pool_take(pool, worker->index);
+        if (module_info != NULL)
+        {
+            worker_pool_run_module(module_info);
+        }
+        /*Codes_SRS_BROKER_30_045: [ The pool worker shall return once no module is ready and the pool is stopping. ]*/
+        else if (ATOMIC_READ(pool->quit) != 0)
+        {
+            should_continue = 0;
+        }
+        else if (Lock(pool->idle_lock) != LOCK_OK)
+        {
+            LogError("unable to lock the worker pool");
+            should_continue = 0;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_30_046: [ When no module is ready, the pool worker shall wait on the pool's idle_cond. ]*/
+            (void)ATOMIC_INCREMENT(pool->idle_count);
+            while (ATOMIC_READ(pool->quit) == 0 && ATOMIC_READ(pool->ready_count) == 0)
+            {
+                if (Condition_Wait(pool->idle_cond, pool->idle_lock, 0) != COND_OK)
+                {
+                    /*Codes_SRS_BROKER_30_047: [ If waiting on the condition fails, the pool worker shall return. ]*/
+                    LogError("unable to wait for ready modules");
+                    should_continue = 0;
+                    break;
+                }
+            }
+            (void)ATOMIC_DECREMENT(pool->idle_count);
+            (void)Unlock(pool->idle_lock);
+        }
+    }
+
+    return 0;
+}
+
+/*tells the workers to stop and waits for the first `thread_count` of them*/
+static void worker_pool_stop(BROKER_WORKER_POOL* pool, size_t thread_count)
+{
+    size_t i;
+
+    (void)ATOMIC_INCREMENT(pool->quit);
+    if (Lock(pool->idle_lock) != LOCK_OK)
+    {
+        /* at the cost of a race with a worker about to wait, wake them up anyway */
+        LogError("unable to lock the worker pool");
+        for (i = 0; i < thread_count; i++)
+        {
+            (void)Condition_Post(pool->idle_cond);
+        }
+    }
+    else
+    {
+        for (i = 0; i < thread_count; i++)
+        {
+            (void)Condition_Post(pool->idle_cond);
+        }
+        (void)Unlock(pool->idle_lock);
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        int thread_result;
+        if (ThreadAPI_Join(pool->workers[i].thread, &thread_result) != THREADAPI_OK)
+        {
+            LogError("unable to join worker %d", (int)i);
+        }
+    }
+}
+
+/*frees the pool and the first `lock_count` ready queue locks*/
+static void worker_pool_free(BROKER_WORKER_POOL* pool, size_t lock_count)
+{
+    size_t i;
+    for (i = 0; i < lock_count; i++)
+    {
+        Lock_Deinit(pool->workers[i].ready_lock);
+    }
+    Condition_Deinit(pool->idle_cond);
+    Lock_Deinit(pool->idle_lock);
+    free(pool);
+}
+
+static BROKER_WORKER_POOL* worker_pool_create(size_t worker_count)
+{
+    /*Codes_SRS_BROKER_30_029: [ Broker_CreateWithOptions shall allocate the worker pool and its workers as a single block. ]*/
+    BROKER_WORKER_POOL* result = (BROKER_WORKER_POOL*)malloc(sizeof(BROKER_WORKER_POOL) + (worker_count * sizeof(BROKER_WORKER)));
+    if (result == NULL)
+    {
+        LogError("unable to allocate a pool of %d workers", (int)worker_count);
+    }
+    else
+    {
+        result->worker_count = worker_count;
+        result->workers = (BROKER_WORKER*)(result + 1);
+        result->ready_count = 0;
+        result->idle_count = 0;
+        result->quit = 0;
+        result->next_worker = 0;
+
+        /*Codes_SRS_BROKER_30_030: [ Broker_CreateWithOptions shall initialize the pool's idle_lock and idle_cond. ]*/
+        result->idle_lock = Lock_Init();
+        if (result->idle_lock == NULL)
+        {
+            LogError("Lock_Init for the worker pool failed");
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            result->idle_cond = Condition_Init();
+            if (result->idle_cond == NULL)
+            {
+                LogError("Condition_Init for the worker pool failed");
+                Lock_Deinit(result->idle_lock);
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                size_t i;
+
+                /* every queue is ready before any worker starts looking at them */
+                /*Codes_SRS_BROKER_30_031: [ Broker_CreateWithOptions shall initialize an empty ready queue and its ready_lock for every worker. ]*/
+                for (i = 0; i < worker_count; i++)
+                {
+                    BROKER_WORKER* worker = &(result->workers[i]);
+                    worker->pool = result;
+                    worker->index = i;
+                    worker->ready_head = NULL;
+                    worker->ready_tail = NULL;
+                    worker->ready_lock = Lock_Init();
+                    if (worker->ready_lock == NULL)
+                    {
+                        LogError("Lock_Init for worker %d failed", (int)i);
+                        break;
+                    }
+                }
+
+                if (i < worker_count)
+                {
+                    worker_pool_free(result, i);
+                    result = NULL;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_032: [ Broker_CreateWithOptions shall start every worker by calling ThreadAPI_Create. ]*/
+                    for (i = 0; i < worker_count; i++)
+                    {
+                        if (ThreadAPI_Create(&(result->workers[i].thread), worker_pool_worker, &(result->workers[i])) != THREADAPI_OK)
+                        {
+                            LogError("ThreadAPI_Create for worker %d failed", (int)i);
+                            break;
+                        }
+                    }
+
+                    if (i < worker_count)
+                    {
+                        /*Codes_SRS_BROKER_30_033: [ If a worker cannot be started, Broker_CreateWithOptions shall stop the workers already started, free the pool and return NULL. ]*/
+                        worker_pool_stop(result, i);
+                        worker_pool_free(result, worker_count);
+                        result = NULL;
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+static void worker_pool_destroy(BROKER_WORKER_POOL* pool)
+{
+    worker_pool_stop(pool, pool->worker_count);
+    worker_pool_free(pool, pool->worker_count);
+}
+
+BROKER_HANDLE Broker_Create(void)
+{
+    /*Codes_SRS_BROKER_30_027: [ Broker_Create shall behave as Broker_CreateWithOptions called with NULL options. ]*/
+    return Broker_CreateWithOptions(NULL);
+}
+
+BROKER_HANDLE Broker_CreateWithOptions(const BROKER_OPTIONS* options)
+{
+    BROKER_HANDLE_DATA* result;
+
+    /*Codes_SRS_BROKER_30_028: [ If options is not NULL and options->scheduler is not a BROKER_SCHEDULER value, Broker_CreateWithOptions shall return NULL. ]*/
+    if ((options != NULL) &&
+        (options->scheduler != BROKER_SCHEDULER_THREAD_PER_MODULE) &&
+        (options->scheduler != BROKER_SCHEDULER_WORKER_POOL))
+    {
+        LogError("invalid arg: unknown scheduler %d", (int)options->scheduler);
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_13_067: [Broker_Create shall malloc a new instance of BROKER_HANDLE_DATA and return NULL if it fails.]*/
+        result = REFCOUNT_TYPE_CREATE(BROKER_HANDLE_DATA);
+        if (result == NULL)
+        {
+            LogError("malloc returned NULL");
+            /*return as is*/
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_13_007: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules with a valid VECTOR_HANDLE.]*/
+            result->modules = singlylinkedlist_create();
+            if (result->modules == NULL)
+            {
+                /*Codes_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]*/
+                LogError("VECTOR_create failed");
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_13_023: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules_lock with a valid LOCK_HANDLE.]*/
+                result->modules_lock = Lock_Init();
+                if (result->modules_lock == NULL)
+                {
+                    /*Codes_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]*/
+                    LogError("Lock_Init failed");
+                    singlylinkedlist_destroy(result->modules);
+                    free(result);
+                    result = NULL;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_014: [ Broker_Create shall initialize BROKER_HANDLE_DATA::routing_table to NULL (no links) and all the reader counters to 0. ]*/
+                    result->routing_table = NULL;
+                    result->any_source_count = 0;
+                    result->reader_phase = 0;
+                    memset((void*)result->readers, 0, sizeof(result->readers));
+
+                    if ((options == NULL) || (options->scheduler == BROKER_SCHEDULER_THREAD_PER_MODULE))
+                    {
+                        /*Codes_SRS_BROKER_30_034: [ Without options or with BROKER_SCHEDULER_THREAD_PER_MODULE, Broker_CreateWithOptions shall set BROKER_HANDLE_DATA::worker_pool to NULL. ]*/
+                        result->worker_pool = NULL;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_BROKER_30_035: [ With BROKER_SCHEDULER_WORKER_POOL, Broker_CreateWithOptions shall create a pool of options->worker_count workers, or BROKER_DEFAULT_WORKER_COUNT workers if options->worker_count is 0. ]*/
+                        result->worker_pool = worker_pool_create((options->worker_count == 0) ? BROKER_DEFAULT_WORKER_COUNT : options->worker_count);
+                        if (result->worker_pool == NULL)
+                        {
+                            /*Codes_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]*/
+                            LogError("unable to create the worker pool");
+                            Lock_Deinit(result->modules_lock);
+                            singlylinkedlist_destroy(result->modules);
+                            free(result);
+                            result = NULL;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /*Codes_SRS_BROKER_13_001: [This API shall yield a BROKER_HANDLE representing the newly created message broker. This handle value shall not be equal to NULL when the API call is successful.]*/
+    return result;
+}
+
+void Broker_IncRef(BROKER_HANDLE broker)
+{
+    /*Codes_SRS_BROKER_13_108: [If `broker` is NULL then Broker_IncRef shall do nothing.]*/
+    if (broker == NULL)
+    {
+        LogError("invalid arg: broker is NULL");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_13_109: [Otherwise, Broker_IncRef shall increment the internal ref count.]*/
+        INC_REF(BROKER_HANDLE_DATA, broker);
+    }
+}
+
+/**
+* This function runs for each module. It receives a pointer to a MODULE_INFO
+* object that describes the module. Its job is to call the Receive function on
+* the associated module whenever a message is queued in its mailbox.
+*/
+static int module_worker(void * user_data)
+{
+    /*Codes_SRS_BROKER_13_026: [This function shall assign `user_data` to a local variable called `module_info` of type `BROKER_MODULEINFO*`.]*/
+    BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)user_data;
+    BROKER_RECEIVE_TIMES times;
+
+    int should_continue = 1;
+    times.count = 0;
+    while (should_continue)
+    {
+        MESSAGE_HANDLE msgs[BROKER_RECEIVE_BATCH];
+        size_t msg_count = 0;
+
+        /*Codes_SRS_BROKER_13_089: [ This function shall acquire the lock on module_info->mailbox_lock. ]*/
+        if (Lock(module_info->mailbox_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_02_004: [ If acquiring the lock fails, then module_worker shall return. ]*/
+            LogError("unable to Lock");
+            should_continue = 0;
+            break;
+        }
+
+        receive_times_record(module_info, &times);
+
+        /*Codes_SRS_BROKER_30_001: [ For every iteration of the loop, the function shall wait on module_info->mailbox_cond until the mailbox is not empty or module_info->quit_worker is set. ]*/
+        while (module_info->quit_worker == false &&
+            MESSAGE_QUEUE_is_empty(module_info->mailbox))
+        {
+            if (Condition_Wait(module_info->mailbox_cond, module_info->mailbox_lock, 0) != COND_OK)
+            {
+                /*Codes_SRS_BROKER_30_002: [ If waiting on the condition fails, the function shall terminate the loop. ]*/
+                LogError("unable to wait on the mailbox of module [%p]", module_info);
+                should_continue = 0;
+                break;
+            }
+        }
+
+        if (module_info->quit_worker)
+        {
+            /*Codes_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_worker is set. ]*/
+            should_continue = 0;
+        }
+        else if (should_continue)
+        {
+            /*Codes_SRS_BROKER_30_003: [ The function shall remove the oldest message from module_info->mailbox. ]*/
+            /*Codes_SRS_BROKER_30_070: [ If the module implements Module_ReceiveBatch, the function shall remove up to BROKER_RECEIVE_BATCH messages from module_info->mailbox, oldest first. ]*/
+            msg_count = mailbox_pop(module_info, msgs, BROKER_RECEIVE_BATCH);
+        }
+
+        /*Codes_SRS_BROKER_13_091: [ The function shall unlock module_info->mailbox_lock. ]*/
+        if (Unlock(module_info->mailbox_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_17_016: [ If releasing the lock fails, then module_worker shall return. ]*/
+            size_t i;
+            should_continue = 0;
+            for (i = 0; i < msg_count; i++)
+            {
+                Message_Destroy(msgs[i]);
+            }
+            break;
+        }
+
+        if (msg_count != 0)
+        {
+            /*Codes_SRS_BROKER_13_092: [The function shall deliver the message to the module's callback function via module_info->module_apis. ]*/
+            /*Codes_SRS_BROKER_30_072: [ If the module implements Module_ReceiveBatch, the function shall deliver all the removed messages with a single call to Module_ReceiveBatch. ]*/
+            /*Codes_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]*/
+            module_receive(module_info, msgs, msg_count, &times);
+        }
+    }
+
+    return 0;
+}
+
+/*applies the mailbox options of a module, returns 0 if success, otherwise __LINE__*/
+static int init_mailbox_limits(BROKER_MODULEINFO* module_info, const BROKER_MAILBOX_OPTIONS* mailbox_options)
+{
+    int result;
+
+    module_info->depth = 0;
+    module_info->dropped = 0;
+    module_info->coalesced = 0;
+    module_info->coalesce_key = NULL;
+    module_info->space_cond = NULL;
+
+    /*Codes_SRS_BROKER_30_084: [ The function shall set all the metrics of the module to 0 and keep the time and size of the first BROKER_QUEUED_INLINE queued messages in BROKER_MODULEINFO itself. ]*/
+    module_info->queued = module_info->queued_inline;
+    module_info->queued_capacity = BROKER_QUEUED_INLINE;
+    module_info->queued_head = 0;
+    module_info->received = 0;
+    module_info->bytes_received = 0;
+    memset(&(module_info->receive_time), 0, sizeof(module_info->receive_time));
+    memset(&(module_info->queue_wait), 0, sizeof(module_info->queue_wait));
+    module_info->published = 0;
+    module_info->bytes_published = 0;
+
+    if (mailbox_options == NULL || mailbox_options->capacity == 0)
+    {
+        /*Codes_SRS_BROKER_30_052: [ If mailbox_options is NULL or its capacity is 0, the module's mailbox shall be unbounded. ]*/
+        module_info->capacity = 0;
+        module_info->overflow = BROKER_OVERFLOW_BLOCK;
+        result = 0;
+    }
+    else
+    {
+        module_info->capacity = mailbox_options->capacity;
+        module_info->overflow = mailbox_options->overflow;
+
+        /*Codes_SRS_BROKER_30_053: [ For BROKER_OVERFLOW_COALESCE, the function shall copy the coalesce_key into BROKER_MODULEINFO::coalesce_key. ]*/
+        if (module_info->overflow == BROKER_OVERFLOW_COALESCE &&
+            mallocAndStrcpy_s(&(module_info->coalesce_key), mailbox_options->coalesce_key) != 0)
+        {
+            LogError("unable to copy the coalesce key");
+            module_info->coalesce_key = NULL;
+            result = __LINE__;
+        }
+        /*Codes_SRS_BROKER_30_054: [ For BROKER_OVERFLOW_BLOCK, the function shall initialize BROKER_MODULEINFO::space_cond with a valid condition handle. ]*/
+        else if (module_info->overflow == BROKER_OVERFLOW_BLOCK &&
+            (module_info->space_cond = Condition_Init()) == NULL)
+        {
+            LogError("Condition_Init for mailbox space failed");
+            result = __LINE__;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+static BROKER_RESULT init_module(BROKER_MODULEINFO* module_info, const MODULE* module, const BROKER_MAILBOX_OPTIONS* mailbox_options)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_13_107: The function shall assign the `module` handle to `BROKER_MODULEINFO::module`.*/
+    module_info->module = (MODULE*)malloc(sizeof(MODULE));
+    if (module_info->module == NULL)
+    {
+        LogError("Allocate module failed");
+        result = BROKER_ERROR;
+    }
+    else
+    {
+        module_info->module->module_apis = module->module_apis;
+        module_info->module->module_handle = module->module_handle;
+        module_info->quit_worker = false;
+        module_info->worker_pool = NULL;
+        module_info->home_worker = 0;
+        module_info->state = BROKER_MODULE_IDLE;
+        module_info->next_ready = NULL;
+        module_info->filters = NULL;
+        module_info->any_source = false;
+
+        /*Codes_SRS_BROKER_13_099: [The function shall initialize BROKER_MODULEINFO::mailbox_lock with a valid lock handle.]*/
+        module_info->mailbox_lock = Lock_Init();
+        if (module_info->mailbox_lock == NULL)
+        {
+            /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+            LogError("Lock_Init for mailbox lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_30_004: [ The function shall initialize BROKER_MODULEINFO::mailbox_cond with a valid condition handle. ]*/
+            module_info->mailbox_cond = Condition_Init();
+            if (module_info->mailbox_cond == NULL)
+            {
+                /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                LogError("Condition_Init for mailbox failed");
+                Lock_Deinit(module_info->mailbox_lock);
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_005: [ The function shall create the module's mailbox by calling MESSAGE_QUEUE_create. ]*/
+                module_info->mailbox = MESSAGE_QUEUE_create();
+                if (module_info->mailbox == NULL)
+                {
+                    /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                    LogError("MESSAGE_QUEUE_create for mailbox failed");
+                    Condition_Deinit(module_info->mailbox_cond);
+                    Lock_Deinit(module_info->mailbox_lock);
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_006: [ The function shall create an empty vector of source module handles the module is linked to. ]*/
+                    module_info->sources = VECTOR_create(sizeof(MODULE_HANDLE));
+                    if (module_info->sources == NULL)
+                    {
+                        /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                        LogError("VECTOR_create for module sources failed");
+                        MESSAGE_QUEUE_destroy(module_info->mailbox);
+                        Condition_Deinit(module_info->mailbox_cond);
+                        Lock_Deinit(module_info->mailbox_lock);
+                        result = BROKER_ERROR;
+                    }
+                    else if (init_mailbox_limits(module_info, mailbox_options) != 0)
+                    {
+                        /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                        VECTOR_destroy(module_info->sources);
+                        MESSAGE_QUEUE_destroy(module_info->mailbox);
+                        Condition_Deinit(module_info->mailbox_cond);
+                        Lock_Deinit(module_info->mailbox_lock);
+                        result = BROKER_ERROR;
+                    }
+                    else
+                    {
+                        result = BROKER_OK;
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+static void deinit_module(BROKER_MODULEINFO* module_info)
+{
+    /*Codes_SRS_BROKER_13_057: [The function shall free all members of the MODULE_INFO object.]*/
+    /*Codes_SRS_BROKER_30_007: [ The function shall destroy all messages still queued in the module's mailbox. ]*/
+    MESSAGE_QUEUE_destroy(module_info->mailbox);
+    Condition_Deinit(module_info->mailbox_cond);
+    Lock_Deinit(module_info->mailbox_lock);
+    VECTOR_destroy(module_info->sources);
+    while (module_info->filters != NULL)
+    {
+        BROKER_FILTER* filter = module_info->filters;
+        module_info->filters = filter->next;
+        free(filter);
+    }
+    free(module_info->coalesce_key);
+    if (module_info->space_cond != NULL)
+    {
+        Condition_Deinit(module_info->space_cond);
+    }
+    if (module_info->queued != module_info->queued_inline)
+    {
+        free(module_info->queued);
+    }
+    free(module_info->module);
+}
+
+/*modules_lock has to be held by the caller*/
+static BROKER_RESULT start_module(BROKER_HANDLE_DATA* broker_data, BROKER_MODULEINFO* module_info)
+{
+    BROKER_RESULT result;
+
+    if (broker_data->worker_pool != NULL)
+    {
+        /*Codes_SRS_BROKER_30_036: [ With a worker pool, the function shall assign the module to the workers of the pool in turn instead of creating a thread. ]*/
+        module_info->worker_pool = broker_data->worker_pool;
+        module_info->home_worker = broker_data->worker_pool->next_worker;
+        broker_data->worker_pool->next_worker = (broker_data->worker_pool->next_worker + 1) % broker_data->worker_pool->worker_count;
+        result = BROKER_OK;
+    }
+    /*Codes_SRS_BROKER_13_102: [The function shall create a new thread for the module by calling ThreadAPI_Create using module_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.*/
+    else if (ThreadAPI_Create(
+        &(module_info->thread),
+        module_worker,
+        (void*)module_info
+    ) != THREADAPI_OK)
+    {
+        /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+        LogError("ThreadAPI_Create failed");
+        result = BROKER_ERROR;
+    }
+    else
+    {
+        result = BROKER_OK;
+    }
+
+    return result;
+}
+
+/*a module of the worker pool is stopped once it is neither in a ready queue nor running on a worker*/
+/*returns 0 if success, otherwise __LINE__*/
+static int stop_pooled_module(BROKER_MODULEINFO* module_info)
+{
+    int result;
+
+    if (Lock(module_info->mailbox_lock) != LOCK_OK)
+    {
+        LogError("unable to lock the mailbox of module [%p]", module_info);
+        result = __LINE__;
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_037: [ With a worker pool, Broker_RemoveModule shall set BROKER_MODULEINFO::quit_worker and take the module out of its worker's ready queue. ]*/
+        module_info->quit_worker = true;
+        if ((module_info->state == BROKER_MODULE_READY) &&
+            worker_pool_unschedule(module_info->worker_pool, module_info))
+        {
+            module_info->state = BROKER_MODULE_IDLE;
+        }
+
+        /*Codes_SRS_BROKER_30_048: [ With a worker pool, Broker_RemoveModule shall wait on BROKER_MODULEINFO::mailbox_cond until no worker runs the module. ]*/
+        result = 0;
+        while (module_info->state != BROKER_MODULE_IDLE)
+        {
+            if (Condition_Wait(module_info->mailbox_cond, module_info->mailbox_lock, 0) != COND_OK)
+            {
+                LogError("unable to wait for module [%p] to leave its worker", module_info);
+                result = __LINE__;
+                break;
+            }
+        }
+        (void)Unlock(module_info->mailbox_lock);
+    }
+
+    return result;
+}
+
+/*stop module means: stop the thread that feeds messages to Module_Receive function + deletion of all queued messages */
+/*returns 0 if success, otherwise __LINE__*/
+static int stop_module(BROKER_MODULEINFO* module_info)
+{
+    int thread_result, result;
+
+    if (module_info->worker_pool != NULL)
+    {
+        result = stop_pooled_module(module_info);
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::mailbox_lock. ]*/
+        if (Lock(module_info->mailbox_lock) != LOCK_OK)
+        {
+            /* at the cost of a data race, we will set the flag to terminate the thread */
+            LogError("unable to peacefully close thread for module [%p], Lock error, taking harsher methods", module_info);
+            module_info->quit_worker = true;
+            (void)Condition_Post(module_info->mailbox_cond);
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_17_021: [ This function shall signal the worker thread to quit by setting BROKER_MODULEINFO::quit_worker and posting BROKER_MODULEINFO::mailbox_cond. ]*/
+            module_info->quit_worker = true;
+            if (Condition_Post(module_info->mailbox_cond) != COND_OK)
+            {
+                LogError("unable to signal the worker thread for module [%p]", module_info);
+            }
+            /*Codes_SRS_BROKER_02_003: [ After signaling the worker thread, Broker_RemoveModule shall unlock BROKER_MODULEINFO::mailbox_lock. ]*/
+            if (Unlock(module_info->mailbox_lock) != LOCK_OK)
+            {
+                LogError("unable to unlock mailbox lock");
+            }
+        }
+        /*Codes_SRS_BROKER_13_104: [The function shall wait for the module's thread to exit by joining BROKER_MODULEINFO::thread via ThreadAPI_Join. ]*/
+        if (ThreadAPI_Join(module_info->thread, &thread_result) != THREADAPI_OK)
+        {
+            result = __LINE__;
+            LogError("ThreadAPI_Join() returned an error.");
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static BROKER_ROUTING_TABLE* routing_table_add_source(const BROKER_ROUTING_TABLE* routing_table, BROKER_MODULEINFO* source);
+static void routing_table_replace(BROKER_HANDLE_DATA* broker_data, BROKER_ROUTING_TABLE* routing_table);
+
+BROKER_RESULT Broker_AddModule(BROKER_HANDLE broker, const MODULE* module)
+{
+    /*Codes_SRS_BROKER_30_055: [ Broker_AddModule shall add the module with an unbounded mailbox, as Broker_AddModuleWithOptions does with NULL mailbox_options. ]*/
+    return Broker_AddModuleWithOptions(broker, module, NULL);
+}
+
+BROKER_RESULT Broker_AddModuleWithOptions(BROKER_HANDLE broker, const MODULE* module, const BROKER_MAILBOX_OPTIONS* mailbox_options)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_99_013: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
+    if (broker == NULL || module == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    /*Codes_SRS_BROKER_99_014: [If `module_handle` or `module_apis` are `NULL` the function shall return `BROKER_INVALIDARG`.]*/
+    else if (module->module_apis == NULL || module->module_handle == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    /*Codes_SRS_BROKER_30_056: [ If mailbox_options has a capacity and an overflow policy that is not a BROKER_OVERFLOW_POLICY value, the function shall return BROKER_INVALIDARG. ]*/
+    else if (mailbox_options != NULL && mailbox_options->capacity != 0 &&
+        mailbox_options->overflow != BROKER_OVERFLOW_BLOCK &&
+        mailbox_options->overflow != BROKER_OVERFLOW_DROP_OLDEST &&
+        mailbox_options->overflow != BROKER_OVERFLOW_DROP_NEWEST &&
+        mailbox_options->overflow != BROKER_OVERFLOW_COALESCE)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid mailbox overflow policy (%d).", (int)mailbox_options->overflow);
+    }
+    /*Codes_SRS_BROKER_30_057: [ If mailbox_options has a capacity, the BROKER_OVERFLOW_COALESCE policy and a NULL coalesce_key, the function shall return BROKER_INVALIDARG. ]*/
+    else if (mailbox_options != NULL && mailbox_options->capacity != 0 &&
+        mailbox_options->overflow == BROKER_OVERFLOW_COALESCE &&
+        mailbox_options->coalesce_key == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("the coalesce overflow policy needs a coalesce_key.");
+    }
+    /*Codes_SRS_BROKER_30_135: [ If the broker has a worker pool and mailbox_options has a capacity and the BROKER_OVERFLOW_BLOCK policy, the function shall return BROKER_INVALIDARG. ]*/
+    else if (mailbox_options != NULL && mailbox_options->capacity != 0 &&
+        mailbox_options->overflow == BROKER_OVERFLOW_BLOCK &&
+        ((BROKER_HANDLE_DATA*)broker)->worker_pool != NULL)
+    {
+        /* a module publishing from a pool worker would park the worker, and
+        with all of them parked nothing drains the mailboxes any more */
+        result = BROKER_INVALIDARG;
+        LogError("a module of a broker with a worker pool cannot block its publishers.");
+    }
+    else
+    {
+        BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)malloc(sizeof(BROKER_MODULEINFO));
+        if (module_info == NULL)
+        {
+            LogError("Allocate module info failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            if (init_module(module_info, module, mailbox_options) != BROKER_OK)
+            {
                 /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
                 LogError("start_module failed");
                 free(module_info->module);
@@ -485,144 +1457,1125 @@ BROKER_RESULT Broker_AddModule(BROKER_HANDLE broker, const MODULE* module)
             }
             else
             {
-                /*Codes_SRS_BROKER_13_039: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
-                BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-                if (Lock(broker_data->modules_lock) != LOCK_OK)
-                {
-                    /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                    LogError("Lock on broker_data->modules_lock failed");
-                    deinit_module(module_info);
-                    free(module_info);
-                    result = BROKER_ERROR;
-                }
-                else
+                /*Codes_SRS_BROKER_13_039: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+                BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+                if (Lock(broker_data->modules_lock) != LOCK_OK)
+                {
+                    /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                    LogError("Lock on broker_data->modules_lock failed");
+                    deinit_module(module_info);
+                    free(module_info);
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_116: [ If modules are linked to "*", Broker_AddModule shall build a routing table with a route from the module to them out of the current routing table. ]*/
+                    /* any_source_count is only set once a routing table exists */
+                    BROKER_ROUTING_TABLE* routing_table = (broker_data->any_source_count == 0) ? NULL : routing_table_add_source(broker_data->routing_table, module_info);
+                    if ((broker_data->any_source_count != 0) && (routing_table == NULL))
+                    {
+                        LogError("unable to route the messages of module [%p] to the modules linked to \"*\"", module_info);
+                        deinit_module(module_info);
+                        free(module_info);
+                        result = BROKER_ERROR;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_BROKER_13_045: [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]*/
+                        LIST_ITEM_HANDLE moduleListItem = singlylinkedlist_add(broker_data->modules, module_info);
+                        if (moduleListItem == NULL)
+                        {
+                            /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                            LogError("singlylinkedlist_add failed");
+                            deinit_module(module_info);
+                            free(module_info);
+                            if (routing_table != NULL)
+                            {
+                                free(routing_table);
+                            }
+                            result = BROKER_ERROR;
+                        }
+                        else
+                        {
+                            if (start_module(broker_data, module_info) != BROKER_OK)
+                            {
+                                LogError("start_module failed");
+                                deinit_module(module_info);
+                                singlylinkedlist_remove(broker_data->modules, moduleListItem);
+                                free(module_info);
+                                if (routing_table != NULL)
+                                {
+                                    free(routing_table);
+                                }
+                                result = BROKER_ERROR;
+                            }
+                            else
+                            {
+                                if (routing_table != NULL)
+                                {
+                                    /*Codes_SRS_BROKER_30_117: [ Broker_AddModule shall replace BROKER_HANDLE_DATA::routing_table with the new routing table once the module is started. ]*/
+                                    routing_table_replace(broker_data, routing_table);
+                                }
+                                /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                                result = BROKER_OK;
+                            }
+                        }
+                    }
+
+                    /*Codes_SRS_BROKER_13_046: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+                    Unlock(broker_data->modules_lock);
+                }
+            }
+
+        }
+    }
+
+    return result;
+}
+
+static bool find_module_predicate(LIST_ITEM_HANDLE list_item, const void* value)
+{
+    BROKER_MODULEINFO* element = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(list_item);
+    return element->module->module_handle == ((MODULE*)value)->module_handle;
+}
+
+static bool find_source_predicate(const void* element, const void* value)
+{
+    return *(MODULE_HANDLE*)element == (MODULE_HANDLE)value;
+}
+
+/*copies filter into a single allocation, splitting every pattern at its first
+'*' so that most of them are compared without scanning for wildcards*/
+static BROKER_FILTER* filter_compile(MODULE_HANDLE source, const BROKER_LINK_FILTER* filter)
+{
+    BROKER_FILTER* result;
+    size_t size = sizeof(BROKER_FILTER) + (filter->match_count * sizeof(BROKER_COMPILED_MATCH));
+    size_t i;
+
+    for (i = 0; i < filter->match_count; i++)
+    {
+        size += strlen(filter->matches[i].name) + strlen(filter->matches[i].pattern) + 2;
+    }
+
+    result = (BROKER_FILTER*)malloc(size);
+    if (result == NULL)
+    {
+        LogError("unable to allocate the filter of a link");
+    }
+    else
+    {
+        char* strings = (char*)((BROKER_COMPILED_MATCH*)(result + 1) + filter->match_count);
+        result->source = source;
+        result->next = NULL;
+        result->match_count = filter->match_count;
+        result->matches = (BROKER_COMPILED_MATCH*)(result + 1);
+        for (i = 0; i < filter->match_count; i++)
+        {
+            BROKER_COMPILED_MATCH* match = &(result->matches[i]);
+            const char* star = strchr(filter->matches[i].pattern, '*');
+            size_t name_length = strlen(filter->matches[i].name) + 1;
+            size_t pattern_length = strlen(filter->matches[i].pattern) + 1;
+
+            match->name = (const char*)memcpy(strings, filter->matches[i].name, name_length);
+            strings += name_length;
+            match->pattern = (const char*)memcpy(strings, filter->matches[i].pattern, pattern_length);
+            strings += pattern_length;
+
+            if (star == NULL)
+            {
+                match->prefix_length = pattern_length - 1;
+                match->kind = BROKER_MATCH_EXACT;
+            }
+            else
+            {
+                match->prefix_length = (size_t)(star - filter->matches[i].pattern);
+                if (star[strspn(star, "*")] != '\0')
+                {
+                    match->kind = BROKER_MATCH_WILDCARD;
+                }
+                else if (match->prefix_length == 0)
+                {
+                    match->kind = BROKER_MATCH_PRESENT;
+                }
+                else
+                {
+                    match->kind = BROKER_MATCH_PREFIX;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+/*matches value against a pattern where '*' stands for any number of
+characters, backtracking to the last '*' only*/
+static bool wildcard_match(const char* pattern, const char* value)
+{
+    bool result = true;
+    const char* star = NULL;
+    const char* resume = NULL;
+
+    while (result && (*value != '\0'))
+    {
+        if (*pattern == '*')
+        {
+            star = pattern++;
+            resume = value;
+        }
+        else if (*pattern == *value)
+        {
+            pattern++;
+            value++;
+        }
+        else if (star != NULL)
+        {
+            pattern = star + 1;
+            value = ++resume;
+        }
+        else
+        {
+            result = false;
+        }
+    }
+
+    if (result)
+    {
+        while (*pattern == '*')
+        {
+            pattern++;
+        }
+        result = (*pattern == '\0');
+    }
+    return result;
+}
+
+static bool filter_match(const BROKER_FILTER* filter, MESSAGE_HANDLE message)
+{
+    bool result = true;
+    size_t i;
+
+    for (i = 0; result && (i < filter->match_count); i++)
+    {
+        const BROKER_COMPILED_MATCH* match = &(filter->matches[i]);
+        const char* value = Message_GetProperty(message, match->name);
+        if (value == NULL)
+        {
+            result = false;
+        }
+        else
+        {
+            switch (match->kind)
+            {
+            case BROKER_MATCH_EXACT:
+                result = (strcmp(value, match->pattern) == 0);
+                break;
+            case BROKER_MATCH_PREFIX:
+                result = (strncmp(value, match->pattern, match->prefix_length) == 0);
+                break;
+            case BROKER_MATCH_PRESENT:
+                break;
+            default:
+                result = (strncmp(value, match->pattern, match->prefix_length) == 0) &&
+                    wildcard_match(match->pattern + match->prefix_length, value + match->prefix_length);
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+/*the filter of the link from source to sink, NULL if the messages of source
+are not filtered. modules_lock has to be held by the caller.*/
+static const BROKER_FILTER* find_route_filter(const BROKER_MODULEINFO* sink, MODULE_HANDLE source)
+{
+    const BROKER_FILTER* result = sink->filters;
+    while ((result != NULL) && (result->source != source))
+    {
+        result = result->next;
+    }
+
+    if (result != NULL)
+    {
+        /*a link added without a filter next to the filtered one lets everything through*/
+        size_t links = 0;
+        size_t source_count = VECTOR_size(sink->sources);
+        size_t i;
+        for (i = 0; i < source_count; i++)
+        {
+            if (*(MODULE_HANDLE*)VECTOR_element(sink->sources, i) == source)
+            {
+                links++;
+            }
+        }
+        if (links > 1)
+        {
+            result = NULL;
+        }
+    }
+
+    return result;
+}
+
+/*number of slots of the index of a routing table with route_count routes, a
+power of two at least twice as large*/
+static size_t routing_index_size(size_t route_count)
+{
+    size_t result = 2;
+    while (result < 2 * route_count)
+    {
+        result *= 2;
+    }
+    return result;
+}
+
+/*slot of the index of routing_table holding the route of source, or the free
+slot where it goes*/
+static size_t routing_table_slot(const BROKER_ROUTING_TABLE* routing_table, MODULE_HANDLE source)
+{
+    /*module handles are usually heap pointers, their low bits tell little apart*/
+    size_t slot = (size_t)((((uint64_t)(size_t)source >> 4) * 0x9E3779B97F4A7C15ULL) >> 32) & routing_table->index_mask;
+    while ((routing_table->index[slot] != 0) &&
+        (routing_table->routes[routing_table->index[slot] - 1].source != source))
+    {
+        slot = (slot + 1) & routing_table->index_mask;
+    }
+    return slot;
+}
+
+/*adds route number `route` of routing_table to its index*/
+static void routing_table_index(BROKER_ROUTING_TABLE* routing_table, size_t route)
+{
+    routing_table->index[routing_table_slot(routing_table, routing_table->routes[route].source)] = route + 1;
+}
+
+/*the route of source in routing_table, NULL if nobody is linked to source*/
+static BROKER_ROUTE* routing_table_find(BROKER_ROUTING_TABLE* routing_table, MODULE_HANDLE source)
+{
+    size_t route = routing_table->index[routing_table_slot(routing_table, source)];
+    return (route == 0) ? NULL : &(routing_table->routes[route - 1]);
+}
+
+static void routing_sink_init(BROKER_ROUTE_SINK* sink, BROKER_MODULEINFO* module, const BROKER_FILTER* filter)
+{
+    sink->module = module;
+    sink->filter = filter;
+    sink->delivered = 0;
+    sink->bytes_delivered = 0;
+    sink->dropped = 0;
+    sink->filtered = 0;
+}
+
+/*builds a routing table out of BROKER_HANDLE_DATA::modules, leaving out the
+module `removed` (NULL when no module is being removed). modules_lock has to be
+held by the caller. Returns NULL if the table cannot be allocated.*/
+static BROKER_ROUTING_TABLE* routing_table_create(BROKER_HANDLE_DATA* broker_data, const BROKER_MODULEINFO* removed)
+{
+    BROKER_ROUTING_TABLE* result;
+    size_t module_count = 0;
+    size_t link_count = 0;
+    size_t any_source_count = 0;
+    size_t index_size;
+    LIST_ITEM_HANDLE sink_item = singlylinkedlist_get_head_item(broker_data->modules);
+
+    /*a route is needed for at most every module and no route has more sinks
+    than there are links, a module linked to "*" is in the route of every module*/
+    while (sink_item != NULL)
+    {
+        BROKER_MODULEINFO* sink = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(sink_item);
+        if (sink != removed)
+        {
+            module_count++;
+            link_count += VECTOR_size(sink->sources);
+            if (sink->any_source)
+            {
+                any_source_count++;
+            }
+        }
+        sink_item = singlylinkedlist_get_next_item(sink_item);
+    }
+    index_size = routing_index_size(module_count);
+
+    /*Codes_SRS_BROKER_30_015: [ The routing table, its routes and their sinks shall be allocated as a single block. ]*/
+    result = (BROKER_ROUTING_TABLE*)malloc(sizeof(BROKER_ROUTING_TABLE) + (module_count * sizeof(BROKER_ROUTE)) + (index_size * sizeof(size_t)) +
+        ((any_source_count + link_count + (any_source_count * module_count)) * sizeof(BROKER_ROUTE_SINK)));
+    if (result == NULL)
+    {
+        LogError("unable to allocate the routing table");
+    }
+    else
+    {
+        BROKER_ROUTE_SINK* next_sink;
+        LIST_ITEM_HANDLE source_item = singlylinkedlist_get_head_item(broker_data->modules);
+
+        result->route_count = 0;
+        result->routes = (BROKER_ROUTE*)(result + 1);
+        result->index_mask = index_size - 1;
+        result->index = (size_t*)(result->routes + module_count);
+        (void)memset(result->index, 0, index_size * sizeof(size_t));
+        result->any_source.source = NULL;
+        result->any_source.source_info = NULL;
+        result->any_source.sink_count = 0;
+        result->any_source.sinks = (BROKER_ROUTE_SINK*)(result->index + index_size);
+        next_sink = result->any_source.sinks + any_source_count;
+        while (source_item != NULL)
+        {
+            BROKER_MODULEINFO* source = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(source_item);
+            if (source != removed)
+            {
+                BROKER_ROUTE* route = &(result->routes[result->route_count]);
+                route->source = source->module->module_handle;
+                route->source_info = source;
+                route->sink_count = 0;
+                route->sinks = next_sink;
+
+                if (source->any_source)
+                {
+                    /*Codes_SRS_BROKER_30_113: [ The routing table shall also keep the modules linked to "*" in a bucket of their own. ]*/
+                    routing_sink_init(&(result->any_source.sinks[result->any_source.sink_count]), source, (source->filters == NULL) ? NULL : find_route_filter(source, NULL));
+                    result->any_source.sink_count++;
+                }
+
+                /*Codes_SRS_BROKER_30_016: [ The route of a source shall hold, once, every module that has the source in its sources. ]*/
+                sink_item = singlylinkedlist_get_head_item(broker_data->modules);
+                while (sink_item != NULL)
+                {
+                    BROKER_MODULEINFO* sink = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(sink_item);
+                    if (sink != removed)
+                    {
+                        bool linked = (VECTOR_find_if(sink->sources, find_source_predicate, route->source) != NULL);
+                        /*Codes_SRS_BROKER_30_114: [ The route of a source shall also hold, once, every other module linked to "*". ]*/
+                        if (linked || (sink->any_source && (sink != source)))
+                        {
+                            const BROKER_FILTER* filter;
+                            if ((sink->filters == NULL) || (linked && sink->any_source))
+                            {
+                                /*a second link between the modules lets everything through*/
+                                filter = NULL;
+                            }
+                            else
+                            {
+                                /*Codes_SRS_BROKER_30_109: [ The sink of a route shall hold the filter of the link from the source, unless the source is linked to the sink more than once. ]*/
+                                filter = find_route_filter(sink, linked ? route->source : NULL);
+                            }
+                            routing_sink_init(&(route->sinks[route->sink_count]), sink, filter);
+                            route->sink_count++;
+                        }
+                    }
+                    sink_item = singlylinkedlist_get_next_item(sink_item);
+                }
+
+                /*a source nobody is linked to gets no route*/
+                if (route->sink_count > 0)
+                {
+                    next_sink += route->sink_count;
+                    routing_table_index(result, result->route_count);
+                    result->route_count++;
+                }
+            }
+            source_item = singlylinkedlist_get_next_item(source_item);
+        }
+    }
+
+    return result;
+}
+
+/*builds a routing table made of the routes of routing_table and of a route
+from `source`, a module that was just added and has no link yet, to every
+module linked to "*". It goes through the routes and the "*" bucket of
+routing_table rather than through the links of every module. modules_lock has
+to be held by the caller. Returns NULL if the table cannot be allocated.*/
+static BROKER_ROUTING_TABLE* routing_table_add_source(const BROKER_ROUTING_TABLE* routing_table, BROKER_MODULEINFO* source)
+{
+    BROKER_ROUTING_TABLE* result;
+    size_t route_count = routing_table->route_count + 1;
+    size_t index_size = routing_index_size(route_count);
+    size_t any_source_count = routing_table->any_source.sink_count;
+    size_t link_count = any_source_count;
+    size_t i;
+
+    for (i = 0; i < routing_table->route_count; i++)
+    {
+        link_count += routing_table->routes[i].sink_count;
+    }
+
+    /*Codes_SRS_BROKER_30_015: [ The routing table, its routes and their sinks shall be allocated as a single block. ]*/
+    result = (BROKER_ROUTING_TABLE*)malloc(sizeof(BROKER_ROUTING_TABLE) + (route_count * sizeof(BROKER_ROUTE)) + (index_size * sizeof(size_t)) +
+        ((any_source_count + link_count) * sizeof(BROKER_ROUTE_SINK)));
+    if (result == NULL)
+    {
+        LogError("unable to allocate the routing table");
+    }
+    else
+    {
+        BROKER_ROUTE_SINK* next_sink;
+        BROKER_ROUTE* route;
+
+        result->route_count = route_count;
+        result->routes = (BROKER_ROUTE*)(result + 1);
+        result->index_mask = index_size - 1;
+        result->index = (size_t*)(result->routes + route_count);
+        (void)memset(result->index, 0, index_size * sizeof(size_t));
+        result->any_source = routing_table->any_source;
+        result->any_source.sinks = (BROKER_ROUTE_SINK*)(result->index + index_size);
+        (void)memcpy(result->any_source.sinks, routing_table->any_source.sinks, any_source_count * sizeof(BROKER_ROUTE_SINK));
+        next_sink = result->any_source.sinks + any_source_count;
+
+        /*the counters start at 0, routing_table_replace carries them over*/
+        for (i = 0; i < routing_table->route_count; i++)
+        {
+            const BROKER_ROUTE* old_route = &(routing_table->routes[i]);
+            size_t j;
+            route = &(result->routes[i]);
+            *route = *old_route;
+            route->sinks = next_sink;
+            for (j = 0; j < old_route->sink_count; j++)
+            {
+                routing_sink_init(&(route->sinks[j]), old_route->sinks[j].module, old_route->sinks[j].filter);
+            }
+            next_sink += route->sink_count;
+            routing_table_index(result, i);
+        }
+
+        /*Codes_SRS_BROKER_30_115: [ The route of a module added to the broker shall be made of the modules in the "*" bucket. ]*/
+        route = &(result->routes[routing_table->route_count]);
+        route->source = source->module->module_handle;
+        route->source_info = source;
+        route->sink_count = any_source_count;
+        route->sinks = next_sink;
+        for (i = 0; i < any_source_count; i++)
+        {
+            routing_sink_init(&(route->sinks[i]), routing_table->any_source.sinks[i].module, routing_table->any_source.sinks[i].filter);
+        }
+        routing_table_index(result, routing_table->route_count);
+    }
+
+    return result;
+}
+
+/*registers the caller as a reader of BROKER_HANDLE_DATA::routing_table, the
+returned phase has to be handed back to routing_table_read_end*/
+static long routing_table_read_begin(BROKER_HANDLE_DATA* broker_data, size_t stripe)
+{
+    long phase = ATOMIC_READ(broker_data->reader_phase) & 1;
+    (void)ATOMIC_INCREMENT(broker_data->readers[phase][stripe].count);
+    return phase;
+}
+
+static void routing_table_read_end(BROKER_HANDLE_DATA* broker_data, long phase, size_t stripe)
+{
+    (void)ATOMIC_DECREMENT(broker_data->readers[phase][stripe].count);
+}
+
+/*waits until no publisher can still be reading a routing table that was
+replaced before the call. modules_lock has to be held by the caller.*/
+static void routing_table_synchronize(BROKER_HANDLE_DATA* broker_data)
+{
+    int flip;
+
+    /*a publisher that read the phase right before it changed registers in the
+    row that was just drained, so the phase is flipped and drained twice*/
+    for (flip = 0; flip < 2; flip++)
+    {
+        long phase = (ATOMIC_INCREMENT(broker_data->reader_phase) - 1) & 1;
+        size_t stripe;
+        for (stripe = 0; stripe < BROKER_READER_STRIPES; stripe++)
+        {
+            while (ATOMIC_READ(broker_data->readers[phase][stripe].count) != 0)
+            {
+                ThreadAPI_Sleep(0);
+            }
+        }
+    }
+}
+
+/*adds the counters of the links of old_routing_table, which no publisher reads
+anymore, to the same links of routing_table, which publishers may be updating*/
+static void routing_table_carry_metrics(BROKER_ROUTING_TABLE* routing_table, const BROKER_ROUTING_TABLE* old_routing_table)
+{
+    size_t i;
+    for (i = 0; i < old_routing_table->route_count; i++)
+    {
+        const BROKER_ROUTE* old_route = &(old_routing_table->routes[i]);
+        BROKER_ROUTE* route = routing_table_find(routing_table, old_route->source);
+        if (route != NULL)
+        {
+            size_t k;
+            for (k = 0; k < old_route->sink_count; k++)
+            {
+                size_t l;
+                for (l = 0; l < route->sink_count; l++)
+                {
+                    if (route->sinks[l].module == old_route->sinks[k].module)
+                    {
+                        (void)ATOMIC_ADD(route->sinks[l].delivered, old_route->sinks[k].delivered);
+                        (void)ATOMIC_ADD64(route->sinks[l].bytes_delivered, old_route->sinks[k].bytes_delivered);
+                        (void)ATOMIC_ADD(route->sinks[l].dropped, old_route->sinks[k].dropped);
+                        (void)ATOMIC_ADD(route->sinks[l].filtered, old_route->sinks[k].filtered);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*publishes `routing_table` and frees the table it replaces once no publisher uses it anymore*/
+static void routing_table_replace(BROKER_HANDLE_DATA* broker_data, BROKER_ROUTING_TABLE* routing_table)
+{
+    /*Codes_SRS_BROKER_30_017: [ The new routing table shall be swapped in atomically. ]*/
+    BROKER_ROUTING_TABLE* old_routing_table = (BROKER_ROUTING_TABLE*)ATOMIC_POINTER_EXCHANGE(broker_data->routing_table, routing_table);
+
+    /*Codes_SRS_BROKER_30_018: [ The previous routing table shall be freed after every Broker_Publish call that could have read it has returned. ]*/
+    routing_table_synchronize(broker_data);
+    if (old_routing_table != NULL)
+    {
+        /*Codes_SRS_BROKER_30_085: [ Before the previous routing table is freed, the counters of its links shall be added to the same links of the new routing table. ]*/
+        routing_table_carry_metrics(routing_table, old_routing_table);
+        free(old_routing_table);
+    }
+}
+
+BROKER_RESULT Broker_RemoveModule(BROKER_HANDLE broker, const MODULE* module)
+{
+    /*Codes_SRS_BROKER_13_048: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
+    BROKER_RESULT result;
+    if (broker == NULL || module == NULL)
+    {
+        /*Codes_SRS_BROKER_13_053: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_13_088: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_13_049: [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]*/
+            LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, module);
+
+            if (module_info_item == NULL)
+            {
+                /*Codes_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]*/
+                LogError("Supplied module is not attached to the broker");
+                /*Codes_SRS_BROKER_13_054: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+                Unlock(broker_data->modules_lock);
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+
+                /*Codes_SRS_BROKER_30_019: [ Broker_RemoveModule shall build a routing table that does not contain the module. ]*/
+                BROKER_ROUTING_TABLE* routing_table = routing_table_create(broker_data, module_info);
+                if (routing_table == NULL)
+                {
+                    /*Codes_SRS_BROKER_30_020: [ If the routing table cannot be built, Broker_RemoveModule shall leave the module attached, unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR. ]*/
+                    LogError("unable to build the routing table without module [%p]", module_info);
+                    Unlock(broker_data->modules_lock);
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_13_052: [The function shall remove the module from BROKER_HANDLE_DATA::modules.]*/
+                    singlylinkedlist_remove(broker_data->modules, module_info_item);
+                    if (module_info->any_source)
+                    {
+                        broker_data->any_source_count--;
+                    }
+
+                    /*Codes_SRS_BROKER_30_021: [ Broker_RemoveModule shall replace BROKER_HANDLE_DATA::routing_table with the new routing table before stopping the module. ]*/
+                    /* once this returns no publisher can queue messages into the module's mailbox */
+                    routing_table_replace(broker_data, routing_table);
+
+                    /*Codes_SRS_BROKER_13_054: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+                    /*Codes_SRS_BROKER_30_008: [ Broker_RemoveModule shall release BROKER_HANDLE_DATA::modules_lock before stopping the module's worker thread. ]*/
+                    /* the worker may be in the middle of a Module_Receive that changes links, so it must be able to take modules_lock */
+                    Unlock(broker_data->modules_lock);
+
+                    if (stop_module(module_info) == 0)
+                    {
+                        deinit_module(module_info);
+                        free(module_info);
+                    }
+                    else
+                    {
+                        /* a worker may still be using the module, it is leaked rather than freed under its feet */
+                        LogError("unable to stop module");
+                    }
+
+                    /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                    result = BROKER_OK;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+BROKER_MODULEINFO* broker_locate_handle(BROKER_HANDLE_DATA* broker_data, MODULE_HANDLE handle)
+{
+    BROKER_MODULEINFO* result;
+    MODULE module;
+    module.module_apis = NULL;
+    module.module_handle = handle;
+
+    LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, &module);
+    if (module_info_item == NULL)
+    {
+        result = NULL;
+    }
+    else
+    {
+        result = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+    }
+    return result;
+}
+
+BROKER_RESULT Broker_GetModuleStats(BROKER_HANDLE broker, MODULE_HANDLE module, BROKER_MODULE_STATS* stats)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_30_066: [ If broker, module or stats are NULL, Broker_GetModuleStats shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || module == NULL || stats == NULL)
+    {
+        LogError("invalid parameter - broker(%p), module(%p), stats(%p).", broker, module, stats);
+        result = BROKER_INVALIDARG;
+    }
+    else
+    {
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*Codes_SRS_BROKER_30_067: [ Broker_GetModuleStats shall lock BROKER_HANDLE_DATA::modules_lock and find the module. ]*/
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, module);
+            if (module_info == NULL)
+            {
+                /*Codes_SRS_BROKER_30_068: [ If the module is not attached to the broker, Broker_GetModuleStats shall return BROKER_ERROR. ]*/
+                LogError("module [%p] is not attached to the broker", module);
+                result = BROKER_ERROR;
+            }
+            else if (Lock(module_info->mailbox_lock) != LOCK_OK)
+            {
+                LogError("unable to lock the mailbox of module [%p]", module_info);
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_069: [ Broker_GetModuleStats shall copy the depth, the dropped count and the coalesced count of the module's mailbox into stats under BROKER_MODULEINFO::mailbox_lock and return BROKER_OK. ]*/
+                stats->depth = module_info->depth;
+                stats->dropped = module_info->dropped;
+                stats->coalesced = module_info->coalesced;
+                (void)Unlock(module_info->mailbox_lock);
+                result = BROKER_OK;
+            }
+            (void)Unlock(broker_data->modules_lock);
+        }
+    }
+
+    return result;
+}
+
+BROKER_RESULT Broker_GetModuleMailbox(BROKER_HANDLE broker, MODULE_HANDLE module, BROKER_MAILBOX_OPTIONS* options)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_30_137: [ If broker, module or options are NULL, Broker_GetModuleMailbox shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || module == NULL || options == NULL)
+    {
+        LogError("invalid parameter - broker(%p), module(%p), options(%p).", broker, module, options);
+        result = BROKER_INVALIDARG;
+    }
+    else
+    {
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*Codes_SRS_BROKER_30_138: [ Broker_GetModuleMailbox shall lock BROKER_HANDLE_DATA::modules_lock and find the module. ]*/
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, module);
+            if (module_info == NULL)
+            {
+                /*Codes_SRS_BROKER_30_139: [ If the module is not attached to the broker, Broker_GetModuleMailbox shall return BROKER_ERROR. ]*/
+                LogError("module [%p] is not attached to the broker", module);
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_140: [ Broker_GetModuleMailbox shall copy the capacity, the overflow policy and the coalesce key of the module's mailbox into options and return BROKER_OK. ]*/
+                options->capacity = module_info->capacity;
+                options->overflow = module_info->overflow;
+                options->coalesce_key = module_info->coalesce_key;
+                result = BROKER_OK;
+            }
+            (void)Unlock(broker_data->modules_lock);
+        }
+    }
+
+    return result;
+}
+
+BROKER_RESULT Broker_GetModuleMetrics(BROKER_HANDLE broker, MODULE_HANDLE module, BROKER_MODULE_METRICS* metrics)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_30_092: [ If broker, module or metrics are NULL, Broker_GetModuleMetrics shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || module == NULL || metrics == NULL)
+    {
+        LogError("invalid parameter - broker(%p), module(%p), metrics(%p).", broker, module, metrics);
+        result = BROKER_INVALIDARG;
+    }
+    else
+    {
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*Codes_SRS_BROKER_30_093: [ Broker_GetModuleMetrics shall lock BROKER_HANDLE_DATA::modules_lock and find the module. ]*/
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, module);
+            if (module_info == NULL)
+            {
+                /*Codes_SRS_BROKER_30_094: [ If the module is not attached to the broker, Broker_GetModuleMetrics shall return BROKER_ERROR. ]*/
+                LogError("module [%p] is not attached to the broker", module);
+                result = BROKER_ERROR;
+            }
+            else if (Lock(module_info->mailbox_lock) != LOCK_OK)
+            {
+                LogError("unable to lock the mailbox of module [%p]", module_info);
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_095: [ Broker_GetModuleMetrics shall copy the counters and the histograms of the module's mailbox into metrics under BROKER_MODULEINFO::mailbox_lock. ]*/
+                metrics->received = module_info->received;
+                metrics->bytes_received = module_info->bytes_received;
+                metrics->depth = module_info->depth;
+                metrics->dropped = module_info->dropped;
+                metrics->coalesced = module_info->coalesced;
+                metrics->receive_time = module_info->receive_time;
+                metrics->queue_wait = module_info->queue_wait;
+                (void)Unlock(module_info->mailbox_lock);
+
+                /*Codes_SRS_BROKER_30_096: [ Broker_GetModuleMetrics shall read the publish counters of the module atomically and return BROKER_OK. ]*/
+                metrics->published = (size_t)ATOMIC_READ(module_info->published);
+                metrics->bytes_published = (uint64_t)ATOMIC_READ64(module_info->bytes_published);
+                result = BROKER_OK;
+            }
+            (void)Unlock(broker_data->modules_lock);
+        }
+    }
+
+    return result;
+}
+
+BROKER_RESULT Broker_GetLinkMetrics(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, BROKER_LINK_METRICS* metrics)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_30_097: [ If broker, link, link->module_source_handle, link->module_sink_handle or metrics are NULL, Broker_GetLinkMetrics shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || link == NULL || link->module_source_handle == NULL || link->module_sink_handle == NULL || metrics == NULL)
+    {
+        LogError("invalid parameter - broker(%p), link(%p), metrics(%p).", broker, link, metrics);
+        result = BROKER_INVALIDARG;
+    }
+    else
+    {
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*Codes_SRS_BROKER_30_098: [ Broker_GetLinkMetrics shall lock BROKER_HANDLE_DATA::modules_lock so that the routing table is not replaced while it is read. ]*/
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            BROKER_ROUTING_TABLE* routing_table = broker_data->routing_table;
+            BROKER_ROUTE* route = (routing_table == NULL) ? NULL : routing_table_find(routing_table, link->module_source_handle);
+            BROKER_ROUTE_SINK* found = NULL;
+
+            /*Codes_SRS_BROKER_30_099: [ Broker_GetLinkMetrics shall look for the sink in the route of the source. ]*/
+            if (route != NULL)
+            {
+                size_t j;
+                for (j = 0; j < route->sink_count; j++)
                 {
-                    /*Codes_SRS_BROKER_13_045: [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]*/
-                    LIST_ITEM_HANDLE moduleListItem = singlylinkedlist_add(broker_data->modules, module_info);
-                    if (moduleListItem == NULL)
-                    {
-                        /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                        LogError("singlylinkedlist_add failed");
-                        deinit_module(module_info);
-                        free(module_info);
-                        result = BROKER_ERROR;
-                    }
-                    else
+                    if (route->sinks[j].module->module->module_handle == link->module_sink_handle)
                     {
-                        if (start_module(module_info, broker_data->url) != BROKER_OK)
-                        {
-                            LogError("start_module failed");
-                            deinit_module(module_info);
-                            singlylinkedlist_remove(broker_data->modules, moduleListItem);
-                            free(module_info);
-                            result = BROKER_ERROR;
-                        }
-                        else
-                        {
-                            /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                            result = BROKER_OK;
-                        }
+                        found = &(route->sinks[j]);
+                        break;
                     }
-
-                    /*Codes_SRS_BROKER_13_046: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
-                    Unlock(broker_data->modules_lock);
                 }
             }
 
+            if (found == NULL)
+            {
+                /*Codes_SRS_BROKER_30_100: [ If the link does not exist, Broker_GetLinkMetrics shall return BROKER_ERROR. ]*/
+                LogError("the link does not exist in the broker");
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_101: [ Broker_GetLinkMetrics shall read the counters of the link atomically into metrics and return BROKER_OK. ]*/
+                metrics->delivered = (size_t)ATOMIC_READ(found->delivered);
+                metrics->bytes_delivered = (uint64_t)ATOMIC_READ64(found->bytes_delivered);
+                metrics->dropped = (size_t)ATOMIC_READ(found->dropped);
+                metrics->filtered = (size_t)ATOMIC_READ(found->filtered);
+                result = BROKER_OK;
+            }
+            (void)Unlock(broker_data->modules_lock);
         }
     }
 
     return result;
 }
 
-static bool find_module_predicate(LIST_ITEM_HANDLE list_item, const void* value)
+uint64_t Broker_HistogramPercentile(const BROKER_HISTOGRAM* histogram, double percentile)
 {
-    BROKER_MODULEINFO* element = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(list_item);
-    return element->module->module_handle == ((MODULE*)value)->module_handle;
+    uint64_t result;
+
+    /*Codes_SRS_BROKER_30_102: [ If histogram is NULL or empty, Broker_HistogramPercentile shall return 0. ]*/
+    if (histogram == NULL || histogram->count == 0)
+    {
+        result = 0;
+    }
+    else
+    {
+        double wanted = (percentile / 100.0) * (double)histogram->count;
+        size_t rank;
+        size_t seen = 0;
+        size_t i;
+
+        if (wanted < 1.0)
+        {
+            rank = 1;
+        }
+        else if (wanted >= (double)histogram->count)
+        {
+            rank = histogram->count;
+        }
+        else
+        {
+            rank = (size_t)wanted;
+            if ((double)rank < wanted)
+            {
+                rank++;
+            }
+        }
+
+        /*Codes_SRS_BROKER_30_103: [ Broker_HistogramPercentile shall return the largest value of the bucket holding the value of the given rank, or the largest value recorded if it is smaller. ]*/
+        for (i = 0; i < BROKER_HISTOGRAM_BUCKETS - 1; i++)
+        {
+            seen += histogram->buckets[i];
+            if (seen >= rank)
+            {
+                break;
+            }
+        }
+        result = histogram_bucket_limit(i);
+        if ((i == BROKER_HISTOGRAM_BUCKETS - 1) || (result > histogram->max))
+        {
+            result = histogram->max;
+        }
+    }
+
+    return result;
 }
 
-BROKER_RESULT Broker_RemoveModule(BROKER_HANDLE broker, const MODULE* module)
+/*adds the link to the broker, with a filter unless filter is NULL*/
+static BROKER_RESULT add_link(BROKER_HANDLE_DATA* broker_data, const BROKER_LINK_DATA* link, const BROKER_LINK_FILTER* filter)
 {
-    /*Codes_SRS_BROKER_13_048: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
     BROKER_RESULT result;
-    if (broker == NULL || module == NULL)
+    /*Codes_SRS_BROKER_17_030: [ Broker_AddLink shall lock the modules_lock. ]*/
+    if (Lock(broker_data->modules_lock) != LOCK_OK)
     {
-        /*Codes_SRS_BROKER_13_053: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-        result = BROKER_INVALIDARG;
-        LogError("invalid parameter (NULL).");
+        /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+        LogError("Broker_AddLink, Lock on broker_data->modules_lock failed");
+        result = BROKER_ADD_LINK_ERROR;
     }
     else
     {
-        /*Codes_SRS_BROKER_13_088: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
-        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        /*Codes_SRS_BROKER_17_031: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->sink. ]*/
+        BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
+
+        if (module_info == NULL)
         {
-            /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-            LogError("Lock on broker_data->modules_lock failed");
-            result = BROKER_ERROR;
+            /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+            LogError("Link->sink is not attached to the broker");
+            result = BROKER_ADD_LINK_ERROR;
         }
         else
         {
-            /*Codes_SRS_BROKER_13_049: [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]*/
-            LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, module);
+            /*Codes_SRS_BROKER_17_041: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_source_handle. ]*/
+            BROKER_MODULEINFO* source_module = broker_locate_handle(broker_data, link->module_source_handle);
+            BROKER_FILTER* compiled = NULL;
 
-            if (module_info_item == NULL)
+            if (source_module == NULL)
             {
-                /*Codes_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]*/
-                LogError("Supplied module is not attached to the broker");
-                result = BROKER_ERROR;
+                LogError("Link->source is not attached to the broker");
+                result = BROKER_ADD_LINK_ERROR;
+            }
+            else if ((source_module == module_info) &&
+                (module_info->capacity != 0) &&
+                (module_info->overflow == BROKER_OVERFLOW_BLOCK))
+            {
+                /*Codes_SRS_BROKER_30_134: [ If the source is the sink and its mailbox is bounded with BROKER_OVERFLOW_BLOCK, Broker_AddLink shall return BROKER_INVALIDARG. ]*/
+                /* the module would wait on its own worker for room */
+                LogError("a module that blocks its publishers cannot be linked to itself");
+                result = BROKER_INVALIDARG;
+            }
+            else if ((filter != NULL) &&
+                (VECTOR_find_if(module_info->sources, find_source_predicate, link->module_source_handle) != NULL))
+            {
+                /*Codes_SRS_BROKER_30_106: [ If the sink is already linked to the source, Broker_AddLinkWithFilter shall return BROKER_ADD_LINK_ERROR. ]*/
+                LogError("a source and a sink can only have one filtered link");
+                result = BROKER_ADD_LINK_ERROR;
+            }
+            /*Codes_SRS_BROKER_30_107: [ Broker_AddLinkWithFilter shall copy filter into a single allocation and compile its patterns. ]*/
+            else if ((filter != NULL) &&
+                ((compiled = filter_compile(link->module_source_handle, filter)) == NULL))
+            {
+                result = BROKER_ADD_LINK_ERROR;
+            }
+            /*Codes_SRS_BROKER_17_032: [ Broker_AddLink shall add link->module_source_handle to the sources of module_info. ]*/
+            else if (VECTOR_push_back(module_info->sources, &(link->module_source_handle), 1) != 0)
+            {
+                /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+                LogError("Unable to make link in Broker");
+                free(compiled);
+                result = BROKER_ADD_LINK_ERROR;
             }
             else
             {
-                BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
-                if (stop_module(broker_data->publish_socket, module_info) == 0)
+                BROKER_ROUTING_TABLE* routing_table;
+                if (compiled != NULL)
                 {
-                    deinit_module(module_info);
+                    /*Codes_SRS_BROKER_30_108: [ Broker_AddLinkWithFilter shall add the compiled filter to the filters of module_info before building the routing table. ]*/
+                    compiled->next = module_info->filters;
+                    module_info->filters = compiled;
+                }
+
+                /*Codes_SRS_BROKER_30_022: [ Broker_AddLink shall build a new routing table and replace BROKER_HANDLE_DATA::routing_table with it. ]*/
+                routing_table = routing_table_create(broker_data, NULL);
+                if (routing_table == NULL)
+                {
+                    /*Codes_SRS_BROKER_30_023: [ If the routing table cannot be built, Broker_AddLink shall remove link->module_source_handle from the sources of module_info again. ]*/
+                    LogError("Unable to build the routing table");
+                    VECTOR_erase(module_info->sources, VECTOR_back(module_info->sources), 1);
+                    if (compiled != NULL)
+                    {
+                        module_info->filters = compiled->next;
+                        free(compiled);
+                    }
+                    result = BROKER_ADD_LINK_ERROR;
                 }
                 else
                 {
-                    LogError("unable to stop module");
+                    routing_table_replace(broker_data, routing_table);
+                    result = BROKER_OK;
                 }
+            }
+        }
+        /*Codes_SRS_BROKER_17_033: [ Broker_AddLink shall unlock the modules_lock. ]*/
+        Unlock(broker_data->modules_lock);
+    }
+    return result;
+}
 
-                /*Codes_SRS_BROKER_13_052: [The function shall remove the module from BROKER_HANDLE_DATA::modules.]*/
-                singlylinkedlist_remove(broker_data->modules, module_info_item);
-                free(module_info);
+BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_17_029: [ If broker or link are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL)
+    {
+        LogError("Broker_AddLink, input is NULL.");
+        result = BROKER_INVALIDARG;
+    }
+    else
+    {
+        result = add_link((BROKER_HANDLE_DATA*)broker, link, NULL);
+    }
+    return result;
+}
 
-                /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                result = BROKER_OK;
-            }
+/*false if filter has a NULL matches, name or pattern*/
+static bool link_filter_is_valid(const BROKER_LINK_FILTER* filter)
+{
+    size_t i = 0;
 
-            /*Codes_SRS_BROKER_13_054: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
-            Unlock(broker_data->modules_lock);
+    if (filter != NULL)
+    {
+        while ((filter->matches != NULL) && (i < filter->match_count) &&
+            (filter->matches[i].name != NULL) && (filter->matches[i].pattern != NULL))
+        {
+            i++;
         }
     }
 
-    return result;
+    return (filter == NULL) || (i == filter->match_count);
 }
 
-BROKER_MODULEINFO* broker_locate_handle(BROKER_HANDLE_DATA* broker_data, MODULE_HANDLE handle)
+/*removes the filter of the link from source (NULL for "*") from the filters
+of module_info and destroys it. modules_lock has to be held by the caller.*/
+static void filter_remove(BROKER_MODULEINFO* module_info, MODULE_HANDLE source)
 {
-    BROKER_MODULEINFO* result;
-    MODULE module;
-    module.module_apis = NULL;
-    module.module_handle = handle;
+    BROKER_FILTER** filter = &(module_info->filters);
+    while ((*filter != NULL) && ((*filter)->source != source))
+    {
+        filter = &((*filter)->next);
+    }
+    if (*filter != NULL)
+    {
+        BROKER_FILTER* removed = *filter;
+        *filter = removed->next;
+        free(removed);
+    }
+}
 
-    LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, &module);
-    if (module_info_item == NULL)
+BROKER_RESULT Broker_AddLinkWithFilter(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, const BROKER_LINK_FILTER* filter)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_30_104: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, or filter has a NULL matches, name or pattern, Broker_AddLinkWithFilter shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL ||
+        !link_filter_is_valid(filter))
     {
-        result = NULL;
+        LogError("invalid parameter - broker(%p), link(%p), filter(%p).", broker, link, filter);
+        result = BROKER_INVALIDARG;
     }
     else
     {
-        result = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+        /*Codes_SRS_BROKER_30_105: [ If filter is NULL or has no match, Broker_AddLinkWithFilter shall add the link as Broker_AddLink does. ]*/
+        result = add_link((BROKER_HANDLE_DATA*)broker, link, ((filter == NULL) || (filter->match_count == 0)) ? NULL : filter);
     }
     return result;
 }
 
-BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
+BROKER_RESULT Broker_RemoveLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
 {
     BROKER_RESULT result;
-    /*Codes_SRS_BROKER_17_029: [ If broker or link are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]*/
+    /*Codes_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]*/
     if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL)
     {
         LogError("Broker_AddLink, input is NULL.");
@@ -631,113 +2584,215 @@ BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
     else
     {
         BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-        /*Codes_SRS_BROKER_17_030: [ Broker_AddLink shall lock the modules_lock. ]*/
+        /*Codes_SRS_BROKER_17_036: [ Broker_RemoveLink shall lock the modules_lock. ]*/
         if (Lock(broker_data->modules_lock) != LOCK_OK)
         {
-            /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+            /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
             LogError("Broker_AddLink, Lock on broker_data->modules_lock failed");
-            result = BROKER_ADD_LINK_ERROR;
+            result = BROKER_REMOVE_LINK_ERROR;
         }
         else
         {
-            /*Codes_SRS_BROKER_17_031: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->sink. ]*/
+            /*Codes_SRS_BROKER_17_037: [ Broker_RemoveLink shall find the module_info for link->module_sink_handle. ]*/
             BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
 
             if (module_info == NULL)
             {
-                /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+                /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
                 LogError("Link->sink is not attached to the broker");
-                result = BROKER_ADD_LINK_ERROR;
+                result = BROKER_REMOVE_LINK_ERROR;
             }
             else
             {
-                /*Codes_SRS_BROKER_17_041: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_source_handle. ]*/
-                BROKER_MODULEINFO* source_module = broker_locate_handle(broker_data, link->module_source_handle);
-
-                if (source_module == NULL)
+                /*Codes_SRS_BROKER_17_042: [ Broker_RemoveLink shall find the module_info for link->module_source_handle. ]*/
+                BROKER_MODULEINFO* source_module_info = broker_locate_handle(broker_data, link->module_source_handle);
+                if (source_module_info == NULL)
                 {
                     LogError("Link->source is not attached to the broker");
-                    result = BROKER_ADD_LINK_ERROR;
+                    result = BROKER_REMOVE_LINK_ERROR;
                 }
                 else
                 {
-                    /*Codes_SRS_BROKER_17_032: [ Broker_AddLink shall subscribe module_info->receive_socket to the link->source module handle. ]*/
-                    if (nn_setsockopt(
-                        module_info->receive_socket, NN_SUB, NN_SUB_SUBSCRIBE, &(link->module_source_handle), sizeof(MODULE_HANDLE)) < 0)
+                    /*Codes_SRS_BROKER_17_038: [ Broker_RemoveLink shall remove link->module_source_handle from the sources of module_info. ]*/
+                    MODULE_HANDLE* source = (MODULE_HANDLE*)VECTOR_find_if(module_info->sources, find_source_predicate, link->module_source_handle);
+                    if (source == NULL)
                     {
-                        /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
-                        LogError("Unable to make link in Broker");
-                        result = BROKER_ADD_LINK_ERROR;
+                        /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
+                        LogError("Link does not exist in Broker");
+                        result = BROKER_REMOVE_LINK_ERROR;
                     }
                     else
                     {
-                        result = BROKER_OK;
+                        BROKER_ROUTING_TABLE* routing_table;
+                        VECTOR_erase(module_info->sources, source, 1);
+
+                        /*Codes_SRS_BROKER_30_024: [ Broker_RemoveLink shall build a new routing table and replace BROKER_HANDLE_DATA::routing_table with it. ]*/
+                        routing_table = routing_table_create(broker_data, NULL);
+                        if (routing_table == NULL)
+                        {
+                            /*Codes_SRS_BROKER_30_025: [ If the routing table cannot be built, Broker_RemoveLink shall add link->module_source_handle back to the sources of module_info. ]*/
+                            LogError("Unable to build the routing table");
+                            if (VECTOR_push_back(module_info->sources, &(link->module_source_handle), 1) != 0)
+                            {
+                                LogError("Unable to restore the link, the broker keeps routing messages on it until the next change");
+                            }
+                            result = BROKER_REMOVE_LINK_ERROR;
+                        }
+                        else
+                        {
+                            routing_table_replace(broker_data, routing_table);
+                            if ((module_info->filters != NULL) &&
+                                (VECTOR_find_if(module_info->sources, find_source_predicate, link->module_source_handle) == NULL))
+                            {
+                                /*Codes_SRS_BROKER_30_110: [ Once the routing table is replaced, Broker_RemoveLink shall destroy the filter of the link if the sink is no longer linked to the source. ]*/
+                                filter_remove(module_info, link->module_source_handle);
+                            }
+                            result = BROKER_OK;
+                        }
+                    }
+                }
+            }
+            /*Codes_SRS_BROKER_17_039: [ Broker_RemoveLink shall unlock the modules_lock. ]*/
+            Unlock(broker_data->modules_lock);
+        }
+    }
+    return result;
+}
+
+BROKER_RESULT Broker_AddAnySourceLink(BROKER_HANDLE broker, MODULE_HANDLE sink, const BROKER_LINK_FILTER* filter)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_30_118: [ If broker or sink are NULL, or filter has a NULL matches, name or pattern, Broker_AddAnySourceLink shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || sink == NULL || !link_filter_is_valid(filter))
+    {
+        LogError("invalid parameter - broker(%p), sink(%p), filter(%p).", broker, sink, filter);
+        result = BROKER_INVALIDARG;
+    }
+    else
+    {
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*Codes_SRS_BROKER_30_119: [ Broker_AddAnySourceLink shall lock the modules_lock. ]*/
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ADD_LINK_ERROR;
+        }
+        else
+        {
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, sink);
+            BROKER_FILTER* compiled = NULL;
+
+            if (module_info == NULL)
+            {
+                /*Codes_SRS_BROKER_30_120: [ If sink is not attached to the broker or is already linked to "*", Broker_AddAnySourceLink shall return BROKER_ADD_LINK_ERROR. ]*/
+                LogError("sink is not attached to the broker");
+                result = BROKER_ADD_LINK_ERROR;
+            }
+            else if (module_info->any_source)
+            {
+                LogError("sink is already linked to \"*\"");
+                result = BROKER_ADD_LINK_ERROR;
+            }
+            /*Codes_SRS_BROKER_30_121: [ If filter has matches, Broker_AddAnySourceLink shall compile it and add it to the filters of the sink. ]*/
+            else if ((filter != NULL) && (filter->match_count > 0) &&
+                ((compiled = filter_compile(NULL, filter)) == NULL))
+            {
+                result = BROKER_ADD_LINK_ERROR;
+            }
+            else
+            {
+                BROKER_ROUTING_TABLE* routing_table;
+                if (compiled != NULL)
+                {
+                    compiled->next = module_info->filters;
+                    module_info->filters = compiled;
+                }
+                module_info->any_source = true;
+
+                /*Codes_SRS_BROKER_30_122: [ Broker_AddAnySourceLink shall build a new routing table and replace BROKER_HANDLE_DATA::routing_table with it. ]*/
+                routing_table = routing_table_create(broker_data, NULL);
+                if (routing_table == NULL)
+                {
+                    /*Codes_SRS_BROKER_30_123: [ If the routing table cannot be built, Broker_AddAnySourceLink shall leave the sink as it was and return BROKER_ADD_LINK_ERROR. ]*/
+                    LogError("Unable to build the routing table");
+                    module_info->any_source = false;
+                    if (compiled != NULL)
+                    {
+                        module_info->filters = compiled->next;
+                        free(compiled);
                     }
+                    result = BROKER_ADD_LINK_ERROR;
+                }
+                else
+                {
+                    broker_data->any_source_count++;
+                    routing_table_replace(broker_data, routing_table);
+                    result = BROKER_OK;
                 }
             }
-            /*Codes_SRS_BROKER_17_033: [ Broker_AddLink shall unlock the modules_lock. ]*/
+            /*Codes_SRS_BROKER_30_124: [ Broker_AddAnySourceLink shall unlock the modules_lock. ]*/
             Unlock(broker_data->modules_lock);
         }
     }
     return result;
 }
 
-BROKER_RESULT Broker_RemoveLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
+BROKER_RESULT Broker_RemoveAnySourceLink(BROKER_HANDLE broker, MODULE_HANDLE sink)
 {
     BROKER_RESULT result;
-    /*Codes_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]*/
-    if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL)
+
+    /*Codes_SRS_BROKER_30_125: [ If broker or sink are NULL, Broker_RemoveAnySourceLink shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || sink == NULL)
     {
-        LogError("Broker_AddLink, input is NULL.");
+        LogError("invalid parameter - broker(%p), sink(%p).", broker, sink);
         result = BROKER_INVALIDARG;
     }
     else
     {
         BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-        /*Codes_SRS_BROKER_17_036: [ Broker_RemoveLink shall lock the modules_lock. ]*/
+        /*Codes_SRS_BROKER_30_126: [ Broker_RemoveAnySourceLink shall lock the modules_lock. ]*/
         if (Lock(broker_data->modules_lock) != LOCK_OK)
         {
-            /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
-            LogError("Broker_AddLink, Lock on broker_data->modules_lock failed");
+            LogError("Lock on broker_data->modules_lock failed");
             result = BROKER_REMOVE_LINK_ERROR;
         }
         else
         {
-            /*Codes_SRS_BROKER_17_037: [ Broker_RemoveLink shall find the module_info for link->module_sink_handle. ]*/
-            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
-
-            if (module_info == NULL)
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, sink);
+            if ((module_info == NULL) || !module_info->any_source)
             {
-                /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
-                LogError("Link->sink is not attached to the broker");
+                /*Codes_SRS_BROKER_30_127: [ If sink is not attached to the broker or not linked to "*", Broker_RemoveAnySourceLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
+                LogError("sink is not linked to \"*\"");
                 result = BROKER_REMOVE_LINK_ERROR;
             }
             else
             {
-                /*Codes_SRS_BROKER_17_042: [ Broker_RemoveLink shall find the module_info for link->module_source_handle. ]*/
-                BROKER_MODULEINFO* source_module_info = broker_locate_handle(broker_data, link->module_source_handle);
-                if (source_module_info == NULL)
+                BROKER_ROUTING_TABLE* routing_table;
+                module_info->any_source = false;
+
+                /*Codes_SRS_BROKER_30_128: [ Broker_RemoveAnySourceLink shall build a new routing table and replace BROKER_HANDLE_DATA::routing_table with it. ]*/
+                routing_table = routing_table_create(broker_data, NULL);
+                if (routing_table == NULL)
                 {
-                    LogError("Link->source is not attached to the broker");
+                    /*Codes_SRS_BROKER_30_129: [ If the routing table cannot be built, Broker_RemoveAnySourceLink shall leave the sink linked to "*" and return BROKER_REMOVE_LINK_ERROR. ]*/
+                    LogError("Unable to build the routing table");
+                    module_info->any_source = true;
                     result = BROKER_REMOVE_LINK_ERROR;
                 }
                 else
                 {
-                    /*Codes_SRS_BROKER_17_038: [ Broker_RemoveLink shall unsubscribe module_info->receive_socket from the link->module_source_handle module handle. ]*/
-                    if (nn_setsockopt(
-                        module_info->receive_socket, NN_SUB, NN_SUB_UNSUBSCRIBE, &(link->module_source_handle), sizeof(MODULE_HANDLE)) < 0)
-                    {
-                        /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
-                        LogError("Unable to make link in Broker");
-                        result = BROKER_REMOVE_LINK_ERROR;
-                    }
-                    else
+                    broker_data->any_source_count--;
+                    routing_table_replace(broker_data, routing_table);
+                    /*Codes_SRS_BROKER_30_130: [ Once the routing table is replaced, Broker_RemoveAnySourceLink shall destroy the filter of the link. ]*/
+                    if (module_info->filters != NULL)
                     {
-                        result = BROKER_OK;
+                        filter_remove(module_info, NULL);
                     }
+                    result = BROKER_OK;
                 }
             }
-            /*Codes_SRS_BROKER_17_039: [ Broker_RemoveLink shall unlock the modules_lock. ]*/
+            /*Codes_SRS_BROKER_30_131: [ Broker_RemoveAnySourceLink shall unlock the modules_lock. ]*/
             Unlock(broker_data->modules_lock);
         }
     }
@@ -758,11 +2813,18 @@ static void broker_decrement_ref(BROKER_HANDLE broker)
             {
                 LogError("WARNING: There are still active modules attached to the broker and the broker is being destroyed.");
             }
-            /* May want to do nn_shutdown first for cleanliness. */
-            nn_close(broker_data->publish_socket);
-            STRING_delete(broker_data->url);
+            /*Codes_SRS_BROKER_30_050: [ If the broker has a worker pool, the workers shall be stopped and the pool freed. ]*/
+            if (broker_data->worker_pool != NULL)
+            {
+                worker_pool_destroy(broker_data->worker_pool);
+            }
             singlylinkedlist_destroy(broker_data->modules);
             Lock_Deinit(broker_data->modules_lock);
+            /*Codes_SRS_BROKER_30_026: [ The current routing table shall be freed. ]*/
+            if (broker_data->routing_table != NULL)
+            {
+                free(broker_data->routing_table);
+            }
             free(broker_data);
         }
     }
@@ -783,84 +2845,485 @@ extern void Broker_DecRef(BROKER_HANDLE broker)
     broker_decrement_ref(broker);
 }
 
-BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE message)
+/*what BROKER_OVERFLOW_COALESCE looks for in a full mailbox*/
+typedef struct BROKER_COALESCE_MATCH_TAG
+{
+    const char* key;
+    const char* value;
+    /** Number of queued messages compared so far */
+    size_t* compared;
+}BROKER_COALESCE_MATCH;
+
+static bool coalesce_match(MESSAGE_HANDLE message, const void* match_context)
+{
+    const BROKER_COALESCE_MATCH* match = (const BROKER_COALESCE_MATCH*)match_context;
+    const char* value;
+    (*(match->compared))++;
+    value = Message_GetProperty(message, match->key);
+    return (value != NULL) && (strcmp(value, match->value) == 0);
+}
+
+/*lets the worker of module_info know there are messages in its mailbox. The
+caller holds module_info->mailbox_lock.*/
+static void wake_module(BROKER_MODULEINFO* module_info)
+{
+    if (module_info->worker_pool != NULL)
+    {
+        /*Codes_SRS_BROKER_30_049: [ With a worker pool, Broker_Publish shall mark the sink ready and queue it to its worker if the sink is idle. ]*/
+        if (module_info->state == BROKER_MODULE_IDLE)
+        {
+            module_info->state = BROKER_MODULE_READY;
+            if (worker_pool_schedule(module_info->worker_pool, module_info) != 0)
+            {
+                /* the message is queued, it is delivered after the next one is published */
+                LogError("unable to schedule module [%p]", module_info);
+                module_info->state = BROKER_MODULE_IDLE;
+            }
+        }
+    }
+    /*Codes_SRS_BROKER_30_012: [ Broker_Publish shall signal the sink's mailbox_cond. ]*/
+    else if (Condition_Post(module_info->mailbox_cond) != COND_OK)
+    {
+        /* the message is queued, the worker will pick it up on its next wakeup */
+        LogError("unable to signal module [%p]", module_info);
+    }
+}
+
+/*makes room for msg in the full mailbox of module_info according to its
+overflow policy. The caller holds module_info->mailbox_lock. now and size are
+the time msg is queued and the size of its content. *block_deadline
+is when the publish stops waiting for room, set by the first wait of the
+publish. Returns BROKER_OK when msg has to be queued or, if *queued is set,
+when the policy has put it in the mailbox already; otherwise msg has been
+disposed of.*/
+static BROKER_RESULT make_room(BROKER_MODULEINFO* module_info, MESSAGE_HANDLE msg, uint64_t now, size_t size, bool* queued, uint64_t* block_deadline)
 {
     BROKER_RESULT result;
-    /*Codes_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]*/
-    if (broker == NULL || source == NULL || message == NULL)
+
+    *queued = false;
+
+    switch (module_info->overflow)
     {
-        result = BROKER_INVALIDARG;
-        LogError("Broker handle, source, and/or message handle is NULL");
+        case BROKER_OVERFLOW_BLOCK:
+        {
+            /*Codes_SRS_BROKER_30_058: [ If the sink's mailbox is full and its policy is BROKER_OVERFLOW_BLOCK, Broker_Publish shall wait on BROKER_MODULEINFO::space_cond until the mailbox has room or the sink stops. ]*/
+            bool timed_out = false;
+            result = BROKER_OK;
+            if (*block_deadline == 0)
+            {
+                *block_deadline = broker_now_us() + (uint64_t)BROKER_BLOCK_TIMEOUT_MS * 1000;
+            }
+            /* the messages of the same batch queued so far have not been signalled yet */
+            wake_module(module_info);
+            while (module_info->quit_worker == false &&
+                module_info->depth >= module_info->capacity)
+            {
+                /*Codes_SRS_BROKER_30_132: [ Broker_Publish shall wait for room at most BROKER_BLOCK_TIMEOUT_MS milliseconds in all, whatever the number of messages and sinks. ]*/
+                uint64_t now = broker_now_us();
+                COND_RESULT wait_result;
+                if (now >= *block_deadline)
+                {
+                    timed_out = true;
+                    break;
+                }
+
+                /* a timeout of 0 would wait forever */
+                wait_result = Condition_Wait(module_info->space_cond, module_info->mailbox_lock, (int)((*block_deadline - now + 999) / 1000));
+                if (wait_result == COND_TIMEOUT)
+                {
+                    timed_out = true;
+                    break;
+                }
+                else if (wait_result != COND_OK)
+                {
+                    LogError("unable to wait for room in the mailbox of module [%p]", module_info);
+                    Message_Destroy(msg);
+                    result = BROKER_ERROR;
+                    break;
+                }
+            }
+            if (result == BROKER_OK && (module_info->quit_worker || timed_out))
+            {
+                /*Codes_SRS_BROKER_30_059: [ If the sink stops while Broker_Publish waits, Broker_Publish shall discard the message and return BROKER_MESSAGE_DROPPED. ]*/
+                /*Codes_SRS_BROKER_30_133: [ If the mailbox still has no room once the wait times out, Broker_Publish shall discard the message, count it as dropped and return BROKER_MESSAGE_DROPPED. ]*/
+                if (timed_out)
+                {
+                    LogError("no room in the mailbox of module [%p] after %d ms, the message is dropped", module_info, BROKER_BLOCK_TIMEOUT_MS);
+                }
+                Message_Destroy(msg);
+                module_info->dropped++;
+                result = BROKER_MESSAGE_DROPPED;
+            }
+            break;
+        }
+        case BROKER_OVERFLOW_DROP_OLDEST:
+        {
+            /*Codes_SRS_BROKER_30_060: [ If the sink's mailbox is full and its policy is BROKER_OVERFLOW_DROP_OLDEST, Broker_Publish shall remove and destroy the oldest message of the mailbox. ]*/
+            MESSAGE_HANDLE oldest = MESSAGE_QUEUE_pop(module_info->mailbox);
+            if (oldest != NULL)
+            {
+                Message_Destroy(oldest);
+                (void)queued_pop(module_info);
+                module_info->depth--;
+            }
+            module_info->dropped++;
+            result = BROKER_OK;
+            break;
+        }
+        case BROKER_OVERFLOW_COALESCE:
+        {
+            /*Codes_SRS_BROKER_30_061: [ If the sink's mailbox is full and its policy is BROKER_OVERFLOW_COALESCE, Broker_Publish shall replace the oldest queued message that has the same value for the coalesce_key property as the message by calling MESSAGE_QUEUE_replace_if, and destroy the replaced message. ]*/
+            BROKER_COALESCE_MATCH match;
+            MESSAGE_HANDLE replaced = NULL;
+            size_t compared = 0;
+            match.compared = &compared;
+            match.key = module_info->coalesce_key;
+            match.value = Message_GetProperty(msg, module_info->coalesce_key);
+            if (match.value != NULL)
+            {
+                replaced = MESSAGE_QUEUE_replace_if(module_info->mailbox, coalesce_match, &match, msg);
+            }
+
+            if (replaced != NULL)
+            {
+                /*Codes_SRS_BROKER_30_136: [ Broker_Publish shall count the replaced message as coalesced, not dropped, and record the time the message was queued and the size of its content in the place of the replaced message. ]*/
+                /* msg took the place of the replaced message, the mailbox does not grow */
+                queued_replace(module_info, compared - 1, now, size);
+                module_info->coalesced++;
+                Message_Destroy(replaced);
+                *queued = true;
+                result = BROKER_OK;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_062: [ If no queued message matches, Broker_Publish shall destroy the message and return BROKER_MESSAGE_DROPPED. ]*/
+                Message_Destroy(msg);
+                module_info->dropped++;
+                result = BROKER_MESSAGE_DROPPED;
+            }
+            break;
+        }
+        default:
+        {
+            /*Codes_SRS_BROKER_30_063: [ If the sink's mailbox is full and its policy is BROKER_OVERFLOW_DROP_NEWEST, Broker_Publish shall destroy the message and return BROKER_MESSAGE_DROPPED. ]*/
+            Message_Destroy(msg);
+            module_info->dropped++;
+            result = BROKER_MESSAGE_DROPPED;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/*queues msg, whose content is size bytes long, in the mailbox of module_info,
+or lets the overflow policy dispose of it. The caller holds
+module_info->mailbox_lock. *pushed tells whether msg was added to the mailbox
+and the worker has to be woken up.*/
+static BROKER_RESULT queue_message(BROKER_MODULEINFO* module_info, MESSAGE_HANDLE msg, size_t size, uint64_t now, bool* pushed, uint64_t* block_deadline)
+{
+    BROKER_RESULT result;
+    bool queued = false;
+
+    *pushed = false;
+    if (module_info->capacity != 0 && module_info->depth >= module_info->capacity)
+    {
+        result = make_room(module_info, msg, now, size, &queued, block_deadline);
+        if (module_info->overflow == BROKER_OVERFLOW_BLOCK)
+        {
+            /* the wait for room does not count as time in the mailbox */
+            now = broker_now_us();
+        }
     }
     else
     {
-        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-        /*Codes_SRS_BROKER_17_022: [ Broker_Publish shall Lock the modules lock. ]*/
-        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        result = BROKER_OK;
+    }
+
+    if (result != BROKER_OK || queued)
+    {
+        /* the overflow policy has disposed of the message or queued it itself */
+    }
+    /*Codes_SRS_BROKER_30_086: [ Broker_Publish shall make room for the time and the size of the message in the queued messages of the sink, allocating a ring twice as large when it is full. ]*/
+    else if (queued_reserve(module_info) != 0)
+    {
+        /*Codes_SRS_BROKER_30_087: [ If the ring cannot be allocated, Broker_Publish shall destroy the cloned message. ]*/
+        LogError("unable to queue message [%p] for module [%p]", msg, module_info);
+        Message_Destroy(msg);
+        result = BROKER_ERROR;
+    }
+    /*Codes_SRS_BROKER_30_011: [ Broker_Publish shall push the cloned message into the sink's mailbox. ]*/
+    else if (MESSAGE_QUEUE_push(module_info->mailbox, msg) != 0)
+    {
+        /*Codes_SRS_BROKER_17_012: [ Broker_Publish shall destroy the cloned message if it cannot be queued. ]*/
+        LogError("unable to queue message [%p] for module [%p]", msg, module_info);
+        Message_Destroy(msg);
+        result = BROKER_ERROR;
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_088: [ Broker_Publish shall record the time the message was queued and the size of its content. ]*/
+        queued_push(module_info, now, size);
+        GATEWAY_TRACE(GATEWAY_TRACE_ENQUEUE, msg, module_info);
+        /*Codes_SRS_BROKER_30_064: [ Broker_Publish shall increment the depth of the sink's mailbox for every message it queues. ]*/
+        module_info->depth++;
+        *pushed = true;
+    }
+
+    return result;
+}
+
+/*folds the result of one delivery into the result of a publish: an error wins
+over a drop, which wins over success*/
+static BROKER_RESULT merge_result(BROKER_RESULT result, BROKER_RESULT delivery_result)
+{
+    if (delivery_result == BROKER_ERROR)
+    {
+        result = BROKER_ERROR;
+    }
+    /*Codes_SRS_BROKER_30_065: [ If no sink failed and the overflow policy of a sink rejected the message, Broker_Publish shall return BROKER_MESSAGE_DROPPED. ]*/
+    else if (delivery_result == BROKER_MESSAGE_DROPPED && result == BROKER_OK)
+    {
+        result = BROKER_MESSAGE_DROPPED;
+    }
+    return result;
+}
+
+/*queues clones of up to BROKER_PUBLISH_BATCH messages, whose content is
+sizes bytes long, in the mailbox of the sink of link under one lock and wakes
+up its worker once*/
+static BROKER_RESULT deliver_to_module(BROKER_ROUTE_SINK* link, MESSAGE_HANDLE* messages, const size_t* sizes, size_t count, uint64_t* block_deadline)
+{
+    BROKER_RESULT result = BROKER_OK;
+    BROKER_MODULEINFO* module_info = link->module;
+    MESSAGE_HANDLE clones[BROKER_PUBLISH_BATCH];
+    size_t clone_sizes[BROKER_PUBLISH_BATCH];
+    size_t clone_count = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        /*Codes_SRS_BROKER_17_007: [ Broker_Publish shall clone the message for each linked sink. ]*/
+        /* messages are immutable, the sink shares the publisher's message */
+        clones[clone_count] = Message_Clone(messages[i]);
+        if (clones[clone_count] == NULL)
         {
-            /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-            LogError("Lock on broker_data->modules_lock failed");
+            /*Codes_SRS_BROKER_13_037: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+            LogError("unable to clone message [%p]", messages[i]);
             result = BROKER_ERROR;
         }
         else
         {
-            int32_t msg_size;
-            int32_t buf_size;
-            /*Codes_SRS_BROKER_17_007: [ Broker_Publish shall clone the message. ]*/
-            MESSAGE_HANDLE msg = Message_Clone(message);
-            /*Codes_SRS_BROKER_17_008: [ Broker_Publish shall serialize the message. ]*/
-            msg_size = Message_ToByteArray(message, NULL, 0);
-            if (msg_size < 0)
+            clone_sizes[clone_count] = sizes[i];
+            clone_count++;
+        }
+    }
+
+    if (clone_count == 0)
+    {
+        /* nothing left to deliver */
+    }
+    /*Codes_SRS_BROKER_30_010: [ Broker_Publish shall lock the sink's mailbox_lock. ]*/
+    else if (Lock(module_info->mailbox_lock) != LOCK_OK)
+    {
+        /*Codes_SRS_BROKER_13_037: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+        LogError("unable to lock mailbox of module [%p]", module_info);
+        for (i = 0; i < clone_count; i++)
+        {
+            Message_Destroy(clones[i]);
+        }
+        result = BROKER_ERROR;
+    }
+    else
+    {
+        bool wake = false;
+        long delivered = 0;
+        long dropped = 0;
+        int64_t bytes_delivered = 0;
+        uint64_t now = broker_now_us();
+        for (i = 0; i < clone_count; i++)
+        {
+            bool pushed;
+            BROKER_RESULT queue_result = queue_message(module_info, clones[i], clone_sizes[i], now, &pushed, block_deadline);
+            if (queue_result == BROKER_OK)
             {
-                /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                LogError("unable to serialize a message [%p]", msg);
-                Message_Destroy(msg);
-                result = BROKER_ERROR;
+                delivered++;
+                bytes_delivered += clone_sizes[i];
             }
-            else
+            else if (queue_result == BROKER_MESSAGE_DROPPED)
             {
-                /*Codes_SRS_BROKER_17_025: [ Broker_Publish shall allocate a nanomsg buffer the size of the serialized message + sizeof(MODULE_HANDLE). ]*/
-                buf_size = msg_size + sizeof(MODULE_HANDLE);
-                void* nn_msg = nn_allocmsg(buf_size, 0);
-                if (nn_msg == NULL)
-                {
-                    /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                    LogError("unable to serialize a message [%p]", msg);
-                    result = BROKER_ERROR;
-                }
-                else
-                {
-                    /*Codes_SRS_BROKER_17_026: [ Broker_Publish shall copy source into the beginning of the nanomsg buffer. ]*/
-                    unsigned char *nn_msg_bytes = (unsigned char *)nn_msg;
-                    memcpy(nn_msg_bytes, &source, sizeof(MODULE_HANDLE));
-                    /*Codes_SRS_BROKER_17_027: [ Broker_Publish shall serialize the message into the remainder of the nanomsg buffer. ]*/
-                    nn_msg_bytes += sizeof(MODULE_HANDLE);
-                    Message_ToByteArray(message, nn_msg_bytes, msg_size);
+                dropped++;
+            }
+            result = merge_result(result, queue_result);
+            wake = wake || pushed;
+        }
 
-                    /*Codes_SRS_BROKER_17_010: [ Broker_Publish shall send a message on the publish_socket. ]*/
-                    int nbytes = nn_send(broker_data->publish_socket, &nn_msg, NN_MSG, 0);
-                    if (nbytes != buf_size)
-                    {
-                        /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                        LogError("unable to send a message [%p]", msg);
-                        /*Codes_SRS_BROKER_17_012: [ Broker_Publish shall free the message. ]*/
-                        nn_freemsg(nn_msg);
-                        result = BROKER_ERROR;
-                    }
-                    else
-                    {
-                        result = BROKER_OK;
-                    }
-                }
-                /*Codes_SRS_BROKER_17_012: [ Broker_Publish shall free the message. ]*/
-                Message_Destroy(msg);
-                /*Codes_SRS_BROKER_17_011: [ Broker_Publish shall free the serialized message data. ]*/
+        if (wake)
+        {
+            wake_module(module_info);
+        }
+        /*Codes_SRS_BROKER_30_013: [ Broker_Publish shall unlock the sink's mailbox_lock. ]*/
+        (void)Unlock(module_info->mailbox_lock);
+
+        /*Codes_SRS_BROKER_30_089: [ Broker_Publish shall add the messages queued, the size of their content and the messages rejected by the overflow policy to the counters of the link. ]*/
+        if (delivered != 0)
+        {
+            (void)ATOMIC_ADD(link->delivered, delivered);
+            (void)ATOMIC_ADD64(link->bytes_delivered, bytes_delivered);
+        }
+        if (dropped != 0)
+        {
+            (void)ATOMIC_ADD(link->dropped, dropped);
+        }
+    }
+
+    return result;
+}
+
+/*delivers the messages that pass the filter of link, if it has one, to its sink*/
+static BROKER_RESULT deliver_to_sink(BROKER_ROUTE_SINK* link, MESSAGE_HANDLE* messages, const size_t* sizes, size_t count, uint64_t* block_deadline)
+{
+    BROKER_RESULT result;
+    if (link->filter == NULL)
+    {
+        result = deliver_to_module(link, messages, sizes, count, block_deadline);
+    }
+    else
+    {
+        MESSAGE_HANDLE selected[BROKER_PUBLISH_BATCH];
+        size_t selected_sizes[BROKER_PUBLISH_BATCH];
+        size_t selected_count = 0;
+        size_t i;
+
+        /*Codes_SRS_BROKER_30_111: [ Broker_Publish shall only deliver to the sink of a filtered link the messages whose properties match every condition of the filter. ]*/
+        for (i = 0; i < count; i++)
+        {
+            if (filter_match(link->filter, messages[i]))
+            {
+                selected[selected_count] = messages[i];
+                selected_sizes[selected_count] = sizes[i];
+                selected_count++;
+            }
+        }
+
+        /*Codes_SRS_BROKER_30_112: [ Broker_Publish shall add the messages the filter kept from the sink to the counters of the link. ]*/
+        if (selected_count < count)
+        {
+            (void)ATOMIC_ADD(link->filtered, (long)(count - selected_count));
+        }
+        result = (selected_count == 0) ? BROKER_OK : deliver_to_module(link, selected, selected_sizes, selected_count, block_deadline);
+    }
+    return result;
+}
+
+/*delivers the messages to every module in the route of source*/
+static BROKER_RESULT publish_messages(BROKER_HANDLE_DATA* broker_data, MODULE_HANDLE source, MESSAGE_HANDLE* messages, size_t count)
+{
+    BROKER_RESULT result = BROKER_OK;
+    /* publishers are spread over the reader counters by source, every module usually publishes from its own thread */
+    size_t stripe = ((size_t)source >> 4) % BROKER_READER_STRIPES;
+    BROKER_ROUTING_TABLE* routing_table;
+    BROKER_ROUTE* route;
+    long phase;
+    /* set by the first wait for room in a BROKER_OVERFLOW_BLOCK mailbox */
+    uint64_t block_deadline = 0;
+
+    /*Codes_SRS_BROKER_17_022: [ Broker_Publish shall register itself as a reader of the routing table instead of locking BROKER_HANDLE_DATA::modules_lock. ]*/
+    phase = routing_table_read_begin(broker_data, stripe);
+    routing_table = (BROKER_ROUTING_TABLE*)ATOMIC_POINTER_READ(broker_data->routing_table);
+
+    /*Codes_SRS_BROKER_30_009: [ Broker_Publish shall deliver the message to every module in the route of source. ]*/
+    route = (routing_table == NULL) ? NULL : routing_table_find(routing_table, source);
+    if (route != NULL)
+    {
+        int64_t bytes_published = 0;
+        size_t first;
+        for (first = 0; first < count; first += BROKER_PUBLISH_BATCH)
+        {
+            size_t sizes[BROKER_PUBLISH_BATCH];
+            size_t chunk = count - first;
+            size_t j;
+            if (chunk > BROKER_PUBLISH_BATCH)
+            {
+                chunk = BROKER_PUBLISH_BATCH;
+            }
+
+            /*Codes_SRS_BROKER_30_090: [ Broker_Publish shall get the size of the content of every message by calling Message_GetContent once, whatever the number of sinks. ]*/
+            for (j = 0; j < chunk; j++)
+            {
+                const CONSTBUFFER* content = Message_GetContent(messages[first + j]);
+                GATEWAY_TRACE(GATEWAY_TRACE_PUBLISH, messages[first + j], source);
+                sizes[j] = (content == NULL) ? 0 : content->size;
+                bytes_published += sizes[j];
+            }
+
+            for (j = 0; j < route->sink_count; j++)
+            {
+                result = merge_result(result, deliver_to_sink(&(route->sinks[j]), messages + first, sizes, chunk, &block_deadline));
             }
-            /*Codes_SRS_BROKER_17_023: [ Broker_Publish shall Unlock the modules lock. ]*/
-            Unlock(broker_data->modules_lock);
         }
 
+        /*Codes_SRS_BROKER_30_091: [ Broker_Publish shall add the messages and the size of their content to the publish counters of the source. ]*/
+        (void)ATOMIC_ADD(route->source_info->published, (long)count);
+        (void)ATOMIC_ADD64(route->source_info->bytes_published, bytes_published);
+    }
+
+    /*Codes_SRS_BROKER_17_023: [ Broker_Publish shall unregister itself as a reader of the routing table. ]*/
+    routing_table_read_end(broker_data, phase, stripe);
+
+    return result;
+}
+
+BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE message)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]*/
+    if (broker == NULL || source == NULL || message == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("Broker handle, source, and/or message handle is NULL");
+    }
+    else
+    {
+        result = publish_messages((BROKER_HANDLE_DATA*)broker, source, &message, 1);
     }
     /*Codes_SRS_BROKER_13_037: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
     return result;
-}
\ No newline at end of file
+}
+
+BROKER_RESULT Broker_PublishBatch(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE* messages, size_t count)
+{
+    BROKER_RESULT result;
+    size_t i;
+
+    /*Codes_SRS_BROKER_30_073: [ If broker, source or messages is NULL or count is 0, Broker_PublishBatch shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || source == NULL || messages == NULL || count == 0)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter - broker(%p), source(%p), messages(%p), count(%d).", broker, source, messages, (int)count);
+    }
+    else
+    {
+        i = 0;
+        while (i < count && messages[i] != NULL)
+        {
+            i++;
+        }
+
+        if (i < count)
+        {
+            /*Codes_SRS_BROKER_30_074: [ If any of the messages is NULL, Broker_PublishBatch shall return BROKER_INVALIDARG without publishing anything. ]*/
+            LogError("message %d of the batch is NULL", (int)i);
+            result = BROKER_INVALIDARG;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_30_075: [ Broker_PublishBatch shall deliver every message, in order, to every module in the route of source, looking up the route once. ]*/
+            /*Codes_SRS_BROKER_30_076: [ Broker_PublishBatch shall lock the mailbox of a sink and signal its worker once for up to BROKER_PUBLISH_BATCH messages. ]*/
+            /*Codes_SRS_BROKER_30_077: [ Broker_PublishBatch shall return BROKER_ERROR if the delivery of any message failed, otherwise BROKER_MESSAGE_DROPPED if an overflow policy rejected any message, otherwise BROKER_OK. ]*/
+            result = publish_messages((BROKER_HANDLE_DATA*)broker, source, messages, count);
+        }
+    }
+
+    return result;
+}
@@ -17,6 +17,9 @@
 static bool module_info_name_find(const void* element, const void* module_name);
 static void gateway_destroymodulelist_internal(GATEWAY_MODULE_INFO* infos, size_t count);
 static bool module_data_find(const void* element, const void* value);
+static int gateway_addlinkmetrics_internal(GATEWAY_HANDLE gw, MODULE_DATA* source_data, MODULE_DATA* sink_data, bool from_any_source, VECTOR_HANDLE links);
+static int gateway_getlinkmetrics_internal(GATEWAY_HANDLE gw, MODULE_DATA* sink_data, VECTOR_HANDLE links);
+static void gateway_destroymetrics_internal(GATEWAY_MODULE_METRICS* metrics, size_t count);
 
 VECTOR_HANDLE Gateway_GetModuleList(GATEWAY_HANDLE gw)
 {
@@ -134,6 +137,95 @@ void Gateway_DestroyModuleList(VECTOR_HANDLE module_list)
     VECTOR_destroy(module_list);
 }
 
+VECTOR_HANDLE Gateway_GetMetrics(GATEWAY_HANDLE gw)
+{
+    VECTOR_HANDLE result;
+
+    /*Codes_SRS_GATEWAY_30_002: [ If the `gw` parameter is NULL, the function shall return NULL handle and not allocate any data. ]*/
+    if (gw == NULL)
+    {
+        LogError("NULL gateway handle given to GetMetrics");
+        result = NULL;
+    }
+    else
+    {
+        result = VECTOR_create(sizeof(GATEWAY_MODULE_METRICS));
+        if (result == NULL)
+        {
+            /*Codes_SRS_GATEWAY_30_006: [ This function shall return a NULL handle should any internal callbacks fail. ]*/
+            LogError("Failed to init vector during GetMetrics");
+        }
+        else
+        {
+            size_t module_count = VECTOR_size(gw->modules);
+            for (size_t i = 0; i < module_count; i++)
+            {
+                MODULE_DATA *module_data = *(MODULE_DATA**)VECTOR_element(gw->modules, i);
+                GATEWAY_MODULE_METRICS module_metrics;
+                module_metrics.module_name = module_data->module_name;
+
+                /*Codes_SRS_GATEWAY_30_003: [ This function shall return a snapshot of the metrics of every module of the gateway as reported by `Broker_GetModuleMetrics`. ]*/
+                if (Broker_GetModuleMetrics(gw->broker, module_data->module, &module_metrics.metrics) != BROKER_OK)
+                {
+                    /*Codes_SRS_GATEWAY_30_006: [ This function shall return a NULL handle should any internal callbacks fail. ]*/
+                    LogError("Failed to get the metrics of module %s", module_data->module_name);
+                    Gateway_DestroyMetrics(result);
+                    result = NULL;
+                    break;
+                }
+                else if ((module_metrics.links = VECTOR_create(sizeof(GATEWAY_LINK_METRICS))) == NULL)
+                {
+                    LogError("Failed to create links vector");
+                    Gateway_DestroyMetrics(result);
+                    result = NULL;
+                    break;
+                }
+                else if (gateway_getlinkmetrics_internal(gw, module_data, module_metrics.links) != 0)
+                {
+                    VECTOR_destroy(module_metrics.links);
+                    Gateway_DestroyMetrics(result);
+                    result = NULL;
+                    break;
+                }
+                else if (VECTOR_push_back(result, &module_metrics, 1) != 0)
+                {
+                    LogError("Failed to push_back module metrics");
+                    VECTOR_destroy(module_metrics.links);
+                    Gateway_DestroyMetrics(result);
+                    result = NULL;
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void Gateway_DestroyMetrics(VECTOR_HANDLE metrics)
+{
+    if (metrics != NULL)
+    {
+        /*Codes_SRS_GATEWAY_30_007: [ This function shall destroy the `links` vector of each `GATEWAY_MODULE_METRICS`. ]*/
+        gateway_destroymetrics_internal(VECTOR_front(metrics), VECTOR_size(metrics));
+        /*Codes_SRS_GATEWAY_30_008: [ This function shall destroy the list of `GATEWAY_MODULE_METRICS`. ]*/
+        VECTOR_destroy(metrics);
+    }
+}
+
+void Gateway_ReportMetrics(GATEWAY_HANDLE gw)
+{
+    /*Codes_SRS_GATEWAY_30_009: [ This function shall log a failure and do nothing else when `gw` parameter is NULL. ]*/
+    if (gw == NULL)
+    {
+        LogError("invalid gateway when reporting metrics");
+    }
+    else
+    {
+        /*Codes_SRS_GATEWAY_30_010: [ This function shall report the `GATEWAY_METRICS` event. ]*/
+        EventSystem_ReportEvent(gw->event_system, gw, GATEWAY_METRICS);
+    }
+}
+
 void Gateway_AddEventCallback(GATEWAY_HANDLE gw, GATEWAY_EVENT event_type, GATEWAY_CALLBACK callback, void* user_param)
 {
     /* Codes_SRS_GATEWAY_26_006: [ This function shall log a failure and do nothing else when `gw` parameter is NULL. ] */
@@ -158,7 +250,7 @@ GATEWAY_HANDLE Gateway_Create(const GATEWAY_PROPERTIES* properties)
     }
     else
     {
-        result = gateway_create_internal(properties, false);
+        result = gateway_create_internal(properties, NULL, false);
         if (result == NULL)
         {
             /* Codes_SRS_GATEWAY_17_017: [ This function shall destroy the default module loaders upon any failure. ]*/
@@ -390,6 +482,80 @@ static void gateway_destroymodulelist_internal(GATEWAY_MODULE_INFO* infos, size_
     }
 }
 
+static int gateway_addlinkmetrics_internal(GATEWAY_HANDLE gw, MODULE_DATA* source_data, MODULE_DATA* sink_data, bool from_any_source, VECTOR_HANDLE links)
+{
+    int result;
+    BROKER_LINK_DATA broker_link = { source_data->module, sink_data->module };
+    GATEWAY_LINK_METRICS link_metrics;
+    link_metrics.source_name = source_data->module_name;
+
+    /*Codes_SRS_GATEWAY_30_004: [ For each module returned this function shall provide a vector of the metrics of every link the module is the sink of, as reported by `Broker_GetLinkMetrics`. ]*/
+    if (Broker_GetLinkMetrics(gw->broker, &broker_link, &link_metrics.metrics) != BROKER_OK)
+    {
+        if (from_any_source)
+        {
+            /* this source is not linked to the sink (yet) */
+            result = 0;
+        }
+        else
+        {
+            LogError("Failed to get the metrics of the link from %s to %s", source_data->module_name, sink_data->module_name);
+            result = __LINE__;
+        }
+    }
+    else if (VECTOR_push_back(links, &link_metrics, 1) != 0)
+    {
+        LogError("Failed to push_back link metrics");
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static int gateway_getlinkmetrics_internal(GATEWAY_HANDLE gw, MODULE_DATA* sink_data, VECTOR_HANDLE links)
+{
+    int result = 0;
+    size_t links_count = VECTOR_size(gw->links);
+
+    for (size_t i = 0; (result == 0) && (i < links_count); i++)
+    {
+        LINK_DATA *link_data = (LINK_DATA*)VECTOR_element(gw->links, i);
+        if (link_data->module_sink != sink_data)
+        {
+            /* not a link into this module */
+        }
+        else if (!link_data->from_any_source)
+        {
+            result = gateway_addlinkmetrics_internal(gw, link_data->module_source, sink_data, false, links);
+        }
+        else
+        {
+            /*Codes_SRS_GATEWAY_30_005: [ For a link with '*' as its source, this function shall provide one entry for every other module linked to the sink. ]*/
+            size_t module_count = VECTOR_size(gw->modules);
+            for (size_t j = 0; (result == 0) && (j < module_count); j++)
+            {
+                MODULE_DATA *source_data = *(MODULE_DATA**)VECTOR_element(gw->modules, j);
+                if (source_data != sink_data)
+                {
+                    result = gateway_addlinkmetrics_internal(gw, source_data, sink_data, true, links);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+static void gateway_destroymetrics_internal(GATEWAY_MODULE_METRICS* metrics, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        VECTOR_destroy((metrics + i)->links);
+    }
+}
+
 static bool module_data_find(const void* element, const void* value)
 {
     return (*(MODULE_DATA**)element)->module == value;
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*this header is internal to the gateway, it provides the handful of atomic
+operations the broker and the messages need to let readers run without taking
+a lock. All the operations are sequentially consistent (full barrier), the
+compare exchanges return the value the variable had before the call and the
+additions the value after it. The 64 bit operations work on int64_t.*/
+
+#ifndef GATEWAY_ATOMIC_H
+#define GATEWAY_ATOMIC_H
+
+#if defined(WIN32)
+
+#include <windows.h>
+
+#define ATOMIC_INCREMENT(var) InterlockedIncrement((volatile LONG*)&(var))
+#define ATOMIC_DECREMENT(var) InterlockedDecrement((volatile LONG*)&(var))
+#define ATOMIC_READ(var) InterlockedCompareExchange((volatile LONG*)&(var), 0, 0)
+#define ATOMIC_ADD(var, value) (InterlockedExchangeAdd((volatile LONG*)&(var), (LONG)(value)) + (LONG)(value))
+#define ATOMIC_READ64(var) InterlockedCompareExchange64((volatile LONGLONG*)&(var), 0, 0)
+#define ATOMIC_ADD64(var, value) (InterlockedExchangeAdd64((volatile LONGLONG*)&(var), (LONGLONG)(value)) + (LONGLONG)(value))
+#define ATOMIC_POINTER_READ(var) InterlockedCompareExchangePointer((PVOID volatile*)&(var), NULL, NULL)
+#define ATOMIC_EXCHANGE(var, value) InterlockedExchange((volatile LONG*)&(var), (LONG)(value))
+#define ATOMIC_POINTER_EXCHANGE(var, value) InterlockedExchangePointer((PVOID volatile*)&(var), (PVOID)(value))
+#define ATOMIC_COMPARE_EXCHANGE(var, value, comparand) InterlockedCompareExchange((volatile LONG*)&(var), (LONG)(value), (LONG)(comparand))
+#define ATOMIC_POINTER_COMPARE_EXCHANGE(var, value, comparand) InterlockedCompareExchangePointer((PVOID volatile*)&(var), (PVOID)(value), (PVOID)(comparand))
+
+#elif defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7)) || defined(__clang__))
+
+#define ATOMIC_INCREMENT(var) __atomic_add_fetch(&(var), 1, __ATOMIC_SEQ_CST)
+#define ATOMIC_DECREMENT(var) __atomic_sub_fetch(&(var), 1, __ATOMIC_SEQ_CST)
+#define ATOMIC_READ(var) __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#define ATOMIC_ADD(var, value) __atomic_add_fetch(&(var), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_READ64(var) __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#define ATOMIC_ADD64(var, value) __atomic_add_fetch(&(var), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_POINTER_READ(var) __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#define ATOMIC_EXCHANGE(var, value) __atomic_exchange_n(&(var), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_POINTER_EXCHANGE(var, value) __atomic_exchange_n(&(var), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_COMPARE_EXCHANGE(var, value, comparand) __sync_val_compare_and_swap(&(var), (comparand), (value))
+#define ATOMIC_POINTER_COMPARE_EXCHANGE(var, value, comparand) __sync_val_compare_and_swap(&(var), (comparand), (value))
+
+#elif defined(__GNUC__)
+
+/*older compilers only have the __sync builtins, they are all full barriers*/
+#define ATOMIC_INCREMENT(var) __sync_add_and_fetch(&(var), 1)
+#define ATOMIC_DECREMENT(var) __sync_sub_and_fetch(&(var), 1)
+#define ATOMIC_READ(var) __sync_fetch_and_add(&(var), 0)
+#define ATOMIC_ADD(var, value) __sync_add_and_fetch(&(var), (value))
+#define ATOMIC_READ64(var) __sync_fetch_and_add(&(var), 0)
+#define ATOMIC_ADD64(var, value) __sync_add_and_fetch(&(var), (value))
+#define ATOMIC_POINTER_READ(var) __sync_val_compare_and_swap(&(var), NULL, NULL)
+#define ATOMIC_EXCHANGE(var, value) (__sync_synchronize(), __sync_lock_test_and_set(&(var), (value)))
+#define ATOMIC_POINTER_EXCHANGE(var, value) (__sync_synchronize(), __sync_lock_test_and_set(&(var), (value)))
+#define ATOMIC_COMPARE_EXCHANGE(var, value, comparand) __sync_val_compare_and_swap(&(var), (comparand), (value))
+#define ATOMIC_POINTER_COMPARE_EXCHANGE(var, value, comparand) __sync_val_compare_and_swap(&(var), (comparand), (value))
+
+#else
+#error "gateway_atomic.h: atomic operations are not available for this compiler"
+#endif
+
+#endif /*GATEWAY_ATOMIC_H*/
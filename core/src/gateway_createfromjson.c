@@ -2,10 +2,12 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdlib.h>
+#include <string.h>
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/macro_utils.h"
 #include "gateway.h"
+#include "broker.h"
 #include "parson.h"
 
 #include "module_loaders/dynamic_loader.h"
@@ -22,6 +24,22 @@
 #define LINKS_KEY "links"
 #define SOURCE_KEY "source"
 #define SINK_KEY "sink"
+#define FILTER_KEY "filter"
+
+#define BROKER_KEY "broker"
+#define SCHEDULER_KEY "scheduler"
+#define WORKERS_KEY "workers"
+#define SCHEDULER_THREAD_PER_MODULE "thread_per_module"
+#define SCHEDULER_WORKER_POOL "worker_pool"
+
+#define MAILBOX_KEY "mailbox"
+#define CAPACITY_KEY "capacity"
+#define OVERFLOW_KEY "overflow"
+#define COALESCE_KEY_KEY "coalesce_key"
+#define OVERFLOW_BLOCK "block"
+#define OVERFLOW_DROP_OLDEST "drop_oldest"
+#define OVERFLOW_DROP_NEWEST "drop_newest"
+#define OVERFLOW_COALESCE "coalesce"
 
 #define PARSE_JSON_RESULT_VALUES \
     PARSE_JSON_SUCCESS, \
@@ -32,9 +50,10 @@
 
 DEFINE_ENUM(PARSE_JSON_RESULT, PARSE_JSON_RESULT_VALUES);
 
-GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, bool use_json);
-static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties, JSON_Value *root);
+GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, const BROKER_OPTIONS* broker_options, bool use_json);
+static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties, BROKER_OPTIONS* out_broker_options, VECTOR_HANDLE* out_link_filters, JSON_Value *root);
 static void destroy_properties_internal(GATEWAY_PROPERTIES* properties);
+static void destroy_link_filters(VECTOR_HANDLE link_filters);
 void gateway_destroy_internal(GATEWAY_HANDLE gw);
 
 GATEWAY_HANDLE Gateway_CreateFromJson(const char* file_path)
@@ -63,13 +82,16 @@ GATEWAY_HANDLE Gateway_CreateFromJson(const char* file_path)
 
                 if (properties != NULL)
                 {
+                    BROKER_OPTIONS broker_options;
+                    VECTOR_HANDLE link_filters = NULL;
                     properties->gateway_modules = NULL;
                     properties->gateway_links = NULL;
-                    if (parse_json_internal(properties, root_value) == PARSE_JSON_SUCCESS)
+                    if (parse_json_internal(properties, &broker_options, &link_filters, root_value) == PARSE_JSON_SUCCESS)
                     {
                         /*Codes_SRS_GATEWAY_JSON_14_007: [The function shall use the GATEWAY_PROPERTIES instance to create and return a GATEWAY_HANDLE using the lower level API.]*/
                         /*Codes_SRS_GATEWAY_JSON_17_004: [ The function shall set the module loader to the default dynamically linked library module loader. ]*/
-                        gw = gateway_create_internal(properties, true);
+                        /*Codes_SRS_GATEWAY_JSON_30_005: [ The function shall create the gateway's broker with the options parsed from "broker". ]*/
+                        gw = gateway_create_internal(properties, &broker_options, true);
 
                         if (gw == NULL)
                         {
@@ -96,6 +118,7 @@ GATEWAY_HANDLE Gateway_CreateFromJson(const char* file_path)
                         LogError("Failed to create properties structure from JSON configuration.");
                     }
                     destroy_properties_internal(properties);
+                    destroy_link_filters(link_filters);
                     free(properties);
                 }
                 /*Codes_SRS_GATEWAY_JSON_14_008: [This function shall return NULL upon any memory allocation failure.]*/
@@ -152,6 +175,94 @@ static void destroy_properties_internal(GATEWAY_PROPERTIES* properties)
     }
 }
 
+/*the filters are only allocated for the links that have one, so the vector
+holding them is only created for the first one*/
+static void destroy_link_filters(VECTOR_HANDLE link_filters)
+{
+    if (link_filters != NULL)
+    {
+        size_t filter_count = VECTOR_size(link_filters);
+        for (size_t filter_index = 0; filter_index < filter_count; ++filter_index)
+        {
+            free(*(BROKER_LINK_FILTER**)VECTOR_element(link_filters, filter_index));
+        }
+        VECTOR_destroy(link_filters);
+    }
+}
+
+static PARSE_JSON_RESULT parse_link_filter(JSON_Object* link_json, VECTOR_HANDLE* link_filters, const BROKER_LINK_FILTER** filter)
+{
+    PARSE_JSON_RESULT result;
+
+    /*Codes_SRS_GATEWAY_JSON_30_010: [ If a link has no "filter" object, or an empty one, the function shall let every message through the link. ]*/
+    JSON_Object* filter_json = json_object_get_object(link_json, FILTER_KEY);
+    size_t match_count = (filter_json == NULL) ? 0 : json_object_get_count(filter_json);
+    *filter = NULL;
+
+    if (match_count == 0)
+    {
+        result = PARSE_JSON_SUCCESS;
+    }
+    else
+    {
+        /*Codes_SRS_GATEWAY_JSON_30_011: [ The function shall parse every member of "filter" as the name of a message property and the pattern its value has to match. ]*/
+        BROKER_LINK_FILTER* link_filter = (BROKER_LINK_FILTER*)malloc(sizeof(BROKER_LINK_FILTER) + (match_count * sizeof(BROKER_PROPERTY_MATCH)));
+        if (link_filter == NULL)
+        {
+            /* Codes_SRS_GATEWAY_JSON_14_008: [ This function shall return NULL upon any memory allocation failure. ] */
+            LogError("Failed to allocate the filter of a link.");
+            result = PARSE_JSON_VECTOR_FAILURE;
+        }
+        else
+        {
+            BROKER_PROPERTY_MATCH* matches = (BROKER_PROPERTY_MATCH*)(link_filter + 1);
+            size_t match_index;
+            link_filter->match_count = match_count;
+            link_filter->matches = matches;
+            result = PARSE_JSON_SUCCESS;
+
+            for (match_index = 0; match_index < match_count; ++match_index)
+            {
+                matches[match_index].name = json_object_get_name(filter_json, match_index);
+                matches[match_index].pattern = json_object_get_string(filter_json, matches[match_index].name);
+                if (matches[match_index].pattern == NULL)
+                {
+                    /*Codes_SRS_GATEWAY_JSON_30_012: [ If a member of "filter" is not a string, the function shall fail and return NULL. ]*/
+                    LogError("The filter of a link can only hold strings - %s.", matches[match_index].name);
+                    result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+                    break;
+                }
+            }
+
+            if (result == PARSE_JSON_SUCCESS)
+            {
+                if (*link_filters == NULL &&
+                    (*link_filters = VECTOR_create(sizeof(BROKER_LINK_FILTER*))) == NULL)
+                {
+                    LogError("Failed to create the link filters vector.");
+                    result = PARSE_JSON_VECTOR_FAILURE;
+                }
+                else if (VECTOR_push_back(*link_filters, &link_filter, 1) != 0)
+                {
+                    LogError("Failed to push data into link filters vector.");
+                    result = PARSE_JSON_VECTOR_FAILURE;
+                }
+                else
+                {
+                    *filter = link_filter;
+                }
+            }
+
+            if (result != PARSE_JSON_SUCCESS)
+            {
+                free(link_filter);
+            }
+        }
+    }
+
+    return result;
+}
+
 static PARSE_JSON_RESULT parse_loader(JSON_Object* loader_json, GATEWAY_MODULE_LOADER_INFO* loader_info)
 {
     PARSE_JSON_RESULT result;
@@ -198,7 +309,115 @@ static PARSE_JSON_RESULT parse_loader(JSON_Object* loader_json, GATEWAY_MODULE_L
     return result;
 }
 
-static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties, JSON_Value *root)
+static PARSE_JSON_RESULT parse_broker(JSON_Object* json_document, BROKER_OPTIONS* broker_options)
+{
+    PARSE_JSON_RESULT result;
+
+    /*Codes_SRS_GATEWAY_JSON_30_001: [ If the "broker" object is missing, the function shall use BROKER_SCHEDULER_THREAD_PER_MODULE. ]*/
+    JSON_Object* broker_json = json_object_get_object(json_document, BROKER_KEY);
+    broker_options->scheduler = BROKER_SCHEDULER_THREAD_PER_MODULE;
+    broker_options->worker_count = 0;
+
+    if (broker_json == NULL)
+    {
+        result = PARSE_JSON_SUCCESS;
+    }
+    else
+    {
+        /*Codes_SRS_GATEWAY_JSON_30_002: [ The function shall parse "broker.scheduler", which may be missing, "thread_per_module" or "worker_pool". ]*/
+        const char* scheduler = json_object_get_string(broker_json, SCHEDULER_KEY);
+        /*Codes_SRS_GATEWAY_JSON_30_003: [ The function shall parse "broker.workers" as the number of threads of the worker pool, 0 or missing for the default. ]*/
+        double workers = json_object_get_number(broker_json, WORKERS_KEY);
+
+        if (scheduler != NULL &&
+            strcmp(scheduler, SCHEDULER_THREAD_PER_MODULE) != 0 &&
+            strcmp(scheduler, SCHEDULER_WORKER_POOL) != 0)
+        {
+            /*Codes_SRS_GATEWAY_JSON_30_004: [ If "broker.scheduler" is not a known scheduler or "broker.workers" is not a non-negative integer, the function shall fail and return NULL. ]*/
+            LogError("Unknown broker scheduler - %s.", scheduler);
+            result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+        }
+        else if (workers < 0 || workers != (double)(size_t)workers)
+        {
+            LogError("\"workers\" in the broker configuration has to be a non-negative integer.");
+            result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+        }
+        else
+        {
+            if (scheduler != NULL && strcmp(scheduler, SCHEDULER_WORKER_POOL) == 0)
+            {
+                broker_options->scheduler = BROKER_SCHEDULER_WORKER_POOL;
+            }
+            broker_options->worker_count = (size_t)workers;
+            result = PARSE_JSON_SUCCESS;
+        }
+    }
+
+    return result;
+}
+
+static PARSE_JSON_RESULT parse_mailbox(JSON_Object* module_json, BROKER_MAILBOX_OPTIONS* mailbox_options)
+{
+    PARSE_JSON_RESULT result;
+
+    /*Codes_SRS_GATEWAY_JSON_30_006: [ If the "mailbox" object of a module is missing, the function shall leave the module's mailbox unbounded. ]*/
+    JSON_Object* mailbox_json = json_object_get_object(module_json, MAILBOX_KEY);
+    mailbox_options->capacity = 0;
+    mailbox_options->overflow = BROKER_OVERFLOW_BLOCK;
+    mailbox_options->coalesce_key = NULL;
+
+    if (mailbox_json == NULL)
+    {
+        result = PARSE_JSON_SUCCESS;
+    }
+    else
+    {
+        /*Codes_SRS_GATEWAY_JSON_30_007: [ The function shall parse "mailbox.capacity" as the maximum number of messages queued for the module, 0 or missing for no limit. ]*/
+        double capacity = json_object_get_number(mailbox_json, CAPACITY_KEY);
+        /*Codes_SRS_GATEWAY_JSON_30_008: [ The function shall parse "mailbox.overflow", which may be missing, "block", "drop_oldest", "drop_newest" or "coalesce", and "mailbox.coalesce_key". ]*/
+        const char* overflow = json_object_get_string(mailbox_json, OVERFLOW_KEY);
+        const char* coalesce_key = json_object_get_string(mailbox_json, COALESCE_KEY_KEY);
+
+        if (capacity < 0 || capacity != (double)(size_t)capacity)
+        {
+            /*Codes_SRS_GATEWAY_JSON_30_009: [ If "mailbox.capacity" is not a non-negative integer, "mailbox.overflow" is not a known policy or "coalesce" has no "coalesce_key", the function shall fail and return NULL. ]*/
+            LogError("\"capacity\" in the mailbox configuration has to be a non-negative integer.");
+            result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+        }
+        else
+        {
+            result = PARSE_JSON_SUCCESS;
+            if (overflow == NULL || strcmp(overflow, OVERFLOW_BLOCK) == 0)
+            {
+                mailbox_options->overflow = BROKER_OVERFLOW_BLOCK;
+            }
+            else if (strcmp(overflow, OVERFLOW_DROP_OLDEST) == 0)
+            {
+                mailbox_options->overflow = BROKER_OVERFLOW_DROP_OLDEST;
+            }
+            else if (strcmp(overflow, OVERFLOW_DROP_NEWEST) == 0)
+            {
+                mailbox_options->overflow = BROKER_OVERFLOW_DROP_NEWEST;
+            }
+            else if (strcmp(overflow, OVERFLOW_COALESCE) == 0 && coalesce_key != NULL)
+            {
+                mailbox_options->overflow = BROKER_OVERFLOW_COALESCE;
+            }
+            else
+            {
+                LogError("Unknown mailbox overflow policy or missing coalesce_key - %s.", overflow);
+                result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+            }
+
+            mailbox_options->capacity = (size_t)capacity;
+            mailbox_options->coalesce_key = coalesce_key;
+        }
+    }
+
+    return result;
+}
+
+static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties, BROKER_OPTIONS* out_broker_options, VECTOR_HANDLE* out_link_filters, JSON_Value *root)
 {
     PARSE_JSON_RESULT result;
 
@@ -240,7 +459,8 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                         else
                         {
                             const char* module_name = json_object_get_string(module, MODULE_NAME_KEY);
-                            if (module_name != NULL)
+                            BROKER_MAILBOX_OPTIONS mailbox_options;
+                            if (module_name != NULL && parse_mailbox(module, &mailbox_options) == PARSE_JSON_SUCCESS)
                             {
                                 /*Codes_SRS_GATEWAY_JSON_14_005: [The function shall set the value of const void* module_properties in the GATEWAY_PROPERTIES instance to a char* representing the serialized args value for the particular module.]*/
                                 JSON_Value *args = json_object_get_value(module, ARG_KEY);
@@ -249,7 +469,8 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                                 GATEWAY_MODULES_ENTRY entry = {
                                     module_name,
                                     loader_info,
-                                    args_str
+                                    args_str,
+                                    mailbox_options
                                 };
 
                                 /*Codes_SRS_GATEWAY_JSON_14_006: [The function shall return NULL if the JSON_Value contains incomplete information.]*/
@@ -295,11 +516,16 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                                 {
                                     GATEWAY_LINK_ENTRY entry = {
                                         module_source,
-                                        module_sink
+                                        module_sink,
+                                        NULL
                                     };
 
+                                    if ((result = parse_link_filter(route, out_link_filters, &(entry.filter))) != PARSE_JSON_SUCCESS)
+                                    {
+                                        break;
+                                    }
                                     /* Codes_SRS_GATEWAY_JSON_04_002: [ The function shall add all modules source and sink to GATEWAY_PROPERTIES inside gateway_links. ] */
-                                    if (VECTOR_push_back(out_properties->gateway_links, &entry, 1) == 0)
+                                    else if (VECTOR_push_back(out_properties->gateway_links, &entry, 1) == 0)
                                     {
                                         result = PARSE_JSON_SUCCESS;
                                     }
@@ -326,6 +552,11 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                             LogError("Failed to create links vector. ");
                         }
                     }
+
+                    if (result == PARSE_JSON_SUCCESS)
+                    {
+                        result = parse_broker(json_document, out_broker_options);
+                    }
                 }
                 /* Codes_SRS_GATEWAY_JSON_14_008: [ This function shall return NULL upon any memory allocation failure. ] */
                 else
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <string.h>
 #include <azure_c_shared_utility/gballoc.h>
 #include <azure_c_shared_utility/xlogging.h>
 
@@ -43,7 +44,51 @@ static bool check_if_link_exists(GATEWAY_HANDLE_DATA* gateway_handle, const GATE
     return link_data == NULL ? false : true;
 }
 
-static int add_one_link_to_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HANDLE source, MODULE_HANDLE sink)
+/*copies filter and its strings into a single allocation*/
+static BROKER_LINK_FILTER* link_filter_clone(const BROKER_LINK_FILTER* filter)
+{
+    BROKER_LINK_FILTER* result;
+    size_t size = sizeof(BROKER_LINK_FILTER) + (filter->match_count * sizeof(BROKER_PROPERTY_MATCH));
+    size_t i;
+
+    for (i = 0; i < filter->match_count; i++)
+    {
+        if (filter->matches == NULL || filter->matches[i].name == NULL || filter->matches[i].pattern == NULL)
+        {
+            break;
+        }
+        size += strlen(filter->matches[i].name) + strlen(filter->matches[i].pattern) + 2;
+    }
+
+    if (i < filter->match_count)
+    {
+        LogError("the filter of the link has a NULL property name or pattern");
+        result = NULL;
+    }
+    else if ((result = (BROKER_LINK_FILTER*)malloc(size)) == NULL)
+    {
+        LogError("unable to allocate the filter of the link");
+    }
+    else
+    {
+        BROKER_PROPERTY_MATCH* matches = (BROKER_PROPERTY_MATCH*)(result + 1);
+        char* strings = (char*)(matches + filter->match_count);
+        for (i = 0; i < filter->match_count; i++)
+        {
+            size_t name_length = strlen(filter->matches[i].name) + 1;
+            size_t pattern_length = strlen(filter->matches[i].pattern) + 1;
+            matches[i].name = (const char*)memcpy(strings, filter->matches[i].name, name_length);
+            strings += name_length;
+            matches[i].pattern = (const char*)memcpy(strings, filter->matches[i].pattern, pattern_length);
+            strings += pattern_length;
+        }
+        result->match_count = filter->match_count;
+        result->matches = matches;
+    }
+    return result;
+}
+
+static int add_one_link_to_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HANDLE source, MODULE_HANDLE sink, const BROKER_LINK_FILTER* filter)
 {
     int result;
     BROKER_LINK_DATA broker_link_entry =
@@ -51,7 +96,10 @@ static int add_one_link_to_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HA
         source,
         sink
     };
-    if (Broker_AddLink(gateway_handle->broker, &broker_link_entry) != BROKER_OK)
+    /*Codes_SRS_GATEWAY_30_011: [ If the link has a filter, the function shall add it to the broker with Broker_AddLinkWithFilter. ]*/
+    if (((filter == NULL) ?
+        Broker_AddLink(gateway_handle->broker, &broker_link_entry) :
+        Broker_AddLinkWithFilter(gateway_handle->broker, &broker_link_entry, filter)) != BROKER_OK)
     {
         LogError("Could not add link to broker [%p] -> [%p]", source, sink);
         result = __LINE__;
@@ -106,7 +154,7 @@ static int add_regular_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_L
         }
         else
         {
-            if (add_one_link_to_broker(gateway_handle, (*module_source_handle)->module, (*module_sink_handle)->module) != 0)
+            if (add_one_link_to_broker(gateway_handle, (*module_source_handle)->module, (*module_sink_handle)->module, link_entry->filter) != 0)
             {
                 LogError("Unable to add link to Broker.");
                 result = __LINE__;
@@ -117,7 +165,8 @@ static int add_regular_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_L
                 {
                     false,
                     *module_source_handle,
-                    *module_sink_handle
+                    *module_sink_handle,
+                    NULL
                 };
 
                 /*Codes_SRS_GATEWAY_04_012: [ This function shall add the entryLink to the gw->links ] */
@@ -137,7 +186,7 @@ static int add_regular_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_L
     return result;
 }
 
-GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, bool use_json)
+GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, const BROKER_OPTIONS* broker_options, bool use_json)
 {
     GATEWAY_HANDLE_DATA* gateway;
     /*Codes_SRS_GATEWAY_14_001: [This function shall create a GATEWAY_HANDLE representing the newly created gateway.]*/
@@ -149,13 +198,14 @@ GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, boo
         memset(gateway, 0, sizeof(GATEWAY_HANDLE_DATA));
 
         /*Codes_SRS_GATEWAY_14_003: [This function shall create a new BROKER_HANDLE for the gateway representing this gateway's message broker. ]*/
-        gateway->broker = Broker_Create();
+        /*Codes_SRS_GATEWAY_30_001: [ The broker shall be created by calling Broker_CreateWithOptions with the broker options, NULL for Gateway_Create. ]*/
+        gateway->broker = Broker_CreateWithOptions(broker_options);
         if (gateway->broker == NULL)
         {
             /*Codes_SRS_GATEWAY_14_004: [This function shall return NULL if a BROKER_HANDLE cannot be created.]*/
             gateway_destroy_internal(gateway);
             gateway = NULL;
-            LogError("Gateway_Create(): Broker_Create() failed.");
+            LogError("Gateway_Create(): Broker_CreateWithOptions() failed.");
         }
         else
         {
@@ -449,9 +499,9 @@ MODULE_HANDLE gateway_addmodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, co
                         module.module_apis = module_apis;
                         module.module_handle = module_handle;
 
-                        /*Codes_SRS_GATEWAY_14_017: [The function shall attach the module to the GATEWAY_HANDLE_DATA's broker using a call to Broker_AddModule. ]*/
+                        /*Codes_SRS_GATEWAY_14_017: [The function shall attach the module to the GATEWAY_HANDLE_DATA's broker using a call to Broker_AddModuleWithOptions with the `mailbox_options` of the entry. ]*/
                         /*Codes_SRS_GATEWAY_14_018: [If the function cannot attach the module to the message broker, the function shall return NULL.]*/
-                        if (Broker_AddModule(gateway_handle->broker, &module) != BROKER_OK)
+                        if (Broker_AddModuleWithOptions(gateway_handle->broker, &module, &(module_entry->mailbox_options)) != BROKER_OK)
                         {
                             free(new_module_data);
                             module_result = NULL;
@@ -502,25 +552,10 @@ MODULE_HANDLE gateway_addmodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, co
                                 }
                                 else
                                 {
-                                    if (add_module_to_any_source(gateway_handle, *(MODULE_DATA**)VECTOR_back(gateway_handle->modules)) != 0)
-                                    {
-                                        /*Codes_SRS_GATEWAY_14_019: [The function shall return the newly created MODULE_HANDLE only if each API call returns successfully.]*/
-                                        Broker_DecRef(gateway_handle->broker);
-                                        module_result = NULL;
-                                        if (Broker_RemoveModule(gateway_handle->broker, &module) != BROKER_OK)
-                                        {
-                                            LogError("Failed to remove module [%p] from the gateway message broker. This module will remain attached.", &module);
-                                        }
-                                        VECTOR_erase(gateway_handle->modules, VECTOR_back(gateway_handle->modules), 1);
-                                        free(new_module_data);
-                                        free(name_copied);
-                                        LogError("Unable to add MODULE_DATA* to existing broker links.");
-                                    }
-                                    else
-                                    {
-                                        /*Codes_SRS_GATEWAY_14_019: [The function shall return the newly created MODULE_HANDLE only if each API call returns successfully.]*/
-                                        module_result = module_handle;
-                                    }
+                                    /*Codes_SRS_GATEWAY_17_005: [ For this link, the sink shall receive all messages publish by other modules. ]*/
+                                    /* the broker routes the messages of the module to the sinks of "*" links when it is added */
+                                    /*Codes_SRS_GATEWAY_14_019: [The function shall return the newly created MODULE_HANDLE only if each API call returns successfully.]*/
+                                    module_result = module_handle;
                                 }
                             }
                         }
@@ -551,7 +586,6 @@ void gateway_removemodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_D
     module.module_apis = NULL;
     module.module_handle = (*module_data_pptr)->module;
 
-    remove_module_from_any_source(gateway_handle, *module_data_pptr);
     /* Codes_SRS_GATEWAY_26_018: [ This function shall remove any links that contain the removed module either as a source or sink. ] */
     if (gateway_handle->links)
     {
@@ -650,70 +684,11 @@ void gateway_removelink_internal(GATEWAY_HANDLE_DATA* gateway_handle, LINK_DATA*
         Broker_RemoveLink(gateway_handle->broker, &broker_data);
     }
 
-    VECTOR_erase(gateway_handle->links, link_data, 1);
-}
-
-int add_module_to_any_source(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_DATA* module)
-{
-    int result = 0;
-    size_t link;
-    size_t num_links = VECTOR_size(gateway_handle->links);
-    for (link = 0; link < num_links; link++)
-    {
-        LINK_DATA * link_data = VECTOR_element(gateway_handle->links, link);
-        if (link_data->from_any_source)
-        {
-            MODULE_DATA** module_sink = (MODULE_DATA**)VECTOR_find_if(gateway_handle->modules, module_name_find, link_data->module_sink->module_name);
-            if (module_sink == NULL)
-            {
-                LogError("Link failure between [%s] and [%s]", link_data->module_sink->module_name, module->module_name);
-                result = __LINE__;
-                break;
-            }
-            else
-            {
-                if (add_one_link_to_broker(gateway_handle, module->module, (*module_sink)->module) != 0)
-                {
-                    result = __LINE__;
-                    break;
-                }
-            }
-        }
-    }
-    if (result != 0)
-    {
-        remove_module_from_any_source(gateway_handle, module);
-    }
-
-    return result;
-}
-
-void remove_module_from_any_source(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_DATA* module)
-{
-    if (gateway_handle->links)
+    if (link_data->filter != NULL)
     {
-        size_t link;
-        size_t num_links = VECTOR_size(gateway_handle->links);
-        for (link = 0; link < num_links; link++)
-        {
-            LINK_DATA * link_data = VECTOR_element(gateway_handle->links, link);
-            if (link_data->from_any_source)
-            {
-                MODULE_DATA** module_sink = (MODULE_DATA**)VECTOR_find_if(gateway_handle->modules, module_name_find, link_data->module_sink->module_name);
-                if (module_sink == NULL)
-                {
-                    LogError("Could not find sink for link [%s]", link_data->module_sink);
-                }
-                else
-                {
-                    if (remove_one_link_from_broker(gateway_handle, module->module, (*module_sink)->module) != 0)
-                    {
-                        LogError("Unable to remove link to Broker.");
-                    }
-                }
-            }
-        }
+        free(link_data->filter);
     }
+    VECTOR_erase(gateway_handle->links, link_data, 1);
 }
 
 int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry)
@@ -734,37 +709,41 @@ int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_
         {
             true,
             no_module,
-            *module_sink_data
+            *module_sink_data,
+            NULL
         };
 
-        /*Codes_SRS_GATEWAY_04_012: [ This function shall add the entryLink to the gw->links ] */
-        if (VECTOR_push_back(gateway_handle->links, &link_data, 1) != 0)
+        /*Codes_SRS_GATEWAY_30_012: [ The function shall keep a copy of the filter of a link with a source of "*" to add it to the links from the modules added later. ]*/
+        if ((link_entry->filter != NULL) &&
+            ((link_data.filter = link_filter_clone(link_entry->filter)) == NULL))
         {
-            LogError("Unable to add LINK_DATA* to the gateway links vector.");
             result = __LINE__;
         }
-        else
+        /*Codes_SRS_GATEWAY_04_012: [ This function shall add the entryLink to the gw->links ] */
+        else if (VECTOR_push_back(gateway_handle->links, &link_data, 1) != 0)
         {
-            /*Codes_SRS_GATEWAY_17_003: [ The gateway shall treat a source of "*" as link to the sink module from every other module in gateway. ]*/
-            size_t m;
-            size_t num_modules = VECTOR_size(gateway_handle->modules);
-            result = 0;
-            for (m = 0; m < num_modules; m++)
+            LogError("Unable to add LINK_DATA* to the gateway links vector.");
+            if (link_data.filter != NULL)
             {
-                MODULE_DATA **source_module_data = (MODULE_DATA **)VECTOR_element(gateway_handle->modules, m);
-                /*Codes_SRS_GATEWAY_17_005: [ For this link, the sink shall receive all messages publish by other modules. ]*/
-                if ((*source_module_data)->module != (*module_sink_data)->module &&
-                    add_one_link_to_broker(gateway_handle, (*source_module_data)->module, (*module_sink_data)->module) != 0)
-                {
-                    result = __LINE__;
-                    break;
-                }
+                free(link_data.filter);
             }
-            if (result != 0)
+            result = __LINE__;
+        }
+        /*Codes_SRS_GATEWAY_17_003: [ The gateway shall treat a source of "*" as link to the sink module from every other module in gateway. ]*/
+        /*Codes_SRS_GATEWAY_30_013: [ The function shall add a link with a source of "*" to the broker once, with Broker_AddAnySourceLink. ]*/
+        else if (Broker_AddAnySourceLink(gateway_handle->broker, (*module_sink_data)->module, link_data.filter) != BROKER_OK)
+        {
+            LogError("Could not add link to broker [*] -> [%p]", (*module_sink_data)->module);
+            VECTOR_erase(gateway_handle->links, VECTOR_back(gateway_handle->links), 1);
+            if (link_data.filter != NULL)
             {
-                remove_any_source_link(gateway_handle, &link_data);
-                VECTOR_erase(gateway_handle->links, VECTOR_back(gateway_handle->links), 1);
+                free(link_data.filter);
             }
+            result = __LINE__;
+        }
+        else
+        {
+            result = 0;
         }
     }
     return result;
@@ -777,16 +756,9 @@ void remove_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, LINK_DATA* link
     /*Codes_SRS_GATEWAY_04_011: [If the module referenced by the entryLink->module_source or entryLink->module_sink doesn't exists this function shall return GATEWAY_ADD_LINK_ERROR ] */
     if (module_sink_data != NULL)
     {
-        size_t m;
-        size_t num_modules = VECTOR_size(gateway_handle->modules);
-        for (m = 0; m < num_modules; m++)
+        if (Broker_RemoveAnySourceLink(gateway_handle->broker, (*module_sink_data)->module) != BROKER_OK)
         {
-            MODULE_DATA **source_module_data = (MODULE_DATA **)VECTOR_element(gateway_handle->modules, m);
-            if ((*source_module_data)->module != (*module_sink_data)->module &&
-                remove_one_link_from_broker(gateway_handle, (*source_module_data)->module, (*module_sink_data)->module) != 0)
-            {
-                LogError("Unable to remove link to Broker.");
-            }
+            LogError("Unable to remove link to Broker.");
         }
     }
     else
@@ -0,0 +1,393 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#ifndef WIN32
+#include <time.h>
+#include <pthread.h>
+#endif
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+#include "gateway_trace.h"
+#include "gateway_atomic.h"
+
+#if defined(_MSC_VER)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+typedef struct GATEWAY_TRACE_ENTRY_TAG
+{
+    uint64_t timestamp;
+    const void* object;
+    const void* context;
+    GATEWAY_TRACE_EVENT event;
+} GATEWAY_TRACE_ENTRY;
+
+/*written by its thread only; next and full are published with a barrier
+after the entry is written so a dump running at the same time reads whole
+entries, except the oldest that may be overwritten under it*/
+typedef struct GATEWAY_TRACE_RING_TAG
+{
+    volatile long next;
+    volatile long full;
+    volatile long released; /*its thread exited, another one can take it over*/
+    volatile long thread_id;
+    GATEWAY_TRACE_ENTRY entries[GATEWAY_TRACE_RING_SIZE];
+} GATEWAY_TRACE_RING;
+
+static const char* const trace_event_names[] =
+{
+    "publish",
+    "enqueue",
+    "dequeue",
+    "receive",
+    "receive",
+    "serialize",
+    "serialize",
+    "deserialize",
+    "deserialize",
+    "send",
+    "send"
+};
+
+static volatile long trace_enabled = 0;
+static volatile int64_t trace_start = 0;
+static volatile long trace_ring_count = 0;
+static volatile long trace_thread_count = 0;
+static GATEWAY_TRACE_RING* volatile trace_rings[GATEWAY_TRACE_MAX_THREADS];
+
+static TRACE_THREAD_LOCAL GATEWAY_TRACE_RING* thread_ring = NULL;
+static TRACE_THREAD_LOCAL int thread_ring_failed = 0;
+
+/*the ring of a thread is handed to trace_release_ring when the thread exits*/
+#ifdef WIN32
+static INIT_ONCE trace_exit_once = INIT_ONCE_STATIC_INIT;
+static DWORD trace_exit_index = FLS_OUT_OF_INDEXES;
+#else
+static pthread_once_t trace_exit_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_exit_key;
+static int trace_exit_key_created = 0;
+#endif
+
+/*monotonic time in nanoseconds*/
+static uint64_t trace_now_ns(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    (void)QueryPerformanceFrequency(&frequency);
+    (void)QueryPerformanceCounter(&counter);
+    return ((uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u) +
+        (uint64_t)(((counter.QuadPart % frequency.QuadPart) * 1000000000) / frequency.QuadPart);
+#else
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000u) + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/*runs on the exiting thread*/
+static void trace_release_ring(void* ring)
+{
+    if (ring != NULL)
+    {
+        /*Codes_SRS_GATEWAY_TRACE_30_013: [ When a thread that has a ring exits, its ring shall be released; the events of the thread shall be kept until another thread takes the ring over. ]*/
+        /*what the thread records while it exits is ignored*/
+        thread_ring = NULL;
+        thread_ring_failed = 1;
+        (void)ATOMIC_EXCHANGE(((GATEWAY_TRACE_RING*)ring)->released, 1);
+    }
+}
+
+#ifdef WIN32
+static VOID WINAPI trace_thread_exit(PVOID ring)
+{
+    trace_release_ring(ring);
+}
+
+static BOOL CALLBACK trace_create_exit_index(PINIT_ONCE once, PVOID parameter, PVOID* context)
+{
+    (void)once;
+    (void)parameter;
+    (void)context;
+    trace_exit_index = FlsAlloc(trace_thread_exit);
+    return TRUE;
+}
+#else
+static void trace_create_exit_key(void)
+{
+    trace_exit_key_created = (pthread_key_create(&trace_exit_key, trace_release_ring) == 0);
+}
+#endif
+
+/*has the ring released when the calling thread exits. If that cannot be
+arranged the ring is kept until the process ends*/
+static void trace_release_on_exit(GATEWAY_TRACE_RING* ring)
+{
+#ifdef WIN32
+    if ((!InitOnceExecuteOnce(&trace_exit_once, trace_create_exit_index, NULL, NULL)) ||
+        (trace_exit_index == FLS_OUT_OF_INDEXES) ||
+        (!FlsSetValue(trace_exit_index, ring)))
+#else
+    if ((pthread_once(&trace_exit_once, trace_create_exit_key) != 0) ||
+        (trace_exit_key_created == 0) ||
+        (pthread_setspecific(trace_exit_key, ring) != 0))
+#endif
+    {
+        LogError("unable to release the trace ring of a thread when it exits");
+    }
+}
+
+/*returns a ring released by a thread that exited, or NULL if there is none*/
+static GATEWAY_TRACE_RING* trace_take_over_ring(void)
+{
+    GATEWAY_TRACE_RING* result = NULL;
+    long ring_count = ATOMIC_READ(trace_ring_count);
+    long i;
+    if (ring_count > GATEWAY_TRACE_MAX_THREADS)
+    {
+        ring_count = GATEWAY_TRACE_MAX_THREADS;
+    }
+    for (i = 0; (result == NULL) && (i < ring_count); i++)
+    {
+        GATEWAY_TRACE_RING* ring = (GATEWAY_TRACE_RING*)ATOMIC_POINTER_READ(trace_rings[i]);
+        if ((ring != NULL) && (ATOMIC_COMPARE_EXCHANGE(ring->released, 0, 1) == 1))
+        {
+            /*the events of the thread that exited go*/
+            (void)ATOMIC_EXCHANGE(ring->full, 0);
+            (void)ATOMIC_EXCHANGE(ring->next, 0);
+            result = ring;
+        }
+    }
+    return result;
+}
+
+/*returns the ring of the calling thread, taking one over or creating it the
+first time the thread records an event; NULL if every slot is taken or malloc
+failed*/
+static GATEWAY_TRACE_RING* trace_thread_ring(void)
+{
+    GATEWAY_TRACE_RING* result = thread_ring;
+    if ((result == NULL) && (thread_ring_failed == 0))
+    {
+        if ((result = trace_take_over_ring()) == NULL)
+        {
+            long slot = ATOMIC_INCREMENT(trace_ring_count) - 1;
+            if (slot >= GATEWAY_TRACE_MAX_THREADS)
+            {
+                LogError("more than %d threads are tracing, this one is left out", GATEWAY_TRACE_MAX_THREADS);
+                thread_ring_failed = 1;
+            }
+            else if ((result = (GATEWAY_TRACE_RING*)malloc(sizeof(GATEWAY_TRACE_RING))) == NULL)
+            {
+                LogError("unable to allocate a trace ring");
+                thread_ring_failed = 1;
+            }
+            else
+            {
+                result->next = 0;
+                result->full = 0;
+                result->released = 0;
+                /*the rings are only taken over, never freed: a dump may need
+                the events of a thread that has exited*/
+                (void)ATOMIC_POINTER_EXCHANGE(trace_rings[slot], result);
+            }
+        }
+
+        if (result != NULL)
+        {
+            (void)ATOMIC_EXCHANGE(result->thread_id, ATOMIC_INCREMENT(trace_thread_count));
+            thread_ring = result;
+            trace_release_on_exit(result);
+        }
+    }
+    return result;
+}
+
+void GatewayTrace_Enable(void)
+{
+    int64_t now = (int64_t)trace_now_ns();
+    int64_t previous = ATOMIC_READ64(trace_start);
+    /*Codes_SRS_GATEWAY_TRACE_30_002: [ GatewayTrace_Enable shall leave the events recorded before the call out of the next dump. ]*/
+    /*there is no 64 bit exchange, adding the difference sets trace_start to now*/
+    (void)ATOMIC_ADD64(trace_start, now - previous);
+    /*Codes_SRS_GATEWAY_TRACE_30_001: [ GatewayTrace_Enable shall make GatewayTrace_Record record events. ]*/
+    (void)ATOMIC_EXCHANGE(trace_enabled, 1);
+}
+
+void GatewayTrace_Disable(void)
+{
+    /*Codes_SRS_GATEWAY_TRACE_30_003: [ GatewayTrace_Disable shall make GatewayTrace_Record ignore events and shall keep the events recorded so far. ]*/
+    (void)ATOMIC_EXCHANGE(trace_enabled, 0);
+}
+
+void GatewayTrace_Record(GATEWAY_TRACE_EVENT event, const void* object, const void* context)
+{
+    /*Codes_SRS_GATEWAY_TRACE_30_004: [ If the trace is disabled, GatewayTrace_Record shall do nothing. ]*/
+    if (trace_enabled != 0)
+    {
+        /*Codes_SRS_GATEWAY_TRACE_30_005: [ The first time a thread records an event, GatewayTrace_Record shall take over the ring released by a thread that exited or allocate a new one; if GATEWAY_TRACE_MAX_THREADS rings are in use or the allocation fails, the events of the thread shall be ignored. ]*/
+        GATEWAY_TRACE_RING* ring = trace_thread_ring();
+        if (ring != NULL)
+        {
+            /*Codes_SRS_GATEWAY_TRACE_30_006: [ GatewayTrace_Record shall write event, object, context and a monotonic timestamp in nanoseconds to the next entry of the ring of the thread, overwriting the oldest entry if the ring is full. ]*/
+            long next = ring->next;
+            GATEWAY_TRACE_ENTRY* entry = &(ring->entries[next]);
+            entry->timestamp = trace_now_ns();
+            entry->object = object;
+            entry->context = context;
+            entry->event = event;
+
+            next = (next + 1) & (GATEWAY_TRACE_RING_SIZE - 1);
+            if ((next == 0) && (ring->full == 0))
+            {
+                (void)ATOMIC_EXCHANGE(ring->full, 1);
+            }
+            (void)ATOMIC_EXCHANGE(ring->next, next);
+        }
+    }
+}
+
+/*writes one event, returns the number of characters written or a negative
+value if the write failed*/
+static int trace_write_entry(FILE* file, const GATEWAY_TRACE_ENTRY* entry, long thread_id, uint64_t start)
+{
+    int result;
+    uint64_t at = entry->timestamp - start;
+    const char* phase;
+    const char* scope = "";
+
+    /*Codes_SRS_GATEWAY_TRACE_30_009: [ Gateway_DumpTrace shall write the _BEGIN events with phase B, the _END events with phase E and the other events as thread scoped instants, with their timestamp in microseconds since GatewayTrace_Enable. ]*/
+    switch (entry->event)
+    {
+    case GATEWAY_TRACE_RECEIVE_BEGIN:
+    case GATEWAY_TRACE_SERIALIZE_BEGIN:
+    case GATEWAY_TRACE_DESERIALIZE_BEGIN:
+    case GATEWAY_TRACE_SEND_BEGIN:
+        phase = "B";
+        break;
+    case GATEWAY_TRACE_RECEIVE_END:
+    case GATEWAY_TRACE_SERIALIZE_END:
+    case GATEWAY_TRACE_DESERIALIZE_END:
+    case GATEWAY_TRACE_SEND_END:
+        phase = "E";
+        break;
+    default:
+        phase = "i";
+        scope = ",\"s\":\"t\"";
+        break;
+    }
+
+    /*ts is in microseconds, the fraction keeps the nanoseconds*/
+    result = fprintf(file,
+        ",\n{\"name\":\"%s\",\"cat\":\"gateway\",\"ph\":\"%s\"%s,\"ts\":%" PRIu64 ".%03u,\"pid\":1,\"tid\":%ld,\"args\":{\"object\":\"%p\",\"context\":\"%p\"}}",
+        trace_event_names[entry->event], phase, scope, at / 1000u, (unsigned int)(at % 1000u), thread_id, entry->object, entry->context);
+
+    if ((result >= 0) &&
+        ((entry->event == GATEWAY_TRACE_ENQUEUE) || (entry->event == GATEWAY_TRACE_DEQUEUE)))
+    {
+        /*Codes_SRS_GATEWAY_TRACE_30_010: [ Gateway_DumpTrace shall join an ENQUEUE and a DEQUEUE event with the same object and context with a flow event. ]*/
+        /*a flow from the enqueue of a message to its dequeue from the same mailbox*/
+        uintptr_t flow_id = (uintptr_t)entry->object ^ ((uintptr_t)entry->context << 1);
+        result = fprintf(file,
+            ",\n{\"name\":\"mailbox\",\"cat\":\"gateway\",\"ph\":\"%s\",\"bp\":\"e\",\"id\":\"%" PRIxPTR "\",\"ts\":%" PRIu64 ".%03u,\"pid\":1,\"tid\":%ld}",
+            (entry->event == GATEWAY_TRACE_ENQUEUE) ? "s" : "f", flow_id, at / 1000u, (unsigned int)(at % 1000u), thread_id);
+    }
+    return result;
+}
+
+int Gateway_DumpTrace(const char* file_path)
+{
+    int result;
+
+    if (file_path == NULL)
+    {
+        /*Codes_SRS_GATEWAY_TRACE_30_007: [ If file_path is NULL, Gateway_DumpTrace shall fail and return a non-zero value. ]*/
+        LogError("invalid parameter - file_path is NULL");
+        result = __LINE__;
+    }
+    else
+    {
+        FILE* file = fopen(file_path, "w");
+        if (file == NULL)
+        {
+            /*Codes_SRS_GATEWAY_TRACE_30_011: [ If the file cannot be opened or written, Gateway_DumpTrace shall fail and return a non-zero value. ]*/
+            LogError("unable to open %s to write the trace", file_path);
+            result = __LINE__;
+        }
+        else
+        {
+            uint64_t start = (uint64_t)ATOMIC_READ64(trace_start);
+            long ring_count = ATOMIC_READ(trace_ring_count);
+            int first = 1;
+            long i;
+
+            result = 0;
+            if (ring_count > GATEWAY_TRACE_MAX_THREADS)
+            {
+                ring_count = GATEWAY_TRACE_MAX_THREADS;
+            }
+
+            /*Codes_SRS_GATEWAY_TRACE_30_008: [ Gateway_DumpTrace shall write to file_path a JSON object with a traceEvents array holding a thread name event for every ring, then the events of the ring recorded since GatewayTrace_Enable, oldest first. ]*/
+            if (fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n") < 0)
+            {
+                result = __LINE__;
+            }
+
+            for (i = 0; (result == 0) && (i < ring_count); i++)
+            {
+                GATEWAY_TRACE_RING* ring = (GATEWAY_TRACE_RING*)ATOMIC_POINTER_READ(trace_rings[i]);
+                if (ring != NULL)
+                {
+                    long thread_id = ATOMIC_READ(ring->thread_id);
+                    long next = ATOMIC_READ(ring->next);
+                    long count = (ATOMIC_READ(ring->full) != 0) ? GATEWAY_TRACE_RING_SIZE : next;
+                    long j;
+
+                    if (fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%ld,\"args\":{\"name\":\"thread %ld\"}}",
+                        first ? "" : ",\n", thread_id, thread_id) < 0)
+                    {
+                        result = __LINE__;
+                    }
+                    first = 0;
+
+                    /*oldest first, so the slices of the thread pair up*/
+                    for (j = 0; (result == 0) && (j < count); j++)
+                    {
+                        const GATEWAY_TRACE_ENTRY* entry = &(ring->entries[(next - count + j) & (GATEWAY_TRACE_RING_SIZE - 1)]);
+                        if ((entry->timestamp >= start) &&
+                            (trace_write_entry(file, entry, thread_id, start) < 0))
+                        {
+                            result = __LINE__;
+                        }
+                    }
+                }
+            }
+
+            if ((result == 0) && (fprintf(file, "\n]}\n") < 0))
+            {
+                result = __LINE__;
+            }
+
+            if (fclose(file) != 0)
+            {
+                result = __LINE__;
+            }
+
+            /*Codes_SRS_GATEWAY_TRACE_30_012: [ Otherwise Gateway_DumpTrace shall return 0. ]*/
+            if (result != 0)
+            {
+                /*Codes_SRS_GATEWAY_TRACE_30_011: [ If the file cannot be opened or written, Gateway_DumpTrace shall fail and return a non-zero value. ]*/
+                LogError("unable to write the trace to %s", file_path);
+            }
+        }
+    }
+
+    return result;
+}
@@ -55,10 +55,14 @@ static THREAD_QUEUE_ROW* get_from_thread_queue(EVENTSYSTEM_HANDLE event_system,
 static void destroy_thread_row(THREAD_QUEUE_ROW* row);
 static int callback_thread_main_func(void* event_system_param);
 static GATEWAY_EVENT_CTX handle_module_list_update(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gateway, VECTOR_HANDLE callbacks);
+static GATEWAY_EVENT_CTX handle_metrics(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gateway, VECTOR_HANDLE callbacks);
 
 /** @brief This function assumes that the context is a #VECTOR_HANDLE and destroys it */
 static void callback_destroy_modulelist(GATEWAY_HANDLE gateway, GATEWAY_EVENT event_type, GATEWAY_EVENT_CTX context, void* user_param);
 
+/** @brief This function assumes that the context is a #VECTOR_HANDLE of metrics and destroys it */
+static void callback_destroy_metrics(GATEWAY_HANDLE gateway, GATEWAY_EVENT event_type, GATEWAY_EVENT_CTX context, void* user_param);
+
 EVENTSYSTEM_HANDLE EventSystem_Init(void)
 {
     /* Codes_SRS_EVENTSYSTEM_26_001: [ This function shall create EVENTSYSTEM_HANDLE representing the created event system. ] */
@@ -194,6 +198,9 @@ void EventSystem_ReportEvent(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gw,
                         case GATEWAY_MODULE_LIST_CHANGED:
                             context = handle_module_list_update(event_system, gw, call_queue);
                             break;
+                        case GATEWAY_METRICS:
+                            context = handle_metrics(event_system, gw, call_queue);
+                            break;
                         default:
                             break;
                         }
@@ -427,4 +434,35 @@ static GATEWAY_EVENT_CTX handle_module_list_update(EVENTSYSTEM_HANDLE event_syst
 static void callback_destroy_modulelist(GATEWAY_HANDLE gateway, GATEWAY_EVENT event_type, GATEWAY_EVENT_CTX context, void* user_param)
 {
     Gateway_DestroyModuleList((VECTOR_HANDLE)context);
-}
\ No newline at end of file
+}
+
+static GATEWAY_EVENT_CTX handle_metrics(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gateway, VECTOR_HANDLE callbacks)
+{
+    /* Codes_SRS_EVENTSYSTEM_30_001: [ This event shall provide `VECTOR_HANDLE` as returned from #Gateway_GetMetrics as the event context in callbacks ] */
+    VECTOR_HANDLE metrics = Gateway_GetMetrics(gateway);
+    if (metrics == NULL)
+    {
+        event_system->is_errored = 1;
+    }
+    else
+    {
+        CALLBACK_CLOSURE closure = {
+            callback_destroy_metrics,
+            NULL
+        };
+        /* Codes_SRS_EVENTSYSTEM_30_002: [ This event shall clean up the `VECTOR_HANDLE` of #Gateway_GetMetrics after finishing all the callbacks ] */
+        if (VECTOR_push_back(callbacks, &closure, 1) != 0)
+        {
+            LogError("Failed to push back during handling metrics event");
+            Gateway_DestroyMetrics(metrics);
+            event_system->is_errored = 1;
+            metrics = NULL;
+        }
+    }
+    return metrics;
+}
+
+static void callback_destroy_metrics(GATEWAY_HANDLE gateway, GATEWAY_EVENT event_type, GATEWAY_EVENT_CTX context, void* user_param)
+{
+    Gateway_DestroyMetrics((VECTOR_HANDLE)context);
+}
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <inttypes.h>
 #include "azure_c_shared_utility/gballoc.h"
 
@@ -13,28 +14,92 @@
 #include "azure_c_shared_utility/xlogging.h"
 
 #include "azure_c_shared_utility/refcount.h"
+#include "gateway_atomic.h"
+#include "gateway_trace.h"
+
+#include <nanomsg/nn.h>
 
 #define FIRST_MESSAGE_BYTE 0xA1  /*0xA1 comes from (A)zure (I)oT*/
 #define SECOND_MESSAGE_BYTE 0x60 /*0x60 comes from (G)ateway*/
 
 #define MIN_MESSAGE_BUFFER_LENGTH 14 /*14 is the minimum message length that is still valid*/
+#define MIN_PROPERTY_LENGTH 2 /*an empty name and an empty value, both null terminated*/
+
+/*a property of a message created from a byte array, name and value point
+inside the copy of the byte array that the message keeps*/
+typedef struct MESSAGE_PROPERTY_TAG
+{
+    const char* name;
+    const char* value;
+}MESSAGE_PROPERTY;
 
 typedef struct MESSAGE_HANDLE_DATA_TAG
 {
+    /*created on first use for a message created from a byte array*/
     CONSTMAP_HANDLE properties;
     CONSTBUFFER_HANDLE content;
+
+    /*the following are only set for a message created from a byte array. The
+    arena is a single allocation holding property_count properties sorted by
+    name followed by the byte array itself, which is also where the content
+    and the property strings are. A message created without copying has only
+    the properties in its arena and reads the rest from nn_buffer*/
+    void* arena;
+    const MESSAGE_PROPERTY* property_block;
+    size_t property_count;
+    const unsigned char* byte_array;
+    CONSTBUFFER byte_array_content;
+    void* nn_buffer;
+
+    /*set for a message created by Message_CreateDerived, which holds a
+    reference to it. The arena, property_block and property_count of such a
+    message are the properties it changes or removes (a NULL value), sorted by
+    name. Everything else is read from base*/
+    MESSAGE_HANDLE base;
+
+    /*properties of any other message sorted by name, pointing inside the
+    CONSTMAP. Built on the first Message_GetProperty*/
+    MESSAGE_PROPERTY* property_index;
+
+    /*size of the serialized message, 0 until it is first needed*/
+    volatile long serialized_size;
 }MESSAGE_HANDLE_DATA;
 
 DEFINE_REFCOUNT_TYPE(MESSAGE_HANDLE_DATA);
 
+static MESSAGE_HANDLE_DATA* create_message_data(void)
+{
+    MESSAGE_HANDLE_DATA* result = REFCOUNT_TYPE_CREATE(MESSAGE_HANDLE_DATA);
+    if (result == NULL)
+    {
+        LogError("malloc returned NULL");
+        /*return as is*/
+    }
+    else
+    {
+        result->properties = NULL;
+        result->content = NULL;
+        result->arena = NULL;
+        result->property_block = NULL;
+        result->property_count = 0;
+        result->byte_array = NULL;
+        result->byte_array_content.buffer = NULL;
+        result->byte_array_content.size = 0;
+        result->nn_buffer = NULL;
+        result->base = NULL;
+        result->property_index = NULL;
+        result->serialized_size = 0;
+    }
+    return result;
+}
+
 static MESSAGE_HANDLE_DATA* Message_CreateImpl(const MESSAGE_CONFIG * cfg)
 {
     MESSAGE_HANDLE_DATA* result;
     /*Codes_SRS_MESSAGE_02_006: [Otherwise, Message_Create shall return a non-NULL handle and shall set the internal ref count to "1".]*/
-    result = REFCOUNT_TYPE_CREATE(MESSAGE_HANDLE_DATA);
+    result = create_message_data();
     if (result == NULL)
     {
-        LogError("malloc returned NULL");
         /*return as is*/
     }
     else
@@ -118,10 +183,9 @@ MESSAGE_HANDLE Message_CreateFromBuffer(const MESSAGE_BUFFER_CONFIG* cfg)
     {
         /*Codes_SRS_MESSAGE_17_011: [If Message_CreateFromBuffer encounters an error while building the internal structures of the message, then it shall return NULL.]*/
         /*Codes_SRS_MESSAGE_17_014: [On success, Message_CreateFromBuffer shall return a non-NULL handle and set the internal ref count to "1".]*/
-        result = REFCOUNT_TYPE_CREATE(MESSAGE_HANDLE_DATA);
+        result = create_message_data();
         if (result == NULL)
         {
-            LogError("malloc returned NULL");
             /*return as is*/
         }
         else
@@ -148,7 +212,7 @@ MESSAGE_HANDLE Message_CreateFromBuffer(const MESSAGE_BUFFER_CONFIG* cfg)
                 else
                 {
                     /*all is fine, return as is.*/
-				}
+                }
             }
         }
     }
@@ -165,17 +229,138 @@ MESSAGE_HANDLE Message_Clone(MESSAGE_HANDLE message)
     else
     {
         /*Codes_SRS_MESSAGE_02_008: [Otherwise, Message_Clone shall increment the internal ref count.] */
+        /*Codes_SRS_MESSAGE_30_001: [ Message_Clone shall not clone the CONSTMAP nor the CONSTBUFFER of the message. ]*/
         INC_REF(MESSAGE_HANDLE_DATA, message);
-        MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
-        /*Codes_SRS_MESSAGE_17_001: [Message_Clone shall clone the CONSTMAP handle.]*/
-        (void)ConstMap_Clone(messageData->properties);
-        /*Codes_SRS_MESSAGE_17_004: [Message_Clone shall clone the CONSTBUFFER handle]*/
-        (void)CONSTBUFFER_Clone(messageData->content);
     }
     /*Codes_SRS_MESSAGE_02_010: [Message_Clone shall return messageHandle.]*/
     return message;
 }
 
+static int compare_properties(const void* left, const void* right)
+{
+    return strcmp(((const MESSAGE_PROPERTY*)left)->name, ((const MESSAGE_PROPERTY*)right)->name);
+}
+
+/*a derived message shares the content of the first message of its chain that
+is not derived*/
+static MESSAGE_HANDLE_DATA* get_root(MESSAGE_HANDLE_DATA* messageData)
+{
+    while (messageData->base != NULL)
+    {
+        messageData = (MESSAGE_HANDLE_DATA*)messageData->base;
+    }
+    return messageData;
+}
+
+static CONSTMAP_HANDLE get_properties_map(MESSAGE_HANDLE_DATA* messageData);
+
+/*creates a writeable map with the properties of a message that was created from
+a byte array or derived from another message*/
+static MAP_HANDLE create_properties_map(MESSAGE_HANDLE_DATA* messageData)
+{
+    MAP_HANDLE result;
+    if (messageData->base == NULL)
+    {
+        result = Map_Create(NULL);
+    }
+    else
+    {
+        CONSTMAP_HANDLE baseProperties = get_properties_map((MESSAGE_HANDLE_DATA*)messageData->base);
+        result = (baseProperties == NULL) ? NULL : ConstMap_CloneWriteable(baseProperties);
+    }
+
+    if (result == NULL)
+    {
+        LogError("failed to create a MAP_HANDLE");
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < messageData->property_count; i++)
+        {
+            const MESSAGE_PROPERTY* property = &messageData->property_block[i];
+            if (messageData->base == NULL)
+            {
+                if (Map_Add(result, property->name, property->value) != MAP_OK)
+                {
+                    LogError("Map_Add failed");
+                    break;
+                }
+            }
+            else if (property->value != NULL)
+            {
+                if (Map_AddOrUpdate(result, property->name, property->value) != MAP_OK)
+                {
+                    LogError("Map_AddOrUpdate failed");
+                    break;
+                }
+            }
+            else
+            {
+                MAP_RESULT deleted = Map_Delete(result, property->name);
+                if (
+                    (deleted != MAP_OK) &&
+                    (deleted != MAP_KEYNOTFOUND)
+                    )
+                {
+                    LogError("Map_Delete failed");
+                    break;
+                }
+            }
+        }
+
+        if (i != messageData->property_count)
+        {
+            Map_Destroy(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+/*returns the CONSTMAP of the message without cloning it. A message created
+from a byte array or derived from another message only builds it the first
+time it is asked for, several threads may race to do that and only the first
+one to finish wins*/
+static CONSTMAP_HANDLE get_properties_map(MESSAGE_HANDLE_DATA* messageData)
+{
+    CONSTMAP_HANDLE result = (CONSTMAP_HANDLE)ATOMIC_POINTER_READ(messageData->properties);
+    if (result == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_011: [ If the message was created by Message_CreateFromByteArray, Message_GetProperties shall build the CONSTMAP from the properties of the message the first time it is called. ]*/
+        /*Codes_SRS_MESSAGE_30_033: [ If the message was created by Message_CreateDerived, Message_GetProperties shall build the CONSTMAP the first time it is called, from a writeable clone of the properties of the original message with the overlay applied. ]*/
+        MAP_HANDLE map = create_properties_map(messageData);
+        if (map == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_012: [ If building the CONSTMAP fails, Message_GetProperties shall fail and return NULL. ]*/
+            LogError("failed to build the properties of the message");
+        }
+        else
+        {
+            CONSTMAP_HANDLE properties = ConstMap_Create(map);
+            if (properties == NULL)
+            {
+                LogError("ConstMap_Create failed");
+            }
+            else
+            {
+                result = (CONSTMAP_HANDLE)ATOMIC_POINTER_COMPARE_EXCHANGE(messageData->properties, properties, NULL);
+                if (result == NULL)
+                {
+                    result = properties;
+                }
+                else
+                {
+                    /*another thread was first*/
+                    ConstMap_Destroy(properties);
+                }
+            }
+            Map_Destroy(map);
+        }
+    }
+    return result;
+}
+
 CONSTMAP_HANDLE Message_GetProperties(MESSAGE_HANDLE message)
 {
     CONSTMAP_HANDLE result;
@@ -187,9 +372,133 @@ CONSTMAP_HANDLE Message_GetProperties(MESSAGE_HANDLE message)
     }
     else
     {
-        /*Codes_SRS_MESSAGE_02_012: [Otherwise, Message_GetProperties shall shall clone and return the CONSTMAP handle representing the properties of the message.]*/
+        CONSTMAP_HANDLE properties = get_properties_map((MESSAGE_HANDLE_DATA*)message);
+        if (properties == NULL)
+        {
+            result = NULL;
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_02_012: [Otherwise, Message_GetProperties shall shall clone and return the CONSTMAP handle representing the properties of the message.]*/
+            result = ConstMap_Clone(properties);
+        }
+    }
+    return result;
+}
+
+/*returns the properties of the message sorted by name, building the index of
+a message that was not created from a byte array the first time. Returns NULL
+(and 0 in *count) when the message has no properties or on failure*/
+static const MESSAGE_PROPERTY* get_sorted_properties(MESSAGE_HANDLE_DATA* messageData, size_t* count)
+{
+    const MESSAGE_PROPERTY* result;
+    if (messageData->byte_array != NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_023: [ If the message was created by Message_CreateFromByteArray or Message_CreateFromByteArrayNoCopy, Message_GetProperty shall binary search the sorted properties of the message. ]*/
+        result = messageData->property_block;
+        *count = messageData->property_count;
+    }
+    else
+    {
+        const char* const* keys;
+        const char* const* values;
+        size_t nProperties;
+        /*Codes_SRS_MESSAGE_30_024: [ Otherwise Message_GetProperty shall get the properties from the CONSTMAP by calling ConstMap_GetInternals. ]*/
+        if (ConstMap_GetInternals(messageData->properties, &keys, &values, &nProperties) != CONSTMAP_OK)
+        {
+            /*Codes_SRS_MESSAGE_30_026: [ If any of the above steps fails, Message_GetProperty shall return NULL. ]*/
+            LogError("unable to get the properties of the message");
+            result = NULL;
+            *count = 0;
+        }
+        else if (nProperties == 0)
+        {
+            result = NULL;
+            *count = 0;
+        }
+        else
+        {
+            result = (const MESSAGE_PROPERTY*)ATOMIC_POINTER_READ(messageData->property_index);
+            if (result == NULL)
+            {
+                /*Codes_SRS_MESSAGE_30_025: [ The first time it is called for a message with properties, Message_GetProperty shall build an index of the properties sorted by name, the following calls shall reuse it. ]*/
+                MESSAGE_PROPERTY* index = (MESSAGE_PROPERTY*)malloc(nProperties * sizeof(MESSAGE_PROPERTY));
+                if (index == NULL)
+                {
+                    /*Codes_SRS_MESSAGE_30_026: [ If any of the above steps fails, Message_GetProperty shall return NULL. ]*/
+                    LogError("unable to allocate the index of %d properties", (int)nProperties);
+                }
+                else
+                {
+                    size_t i;
+                    for (i = 0; i < nProperties; i++)
+                    {
+                        index[i].name = keys[i];
+                        index[i].value = values[i];
+                    }
+                    qsort(index, nProperties, sizeof(MESSAGE_PROPERTY), compare_properties);
+
+                    result = (const MESSAGE_PROPERTY*)ATOMIC_POINTER_COMPARE_EXCHANGE(messageData->property_index, index, NULL);
+                    if (result == NULL)
+                    {
+                        result = index;
+                    }
+                    else
+                    {
+                        /*another thread was first*/
+                        free(index);
+                    }
+                }
+            }
+            *count = (result == NULL) ? 0 : nProperties;
+        }
+    }
+    return result;
+}
+
+const char* Message_GetProperty(MESSAGE_HANDLE message, const char* key)
+{
+    const char* result;
+    /*Codes_SRS_MESSAGE_30_022: [ If message or key is NULL then Message_GetProperty shall return NULL. ]*/
+    if (
+        (message == NULL) ||
+        (key == NULL)
+        )
+    {
+        LogError("invalid arg: message=%p key=%p", message, key);
+        result = NULL;
+    }
+    else
+    {
         MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
-        result = ConstMap_Clone(messageData->properties);
+        MESSAGE_PROPERTY wanted;
+        const MESSAGE_PROPERTY* found = NULL;
+        wanted.name = key;
+        wanted.value = NULL;
+
+        /*Codes_SRS_MESSAGE_30_034: [ If the message was created by Message_CreateDerived, Message_GetProperty shall look for key in the overlay of the message first and then in the original message, without building the CONSTMAP of the message. ]*/
+        while (
+            (messageData->base != NULL) &&
+            (found == NULL)
+            )
+        {
+            found = (messageData->property_count == 0) ? NULL :
+                (const MESSAGE_PROPERTY*)bsearch(&wanted, messageData->property_block, messageData->property_count, sizeof(MESSAGE_PROPERTY), compare_properties);
+            messageData = (MESSAGE_HANDLE_DATA*)messageData->base;
+        }
+
+        if (found == NULL)
+        {
+            size_t count;
+            const MESSAGE_PROPERTY* properties = get_sorted_properties(messageData, &count);
+            if (properties != NULL)
+            {
+                found = (const MESSAGE_PROPERTY*)bsearch(&wanted, properties, count, sizeof(MESSAGE_PROPERTY), compare_properties);
+            }
+        }
+
+        /*Codes_SRS_MESSAGE_30_027: [ Message_GetProperty shall return the value of the property named key, or NULL if there is no such property. ]*/
+        result = (found == NULL) ? NULL : found->value;
     }
     return result;
 }
@@ -205,14 +514,24 @@ const CONSTBUFFER * Message_GetContent(MESSAGE_HANDLE message)
     }
     else
     {
-        /*Codes_SRS_MESSAGE_02_014: [Otherwise, Message_GetContent shall return a non-NULL const pointer to a structure of type MESSAGE_CONTENT.]*/
-        /*Codes_SRS_MESSAGE_02_016: [The CONSTBUFFER's field buffer shall compare equal byte-by-byte to the cfg's field source.]*/
-        result = CONSTBUFFER_GetContent(((MESSAGE_HANDLE_DATA*)message)->content);
+        /*Codes_SRS_MESSAGE_30_035: [ If the message was created by Message_CreateDerived, Message_GetContent and Message_GetContentHandle shall return the content of the original message. ]*/
+        MESSAGE_HANDLE_DATA* messageData = get_root((MESSAGE_HANDLE_DATA*)message);
+        if (messageData->byte_array != NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_013: [ If the message was created by Message_CreateFromByteArray, Message_GetContent shall return the content as it is in the byte array the message keeps. ]*/
+            result = &messageData->byte_array_content;
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_02_014: [Otherwise, Message_GetContent shall return a non-NULL const pointer to a structure of type MESSAGE_CONTENT.]*/
+            /*Codes_SRS_MESSAGE_02_016: [The CONSTBUFFER's field buffer shall compare equal byte-by-byte to the cfg's field source.]*/
+            result = CONSTBUFFER_GetContent(messageData->content);
+        }
     }
     return result;
 }
 
-CONSTBUFFER_HANDLE Message_GetContentHandle(MESSAGE_HANDLE message) 
+CONSTBUFFER_HANDLE Message_GetContentHandle(MESSAGE_HANDLE message)
 {
     CONSTBUFFER_HANDLE result;
     if (message == NULL)
@@ -223,8 +542,42 @@ CONSTBUFFER_HANDLE Message_GetContentHandle(MESSAGE_HANDLE message)
     }
     else
     {
-        /*Codes_SRS_MESSAGE_17_007: [Otherwise, Message_GetContentHandle shall shall clone and return the CONSTBUFFER_HANDLE representing the message content.]*/
-        result = CONSTBUFFER_Clone(((MESSAGE_HANDLE_DATA*)message)->content);
+        /*Codes_SRS_MESSAGE_30_035: [ If the message was created by Message_CreateDerived, Message_GetContent and Message_GetContentHandle shall return the content of the original message. ]*/
+        MESSAGE_HANDLE_DATA* messageData = get_root((MESSAGE_HANDLE_DATA*)message);
+        CONSTBUFFER_HANDLE content = (CONSTBUFFER_HANDLE)ATOMIC_POINTER_READ(messageData->content);
+        if (content == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_014: [ If the message was created by Message_CreateFromByteArray, Message_GetContentHandle shall copy the content to a CONSTBUFFER the first time it is called. ]*/
+            CONSTBUFFER_HANDLE copy = CONSTBUFFER_Create(messageData->byte_array_content.buffer, messageData->byte_array_content.size);
+            if (copy == NULL)
+            {
+                /*Codes_SRS_MESSAGE_30_015: [ If copying the content fails, Message_GetContentHandle shall fail and return NULL. ]*/
+                LogError("CONSTBUFFER_Create failed");
+            }
+            else
+            {
+                content = (CONSTBUFFER_HANDLE)ATOMIC_POINTER_COMPARE_EXCHANGE(messageData->content, copy, NULL);
+                if (content == NULL)
+                {
+                    content = copy;
+                }
+                else
+                {
+                    /*another thread was first*/
+                    CONSTBUFFER_Destroy(copy);
+                }
+            }
+        }
+
+        if (content == NULL)
+        {
+            result = NULL;
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_17_007: [Otherwise, Message_GetContentHandle shall shall clone and return the CONSTBUFFER_HANDLE representing the message content.]*/
+            result = CONSTBUFFER_Clone(content);
+        }
     }
     return result;
 }
@@ -238,14 +591,38 @@ void Message_Destroy(MESSAGE_HANDLE message)
     }
     else
     {
-        MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
-        /*Codes_SRS_MESSAGE_17_002: [Message_Destroy shall destroy the CONSTMAP properties.]*/
-        ConstMap_Destroy(messageData->properties);
-        /*Codes_SRS_MESSAGE_17_005: [Message_Destroy shall destroy the CONSTBUFFER.]*/
-        CONSTBUFFER_Destroy(messageData->content);
         /*Codes_SRS_MESSAGE_02_020: [Otherwise, Message_Destroy shall decrement the internal ref count of the message.]*/
         if (DEC_REF(MESSAGE_HANDLE_DATA, message) == DEC_RETURN_ZERO)
         {
+            MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
+            /*Codes_SRS_MESSAGE_17_002: [If the ref count is zero then Message_Destroy shall destroy the CONSTMAP properties.]*/
+            if (messageData->properties != NULL)
+            {
+                ConstMap_Destroy(messageData->properties);
+            }
+            /*Codes_SRS_MESSAGE_17_005: [If the ref count is zero then Message_Destroy shall destroy the CONSTBUFFER.]*/
+            if (messageData->content != NULL)
+            {
+                CONSTBUFFER_Destroy(messageData->content);
+            }
+            if (messageData->arena != NULL)
+            {
+                free(messageData->arena);
+            }
+            if (messageData->property_index != NULL)
+            {
+                free(messageData->property_index);
+            }
+            /*Codes_SRS_MESSAGE_30_021: [ If the ref count is zero and the message was created by Message_CreateFromByteArrayNoCopy then Message_Destroy shall call nn_freemsg on the buffer of the message. ]*/
+            if (messageData->nn_buffer != NULL)
+            {
+                (void)nn_freemsg(messageData->nn_buffer);
+            }
+            /*Codes_SRS_MESSAGE_30_036: [ If the ref count is zero and the message was created by Message_CreateDerived then Message_Destroy shall call Message_Destroy on the original message. ]*/
+            if (messageData->base != NULL)
+            {
+                Message_Destroy(messageData->base);
+            }
             /*Codes_SRS_MESSAGE_02_021: [If the ref count is zero then the allocated resources are freed.]*/
             free(message);
         }
@@ -268,11 +645,11 @@ static int parse_int32_t(const unsigned char* source, int32_t sourceSize, int32_
     else
     {
         *parsed = 4;
-        *value = 
-            (source[position + 0] << 24) |
-            (source[position + 1] << 16) |
-            (source[position + 2] <<  8) |
-            (source[position + 3]);
+        *value = (int32_t)(
+            ((uint32_t)source[position + 0] << 24) |
+            ((uint32_t)source[position + 1] << 16) |
+            ((uint32_t)source[position + 2] <<  8) |
+            ((uint32_t)source[position + 3]));
         result = 0;
     }
     return result;
@@ -282,7 +659,7 @@ static int parse_null_terminated_const_char(const unsigned char* source, int32_t
 {
     int result;
     const unsigned char* whereIsnull = (unsigned char*)memchr(source + position, '\0', sourceSize - position);
-    
+
     if (whereIsnull == NULL)
     {
         /*Codes_SRS_MESSAGE_02_025: [ If while parsing the message content, a read would occur past the end of the array (as indicated by size) then Message_CreateFromByteArray shall fail and return NULL. ]*/
@@ -298,10 +675,98 @@ static int parse_null_terminated_const_char(const unsigned char* source, int32_t
     return result;
 }
 
-/*creates a MESSAGE_HANDLE from a serialized byte array*/
-MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t size)
+/*parses the properties and the content of the byte array starting at position
+10 (after the header, the size and the number of properties). The property
+block is filled in and sorted by name. Returns 0 on success*/
+static int parse_properties_and_content(const unsigned char* byteArray, int32_t size, MESSAGE_PROPERTY* propertyBlock, int32_t propertiesCount, CONSTBUFFER* content)
 {
-    MESSAGE_HANDLE_DATA* result;
+    int result;
+    int32_t currentPosition = 10; /*current position is always the first character that "we are about to look at"*/
+    int32_t parsed; /*reused in all parsings*/
+    int32_t i;
+
+    for (i = 0; i < propertiesCount; i++)
+    {
+        if (parse_null_terminated_const_char(byteArray, size, currentPosition, &parsed, &propertyBlock[i].name) != 0)
+        {
+            LogError("unable to parse the name string of the property");
+            break;
+        }
+        else
+        {
+            currentPosition += parsed;
+            if (parse_null_terminated_const_char(byteArray, size, currentPosition, &parsed, &propertyBlock[i].value) != 0)
+            {
+                LogError("unable to parse the value string of the property");
+                break;
+            }
+            else
+            {
+                currentPosition += parsed;
+            }
+        }
+    }
+
+    if (i != propertiesCount)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        int32_t messageContentSize;
+        if (parse_int32_t(byteArray, size, currentPosition, &parsed, &messageContentSize) != 0)
+        {
+            LogError("no space to read the number of bytes making the message");
+            result = __LINE__;
+        }
+        else
+        {
+            currentPosition += parsed;
+            if (currentPosition + messageContentSize != size)
+            {
+                LogError("the message content doesn't up to the message size %" PRId32 " %" PRId32 "", (int32_t)(currentPosition + messageContentSize), size);
+                result = __LINE__;
+            }
+            else
+            {
+                /*Codes_SRS_MESSAGE_30_003: [ The properties shall be sorted by name. ]*/
+                if (propertiesCount > 1)
+                {
+                    qsort(propertyBlock, propertiesCount, sizeof(MESSAGE_PROPERTY), compare_properties);
+                }
+
+                for (i = 1; i < propertiesCount; i++)
+                {
+                    if (strcmp(propertyBlock[i - 1].name, propertyBlock[i].name) == 0)
+                    {
+                        break;
+                    }
+                }
+
+                if (i < propertiesCount)
+                {
+                    /*Codes_SRS_MESSAGE_30_004: [ If two properties have the same name then Message_CreateFromByteArray shall fail and return NULL. ]*/
+                    LogError("property %s appears more than once", propertyBlock[i].name);
+                    result = __LINE__;
+                }
+                else
+                {
+                    content->buffer = (messageContentSize == 0) ? NULL : byteArray + currentPosition;
+                    content->size = (size_t)messageContentSize;
+                    result = 0;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/*checks the header, the size and the number of properties of a serialized
+message. Returns 0 and the number of properties when the byte array can be
+parsed further*/
+static int validate_byte_array(const unsigned char* source, int32_t size, int32_t* propertiesCount)
+{
+    int result;
     /*Codes_SRS_MESSAGE_02_022: [ If source is NULL then Message_CreateFromByteArray shall fail and return NULL. ]*/
     /*Codes_SRS_MESSAGE_02_023: [ If source is not NULL and and size parameter is smaller than 14 then Message_CreateFromByteArray shall fail and return NULL. ]*/
     if (
@@ -310,163 +775,366 @@ MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t
         )
     {
         LogError("invalid parameter source=[%p] size=%" PRId32, source, size);
-        result = NULL;
+        result = __LINE__;
+    }
+    /*Codes_SRS_MESSAGE_02_024: [ If the first two bytes of source are not 0xA1 0x60 then Message_CreateFromByteArray shall fail and return NULL. ]*/
+    else if (
+        (source[0] != FIRST_MESSAGE_BYTE) ||
+        (source[1] != SECOND_MESSAGE_BYTE)
+        )
+    {
+        LogError("byte array is not a gateway message serialization");
+        result = __LINE__;
     }
     else
     {
-        /*Codes_SRS_MESSAGE_02_024: [ If the first two bytes of source are not 0xA1 0x60 then Message_CreateFromByteArray shall fail and return NULL. ]*/
-        if (
-            (source[0] != FIRST_MESSAGE_BYTE) ||
-            (source[1] != SECOND_MESSAGE_BYTE)
+        int32_t parsed;
+        int32_t messageSize;
+        /*size is at least 14, both int32_t can be parsed*/
+        (void)parse_int32_t(source, size, 2, &parsed, &messageSize);
+        (void)parse_int32_t(source, size, 6, &parsed, propertiesCount);
+
+        /*Codes_SRS_MESSAGE_02_037: [ If the size embedded in the message is not the same as size parameter then Message_CreateFromByteArray shall fail and return NULL. ]*/
+        if (messageSize != size)
+        {
+            LogError("message size is inconsistent");
+            result = __LINE__;
+        }
+        else if (
+            (*propertiesCount < 0) ||
+            (*propertiesCount > (size - MIN_MESSAGE_BUFFER_LENGTH) / MIN_PROPERTY_LENGTH)
             )
         {
-            LogError("byte array is not a gateway message serialization");
+            /*Codes_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
+            LogError("invalid message detected with wrong number of properties =%" PRId32, *propertiesCount);
+            result = __LINE__;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+    return result;
+}
+
+/*creates a MESSAGE_HANDLE from a serialized byte array*/
+MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t size)
+{
+    MESSAGE_HANDLE_DATA* result;
+    int32_t propertiesCount;
+    GATEWAY_TRACE(GATEWAY_TRACE_DESERIALIZE_BEGIN, source, NULL);
+    if (validate_byte_array(source, size, &propertiesCount) != 0)
+    {
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_002: [ Message_CreateFromByteArray shall copy source to a single allocation that also holds an array with an entry for every property. ]*/
+        size_t blockSize = (size_t)propertiesCount * sizeof(MESSAGE_PROPERTY);
+        void* arena = malloc(blockSize + (size_t)size);
+        if (arena == NULL)
+        {
+            /*Codes_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
+            LogError("unable to allocate %d bytes for the message", (int)(blockSize + size));
+            result = NULL;
+        }
+        else
+        {
+            MESSAGE_PROPERTY* propertyBlock = (MESSAGE_PROPERTY*)arena;
+            unsigned char* byteArray = (unsigned char*)arena + blockSize;
+            CONSTBUFFER content;
+            (void)memcpy(byteArray, source, size);
+
+            /*Codes_SRS_MESSAGE_30_005: [ The names and the values of the properties and the content of the message shall point inside the copy of source. ]*/
+            if (parse_properties_and_content(byteArray, size, propertyBlock, propertiesCount, &content) != 0)
+            {
+                /*Codes_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
+                free(arena);
+                result = NULL;
+            }
+            else
+            {
+                /*Codes_SRS_MESSAGE_02_031: [ Otherwise Message_CreateFromByteArray shall succeed and return a non-NULL handle. ]*/
+                result = create_message_data();
+                if (result == NULL)
+                {
+                    free(arena);
+                }
+                else
+                {
+                    /*Codes_SRS_MESSAGE_30_006: [ Message_CreateFromByteArray shall not create the CONSTMAP and the CONSTBUFFER of the message. ]*/
+                    result->arena = arena;
+                    result->property_block = propertyBlock;
+                    result->property_count = (size_t)propertiesCount;
+                    result->byte_array = byteArray;
+                    result->byte_array_content = content;
+                    result->serialized_size = size;
+                }
+            }
+        }
+    }
+    GATEWAY_TRACE(GATEWAY_TRACE_DESERIALIZE_END, source, result);
+    return (MESSAGE_HANDLE)result;
+}
+
+/*creates a MESSAGE_HANDLE that takes ownership of a nanomsg buffer holding a serialized message*/
+MESSAGE_HANDLE Message_CreateFromByteArrayNoCopy(unsigned char* source, int32_t size)
+{
+    MESSAGE_HANDLE_DATA* result;
+    int32_t propertiesCount;
+    GATEWAY_TRACE(GATEWAY_TRACE_DESERIALIZE_BEGIN, source, NULL);
+    /*Codes_SRS_MESSAGE_30_016: [ Message_CreateFromByteArrayNoCopy shall validate source the same way as Message_CreateFromByteArray and shall fail and return NULL if source is not a valid serialization. ]*/
+    if (validate_byte_array(source, size, &propertiesCount) != 0)
+    {
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_017: [ Message_CreateFromByteArrayNoCopy shall allocate an array with an entry for every property and shall not copy source. ]*/
+        size_t blockSize = (size_t)propertiesCount * sizeof(MESSAGE_PROPERTY);
+        MESSAGE_PROPERTY* propertyBlock = (blockSize == 0) ? NULL : (MESSAGE_PROPERTY*)malloc(blockSize);
+        CONSTBUFFER content;
+        if ((blockSize != 0) && (propertyBlock == NULL))
+        {
+            /*Codes_SRS_MESSAGE_30_020: [ If any of the above steps fails, then Message_CreateFromByteArrayNoCopy shall fail, return NULL and shall not free source. ]*/
+            LogError("unable to allocate %d bytes for the properties", (int)blockSize);
+            result = NULL;
+        }
+        /*Codes_SRS_MESSAGE_30_018: [ The names and the values of the properties and the content of the message shall point inside source. ]*/
+        else if (parse_properties_and_content(source, size, propertyBlock, propertiesCount, &content) != 0)
+        {
+            /*Codes_SRS_MESSAGE_30_020: [ If any of the above steps fails, then Message_CreateFromByteArrayNoCopy shall fail, return NULL and shall not free source. ]*/
+            if (propertyBlock != NULL)
+            {
+                free(propertyBlock);
+            }
+            result = NULL;
+        }
+        else
+        {
+            result = create_message_data();
+            if (result == NULL)
+            {
+                /*Codes_SRS_MESSAGE_30_020: [ If any of the above steps fails, then Message_CreateFromByteArrayNoCopy shall fail, return NULL and shall not free source. ]*/
+                if (propertyBlock != NULL)
+                {
+                    free(propertyBlock);
+                }
+            }
+            else
+            {
+                /*Codes_SRS_MESSAGE_30_019: [ Otherwise Message_CreateFromByteArrayNoCopy shall succeed, take ownership of source and return a non-NULL handle. ]*/
+                result->arena = propertyBlock;
+                result->property_block = propertyBlock;
+                result->property_count = (size_t)propertiesCount;
+                result->byte_array = source;
+                result->byte_array_content = content;
+                result->nn_buffer = source;
+                result->serialized_size = size;
+            }
+        }
+    }
+    GATEWAY_TRACE(GATEWAY_TRACE_DESERIALIZE_END, source, result);
+    return (MESSAGE_HANDLE)result;
+}
+
+/*creates a MESSAGE_HANDLE that shares the content and the properties of
+original, except for the properties in overlay*/
+MESSAGE_HANDLE Message_CreateDerived(MESSAGE_HANDLE original, const MESSAGE_PROPERTY_OVERLAY* overlay, size_t overlaySize)
+{
+    MESSAGE_HANDLE_DATA* result;
+    size_t i;
+    /*Codes_SRS_MESSAGE_30_028: [ If original is NULL, or overlay is NULL and overlaySize is not zero, then Message_CreateDerived shall fail and return NULL. ]*/
+    if (
+        (original == NULL) ||
+        ((overlay == NULL) && (overlaySize != 0))
+        )
+    {
+        LogError("invalid arg: original=%p overlay=%p overlaySize=%d", original, overlay, (int)overlaySize);
+        result = NULL;
+    }
+    else
+    {
+        size_t arenaSize = overlaySize * sizeof(MESSAGE_PROPERTY);
+        for (i = 0; i < overlaySize; i++)
+        {
+            if (overlay[i].name == NULL)
+            {
+                break;
+            }
+            else
+            {
+                arenaSize += strlen(overlay[i].name) + 1;
+                if (overlay[i].value != NULL)
+                {
+                    arenaSize += strlen(overlay[i].value) + 1;
+                }
+            }
+        }
+
+        if (i != overlaySize)
+        {
+            /*Codes_SRS_MESSAGE_30_029: [ If the name of any entry of overlay is NULL then Message_CreateDerived shall fail and return NULL. ]*/
+            LogError("invalid arg: name of overlay entry %d is NULL", (int)i);
             result = NULL;
         }
         else
         {
-            int32_t currentPosition = 2; /*current position is always the first character that "we are about to look at"*/
-			int32_t parsed; /*reused in all parsings*/
-			int32_t messageSize;
-			/*Codes_SRS_MESSAGE_02_037: [ If the size embedded in the message is not the same as size parameter then Message_CreateFromByteArray shall fail and return NULL. ]*/
-			if (parse_int32_t(source, size, currentPosition, &parsed, &messageSize) != 0)
-			{
-				LogError("unable to parse an int32_t");
-				result = NULL;
-			}
-			else
-			{
-				currentPosition += parsed;
-				if (messageSize != size)
-				{
-					LogError("message size is inconsistent");
-					result = NULL;
-				}
-				else
-				{
-					/*Codes_SRS_MESSAGE_02_026: [ A MAP_HANDLE shall be created. ]*/
-					MAP_HANDLE configMap = Map_Create(NULL);
-					if (configMap == NULL)
-					{
-						/*Codes_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
-						LogError("failed to create a MAP_HANDLE");
-						result = NULL;
-					}
-					else
-					{
-						/*add all the properties to the map*/
-						int32_t propertiesCount;
-						if (parse_int32_t(source, size, currentPosition, &parsed, &propertiesCount) != 0)
-						{
-							LogError("unable to parse an int32_t");
-							result = NULL;
-						}
-						else
-						{
-							currentPosition += parsed;
-
-							if (
-								(propertiesCount < 0) ||
-								(propertiesCount == INT32_MAX)
-								)
-							{
-								/*Codes_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
-								LogError("invalid message detected with wrong number of properties =%" PRId32, propertiesCount);
-								result = NULL;
-							}
-							else
-							{
-								int32_t i;
-
-								for (i = 0; i < propertiesCount; i++)
-								{
-									const char* keyName;
-									if (parse_null_terminated_const_char(source, size, currentPosition, &parsed, &keyName) != 0)
-									{
-										LogError("unable to parse the name string of the property");
-										break;
-									}
-									else
-									{
-										const char* keyValue;
-										currentPosition += parsed;
-										if (parse_null_terminated_const_char(source, size, currentPosition, &parsed, &keyValue) != 0)
-										{
-											LogError("unable to parse the name string of the property");
-											break;
-										}
-										else
-										{
-											currentPosition += parsed;
-											/*Codes_SRS_MESSAGE_02_027: [ All the properties of the byte array shall be added to the MAP_HANDLE. ]*/
-											if (Map_Add(configMap, keyName, keyValue) != MAP_OK)
-											{
-												LogError("Map_Add failed\n");
-												break;
-											}
-											else
-											{
-												/*all is fine, proceed to the next property*/
-											}
-										}
-									}
-								}
-
-								if (i != propertiesCount)
-								{
-									result = NULL;
-								}
-								else
-								{
-									/*all is fine*/
-									int32_t messageContentSize;
-
-									if (parse_int32_t(source, size, currentPosition, &parsed, &messageContentSize) != 0)
-									{
-										LogError("no space to read the number of bytes making the message");
-										result = NULL;
-									}
-									else
-									{
-										currentPosition += parsed;
-										if (currentPosition + messageContentSize != messageSize)
-										{
-											LogError("the message content doesn't up to the message size %" PRId32 " %" PRId32 "\n", (int32_t)(currentPosition + messageContentSize), messageSize);
-											result = NULL;
-										}
-										else
-										{
-											/*Codes_SRS_MESSAGE_02_028: [ A structure of type MESSAGE_CONFIG shall be populated with the MAP_HANDLE previously constructed and the message content ]*/
-											MESSAGE_CONFIG msgConfig = { (size_t)messageContentSize, source + currentPosition, configMap };
-
-											/*Codes_SRS_MESSAGE_02_029: [ A MESSAGE_HANDLE shall be constructed from the MESSAGE_CONFIG. ]*/
-											/*Codes_SRS_MESSAGE_02_031: [ Otherwise Message_CreateFromByteArray shall succeed and return a non-NULL handle. ]*/
-											result = Message_CreateImpl(&msgConfig);
-
-											/*return as is*/
-
-										}
-									}
-								}
-							}
-						}
-						Map_Destroy(configMap);
-					}
-				}
-			}
+            /*Codes_SRS_MESSAGE_30_030: [ Message_CreateDerived shall copy overlay to a single allocation holding the entries sorted by name and their strings. ]*/
+            void* arena = (overlaySize == 0) ? NULL : malloc(arenaSize);
+            if (
+                (overlaySize != 0) &&
+                (arena == NULL)
+                )
+            {
+                /*Codes_SRS_MESSAGE_30_032: [ If any of the above steps fails, then Message_CreateDerived shall fail and return NULL. ]*/
+                LogError("unable to allocate %d bytes for the overlay", (int)arenaSize);
+                result = NULL;
+            }
+            else
+            {
+                MESSAGE_PROPERTY* propertyBlock = (MESSAGE_PROPERTY*)arena;
+                char* strings = (char*)arena + overlaySize * sizeof(MESSAGE_PROPERTY);
+                for (i = 0; i < overlaySize; i++)
+                {
+                    size_t length = strlen(overlay[i].name) + 1;
+                    (void)memcpy(strings, overlay[i].name, length);
+                    propertyBlock[i].name = strings;
+                    strings += length;
+                    if (overlay[i].value == NULL)
+                    {
+                        propertyBlock[i].value = NULL;
+                    }
+                    else
+                    {
+                        length = strlen(overlay[i].value) + 1;
+                        (void)memcpy(strings, overlay[i].value, length);
+                        propertyBlock[i].value = strings;
+                        strings += length;
+                    }
+                }
+
+                if (overlaySize > 1)
+                {
+                    qsort(propertyBlock, overlaySize, sizeof(MESSAGE_PROPERTY), compare_properties);
+                }
+
+                for (i = 1; i < overlaySize; i++)
+                {
+                    if (strcmp(propertyBlock[i - 1].name, propertyBlock[i].name) == 0)
+                    {
+                        break;
+                    }
+                }
+
+                if (i < overlaySize)
+                {
+                    /*Codes_SRS_MESSAGE_30_031: [ If two entries of overlay have the same name then Message_CreateDerived shall fail and return NULL. ]*/
+                    LogError("property %s appears more than once in the overlay", propertyBlock[i].name);
+                    free(arena);
+                    result = NULL;
+                }
+                else
+                {
+                    result = create_message_data();
+                    if (result == NULL)
+                    {
+                        /*Codes_SRS_MESSAGE_30_032: [ If any of the above steps fails, then Message_CreateDerived shall fail and return NULL. ]*/
+                        if (arena != NULL)
+                        {
+                            free(arena);
+                        }
+                    }
+                    else
+                    {
+                        /*Codes_SRS_MESSAGE_30_038: [ Otherwise Message_CreateDerived shall call Message_Clone on original, shall not copy its properties nor its content, and shall return a non-NULL handle. ]*/
+                        result->arena = arena;
+                        result->property_block = propertyBlock;
+                        result->property_count = overlaySize;
+                        result->base = Message_Clone(original);
+                    }
+                }
+            }
         }
     }
     return (MESSAGE_HANDLE)result;
+}
+
+static void write_int32_t(unsigned char* buf, size_t position, size_t value)
+{
+    buf[position + 0] = (value >> 24) & 0xFF;
+    buf[position + 1] = (value >> 16) & 0xFF;
+    buf[position + 2] = (value >> 8) & 0xFF;
+    buf[position + 3] = value & 0xFF;
+}
+
+/*writes the message to buf as indicated in the implementation details, in a
+single pass over the properties. Stops and returns -1 as soon as something
+does not fit in size bytes*/
+static int32_t write_byte_array(const char* const* keys, const char* const* values, size_t nProperties, const CONSTBUFFER* messageContent, unsigned char* buf, int32_t size)
+{
+    int32_t result;
+    size_t currentPosition; /*always points to the byte we are about to write*/
+    size_t i;
 
+    /*a header formed of the following hex characters in this order: 0xA1 0x60*/
+    buf[0] = FIRST_MESSAGE_BYTE;
+    buf[1] = SECOND_MESSAGE_BYTE;
+    /*4 bytes in MSB order representing the number of properties*/
+    write_int32_t(buf, 6, nProperties);
+    /*for every property, 2 arrays of null terminated characters representing the name of the property and the value.*/
+    currentPosition = 10;
+    for (i = 0; i < nProperties; i++)
+    {
+        size_t nameLength = strlen(keys[i]) + 1;/*the +1 will take care of copying '\0' too*/
+        size_t valueLength = strlen(values[i]) + 1;/*the +1 will take care of copying '\0' too*/
+        if (currentPosition + nameLength + valueLength > (size_t)size)
+        {
+            break;
+        }
+        else
+        {
+            (void)memcpy(buf + currentPosition, keys[i], nameLength);
+            currentPosition += nameLength;
+            (void)memcpy(buf + currentPosition, values[i], valueLength);
+            currentPosition += valueLength;
+        }
+    }
+
+    if (
+        (i < nProperties) ||
+        (currentPosition + 4 + messageContent->size > (size_t)size)
+        )
+    {
+        /*Codes_SRS_MESSAGE_17_017: [ If buf is not NULL and size is less than the needed memory size, Message_ToByteArray shall return -1; ]*/
+        LogError("message won't fit in buffer of %d bytes", (int)size);
+        result = -1;
+    }
+    else
+    {
+        /*4 bytes in MSB order representing the number of bytes in the message content array*/
+        write_int32_t(buf, currentPosition, messageContent->size);
+        currentPosition += 4;
+        /*n bytes of message content follows.*/
+        if (messageContent->size > 0)
+        {
+            (void)memcpy(buf + currentPosition, messageContent->buffer, messageContent->size);
+            currentPosition += messageContent->size;
+        }
+        /*4 bytes in MSB order representing the total size of the byte array, known only now*/
+        write_int32_t(buf, 2, currentPosition);
+        result = (int32_t)currentPosition;
+    }
+    return result;
 }
 
 extern int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char* buf, int32_t size)
 {
     int32_t result;
-    if (messageHandle == NULL) 
+    if (messageHandle == NULL)
     {
         /*Codes_SRS_MESSAGE_02_032: [ If messageHandle is NULL then Message_ToByteArray shall fail and return -1. ]*/
-        LogError("invalid (NULL) messageHandle parameter detected", messageHandle, size);
+        LogError("invalid (NULL) messageHandle parameter detected");
         result = -1;
     }
     else if (
@@ -478,100 +1146,120 @@ extern int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char*
         LogError("Null buffer sent with a specific size buffer=[%p], size=[%d]", messageHandle, size);
         result = -1;
     }
+    else if (size < 0)
+    {
+        /*Codes_SRS_MESSAGE_30_010: [ If size is negative, Message_ToByteArray shall return -1. ]*/
+        LogError("invalid size=[%d]", size);
+        result = -1;
+    }
+    else if (
+        (size != 0) &&
+        (size < MIN_MESSAGE_BUFFER_LENGTH)
+        )
+    {
+        /*Codes_SRS_MESSAGE_30_039: [ If buf is not NULL and size is less than 14, the minimum message length, Message_ToByteArray shall return -1 without writing to buf. ]*/
+        LogError("buffer of %d bytes is shorter than any message", (int)size);
+        result = -1;
+    }
     else
     {
         MESSAGE_HANDLE_DATA* messageHandleData = (MESSAGE_HANDLE_DATA*)messageHandle;
+        /*Codes_SRS_MESSAGE_30_007: [ Message_ToByteArray shall remember the size of the byte array after it has been computed once. ]*/
+        long knownSize = ATOMIC_READ(messageHandleData->serialized_size);
 
-        /*Codes_SRS_MESSAGE_02_033: [Message_ToByteArray shall precompute the needed memory size.]*/
-        size_t byteArraySize =
-            + 2 /*header*/
-            + 4 /*total size of byte array*/
-            + 4 /*total number of properties*/
-            + 0 /*an unknown at this moment number of bytes for properties*/
-            + 4 /*number of bytes in messageContent*/
-            + 0 /*an unknown at this moment number of bytes for message content*/
-            ;
-        
-        const char* const * keys;
-        const char* const * values;
-        size_t nProperties;
-
-        /*Codes_SRS_MESSAGE_02_035: [ If any of the above steps fails then Message_ToByteArray shall fail and return -1. ]*/
-        if (ConstMap_GetInternals(messageHandleData->properties, &keys, &values, &nProperties) != CONSTMAP_OK)
+        if (
+            (size != 0) &&
+            (knownSize != 0) &&
+            (knownSize > size)
+            )
         {
-            LogError("failed to get the keys and values from the message properties");
+            /*Codes_SRS_MESSAGE_17_017: [ If buf is not NULL and size is less than the needed memory size, Message_ToByteArray shall return -1; ]*/
+            LogError("message is %d bytes, won't fit in buffer of %d bytes", (int)knownSize, (int)size);
             result = -1;
         }
+        else if (
+            (size == 0) &&
+            (knownSize != 0)
+            )
+        {
+            /*Codes_SRS_MESSAGE_17_016: [ If buf is NULL and size is equal to zero, Message_ToByteArray shall return the needed memory size. ]*/
+            result = (int32_t)knownSize;
+        }
+        else if (messageHandleData->byte_array != NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_008: [ If the message was created by Message_CreateFromByteArray, Message_ToByteArray shall copy the byte array the message keeps. ]*/
+            GATEWAY_TRACE(GATEWAY_TRACE_SERIALIZE_BEGIN, messageHandle, buf);
+            (void)memcpy(buf, messageHandleData->byte_array, knownSize);
+            result = (int32_t)knownSize;
+            GATEWAY_TRACE(GATEWAY_TRACE_SERIALIZE_END, messageHandle, buf);
+        }
         else
         {
-            size_t i;
-            for (i = 0;i < nProperties;i++)
-            {
-                /*add to the needed size the name and value of property i*/
-                byteArraySize += (strlen(keys[i]) + 1) + (strlen(values[i]) + 1);
-            }
+            const char* const * keys;
+            const char* const * values;
+            size_t nProperties;
 
-            const CONSTBUFFER* messageContent = CONSTBUFFER_GetContent(messageHandleData->content);
-            byteArraySize += messageContent->size;
-            
-            if (size == 0)
-            {
-                /*Codes_SRS_MESSAGE_17_016: [ If buf is NULL and size is equal to zero, Message_ToByteArray shall return the needed memory size. ]*/
-                result = byteArraySize;
-            }
-            else if (byteArraySize > (size_t)size)
+            /*Codes_SRS_MESSAGE_02_035: [ If any of the above steps fails then Message_ToByteArray shall fail and return -1. ]*/
+            /*Codes_SRS_MESSAGE_30_037: [ If the message was created by Message_CreateDerived, Message_ToByteArray shall serialize the CONSTMAP built by Message_GetProperties and the content of the original message. ]*/
+            CONSTMAP_HANDLE properties = get_properties_map(messageHandleData);
+            if (
+                (properties == NULL) ||
+                (ConstMap_GetInternals(properties, &keys, &values, &nProperties) != CONSTMAP_OK)
+                )
             {
-                /*Codes_SRS_MESSAGE_17_017: [ If buf is not NULL and size is less than the needed memory size, Message_ToByteArray shall return -1; ]*/
-                LogError("message is %u bytes, won't fit in buffer of %u bytes", byteArraySize, size);
+                LogError("failed to get the keys and values from the message properties");
                 result = -1;
             }
             else
             {
-                /*Codes_SRS_MESSAGE_02_034: [ Message_ToByteArray shall populate the memory with values as indicated in the implementation details. ]*/
-
-                size_t currentPosition; /*always points to the byte we are about to write*/
-                /*a header formed of the following hex characters in this order: 0xA1 0x60*/
-                buf[0] = FIRST_MESSAGE_BYTE;
-                buf[1] = SECOND_MESSAGE_BYTE;
-                /*4 bytes in MSB order representing the total size of the byte array. */
-                buf[2] = byteArraySize >> 24;
-                buf[3] = (byteArraySize >> 16) & 0xFF;
-                buf[4] = (byteArraySize >> 8) & 0xFF;
-                buf[5] = (byteArraySize) & 0xFF;
-                /*4 bytes in MSB order representing the number of properties*/
-                buf[6] = nProperties >> 24;
-                buf[7] = (nProperties >> 16) & 0xFF;
-                buf[8] = (nProperties >> 8) & 0xFF;
-                buf[9] = nProperties & 0xFF;
-                /*for every property, 2 arrays of null terminated characters representing the name of the property and the value.*/
-				currentPosition = 10;
-                for (i = 0;i < nProperties;i++)
+                const CONSTBUFFER* messageContent = Message_GetContent(messageHandle);
+                if (size == 0)
                 {
-                    size_t nameLength = strlen(keys[i]) + 1;/*the +1 will take care of copying '\0' too*/
-                    size_t valueLength = strlen(values[i]) + 1;/*the +1 will take care of copying '\0' too*/
-
-                    /*copy name*/
-                    memcpy(buf + currentPosition, keys[i], nameLength);
-                    currentPosition += nameLength;
-                    
-                    /*copy value*/
-                    memcpy(buf + currentPosition, values[i], valueLength);
-                    currentPosition += valueLength;
-                }
-
-                /*4 bytes in MSB order representing the number of bytes in the message content array*/
-                buf[currentPosition++] = (messageContent->size) >> 24;
-                buf[currentPosition++] = ((messageContent->size) >> 16) & 0xFF;
-                buf[currentPosition++] = ((messageContent->size) >> 8) & 0xFF;
-                buf[currentPosition++] = (messageContent->size) & 0xFF;
+                    /*Codes_SRS_MESSAGE_02_033: [ Message_ToByteArray shall precompute the needed memory size. ]*/
+                    size_t byteArraySize =
+                        + 2 /*header*/
+                        + 4 /*total size of byte array*/
+                        + 4 /*total number of properties*/
+                        + 4 /*number of bytes in messageContent*/
+                        + messageContent->size
+                        ;
+                    size_t i;
+                    for (i = 0; i < nProperties; i++)
+                    {
+                        /*add to the needed size the name and value of property i*/
+                        byteArraySize += (strlen(keys[i]) + 1) + (strlen(values[i]) + 1);
+                    }
 
-                /*n bytes of message content follows.*/
-                memcpy(buf + currentPosition, messageContent->buffer, messageContent->size);
+                    if (byteArraySize > INT32_MAX)
+                    {
+                        LogError("message is too big to be serialized");
+                        result = -1;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_MESSAGE_17_016: [ If buf is NULL and size is equal to zero, Message_ToByteArray shall return the needed memory size. ]*/
+                        result = (int32_t)byteArraySize;
+                    }
+                }
+                else
+                {
+                    /*Codes_SRS_MESSAGE_30_009: [ When the size of the byte array is not known yet, Message_ToByteArray shall compute it while it writes the byte array, in a single pass over the properties. ]*/
+                    /*Codes_SRS_MESSAGE_02_034: [ Message_ToByteArray shall populate the memory with values as indicated in the implementation details. ]*/
+                    GATEWAY_TRACE(GATEWAY_TRACE_SERIALIZE_BEGIN, messageHandle, buf);
+                    result = write_byte_array(keys, values, nProperties, messageContent, buf, size);
+                    GATEWAY_TRACE(GATEWAY_TRACE_SERIALIZE_END, messageHandle, buf);
+                }
 
-                /*Codes_SRS_MESSAGE_02_036: [ Otherwise Message_ToByteArray shall succeed, and return the byte array size. ]*/
-                result = byteArraySize;
+                if (
+                    (result > 0) &&
+                    (knownSize == 0)
+                    )
+                {
+                    (void)ATOMIC_COMPARE_EXCHANGE(messageHandleData->serialized_size, result, 0);
+                }
             }
         }
     }
+    /*Codes_SRS_MESSAGE_02_036: [ Otherwise Message_ToByteArray shall succeed, and return the byte array size. ]*/
     return result;
-}
\ No newline at end of file
+}
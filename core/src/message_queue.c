@@ -7,8 +7,14 @@
 #include "azure_c_shared_utility/xlogging.h"
 
 #include "azure_c_shared_utility/doublylinkedlist.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
 #include "message.h"
 #include "message_queue.h"
+#include "gateway_atomic.h"
+
+/*a concurrent queue holds at most this many messages in its ring*/
+#define MESSAGE_QUEUE_CAPACITY_MAX  0x40000000
 
 typedef struct MESSAGE_QUEUE_STORAGE_TAG
 {
@@ -16,9 +22,30 @@ typedef struct MESSAGE_QUEUE_STORAGE_TAG
     MESSAGE_HANDLE message;
 } MESSAGE_QUEUE_STORAGE;
 
+/*a slot of the ring of a concurrent queue, sequence tells whose turn it is:
+equal to the enqueue position when a producer may fill it, one past it once
+the message can be popped*/
+typedef struct MESSAGE_QUEUE_CELL_TAG
+{
+    volatile long sequence;
+    MESSAGE_HANDLE message;
+} MESSAGE_QUEUE_CELL;
+
 typedef struct MESSAGE_QUEUE_TAG
 {
     MESSAGE_QUEUE_STORAGE queue_head;
+    /*the rest is only used by a queue from MESSAGE_QUEUE_create_concurrent,
+    queue_head then holds the messages that did not fit in the ring*/
+    MESSAGE_QUEUE_CELL* cells;
+    long mask;
+    volatile long enqueue_position;
+    volatile long spilled;
+    volatile long waiting;
+    /*keeps the producers' and the consumer's positions on separate cache lines*/
+    unsigned char padding[64];
+    volatile long dequeue_position;
+    LOCK_HANDLE lock;
+    COND_HANDLE wake;
 } MESSAGE_QUEUE_HANDLE_DATA;
 
 static MESSAGE_HANDLE message_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
@@ -43,6 +70,154 @@ static MESSAGE_HANDLE message_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
     return result;
 }
 
+static bool ring_push(MESSAGE_QUEUE_HANDLE_DATA* handle, MESSAGE_HANDLE element)
+{
+    bool result;
+    long position = ATOMIC_READ(handle->enqueue_position);
+    for (;;)
+    {
+        MESSAGE_QUEUE_CELL* cell = &(handle->cells[position & handle->mask]);
+        long difference = (long)((unsigned long)ATOMIC_READ(cell->sequence) - (unsigned long)position);
+        if (difference == 0)
+        {
+            /*claim the cell, then publish the message in it*/
+            long next = (long)((unsigned long)position + 1);
+            long previous = ATOMIC_COMPARE_EXCHANGE(handle->enqueue_position, next, position);
+            if (previous == position)
+            {
+                cell->message = element;
+                (void)ATOMIC_EXCHANGE(cell->sequence, next);
+                result = true;
+                break;
+            }
+            position = previous;
+        }
+        else if (difference < 0)
+        {
+            /*the consumer has not freed the cell yet, the ring is full*/
+            result = false;
+            break;
+        }
+        else
+        {
+            position = ATOMIC_READ(handle->enqueue_position);
+        }
+    }
+    return result;
+}
+
+static MESSAGE_QUEUE_CELL* ring_front(MESSAGE_QUEUE_HANDLE_DATA* handle)
+{
+    long position = handle->dequeue_position;
+    MESSAGE_QUEUE_CELL* cell = &(handle->cells[position & handle->mask]);
+    return (ATOMIC_READ(cell->sequence) == (long)((unsigned long)position + 1)) ? cell : NULL;
+}
+
+static MESSAGE_HANDLE ring_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
+{
+    MESSAGE_HANDLE result;
+    MESSAGE_QUEUE_CELL* cell = ring_front(handle);
+    if (cell == NULL)
+    {
+        result = NULL;
+    }
+    else
+    {
+        long position = handle->dequeue_position;
+        result = cell->message;
+        /*hand the cell back to the producers for the next lap of the ring*/
+        (void)ATOMIC_EXCHANGE(cell->sequence, (long)((unsigned long)position + (unsigned long)handle->mask + 1));
+        (void)ATOMIC_EXCHANGE(handle->dequeue_position, (long)((unsigned long)position + 1));
+    }
+    return result;
+}
+
+/*the spilled messages were pushed after every message of the ring by the same
+producer, they are only looked at once no producer is filling the ring*/
+static bool spill_is_next(MESSAGE_QUEUE_HANDLE_DATA* handle)
+{
+    return (ATOMIC_READ(handle->spilled) != 0) &&
+        (ATOMIC_READ(handle->enqueue_position) == handle->dequeue_position);
+}
+
+/*the caller holds handle->lock*/
+static MESSAGE_HANDLE spill_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
+{
+    MESSAGE_HANDLE result = message_pop(handle);
+    if (DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head)))
+    {
+        (void)ATOMIC_EXCHANGE(handle->spilled, 0);
+    }
+    return result;
+}
+
+static MESSAGE_HANDLE concurrent_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
+{
+    MESSAGE_HANDLE result = ring_pop(handle);
+    if (result == NULL && spill_is_next(handle))
+    {
+        if (Lock(handle->lock) != LOCK_OK)
+        {
+            LogError("unable to lock the spilled messages");
+        }
+        else
+        {
+            result = spill_pop(handle);
+            (void)Unlock(handle->lock);
+        }
+    }
+    return result;
+}
+
+static int concurrent_push(MESSAGE_QUEUE_HANDLE_DATA* handle, MESSAGE_HANDLE element)
+{
+    int result;
+    /*Codes_SRS_MESSAGE_QUEUE_30_010: [ MESSAGE_QUEUE_push shall store the message in the ring of a concurrent queue without allocating memory. ]*/
+    if (ATOMIC_READ(handle->spilled) == 0 && ring_push(handle, element))
+    {
+        result = 0;
+    }
+    else if (Lock(handle->lock) != LOCK_OK)
+    {
+        LogError("unable to lock the spilled messages");
+        result = __LINE__;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_011: [ If the ring is full, MESSAGE_QUEUE_push shall append the message to a list protected by a lock, and keep doing so until the consumer has emptied the list. ]*/
+        MESSAGE_QUEUE_STORAGE* temp = (MESSAGE_QUEUE_STORAGE*)malloc(sizeof(MESSAGE_QUEUE_STORAGE));
+        if (temp == NULL)
+        {
+            LogError("malloc failed.");
+            result = __LINE__;
+        }
+        else
+        {
+            DList_InitializeListHead((PDLIST_ENTRY)temp);
+            temp->message = element;
+            DList_AppendTailList((PDLIST_ENTRY)&(handle->queue_head), (PDLIST_ENTRY)temp);
+            (void)ATOMIC_EXCHANGE(handle->spilled, 1);
+            result = 0;
+        }
+        (void)Unlock(handle->lock);
+    }
+
+    /*Codes_SRS_MESSAGE_QUEUE_30_012: [ MESSAGE_QUEUE_push shall wake the consumer if it waits in MESSAGE_QUEUE_pop_wait. ]*/
+    if (result == 0 && ATOMIC_READ(handle->waiting) != 0)
+    {
+        if (Lock(handle->lock) != LOCK_OK)
+        {
+            LogError("unable to lock the queue to wake the consumer");
+        }
+        else
+        {
+            (void)Condition_Post(handle->wake);
+            (void)Unlock(handle->lock);
+        }
+    }
+    return result;
+}
+
 MESSAGE_QUEUE_HANDLE MESSAGE_QUEUE_create()
 {
 	MESSAGE_QUEUE_HANDLE_DATA* result;
@@ -59,6 +234,73 @@ MESSAGE_QUEUE_HANDLE MESSAGE_QUEUE_create()
         /*Codes_SRS_MESSAGE_QUEUE_17_002: [ A newly created message queue shall be empty. ]*/
         DList_InitializeListHead((PDLIST_ENTRY)&(result->queue_head));
         result->queue_head.message = NULL;
+        result->cells = NULL;
+    }
+    return result;
+}
+
+MESSAGE_QUEUE_HANDLE MESSAGE_QUEUE_create_concurrent(size_t capacity)
+{
+    MESSAGE_QUEUE_HANDLE_DATA* result;
+
+    if (capacity == 0 || capacity > MESSAGE_QUEUE_CAPACITY_MAX)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_005: [ MESSAGE_QUEUE_create_concurrent shall return NULL if capacity is 0 or larger than 2^30. ]*/
+        LogError("invalid argument - capacity(%lu).", (unsigned long)capacity);
+        result = NULL;
+    }
+    else if ((result = (MESSAGE_QUEUE_HANDLE_DATA*)malloc(sizeof(MESSAGE_QUEUE_HANDLE_DATA))) == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_008: [ On a failure, MESSAGE_QUEUE_create_concurrent shall free any allocated resources and return NULL. ]*/
+        LogError("malloc failed.");
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_006: [ MESSAGE_QUEUE_create_concurrent shall allocate a ring of capacity messages, rounded up to a power of 2. ]*/
+        size_t ring_size = 1;
+        while (ring_size < capacity)
+        {
+            ring_size <<= 1;
+        }
+
+        DList_InitializeListHead((PDLIST_ENTRY)&(result->queue_head));
+        result->queue_head.message = NULL;
+        if ((result->cells = (MESSAGE_QUEUE_CELL*)malloc(ring_size * sizeof(MESSAGE_QUEUE_CELL))) == NULL)
+        {
+            LogError("malloc failed for the ring.");
+            free(result);
+            result = NULL;
+        }
+        /*Codes_SRS_MESSAGE_QUEUE_30_007: [ MESSAGE_QUEUE_create_concurrent shall create the lock and the condition the consumer waits on in MESSAGE_QUEUE_pop_wait. ]*/
+        else if ((result->lock = Lock_Init()) == NULL)
+        {
+            LogError("Lock_Init failed.");
+            free(result->cells);
+            free(result);
+            result = NULL;
+        }
+        else if ((result->wake = Condition_Init()) == NULL)
+        {
+            LogError("Condition_Init failed.");
+            (void)Lock_Deinit(result->lock);
+            free(result->cells);
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            size_t i;
+            for (i = 0; i < ring_size; i++)
+            {
+                result->cells[i].sequence = (long)i;
+                result->cells[i].message = NULL;
+            }
+            result->mask = (long)(ring_size - 1);
+            result->enqueue_position = 0;
+            result->dequeue_position = 0;
+            result->spilled = 0;
+            result->waiting = 0;
+        }
     }
     return result;
 }
@@ -74,6 +316,16 @@ void MESSAGE_QUEUE_destroy(MESSAGE_QUEUE_HANDLE handle)
     {
 		MESSAGE_QUEUE_HANDLE_DATA * mq = (MESSAGE_QUEUE_HANDLE_DATA*)handle;
         MESSAGE_HANDLE message;
+        if (mq->cells != NULL)
+        {
+            while ((message = ring_pop(mq)) != NULL)
+            {
+                Message_Destroy(message);
+            }
+            (void)Condition_Deinit(mq->wake);
+            (void)Lock_Deinit(mq->lock);
+            free(mq->cells);
+        }
         while((message = message_pop(mq)) != NULL)
         {
             /*Codes_SRS_MESSAGE_QUEUE_17_005: [ If the message queue is not empty, MESSAGE_QUEUE_destroy shall destroy all messages in the queue. ]*/
@@ -96,6 +348,10 @@ int MESSAGE_QUEUE_push(MESSAGE_QUEUE_HANDLE handle, MESSAGE_HANDLE element)
         LogError("invalid argument - handle(%p), element(%p).", handle, element);
         result = __LINE__;
     }
+    else if (handle->cells != NULL)
+    {
+        result = concurrent_push(handle, element);
+    }
     else
     {
 		MESSAGE_QUEUE_STORAGE* temp = (MESSAGE_QUEUE_STORAGE*)malloc(sizeof(MESSAGE_QUEUE_STORAGE));
@@ -129,6 +385,11 @@ MESSAGE_HANDLE MESSAGE_QUEUE_pop(MESSAGE_QUEUE_HANDLE handle)
         LogError("invalid argument - handle(%p).", handle);
         result = NULL;
     }
+    else if (handle->cells != NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_013: [ MESSAGE_QUEUE_pop shall return NULL on a concurrent queue while the oldest message is still being pushed. ]*/
+        result = concurrent_pop(handle);
+    }
     else
     {
         /*Codes_SRS_MESSAGE_QUEUE_17_013: [ MESSAGE_QUEUE_pop shall return NULL on an empty message queue. ]*/
@@ -139,6 +400,117 @@ MESSAGE_HANDLE MESSAGE_QUEUE_pop(MESSAGE_QUEUE_HANDLE handle)
     return result;
 }
 
+size_t MESSAGE_QUEUE_pop_many(MESSAGE_QUEUE_HANDLE handle, MESSAGE_HANDLE* messages, size_t max_count)
+{
+    size_t result;
+    if (handle == NULL || messages == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_014: [ MESSAGE_QUEUE_pop_many shall return 0 if handle or messages are NULL. ]*/
+        LogError("invalid argument - handle(%p), messages(%p).", handle, messages);
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_015: [ MESSAGE_QUEUE_pop_many shall pop up to max_count messages into messages, oldest first, and return how many it popped. ]*/
+        for (result = 0; result < max_count; result++)
+        {
+            messages[result] = (handle->cells != NULL) ? concurrent_pop(handle) : message_pop(handle);
+            if (messages[result] == NULL)
+            {
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+MESSAGE_HANDLE MESSAGE_QUEUE_pop_wait(MESSAGE_QUEUE_HANDLE handle, int timeout_ms)
+{
+    MESSAGE_HANDLE result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_016: [ MESSAGE_QUEUE_pop_wait shall return NULL on a NULL message queue. ]*/
+        LogError("invalid argument - handle(%p).", handle);
+        result = NULL;
+    }
+    else if (handle->cells == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_017: [ MESSAGE_QUEUE_pop_wait shall not wait on a queue from MESSAGE_QUEUE_create, it shall behave as MESSAGE_QUEUE_pop. ]*/
+        result = message_pop(handle);
+    }
+    else if ((result = concurrent_pop(handle)) != NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_018: [ MESSAGE_QUEUE_pop_wait shall return the oldest message without waiting if there is one. ]*/
+    }
+    else if (Lock(handle->lock) != LOCK_OK)
+    {
+        LogError("unable to lock the queue to wait.");
+    }
+    else
+    {
+        /*announce the wait before looking at the queue again, a producer
+        either sees the announcement or its message is seen here*/
+        (void)ATOMIC_EXCHANGE(handle->waiting, 1);
+        if ((result = ring_pop(handle)) == NULL && spill_is_next(handle))
+        {
+            result = spill_pop(handle);
+        }
+        if (result == NULL)
+        {
+            /*Codes_SRS_MESSAGE_QUEUE_30_019: [ Otherwise MESSAGE_QUEUE_pop_wait shall wait up to timeout_ms milliseconds for a message to be pushed, then return the oldest message or NULL. ]*/
+            (void)Condition_Wait(handle->wake, handle->lock, timeout_ms);
+            if ((result = ring_pop(handle)) == NULL && spill_is_next(handle))
+            {
+                result = spill_pop(handle);
+            }
+        }
+        (void)ATOMIC_EXCHANGE(handle->waiting, 0);
+        (void)Unlock(handle->lock);
+    }
+    return result;
+}
+
+/* replacement */
+
+MESSAGE_HANDLE MESSAGE_QUEUE_replace_if(MESSAGE_QUEUE_HANDLE handle, MESSAGE_QUEUE_MATCH_FUNCTION match_function, const void* match_context, MESSAGE_HANDLE element)
+{
+    MESSAGE_HANDLE result;
+    if (handle == NULL || match_function == NULL || element == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_001: [ MESSAGE_QUEUE_replace_if shall return NULL if handle, match_function or element are NULL. ]*/
+        LogError("invalid argument - handle(%p), match_function(%p), element(%p).", handle, match_function, element);
+        result = NULL;
+    }
+    else if (handle->cells != NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_009: [ MESSAGE_QUEUE_replace_if shall return NULL on a concurrent queue, whose producers never wait for one another. ]*/
+        LogError("MESSAGE_QUEUE_replace_if is not supported on a concurrent queue.");
+        result = NULL;
+    }
+    else
+    {
+        PDLIST_ENTRY head = (PDLIST_ENTRY)&(handle->queue_head);
+        PDLIST_ENTRY current = head->Flink;
+
+        /*Codes_SRS_MESSAGE_QUEUE_30_004: [ MESSAGE_QUEUE_replace_if shall return NULL and leave the queue unchanged if no message matches. ]*/
+        result = NULL;
+        /*Codes_SRS_MESSAGE_QUEUE_30_002: [ MESSAGE_QUEUE_replace_if shall call match_function with match_context on the queued messages, oldest first, until it returns true. ]*/
+        while (current != head)
+        {
+            MESSAGE_QUEUE_STORAGE* entry = (MESSAGE_QUEUE_STORAGE*)current;
+            if (match_function(entry->message, match_context))
+            {
+                /*Codes_SRS_MESSAGE_QUEUE_30_003: [ MESSAGE_QUEUE_replace_if shall put element in the place of the matching message and return the matching message. ]*/
+                result = entry->message;
+                entry->message = element;
+                break;
+            }
+            current = current->Flink;
+        }
+    }
+    return result;
+}
+
 /* access */
 bool MESSAGE_QUEUE_is_empty(MESSAGE_QUEUE_HANDLE handle)
 {
@@ -149,6 +521,12 @@ bool MESSAGE_QUEUE_is_empty(MESSAGE_QUEUE_HANDLE handle)
 		LogError("invalid argument handle (NULL).");
 		result = true;
 	}
+	else if (handle->cells != NULL)
+	{
+        /*Codes_SRS_MESSAGE_QUEUE_30_020: [ MESSAGE_QUEUE_is_empty shall return true on a concurrent queue if every message pushed has been popped. ]*/
+		result = (ATOMIC_READ(handle->enqueue_position) == ATOMIC_READ(handle->dequeue_position)) &&
+			(ATOMIC_READ(handle->spilled) == 0);
+	}
 	else
 	{
         /*Codes_SRS_MESSAGE_QUEUE_17_017: [ MESSAGE_QUEUE_is_empty shall return true if there are no messages on the queue. ]*/
@@ -167,6 +545,24 @@ MESSAGE_HANDLE MESSAGE_QUEUE_front(MESSAGE_QUEUE_HANDLE handle)
         LogError("invalid argument handle (NULL).");
         result = NULL;
     }
+    else if (handle->cells != NULL)
+    {
+        MESSAGE_QUEUE_CELL* cell = ring_front(handle);
+        if (cell != NULL)
+        {
+            result = cell->message;
+        }
+        else if (!spill_is_next(handle) || Lock(handle->lock) != LOCK_OK)
+        {
+            result = NULL;
+        }
+        else
+        {
+            result = DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head)) ? NULL :
+                ((MESSAGE_QUEUE_STORAGE*)handle->queue_head.queue_entry.Flink)->message;
+            (void)Unlock(handle->lock);
+        }
+    }
     else
     {
         /*Codes_SRS_MESSAGE_QUEUE_17_020: [ MESSAGE_QUEUE_front shall return NULL if the message queue is empty. ]*/
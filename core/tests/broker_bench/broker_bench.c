@@ -0,0 +1,603 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*throughput and latency benchmark of the broker. Every case links N source
+modules to M sink modules, every source to every sink, and the sources publish
+from their own threads. The content of every message starts with the time it
+was published at, the sinks use it to record the publish to receive latency.
+With the "codec" transport the sinks also serialize and decode every message
+they receive, which is the work the outprocess proxy does for every message
+that crosses a process boundary.
+
+Every case prints one JSON object on its own line so the output can be kept
+and compared from one run to the next. The only argument is the number of
+messages each source publishes in a case.*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "azure_c_shared_utility/map.h"
+#include "azure_c_shared_utility/constbuffer.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "broker.h"
+#include "message.h"
+#include "module.h"
+#include "gateway_atomic.h"
+
+#define DEFAULT_MESSAGES_PER_SOURCE 2000
+#define MAX_MODULES 4
+#define CASE_TIMEOUT_MS 60000
+
+typedef struct TOPOLOGY_TAG
+{
+    size_t sources;
+    size_t sinks;
+} TOPOLOGY;
+
+static const TOPOLOGY topologies[] = { { 1, 1 }, { 1, 4 }, { 4, 1 }, { 4, 4 } };
+static const size_t property_counts[] = { 0, 8, 32 };
+static const size_t payload_sizes[] = { 16, 1024, 16384 };
+static const BROKER_SCHEDULER schedulers[] = { BROKER_SCHEDULER_THREAD_PER_MODULE, BROKER_SCHEDULER_WORKER_POOL };
+static const char* const transports[] = { "direct", "codec" };
+
+#ifdef BROKER_BENCH_COUNT_ALLOCATIONS
+/*the executable is linked with --wrap for the following, so every allocation
+made by the broker, the messages and the shared utilities is counted*/
+static volatile long allocation_count;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    (void)ATOMIC_INCREMENT(allocation_count);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+    (void)ATOMIC_INCREMENT(allocation_count);
+    return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    (void)ATOMIC_INCREMENT(allocation_count);
+    return __real_realloc(ptr, size);
+}
+
+static long get_allocation_count(void)
+{
+    return ATOMIC_READ(allocation_count);
+}
+#else
+static long get_allocation_count(void)
+{
+    return -1;
+}
+#endif
+
+static uint64_t now_ns(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    (void)QueryPerformanceFrequency(&frequency);
+    (void)QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1000000000.0 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/*the synthetic modules*/
+
+typedef struct BENCH_SINK_TAG
+{
+    MODULE module;
+    bool round_trip;
+    unsigned char* buffer;
+    int32_t buffer_size;
+    uint64_t* latencies;
+    long capacity;
+    volatile long received;
+    volatile long failed;
+} BENCH_SINK;
+
+typedef struct BENCH_SOURCE_TAG
+{
+    MODULE module;
+    BROKER_HANDLE broker;
+    MAP_HANDLE properties;
+    unsigned char* payload;
+    size_t payload_size;
+    size_t messages;
+    size_t failed;
+    THREAD_HANDLE thread;
+} BENCH_SOURCE;
+
+static void source_receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
+{
+    /*sources are not linked to anything*/
+    (void)moduleHandle;
+    (void)messageHandle;
+}
+
+static void sink_receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
+{
+    uint64_t received_at = now_ns();
+    BENCH_SINK* sink = (BENCH_SINK*)moduleHandle;
+    MESSAGE_HANDLE decoded = NULL;
+    const CONSTBUFFER* content;
+
+    if (sink->round_trip)
+    {
+        /*a sink is only ever called by one thread at a time, the buffer is its own*/
+        int32_t size = Message_ToByteArray(messageHandle, sink->buffer, sink->buffer_size);
+        decoded = (size < 0) ? NULL : Message_CreateFromByteArray(sink->buffer, size);
+        content = (decoded == NULL) ? NULL : Message_GetContent(decoded);
+    }
+    else
+    {
+        content = Message_GetContent(messageHandle);
+    }
+
+    if (
+        (content == NULL) ||
+        (content->size < sizeof(uint64_t))
+        )
+    {
+        (void)ATOMIC_INCREMENT(sink->failed);
+    }
+    else
+    {
+        uint64_t published_at;
+        long index = ATOMIC_INCREMENT(sink->received) - 1;
+        (void)memcpy(&published_at, content->buffer, sizeof(published_at));
+        if (index < sink->capacity)
+        {
+            sink->latencies[index] = received_at - published_at;
+        }
+    }
+
+    if (decoded != NULL)
+    {
+        Message_Destroy(decoded);
+    }
+}
+
+static const MODULE_API_1 source_apis =
+{
+    { MODULE_API_VERSION_1 },
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    source_receive,
+    NULL
+};
+
+static const MODULE_API_1 sink_apis =
+{
+    { MODULE_API_VERSION_1 },
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    sink_receive,
+    NULL
+};
+
+static int source_thread(void* context)
+{
+    BENCH_SOURCE* source = (BENCH_SOURCE*)context;
+    size_t i;
+    for (i = 0; i < source->messages; i++)
+    {
+        MESSAGE_CONFIG config = { source->payload_size, source->payload, source->properties };
+        MESSAGE_HANDLE message;
+        uint64_t published_at = now_ns();
+        (void)memcpy(source->payload, &published_at, sizeof(published_at));
+
+        message = Message_Create(&config);
+        if (message == NULL)
+        {
+            source->failed++;
+        }
+        else
+        {
+            if (Broker_Publish(source->broker, (MODULE_HANDLE)source, message) != BROKER_OK)
+            {
+                source->failed++;
+            }
+            Message_Destroy(message);
+        }
+    }
+    return 0;
+}
+
+/*a case*/
+
+typedef struct BENCH_CASE_TAG
+{
+    TOPOLOGY topology;
+    size_t property_count;
+    size_t payload_size;
+    BROKER_SCHEDULER scheduler;
+    const char* transport;
+    size_t messages_per_source;
+} BENCH_CASE;
+
+typedef struct BENCH_RESULT_TAG
+{
+    long published;
+    long delivered;
+    double elapsed_ms;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    long allocations;
+} BENCH_RESULT;
+
+static MAP_HANDLE create_properties(size_t property_count)
+{
+    MAP_HANDLE result = Map_Create(NULL);
+    if (result != NULL)
+    {
+        size_t i;
+        for (i = 0; i < property_count; i++)
+        {
+            /*names and values about as long as the ones modules use*/
+            char name[32];
+            char value[32];
+            (void)sprintf(name, "property-name-%u", (unsigned int)i);
+            (void)sprintf(value, "value-%08u", (unsigned int)(i * 2654435761u));
+            if (Map_Add(result, name, value) != MAP_OK)
+            {
+                Map_Destroy(result);
+                result = NULL;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+static int compare_latencies(const void* left, const void* right)
+{
+    uint64_t l = *(const uint64_t*)left;
+    uint64_t r = *(const uint64_t*)right;
+    return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+static uint64_t percentile(const uint64_t* sorted, size_t count, double fraction)
+{
+    size_t index = (size_t)(fraction * (double)count);
+    return (count == 0) ? 0 : sorted[(index < count) ? index : count - 1];
+}
+
+/*size of the byte array of the messages of the case, the codec sinks serialize into a buffer that big*/
+static int32_t serialized_size(MAP_HANDLE properties, const unsigned char* payload, size_t payload_size)
+{
+    int32_t result;
+    MESSAGE_CONFIG config = { payload_size, payload, properties };
+    MESSAGE_HANDLE message = Message_Create(&config);
+    if (message == NULL)
+    {
+        result = -1;
+    }
+    else
+    {
+        result = Message_ToByteArray(message, NULL, 0);
+        Message_Destroy(message);
+    }
+    return result;
+}
+
+static int wait_for_deliveries(BENCH_SINK* sinks, size_t sink_count, long expected, long* delivered)
+{
+    int result = __LINE__;
+    uint64_t deadline = now_ns() + (uint64_t)CASE_TIMEOUT_MS * 1000000u;
+    for (;;)
+    {
+        size_t i;
+        long done = 0;
+        for (i = 0; i < sink_count; i++)
+        {
+            done += ATOMIC_READ(sinks[i].received) + ATOMIC_READ(sinks[i].failed);
+        }
+        *delivered = done;
+        if (done >= expected)
+        {
+            result = 0;
+            break;
+        }
+        else if (now_ns() > deadline)
+        {
+            (void)fprintf(stderr, "timed out with %ld of %ld messages delivered\n", done, expected);
+            break;
+        }
+        else
+        {
+            ThreadAPI_Sleep(1);
+        }
+    }
+    return result;
+}
+
+static int run_case(const BENCH_CASE* bench_case, BENCH_RESULT* bench_result)
+{
+    int result;
+    BENCH_SOURCE sources[MAX_MODULES];
+    BENCH_SINK sinks[MAX_MODULES];
+    size_t i;
+    size_t j;
+    size_t sources_added = 0;
+    size_t sinks_added = 0;
+    long expected = (long)(bench_case->topology.sources * bench_case->messages_per_source * bench_case->topology.sinks);
+    BROKER_OPTIONS options;
+    BROKER_HANDLE broker;
+    MAP_HANDLE properties = create_properties(bench_case->property_count);
+    unsigned char* template_payload = (unsigned char*)calloc(1, bench_case->payload_size);
+    int32_t buffer_size = (properties == NULL || template_payload == NULL) ? -1 : serialized_size(properties, template_payload, bench_case->payload_size);
+
+    options.scheduler = bench_case->scheduler;
+    options.worker_count = 0;
+    broker = (buffer_size < 0) ? NULL : Broker_CreateWithOptions(&options);
+
+    memset(sources, 0, sizeof(sources));
+    memset(sinks, 0, sizeof(sinks));
+
+    if (broker == NULL)
+    {
+        (void)fprintf(stderr, "unable to set up the case\n");
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+        for (i = 0; (result == 0) && (i < bench_case->topology.sinks); i++)
+        {
+            sinks[i].module.module_apis = (const MODULE_API*)&sink_apis;
+            sinks[i].module.module_handle = (MODULE_HANDLE)&sinks[i];
+            sinks[i].round_trip = (strcmp(bench_case->transport, "codec") == 0);
+            sinks[i].buffer_size = buffer_size;
+            sinks[i].buffer = (unsigned char*)malloc(buffer_size);
+            sinks[i].capacity = (long)(bench_case->topology.sources * bench_case->messages_per_source);
+            sinks[i].latencies = (uint64_t*)malloc(sinks[i].capacity * sizeof(uint64_t));
+            if (
+                (sinks[i].buffer == NULL) ||
+                (sinks[i].latencies == NULL) ||
+                (Broker_AddModule(broker, &sinks[i].module) != BROKER_OK)
+                )
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                sinks_added++;
+            }
+        }
+
+        for (i = 0; (result == 0) && (i < bench_case->topology.sources); i++)
+        {
+            sources[i].module.module_apis = (const MODULE_API*)&source_apis;
+            sources[i].module.module_handle = (MODULE_HANDLE)&sources[i];
+            sources[i].broker = broker;
+            sources[i].properties = properties;
+            sources[i].payload_size = bench_case->payload_size;
+            sources[i].payload = (unsigned char*)malloc(bench_case->payload_size);
+            sources[i].messages = bench_case->messages_per_source;
+            if (
+                (sources[i].payload == NULL) ||
+                (Broker_AddModule(broker, &sources[i].module) != BROKER_OK)
+                )
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                memset(sources[i].payload, 'x', bench_case->payload_size);
+                sources_added++;
+                for (j = 0; (result == 0) && (j < bench_case->topology.sinks); j++)
+                {
+                    BROKER_LINK_DATA link = { sources[i].module.module_handle, sinks[j].module.module_handle };
+                    if (Broker_AddLink(broker, &link) != BROKER_OK)
+                    {
+                        result = __LINE__;
+                    }
+                }
+            }
+        }
+
+        if (result != 0)
+        {
+            (void)fprintf(stderr, "unable to set up the modules of the case\n");
+        }
+        else
+        {
+            long allocations_before = get_allocation_count();
+            uint64_t start = now_ns();
+            size_t started = 0;
+            for (i = 0; i < bench_case->topology.sources; i++)
+            {
+                if (ThreadAPI_Create(&sources[i].thread, source_thread, &sources[i]) != THREADAPI_OK)
+                {
+                    (void)fprintf(stderr, "unable to start source %u\n", (unsigned int)i);
+                    result = __LINE__;
+                    break;
+                }
+                started++;
+            }
+
+            for (i = 0; i < started; i++)
+            {
+                int thread_result;
+                (void)ThreadAPI_Join(sources[i].thread, &thread_result);
+            }
+
+            if (result == 0)
+            {
+                long published = 0;
+                for (i = 0; i < bench_case->topology.sources; i++)
+                {
+                    published += (long)(sources[i].messages - sources[i].failed);
+                }
+                /*a message that could not be published is not going to be delivered*/
+                expected = published * (long)bench_case->topology.sinks;
+
+                result = wait_for_deliveries(sinks, bench_case->topology.sinks, expected, &bench_result->delivered);
+                if (result == 0)
+                {
+                    long allocations_after = get_allocation_count();
+                    size_t latency_count = 0;
+                    uint64_t* latencies;
+
+                    bench_result->elapsed_ms = (double)(now_ns() - start) / 1000000.0;
+                    bench_result->published = published;
+                    bench_result->allocations = (allocations_before < 0) ? -1 : allocations_after - allocations_before;
+
+                    for (i = 0; i < bench_case->topology.sinks; i++)
+                    {
+                        latency_count += (size_t)sinks[i].received;
+                    }
+                    latencies = (uint64_t*)malloc((latency_count == 0 ? 1 : latency_count) * sizeof(uint64_t));
+                    if (latencies == NULL)
+                    {
+                        result = __LINE__;
+                    }
+                    else
+                    {
+                        size_t k = 0;
+                        for (i = 0; i < bench_case->topology.sinks; i++)
+                        {
+                            (void)memcpy(latencies + k, sinks[i].latencies, sinks[i].received * sizeof(uint64_t));
+                            k += (size_t)sinks[i].received;
+                        }
+                        qsort(latencies, latency_count, sizeof(uint64_t), compare_latencies);
+                        bench_result->p50_ns = percentile(latencies, latency_count, 0.50);
+                        bench_result->p99_ns = percentile(latencies, latency_count, 0.99);
+                        bench_result->p999_ns = percentile(latencies, latency_count, 0.999);
+                        free(latencies);
+                    }
+                }
+            }
+        }
+
+        for (i = 0; i < sources_added; i++)
+        {
+            (void)Broker_RemoveModule(broker, &sources[i].module);
+        }
+        for (i = 0; i < sinks_added; i++)
+        {
+            (void)Broker_RemoveModule(broker, &sinks[i].module);
+        }
+        Broker_Destroy(broker);
+    }
+
+    for (i = 0; i < MAX_MODULES; i++)
+    {
+        free(sources[i].payload);
+        free(sinks[i].buffer);
+        free(sinks[i].latencies);
+    }
+    free(template_payload);
+    if (properties != NULL)
+    {
+        Map_Destroy(properties);
+    }
+    return result;
+}
+
+static void print_result(const BENCH_CASE* bench_case, const BENCH_RESULT* bench_result)
+{
+    double seconds = bench_result->elapsed_ms / 1000.0;
+    (void)printf("{\"scheduler\":\"%s\",\"transport\":\"%s\",\"sources\":%u,\"sinks\":%u,\"properties\":%u,\"payload\":%u,"
+        "\"published\":%ld,\"delivered\":%ld,\"elapsed_ms\":%.3f,\"msgs_per_sec\":%.1f,"
+        "\"latency_p50_us\":%.3f,\"latency_p99_us\":%.3f,\"latency_p999_us\":%.3f,",
+        (bench_case->scheduler == BROKER_SCHEDULER_WORKER_POOL) ? "worker_pool" : "thread_per_module",
+        bench_case->transport,
+        (unsigned int)bench_case->topology.sources,
+        (unsigned int)bench_case->topology.sinks,
+        (unsigned int)bench_case->property_count,
+        (unsigned int)bench_case->payload_size,
+        bench_result->published,
+        bench_result->delivered,
+        bench_result->elapsed_ms,
+        (seconds > 0) ? (double)bench_result->delivered / seconds : 0.0,
+        (double)bench_result->p50_ns / 1000.0,
+        (double)bench_result->p99_ns / 1000.0,
+        (double)bench_result->p999_ns / 1000.0);
+    if (
+        (bench_result->allocations < 0) ||
+        (bench_result->published == 0)
+        )
+    {
+        (void)printf("\"allocations_per_message\":null}\n");
+    }
+    else
+    {
+        (void)printf("\"allocations_per_message\":%.2f}\n", (double)bench_result->allocations / (double)bench_result->published);
+    }
+    (void)fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    int result = 0;
+    BENCH_CASE bench_case;
+    size_t t;
+    bench_case.messages_per_source = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES_PER_SOURCE;
+    if (bench_case.messages_per_source == 0)
+    {
+        (void)fprintf(stderr, "usage: %s [messages per source]\n", argv[0]);
+        result = 1;
+    }
+
+    for (t = 0; (result == 0) && (t < sizeof(topologies) / sizeof(topologies[0])); t++)
+    {
+        size_t s;
+        bench_case.topology = topologies[t];
+        for (s = 0; (result == 0) && (s < sizeof(schedulers) / sizeof(schedulers[0])); s++)
+        {
+            size_t x;
+            bench_case.scheduler = schedulers[s];
+            for (x = 0; (result == 0) && (x < sizeof(transports) / sizeof(transports[0])); x++)
+            {
+                size_t p;
+                bench_case.transport = transports[x];
+                for (p = 0; (result == 0) && (p < sizeof(property_counts) / sizeof(property_counts[0])); p++)
+                {
+                    size_t z;
+                    bench_case.property_count = property_counts[p];
+                    for (z = 0; (result == 0) && (z < sizeof(payload_sizes) / sizeof(payload_sizes[0])); z++)
+                    {
+                        BENCH_RESULT bench_result;
+                        bench_case.payload_size = payload_sizes[z];
+                        memset(&bench_result, 0, sizeof(bench_result));
+                        if (run_case(&bench_case, &bench_result) != 0)
+                        {
+                            result = 1;
+                        }
+                        else
+                        {
+                            print_result(&bench_case, &bench_result);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
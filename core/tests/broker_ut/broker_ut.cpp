@@ -4,6 +4,9 @@
 #include <cstdlib>
 #include <cstddef>
 #include <cstdbool>
+#include <deque>
+#include <map>
+#include <cstring>
 #include "testrunnerswitcher.h"
 #include "micromock.h"
 #include "micromockcharstararenullterminatedstrings.h"
@@ -11,12 +14,12 @@
 #include "azure_c_shared_utility/vector.h"
 #include "azure_c_shared_utility/vector_types_internal.h"
 #include "azure_c_shared_utility/singlylinkedlist.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
 #include "message.h"
+#include "message_queue.h"
 #include "azure_c_shared_utility/threadapi.h"
-#include "azure_c_shared_utility/uniqueid.h"
 #include "azure_c_shared_utility/xlogging.h"
-#include "nanomsg/nn.h"
-#include "nanomsg/pubsub.h"
 
 static MICROMOCK_MUTEX_HANDLE g_testByTest;
 static MICROMOCK_GLOBAL_SEMAPHORE_HANDLE g_dllByDll;
@@ -42,7 +45,6 @@ namespace BASEIMPLEMENTATION
 #undef Lock_Init
 #undef Lock_Deinit
 #include "vector.c"
-#include "strings.c"
 };
 
 #include "broker.h"
@@ -89,7 +91,19 @@ static size_t whenShallCond_Post_fail;
 static size_t currentThreadAPI_Create_call;
 static size_t whenShallThreadAPI_Create_fail;
 
-static size_t nn_current_msg_size;
+static size_t currentMESSAGE_QUEUE_create_call;
+static size_t whenShallMESSAGE_QUEUE_create_fail;
+
+static size_t currentMESSAGE_QUEUE_push_call;
+static size_t whenShallMESSAGE_QUEUE_push_fail;
+
+static size_t currentMessage_Clone_call;
+static size_t whenShallMessage_Clone_fail;
+
+static bool run_worker_on_join;
+
+static const unsigned char fake_content_bytes[] = { 'm', 'e', 't', 'r', 'i', 'c', 's' };
+static const CONSTBUFFER fake_content = { fake_content_bytes, sizeof(fake_content_bytes) };
 
 typedef struct LIST_ITEM_INSTANCE_TAG
 {
@@ -108,8 +122,11 @@ struct ListNode
     ListNode *next, *prev;
 };
 
-static int current_nn_socket_index;
-static void* nn_socket_memory[10];
+typedef std::deque<MESSAGE_HANDLE> FakeMessageQueue;
+
+/*value of the coalesce key property of the fake messages, the fake properties
+of a message are the message handle itself*/
+static std::map<MESSAGE_HANDLE, const char*> fake_coalesce_values;
 
 static THREAD_START_FUNC thread_func_to_call;
 static void* thread_func_args;
@@ -124,6 +141,8 @@ static FakeModule_Receive_Call_Status call_status_for_FakeModule_Receive;
 
 static MODULE_HANDLE fake_module_handle = (MODULE_HANDLE)0x42;
 
+static const char* fake_mac_address;
+
 static MODULE_HANDLE FakeModule_Create(BROKER_HANDLE broker, const void* configuration)
 {
     return (MODULE_HANDLE)malloc(1);
@@ -156,6 +175,32 @@ MODULE fake_module =
     fake_module_handle
 };
 
+static size_t FakeModule_ReceiveBatch_count;
+
+static void FakeModule_ReceiveBatch(MODULE_HANDLE module, MESSAGE_HANDLE* messageHandles, size_t messageCount)
+{
+    FakeModule_ReceiveBatch_count = messageCount;
+    ASSERT_ARE_EQUAL(void_ptr, module, call_status_for_FakeModule_Receive.module);
+}
+
+static MODULE_API_2 fake_batch_module_apis =
+{
+    { MODULE_API_VERSION_2 },
+    NULL,
+    NULL,
+    FakeModule_Create,
+    FakeModule_Destroy,
+    FakeModule_Receive,
+    NULL,
+    FakeModule_ReceiveBatch
+};
+
+MODULE fake_batch_module =
+{
+    (const MODULE_API *)&fake_batch_module_apis,
+    fake_module_handle
+};
+
 class RefCountObject
 {
 private:
@@ -324,7 +369,15 @@ public:
         }
     MOCK_METHOD_END(THREADAPI_RESULT, result2)
 
+    MOCK_STATIC_METHOD_1(, void, ThreadAPI_Sleep, unsigned int, milliseconds)
+    MOCK_VOID_METHOD_END()
+
     MOCK_STATIC_METHOD_2(, THREADAPI_RESULT, ThreadAPI_Join, THREAD_HANDLE, threadHandle, int*, res)
+        if (run_worker_on_join)
+        {
+            /*the worker is expected to see the quit flag and return*/
+            *res = thread_func_to_call(thread_func_args);
+        }
         free(threadHandle);
         auto result2 = THREADAPI_OK;
     MOCK_METHOD_END(THREADAPI_RESULT, result2)
@@ -334,18 +387,47 @@ public:
     MOCK_METHOD_END(MESSAGE_HANDLE, result2)
 
     MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE, message)
-        ((RefCountObject*)message)->inc_ref();
-    MOCK_METHOD_END(MESSAGE_HANDLE, message)
+        MESSAGE_HANDLE result2;
+        ++currentMessage_Clone_call;
+        if ((whenShallMessage_Clone_fail > 0) &&
+            (currentMessage_Clone_call == whenShallMessage_Clone_fail))
+        {
+            result2 = NULL;
+        }
+        else
+        {
+            ((RefCountObject*)message)->inc_ref();
+            result2 = message;
+        }
+    MOCK_METHOD_END(MESSAGE_HANDLE, result2)
 
     MOCK_STATIC_METHOD_1(, void, Message_Destroy, MESSAGE_HANDLE, message)
         ((RefCountObject*)message)->dec_ref();
     MOCK_VOID_METHOD_END()
 
-    MOCK_STATIC_METHOD_2(, MESSAGE_HANDLE, Message_CreateFromByteArray, const unsigned char*, source, int32_t, size)
-    MOCK_METHOD_END(MESSAGE_HANDLE, (MESSAGE_HANDLE)(new RefCountObject()))
+    MOCK_STATIC_METHOD_1(, const CONSTBUFFER*, Message_GetContent, MESSAGE_HANDLE, message)
+        const CONSTBUFFER* result2 = &fake_content;
+    MOCK_METHOD_END(const CONSTBUFFER*, result2)
+
+    MOCK_STATIC_METHOD_2(, const char*, Message_GetProperty, MESSAGE_HANDLE, message, const char*, key)
+        const char* result2;
+        if (strcmp(key, "macAddress") == 0)
+        {
+            result2 = fake_mac_address;
+        }
+        else
+        {
+            auto found = fake_coalesce_values.find(message);
+            result2 = (found == fake_coalesce_values.end()) ? NULL : found->second;
+        }
+    MOCK_METHOD_END(const char*, result2)
+
+    // crt_abstractions.h
 
-    MOCK_STATIC_METHOD_3(, int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char *, buffer, int32_t, size)
-    MOCK_METHOD_END(int32_t, (int32_t)1)
+    MOCK_STATIC_METHOD_2(, int, mallocAndStrcpy_s, char**, destination, const char*, source)
+        *destination = (char*)BASEIMPLEMENTATION::gballoc_malloc(strlen(source) + 1);
+        strcpy(*destination, source);
+    MOCK_METHOD_END(int, 0)
 
     // list.h
 
@@ -486,90 +568,114 @@ public:
         }
     MOCK_METHOD_END(const void*, result1)
 
-    MOCK_STATIC_METHOD_1(, void, STRING_delete, STRING_HANDLE, s)
-        BASEIMPLEMENTATION::STRING_delete(s);
-    MOCK_VOID_METHOD_END()
-
-    MOCK_STATIC_METHOD_1(, STRING_HANDLE, STRING_construct, const char*, source)
-        STRING_HANDLE result2;
-        result2 = BASEIMPLEMENTATION::STRING_construct(source);
-    MOCK_METHOD_END(STRING_HANDLE, result2)
-
-    MOCK_STATIC_METHOD_2(, int, STRING_concat, STRING_HANDLE, s1, const char*, s2)
-        int result1 = BASEIMPLEMENTATION::STRING_concat(s1, s2);
-    MOCK_METHOD_END(int, result1);
-
-    MOCK_STATIC_METHOD_1(, const char*, STRING_c_str, STRING_HANDLE, s)
-    MOCK_METHOD_END(const char*, BASEIMPLEMENTATION::STRING_c_str(s))
-
-    MOCK_STATIC_METHOD_1(, size_t, STRING_length, STRING_HANDLE, s)
-    MOCK_METHOD_END(size_t, BASEIMPLEMENTATION::STRING_length(s))
+    // condition.h
 
-    MOCK_STATIC_METHOD_2(, UNIQUEID_RESULT, UniqueId_Generate, char*, uid, size_t, bufferSize)
-        for (int i = 0; i < (int)bufferSize; i++)
+    MOCK_STATIC_METHOD_0(, COND_HANDLE, Condition_Init)
+        COND_HANDLE result2;
+        ++currentCond_Init_call;
+        if ((whenShallCond_Init_fail > 0) &&
+            (currentCond_Init_call == whenShallCond_Init_fail))
         {
-            if (i == (bufferSize - 1))
-                uid[i] = '\0';
-            else
-                uid[i] = 'u';
+            result2 = NULL;
         }
-    MOCK_METHOD_END(UNIQUEID_RESULT, UNIQUEID_OK)
-
-
-    MOCK_STATIC_METHOD_2(, void *, nn_allocmsg, size_t, size, int, type)
-        nn_current_msg_size = size;
-    MOCK_METHOD_END(void*, malloc(size))
-
-    MOCK_STATIC_METHOD_1(, int, nn_freemsg, void*, msg)
-        free(msg);
-    MOCK_METHOD_END(int, 0)
+        else
+        {
+            result2 = (COND_HANDLE)malloc(1);
+        }
+    MOCK_METHOD_END(COND_HANDLE, result2)
 
-    MOCK_STATIC_METHOD_2(, int, nn_socket, int, domain, int, protocol)
-        current_nn_socket_index++;
-        nn_socket_memory[current_nn_socket_index] = malloc(1);
-    MOCK_METHOD_END(int, current_nn_socket_index)
+    MOCK_STATIC_METHOD_1(, COND_RESULT, Condition_Post, COND_HANDLE, handle)
+        COND_RESULT result2;
+        ++currentCond_Post_call;
+        if ((whenShallCond_Post_fail > 0) &&
+            (currentCond_Post_call == whenShallCond_Post_fail))
+        {
+            result2 = COND_ERROR;
+        }
+        else
+        {
+            result2 = COND_OK;
+        }
+    MOCK_METHOD_END(COND_RESULT, result2)
 
-    MOCK_STATIC_METHOD_1(, int, nn_close, int, s)
-        free(nn_socket_memory[s]);
-    MOCK_METHOD_END(int, 0)
+    MOCK_STATIC_METHOD_3(, COND_RESULT, Condition_Wait, COND_HANDLE, handle, LOCK_HANDLE, lock, int, timeout_milliseconds)
+    MOCK_METHOD_END(COND_RESULT, COND_OK)
 
-    MOCK_STATIC_METHOD_2(, int, nn_bind, int, s, const char *, addr)
-    MOCK_METHOD_END(int, 1)
+    MOCK_STATIC_METHOD_1(, void, Condition_Deinit, COND_HANDLE, handle)
+        free(handle);
+    MOCK_VOID_METHOD_END()
 
-    MOCK_STATIC_METHOD_2(, int, nn_connect, int, s, const char *, addr)
-    MOCK_METHOD_END(int, 1)
+    // message_queue.h
 
-    MOCK_STATIC_METHOD_5(, int, nn_setsockopt, int, s, int, level, int, option, const void *, optval, size_t, optvallen)
-    MOCK_METHOD_END(int, 1)
+    MOCK_STATIC_METHOD_0(, MESSAGE_QUEUE_HANDLE, MESSAGE_QUEUE_create)
+        MESSAGE_QUEUE_HANDLE result2;
+        ++currentMESSAGE_QUEUE_create_call;
+        if ((whenShallMESSAGE_QUEUE_create_fail > 0) &&
+            (currentMESSAGE_QUEUE_create_call == whenShallMESSAGE_QUEUE_create_fail))
+        {
+            result2 = NULL;
+        }
+        else
+        {
+            result2 = (MESSAGE_QUEUE_HANDLE)new FakeMessageQueue();
+        }
+    MOCK_METHOD_END(MESSAGE_QUEUE_HANDLE, result2)
 
+    MOCK_STATIC_METHOD_1(, void, MESSAGE_QUEUE_destroy, MESSAGE_QUEUE_HANDLE, handle)
+        FakeMessageQueue* queue = (FakeMessageQueue*)handle;
+        for (auto message : *queue)
+        {
+            /*the real queue destroys the messages it still holds*/
+            ((RefCountObject*)message)->dec_ref();
+        }
+        delete queue;
+    MOCK_VOID_METHOD_END()
 
-    MOCK_STATIC_METHOD_4(, int, nn_send, int, s, const void*, buf, size_t, len, int, flags)
-        int send_length;
-        if (len == NN_MSG)
+    MOCK_STATIC_METHOD_2(, int, MESSAGE_QUEUE_push, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_HANDLE, element)
+        int result2;
+        ++currentMESSAGE_QUEUE_push_call;
+        if ((whenShallMESSAGE_QUEUE_push_fail > 0) &&
+            (currentMESSAGE_QUEUE_push_call == whenShallMESSAGE_QUEUE_push_fail))
         {
-            send_length = (int)nn_current_msg_size;
-            free(*(void**)buf); // send is supposed to free auto created buffer on success
+            result2 = __LINE__;
         }
         else
         {
-            send_length = len;
+            ((FakeMessageQueue*)handle)->push_back(element);
+            result2 = 0;
         }
-    MOCK_METHOD_END(int, send_length)
+    MOCK_METHOD_END(int, result2)
 
-    MOCK_STATIC_METHOD_4(, int, nn_recv, int, s, void*, buf, size_t, len, int, flags)
-        int rcv_length;
-        if (len == NN_MSG)
+    MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, MESSAGE_QUEUE_pop, MESSAGE_QUEUE_HANDLE, handle)
+        MESSAGE_HANDLE result2;
+        FakeMessageQueue* queue = (FakeMessageQueue*)handle;
+        if (queue->empty())
         {
-            char * text = (char*)"nn_recv";
-            (*(void**)buf) = malloc(8);
-            memcpy((*(void**)buf), text, 8);
-            rcv_length = 8;
+            result2 = NULL;
         }
         else
         {
-            rcv_length = (int)len;
+            result2 = queue->front();
+            queue->pop_front();
+        }
+    MOCK_METHOD_END(MESSAGE_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, bool, MESSAGE_QUEUE_is_empty, MESSAGE_QUEUE_HANDLE, handle)
+        bool result2 = ((FakeMessageQueue*)handle)->empty();
+    MOCK_METHOD_END(bool, result2)
+
+    MOCK_STATIC_METHOD_4(, MESSAGE_HANDLE, MESSAGE_QUEUE_replace_if, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_QUEUE_MATCH_FUNCTION, match_function, const void*, match_context, MESSAGE_HANDLE, element)
+        MESSAGE_HANDLE result2 = NULL;
+        for (auto& queued : *((FakeMessageQueue*)handle))
+        {
+            if (match_function(queued, match_context))
+            {
+                result2 = queued;
+                queued = element;
+                break;
+            }
         }
-    MOCK_METHOD_END(int, rcv_length)
+    MOCK_METHOD_END(MESSAGE_HANDLE, result2)
 };
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void*, gballoc_malloc, size_t, size);
@@ -592,12 +698,15 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , size_t, VECTOR_size, VECTOR_HANDLE,
 
 DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , THREADAPI_RESULT, ThreadAPI_Create, THREAD_HANDLE*, threadHandle, THREAD_START_FUNC, func, void*, arg);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , THREADAPI_RESULT, ThreadAPI_Join, THREAD_HANDLE, threadHandle, int*, res);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, ThreadAPI_Sleep, unsigned int, milliseconds);
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG*, cfg);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE, message);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, Message_Destroy, MESSAGE_HANDLE, message);
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , MESSAGE_HANDLE, Message_CreateFromByteArray, const unsigned char*, source, int32_t, size);
-DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char *, buffer, int32_t, size);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , const CONSTBUFFER*, Message_GetContent, MESSAGE_HANDLE, message);
+DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , const char*, Message_GetProperty, MESSAGE_HANDLE, message, const char*, key);
+
+DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, mallocAndStrcpy_s, char**, destination, const char*, source);
 
 // singlylinkedlist.h
 DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , SINGLYLINKEDLIST_HANDLE, singlylinkedlist_create);
@@ -609,25 +718,47 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , LIST_ITEM_HANDLE, singlylinkedlist_
 DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , LIST_ITEM_HANDLE, singlylinkedlist_find, SINGLYLINKEDLIST_HANDLE, list, LIST_MATCH_FUNCTION, match_function, const void*, match_context);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , const void*, singlylinkedlist_item_get_value, LIST_ITEM_HANDLE, item_handle);
 
-//strings.h
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, STRING_delete, STRING_HANDLE, s)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , STRING_HANDLE, STRING_construct, const char*, source)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, STRING_concat, STRING_HANDLE, s1, const char*, s2)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , const char*, STRING_c_str, STRING_HANDLE, s)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , size_t, STRING_length, STRING_HANDLE, s)
-
-// unique id
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , UNIQUEID_RESULT, UniqueId_Generate, char*, uid, size_t, bufferSize)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , void *, nn_allocmsg, size_t, size, int, type)
-// nn.h
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , int, nn_freemsg, void*, msg)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, nn_socket, int, domain, int, protocol)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , int, nn_close, int, s)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, nn_bind, int, s, const char *, addr)
-DECLARE_GLOBAL_MOCK_METHOD_5(CBrokerMocks, , int, nn_setsockopt, int, s, int, level, int, option, const void *, optval, size_t, optvallen)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, nn_connect, int, s, const char *, addr)
-DECLARE_GLOBAL_MOCK_METHOD_4(CBrokerMocks, , int, nn_send, int, s, const void*, buf, size_t, len, int, flags)
-DECLARE_GLOBAL_MOCK_METHOD_4(CBrokerMocks, , int, nn_recv, int, s, void*, buf, size_t, len, int, flags)
+// condition.h
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , COND_HANDLE, Condition_Init);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , COND_RESULT, Condition_Post, COND_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , COND_RESULT, Condition_Wait, COND_HANDLE, handle, LOCK_HANDLE, lock, int, timeout_milliseconds);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, Condition_Deinit, COND_HANDLE, handle);
+
+// message_queue.h
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , MESSAGE_QUEUE_HANDLE, MESSAGE_QUEUE_create);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, MESSAGE_QUEUE_destroy, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, MESSAGE_QUEUE_push, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_HANDLE, element);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_HANDLE, MESSAGE_QUEUE_pop, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , bool, MESSAGE_QUEUE_is_empty, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_4(CBrokerMocks, , MESSAGE_HANDLE, MESSAGE_QUEUE_replace_if, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_QUEUE_MATCH_FUNCTION, match_function, const void*, match_context, MESSAGE_HANDLE, element);
+
+/*expectations for building a routing table out of `module_count` attached
+modules, `removed` of which (0 or 1) is being left out. The modules are walked
+once to count the links and, when the table could be allocated, once more per
+kept source to find its sinks.*/
+static void expectRoutingTableCreate(CBrokerMocks &mocks, size_t module_count, size_t removed, bool malloc_succeeds = true)
+{
+    size_t kept = module_count - removed;
+    size_t walks = (malloc_succeeds) ? (1 + kept) : 0;
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(kept);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(1 + walks);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(module_count + (walks * module_count));
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(module_count + (walks * module_count));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments()
+        .ExpectedTimesExactly((malloc_succeeds) ? (kept * kept) : 0);
+}
 
 BEGIN_TEST_SUITE(broker_ut)
 
@@ -689,13 +820,19 @@ TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
     currentThreadAPI_Create_call = 0;
     whenShallThreadAPI_Create_fail = 0;
 
-    current_nn_socket_index = 0;
-    for (int l = 0; l < 10; l++)
-    {
-        nn_socket_memory[l] = NULL;
-    }
+    currentMESSAGE_QUEUE_create_call = 0;
+    whenShallMESSAGE_QUEUE_create_fail = 0;
+
+    currentMESSAGE_QUEUE_push_call = 0;
+    whenShallMESSAGE_QUEUE_push_fail = 0;
 
-    nn_current_msg_size = 0;
+    currentMessage_Clone_call = 0;
+    whenShallMessage_Clone_fail = 0;
+    fake_mac_address = NULL;
+
+    run_worker_on_join = false;
+    fake_coalesce_values.clear();
+    FakeModule_ReceiveBatch_count = 0;
 
     thread_func_to_call = NULL;
     thread_func_args = NULL;
@@ -715,12 +852,11 @@ TEST_FUNCTION_CLEANUP(TestMethodCleanup)
 }
 
 //Tests_SRS_BROKER_13_001: [This API shall yield a BROKER_HANDLE representing the newly created message broker. This handle value shall not be equal to NULL when the API call is successful.]
-//Tests_SRS_BROKER_13_007: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules with a valid VECTOR_HANDLE.]
+//Tests_SRS_BROKER_13_007: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules with a valid SINGLYLINKEDLIST_HANDLE.]
+//Tests_SRS_BROKER_30_014: [ Broker_Create shall initialize BROKER_HANDLE_DATA::routing_table to NULL (no links) and all the reader counters to 0. ]
 //Tests_SRS_BROKER_13_023: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules_lock with a valid LOCK_HANDLE.]
-//Tests_SRS_BROKER_17_001: [ Broker_Create shall initialize a socket for publishing messages. ]
-//Tests_SRS_BROKER_17_002: [ Broker_Create shall create a unique id. ]
-//Tests_SRS_BROKER_17_003: [ Broker_Create shall initialize a url consisting of "inproc://" + unique id. ]
-//Tests_SRS_BROKER_17_004: [ Broker_Create shall bind the socket to the BROKER_HANDLE_DATA::url. ]
+//Tests_SRS_BROKER_30_027: [ Broker_Create shall behave as Broker_CreateWithOptions called with NULL options. ]
+//Tests_SRS_BROKER_30_034: [ Without options or with BROKER_SCHEDULER_THREAD_PER_MODULE, Broker_CreateWithOptions shall set BROKER_HANDLE_DATA::worker_pool to NULL. ]
 TEST_FUNCTION(Broker_Create_succeeds)
 {
     ///arrange
@@ -730,18 +866,7 @@ TEST_FUNCTION(Broker_Create_succeeds)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"));
-    STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_bind(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+
     ///act
     auto r = Broker_Create();
 
@@ -823,191 +948,114 @@ TEST_FUNCTION(Broker_Create_fails_when_Lock_Init_fails)
     ///cleanup
 }
 
-
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_socket_fails)
+//Tests_SRS_BROKER_30_028: [ If options is not NULL and options->scheduler is not a BROKER_SCHEDULER value, Broker_CreateWithOptions shall return NULL. ]
+TEST_FUNCTION(Broker_CreateWithOptions_fails_with_unknown_scheduler)
 {
     ///arrange
     CBrokerMocks mocks;
-
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB))
-        .SetFailReturn(-1);
+    BROKER_OPTIONS options = { (BROKER_SCHEDULER)42, 1 };
 
     ///act
-    auto r = Broker_Create();
+    auto r = Broker_CreateWithOptions(&options);
 
     ///assert
     ASSERT_IS_NULL(r);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_Destroy(r);
 }
 
-
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_uuid_fails)
+//Tests_SRS_BROKER_30_029: [ Broker_CreateWithOptions shall allocate the worker pool and its workers as a single block. ]
+//Tests_SRS_BROKER_30_030: [ Broker_CreateWithOptions shall initialize the pool's idle_lock and idle_cond. ]
+//Tests_SRS_BROKER_30_031: [ Broker_CreateWithOptions shall initialize an empty ready queue and its ready_lock for every worker. ]
+//Tests_SRS_BROKER_30_032: [ Broker_CreateWithOptions shall start every worker by calling ThreadAPI_Create. ]
+//Tests_SRS_BROKER_30_035: [ With BROKER_SCHEDULER_WORKER_POOL, Broker_CreateWithOptions shall create a pool of options->worker_count workers, or BROKER_DEFAULT_WORKER_COUNT workers if options->worker_count is 0. ]
+TEST_FUNCTION(Broker_CreateWithOptions_starts_the_worker_pool)
 {
     ///arrange
     CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 2 };
 
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the pool*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1)
-        .SetFailReturn(UNIQUEID_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
 
     ///act
-    auto r = Broker_Create();
+    auto r = Broker_CreateWithOptions(&options);
 
     ///assert
-    ASSERT_IS_NULL(r);
+    ASSERT_IS_NOT_NULL(r);
+    ASSERT_IS_NOT_NULL(thread_func_to_call);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
     Broker_Destroy(r);
 }
 
-
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_url_create_fails)
+//Tests_SRS_BROKER_30_033: [ If a worker cannot be started, Broker_CreateWithOptions shall stop the workers already started, free the pool and return NULL. ]
+TEST_FUNCTION(Broker_CreateWithOptions_fails_when_ThreadAPI_Create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 2 };
+    whenShallThreadAPI_Create_fail = 2;
+    run_worker_on_join = true;
 
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the pool*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"))
-        .SetFailReturn((STRING_HANDLE)NULL);
-
-
-    ///act
-    auto r = Broker_Create();
-
-    ///assert
-    ASSERT_IS_NULL(r);
-    mocks.AssertActualAndExpectedCalls();
-
-    ///cleanup
-    Broker_Destroy(r);
-}
-
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_url_concat_fails)
-{
-    ///arrange
-    CBrokerMocks mocks;
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
 
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
+    /*the worker that was started is told to quit and joined*/
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"));
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(1);
-
-    ///act
-    auto r = Broker_Create();
-
-    ///assert
-    ASSERT_IS_NULL(r);
-    mocks.AssertActualAndExpectedCalls();
-
-    ///cleanup
-    Broker_Destroy(r);
-}
-
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_bind_fails)
-{
-    ///arrange
-    CBrokerMocks mocks;
-
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is for the pool*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"));
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_bind(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is for the structure*/
         .IgnoreArgument(1);
+
     ///act
-    auto r = Broker_Create();
+    auto r = Broker_CreateWithOptions(&options);
 
     ///assert
     ASSERT_IS_NULL(r);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_Destroy(r);
 }
 
 //Tests_SRS_BROKER_99_013: [ If broker or module is NULL the function shall return BROKER_INVALIDARG. ]
@@ -1174,7 +1222,7 @@ TEST_FUNCTION(Broker_AddModule_fails_when_Lock_Init_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_quit_uuid_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_Condition_Init_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1193,9 +1241,8 @@ TEST_FUNCTION(Broker_AddModule_fails_quit_uuid_fails)
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1)
-        .SetFailReturn(UNIQUEID_ERROR);
+    whenShallCond_Init_fail = 1;
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1209,7 +1256,7 @@ TEST_FUNCTION(Broker_AddModule_fails_quit_uuid_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_string_construct_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_MESSAGE_QUEUE_create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1228,11 +1275,11 @@ TEST_FUNCTION(Broker_AddModule_fails_string_construct_fails)
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn((STRING_HANDLE)NULL);
+    whenShallMESSAGE_QUEUE_create_fail = 1;
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1246,7 +1293,7 @@ TEST_FUNCTION(Broker_AddModule_fails_string_construct_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_VECTOR_create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1265,15 +1312,14 @@ TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
+    whenShallVECTOR_create_fail = 1;
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_HANDLE)));
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1287,7 +1333,7 @@ TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
+TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1306,19 +1352,18 @@ TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_HANDLE)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    whenShallLock_fail = currentLock_call + 1;
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    whenShallsinglylinkedlist_add_fail = 1;
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1331,9 +1376,8 @@ TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
     Broker_Destroy(broker);
 }
 
-
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_nn_socket_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1352,22 +1396,22 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_socket_fails)
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_HANDLE)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    whenShallsinglylinkedlist_add_fail = 1;
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB))
-        .SetFailReturn(-1);
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1381,7 +1425,7 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_socket_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_ThreadAPI_Create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1400,11 +1444,14 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_HANDLE)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -1414,14 +1461,9 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments()
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
+    whenShallThreadAPI_Create_fail = 1;
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1434,8 +1476,17 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_nn_setSocketOpts_fails)
+//Tests_SRS_BROKER_13_107 : [The function shall assign the module handle to BROKER_MODULEINFO::module.]
+//Tests_SRS_BROKER_13_099: [ The function shall initialize BROKER_MODULEINFO::mailbox_lock with a valid lock handle. ]
+//Tests_SRS_BROKER_30_004: [ The function shall initialize BROKER_MODULEINFO::mailbox_cond with a valid condition handle. ]
+//Tests_SRS_BROKER_30_005: [ The function shall create the module's mailbox by calling MESSAGE_QUEUE_create. ]
+//Tests_SRS_BROKER_30_006: [ The function shall create an empty vector of source module handles the module is linked to. ]
+//Tests_SRS_BROKER_13_102 : [The function shall create a new thread for the module by calling ThreadAPI_Create using module_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.]
+//Tests_SRS_BROKER_13_039 : [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_13_045 : [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]
+//Tests_SRS_BROKER_13_046 : [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_13_047 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_AddModule_succeeds)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1445,175 +1496,133 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_setSocketOpts_fails)
     // this is for the Broker_AddModule call
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_HANDLE)));
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_length(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, 36))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4)
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_IS_NOT_NULL(thread_func_to_call);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_ThreadAPI_Create_fails)
+//Tests_SRS_BROKER_13_026: [ This function shall assign user_data to a local variable called module_info of type BROKER_MODULEINFO*. ]
+//Tests_SRS_BROKER_13_089: [ This function shall acquire the lock on module_info->mailbox_lock. ]
+//Tests_SRS_BROKER_30_001: [ For every iteration of the loop, the function shall wait on module_info->mailbox_cond until the mailbox is not empty or module_info->quit_worker is set. ]
+//Tests_SRS_BROKER_30_003: [ The function shall remove the oldest message from module_info->mailbox. ]
+//Tests_SRS_BROKER_13_091: [ The function shall unlock module_info->mailbox_lock. ]
+//Tests_SRS_BROKER_13_092: [ The function shall deliver the message to the module's callback function via module_info->module_apis. ]
+//Tests_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]
+//Tests_SRS_BROKER_30_002: [ If waiting on the condition fails, the function shall terminate the loop. ]
+TEST_FUNCTION(module_worker_calls_receive_once_then_exits_on_wait_error)
 {
-    ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+
+    // setup fake module's validation data
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
+    call_status_for_FakeModule_Receive.messageHandle = message;
+
+    auto add_result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+
     mocks.ResetAllCalls();
 
-    // this is for the Broker_AddModule call
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
+    //loop 1
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+
+    //loop 2
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_length(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, 36))
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
         .IgnoreArgument(1)
-        .IgnoreArgument(4);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
+        .IgnoreArgument(2)
+        .SetFailReturn(COND_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    whenShallThreadAPI_Create_fail = 1;
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
 
     ///act
-    auto result = Broker_AddModule(broker, &fake_module);
+    auto result = thread_func_to_call(thread_func_args);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_TRUE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-
-
-//Tests_SRS_BROKER_13_107 : [The function shall assign the module handle to BROKER_MODULEINFO::module.]
-//Tests_SRS_BROKER_17_013: [ The function shall create a nanomsg socket for reception. ]
-//Tests_SRS_BROKER_17_014: [ The function shall bind the socket to the the BROKER_HANDLE_DATA::url. ]
-//Tests_SRS_BROKER_13_099: [ The function shall initialize BROKER_MODULEINFO::socket_lock with a valid lock handle. ]
-//Tests_SRS_BROKER_17_020: [ The function shall create a unique ID used as a quit signal. ]
-//Tests_SRS_BROKER_13_102 : [The function shall create a new thread for the module by calling ThreadAPI_Create using module_publish_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.]
-//Tests_SRS_BROKER_13_039 : [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_13_045 : [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_046 : [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_13_047 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-//Tests_SRS_BROKER_17_028: [ The function shall subscribe BROKER_MODULEINFO::receive_socket to the quit signal GUID. ]
-TEST_FUNCTION(Broker_AddModule_succeeds)
+//Tests_SRS_BROKER_30_001: [ For every iteration of the loop, the function shall wait on module_info->mailbox_cond until the mailbox is not empty or module_info->quit_worker is set. ]
+TEST_FUNCTION(module_worker_waits_while_mailbox_is_empty)
 {
-    ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+    auto add_result = Broker_AddModule(broker, &fake_module);
+
     mocks.ResetAllCalls();
 
-    // this is for the Broker_AddModule call
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_length(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, 36))
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
         .IgnoreArgument(1)
-        .IgnoreArgument(4);
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
+        .IgnoreArgument(2)
+        .SetFailReturn(COND_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
 
     ///act
-    auto result = Broker_AddModule(broker, &fake_module);
+    auto result = thread_func_to_call(thread_func_args);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -1621,114 +1630,104 @@ TEST_FUNCTION(Broker_AddModule_succeeds)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_026: [ This function shall assign user_data to a local variable called module_info of type BROKER_MODULEINFO*. ]
-//Tests_SRS_BROKER_13_089: [ This function shall acquire the lock on module_info->socket_lock. ]
-//Tests_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_message_guid is sent to the thread. ]
-//Tests_SRS_BROKER_13_091: [ The function shall unlock module_info->socket_lock. ]
-//Tests_SRS_BROKER_17_005: [ For every iteration of the loop, the function shall wait on the receive_socket for messages. ]
-//Tests_SRS_BROKER_17_017: [ The function shall deserialize the message received. ]
-//Tests_SRS_BROKER_13_092: [ The function shall deliver the message to the module's callback function via module_info->module_apis. ]
-//Tests_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]
-//Tests_SRS_BROKER_17_019: [ The function shall free the buffer received on the receive_socket. ]
-//Tests_SRS_BROKER_17_024: [ The function shall strip off the topic from the message. ]
-TEST_FUNCTION(module_publish_worker_calls_receive_once_then_exits_on_quit_msg)
+//Tests_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_worker is set. ]
+TEST_FUNCTION(module_worker_exits_when_quit_worker_is_set)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-
-    // setup fake module's validation data
-    unsigned char fake;
-    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
     auto add_result = Broker_AddModule(broker, &fake_module);
 
     mocks.ResetAllCalls();
 
-    //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
+
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
         .IgnoreArgument(1);
-
-    //loop 2
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so match this here to let it
-    // recognize quit message
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn("nn_recv");
 
+    // the worker runs inside ThreadAPI_Join, after Broker_RemoveModule signaled it
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .IgnoreAllArguments()
+        .NeverInvoked();
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .NeverInvoked();
+    run_worker_on_join = true;
 
-    auto result = thread_func_to_call(thread_func_args);
+    ///act
+    auto result = Broker_RemoveModule(broker, &fake_module);
 
-    ASSERT_ARE_EQUAL(int, result, 0);
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
-    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_02_004: [ If acquiring the lock fails, then module_publish_worker shall return. ]
-TEST_FUNCTION(module_publish_worker_exits_on_lock_fail)
+//Tests_SRS_BROKER_02_004: [ If acquiring the lock fails, then module_worker shall return. ]
+TEST_FUNCTION(module_worker_exits_on_lock_fail)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-
-    // setup fake module's validation data
-    unsigned char fake;
-    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
     auto add_result = Broker_AddModule(broker, &fake_module);
 
     mocks.ResetAllCalls();
 
-    //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetFailReturn(LOCK_ERROR);
 
-
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_091: [ The function shall unlock module_info->socket_lock. ]
-//Tests_SRS_BROKER_17_016: [ If releasing the lock fails, then module_publish_worker shall return. ]
-TEST_FUNCTION(module_publish_worker_exits_on_Unlock_fail)
+//Tests_SRS_BROKER_17_016: [ If releasing the lock fails, then module_worker shall return. ]
+TEST_FUNCTION(module_worker_exits_on_Unlock_fail)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
@@ -1737,29 +1736,36 @@ TEST_FUNCTION(module_publish_worker_exits_on_Unlock_fail)
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
     auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
 
     auto add_result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
 
     mocks.ResetAllCalls();
 
     //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetFailReturn(LOCK_ERROR);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
 
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -1768,226 +1774,134 @@ TEST_FUNCTION(module_publish_worker_exits_on_Unlock_fail)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_006: [ An error on receiving a message shall terminate the loop. ]
-TEST_FUNCTION(module_publish_worker_exits_on_nn_recv_error)
+//Tests_SRS_BROKER_13_048: [If broker or module is NULL the function shall return BROKER_INVALIDARG.]
+TEST_FUNCTION(Broker_RemoveModule_fails_with_null_broker)
 {
+    ///arrange
     CBrokerMocks mocks;
-    auto broker = Broker_Create();
-
-    // setup fake module's validation data
-    unsigned char fake;
-    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
 
-    auto add_result = Broker_AddModule(broker, &fake_module);
+    ///act
+    auto r1 = Broker_RemoveModule(NULL, (MODULE*)0x1);
 
-    mocks.ResetAllCalls();
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
 
-    //loop 1
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(-1);
+    ///cleanup
+}
 
+//Tests_SRS_BROKER_13_048: [If broker or module is NULL the function shall return BROKER_INVALIDARG.]
+TEST_FUNCTION(Broker_RemoveModule_fails_with_null_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
 
-    auto result = thread_func_to_call(thread_func_args);
+    ///act
+    auto r1 = Broker_RemoveModule((BROKER_HANDLE)0x1, NULL);
 
-    ASSERT_ARE_EQUAL(int, result, 0);
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
-    Broker_RemoveModule(broker, &fake_module);
-    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_message_guid is sent to the thread. ]
-TEST_FUNCTION(module_publish_worker_message_size_matches_but_not_quit_for_me)
+//Tests_SRS_BROKER_13_088 : [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_13_049 : [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]
+//Tests_SRS_BROKER_13_052 : [The function shall remove the module from BROKER_HANDLE_DATA::modules.]
+//Tests_SRS_BROKER_30_019: [ Broker_RemoveModule shall build a routing table that does not contain the module. ]
+//Tests_SRS_BROKER_30_021: [ Broker_RemoveModule shall replace BROKER_HANDLE_DATA::routing_table with the new routing table before stopping the module. ]
+//Tests_SRS_BROKER_13_054 : [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::mailbox_lock. ]
+//Tests_SRS_BROKER_17_021: [ This function shall signal the worker thread to quit by setting BROKER_MODULEINFO::quit_worker and posting BROKER_MODULEINFO::mailbox_cond. ]
+//Tests_SRS_BROKER_02_003: [ After signaling the worker thread, Broker_RemoveModule shall unlock BROKER_MODULEINFO::mailbox_lock. ]
+//Tests_SRS_BROKER_13_104 : [The function shall wait for the module's thread to exit by joining BROKER_MODULEINFO::thread via ThreadAPI_Join. ]
+//Tests_SRS_BROKER_13_057 : [The function shall free all members of the BROKER_MODULEINFO object.]
+//Tests_SRS_BROKER_13_053 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_RemoveModule_succeeds)
 {
+    ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-
-    // setup fake module's validation data
-    unsigned char fake;
-    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
-    auto add_result = Broker_AddModule(broker, &fake_module);
-
+    auto result = Broker_AddModule(broker, &fake_module);
     mocks.ResetAllCalls();
 
-    //loop 1
+    // this is for the Broker_RemoveModule call
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so force a mismatch
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn("nn_send");
-    STRICT_EXPECTED_CALL(mocks, Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-
-    //loop 2
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
+    expectRoutingTableCreate(mocks, 1, 1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
         .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so match this here to let it
-    // recognize quit message
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn("nn_recv");
-
-
-    auto result = thread_func_to_call(thread_func_args);
-
-    ASSERT_ARE_EQUAL(int, result, 0);
-    mocks.AssertActualAndExpectedCalls();
-
-    ///cleanup
-    Message_Destroy(message);
-    Broker_RemoveModule(broker, &fake_module);
-    Broker_Destroy(broker);
-}
-
-//Tests_SRS_BROKER_17_018: [ If the deserialization is not successful, the message loop shall continue. ]
-TEST_FUNCTION(module_publish_worker_continue_on_CreateFromByteArray_fails)
-{
-    CBrokerMocks mocks;
-    auto broker = Broker_Create();
-
-    // setup fake module's validation data
-    unsigned char fake;
-    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
-    auto add_result = Broker_AddModule(broker, &fake_module);
-
-    mocks.ResetAllCalls();
-
-    //loop 1
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn((MESSAGE_HANDLE)NULL);
-
-    //loop 2
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so match this here to let it
-    // recognize quit message
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn("nn_recv");
-
-
-    auto result = thread_func_to_call(thread_func_args);
-
-    ASSERT_ARE_EQUAL(int, result, 0);
-    mocks.AssertActualAndExpectedCalls();
-
-    ///cleanup
-    Message_Destroy(message);
-    Broker_RemoveModule(broker, &fake_module);
-    Broker_Destroy(broker);
-}
 
-//Tests_SRS_BROKER_13_048: [If broker or module is NULL the function shall return BROKER_INVALIDARG.]
-TEST_FUNCTION(Broker_RemoveModule_fails_with_null_broker)
-{
-    ///arrange
-    CBrokerMocks mocks;
 
     ///act
-    auto r1 = Broker_RemoveModule(NULL, (MODULE*)0x1);
+    result = Broker_RemoveModule(broker, &fake_module);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_048: [If broker or module is NULL the function shall return BROKER_INVALIDARG.]
-TEST_FUNCTION(Broker_RemoveModule_fails_with_null_module)
+//Tests_SRS_BROKER_30_007: [ The function shall destroy all messages still queued in the module's mailbox. ]
+TEST_FUNCTION(Broker_RemoveModule_destroys_queued_messages)
 {
     ///arrange
     CBrokerMocks mocks;
+    auto broker = Broker_Create();
 
-    ///act
-    auto r1 = Broker_RemoveModule((BROKER_HANDLE)0x1, NULL);
-
-    ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
-    mocks.AssertActualAndExpectedCalls();
-
-    ///cleanup
-}
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
 
-//Tests_SRS_BROKER_13_088 : [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_13_049 : [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_050 : [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_052 : [The function shall remove the module from BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_054 : [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_17_021: [ This function shall send a quit signal to the worker thread by sending BROKER_MODULEINFO::quit_message_guid to the publish_socket. ]
-//Tests_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::socket_lock. ]
-//Tests_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]
-//Tests_SRS_BROKER_02_003: [ After closing the socket, Broker_RemoveModule shall unlock BROKER_MODULEINFO::info_lock. ]
-//Tests_SRS_BROKER_13_104 : [The function shall wait for the module's thread to exit by joining BROKER_MODULEINFO::thread via ThreadAPI_Join. ]
-//Tests_SRS_BROKER_13_057 : [The function shall free all members of the BROKER_MODULEINFO object.]
-//Tests_SRS_BROKER_13_053 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_RemoveModule_succeeds)
-{
-    ///arrange
-    CBrokerMocks mocks;
-    auto broker = Broker_Create();
     auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+
+    /*the caller gives up its reference, only the mailbox holds the message now*/
+    Message_Destroy(message);
     mocks.ResetAllCalls();
 
-    // this is for the Broker_RemoveModule call
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
@@ -2000,32 +1914,37 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
+    expectRoutingTableCreate(mocks, 1, 1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is the routing table that had the link*/
+        .IgnoreArgument(1);
+    /*the queued clones are released by the mailbox, not by the broker*/
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .NeverInvoked();
 
     ///act
     result = Broker_RemoveModule(broker, &fake_module);
@@ -2095,9 +2014,9 @@ TEST_FUNCTION(Broker_RemoveModule_fails_when_singlylinkedlist_find_fails)
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
 
-TEST_FUNCTION(Broker_RemoveModule_succeeds_when_nn_send_fails)
+//Tests_SRS_BROKER_30_020: [ If the routing table cannot be built, Broker_RemoveModule shall leave the module attached, unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_RemoveModule_fails_when_routing_table_cannot_be_built)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2118,42 +2037,29 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds_when_nn_send_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+    whenShallmalloc_fail = currentmalloc_call + 1;
+    expectRoutingTableCreate(mocks, 1, 1, false);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+        .IgnoreAllArguments()
+        .NeverInvoked();
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments()
+        .NeverInvoked();
 
     ///act
     result = Broker_RemoveModule(broker, &fake_module);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.s]
-TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_Lock_fails)
+//Tests_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_RemoveModule_succeeds_when_Condition_Post_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2174,26 +2080,28 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_Lock_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
+    expectRoutingTableCreate(mocks, 1, 1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
+        .SetFailReturn(COND_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
@@ -2210,8 +2118,8 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_Lock_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
-TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_nn_close_fails)
+//Tests_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_Lock_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2232,28 +2140,26 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_nn_close_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
+    expectRoutingTableCreate(mocks, 1, 1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    whenShallLock_fail = currentLock_call + 2;
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1)
-        .SetReturn(-1);
     STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
@@ -2270,206 +2176,1765 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_nn_close_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
-TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_unlock_fails)
+//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLink_null_broker_fails)
 {
     ///arrange
     CBrokerMocks mocks;
-    auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
-    mocks.ResetAllCalls();
+    BROKER_HANDLE broker = NULL;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
 
-    // this is for the Broker_RemoveModule call
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
+    ///act
+    auto result = Broker_AddLink(broker, &bld);
 
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLink_null_link_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    auto result = Broker_AddLink(broker, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLink_null_source_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        NULL,
+        fake_module_handle
+    };
+
+    ///act
+    auto result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLink_null_sink_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        NULL
+    };
+
+    ///act
+    auto result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_030: [ Broker_AddLink shall lock the modules_lock. ]
+//Tests_SRS_BROKER_17_031: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_sink_handle. ]
+//Tests_SRS_BROKER_17_041: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_source_handle. ]
+//Tests_SRS_BROKER_17_032: [ Broker_AddLink shall add link->module_source_handle to the sources of module_info. ]
+//Tests_SRS_BROKER_30_022: [ Broker_AddLink shall build a new routing table and replace BROKER_HANDLE_DATA::routing_table with it. ]
+//Tests_SRS_BROKER_30_015: [ The routing table, its routes and their sinks shall be allocated as a single block. ]
+//Tests_SRS_BROKER_30_016: [ The route of a source shall hold, once, every module that has the source in its sources. ]
+//Tests_SRS_BROKER_30_017: [ The new routing table shall be swapped in atomically. ]
+//Tests_SRS_BROKER_17_033: [ Broker_AddLink shall unlock the modules_lock. ]
+TEST_FUNCTION(Broker_AddLink_succeeds)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    expectRoutingTableCreate(mocks, 1, 0);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_when_VECTOR_push_back_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    whenShallVECTOR_push_back_fail = currentVECTOR_push_back_call + 1;
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_023: [ If the routing table cannot be built, Broker_AddLink shall remove link->module_source_handle from the sources of module_info again. ]
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_when_routing_table_cannot_be_built)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments()
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    whenShallmalloc_fail = currentmalloc_call + 1;
+    expectRoutingTableCreate(mocks, 1, 0, false);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_source_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_singlylinkedlist_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_lock_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetFailReturn(LOCK_ERROR);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_RemoveLink_null_broker_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = NULL;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    auto result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_RemoveLink_null_link_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    auto result = Broker_RemoveLink(broker, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_RemoveLink_null_source_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        NULL,
+        fake_module_handle
+    };
+
+    ///act
+    auto result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_RemoveLink_null_sink_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        NULL
+    };
+
+    ///act
+    auto result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_036: [ Broker_RemoveLink shall lock the modules_lock. ]
+//Tests_SRS_BROKER_17_037: [ Broker_RemoveLink shall find the module_info for link->module_sink_handle. ]
+//Tests_SRS_BROKER_17_042: [ Broker_RemoveLink shall find the module_info for link->module_source_handle. ]
+//Tests_SRS_BROKER_17_038: [ Broker_RemoveLink shall remove link->module_source_handle from the sources of module_info. ]
+//Tests_SRS_BROKER_30_024: [ Broker_RemoveLink shall build a new routing table and replace BROKER_HANDLE_DATA::routing_table with it. ]
+//Tests_SRS_BROKER_30_018: [ The previous routing table shall be freed after every Broker_Publish call that could have read it has returned. ]
+//Tests_SRS_BROKER_17_039: [ Broker_RemoveLink shall unlock the modules_lock. ]
+TEST_FUNCTION(Broker_RemoveLink_succeeds)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, fake_module_handle))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    expectRoutingTableCreate(mocks, 1, 0);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is the routing table that had the link*/
+        .IgnoreArgument(1);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
+TEST_FUNCTION(Broker_RemoveLink_fails_when_link_does_not_exist)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, fake_module_handle))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetFailReturn((void*)NULL);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_025: [ If the routing table cannot be built, Broker_RemoveLink shall add link->module_source_handle back to the sources of module_info. ]
+//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
+TEST_FUNCTION(Broker_RemoveLink_fails_when_routing_table_cannot_be_built)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments()
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, fake_module_handle))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    whenShallmalloc_fail = currentmalloc_call + 1;
+    expectRoutingTableCreate(mocks, 1, 0, false);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn(nullptr);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+
+//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
+TEST_FUNCTION(Broker_RemoveLink_fails_singlylinkedlist_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn(nullptr);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
+TEST_FUNCTION(Broker_RemoveLink_fails_lock_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetFailReturn(LOCK_ERROR);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_13_108: [If broker is NULL then Broker_IncRef shall do nothing.]
+TEST_FUNCTION(Broker_IncRef_does_nothing_with_null_input)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    ///act
+    Broker_IncRef(NULL);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_109: [Otherwise, `Broker_IncRef` shall increment the internal ref count.]
+TEST_FUNCTION(Broker_IncRef_increments_ref_count_1)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    mocks.ResetAllCalls();
+
+    ///act
+    Broker_IncRef(broker);
+    Broker_DecRef(broker);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_13_111: [ Otherwise, Broker_Destroy shall decrement the internal ref count of the message. ]
+TEST_FUNCTION(Broker_IncRef_increments_ref_count_1_destroy)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    mocks.ResetAllCalls();
+
+    ///act
+    Broker_IncRef(broker);
+    Broker_Destroy(broker);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_13_058: [If broker is NULL the function shall do nothing.]
+TEST_FUNCTION(Broker_Destroy_does_nothing_with_null_input)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    ///act
+    Broker_Destroy(NULL);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_058: [If broker is NULL the function shall do nothing.]
+TEST_FUNCTION(Broker_DecRef_does_nothing_with_null_input)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    ///act
+    Broker_DecRef(NULL);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_112: [If the ref count is zero then the allocated resources are freed.]
+TEST_FUNCTION(Broker_Destroy_works)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    mocks.ResetAllCalls();
+
+    // these are for Broker_Destroy
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    Broker_Destroy(broker);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_026: [ The current routing table shall be freed. ]
+TEST_FUNCTION(Broker_Destroy_frees_the_routing_table)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+    result = Broker_RemoveLink(broker, &bld);
+    result = Broker_RemoveModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    // these are for Broker_Destroy
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is the routing table*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    Broker_Destroy(broker);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_112: [If the ref count is zero then the allocated resources are freed.]
+//Tests_SRS_BROKER_13_113: [ This function shall implement all the requirements of the Broker_Destroy API. ]
+TEST_FUNCTION(Broker_DecRef_works)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    mocks.ResetAllCalls();
+
+    // these are for Broker_Destroy
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    Broker_DecRef(broker);
+
+    ///assert
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]
+TEST_FUNCTION(Broker_Publish_fails_with_null_broker)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    ///act
+    auto r1 = Broker_Publish(NULL, fake_module_handle, (MESSAGE_HANDLE)0x1);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]
+TEST_FUNCTION(Broker_Publish_fails_with_null_message)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    ///act
+    auto r1 = Broker_Publish((BROKER_HANDLE)0x1, fake_module_handle, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]
+TEST_FUNCTION(Broker_Publish_fails_with_null_source)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    ///act
+    auto r1 = Broker_Publish((BROKER_HANDLE)0x1, NULL, (MESSAGE_HANDLE)0x1);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+//Tests_SRS_BROKER_17_022: [ Broker_Publish shall register itself as a reader of the routing table instead of locking BROKER_HANDLE_DATA::modules_lock. ]
+//Tests_SRS_BROKER_30_009: [ Broker_Publish shall deliver the message to every module in the route of source. ]
+//Tests_SRS_BROKER_17_007: [ Broker_Publish shall clone the message for each linked sink. ]
+//Tests_SRS_BROKER_30_010: [ Broker_Publish shall lock the sink's mailbox_lock. ]
+//Tests_SRS_BROKER_30_011: [ Broker_Publish shall push the cloned message into the sink's mailbox. ]
+//Tests_SRS_BROKER_30_012: [ Broker_Publish shall signal the sink's mailbox_cond. ]
+//Tests_SRS_BROKER_30_013: [ Broker_Publish shall unlock the sink's mailbox_lock. ]
+//Tests_SRS_BROKER_17_023: [ Broker_Publish shall unregister itself as a reader of the routing table. ]
+//Tests_SRS_BROKER_13_037 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_Publish_succeeds)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, message))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_009: [ Broker_Publish shall deliver the message to every module in the route of source. ]
+TEST_FUNCTION(Broker_Publish_does_not_deliver_to_unlinked_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message))
+        .NeverInvoked();
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_009: [ Broker_Publish shall deliver the message to every module in the route of source. ]
+TEST_FUNCTION(Broker_Publish_does_not_deliver_after_RemoveLink)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+    result = Broker_RemoveLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message))
+        .NeverInvoked();
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .NeverInvoked();
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_Publish_fails_when_Message_Clone_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    whenShallMessage_Clone_fail = currentMessage_Clone_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_Publish_fails_when_mailbox_Lock_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    whenShallLock_fail = currentLock_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_012: [ Broker_Publish shall destroy the cloned message if it cannot be queued. ]
+TEST_FUNCTION(Broker_Publish_fails_when_MESSAGE_QUEUE_push_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    whenShallMESSAGE_QUEUE_push_fail = currentMESSAGE_QUEUE_push_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, message))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_Publish_succeeds_when_Condition_Post_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    whenShallCond_Post_fail = currentCond_Post_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, message))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+
+//Tests_SRS_BROKER_30_036: [ With a worker pool, the function shall assign the module to the workers of the pool in turn instead of creating a thread. ]
+TEST_FUNCTION(Broker_AddModule_with_worker_pool_does_not_create_a_thread)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 1 };
+    auto broker = Broker_CreateWithOptions(&options);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_HANDLE)));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_AddModule(broker, &fake_module);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_049: [ With a worker pool, Broker_Publish shall mark the sink ready and queue it to its worker if the sink is idle. ]
+TEST_FUNCTION(Broker_Publish_with_worker_pool_schedules_an_idle_sink)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 1 };
+    auto broker = Broker_CreateWithOptions(&options);
+
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, message))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the ready queue*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    /*no worker is waiting, the module is picked up by the next one to look for work*/
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .NeverInvoked();
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_049: [ With a worker pool, Broker_Publish shall mark the sink ready and queue it to its worker if the sink is idle. ]
+TEST_FUNCTION(Broker_Publish_with_worker_pool_does_not_schedule_a_ready_sink_again)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 1 };
+    auto broker = Broker_CreateWithOptions(&options);
+
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, message))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_038: [ The pool worker shall acquire the lock on module_info->mailbox_lock before every message. ]
+//Tests_SRS_BROKER_30_040: [ If the mailbox is empty, the pool worker shall mark the module idle. ]
+//Tests_SRS_BROKER_30_042: [ Otherwise the pool worker shall mark the module running and remove the oldest message from module_info->mailbox. ]
+//Tests_SRS_BROKER_30_043: [ The pool worker shall deliver the message to the module's callback function without holding module_info->mailbox_lock and destroy it afterwards. ]
+//Tests_SRS_BROKER_30_044: [ The pool worker shall take the oldest module from its own ready queue or, if it is empty, from the ready queues of the other workers. ]
+//Tests_SRS_BROKER_30_046: [ When no module is ready, the pool worker shall wait on the pool's idle_cond. ]
+//Tests_SRS_BROKER_30_047: [ If waiting on the condition fails, the pool worker shall return. ]
+TEST_FUNCTION(worker_pool_worker_delivers_the_message_then_exits_on_wait_error)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 1 };
+    auto broker = Broker_CreateWithOptions(&options);
+
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
+    call_status_for_FakeModule_Receive.messageHandle = message;
+
+    auto add_result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+
+    mocks.ResetAllCalls();
+
+    //take the module out of the ready queue
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    //message 1
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+
+    //empty mailbox
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    //nothing is ready
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetFailReturn(COND_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = thread_func_to_call(thread_func_args);
+
+    ///assert
+    ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_TRUE(call_status_for_FakeModule_Receive.was_called);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_037: [ With a worker pool, Broker_RemoveModule shall set BROKER_MODULEINFO::quit_worker and take the module out of its worker's ready queue. ]
+//Tests_SRS_BROKER_30_048: [ With a worker pool, Broker_RemoveModule shall wait on BROKER_MODULEINFO::mailbox_cond until no worker runs the module. ]
+TEST_FUNCTION(Broker_RemoveModule_with_worker_pool_unschedules_a_ready_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 1 };
+    auto broker = Broker_CreateWithOptions(&options);
+
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    Message_Destroy(message);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    expectRoutingTableCreate(mocks, 1, 1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the ready queue*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    /*the module was never taken by a worker, there is nothing to wait for*/
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .IgnoreAllArguments()
+        .NeverInvoked();
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is the routing table that had the link*/
+        .IgnoreArgument(1);
+
+    ///act
+    result = Broker_RemoveModule(broker, &fake_module);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_045: [ The pool worker shall return once no module is ready and the pool is stopping. ]
+//Tests_SRS_BROKER_30_050: [ If the broker has a worker pool, the workers shall be stopped and the pool freed. ]
+TEST_FUNCTION(Broker_Destroy_stops_the_worker_pool)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 1 };
+    auto broker = Broker_CreateWithOptions(&options);
+    run_worker_on_join = true;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG)) /*ready queue, pool and modules locks*/
         .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is for the pool*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*this is for the structure*/
         .IgnoreArgument(1);
 
     ///act
-    result = Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_broker_fails)
+
+//Tests_SRS_BROKER_30_056: [ If mailbox_options has a capacity and an overflow policy that is not a BROKER_OVERFLOW_POLICY value, the function shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddModuleWithOptions_fails_with_unknown_overflow_policy)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = NULL;
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
+    auto broker = Broker_Create();
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 4, (BROKER_OVERFLOW_POLICY)42, NULL };
+    mocks.ResetAllCalls();
 
     ///act
-    auto result = Broker_AddLink(broker, &bld);
+    auto result = Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_link_fails)
+//Tests_SRS_BROKER_30_057: [ If mailbox_options has a capacity, the BROKER_OVERFLOW_COALESCE policy and a NULL coalesce_key, the function shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddModuleWithOptions_fails_for_coalesce_without_key)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
+    auto broker = Broker_Create();
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 4, BROKER_OVERFLOW_COALESCE, NULL };
+    mocks.ResetAllCalls();
 
     ///act
-    auto result = Broker_AddLink(broker, NULL);
+    auto result = Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_source_fails)
+//Tests_SRS_BROKER_30_135: [ If the broker has a worker pool and mailbox_options has a capacity and the BROKER_OVERFLOW_BLOCK policy, the function shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddModuleWithOptions_with_worker_pool_refuses_modules_that_block_each_other)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
-    BROKER_LINK_DATA bld =
+    BROKER_OPTIONS options = { BROKER_SCHEDULER_WORKER_POOL, 1 };
+    auto broker = Broker_CreateWithOptions(&options);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto first = Message_Create(&c);
+    auto second = Message_Create(&c);
+    MODULE peer_module =
     {
-        NULL,
+        (const MODULE_API *)&fake_module_apis,
+        (MODULE_HANDLE)0x43
+    };
+    BROKER_MAILBOX_OPTIONS block_options = { 1, BROKER_OVERFLOW_BLOCK, NULL };
+    BROKER_MAILBOX_OPTIONS drop_options = { 1, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    BROKER_LINK_DATA to_peer =
+    {
+        fake_module_handle,
+        peer_module.module_handle
+    };
+    BROKER_LINK_DATA from_peer =
+    {
+        peer_module.module_handle,
         fake_module_handle
     };
 
     ///act
-    auto result = Broker_AddLink(broker, &bld);
+    auto block_result1 = Broker_AddModuleWithOptions(broker, &fake_module, &block_options);
+    auto block_result2 = Broker_AddModuleWithOptions(broker, &peer_module, &block_options);
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &drop_options);
+    (void)Broker_AddModuleWithOptions(broker, &peer_module, &drop_options);
+    (void)Broker_AddLink(broker, &to_peer);
+    (void)Broker_AddLink(broker, &from_peer);
+    (void)Broker_Publish(broker, fake_module_handle, first); /*the worker does not run, these fill the mailboxes*/
+    (void)Broker_Publish(broker, peer_module.module_handle, first);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .IgnoreAllArguments()
+        .NeverInvoked();
+    mocks.SetIgnoreUnexpectedCalls(true);
+
+    auto publish_result1 = Broker_Publish(broker, fake_module_handle, second);
+    auto publish_result2 = Broker_Publish(broker, peer_module.module_handle, second);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, block_result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, block_result2);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_MESSAGE_DROPPED, publish_result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_MESSAGE_DROPPED, publish_result2);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Message_Destroy(first);
+    Message_Destroy(second);
+    (void)Broker_RemoveLink(broker, &from_peer);
+    (void)Broker_RemoveLink(broker, &to_peer);
+    Broker_RemoveModule(broker, &peer_module);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_sink_fails)
+//Tests_SRS_BROKER_30_052: [ If mailbox_options is NULL or its capacity is 0, the module's mailbox shall be unbounded. ]
+TEST_FUNCTION(Broker_AddModuleWithOptions_ignores_policy_without_capacity)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        NULL
-    };
+    auto broker = Broker_Create();
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 0, (BROKER_OVERFLOW_POLICY)42, NULL };
+    mocks.ResetAllCalls();
 
     ///act
-    auto result = Broker_AddLink(broker, &bld);
+    auto result = Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
 
     ///cleanup
-
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_030: [ Broker_AddLink shall lock the modules_lock. ]
-//Tests_SRS_BROKER_17_031: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_sink_handle. ]
-//Tests_SRS_BROKER_17_041: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_source_handle. ]
-//Tests_SRS_BROKER_17_032: [ Broker_AddLink shall subscribe module_info->receive_socket to the link->module_source_handle module handle. ]
-//Tests_SRS_BROKER_17_033: [ Broker_AddLink shall unlock the modules_lock. ]
-TEST_FUNCTION(Broker_AddLink_succeeds)
+//Tests_SRS_BROKER_30_054: [ For BROKER_OVERFLOW_BLOCK, the function shall initialize BROKER_MODULEINFO::space_cond with a valid condition handle. ]
+TEST_FUNCTION(Broker_AddModuleWithOptions_creates_space_condition_for_block_policy)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 4, BROKER_OVERFLOW_BLOCK, NULL };
     mocks.ResetAllCalls();
 
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4);
-
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
+    STRICT_EXPECTED_CALL(mocks, Condition_Init()) /*mailbox_cond and space_cond*/
+        .ExpectedTimesExactly(2);
+    mocks.SetIgnoreUnexpectedCalls(true);
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    auto result = Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -2477,51 +3942,24 @@ TEST_FUNCTION(Broker_AddLink_succeeds)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_setsocketoption_fails)
+//Tests_SRS_BROKER_30_053: [ For BROKER_OVERFLOW_COALESCE, the function shall copy the coalesce_key into BROKER_MODULEINFO::coalesce_key. ]
+TEST_FUNCTION(Broker_AddModuleWithOptions_copies_the_coalesce_key)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 4, BROKER_OVERFLOW_COALESCE, "deviceName" };
     mocks.ResetAllCalls();
 
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, "deviceName"))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4)
-        .SetFailReturn(-1);
-
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
+    mocks.SetIgnoreUnexpectedCalls(true);
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    auto result = Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -2529,359 +3967,457 @@ TEST_FUNCTION(Broker_AddLink_fails_setsocketoption_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_source_find_fails)
+//Tests_SRS_BROKER_30_063: [ If the sink's mailbox is full and its policy is BROKER_OVERFLOW_DROP_NEWEST, Broker_Publish shall destroy the message and return BROKER_MESSAGE_DROPPED. ]
+//Tests_SRS_BROKER_30_065: [ If no sink failed and the overflow policy of a sink rejected the message, Broker_Publish shall return BROKER_MESSAGE_DROPPED. ]
+TEST_FUNCTION(Broker_Publish_drops_newest_message_when_mailbox_is_full)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 1, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message); /*the worker does not run, this fills the mailbox*/
     mocks.ResetAllCalls();
 
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
-
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    auto result = Broker_Publish(broker, fake_module_handle, message);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_MESSAGE_DROPPED, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_singlylinkedlist_find_fails)
+//Tests_SRS_BROKER_30_060: [ If the sink's mailbox is full and its policy is BROKER_OVERFLOW_DROP_OLDEST, Broker_Publish shall remove and destroy the oldest message of the mailbox. ]
+TEST_FUNCTION(Broker_Publish_drops_oldest_message_when_mailbox_is_full)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto oldest = Message_Create(&c);
+    auto newest = Message_Create(&c);
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 1, BROKER_OVERFLOW_DROP_OLDEST, NULL };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, oldest);
     mocks.ResetAllCalls();
 
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(newest));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(newest));
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(oldest));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, newest))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
 
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, newest);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(oldest);
+    Message_Destroy(newest);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_132: [ Broker_Publish shall wait for room at most BROKER_BLOCK_TIMEOUT_MS milliseconds in all, whatever the number of messages and sinks. ]
+//Tests_SRS_BROKER_30_133: [ If the mailbox still has no room once the wait times out, Broker_Publish shall discard the message, count it as dropped and return BROKER_MESSAGE_DROPPED. ]
+TEST_FUNCTION(Broker_Publish_drops_message_when_the_wait_for_room_times_out)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto first = Message_Create(&c);
+    auto second = Message_Create(&c);
+    MODULE sink_module =
+    {
+        (const MODULE_API *)&fake_module_apis,
+        (MODULE_HANDLE)0x43
+    };
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 1, BROKER_OVERFLOW_BLOCK, NULL };
+    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_AddModuleWithOptions(broker, &sink_module, &mailbox_options);
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
-        fake_module_handle
+        sink_module.module_handle
     };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, first); /*the worker does not run, this fills the mailbox*/
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .IgnoreAllArguments()
+        .SetReturn(COND_TIMEOUT);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(second));
+    mocks.SetIgnoreUnexpectedCalls(true);
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    auto result = Broker_Publish(broker, fake_module_handle, second);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    BROKER_MODULE_STATS stats;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_MESSAGE_DROPPED, result);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, Broker_GetModuleStats(broker, sink_module.module_handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 1, stats.depth);
+    ASSERT_ARE_EQUAL(size_t, 1, stats.dropped);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Message_Destroy(first);
+    Message_Destroy(second);
+    (void)Broker_RemoveLink(broker, &bld);
+    Broker_RemoveModule(broker, &sink_module);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_lock_fails)
+//Tests_SRS_BROKER_30_134: [ If the source is the sink and its mailbox is bounded with BROKER_OVERFLOW_BLOCK, Broker_AddLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLink_fails_to_link_a_blocking_module_to_itself)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
-    mocks.ResetAllCalls();
-
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
-
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 4, BROKER_OVERFLOW_BLOCK, NULL };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
+    mocks.ResetAllCalls();
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    auto result = Broker_AddLink(broker, &bld);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result);
 
     ///cleanup
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_RemoveLink_null_broker_fails)
+//Tests_SRS_BROKER_30_061: [ If the sink's mailbox is full and its policy is BROKER_OVERFLOW_COALESCE, Broker_Publish shall replace the oldest queued message that has the same value for the coalesce_key property as the message by calling MESSAGE_QUEUE_replace_if, and destroy the replaced message. ]
+//Tests_SRS_BROKER_30_136: [ Broker_Publish shall count the replaced message as coalesced, not dropped, and record the time the message was queued and the size of its content in the place of the replaced message. ]
+TEST_FUNCTION(Broker_Publish_coalesces_message_with_the_same_key)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = NULL;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto older = Message_Create(&c);
+    auto newer = Message_Create(&c);
+    fake_coalesce_values[older] = "device1";
+    fake_coalesce_values[newer] = "device1";
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 1, BROKER_OVERFLOW_COALESCE, "deviceName" };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, older);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_replace_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, newer))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(older));
+    mocks.SetIgnoreUnexpectedCalls(true);
 
     ///act
-    auto result = Broker_RemoveLink(broker, &bld);
+    auto result = Broker_Publish(broker, fake_module_handle, newer);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    BROKER_MODULE_STATS stats;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, Broker_GetModuleStats(broker, fake_module_handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 1, stats.depth);
+    ASSERT_ARE_EQUAL(size_t, 0, stats.dropped);
+    ASSERT_ARE_EQUAL(size_t, 1, stats.coalesced);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Message_Destroy(older);
+    Message_Destroy(newer);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_RemoveLink_null_link_fails)
+//Tests_SRS_BROKER_30_062: [ If no queued message matches, Broker_Publish shall destroy the message and return BROKER_MESSAGE_DROPPED. ]
+TEST_FUNCTION(Broker_Publish_drops_message_when_nothing_coalesces)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto older = Message_Create(&c);
+    auto newer = Message_Create(&c);
+    fake_coalesce_values[older] = "device1";
+    fake_coalesce_values[newer] = "device2";
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 1, BROKER_OVERFLOW_COALESCE, "deviceName" };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, older);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(newer));
+    mocks.SetIgnoreUnexpectedCalls(true);
 
     ///act
-    auto result = Broker_RemoveLink(broker, NULL);
+    auto result = Broker_Publish(broker, fake_module_handle, newer);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    BROKER_MODULE_STATS stats;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_MESSAGE_DROPPED, result);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, Broker_GetModuleStats(broker, fake_module_handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 1, stats.depth);
+    ASSERT_ARE_EQUAL(size_t, 1, stats.dropped);
+    ASSERT_ARE_EQUAL(size_t, 0, stats.coalesced);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Message_Destroy(older);
+    Message_Destroy(newer);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_RemoveLink_null_source_fails)
+//Tests_SRS_BROKER_30_066: [ If broker, module or stats are NULL, Broker_GetModuleStats shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetModuleStats_fails_with_null_arguments)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
-    BROKER_LINK_DATA bld =
-    {
-        NULL,
-        fake_module_handle
-    };
+    auto broker = Broker_Create();
+    BROKER_MODULE_STATS stats;
+    mocks.ResetAllCalls();
 
     ///act
-    auto result = Broker_RemoveLink(broker, &bld);
+    auto result1 = Broker_GetModuleStats(NULL, fake_module_handle, &stats);
+    auto result2 = Broker_GetModuleStats(broker, NULL, &stats);
+    auto result3 = Broker_GetModuleStats(broker, fake_module_handle, NULL);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result2);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result3);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_RemoveLink_null_sink_fails)
+//Tests_SRS_BROKER_30_068: [ If the module is not attached to the broker, Broker_GetModuleStats shall return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_GetModuleStats_fails_for_unknown_module)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        NULL
-    };
+    auto broker = Broker_Create();
+    BROKER_MODULE_STATS stats;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
 
     ///act
-    auto result = Broker_RemoveLink(broker, &bld);
+    auto result = Broker_GetModuleStats(broker, fake_module_handle, &stats);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_ERROR, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_036: [ Broker_RemoveLink shall lock the modules_lock. ]
-//Tests_SRS_BROKER_17_037: [ Broker_RemoveLink shall find the module_info for link->module_sink_handle. ]
-//Tests_SRS_BROKER_17_042: [ Broker_RemoveLink shall find the module_info for link->module_source_handle. ]
-//Tests_SRS_BROKER_17_038: [ Broker_RemoveLink shall unsubscribe module_info->receive_socket from the link->module_source_handle module handle. ]
-//Tests_SRS_BROKER_17_039: [ Broker_RemoveLink shall unlock the modules_lock. ]
-TEST_FUNCTION(Broker_RemoveLink_succeeds)
+//Tests_SRS_BROKER_30_067: [ Broker_GetModuleStats shall lock BROKER_HANDLE_DATA::modules_lock and find the module. ]
+//Tests_SRS_BROKER_30_069: [ Broker_GetModuleStats shall copy the depth, the dropped count and the coalesced count of the module's mailbox into stats under BROKER_MODULEINFO::mailbox_lock and return BROKER_OK. ]
+TEST_FUNCTION(Broker_GetModuleStats_reports_depth_and_drops)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 2, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
-    result = Broker_AddLink(broker, &bld);
-
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    BROKER_MODULE_STATS stats;
     mocks.ResetAllCalls();
 
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*modules_lock*/
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
+        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*mailbox_lock*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_UNSUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4);
-
     ///act
-    result = Broker_RemoveLink(broker, &bld);
+    auto result = Broker_GetModuleStats(broker, fake_module_handle, &stats);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(size_t, 2, stats.depth);
+    ASSERT_ARE_EQUAL(size_t, 1, stats.dropped);
+    ASSERT_ARE_EQUAL(size_t, 0, stats.coalesced);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
-TEST_FUNCTION(Broker_RemoveLink_fails_sockopt_fails)
+//Tests_SRS_BROKER_30_137: [ If broker, module or options are NULL, Broker_GetModuleMailbox shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetModuleMailbox_fails_with_null_arguments)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
-    result = Broker_AddLink(broker, &bld);
+    BROKER_MAILBOX_OPTIONS options;
+    mocks.ResetAllCalls();
+
+    ///act
+    auto result1 = Broker_GetModuleMailbox(NULL, fake_module_handle, &options);
+    auto result2 = Broker_GetModuleMailbox(broker, NULL, &options);
+    auto result3 = Broker_GetModuleMailbox(broker, fake_module_handle, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result2);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result3);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
 
+//Tests_SRS_BROKER_30_139: [ If the module is not attached to the broker, Broker_GetModuleMailbox shall return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_GetModuleMailbox_fails_for_unknown_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    BROKER_MAILBOX_OPTIONS options;
     mocks.ResetAllCalls();
 
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_UNSUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4)
-        .SetFailReturn(-1);
 
     ///act
-    result = Broker_RemoveLink(broker, &bld);
+    auto result = Broker_GetModuleMailbox(broker, fake_module_handle, &options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_ERROR, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
+//Tests_SRS_BROKER_30_138: [ Broker_GetModuleMailbox shall lock BROKER_HANDLE_DATA::modules_lock and find the module. ]
+//Tests_SRS_BROKER_30_140: [ Broker_GetModuleMailbox shall copy the capacity, the overflow policy and the coalesce key of the module's mailbox into options and return BROKER_OK. ]
+TEST_FUNCTION(Broker_GetModuleMailbox_reports_the_limits_of_the_mailbox)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
-    result = Broker_AddLink(broker, &bld);
-
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 3, BROKER_OVERFLOW_COALESCE, "deviceName" };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
+    BROKER_MAILBOX_OPTIONS options;
     mocks.ResetAllCalls();
 
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
+        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn(nullptr);
 
     ///act
-    result = Broker_RemoveLink(broker, &bld);
+    auto result = Broker_GetModuleMailbox(broker, fake_module_handle, &options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(size_t, 3, options.capacity);
+    ASSERT_ARE_EQUAL(int, (int)BROKER_OVERFLOW_COALESCE, (int)options.overflow);
+    ASSERT_ARE_EQUAL(char_ptr, "deviceName", options.coalesce_key);
+    ASSERT_ARE_NOT_EQUAL(void_ptr, (void*)mailbox_options.coalesce_key, (void*)options.coalesce_key);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -2889,491 +4425,697 @@ TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
     Broker_Destroy(broker);
 }
 
-
-//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
-TEST_FUNCTION(Broker_RemoveLink_fails_singlylinkedlist_find_fails)
+//Tests_SRS_BROKER_30_092: [ If broker, module or metrics are NULL, Broker_GetModuleMetrics shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetModuleMetrics_fails_with_null_arguments)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
-    result = Broker_AddLink(broker, &bld);
+    BROKER_MODULE_METRICS metrics;
+    mocks.ResetAllCalls();
+
+    ///act
+    auto result1 = Broker_GetModuleMetrics(NULL, fake_module_handle, &metrics);
+    auto result2 = Broker_GetModuleMetrics(broker, NULL, &metrics);
+    auto result3 = Broker_GetModuleMetrics(broker, fake_module_handle, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result2);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result3);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
 
+//Tests_SRS_BROKER_30_094: [ If the module is not attached to the broker, Broker_GetModuleMetrics shall return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_GetModuleMetrics_fails_for_unknown_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    BROKER_MODULE_METRICS metrics;
     mocks.ResetAllCalls();
 
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn(nullptr);
 
     ///act
-    result = Broker_RemoveLink(broker, &bld);
+    auto result = Broker_GetModuleMetrics(broker, fake_module_handle, &metrics);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_ERROR, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
-TEST_FUNCTION(Broker_RemoveLink_fails_lock_fails)
+//Tests_SRS_BROKER_30_090: [ Broker_Publish shall get the size of the content of every message by calling Message_GetContent once, whatever the number of sinks. ]
+//Tests_SRS_BROKER_30_091: [ Broker_Publish shall add the messages and the size of their content to the publish counters of the source. ]
+//Tests_SRS_BROKER_30_093: [ Broker_GetModuleMetrics shall lock BROKER_HANDLE_DATA::modules_lock and find the module. ]
+//Tests_SRS_BROKER_30_095: [ Broker_GetModuleMetrics shall copy the counters and the histograms of the module's mailbox into metrics under BROKER_MODULEINFO::mailbox_lock. ]
+//Tests_SRS_BROKER_30_096: [ Broker_GetModuleMetrics shall read the publish counters of the module atomically and return BROKER_OK. ]
+TEST_FUNCTION(Broker_GetModuleMetrics_reports_published_and_depth)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_AddModule(broker, &fake_module);
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
-    result = Broker_AddLink(broker, &bld);
-
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    BROKER_MODULE_METRICS metrics;
     mocks.ResetAllCalls();
 
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*modules_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*mailbox_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
 
     ///act
-    result = Broker_RemoveLink(broker, &bld);
+    auto result = Broker_GetModuleMetrics(broker, fake_module_handle, &metrics);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(size_t, 2, metrics.published);
+    ASSERT_ARE_EQUAL(uint64_t, (uint64_t)(2 * sizeof(fake_content_bytes)), metrics.bytes_published);
+    ASSERT_ARE_EQUAL(size_t, 2, metrics.depth);
+    ASSERT_ARE_EQUAL(size_t, 0, metrics.received);
+    ASSERT_ARE_EQUAL(size_t, 0, metrics.receive_time.count);
+    ASSERT_ARE_EQUAL(size_t, 0, metrics.queue_wait.count);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_108: [If broker is NULL then Broker_IncRef shall do nothing.]
-TEST_FUNCTION(Broker_IncRef_does_nothing_with_null_input)
+//Tests_SRS_BROKER_30_097: [ If broker, link, link->module_source_handle, link->module_sink_handle or metrics are NULL, Broker_GetLinkMetrics shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetLinkMetrics_fails_with_null_arguments)
 {
     ///arrange
     CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    BROKER_LINK_METRICS metrics;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_DATA no_sink =
+    {
+        fake_module_handle,
+        NULL
+    };
+    mocks.ResetAllCalls();
 
     ///act
-    Broker_IncRef(NULL);
+    auto result1 = Broker_GetLinkMetrics(NULL, &bld, &metrics);
+    auto result2 = Broker_GetLinkMetrics(broker, NULL, &metrics);
+    auto result3 = Broker_GetLinkMetrics(broker, &no_sink, &metrics);
+    auto result4 = Broker_GetLinkMetrics(broker, &bld, NULL);
 
     ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result2);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result3);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result4);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_109: [Otherwise, `Broker_IncRef` shall increment the internal ref count.]
-TEST_FUNCTION(Broker_IncRef_increments_ref_count_1)
+//Tests_SRS_BROKER_30_100: [ If the link does not exist, Broker_GetLinkMetrics shall return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_GetLinkMetrics_fails_for_missing_link)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_METRICS metrics;
     mocks.ResetAllCalls();
 
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
     ///act
-    Broker_IncRef(broker);
-    Broker_DecRef(broker);
+    auto result = Broker_GetLinkMetrics(broker, &bld, &metrics);
 
     ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_ERROR, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_111: [ Otherwise, Broker_Destroy shall decrement the internal ref count of the message. ]
-TEST_FUNCTION(Broker_IncRef_increments_ref_count_1_destroy)
+//Tests_SRS_BROKER_30_089: [ Broker_Publish shall add the messages queued, the size of their content and the messages rejected by the overflow policy to the counters of the link. ]
+//Tests_SRS_BROKER_30_098: [ Broker_GetLinkMetrics shall lock BROKER_HANDLE_DATA::modules_lock so that the routing table is not replaced while it is read. ]
+//Tests_SRS_BROKER_30_099: [ Broker_GetLinkMetrics shall look for the sink in the route of the source. ]
+//Tests_SRS_BROKER_30_101: [ Broker_GetLinkMetrics shall read the counters of the link atomically into metrics and return BROKER_OK. ]
+TEST_FUNCTION(Broker_GetLinkMetrics_counts_delivered_and_dropped)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_MAILBOX_OPTIONS mailbox_options = { 2, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    (void)Broker_AddModuleWithOptions(broker, &fake_module, &mailbox_options);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    BROKER_LINK_METRICS metrics;
     mocks.ResetAllCalls();
 
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
     ///act
-    Broker_IncRef(broker);
-    Broker_Destroy(broker);
+    auto result = Broker_GetLinkMetrics(broker, &bld, &metrics);
 
     ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(size_t, 2, metrics.delivered);
+    ASSERT_ARE_EQUAL(uint64_t, (uint64_t)(2 * sizeof(fake_content_bytes)), metrics.bytes_delivered);
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.dropped);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_058: [If broker is NULL the function shall do nothing.]
-TEST_FUNCTION(Broker_Destroy_does_nothing_with_null_input)
+//Tests_SRS_BROKER_30_104: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, or filter has a NULL matches, name or pattern, Broker_AddLinkWithFilter shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLinkWithFilter_fails_with_a_null_pattern)
 {
     ///arrange
     CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_PROPERTY_MATCH match = { "macAddress", NULL };
+    BROKER_LINK_FILTER filter = { 1, &match };
 
     ///act
-    Broker_Destroy(NULL);
+    auto result = Broker_AddLinkWithFilter(broker, &bld, &filter);
 
     ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
 }
 
-//Tests_SRS_BROKER_13_058: [If broker is NULL the function shall do nothing.]
-TEST_FUNCTION(Broker_DecRef_does_nothing_with_null_input)
+//Tests_SRS_BROKER_30_106: [ If the sink is already linked to the source, Broker_AddLinkWithFilter shall return BROKER_ADD_LINK_ERROR. ]
+TEST_FUNCTION(Broker_AddLinkWithFilter_fails_when_the_modules_are_already_linked)
 {
     ///arrange
     CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    BROKER_PROPERTY_MATCH match = { "macAddress", "AA:*" };
+    BROKER_LINK_FILTER filter = { 1, &match };
 
     ///act
-    Broker_DecRef(NULL);
+    auto result = Broker_AddLinkWithFilter(broker, &bld, &filter);
 
     ///assert
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_ADD_LINK_ERROR, result);
 
     ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_112: [If the ref count is zero then the allocated resources are freed.]
-TEST_FUNCTION(Broker_Destroy_works)
+//Tests_SRS_BROKER_30_107: [ Broker_AddLinkWithFilter shall copy filter into a single allocation and compile its patterns. ]
+//Tests_SRS_BROKER_30_111: [ Broker_Publish shall only deliver to the sink of a filtered link the messages whose properties match every condition of the filter. ]
+//Tests_SRS_BROKER_30_112: [ Broker_Publish shall add the messages the filter kept from the sink to the counters of the link. ]
+TEST_FUNCTION(Broker_Publish_only_delivers_the_messages_the_link_filter_matches)
 {
     ///arrange
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-    mocks.ResetAllCalls();
-
-    // these are for Broker_Destroy
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_PROPERTY_MATCH match = { "macAddress", "AA:*" };
+    BROKER_LINK_FILTER filter = { 1, &match };
+    (void)Broker_AddLinkWithFilter(broker, &bld, &filter);
+    fake_mac_address = "AA:BB:CC:DD:EE:FF";
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    fake_mac_address = "BB:BB:CC:DD:EE:FF";
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    fake_mac_address = NULL;
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    BROKER_LINK_METRICS metrics;
 
     ///act
-    Broker_Destroy(broker);
+    auto result = Broker_GetLinkMetrics(broker, &bld, &metrics);
 
     ///assert
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.delivered);
+    ASSERT_ARE_EQUAL(size_t, 2, metrics.filtered);
 
     ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_112: [If the ref count is zero then the allocated resources are freed.]
-//Tests_SRS_BROKER_13_113: [ This function shall implement all the requirements of the Broker_Destroy API. ]
-TEST_FUNCTION(Broker_DecRef_works)
+//Tests_SRS_BROKER_30_118: [ If broker or sink are NULL, or filter has a NULL matches, name or pattern, Broker_AddAnySourceLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddAnySourceLink_fails_with_null_arguments)
 {
     ///arrange
     CBrokerMocks mocks;
-    auto broker = Broker_Create();
-    mocks.ResetAllCalls();
-
-    // these are for Broker_Destroy
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_PROPERTY_MATCH match = { NULL, "AA:*" };
+    BROKER_LINK_FILTER filter = { 1, &match };
 
     ///act
-    Broker_DecRef(broker);
+    auto result1 = Broker_AddAnySourceLink(NULL, fake_module_handle, NULL);
+    auto result2 = Broker_AddAnySourceLink(broker, NULL, NULL);
+    auto result3 = Broker_AddAnySourceLink(broker, fake_module_handle, &filter);
 
     ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result2);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result3);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
 }
 
-//Tests_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]
-TEST_FUNCTION(Broker_Publish_fails_with_null_broker)
+//Tests_SRS_BROKER_30_114: [ The route of a source shall also hold, once, every other module linked to "*". ]
+//Tests_SRS_BROKER_30_122: [ Broker_AddAnySourceLink shall build a new routing table and replace BROKER_HANDLE_DATA::routing_table with it. ]
+TEST_FUNCTION(Broker_Publish_delivers_to_a_module_linked_to_any_source)
 {
     ///arrange
     CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    MODULE sink_module =
+    {
+        (const MODULE_API *)&fake_module_apis,
+        (MODULE_HANDLE)0x43
+    };
+    call_status_for_FakeModule_Receive.module = sink_module.module_handle;
+    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_AddModule(broker, &sink_module);
+    (void)Broker_AddAnySourceLink(broker, sink_module.module_handle, NULL);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    (void)Broker_Publish(broker, sink_module.module_handle, message);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        sink_module.module_handle
+    };
+    BROKER_LINK_DATA self =
+    {
+        sink_module.module_handle,
+        sink_module.module_handle
+    };
+    BROKER_LINK_METRICS metrics;
+    BROKER_LINK_METRICS self_metrics;
 
     ///act
-    auto r1 = Broker_Publish(NULL, fake_module_handle, (MESSAGE_HANDLE)0x1);
+    auto result = Broker_GetLinkMetrics(broker, &bld, &metrics);
+    auto self_result = Broker_GetLinkMetrics(broker, &self, &self_metrics);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.delivered);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_ERROR, self_result);
 
     ///cleanup
+    Message_Destroy(message);
+    (void)Broker_RemoveAnySourceLink(broker, sink_module.module_handle);
+    Broker_RemoveModule(broker, &sink_module);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]
-TEST_FUNCTION(Broker_Publish_fails_with_null_message)
+//Tests_SRS_BROKER_30_115: [ The route of a module added to the broker shall be made of the modules in the "*" bucket. ]
+//Tests_SRS_BROKER_30_116: [ If modules are linked to "*", Broker_AddModule shall build a routing table with a route from the module to them out of the current routing table. ]
+TEST_FUNCTION(Broker_AddModule_routes_a_new_module_to_the_modules_linked_to_any_source)
 {
     ///arrange
     CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    MODULE sink_module =
+    {
+        (const MODULE_API *)&fake_module_apis,
+        (MODULE_HANDLE)0x43
+    };
+    call_status_for_FakeModule_Receive.module = sink_module.module_handle;
+    (void)Broker_AddModule(broker, &sink_module);
+    (void)Broker_AddAnySourceLink(broker, sink_module.module_handle, NULL);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        sink_module.module_handle
+    };
+    BROKER_LINK_METRICS metrics;
 
     ///act
-    auto r1 = Broker_Publish((BROKER_HANDLE)0x1, fake_module_handle, NULL);
+    auto add_result = Broker_AddModule(broker, &fake_module);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    auto result = Broker_GetLinkMetrics(broker, &bld, &metrics);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, add_result);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.delivered);
 
     ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    (void)Broker_RemoveAnySourceLink(broker, sink_module.module_handle);
+    Broker_RemoveModule(broker, &sink_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.]
-TEST_FUNCTION(Broker_Publish_fails_with_null_source)
+//Tests_SRS_BROKER_30_102: [ If histogram is NULL or empty, Broker_HistogramPercentile shall return 0. ]
+TEST_FUNCTION(Broker_HistogramPercentile_returns_0_for_an_empty_histogram)
 {
     ///arrange
-    CBrokerMocks mocks;
+    BROKER_HISTOGRAM histogram;
+    memset(&histogram, 0, sizeof(histogram));
 
     ///act
-    auto r1 = Broker_Publish((BROKER_HANDLE)0x1, NULL, (MESSAGE_HANDLE)0x1);
+    auto result1 = Broker_HistogramPercentile(NULL, 50.0);
+    auto result2 = Broker_HistogramPercentile(&histogram, 50.0);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(uint64_t, 0, result1);
+    ASSERT_ARE_EQUAL(uint64_t, 0, result2);
+}
 
-    ///cleanup
+//Tests_SRS_BROKER_30_103: [ Broker_HistogramPercentile shall return the largest value of the bucket holding the value of the given rank, or the largest value recorded if it is smaller. ]
+TEST_FUNCTION(Broker_HistogramPercentile_returns_the_bucket_of_the_rank)
+{
+    ///arrange
+    BROKER_HISTOGRAM histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    histogram.buckets[1] = 90; /*values of 1*/
+    histogram.buckets[8] = 10; /*values from 8 to 9*/
+    histogram.count = 100;
+    histogram.max = 8;
+
+    ///act
+    auto p50 = Broker_HistogramPercentile(&histogram, 50.0);
+    auto p90 = Broker_HistogramPercentile(&histogram, 90.0);
+    auto p99 = Broker_HistogramPercentile(&histogram, 99.0);
+
+    ///assert
+    ASSERT_ARE_EQUAL(uint64_t, 1, p50);
+    ASSERT_ARE_EQUAL(uint64_t, 1, p90);
+    ASSERT_ARE_EQUAL(uint64_t, 8, p99);
 }
-//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_fails_when_Lock_fails)
+
+//Tests_SRS_BROKER_30_073: [ If broker, source or messages is NULL or count is 0, Broker_PublishBatch shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_PublishBatch_fails_with_null_arguments)
 {
     ///arrange
     CBrokerMocks mocks;
-
     auto broker = Broker_Create();
-
-    // create a message to send
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-
-    auto result = Broker_AddModule(broker, &fake_module);
-
+    MESSAGE_HANDLE messages[1] = { Message_Create(&c) };
     mocks.ResetAllCalls();
 
-    // this is for Broker_Publish
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
-
     ///act
-    result = Broker_Publish(broker, fake_module_handle, message);
+    auto result1 = Broker_PublishBatch(NULL, fake_module_handle, messages, 1);
+    auto result2 = Broker_PublishBatch(broker, NULL, messages, 1);
+    auto result3 = Broker_PublishBatch(broker, fake_module_handle, NULL, 1);
+    auto result4 = Broker_PublishBatch(broker, fake_module_handle, messages, 0);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result1);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result2);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result3);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result4);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
-    Broker_RemoveModule(broker, &fake_module);
+    Message_Destroy(messages[0]);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_fails_when_Message_ToByteArray_fails)
+//Tests_SRS_BROKER_30_074: [ If any of the messages is NULL, Broker_PublishBatch shall return BROKER_INVALIDARG without publishing anything. ]
+TEST_FUNCTION(Broker_PublishBatch_fails_with_null_message)
 {
     ///arrange
     CBrokerMocks mocks;
-
     auto broker = Broker_Create();
-
-    // create a message to send
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-
-    auto result = Broker_AddModule(broker, &fake_module);
-
+    MESSAGE_HANDLE messages[2] = { Message_Create(&c), NULL };
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
     mocks.ResetAllCalls();
 
-    // this is for Broker_Publish
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0))
-        .SetFailReturn(-1);
-
     ///act
-    result = Broker_Publish(broker, fake_module_handle, message);
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 2);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_INVALIDARG, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
+    Message_Destroy(messages[0]);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_fails_when_allocmsg_fails)
+//Tests_SRS_BROKER_30_075: [ Broker_PublishBatch shall deliver every message, in order, to every module in the route of source, looking up the route once. ]
+//Tests_SRS_BROKER_30_076: [ Broker_PublishBatch shall lock the mailbox of a sink and signal its worker once for up to BROKER_PUBLISH_BATCH messages. ]
+//Tests_SRS_BROKER_30_077: [ Broker_PublishBatch shall return BROKER_ERROR if the delivery of any message failed, otherwise BROKER_MESSAGE_DROPPED if an overflow policy rejected any message, otherwise BROKER_OK. ]
+TEST_FUNCTION(Broker_PublishBatch_queues_the_messages_under_one_lock)
 {
     ///arrange
     CBrokerMocks mocks;
-
     auto broker = Broker_Create();
-
-    // create a message to send
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-
-    auto result = Broker_AddModule(broker, &fake_module);
-
+    MESSAGE_HANDLE messages[2] = { Message_Create(&c), Message_Create(&c) };
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
     mocks.ResetAllCalls();
 
-    // this is for Broker_Publish
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[1]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[1]));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting the mailbox*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, messages[0]))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, messages[1]))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(mocks, nn_allocmsg(1 + sizeof(MODULE_HANDLE), 0))
-        .SetFailReturn(nullptr);
 
     ///act
-    result = Broker_Publish(broker, fake_module_handle, message);
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 2);
 
     ///assert
-    ASSERT_ARE_EQUAL(int, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
+    Message_Destroy(messages[0]);
+    Message_Destroy(messages[1]);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_fails_when_send_fails)
+//Tests_SRS_BROKER_30_077: [ Broker_PublishBatch shall return BROKER_ERROR if the delivery of any message failed, otherwise BROKER_MESSAGE_DROPPED if an overflow policy rejected any message, otherwise BROKER_OK. ]
+TEST_FUNCTION(Broker_PublishBatch_queues_the_other_messages_when_Message_Clone_fails)
 {
     ///arrange
     CBrokerMocks mocks;
-
     auto broker = Broker_Create();
-
-    // create a message to send
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-
-    auto result = Broker_AddModule(broker, &fake_module);
-
+    MESSAGE_HANDLE messages[2] = { Message_Create(&c), Message_Create(&c) };
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
     mocks.ResetAllCalls();
+    whenShallMessage_Clone_fail = currentMessage_Clone_call + 1;
 
-    // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[1]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[1]));
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push(IGNORED_PTR_ARG, messages[1]))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(mocks, nn_allocmsg(1 + sizeof(MODULE_HANDLE), 0))
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn((int)-1);
 
     ///act
-    result = Broker_Publish(broker, fake_module_handle, message);
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 2);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_ERROR, result);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
+    Message_Destroy(messages[0]);
+    Message_Destroy(messages[1]);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_022: [ Broker_Publish shall Lock the modules lock. ]
-//Tests_SRS_BROKER_17_007: [Broker_Publish shall clone the message.]
-//Tests_SRS_BROKER_17_008: [ Broker_Publish shall serialize the message. ]
-//Tests_SRS_BROKER_17_025: [ Broker_Publish shall allocate a nanomsg buffer the size of the serialized message + sizeof(MODULE_HANDLE). ]
-//Tests_SRS_BROKER_17_026: [ Broker_Publish shall copy source into the beginning of the nanomsg buffer. ]
-//Tests_SRS_BROKER_17_027: [ Broker_Publish shall serialize the message into the remainder of the nanomsg buffer. ]
-//Tests_SRS_BROKER_17_010: [ Broker_Publish shall send a message on the publish_socket. ]
-//Tests_SRS_BROKER_17_011: [ Broker_Publish shall free the serialized message data. ]
-//Tests_SRS_BROKER_17_012: [ Broker_Publish shall free the message. ]
-//Tests_SRS_BROKER_17_023: [ Broker_Publish shall Unlock the modules lock. ]
-//Tests_SRS_BROKER_13_037 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_succeeds)
+//Tests_SRS_BROKER_30_070: [ If the module implements Module_ReceiveBatch, the function shall remove up to BROKER_RECEIVE_BATCH messages from module_info->mailbox, oldest first. ]
+//Tests_SRS_BROKER_30_072: [ If the module implements Module_ReceiveBatch, the function shall deliver all the removed messages with a single call to Module_ReceiveBatch. ]
+TEST_FUNCTION(module_worker_delivers_a_batch_to_a_version_2_module)
 {
     ///arrange
     CBrokerMocks mocks;
-
     auto broker = Broker_Create();
-
-    // create a message to send
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-
-    auto result = Broker_AddModule(broker, &fake_module);
-
+    MESSAGE_HANDLE messages[2] = { Message_Create(&c), Message_Create(&c) };
+    call_status_for_FakeModule_Receive.module = fake_batch_module.module_handle;
+    (void)Broker_AddModule(broker, &fake_batch_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_PublishBatch(broker, fake_module_handle, messages, 2);
     mocks.ResetAllCalls();
 
-    // this is for Broker_Publish
+    //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(mocks, nn_allocmsg(1 + sizeof(MODULE_HANDLE), 0))
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(messages[1]));
+
+    //loop 2
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
         .IgnoreArgument(1)
-        .IgnoreArgument(2);
-
+        .IgnoreArgument(2)
+        .SetFailReturn(COND_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
 
     ///act
-    result = Broker_Publish(broker, fake_module_handle, message);
+    auto result = thread_func_to_call(thread_func_args);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, FakeModule_ReceiveBatch_count);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
-    Broker_RemoveModule(broker, &fake_module);
+    Message_Destroy(messages[0]);
+    Message_Destroy(messages[1]);
+    Broker_RemoveModule(broker, &fake_batch_module);
     Broker_Destroy(broker);
 }
 
-
 END_TEST_SUITE(broker_ut)
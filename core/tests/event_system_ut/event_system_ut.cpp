@@ -59,6 +59,7 @@ static void* last_context;
 static void* last_user_param;
 
 static VECTOR_HANDLE module_list;
+static VECTOR_HANDLE metrics_list;
 
 struct ListNode
 {
@@ -200,6 +201,12 @@ public:
 
     MOCK_STATIC_METHOD_1(, void, Gateway_DestroyModuleList, VECTOR_HANDLE, vec);
     MOCK_VOID_METHOD_END();
+
+    MOCK_STATIC_METHOD_1(, VECTOR_HANDLE, Gateway_GetMetrics, GATEWAY_HANDLE, gw);
+    MOCK_METHOD_END(VECTOR_HANDLE, metrics_list);
+
+    MOCK_STATIC_METHOD_1(, void, Gateway_DestroyMetrics, VECTOR_HANDLE, vec);
+    MOCK_VOID_METHOD_END();
         
 };
 
@@ -241,6 +248,8 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , void, Condition_Deinit, COND_H
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , VECTOR_HANDLE, Gateway_GetModuleList, GATEWAY_HANDLE, gw);
 DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , void, Gateway_DestroyModuleList, VECTOR_HANDLE, vec);
+DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , VECTOR_HANDLE, Gateway_GetMetrics, GATEWAY_HANDLE, gw);
+DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , void, Gateway_DestroyMetrics, VECTOR_HANDLE, vec);
 
 static void expectEventSystemDestroy(CEventSystemMocks &mocks, bool started_thread, int nodes_in_queue)
 {
@@ -318,6 +327,7 @@ TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
     last_thread_arg = NULL;
     last_thread_func = NULL;
     module_list = NULL;
+    metrics_list = NULL;
     last_context = NULL;
 }
 
@@ -1103,6 +1113,91 @@ TEST_FUNCTION(EventSystem_ReportEvent_Modules_Pushback_Fails)
     EventSystem_Destroy(handle);
 }
 
+/* Tests_SRS_EVENTSYSTEM_30_001: [ This event shall provide `VECTOR_HANDLE` as returned from #Gateway_GetMetrics as the event context in callbacks ] */
+/* Tests_SRS_EVENTSYSTEM_30_002: [ This event shall clean up the `VECTOR_HANDLE` of #Gateway_GetMetrics after finishing all the callbacks ] */
+TEST_FUNCTION(EventSystem_ReportEvent_Metrics_Proper_List_Given)
+{
+    // Arrange
+    CEventSystemMocks mocks;
+    metrics_list = BASEIMPLEMENTATION::VECTOR_create(1);
+    EVENTSYSTEM_HANDLE handle = EventSystem_Init();
+    EventSystem_AddEventCallback(handle, GATEWAY_METRICS, catch_context_callback, NULL);
+    mocks.ResetAllCalls();
+
+    // Expect
+    EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(6);
+    EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(6);
+    EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(2);
+    EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .ExpectedTimesExactly(2);
+    EXPECTED_CALL(mocks, VECTOR_front(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Gateway_GetMetrics(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    // simulated thread
+    EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(3);
+    EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .ExpectedTimesExactly(2);
+    EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(1);
+    EXPECTED_CALL(mocks, Gateway_DestroyMetrics(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+
+    // Act
+    EventSystem_ReportEvent(handle, NULL, GATEWAY_METRICS);
+    // simulate the thread running
+    last_thread_func(last_thread_arg);
+
+    // Assert
+    ASSERT_IS_TRUE(metrics_list == (VECTOR_HANDLE)last_context);
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    BASEIMPLEMENTATION::VECTOR_destroy(metrics_list);
+    EventSystem_Destroy(handle);
+}
+
+TEST_FUNCTION(EventSystem_ReportEvent_Metrics_GetMetrics_Fails)
+{
+    // Arrange
+    CEventSystemMocks mocks;
+    EVENTSYSTEM_HANDLE handle = EventSystem_Init();
+    EventSystem_AddEventCallback(handle, GATEWAY_METRICS, catch_context_callback, NULL);
+    mocks.ResetAllCalls();
+
+    // Expect
+    EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(1);
+    EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(1);
+    EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, VECTOR_front(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Gateway_GetMetrics(IGNORED_PTR_ARG))
+        .SetFailReturn((VECTOR_HANDLE)NULL);
+    EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG));
+
+    // Act
+    EventSystem_ReportEvent(handle, NULL, GATEWAY_METRICS);
+
+    // Assert
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    EventSystem_Destroy(handle);
+}
+
 TEST_FUNCTION(EventSystem_ReportEvent_user_param_is_passed)
 {
     // Arrange
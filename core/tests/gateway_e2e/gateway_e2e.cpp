@@ -154,6 +154,15 @@ BEGIN_TEST_SUITE(gateway_e2e)
         iotHubConfig.IoTHubName = IoTHubAccount_GetIoTHubName(g_iothubAcctInfo);
         iotHubConfig.IoTHubSuffix = IoTHubAccount_GetIoTHubSuffix(g_iothubAcctInfo);
         iotHubConfig.transportProvider = HTTP_Protocol;
+        iotHubConfig.maxDevices = 0;
+        iotHubConfig.deviceIdleSeconds = 0;
+        iotHubConfig.mqttPoolSize = 0;
+        iotHubConfig.maxInFlight = 0;
+        iotHubConfig.batching = false;
+        iotHubConfig.spoolDirectory = NULL;
+        iotHubConfig.spoolMaxBytes = 0;
+        iotHubConfig.spoolMaxAgeSeconds = 0;
+        iotHubConfig.shards = 0;
 
 
         E2EMODULE_CONFIG e2eModuleConfiguration;
@@ -0,0 +1,361 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+/*the trace is process-wide and its rings are never freed, so the tests record
+objects of their own and look for them in the dump rather than counting on an
+empty trace*/
+
+static void* my_gballoc_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void my_gballoc_free(void* ptr)
+{
+    free(ptr);
+}
+
+#define ENABLE_MOCKS
+#include "azure_c_shared_utility/gballoc.h"
+#undef ENABLE_MOCKS
+
+#include "gateway_trace.h"
+
+#define TRACE_FILE              "gateway_trace_ut.json"
+#define TRACE_OBJECT(n)         ((const void*)(uintptr_t)(0x10000u + (n)))
+#define TRACE_CONTEXT(n)        ((const void*)(uintptr_t)(0x20000u + (n)))
+
+static TEST_MUTEX_HANDLE g_testByTest;
+static TEST_MUTEX_HANDLE g_dllByDll;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+/*dumps the trace and returns the content of the file, to be freed*/
+static char* dump_trace(void)
+{
+    char* result;
+    FILE* file;
+    long size;
+    ASSERT_ARE_EQUAL(int, 0, Gateway_DumpTrace(TRACE_FILE));
+    file = fopen(TRACE_FILE, "rb");
+    ASSERT_IS_NOT_NULL(file);
+    ASSERT_ARE_EQUAL(int, 0, fseek(file, 0, SEEK_END));
+    size = ftell(file);
+    ASSERT_IS_TRUE(size > 0);
+    ASSERT_ARE_EQUAL(int, 0, fseek(file, 0, SEEK_SET));
+    result = (char*)malloc((size_t)size + 1);
+    ASSERT_IS_NOT_NULL(result);
+    ASSERT_ARE_EQUAL(size_t, (size_t)size, fread(result, 1, (size_t)size, file));
+    result[size] = '\0';
+    (void)fclose(file);
+    return result;
+}
+
+/*returns where the event recorded for object is in the dump, NULL if it is not*/
+static const char* find_object(const char* trace, const void* object)
+{
+    char text[64];
+    (void)snprintf(text, sizeof(text), "\"object\":\"%p\"", object);
+    return strstr(trace, text);
+}
+
+static size_t count_threads(const char* trace)
+{
+    size_t result = 0;
+    const char* at = trace;
+    while ((at = strstr(at, "\"thread_name\"")) != NULL)
+    {
+        result++;
+        at++;
+    }
+    return result;
+}
+
+static int record_and_exit(void* object)
+{
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, object, NULL);
+    return 0;
+}
+
+static void record_on_a_thread(const void* object)
+{
+    THREAD_HANDLE thread;
+    int thread_result;
+    ASSERT_ARE_EQUAL(int, (int)THREADAPI_OK, (int)ThreadAPI_Create(&thread, record_and_exit, (void*)object));
+    ASSERT_ARE_EQUAL(int, (int)THREADAPI_OK, (int)ThreadAPI_Join(thread, &thread_result));
+}
+
+BEGIN_TEST_SUITE(gateway_trace_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    TEST_INITIALIZE_MEMORY_DEBUG(g_dllByDll);
+    g_testByTest = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(g_testByTest);
+
+    umock_c_init(on_umock_c_error);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+    TEST_MUTEX_DESTROY(g_testByTest);
+    TEST_DEINITIALIZE_MEMORY_DEBUG(g_dllByDll);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(g_testByTest))
+    {
+        ASSERT_FAIL("our mutex is ABANDONED. Failure in test framework");
+    }
+
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    GatewayTrace_Disable();
+    (void)remove(TRACE_FILE);
+    TEST_MUTEX_RELEASE(g_testByTest);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_001: [ GatewayTrace_Enable shall make GatewayTrace_Record record events. ]*/
+/*Tests_SRS_GATEWAY_TRACE_30_006: [ GatewayTrace_Record shall write event, object, context and a monotonic timestamp in nanoseconds to the next entry of the ring of the thread, overwriting the oldest entry if the ring is full. ]*/
+/*Tests_SRS_GATEWAY_TRACE_30_012: [ Otherwise Gateway_DumpTrace shall return 0. ]*/
+TEST_FUNCTION(GatewayTrace_Record_records_the_event_once_enabled)
+{
+    ///arrange
+    char* trace;
+    char context[64];
+    const char* event;
+    GatewayTrace_Enable();
+
+    ///act
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(1), TRACE_CONTEXT(1));
+
+    ///assert
+    trace = dump_trace();
+    event = find_object(trace, TRACE_OBJECT(1));
+    ASSERT_IS_NOT_NULL(event);
+    (void)snprintf(context, sizeof(context), "\"context\":\"%p\"", TRACE_CONTEXT(1));
+    ASSERT_IS_NOT_NULL(strstr(event, context));
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_004: [ If the trace is disabled, GatewayTrace_Record shall do nothing. ]*/
+/*Tests_SRS_GATEWAY_TRACE_30_003: [ GatewayTrace_Disable shall make GatewayTrace_Record ignore events and shall keep the events recorded so far. ]*/
+TEST_FUNCTION(GatewayTrace_Disable_keeps_the_events_and_ignores_the_new_ones)
+{
+    ///arrange
+    char* trace;
+    GatewayTrace_Enable();
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(2), NULL);
+
+    ///act
+    GatewayTrace_Disable();
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(3), NULL);
+
+    ///assert
+    trace = dump_trace();
+    ASSERT_IS_NOT_NULL(find_object(trace, TRACE_OBJECT(2)));
+    ASSERT_IS_NULL(find_object(trace, TRACE_OBJECT(3)));
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_002: [ GatewayTrace_Enable shall leave the events recorded before the call out of the next dump. ]*/
+TEST_FUNCTION(GatewayTrace_Enable_leaves_the_earlier_events_out_of_the_dump)
+{
+    ///arrange
+    char* trace;
+    GatewayTrace_Enable();
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(4), NULL);
+    ThreadAPI_Sleep(1);
+
+    ///act
+    GatewayTrace_Enable();
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(5), NULL);
+
+    ///assert
+    trace = dump_trace();
+    ASSERT_IS_NULL(find_object(trace, TRACE_OBJECT(4)));
+    ASSERT_IS_NOT_NULL(find_object(trace, TRACE_OBJECT(5)));
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_006: [ GatewayTrace_Record shall write event, object, context and a monotonic timestamp in nanoseconds to the next entry of the ring of the thread, overwriting the oldest entry if the ring is full. ]*/
+/*Tests_SRS_GATEWAY_TRACE_30_008: [ Gateway_DumpTrace shall write to file_path a JSON object with a traceEvents array holding a thread name event for every ring, then the events of the ring recorded since GatewayTrace_Enable, oldest first. ]*/
+TEST_FUNCTION(GatewayTrace_Record_overwrites_the_oldest_event_of_a_full_ring)
+{
+    ///arrange
+    char* trace;
+    unsigned int i;
+    GatewayTrace_Enable();
+
+    ///act
+    for (i = 0; i <= GATEWAY_TRACE_RING_SIZE; i++)
+    {
+        GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(0x1000u + i), NULL);
+    }
+
+    ///assert
+    trace = dump_trace();
+    ASSERT_IS_NULL(find_object(trace, TRACE_OBJECT(0x1000u)));
+    ASSERT_IS_NOT_NULL(find_object(trace, TRACE_OBJECT(0x1001u)));
+    ASSERT_IS_TRUE(find_object(trace, TRACE_OBJECT(0x1001u)) < find_object(trace, TRACE_OBJECT(0x1000u + GATEWAY_TRACE_RING_SIZE)));
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_008: [ Gateway_DumpTrace shall write to file_path a JSON object with a traceEvents array holding a thread name event for every ring, then the events of the ring recorded since GatewayTrace_Enable, oldest first. ]*/
+TEST_FUNCTION(Gateway_DumpTrace_writes_a_trace_events_object)
+{
+    ///arrange
+    char* trace;
+    size_t length;
+    GatewayTrace_Enable();
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(6), NULL);
+
+    ///act
+    trace = dump_trace();
+
+    ///assert
+    length = strlen(trace);
+    ASSERT_ARE_EQUAL(int, 0, strncmp(trace, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"name\":\"thread_name\"", strlen("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"name\":\"thread_name\"")));
+    ASSERT_IS_TRUE(length > 4);
+    ASSERT_ARE_EQUAL(char_ptr, "\n]}\n", trace + length - 4);
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_009: [ Gateway_DumpTrace shall write the _BEGIN events with phase B, the _END events with phase E and the other events as thread scoped instants, with their timestamp in microseconds since GatewayTrace_Enable. ]*/
+TEST_FUNCTION(Gateway_DumpTrace_writes_slices_and_instants)
+{
+    ///arrange
+    char* trace;
+    GatewayTrace_Enable();
+    GatewayTrace_Record(GATEWAY_TRACE_RECEIVE_BEGIN, TRACE_OBJECT(7), NULL);
+    GatewayTrace_Record(GATEWAY_TRACE_PUBLISH, TRACE_OBJECT(8), NULL);
+    GatewayTrace_Record(GATEWAY_TRACE_RECEIVE_END, TRACE_OBJECT(9), NULL);
+
+    ///act
+    trace = dump_trace();
+
+    ///assert
+    ASSERT_IS_NOT_NULL(strstr(trace, "{\"name\":\"receive\",\"cat\":\"gateway\",\"ph\":\"B\",\"ts\":"));
+    ASSERT_IS_NOT_NULL(strstr(trace, "{\"name\":\"publish\",\"cat\":\"gateway\",\"ph\":\"i\",\"s\":\"t\",\"ts\":"));
+    ASSERT_IS_NOT_NULL(strstr(trace, "{\"name\":\"receive\",\"cat\":\"gateway\",\"ph\":\"E\",\"ts\":"));
+    ASSERT_IS_TRUE(find_object(trace, TRACE_OBJECT(7)) < find_object(trace, TRACE_OBJECT(8)));
+    ASSERT_IS_TRUE(find_object(trace, TRACE_OBJECT(8)) < find_object(trace, TRACE_OBJECT(9)));
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_010: [ Gateway_DumpTrace shall join an ENQUEUE and a DEQUEUE event with the same object and context with a flow event. ]*/
+TEST_FUNCTION(Gateway_DumpTrace_joins_the_enqueue_and_dequeue_of_a_message)
+{
+    ///arrange
+    char* trace;
+    char flow[128];
+    uintptr_t flow_id = (uintptr_t)TRACE_OBJECT(10) ^ ((uintptr_t)TRACE_CONTEXT(10) << 1);
+    GatewayTrace_Enable();
+    GatewayTrace_Record(GATEWAY_TRACE_ENQUEUE, TRACE_OBJECT(10), TRACE_CONTEXT(10));
+    GatewayTrace_Record(GATEWAY_TRACE_DEQUEUE, TRACE_OBJECT(10), TRACE_CONTEXT(10));
+
+    ///act
+    trace = dump_trace();
+
+    ///assert
+    (void)snprintf(flow, sizeof(flow), "\"ph\":\"s\",\"bp\":\"e\",\"id\":\"%" PRIxPTR "\"", flow_id);
+    ASSERT_IS_NOT_NULL(strstr(trace, flow));
+    (void)snprintf(flow, sizeof(flow), "\"ph\":\"f\",\"bp\":\"e\",\"id\":\"%" PRIxPTR "\"", flow_id);
+    ASSERT_IS_NOT_NULL(strstr(trace, flow));
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_005: [ The first time a thread records an event, GatewayTrace_Record shall take over the ring released by a thread that exited or allocate a new one; if GATEWAY_TRACE_MAX_THREADS rings are in use or the allocation fails, the events of the thread shall be ignored. ]*/
+/*Tests_SRS_GATEWAY_TRACE_30_013: [ When a thread that has a ring exits, its ring shall be released; the events of the thread shall be kept until another thread takes the ring over. ]*/
+TEST_FUNCTION(GatewayTrace_Record_takes_over_the_ring_of_a_thread_that_exited)
+{
+    ///arrange
+    char* trace;
+    size_t threads;
+    GatewayTrace_Enable();
+    record_on_a_thread(TRACE_OBJECT(11));
+    trace = dump_trace();
+    ASSERT_IS_NOT_NULL(find_object(trace, TRACE_OBJECT(11)));
+    threads = count_threads(trace);
+    free(trace);
+
+    ///act
+    record_on_a_thread(TRACE_OBJECT(12));
+
+    ///assert
+    trace = dump_trace();
+    ASSERT_IS_NULL(find_object(trace, TRACE_OBJECT(11)));
+    ASSERT_IS_NOT_NULL(find_object(trace, TRACE_OBJECT(12)));
+    ASSERT_ARE_EQUAL(size_t, threads, count_threads(trace));
+
+    ///cleanup
+    free(trace);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_007: [ If file_path is NULL, Gateway_DumpTrace shall fail and return a non-zero value. ]*/
+TEST_FUNCTION(Gateway_DumpTrace_with_NULL_file_path_fails)
+{
+    ///arrange
+    int result;
+
+    ///act
+    result = Gateway_DumpTrace(NULL);
+
+    ///assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_GATEWAY_TRACE_30_011: [ If the file cannot be opened or written, Gateway_DumpTrace shall fail and return a non-zero value. ]*/
+TEST_FUNCTION(Gateway_DumpTrace_fails_when_the_file_cannot_be_opened)
+{
+    ///arrange
+    int result;
+
+    ///act
+    result = Gateway_DumpTrace("gateway_trace_ut_no_such_directory/" TRACE_FILE);
+
+    ///assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+END_TEST_SUITE(gateway_trace_ut)
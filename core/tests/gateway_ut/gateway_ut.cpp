@@ -54,10 +54,11 @@ static size_t whenShallmalloc_fail;
 
 static size_t currentBroker_AddModule_call;
 static size_t whenShallBroker_AddModule_fail;
+static size_t lastBroker_AddModule_capacity;
 static size_t currentBroker_RemoveModule_call;
 static size_t whenShallBroker_RemoveModule_fail;
-static size_t currentBroker_Create_call;
-static size_t whenShallBroker_Create_fail;
+static size_t currentBroker_CreateWithOptions_call;
+static size_t whenShallBroker_CreateWithOptions_fail;
 static size_t currentBroker_module_count;
 static size_t currentBroker_ref_count;
 
@@ -116,10 +117,10 @@ public:
         ++currentBroker_ref_count;
     MOCK_VOID_METHOD_END();
 
-    MOCK_STATIC_METHOD_0(, BROKER_HANDLE, Broker_Create)
+    MOCK_STATIC_METHOD_1(, BROKER_HANDLE, Broker_CreateWithOptions, const BROKER_OPTIONS*, options)
     BROKER_HANDLE result1;
-    currentBroker_Create_call++;
-    if (whenShallBroker_Create_fail >= 0 && whenShallBroker_Create_fail == currentBroker_Create_call)
+    currentBroker_CreateWithOptions_call++;
+    if (whenShallBroker_CreateWithOptions_fail >= 0 && whenShallBroker_CreateWithOptions_fail == currentBroker_CreateWithOptions_call)
     {
         result1 = NULL;
     }
@@ -141,9 +142,10 @@ public:
         }
     MOCK_VOID_METHOD_END();
 
-    MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_AddModule, BROKER_HANDLE, handle, const MODULE*, module)
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_AddModuleWithOptions, BROKER_HANDLE, handle, const MODULE*, module, const BROKER_MAILBOX_OPTIONS*, mailbox_options)
         currentBroker_AddModule_call++;
         BROKER_RESULT result1  = BROKER_ERROR;
+        lastBroker_AddModule_capacity = (mailbox_options == NULL) ? 0 : mailbox_options->capacity;
         if (handle != NULL && module != NULL)
         {
             if (whenShallBroker_AddModule_fail != currentBroker_AddModule_call)
@@ -167,9 +169,28 @@ public:
     MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_AddLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link)
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
 
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_AddLinkWithFilter, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_FILTER*, filter)
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
+
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_AddAnySourceLink, BROKER_HANDLE, handle, MODULE_HANDLE, sink, const BROKER_LINK_FILTER*, filter)
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
+
+    MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_RemoveAnySourceLink, BROKER_HANDLE, handle, MODULE_HANDLE, sink)
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
+
     MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_RemoveLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link)
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
 
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_GetModuleMetrics, BROKER_HANDLE, handle, MODULE_HANDLE, module, BROKER_MODULE_METRICS*, metrics)
+        memset(metrics, 0, sizeof(BROKER_MODULE_METRICS));
+        metrics->received = 1;
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
+
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_GetLinkMetrics, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, BROKER_LINK_METRICS*, metrics)
+        memset(metrics, 0, sizeof(BROKER_LINK_METRICS));
+        metrics->delivered = 1;
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
+
     MOCK_STATIC_METHOD_2(, MODULE_LIBRARY_HANDLE, DynamicModuleLoader_Load, const struct MODULE_LOADER_TAG*, loader, const void*, entrypoint)
         currentModuleLoader_Load_call++;
         MODULE_LIBRARY_HANDLE handle = NULL;
@@ -327,12 +348,17 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, mock_Module_Destroy, MODUL
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , void, mock_Module_Receive, MODULE_HANDLE, moduleHandle, MESSAGE_HANDLE, messageHandle);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, mock_Module_Start, MODULE_HANDLE, moduleHandle);
 
-DECLARE_GLOBAL_MOCK_METHOD_0(CGatewayLLMocks, , BROKER_HANDLE, Broker_Create);
+DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , BROKER_HANDLE, Broker_CreateWithOptions, const BROKER_OPTIONS*, options);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, Broker_Destroy, BROKER_HANDLE, broker);
-DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_AddModule, BROKER_HANDLE, handle, const MODULE*, module);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_AddModuleWithOptions, BROKER_HANDLE, handle, const MODULE*, module, const BROKER_MAILBOX_OPTIONS*, mailbox_options);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_RemoveModule, BROKER_HANDLE, handle, const MODULE*, module);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_AddLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_AddLinkWithFilter, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_FILTER*, filter);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_AddAnySourceLink, BROKER_HANDLE, handle, MODULE_HANDLE, sink, const BROKER_LINK_FILTER*, filter);
+DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_RemoveAnySourceLink, BROKER_HANDLE, handle, MODULE_HANDLE, sink);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_RemoveLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_GetModuleMetrics, BROKER_HANDLE, handle, MODULE_HANDLE, module, BROKER_MODULE_METRICS*, metrics);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_GetLinkMetrics, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, BROKER_LINK_METRICS*, metrics);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, Broker_IncRef, BROKER_HANDLE, broker);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, Broker_DecRef, BROKER_HANDLE, broker);
 
@@ -454,10 +480,11 @@ TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
 
     currentBroker_AddModule_call = 0;
     whenShallBroker_AddModule_fail = 0;
+    lastBroker_AddModule_capacity = 0;
     currentBroker_RemoveModule_call = 0;
     whenShallBroker_RemoveModule_fail = 0;
-    currentBroker_Create_call = 0;
-    whenShallBroker_Create_fail = 0;
+    currentBroker_CreateWithOptions_call = 0;
+    whenShallBroker_CreateWithOptions_fail = 0;
     currentBroker_module_count = 0;
     currentBroker_ref_count = 0;
 
@@ -507,8 +534,8 @@ TEST_FUNCTION_CLEANUP(TestMethodCleanup)
     currentmalloc_call = 0;
     whenShallmalloc_fail = 0;
 
-    currentBroker_Create_call = 0;
-    whenShallBroker_Create_fail = 0;
+    currentBroker_CreateWithOptions_call = 0;
+    whenShallBroker_CreateWithOptions_fail = 0;
 
     BASEIMPLEMENTATION::VECTOR_destroy(dummyProps->gateway_modules);
     BASEIMPLEMENTATION::VECTOR_destroy(dummyProps->gateway_links);
@@ -534,7 +561,7 @@ TEST_FUNCTION(Gateway_Create_Creates_Handle_Success)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -590,7 +617,7 @@ TEST_FUNCTION(Gateway_Create_returns_null_on_bad_module_api_entry)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
 	STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1); //modules
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -679,8 +706,8 @@ TEST_FUNCTION(Gateway_Create_Cannot_Create_Broker_Handle_Failure)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
 	STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
-    whenShallBroker_Create_fail = 1;
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    whenShallBroker_CreateWithOptions_fail = 1;
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
@@ -707,7 +734,7 @@ TEST_FUNCTION(Gateway_Create_VECTOR_Create_Fails)
 	STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
 
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
 
     whenShallVECTOR_create_fail = 1; 
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -741,7 +768,7 @@ TEST_FUNCTION(Gateway_Create_VECTOR_Create2_Fails)
 	STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
 
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
 
     whenShallVECTOR_create_fail = 2;
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -790,7 +817,7 @@ TEST_FUNCTION(Gateway_Create_VECTOR_push_back_Fails_To_Add_All_Modules_In_Props)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
 	STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1); //modules
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -817,7 +844,8 @@ TEST_FUNCTION(Gateway_Create_VECTOR_push_back_Fails_To_Add_All_Modules_In_Props)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -853,7 +881,8 @@ TEST_FUNCTION(Gateway_Create_VECTOR_push_back_Fails_To_Add_All_Modules_In_Props)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -940,7 +969,7 @@ TEST_FUNCTION(Gateway_Create_Broker_AddModule_Fails_To_Add_All_Modules_In_Props)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
 	STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1); //modules
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -967,7 +996,8 @@ TEST_FUNCTION(Gateway_Create_Broker_AddModule_Fails_To_Add_All_Modules_In_Props)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1002,7 +1032,8 @@ TEST_FUNCTION(Gateway_Create_Broker_AddModule_Fails_To_Add_All_Modules_In_Props)
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
     whenShallBroker_AddModule_fail = 2;
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
@@ -1080,7 +1111,7 @@ TEST_FUNCTION(Gateway_Create_AddModule_WithDuplicatedModuleName_Fails)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
 	STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1); //modules
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -1109,7 +1140,8 @@ TEST_FUNCTION(Gateway_Create_AddModule_WithDuplicatedModuleName_Fails)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1198,7 +1230,7 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_In_Props_Success)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1); //modules vector.
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -1225,7 +1257,8 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_In_Props_Success)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1258,7 +1291,8 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_In_Props_Success)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1327,7 +1361,7 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_And_All_Links_In_Props_Success)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
 
     EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1); //modules vector.
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -1357,7 +1391,8 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_And_All_Links_In_Props_Success)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1391,7 +1426,8 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_And_All_Links_In_Props_Success)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1451,7 +1487,7 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_And_Links_fromNonExistingModule_Fa
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
 	EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
         .IgnoreArgument(1); //modules vector.
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
@@ -1480,7 +1516,8 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_And_Links_fromNonExistingModule_Fa
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1852,7 +1889,7 @@ TEST_FUNCTION(Gateway_AddModule_Returns_Null_For_star_module_name)
 /*Tests_SRS_GATEWAY_14_012: [ The function shall load the module located at GATEWAY_MODULES_ENTRY's module_path into a MODULE_LIBRARY_HANDLE. ]*/
 /*Tests_SRS_GATEWAY_14_013: [ The function shall get the const MODULE_API* from the MODULE_LIBRARY_HANDLE. ]*/
 /*Tests_SRS_GATEWAY_17_015: [ The function shall use GATEWAY_PROPERTIES::loader_api->Load and each GATEWAY_PROPERTIES::loader_configuration to get each module's MODULE_LIBRARY_HANDLE. ]*/
-/*Tests_SRS_GATEWAY_14_017: [ The function shall attach the module to the GATEWAY_HANDLE_DATA's broker using a call to Broker_AddModule. ]*/
+/*Tests_SRS_GATEWAY_14_017: [ The function shall attach the module to the GATEWAY_HANDLE_DATA's broker using a call to Broker_AddModuleWithOptions with the `mailbox_options` of the entry. ]*/
 /*Tests_SRS_GATEWAY_14_029: [ The function shall create a new MODULE_DATA containing the MODULE_HANDLE, MODULE_LOADER_API and MODULE_LIBRARY_HANDLE if the module was successfully linked to the message broker. ]*/
 /*Tests_SRS_GATEWAY_14_032: [ The function shall add the new MODULE_DATA to GATEWAY_HANDLE_DATA's modules if the module was successfully linked to the message broker. ]*/
 /*Tests_SRS_GATEWAY_14_019: [ The function shall return the newly created MODULE_HANDLE only if each API call returns successfully. ]*/
@@ -1888,7 +1925,8 @@ TEST_FUNCTION(Gateway_AddModule_Loads_Module_From_Library_Path)
     STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -1914,6 +1952,39 @@ TEST_FUNCTION(Gateway_AddModule_Loads_Module_From_Library_Path)
     Gateway_Destroy(gw);
 }
 
+/*Tests_SRS_GATEWAY_14_017: [ The function shall attach the module to the GATEWAY_HANDLE_DATA's broker using a call to Broker_AddModuleWithOptions with the `mailbox_options` of the entry. ]*/
+TEST_FUNCTION(Gateway_AddModule_Passes_Mailbox_Options_To_Broker)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    GATEWAY_MODULES_ENTRY dummyModule = {
+        "dummy module",
+        dummyLoaderInfo,
+        NULL,
+        { 10, BROKER_OVERFLOW_DROP_OLDEST, NULL }
+    };
+
+    GATEWAY_HANDLE gw = Gateway_Create(NULL);
+    mocks.ResetAllCalls();
+
+    //Expectations
+    mocks.SetIgnoreUnexpectedCalls(true);
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+
+    //Act
+    MODULE_HANDLE handle = Gateway_AddModule(gw, &dummyModule);
+
+    //Assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, 10, lastBroker_AddModule_capacity);
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gw);
+}
+
 /*Tests_SRS_GATEWAY_14_031: [ If unsuccessful, the function shall return NULL. ]*/
 TEST_FUNCTION(Gateway_AddModule_Malloc_data_Fails)
 {
@@ -2007,7 +2078,8 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_Using_Module_Properties)
     STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -2146,7 +2218,8 @@ TEST_FUNCTION(Gateway_AddModule_Broker_AddModule_Fails)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     whenShallBroker_AddModule_fail = 1;
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, mock_Module_Destroy(IGNORED_PTR_ARG))
@@ -2197,7 +2270,8 @@ TEST_FUNCTION(Gateway_AddModule_Internal_API_Fail_Rollback_Module)
 	STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -2739,7 +2813,7 @@ TEST_FUNCTION(Gateway_Event_System_Create_And_Report)
     //Expectations
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
 	EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
-    EXPECTED_CALL(mocks, Broker_Create());
+    EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG)); //Modules.
     EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG)); //Links
     
@@ -2764,7 +2838,7 @@ TEST_FUNCTION(Gateway_Event_System_Create_Fail)
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
 	STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
 	EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
-    EXPECTED_CALL(mocks, Broker_Create());
+    EXPECTED_CALL(mocks, Broker_CreateWithOptions(NULL));
     EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG)); //Modules.
     EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG)); //Links
     // Fail to create
@@ -2944,6 +3018,145 @@ TEST_FUNCTION(Gateway_GetModuleList_push_back_fail)
     Gateway_Destroy(gw);
 }
 
+/*Tests_SRS_GATEWAY_30_002: [ If the `gw` parameter is NULL, the function shall return NULL handle and not allocate any data. ]*/
+TEST_FUNCTION(Gateway_GetMetrics_NULL_Gateway)
+{
+    // Arrange
+    CGatewayLLMocks mocks;
+
+    // Expectations
+    // Empty
+
+    // Act
+    VECTOR_HANDLE vector = Gateway_GetMetrics(NULL);
+
+    // Assert
+    ASSERT_IS_NULL(vector);
+    mocks.AssertActualAndExpectedCalls();
+}
+
+/*Tests_SRS_GATEWAY_30_003: [ This function shall return a snapshot of the metrics of every module of the gateway as reported by `Broker_GetModuleMetrics`. ]*/
+/*Tests_SRS_GATEWAY_30_004: [ For each module returned this function shall provide a vector of the metrics of every link the module is the sink of, as reported by `Broker_GetLinkMetrics`. ]*/
+/*Tests_SRS_GATEWAY_30_005: [ For a link with '*' as its source, this function shall provide one entry for every other module linked to the sink. ]*/
+TEST_FUNCTION(Gateway_GetMetrics_reports_modules_and_links)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+    // Using only for implemenation instead of checking calls
+    mocks.SetIgnoreUnexpectedCalls(true);
+
+    PREDICATE_FUNCTION search_lambda = [](const void *metrics, const void *searched) { return strcmp(((const GATEWAY_MODULE_METRICS*)metrics)->module_name, (const char*)searched) == 0; };
+
+    GATEWAY_MODULES_ENTRY module_entries[] = {
+        {
+            "module_1",
+            dummyLoaderInfo,
+            NULL
+        },
+        {
+            "module_2",
+            dummyLoaderInfo,
+            NULL
+        },
+        {
+            "module_3",
+            dummyLoaderInfo,
+            NULL
+        }
+    };
+
+    GATEWAY_LINK_ENTRY link_entries[] = {
+        { "module_1", "module_2" },
+        { "*", "module_3" }
+    };
+
+    GATEWAY_PROPERTIES props;
+    props.gateway_modules = VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY));
+    props.gateway_links = VECTOR_create(sizeof(GATEWAY_LINK_ENTRY));
+    VECTOR_push_back(props.gateway_modules, module_entries, 3);
+    VECTOR_push_back(props.gateway_links, link_entries, 2);
+
+    auto gateway = Gateway_Create(&props);
+
+    //Act
+    auto metrics = Gateway_GetMetrics(gateway);
+    auto module_1 = (GATEWAY_MODULE_METRICS*)VECTOR_find_if(metrics, search_lambda, "module_1");
+    auto module_2 = (GATEWAY_MODULE_METRICS*)VECTOR_find_if(metrics, search_lambda, "module_2");
+    auto module_3 = (GATEWAY_MODULE_METRICS*)VECTOR_find_if(metrics, search_lambda, "module_3");
+
+    // Assert
+    ASSERT_IS_NOT_NULL(metrics);
+    ASSERT_ARE_EQUAL(size_t, 3, VECTOR_size(metrics));
+    ASSERT_IS_NOT_NULL(module_1);
+    ASSERT_IS_NOT_NULL(module_2);
+    ASSERT_IS_NOT_NULL(module_3);
+    ASSERT_ARE_EQUAL(size_t, 1, module_1->metrics.received);
+    ASSERT_ARE_EQUAL(size_t, 0, VECTOR_size(module_1->links));
+    ASSERT_ARE_EQUAL(size_t, 1, VECTOR_size(module_2->links));
+    ASSERT_ARE_EQUAL(char_ptr, "module_1", ((GATEWAY_LINK_METRICS*)VECTOR_element(module_2->links, 0))->source_name);
+    ASSERT_ARE_EQUAL(size_t, 1, ((GATEWAY_LINK_METRICS*)VECTOR_element(module_2->links, 0))->metrics.delivered);
+    ASSERT_ARE_EQUAL(size_t, 2, VECTOR_size(module_3->links));
+
+    // Cleanup
+    VECTOR_destroy(props.gateway_modules);
+    VECTOR_destroy(props.gateway_links);
+    Gateway_DestroyMetrics(metrics);
+    Gateway_Destroy(gateway);
+}
+
+/*Tests_SRS_GATEWAY_30_006: [ This function shall return a NULL handle should any internal callbacks fail. ]*/
+TEST_FUNCTION(Gateway_GetMetrics_fails_when_Broker_GetModuleMetrics_fails)
+{
+    // Arrange
+    CGatewayLLMocks mocks;
+    GATEWAY_HANDLE gw = Gateway_Create(dummyProps);
+    mocks.ResetAllCalls();
+
+    // Expectations
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULE_METRICS)));
+    EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(2);
+    EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, Broker_GetModuleMetrics(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .SetFailReturn(BROKER_ERROR);
+    EXPECTED_CALL(mocks, VECTOR_front(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG));
+
+    // Act
+    VECTOR_HANDLE vector = Gateway_GetMetrics(gw);
+
+    // Assert
+    ASSERT_IS_NULL(vector);
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    Gateway_Destroy(gw);
+}
+
+/*Tests_SRS_GATEWAY_30_009: [ This function shall log a failure and do nothing else when `gw` parameter is NULL. ]*/
+/*Tests_SRS_GATEWAY_30_010: [ This function shall report the `GATEWAY_METRICS` event. ]*/
+TEST_FUNCTION(Gateway_ReportMetrics_reports_the_event)
+{
+    // Arrange
+    CGatewayLLMocks mocks;
+    GATEWAY_HANDLE gw = Gateway_Create(NULL);
+    mocks.ResetAllCalls();
+
+    // Expectations
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gw, GATEWAY_METRICS))
+        .IgnoreArgument(1);
+
+    // Act
+    Gateway_ReportMetrics(NULL);
+    Gateway_ReportMetrics(gw);
+
+    // Assert
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    Gateway_Destroy(gw);
+}
+
 TEST_FUNCTION(Gateway_AddEventCallback_Forwards)
 {
     // Arrange
@@ -3190,6 +3403,60 @@ TEST_FUNCTION(Gateway_AddLink_Succeeds)
     Gateway_Destroy(gateway);
 }
 
+/*Tests_SRS_GATEWAY_30_011: [ If the link has a filter, the function shall add it to the broker with Broker_AddLinkWithFilter. ]*/
+TEST_FUNCTION(Gateway_AddLink_with_a_filter_adds_a_filtered_link)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    //Add another entry to the properties
+    GATEWAY_MODULES_ENTRY dummyEntry2 = {
+        "dummy module 2",
+        dummyLoaderInfo,
+        NULL
+    };
+
+    BROKER_PROPERTY_MATCH match = { "macAddress", "AA:*" };
+    BROKER_LINK_FILTER filter = { 1, &match };
+    GATEWAY_LINK_ENTRY dummyLink = {
+        "dummy module",
+        "dummy module 2",
+        &filter
+    };
+
+    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
+
+    GATEWAY_HANDLE gateway = Gateway_Create(dummyProps);
+    mocks.ResetAllCalls();
+
+    //Act
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check link
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check Source Module.
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check Sink Module.
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithFilter(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &filter))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    GATEWAY_ADD_LINK_RESULT result = Gateway_AddLink(gateway, &dummyLink);
+
+    //Assert
+    ASSERT_ARE_EQUAL(GATEWAY_ADD_LINK_RESULT, GATEWAY_ADD_LINK_SUCCESS, result);
+
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gateway);
+}
+
 TEST_FUNCTION(Gateway_AddLink_pushback_fails)
 {
     //Arrange
@@ -3282,7 +3549,8 @@ TEST_FUNCTION(Gateway_AddLink_broker_add_fails)
     Gateway_Destroy(gateway);
 }
 
-TEST_FUNCTION(Gateway_AddLink_star_2nd_addbroker_fails)
+/*Tests_SRS_GATEWAY_30_012: [ The function shall keep a copy of the filter of a link with a source of "*" to add it to the links from the modules added later. ]*/
+TEST_FUNCTION(Gateway_AddLink_star_with_a_filter_broker_add_fails)
 {
     //Arrange
     CGatewayLLMocks mocks;
@@ -3303,9 +3571,12 @@ TEST_FUNCTION(Gateway_AddLink_star_2nd_addbroker_fails)
         "*",
         "dummy module 2"
     };
+    BROKER_PROPERTY_MATCH match = { "macAddress", "AA:*" };
+    BROKER_LINK_FILTER filter = { 1, &match };
     GATEWAY_LINK_ENTRY dummyLink2 = {
         "*",
-        "dummy module 3"
+        "dummy module 3",
+        &filter
     };
 
     BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
@@ -3322,41 +3593,23 @@ TEST_FUNCTION(Gateway_AddLink_star_2nd_addbroker_fails)
         .IgnoreAllArguments();//Check link
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();//Check Sink Module.
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1); // Copy of the filter
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2); // Add link to links vector
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1); // for each module.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddAnySourceLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_ADD_LINK_ERROR);
 
     //Remove link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1); // for each module.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
 
     result = Gateway_AddLink(gateway, &dummyLink2);
 
@@ -3480,7 +3733,8 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_with_star_links)
     STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(3)
         .IgnoreArgument(1)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
@@ -3488,24 +3742,7 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_with_star_links)
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // 1st broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    // 2nd broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
+    // the broker routes the new module to the sinks of the star links, no link is added
     STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gateway, GATEWAY_MODULE_LIST_CHANGED))
         .IgnoreArgument(1);
 
@@ -3521,9 +3758,12 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_with_star_links)
     Gateway_Destroy(gateway);
 }
 
+//Tests_SRS_GATEWAY_17_002: [ The gateway shall accept a link with a source of "*" and a sink of a valid module. ]
 //Tests_SRS_GATEWAY_17_003: [ The gateway shall treat a source of "*" as link to the sink module from every other module in gateway. ]
+//Tests_SRS_GATEWAY_17_004: [ The gateway shall accept a link containing "*" as entryLink->module_source, and a valid module name as a entryLink->module_sink. ]
 //Tests_SRS_GATEWAY_17_005: [ For this link, the sink shall receive all messages publish by other modules. ]
-TEST_FUNCTION(Gateway_AddModule_Creates_Module_star_2nd_addLink_fails)
+//Tests_SRS_GATEWAY_30_013: [ The function shall add a link with a source of "*" to the broker once, with Broker_AddAnySourceLink. ]
+TEST_FUNCTION(Gateway_AddLink_star_success)
 {
     //Arrange
     CGatewayLLMocks mocks;
@@ -3549,291 +3789,25 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_star_2nd_addLink_fails)
     };
 
     BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
+    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry3, 1);
     BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_links, &dummyLink1, 1);
-    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_links, &dummyLink2, 1);
 
     GATEWAY_HANDLE gateway = Gateway_Create(dummyProps);
     mocks.ResetAllCalls();
 
-    //Expectations
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_Load(IGNORED_PTR_ARG, dummyLoaderInfo.entrypoint))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_GetModuleApi(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_BuildModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-		.IgnoreAllArguments();
-	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-		.IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &dummyLink2))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // 1st broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    // 2nd broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments()
-        .SetFailReturn(BROKER_ADD_LINK_ERROR);
-
-    // tear down the star link for each module
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1); // for each module.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    // and remove the rest.
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, "dummy module"))
         .IgnoreArgument(1)
         .IgnoreArgument(2)
-        .SetFailReturn(BROKER_ERROR);
-    STRICT_EXPECTED_CALL(mocks, Broker_DecRef(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, mock_Module_Destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_Unload(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-
-    //Act
-    MODULE_HANDLE handle = Gateway_AddModule(gateway, &dummyEntry3);
-
-    //Assert
-    ASSERT_IS_NULL(handle);
-    mocks.AssertActualAndExpectedCalls();
-
-    //Cleanup
-    Gateway_Destroy(gateway);
-}
-
-//Tests_SRS_GATEWAY_17_003: [ The gateway shall treat a source of "*" as link to the sink module from every other module in gateway. ]
-//Tests_SRS_GATEWAY_17_005: [ For this link, the sink shall receive all messages publish by other modules. ]
-TEST_FUNCTION(Gateway_AddModule_Creates_Module_star_2nd_find_fails)
-{
-    //Arrange
-    CGatewayLLMocks mocks;
-
-    GATEWAY_MODULES_ENTRY dummyEntry2 = {
-        "dummy module 2",
-		dummyLoaderInfo,
-        NULL
-    };
-    GATEWAY_MODULES_ENTRY dummyEntry3 = {
-        "dummy module 3",
-		dummyLoaderInfo,
-        NULL
-    };
-
-    GATEWAY_LINK_ENTRY dummyLink1 = {
-        "*",
-        "dummy module 2"
-    };
-    GATEWAY_LINK_ENTRY dummyLink2 = {
-        "*",
-        "dummy module"
-    };
-
-    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
-    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_links, &dummyLink1, 1);
-    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_links, &dummyLink2, 1);
-
-    GATEWAY_HANDLE gateway = Gateway_Create(dummyProps);
-    mocks.ResetAllCalls();
-
-    //Expectations
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_Load(IGNORED_PTR_ARG, dummyLoaderInfo.entrypoint))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_GetModuleApi(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_BuildModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-		.IgnoreAllArguments();
-	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-		.IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // 1st broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    // 2nd broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments()
-        .SetFailReturn(nullptr);
-
-
-    // tear down broadcast link.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments()
-        .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    // and remove the rest.
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_DecRef(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, mock_Module_Destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_Unload(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-
-    //Act
-    MODULE_HANDLE handle = Gateway_AddModule(gateway, &dummyEntry3);
-
-    //Assert
-    ASSERT_IS_NULL(handle);
-    mocks.AssertActualAndExpectedCalls();
-
-    //Cleanup
-    Gateway_Destroy(gateway);
-}
-
-//Tests_SRS_GATEWAY_17_002: [ The gateway shall accept a link with a source of "*" and a sink of a valid module. ]
-//Tests_SRS_GATEWAY_17_003: [ The gateway shall treat a source of "*" as link to the sink module from every other module in gateway. ]
-//Tests_SRS_GATEWAY_17_004: [ The gateway shall accept a link containing "*" as entryLink->module_source, and a valid module name as a entryLink->module_sink. ]
-//Tests_SRS_GATEWAY_17_005: [ For this link, the sink shall receive all messages publish by other modules. ]
-TEST_FUNCTION(Gateway_AddLink_star_success)
-{
-    //Arrange
-    CGatewayLLMocks mocks;
-
-    GATEWAY_MODULES_ENTRY dummyEntry2 = {
-        "dummy module 2",
-		dummyLoaderInfo,
-        NULL
-    };
-    GATEWAY_MODULES_ENTRY dummyEntry3 = {
-        "dummy module 3",
-		dummyLoaderInfo,
-        NULL
-    };
-
-    GATEWAY_LINK_ENTRY dummyLink1 = {
-        "*",
-        "dummy module 2"
-    };
-    GATEWAY_LINK_ENTRY dummyLink2 = {
-        "*",
-        "dummy module"
-    };
-
-    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
-    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry3, 1);
-    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_links, &dummyLink1, 1);
-
-    GATEWAY_HANDLE gateway = Gateway_Create(dummyProps);
-    mocks.ResetAllCalls();
-
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &dummyLink2))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddAnySourceLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, "dummy module"))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
@@ -3948,32 +3922,11 @@ TEST_FUNCTION(Gateway_AddLink_star_failure_to_add)
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddAnySourceLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_ADD_LINK_ERROR);
 
     //Remove link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1); // for each module.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments()
-        .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
@@ -4031,23 +3984,7 @@ TEST_FUNCTION(Gateway_RemoveModule_with_star_links)
     //Expectations
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, module_handle))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // 1st broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    // 2nd broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    // and the rest of the remove...
+    // the broker drops the routes of the module, the star links stay
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
@@ -4081,8 +4018,8 @@ TEST_FUNCTION(Gateway_RemoveModule_with_star_links)
     Gateway_Destroy(gateway);
 }
 
-//Tests_SRS_GATEWAY_17_003: [ The gateway shall treat a source of "*" as link to the sink module from every other module in gateway. ]
-TEST_FUNCTION(Gateway_RemoveModule_with_star_links_has_errors)
+//Tests_SRS_GATEWAY_26_018: [ This function shall remove any links that contain the removed module either as a source or sink. ]
+TEST_FUNCTION(Gateway_RemoveModule_removes_the_star_link_to_the_module)
 {
     //Arrange
     CGatewayLLMocks mocks;
@@ -4107,6 +4044,10 @@ TEST_FUNCTION(Gateway_RemoveModule_with_star_links_has_errors)
         "*",
         "dummy module"
     };
+    GATEWAY_LINK_ENTRY dummyLink3 = {
+        "*",
+        "dummy module 3"
+    };
 
     BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
     BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_links, &dummyLink1, 1);
@@ -4114,32 +4055,28 @@ TEST_FUNCTION(Gateway_RemoveModule_with_star_links_has_errors)
 
     GATEWAY_HANDLE gateway = Gateway_Create(dummyProps);
     auto module_handle = Gateway_AddModule(gateway, &dummyEntry3);
+    (void)Gateway_AddLink(gateway, &dummyLink3);
 
     mocks.ResetAllCalls();
 
     //Expectations
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, module_handle))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // 1st broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
+    // the star link to the module goes first
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments()
-        .SetFailReturn(nullptr);
-    // 2nd broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
+        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveAnySourceLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
     // and the rest of the remove...
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
+    EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(mocks, Broker_RemoveModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, Broker_DecRef(IGNORED_PTR_ARG))
@@ -4214,18 +4151,7 @@ TEST_FUNCTION(Gateway_RemoveLink_star_link_success)
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, "dummy module"))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // 1st broadcast link
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveAnySourceLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
@@ -5202,7 +5128,7 @@ TEST_FUNCTION(Gateway_AddModule_malloc_name_fail)
 	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreArgument(1)
         .IgnoreArgument(2);
-    EXPECTED_CALL(mocks, Broker_AddModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Broker_AddModuleWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
     EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
     EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .SetFailReturn(0);
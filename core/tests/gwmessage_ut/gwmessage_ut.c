@@ -18,6 +18,8 @@
 static TEST_MUTEX_HANDLE g_testByTest;
 static TEST_MUTEX_HANDLE g_dllByDll;
 
+#include <nanomsg/nn.h>
+
 #include "message.h"
 
 static size_t currentmalloc_call;
@@ -64,6 +66,11 @@ static void my_gballoc_free(void* ptr)
     free(ptr);
 }
 
+MOCK_FUNCTION_WITH_CODE(, int, nn_freemsg, void *, msg)
+    int free_result = 0;
+    free(msg);
+MOCK_FUNCTION_END(free_result)
+
 static CONSTMAP_HANDLE my_ConstMap_Create(MAP_HANDLE sourceMap)
 {
     CONSTMAP_HANDLE result2;
@@ -879,8 +886,7 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     }
 
     /*Tests_SRS_MESSAGE_02_010: [Message_Clone shall return messageHandle.]*/
-    /*Tests_SRS_MESSAGE_17_001: [Message_Clone shall clone the CONSTMAP handle.]*/
-    /*Tests_SRS_MESSAGE_17_004: [Message_Clone shall clone the CONSTBUFFER handle]*/
+    /*Tests_SRS_MESSAGE_30_001: [Message_Clone shall not clone the CONSTMAP nor the CONSTBUFFER of the message.]*/
     TEST_FUNCTION(Message_Clone_increments_ref_count_1)
     {
         ///arrange
@@ -888,11 +894,6 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         MESSAGE_HANDLE aMessage = Message_Create(&c);
         umock_c_reset_all_calls();
 
-        STRICT_EXPECTED_CALL(ConstMap_Clone(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         ///act
         MESSAGE_HANDLE r = Message_Clone(aMessage);
 
@@ -914,11 +915,6 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         MESSAGE_HANDLE r = Message_Clone(aMessage);
         umock_c_reset_all_calls();
 
-        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         ///act
         Message_Destroy(r);
 
@@ -1213,22 +1209,17 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     }
 
     /*Tests_SRS_MESSAGE_02_031: [ Otherwise Message_CreateFromByteArray shall succeed and return a non-NULL handle. ]*/
-    /*Tests_SRS_MESSAGE_02_026: [ A MAP_HANDLE shall be created. ]*/
-    /*Tests_SRS_MESSAGE_02_028: [ A structure of type MESSAGE_CONFIG shall be populated with the MAP_HANDLE previously constructed and the message content ]*/
-    /*Tests_SRS_MESSAGE_02_029: [ A MESSAGE_HANDLE shall be constructed from the MESSAGE_CONFIG. ]*/
+    /*Tests_SRS_MESSAGE_30_002: [ Message_CreateFromByteArray shall copy source to a single allocation that also holds an array with an entry for every property. ]*/
+    /*Tests_SRS_MESSAGE_30_006: [ Message_CreateFromByteArray shall not create the CONSTMAP and the CONSTBUFFER of the message. ]*/
     TEST_FUNCTION(Message_CreateFromByteArray_notFail____minimalMessage)
     {
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(notFail____minimalMessage + 14, 0));
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail____minimalMessage, sizeof(notFail____minimalMessage));
@@ -1242,24 +1233,16 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     }
 
     /*Tests_SRS_MESSAGE_02_031: [ Otherwise Message_CreateFromByteArray shall succeed and return a non-NULL handle. ]*/
-    /*Tests_SRS_MESSAGE_02_027: [ All the properties of the byte array shall be added to the MAP_HANDLE. ]*/
+    /*Tests_SRS_MESSAGE_30_005: [ The names and the values of the properties and the content of the message shall point inside the copy of source. ]*/
     TEST_FUNCTION(Message_CreateFromByteArray_notFail__1Property_0bytes)
     {
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "3", "3"))
-            .SetReturn(MAP_OK);
-
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 0))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__1Property_0bytes, sizeof(notFail__1Property_0bytes));
@@ -1278,20 +1261,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "3", "3"))
-            .SetReturn(MAP_OK);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "ab", "a"))
-            .SetReturn(MAP_OK);
-
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 0))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__2Property_0bytes, sizeof(notFail__2Property_0bytes));
@@ -1310,16 +1283,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 1))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__0Property_1bytes, sizeof(notFail__0Property_1bytes));
@@ -1327,6 +1294,7 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ///assert
         ASSERT_IS_NOT_NULL(handle);
         ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(size_t, 1, Message_GetContent(handle)->size);
 
         ///cleanup
         Message_Destroy(handle);
@@ -1339,17 +1307,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "Azure IoT Gateway is", "awesome"));
-
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 1))
-            .ValidateArgumentBuffer(1, "3", 1);
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__1Property_1bytes, sizeof(notFail__1Property_1bytes));
@@ -1369,18 +1330,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "Azure IoT Gateway is", "awesome"));
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "BleedingEdge", "rocks"));
-
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 1))
-            .ValidateArgumentBuffer(1, "3", 1);
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__2Property_1bytes, sizeof(notFail__2Property_1bytes));
@@ -1399,16 +1352,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
-            .ValidateArgumentBuffer(1, "34", 2);
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__0Property_2bytes, sizeof(notFail__0Property_2bytes));
@@ -1427,16 +1374,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "Azure IoT Gateway is", "awesome"));
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
-            .ValidateArgumentBuffer(1, "34", 2);
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__1Property_2bytes, sizeof(notFail__1Property_2bytes));
@@ -1455,17 +1396,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
 
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "BleedingEdge", "rocks"));
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "Azure IoT Gateway is", "awesome"));
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
-            .ValidateArgumentBuffer(1, "34", 2);
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
@@ -1473,6 +1407,8 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ///assert
         ASSERT_IS_NOT_NULL(handle);
         ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(size_t, 2, Message_GetContent(handle)->size);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(Message_GetContent(handle)->buffer, "34", 2));
 
         ///cleanup
         Message_Destroy(handle);
@@ -1530,11 +1466,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     TEST_FUNCTION(Message_CreateFromByteArray_with_1_property_when_1st_property_doesnt_end_fails)
     {
         ///arrange
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_firstPropertyNameTooBig, sizeof(fail_firstPropertyNameTooBig));
@@ -1550,11 +1485,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     TEST_FUNCTION(Message_CreateFromByteArray_with_1_property_when_1st_property_value_doesnt_start_fails)
     {
         ///arrange
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_firstPropertyValueDoesNotExist, sizeof(fail_firstPropertyValueDoesNotExist));
@@ -1570,11 +1504,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     TEST_FUNCTION(Message_CreateFromByteArray_with_1_property_when_1st_property_value_doesnt_end_fails)
     {
         ///arrange
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_firstPropertyValueDoesNotEnd, sizeof(fail_firstPropertyValueDoesNotEnd));
@@ -1590,11 +1523,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     TEST_FUNCTION(Message_CreateFromByteArray_with_1_byte_of_content_size_fails)
     {
         ///arrange
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "333", "333"));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_whenThereIsOnly1ByteOfcontentSize, sizeof(fail_whenThereIsOnly1ByteOfcontentSize));
@@ -1621,11 +1553,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
             0x00, 0x00              /*not enough bytes for contentSize*/
         };
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "333", "333"));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_whenThereIsOnly2ByteOfcontentSize, sizeof(fail_whenThereIsOnly2ByteOfcontentSize));
@@ -1652,11 +1583,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
             0x00, 0x00, 0x00        /*not enough bytes for contentSize*/
         };
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "333", "333"));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_whenThereIsOnly3ByteOfcontentSize, sizeof(fail_whenThereIsOnly3ByteOfcontentSize));
@@ -1683,11 +1613,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
             0x00, 0x00, 0x00, 0x01  /*no further content*/
         };
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "333", "333"));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_whenThereIsNotEnoughContent, sizeof(fail_whenThereIsNotEnoughContent));
@@ -1715,11 +1644,10 @@ BEGIN_TEST_SUITE(gwmessage_ut)
             '3', '3'
         };
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "333", "333"));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_whenThereIsTooMuchContent, sizeof(fail_whenThereIsTooMuchContent));
@@ -1732,24 +1660,37 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     }
 
     /*Tests_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
-    TEST_FUNCTION(Message_CreateFromByteArray_fails_when_Map_Create_fails)
+    TEST_FUNCTION(Message_CreateFromByteArray_fails_when_malloc_fails_1)
     {
         ///arrange
+        whenShallmalloc_fail = 1;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
 
-        const unsigned char notFail____minimalMessage[] =
-        {
-            0xA1, 0x60,             /*header*/
-            0x00, 0x00, 0x00, 14,   /*size of this array*/
-            0x00, 0x00, 0x00, 0x00, /*zero properties*/
-            0x00, 0x00, 0x00, 0x00  /*zero message content size*/
-        };
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail____minimalMessage, sizeof(notFail____minimalMessage));
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(NULL);
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArray_fails_when_malloc_fails_2)
+    {
+        ///arrange
+        whenShallmalloc_fail = 2;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
-        MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail____minimalMessage, sizeof(notFail____minimalMessage));
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__1Property_1bytes, sizeof(notFail__1Property_1bytes));
 
         ///assert
         ASSERT_IS_NULL(handle);
@@ -1771,11 +1712,6 @@ BEGIN_TEST_SUITE(gwmessage_ut)
             0x00, 0x00, 0x00, 0x00  /*zero message content size*/
         };
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
-
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail____minimalMessage, sizeof(notFail____minimalMessage));
 
@@ -1799,12 +1735,6 @@ BEGIN_TEST_SUITE(gwmessage_ut)
             0x00, 0x00, 0x00, 0x00  /*zero message content size*/
         };
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
-
         ///act
         MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail____minimalMessage, sizeof(notFail____minimalMessage));
 
@@ -1816,28 +1746,57 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     }
 
     /*Tests_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
-    TEST_FUNCTION(Message_CreateFromByteArray_fails_when_Map_Add_fails)
+    TEST_FUNCTION(Message_CreateFromByteArray_fails_when_there_are_more_properties_than_bytes)
     {
+        ///arrange
+
+        const unsigned char fail_whenThereAreTooManyProperties[] =
+        {
+            0xA1, 0x60,             /*header*/
+            0x00, 0x00, 0x00, 18,   /*size of this array*/
+            0x00, 0x00, 0x00, 0x03, /*three properties cannot fit in 4 bytes*/
+            '3', '\0', '3', '\0',
+            0x00, 0x00, 0x00, 0x00  /*zero message content size*/
+        };
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_whenThereAreTooManyProperties, sizeof(fail_whenThereAreTooManyProperties));
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_004: [ If two properties have the same name then Message_CreateFromByteArray shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArray_fails_when_a_property_name_is_repeated)
+    {
         ///arrange
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "3", "3"))
-            .SetReturn(MAP_ERROR);
+        const unsigned char fail_whenAPropertyIsRepeated[] =
+        {
+            0xA1, 0x60,             /*header*/
+            0x00, 0x00, 0x00, 23,   /*size of this array*/
+            0x00, 0x00, 0x00, 0x02, /*two properties*/
+            'a', 'b', '\0', 'a', '\0',
+            'a', 'b', '\0', '\0',
+            0x00, 0x00, 0x00, 0x00  /*zero message content size*/
+        };
 
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
 
         ///act
-        MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__1Property_0bytes, sizeof(notFail__1Property_0bytes));
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(fail_whenAPropertyIsRepeated, sizeof(fail_whenAPropertyIsRepeated));
 
         ///assert
         ASSERT_IS_NULL(handle);
         ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
         ///cleanup
-        Message_Destroy(handle);
     }
 
     /*Tests_SRS_MESSAGE_02_032: [ If messageHandle is NULL then Message_ToByteArray shall fail and return NULL. ]*/
@@ -1896,17 +1855,9 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         int32_t size = 0;
         unsigned char * buf = NULL;
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 0))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
-
-        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail____minimalMessage, sizeof(notFail____minimalMessage));
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
 
         size_t zero = 0;
         const CONSTBUFFER bufferContent = { NULL, 0 };
@@ -1944,17 +1895,9 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ASSERT_IS_NOT_NULL(buf);
         umock_c_reset_all_calls();
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 0))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
-
-        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail____minimalMessage, sizeof(notFail____minimalMessage));
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
 
         size_t zero = 0;
         const CONSTBUFFER bufferContent = { NULL, 0 };
@@ -1994,21 +1937,9 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ASSERT_IS_NOT_NULL(buf);
         umock_c_reset_all_calls();
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
-
-        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
 
         size_t two = 2;
         const char* keys[] = { "BleedingEdge", "Azure IoT Gateway is" };
@@ -2051,21 +1982,9 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ASSERT_IS_NOT_NULL(buf);
         umock_c_reset_all_calls();
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
-
-        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
 
         size_t two = 2;
         const char* keys[] = { "BleedingEdge", "Azure IoT Gateway is" };
@@ -2104,21 +2023,9 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ASSERT_IS_NOT_NULL(buf);
         umock_c_reset_all_calls();
 
-        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
-            .IgnoreArgument_mapFilterFunc()
-            .SetReturn(TEST_MAP_HANDLE);
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreAllCalls();
-        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
-            .IgnoreArgument_source();
-        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
-        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
-
-        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
 
         size_t two = 2;
         const char* keys[] = { "BleedingEdge", "Azure IoT Gateway is" };
@@ -2149,4 +2056,760 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         Message_Destroy(messageHandle);
     }
 
+    /*Tests_SRS_MESSAGE_30_010: [ If size is negative, Message_ToByteArray shall return -1. ]*/
+    TEST_FUNCTION(Message_ToByteArray_fails_with_negative_size)
+    {
+        ///arrange
+        unsigned char buf[1];
+
+        ///act
+        int32_t size = Message_ToByteArray(TEST_MESSAGE_HANDLE, buf, -1);
+
+        ///assert
+        ASSERT_IS_TRUE(size < 0);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_039: [ If buf is not NULL and size is less than 14, the minimum message length, Message_ToByteArray shall return -1 without writing to buf. ]*/
+    TEST_FUNCTION(Message_ToByteArray_fails_with_a_buffer_shorter_than_a_message)
+    {
+        ///arrange
+        unsigned char buf[sizeof(notFail____minimalMessage)];
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        memset(buf, 0xCC, sizeof(buf));
+        umock_c_reset_all_calls();
+
+        ///act
+        int32_t size = Message_ToByteArray(messageHandle, buf, sizeof(notFail____minimalMessage) - 1);
+
+        ///assert
+        ASSERT_IS_TRUE(size < 0);
+        ASSERT_ARE_EQUAL(int, 0xCC, buf[0]);
+        ASSERT_ARE_EQUAL(int, 0xCC, buf[6]);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_007: [ Message_ToByteArray shall remember the size of the byte array after it has been computed once. ]*/
+    TEST_FUNCTION(Message_ToByteArray_returns_the_remembered_size)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        size_t zero = 0;
+        const CONSTBUFFER bufferContent = { NULL, 0 };
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .IgnoreArgument_keys()
+            .IgnoreArgument_values()
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
+            .IgnoreArgument_constbufferHandle()
+            .SetReturn(&bufferContent);
+        (void)Message_ToByteArray(messageHandle, NULL, 0);
+        umock_c_reset_all_calls();
+
+        ///act
+        int32_t nbytes = Message_ToByteArray(messageHandle, NULL, 0);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int32_t, sizeof(notFail____minimalMessage), nbytes);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_008: [ If the message was created by Message_CreateFromByteArray, Message_ToByteArray shall copy the byte array the message keeps. ]*/
+    TEST_FUNCTION(Message_ToByteArray_copies_the_byte_array_of_a_decoded_message)
+    {
+        ///arrange
+        unsigned char buf[sizeof(notFail__2Property_2bytes)];
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        ///act
+        int32_t needed = Message_ToByteArray(messageHandle, NULL, 0);
+        int32_t nbytes = Message_ToByteArray(messageHandle, buf, sizeof(buf));
+
+        ///assert
+        ASSERT_ARE_EQUAL(int32_t, sizeof(notFail__2Property_2bytes), needed);
+        ASSERT_ARE_EQUAL(int32_t, sizeof(notFail__2Property_2bytes), nbytes);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(buf, notFail__2Property_2bytes, sizeof(buf)));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_011: [ If the message was created by Message_CreateFromByteArray, Message_GetProperties shall build the CONSTMAP from the properties of the message the first time it is called. ]*/
+    /*Tests_SRS_MESSAGE_30_003: [ The properties shall be sorted by name. ]*/
+    TEST_FUNCTION(Message_GetProperties_builds_the_CONSTMAP_of_a_decoded_message)
+    {
+        ///arrange
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(Map_Create(NULL))
+            .SetReturn(TEST_MAP_HANDLE);
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "Azure IoT Gateway is", "awesome"));
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "BleedingEdge", "rocks"));
+        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(ConstMap_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(properties);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        ConstMap_Destroy(properties);
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_012: [ If building the CONSTMAP fails, Message_GetProperties shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_GetProperties_of_a_decoded_message_fails_when_Map_Create_fails)
+    {
+        ///arrange
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(Map_Create(NULL))
+            .SetReturn(NULL);
+
+        ///act
+        CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
+
+        ///assert
+        ASSERT_IS_NULL(properties);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_022: [ If message or key is NULL then Message_GetProperty shall return NULL. ]*/
+    TEST_FUNCTION(Message_GetProperty_with_NULL_message_returns_NULL)
+    {
+        ///arrange
+
+        ///act
+        const char* value = Message_GetProperty(NULL, "BleedingEdge");
+
+        ///assert
+        ASSERT_IS_NULL(value);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_022: [ If message or key is NULL then Message_GetProperty shall return NULL. ]*/
+    TEST_FUNCTION(Message_GetProperty_with_NULL_key_returns_NULL)
+    {
+        ///arrange
+
+        ///act
+        const char* value = Message_GetProperty(TEST_MESSAGE_HANDLE, NULL);
+
+        ///assert
+        ASSERT_IS_NULL(value);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_023: [ If the message was created by Message_CreateFromByteArray or Message_CreateFromByteArrayNoCopy, Message_GetProperty shall binary search the sorted properties of the message. ]*/
+    /*Tests_SRS_MESSAGE_30_027: [ Message_GetProperty shall return the value of the property named key, or NULL if there is no such property. ]*/
+    TEST_FUNCTION(Message_GetProperty_of_a_decoded_message_succeeds)
+    {
+        ///arrange
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        ///act
+        const char* value1 = Message_GetProperty(messageHandle, "BleedingEdge");
+        const char* value2 = Message_GetProperty(messageHandle, "Azure IoT Gateway is");
+        const char* value3 = Message_GetProperty(messageHandle, "Bleeding");
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, "rocks", value1);
+        ASSERT_ARE_EQUAL(char_ptr, "awesome", value2);
+        ASSERT_IS_NULL(value3);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_024: [ Otherwise Message_GetProperty shall get the properties from the CONSTMAP by calling ConstMap_GetInternals. ]*/
+    /*Tests_SRS_MESSAGE_30_025: [ The first time it is called for a message with properties, Message_GetProperty shall build an index of the properties sorted by name, the following calls shall reuse it. ]*/
+    /*Tests_SRS_MESSAGE_30_027: [ Message_GetProperty shall return the value of the property named key, or NULL if there is no such property. ]*/
+    TEST_FUNCTION(Message_GetProperty_builds_the_index_once)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
+
+        size_t two = 2;
+        const char* keys[] = { "BleedingEdge", "Azure IoT Gateway is" };
+        const char* values[] = { "rocks", "awesome" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &two, sizeof(two));
+        STRICT_EXPECTED_CALL(gballoc_malloc(2 * 2 * sizeof(const char*))); /*this is the index*/
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &two, sizeof(two));
+
+        ///act
+        const char* value1 = Message_GetProperty(messageHandle, "Azure IoT Gateway is");
+        const char* value2 = Message_GetProperty(messageHandle, "Azure");
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, "awesome", value1);
+        ASSERT_IS_NULL(value2);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_026: [ If any of the above steps fails, Message_GetProperty shall return NULL. ]*/
+    TEST_FUNCTION(Message_GetProperty_fails_when_ConstMap_GetInternals_fails)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .SetReturn(CONSTMAP_ERROR);
+
+        ///act
+        const char* value = Message_GetProperty(messageHandle, "BleedingEdge");
+
+        ///assert
+        ASSERT_IS_NULL(value);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_026: [ If any of the above steps fails, Message_GetProperty shall return NULL. ]*/
+    TEST_FUNCTION(Message_GetProperty_fails_when_malloc_fails)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        umock_c_reset_all_calls();
+        whenShallmalloc_fail = currentmalloc_call + 1;
+
+        size_t two = 2;
+        const char* keys[] = { "BleedingEdge", "Azure IoT Gateway is" };
+        const char* values[] = { "rocks", "awesome" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &two, sizeof(two));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the index*/
+            .IgnoreArgument(1);
+
+        ///act
+        const char* value = Message_GetProperty(messageHandle, "BleedingEdge");
+
+        ///assert
+        ASSERT_IS_NULL(value);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_013: [ If the message was created by Message_CreateFromByteArray, Message_GetContent shall return the content as it is in the byte array the message keeps. ]*/
+    TEST_FUNCTION(Message_GetContent_of_a_decoded_message_succeeds)
+    {
+        ///arrange
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        ///act
+        const CONSTBUFFER* content = Message_GetContent(messageHandle);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(content);
+        ASSERT_ARE_EQUAL(size_t, 2, content->size);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(content->buffer, "34", 2));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_014: [ If the message was created by Message_CreateFromByteArray, Message_GetContentHandle shall copy the content to a CONSTBUFFER the first time it is called. ]*/
+    TEST_FUNCTION(Message_GetContentHandle_of_a_decoded_message_succeeds)
+    {
+        ///arrange
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        CONSTBUFFER_HANDLE content = Message_GetContentHandle(messageHandle);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(content);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        CONSTBUFFER_Destroy(content);
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_015: [ If copying the content fails, Message_GetContentHandle shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_GetContentHandle_of_a_decoded_message_fails_when_CONSTBUFFER_Create_fails)
+    {
+        ///arrange
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+        whenShallCONSTBUFFER_Create_fail = 1;
+
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, 2))
+            .IgnoreArgument(1);
+
+        ///act
+        CONSTBUFFER_HANDLE content = Message_GetContentHandle(messageHandle);
+
+        ///assert
+        ASSERT_IS_NULL(content);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_02_021: [If the ref count is zero then the allocated resources are freed.]*/
+    TEST_FUNCTION(Message_Destroy_of_a_decoded_message_frees_the_byte_array)
+    {
+        ///arrange
+        MESSAGE_HANDLE messageHandle = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the copy of the byte array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(messageHandle);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_016: [ Message_CreateFromByteArrayNoCopy shall validate source the same way as Message_CreateFromByteArray and shall fail and return NULL if source is not a valid serialization. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayNoCopy_with_NULL_source_fails)
+    {
+        ///arrange
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayNoCopy(NULL, 1);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_016: [ Message_CreateFromByteArrayNoCopy shall validate source the same way as Message_CreateFromByteArray and shall fail and return NULL if source is not a valid serialization. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayNoCopy_when_first_byte_is_not_0xA1_fails)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(fail_____firstByteNot0xA1));
+        ASSERT_IS_NOT_NULL(source);
+        (void)memcpy(source, fail_____firstByteNot0xA1, sizeof(fail_____firstByteNot0xA1));
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayNoCopy(source, sizeof(fail_____firstByteNot0xA1));
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        free(source);
+    }
+
+    /*Tests_SRS_MESSAGE_30_017: [ Message_CreateFromByteArrayNoCopy shall allocate an array with an entry for every property and shall not copy source. ]*/
+    /*Tests_SRS_MESSAGE_30_018: [ The names and the values of the properties and the content of the message shall point inside source. ]*/
+    /*Tests_SRS_MESSAGE_30_019: [ Otherwise Message_CreateFromByteArrayNoCopy shall succeed, take ownership of source and return a non-NULL handle. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayNoCopy_notFail__2Property_2bytes)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        ASSERT_IS_NOT_NULL(source);
+        (void)memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(2 * 2 * sizeof(const char*))); /*this is the properties*/
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayNoCopy(source, sizeof(notFail__2Property_2bytes));
+
+        ///assert
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(size_t, 2, Message_GetContent(handle)->size);
+        ASSERT_ARE_EQUAL(void_ptr, source + sizeof(notFail__2Property_2bytes) - 2, Message_GetContent(handle)->buffer);
+
+        ///cleanup
+        Message_Destroy(handle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_017: [ Message_CreateFromByteArrayNoCopy shall allocate an array with an entry for every property and shall not copy source. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayNoCopy_notFail__0Property_1bytes)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__0Property_1bytes));
+        ASSERT_IS_NOT_NULL(source);
+        (void)memcpy(source, notFail__0Property_1bytes, sizeof(notFail__0Property_1bytes));
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayNoCopy(source, sizeof(notFail__0Property_1bytes));
+
+        ///assert
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(handle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_020: [ If any of the above steps fails, then Message_CreateFromByteArrayNoCopy shall fail, return NULL and shall not free source. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayNoCopy_fails_when_malloc_fails)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        ASSERT_IS_NOT_NULL(source);
+        (void)memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+
+        whenShallmalloc_fail = 2;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the properties*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayNoCopy(source, sizeof(notFail__2Property_2bytes));
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        free(source);
+    }
+
+    /*Tests_SRS_MESSAGE_30_021: [ If the ref count is zero and the message was created by Message_CreateFromByteArrayNoCopy then Message_Destroy shall call nn_freemsg on the buffer of the message. ]*/
+    TEST_FUNCTION(Message_Destroy_of_a_message_created_without_copy_calls_nn_freemsg)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        ASSERT_IS_NOT_NULL(source);
+        (void)memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayNoCopy(source, sizeof(notFail__2Property_2bytes));
+        MESSAGE_HANDLE clone = Message_Clone(handle);
+        Message_Destroy(handle);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the properties*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(nn_freemsg(source));
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(clone);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_028: [ If original is NULL, or overlay is NULL and overlaySize is not zero, then Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_with_NULL_original_fails)
+    {
+        ///arrange
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "BleedingEdge", "is here" } };
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateDerived(NULL, overlay, 1);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_028: [ If original is NULL, or overlay is NULL and overlaySize is not zero, then Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_with_NULL_overlay_and_nonzero_size_fails)
+    {
+        ///arrange
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateDerived(TEST_MESSAGE_HANDLE, NULL, 1);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_029: [ If the name of any entry of overlay is NULL then Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_with_NULL_name_fails)
+    {
+        ///arrange
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "BleedingEdge", "is here" }, { NULL, "x" } };
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateDerived(TEST_MESSAGE_HANDLE, overlay, 2);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_031: [ If two entries of overlay have the same name then Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_with_repeated_name_fails)
+    {
+        ///arrange
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "BleedingEdge", "is here" }, { "BleedingEdge", NULL } };
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the overlay*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateDerived(TEST_MESSAGE_HANDLE, overlay, 2);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_032: [ If any of the above steps fails, then Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_fails_when_malloc_fails)
+    {
+        ///arrange
+        MESSAGE_HANDLE original = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "BleedingEdge", "is here" } };
+        umock_c_reset_all_calls();
+
+        whenShallmalloc_fail = currentmalloc_call + 2;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the overlay*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateDerived(original, overlay, 1);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(original);
+    }
+
+    /*Tests_SRS_MESSAGE_30_030: [ Message_CreateDerived shall copy overlay to a single allocation holding the entries sorted by name and their strings. ]*/
+    /*Tests_SRS_MESSAGE_30_038: [ Otherwise Message_CreateDerived shall call Message_Clone on original, shall not copy its properties nor its content, and shall return a non-NULL handle. ]*/
+    /*Tests_SRS_MESSAGE_30_034: [ If the message was created by Message_CreateDerived, Message_GetProperty shall look for key in the overlay of the message first and then in the original message, without building the CONSTMAP of the message. ]*/
+    TEST_FUNCTION(Message_CreateDerived_happy_path)
+    {
+        ///arrange
+        MESSAGE_HANDLE original = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        char value[] = "is here";
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "Zzz", value }, { "Azure IoT Gateway is", NULL } };
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the overlay*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateDerived(original, overlay, 2);
+        value[0] = 'X';
+        Message_Destroy(original);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, "is here", Message_GetProperty(handle, "Zzz"));
+        ASSERT_ARE_EQUAL(char_ptr, "rocks", Message_GetProperty(handle, "BleedingEdge"));
+        ASSERT_IS_NULL(Message_GetProperty(handle, "Azure IoT Gateway is"));
+        ASSERT_IS_NULL(Message_GetProperty(handle, "Bleeding"));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(handle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_033: [ If the message was created by Message_CreateDerived, Message_GetProperties shall build the CONSTMAP the first time it is called, from a writeable clone of the properties of the original message with the overlay applied. ]*/
+    TEST_FUNCTION(Message_GetProperties_builds_the_CONSTMAP_of_a_derived_message)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE original = Message_Create(&c);
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "b", NULL }, { "a", "1" } };
+        MESSAGE_HANDLE handle = Message_CreateDerived(original, overlay, 2);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_CloneWriteable(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetReturn(TEST_MAP_HANDLE);
+        STRICT_EXPECTED_CALL(Map_AddOrUpdate(TEST_MAP_HANDLE, "a", "1"));
+        STRICT_EXPECTED_CALL(Map_Delete(TEST_MAP_HANDLE, "b"))
+            .SetReturn(MAP_KEYNOTFOUND);
+        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(ConstMap_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        CONSTMAP_HANDLE properties = Message_GetProperties(handle);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(properties);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        ConstMap_Destroy(properties);
+        Message_Destroy(handle);
+        Message_Destroy(original);
+    }
+
+    /*Tests_SRS_MESSAGE_30_012: [ If building the CONSTMAP fails, Message_GetProperties shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_GetProperties_of_a_derived_message_fails_when_Map_AddOrUpdate_fails)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE original = Message_Create(&c);
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "a", "1" } };
+        MESSAGE_HANDLE handle = Message_CreateDerived(original, overlay, 1);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_CloneWriteable(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetReturn(TEST_MAP_HANDLE);
+        STRICT_EXPECTED_CALL(Map_AddOrUpdate(TEST_MAP_HANDLE, "a", "1"))
+            .SetReturn(MAP_ERROR);
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+
+        ///act
+        CONSTMAP_HANDLE properties = Message_GetProperties(handle);
+
+        ///assert
+        ASSERT_IS_NULL(properties);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(handle);
+        Message_Destroy(original);
+    }
+
+    /*Tests_SRS_MESSAGE_30_035: [ If the message was created by Message_CreateDerived, Message_GetContent and Message_GetContentHandle shall return the content of the original message. ]*/
+    TEST_FUNCTION(Message_GetContent_of_a_derived_message_returns_the_content_of_the_original)
+    {
+        ///arrange
+        MESSAGE_HANDLE original = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_HANDLE handle = Message_CreateDerived(original, NULL, 0);
+        umock_c_reset_all_calls();
+
+        ///act
+        const CONSTBUFFER* content = Message_GetContent(handle);
+
+        ///assert
+        ASSERT_ARE_EQUAL(void_ptr, Message_GetContent(original), content);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(handle);
+        Message_Destroy(original);
+    }
+
+    /*Tests_SRS_MESSAGE_30_036: [ If the ref count is zero and the message was created by Message_CreateDerived then Message_Destroy shall call Message_Destroy on the original message. ]*/
+    TEST_FUNCTION(Message_Destroy_of_a_derived_message_destroys_the_original)
+    {
+        ///arrange
+        MESSAGE_HANDLE original = Message_CreateFromByteArray(notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_PROPERTY_OVERLAY overlay[] = { { "a", "1" } };
+        MESSAGE_HANDLE handle = Message_CreateDerived(original, overlay, 1);
+        Message_Destroy(original);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the overlay*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the copy of the byte array of the original*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the original*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the handle*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(handle);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
 END_TEST_SUITE(gwmessage_ut)
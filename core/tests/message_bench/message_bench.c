@@ -0,0 +1,488 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*micro benchmark of Message_CreateFromByteArray and Message_ToByteArray. Every
+case is run with the codec of the gateway and with a copy of the codec the
+gateway had before the messages decoded from a byte array kept it, which is
+the baseline the speedup is computed against.*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "azure_c_shared_utility/map.h"
+#include "azure_c_shared_utility/constmap.h"
+#include "azure_c_shared_utility/constbuffer.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "message.h"
+
+#define MIN_RUN_MS 200
+
+static const size_t property_counts[] = { 0, 8, 64 };
+static const size_t payload_sizes[] = { 16, 256, 4096, 65536 };
+
+/*the baseline codec*/
+
+static int legacy_parse_int32_t(const unsigned char* source, int32_t sourceSize, int32_t position, int32_t *parsed, int32_t* value)
+{
+    int result;
+    if (position + 4 > sourceSize)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        *parsed = 4;
+        *value = (int32_t)(
+            ((uint32_t)source[position + 0] << 24) |
+            ((uint32_t)source[position + 1] << 16) |
+            ((uint32_t)source[position + 2] << 8) |
+            ((uint32_t)source[position + 3]));
+        result = 0;
+    }
+    return result;
+}
+
+static int legacy_parse_null_terminated_const_char(const unsigned char* source, int32_t sourceSize, int32_t position, int32_t *parsed, const char** value)
+{
+    int result;
+    const unsigned char* whereIsnull = (unsigned char*)memchr(source + position, '\0', sourceSize - position);
+    if (whereIsnull == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        *parsed = (int32_t)(whereIsnull - (source + position - 1));
+        *value = (const char*)source + position;
+        result = 0;
+    }
+    return result;
+}
+
+static MESSAGE_HANDLE legacy_create_from_byte_array(const unsigned char* source, int32_t size)
+{
+    MESSAGE_HANDLE result = NULL;
+    int32_t currentPosition = 2;
+    int32_t parsed;
+    int32_t messageSize;
+    if (
+        (size >= 14) &&
+        (source[0] == 0xA1) &&
+        (source[1] == 0x60) &&
+        (legacy_parse_int32_t(source, size, currentPosition, &parsed, &messageSize) == 0) &&
+        (messageSize == size)
+        )
+    {
+        MAP_HANDLE configMap = Map_Create(NULL);
+        if (configMap != NULL)
+        {
+            int32_t propertiesCount;
+            currentPosition += parsed;
+            if (
+                (legacy_parse_int32_t(source, size, currentPosition, &parsed, &propertiesCount) == 0) &&
+                (propertiesCount >= 0) &&
+                (propertiesCount != INT32_MAX)
+                )
+            {
+                int32_t i;
+                int32_t messageContentSize;
+                currentPosition += parsed;
+                for (i = 0; i < propertiesCount; i++)
+                {
+                    const char* keyName;
+                    const char* keyValue;
+                    if (legacy_parse_null_terminated_const_char(source, size, currentPosition, &parsed, &keyName) != 0)
+                    {
+                        break;
+                    }
+                    currentPosition += parsed;
+                    if (legacy_parse_null_terminated_const_char(source, size, currentPosition, &parsed, &keyValue) != 0)
+                    {
+                        break;
+                    }
+                    currentPosition += parsed;
+                    if (Map_Add(configMap, keyName, keyValue) != MAP_OK)
+                    {
+                        break;
+                    }
+                }
+
+                if (
+                    (i == propertiesCount) &&
+                    (legacy_parse_int32_t(source, size, currentPosition, &parsed, &messageContentSize) == 0) &&
+                    (currentPosition + parsed + messageContentSize == messageSize)
+                    )
+                {
+                    /*Message_Create copies the map to a CONSTMAP and the content to a CONSTBUFFER*/
+                    MESSAGE_CONFIG msgConfig = { (size_t)messageContentSize, source + currentPosition + parsed, configMap };
+                    result = Message_Create(&msgConfig);
+                }
+            }
+            Map_Destroy(configMap);
+        }
+    }
+    return result;
+}
+
+/*properties and content are what the baseline read from the message itself*/
+static int32_t legacy_to_byte_array(CONSTMAP_HANDLE properties, const CONSTBUFFER* messageContent, unsigned char* buf, int32_t size)
+{
+    int32_t result;
+    const char* const * keys;
+    const char* const * values;
+    size_t nProperties;
+    if (ConstMap_GetInternals(properties, &keys, &values, &nProperties) != CONSTMAP_OK)
+    {
+        result = -1;
+    }
+    else
+    {
+        size_t byteArraySize = 2 + 4 + 4 + 4 + messageContent->size;
+        size_t i;
+        for (i = 0; i < nProperties; i++)
+        {
+            byteArraySize += (strlen(keys[i]) + 1) + (strlen(values[i]) + 1);
+        }
+
+        if (size == 0)
+        {
+            result = (int32_t)byteArraySize;
+        }
+        else if (byteArraySize > (size_t)size)
+        {
+            result = -1;
+        }
+        else
+        {
+            size_t currentPosition;
+            buf[0] = 0xA1;
+            buf[1] = 0x60;
+            buf[2] = (byteArraySize >> 24) & 0xFF;
+            buf[3] = (byteArraySize >> 16) & 0xFF;
+            buf[4] = (byteArraySize >> 8) & 0xFF;
+            buf[5] = (byteArraySize) & 0xFF;
+            buf[6] = (nProperties >> 24) & 0xFF;
+            buf[7] = (nProperties >> 16) & 0xFF;
+            buf[8] = (nProperties >> 8) & 0xFF;
+            buf[9] = nProperties & 0xFF;
+            currentPosition = 10;
+            for (i = 0; i < nProperties; i++)
+            {
+                size_t nameLength = strlen(keys[i]) + 1;
+                size_t valueLength = strlen(values[i]) + 1;
+                memcpy(buf + currentPosition, keys[i], nameLength);
+                currentPosition += nameLength;
+                memcpy(buf + currentPosition, values[i], valueLength);
+                currentPosition += valueLength;
+            }
+            buf[currentPosition++] = (messageContent->size >> 24) & 0xFF;
+            buf[currentPosition++] = (messageContent->size >> 16) & 0xFF;
+            buf[currentPosition++] = (messageContent->size >> 8) & 0xFF;
+            buf[currentPosition++] = messageContent->size & 0xFF;
+            memcpy(buf + currentPosition, messageContent->buffer, messageContent->size);
+            result = (int32_t)byteArraySize;
+        }
+    }
+    return result;
+}
+
+/*the cases*/
+
+typedef struct BENCH_CASE_TAG
+{
+    MESSAGE_HANDLE message;
+    CONSTMAP_HANDLE properties;
+    const CONSTBUFFER* content;
+    unsigned char* byte_array;
+    int32_t byte_array_size;
+    unsigned char* out;
+} BENCH_CASE;
+
+typedef int(*BENCH_FUNCTION)(BENCH_CASE* bench_case);
+
+static int bench_decode_legacy(BENCH_CASE* bench_case)
+{
+    int result;
+    MESSAGE_HANDLE message = legacy_create_from_byte_array(bench_case->byte_array, bench_case->byte_array_size);
+    if (message == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        /*a module reading the content is what the decoding is for*/
+        result = (Message_GetContent(message) == NULL) ? __LINE__ : 0;
+        Message_Destroy(message);
+    }
+    return result;
+}
+
+static int bench_decode(BENCH_CASE* bench_case)
+{
+    int result;
+    MESSAGE_HANDLE message = Message_CreateFromByteArray(bench_case->byte_array, bench_case->byte_array_size);
+    if (message == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        result = (Message_GetContent(message) == NULL) ? __LINE__ : 0;
+        Message_Destroy(message);
+    }
+    return result;
+}
+
+static int bench_encode_legacy(BENCH_CASE* bench_case)
+{
+    /*callers ask for the size and then serialize*/
+    int32_t size = legacy_to_byte_array(bench_case->properties, bench_case->content, NULL, 0);
+    return (legacy_to_byte_array(bench_case->properties, bench_case->content, bench_case->out, size) == size) ? 0 : __LINE__;
+}
+
+static int bench_encode(BENCH_CASE* bench_case)
+{
+    int32_t size = Message_ToByteArray(bench_case->message, NULL, 0);
+    return (Message_ToByteArray(bench_case->message, bench_case->out, size) == size) ? 0 : __LINE__;
+}
+
+/*a proxy that receives a message, then sends it on*/
+static int bench_forward_legacy(BENCH_CASE* bench_case)
+{
+    int result;
+    MESSAGE_HANDLE message = legacy_create_from_byte_array(bench_case->byte_array, bench_case->byte_array_size);
+    if (message == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        CONSTMAP_HANDLE properties = Message_GetProperties(message);
+        int32_t size = legacy_to_byte_array(properties, Message_GetContent(message), NULL, 0);
+        result = (legacy_to_byte_array(properties, Message_GetContent(message), bench_case->out, size) == size) ? 0 : __LINE__;
+        ConstMap_Destroy(properties);
+        Message_Destroy(message);
+    }
+    return result;
+}
+
+static int bench_forward(BENCH_CASE* bench_case)
+{
+    int result;
+    MESSAGE_HANDLE message = Message_CreateFromByteArray(bench_case->byte_array, bench_case->byte_array_size);
+    if (message == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        int32_t size = Message_ToByteArray(message, NULL, 0);
+        result = (Message_ToByteArray(message, bench_case->out, size) == size) ? 0 : __LINE__;
+        Message_Destroy(message);
+    }
+    return result;
+}
+
+/*returns the nanoseconds per call of bench_function, or a negative value on failure*/
+static double run(TICK_COUNTER_HANDLE tick_counter, BENCH_FUNCTION bench_function, BENCH_CASE* bench_case)
+{
+    double result = -1;
+    size_t iterations = 16;
+    for (;;)
+    {
+        tickcounter_ms_t start;
+        tickcounter_ms_t end;
+        size_t i;
+        if (tickcounter_get_current_ms(tick_counter, &start) != 0)
+        {
+            break;
+        }
+        for (i = 0; i < iterations; i++)
+        {
+            if (bench_function(bench_case) != 0)
+            {
+                break;
+            }
+        }
+        if (
+            (i != iterations) ||
+            (tickcounter_get_current_ms(tick_counter, &end) != 0)
+            )
+        {
+            break;
+        }
+        else if (end - start >= MIN_RUN_MS)
+        {
+            result = (double)(end - start) * 1000000.0 / (double)iterations;
+            break;
+        }
+        else
+        {
+            iterations *= 2;
+        }
+    }
+    return result;
+}
+
+static int create_case(BENCH_CASE* bench_case, size_t property_count, size_t payload_size)
+{
+    int result;
+    MAP_HANDLE map = Map_Create(NULL);
+    unsigned char* payload = (unsigned char*)malloc(payload_size);
+    bench_case->message = NULL;
+    bench_case->properties = NULL;
+    bench_case->byte_array = NULL;
+    bench_case->out = NULL;
+    if (
+        (map == NULL) ||
+        (payload == NULL)
+        )
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < property_count; i++)
+        {
+            /*names and values about as long as the ones modules use*/
+            char name[32];
+            char value[32];
+            (void)sprintf(name, "property-name-%u", (unsigned int)i);
+            (void)sprintf(value, "value-%08u", (unsigned int)(i * 2654435761u));
+            if (Map_Add(map, name, value) != MAP_OK)
+            {
+                break;
+            }
+        }
+        memset(payload, 'x', payload_size);
+
+        if (i != property_count)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            MESSAGE_CONFIG config = { payload_size, payload, map };
+            bench_case->message = Message_Create(&config);
+            if (bench_case->message == NULL)
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                bench_case->properties = Message_GetProperties(bench_case->message);
+                bench_case->content = Message_GetContent(bench_case->message);
+                bench_case->byte_array_size = Message_ToByteArray(bench_case->message, NULL, 0);
+                bench_case->byte_array = (unsigned char*)malloc(bench_case->byte_array_size);
+                bench_case->out = (unsigned char*)malloc(bench_case->byte_array_size);
+                if (
+                    (bench_case->properties == NULL) ||
+                    (bench_case->byte_array == NULL) ||
+                    (bench_case->out == NULL) ||
+                    (Message_ToByteArray(bench_case->message, bench_case->byte_array, bench_case->byte_array_size) != bench_case->byte_array_size)
+                    )
+                {
+                    result = __LINE__;
+                }
+                else
+                {
+                    result = 0;
+                }
+            }
+        }
+    }
+    free(payload);
+    if (map != NULL)
+    {
+        Map_Destroy(map);
+    }
+    return result;
+}
+
+static void destroy_case(BENCH_CASE* bench_case)
+{
+    if (bench_case->properties != NULL)
+    {
+        ConstMap_Destroy(bench_case->properties);
+    }
+    if (bench_case->message != NULL)
+    {
+        Message_Destroy(bench_case->message);
+    }
+    free(bench_case->byte_array);
+    free(bench_case->out);
+}
+
+static const struct
+{
+    const char* name;
+    BENCH_FUNCTION legacy;
+    BENCH_FUNCTION current;
+} operations[] =
+{
+    { "decode", bench_decode_legacy, bench_decode },
+    { "encode", bench_encode_legacy, bench_encode },
+    { "forward", bench_forward_legacy, bench_forward }
+};
+
+int main(void)
+{
+    int result = 0;
+    TICK_COUNTER_HANDLE tick_counter = tickcounter_create();
+    if (tick_counter == NULL)
+    {
+        (void)fprintf(stderr, "tickcounter_create failed\n");
+        result = 1;
+    }
+    else
+    {
+        size_t p;
+        (void)printf("%-8s %10s %10s %14s %14s %8s\n", "op", "properties", "payload", "baseline_ns", "current_ns", "speedup");
+        for (p = 0; (result == 0) && (p < sizeof(property_counts) / sizeof(property_counts[0])); p++)
+        {
+            size_t s;
+            for (s = 0; (result == 0) && (s < sizeof(payload_sizes) / sizeof(payload_sizes[0])); s++)
+            {
+                BENCH_CASE bench_case;
+                if (create_case(&bench_case, property_counts[p], payload_sizes[s]) != 0)
+                {
+                    (void)fprintf(stderr, "unable to create the case with %u properties and %u bytes\n", (unsigned int)property_counts[p], (unsigned int)payload_sizes[s]);
+                    result = 1;
+                }
+                else
+                {
+                    size_t o;
+                    for (o = 0; (result == 0) && (o < sizeof(operations) / sizeof(operations[0])); o++)
+                    {
+                        double legacy_ns = run(tick_counter, operations[o].legacy, &bench_case);
+                        double current_ns = run(tick_counter, operations[o].current, &bench_case);
+                        if (
+                            (legacy_ns < 0) ||
+                            (current_ns < 0)
+                            )
+                        {
+                            (void)fprintf(stderr, "%s failed\n", operations[o].name);
+                            result = 1;
+                        }
+                        else
+                        {
+                            (void)printf("%-8s %10u %10u %14.1f %14.1f %7.2fx\n",
+                                operations[o].name,
+                                (unsigned int)property_counts[p],
+                                (unsigned int)payload_sizes[s],
+                                legacy_ns,
+                                current_ns,
+                                (current_ns > 0) ? legacy_ns / current_ns : 0.0);
+                        }
+                    }
+                }
+                destroy_case(&bench_case);
+            }
+        }
+        tickcounter_destroy(tick_counter);
+    }
+    return result;
+}
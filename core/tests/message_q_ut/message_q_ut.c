@@ -48,6 +48,8 @@ void my_gballoc_free(void* ptr)
 #include "message.h"
 #include "azure_c_shared_utility/doublylinkedlist.h"
 #include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
 
 #undef ENABLE_MOCKS
 
@@ -146,6 +148,10 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
 	REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(PDLIST_ENTRY, void *);
 	REGISTER_UMOCK_ALIAS_TYPE(const PDLIST_ENTRY, const void*);
+	REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(LOCK_RESULT, int);
+	REGISTER_UMOCK_ALIAS_TYPE(COND_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(COND_RESULT, int);
 
 	// malloc/free hooks
 	REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
@@ -159,6 +165,13 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
 	REGISTER_GLOBAL_MOCK_HOOK(DList_AppendTailList, real_DList_AppendTailList);
 	REGISTER_GLOBAL_MOCK_HOOK(DList_RemoveEntryList, real_DList_RemoveEntryList);
 	REGISTER_GLOBAL_MOCK_HOOK(DList_RemoveHeadList, real_DList_RemoveHeadList);
+
+	//lock and condition of the concurrent queue
+	REGISTER_GLOBAL_MOCK_RETURNS(Lock_Init, (LOCK_HANDLE)0x44, NULL);
+	REGISTER_GLOBAL_MOCK_RETURNS(Lock, LOCK_OK, LOCK_ERROR);
+	REGISTER_GLOBAL_MOCK_RETURNS(Unlock, LOCK_OK, LOCK_ERROR);
+	REGISTER_GLOBAL_MOCK_RETURNS(Condition_Init, (COND_HANDLE)0x45, NULL);
+	REGISTER_GLOBAL_MOCK_RETURNS(Condition_Wait, COND_TIMEOUT, COND_ERROR);
 }
 
 TEST_SUITE_CLEANUP(TestClassCleanup)
@@ -427,6 +440,83 @@ TEST_FUNCTION(MESSAGE_QUEUE_pop_success)
 	MESSAGE_QUEUE_destroy(mq);
 }
 
+static bool match_message(MESSAGE_HANDLE message, const void* match_context)
+{
+	return (message == (MESSAGE_HANDLE)match_context);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_001: [ MESSAGE_QUEUE_replace_if shall return NULL if handle, match_function or element are NULL. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_returns_null_with_null)
+{
+	///arrange
+	MESSAGE_HANDLE mh = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE r1 = MESSAGE_QUEUE_replace_if(NULL, match_message, mh, mh);
+	MESSAGE_HANDLE r2 = MESSAGE_QUEUE_replace_if(mq, NULL, mh, mh);
+	MESSAGE_HANDLE r3 = MESSAGE_QUEUE_replace_if(mq, match_message, mh, NULL);
+
+	///assert
+	ASSERT_IS_NULL(r1);
+	ASSERT_IS_NULL(r2);
+	ASSERT_IS_NULL(r3);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_002: [ MESSAGE_QUEUE_replace_if shall call match_function with match_context on the queued messages, oldest first, until it returns true. ]*/
+/*Tests_SRS_MESSAGE_QUEUE_30_003: [ MESSAGE_QUEUE_replace_if shall put element in the place of the matching message and return the matching message. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_replaces_in_place)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_HANDLE mh3 = (MESSAGE_HANDLE)(0x44);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	MESSAGE_QUEUE_push(mq, mh1);
+	MESSAGE_QUEUE_push(mq, mh2);
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE replaced = MESSAGE_QUEUE_replace_if(mq, match_message, mh1, mh3);
+
+	///assert
+	ASSERT_IS_TRUE((replaced == mh1));
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == mh3));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == mh2));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_004: [ MESSAGE_QUEUE_replace_if shall return NULL and leave the queue unchanged if no message matches. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_returns_null_when_nothing_matches)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	MESSAGE_QUEUE_push(mq, mh1);
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE replaced = MESSAGE_QUEUE_replace_if(mq, match_message, mh2, mh2);
+
+	///assert
+	ASSERT_IS_NULL(replaced);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == mh1));
+	ASSERT_IS_TRUE(MESSAGE_QUEUE_is_empty(mq));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
 /*Tests_SRS_MESSAGE_QUEUE_17_016: [ MESSAGE_QUEUE_is_empty shall return true if handle is NULL. ]*/
 TEST_FUNCTION(MESSAGE_QUEUE_is_empty_returns_true_with_null)
 {
@@ -566,6 +656,258 @@ TEST_FUNCTION(MESSAGE_QUEUE_front_returns_null_empty_queue)
 	MESSAGE_QUEUE_destroy(mq);
 }
 
+/*Tests_SRS_MESSAGE_QUEUE_30_006: [ MESSAGE_QUEUE_create_concurrent shall allocate a ring of capacity messages, rounded up to a power of 2. ]*/
+/*Tests_SRS_MESSAGE_QUEUE_30_007: [ MESSAGE_QUEUE_create_concurrent shall create the lock and the condition the consumer waits on in MESSAGE_QUEUE_pop_wait. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_create_concurrent_success)
+{
+	///arrange
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(DList_InitializeListHead(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
+
+	///act
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(5);
+
+	///assert
+	ASSERT_IS_NOT_NULL(mq);
+	ASSERT_IS_TRUE(MESSAGE_QUEUE_is_empty(mq));
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_005: [ MESSAGE_QUEUE_create_concurrent shall return NULL if capacity is 0 or larger than 2^30. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_create_concurrent_fails_with_zero_capacity)
+{
+	///arrange
+	///act
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(0);
+
+	///assert
+	ASSERT_IS_NULL(mq);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_008: [ On a failure, MESSAGE_QUEUE_create_concurrent shall free any allocated resources and return NULL. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_create_concurrent_fails_when_Condition_Init_fails)
+{
+	///arrange
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(DList_InitializeListHead(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init())
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+
+	///act
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(8);
+
+	///assert
+	ASSERT_IS_NULL(mq);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_010: [ MESSAGE_QUEUE_push shall store the message in the ring of a concurrent queue without allocating memory. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_push_concurrent_does_not_allocate)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(2);
+	umock_c_reset_all_calls();
+
+	///act
+	int mp1 = MESSAGE_QUEUE_push(mq, mh1);
+	int mp2 = MESSAGE_QUEUE_push(mq, mh2);
+
+	///assert
+	ASSERT_ARE_EQUAL(int, 0, mp1);
+	ASSERT_ARE_EQUAL(int, 0, mp2);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_IS_FALSE(MESSAGE_QUEUE_is_empty(mq));
+	ASSERT_IS_TRUE(mh1 == MESSAGE_QUEUE_front(mq));
+	ASSERT_IS_TRUE(mh1 == MESSAGE_QUEUE_pop(mq));
+	ASSERT_IS_TRUE(mh2 == MESSAGE_QUEUE_pop(mq));
+	ASSERT_IS_NULL(MESSAGE_QUEUE_pop(mq));
+	ASSERT_IS_TRUE(MESSAGE_QUEUE_is_empty(mq));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_011: [ If the ring is full, MESSAGE_QUEUE_push shall append the message to a list protected by a lock, and keep doing so until the consumer has emptied the list. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_push_concurrent_spills_when_the_ring_is_full)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_HANDLE mh3 = (MESSAGE_HANDLE)(0x44);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(1);
+	(void)MESSAGE_QUEUE_push(mq, mh1);
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(DList_InitializeListHead(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(DList_AppendTailList(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+
+	///act
+	int mp2 = MESSAGE_QUEUE_push(mq, mh2);
+
+	///assert
+	ASSERT_ARE_EQUAL(int, 0, mp2);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// the ring has room again, but mh3 must stay behind mh2
+	ASSERT_IS_TRUE(mh1 == MESSAGE_QUEUE_pop(mq));
+	ASSERT_ARE_EQUAL(int, 0, MESSAGE_QUEUE_push(mq, mh3));
+	ASSERT_IS_TRUE(mh2 == MESSAGE_QUEUE_pop(mq));
+	ASSERT_IS_TRUE(mh3 == MESSAGE_QUEUE_pop(mq));
+	ASSERT_IS_TRUE(MESSAGE_QUEUE_is_empty(mq));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_009: [ MESSAGE_QUEUE_replace_if shall return NULL on a concurrent queue, whose producers never wait for one another. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_returns_null_on_a_concurrent_queue)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(4);
+	(void)MESSAGE_QUEUE_push(mq, mh1);
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE replaced = MESSAGE_QUEUE_replace_if(mq, match_message, mh1, mh2);
+
+	///assert
+	ASSERT_IS_NULL(replaced);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_IS_TRUE(mh1 == MESSAGE_QUEUE_pop(mq));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_014: [ MESSAGE_QUEUE_pop_many shall return 0 if handle or messages are NULL. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_pop_many_returns_zero_with_null)
+{
+	///arrange
+	MESSAGE_HANDLE messages[2];
+	MESSAGE_QUEUE_HANDLE handle = (MESSAGE_QUEUE_HANDLE)(0x42);
+
+	///act
+	size_t popped1 = MESSAGE_QUEUE_pop_many(NULL, messages, 2);
+	size_t popped2 = MESSAGE_QUEUE_pop_many(handle, NULL, 2);
+
+	///assert
+	ASSERT_ARE_EQUAL(size_t, 0, popped1);
+	ASSERT_ARE_EQUAL(size_t, 0, popped2);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_015: [ MESSAGE_QUEUE_pop_many shall pop up to max_count messages into messages, oldest first, and return how many it popped. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_pop_many_pops_oldest_first)
+{
+	///arrange
+	MESSAGE_HANDLE messages[4];
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(4);
+	(void)MESSAGE_QUEUE_push(mq, (MESSAGE_HANDLE)0x42);
+	(void)MESSAGE_QUEUE_push(mq, (MESSAGE_HANDLE)0x43);
+	(void)MESSAGE_QUEUE_push(mq, (MESSAGE_HANDLE)0x44);
+	umock_c_reset_all_calls();
+
+	///act
+	size_t popped1 = MESSAGE_QUEUE_pop_many(mq, messages, 2);
+	size_t popped2 = MESSAGE_QUEUE_pop_many(mq, messages + 2, 2);
+
+	///assert
+	ASSERT_ARE_EQUAL(size_t, 2, popped1);
+	ASSERT_ARE_EQUAL(size_t, 1, popped2);
+	ASSERT_IS_TRUE(messages[0] == (MESSAGE_HANDLE)0x42);
+	ASSERT_IS_TRUE(messages[1] == (MESSAGE_HANDLE)0x43);
+	ASSERT_IS_TRUE(messages[2] == (MESSAGE_HANDLE)0x44);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_018: [ MESSAGE_QUEUE_pop_wait shall return the oldest message without waiting if there is one. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_pop_wait_does_not_wait_for_a_queued_message)
+{
+	///arrange
+	MESSAGE_HANDLE mh = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(4);
+	(void)MESSAGE_QUEUE_push(mq, mh);
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE mh1 = MESSAGE_QUEUE_pop_wait(mq, 100);
+
+	///assert
+	ASSERT_IS_TRUE(mh == mh1);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_019: [ Otherwise MESSAGE_QUEUE_pop_wait shall wait up to timeout_ms milliseconds for a message to be pushed, then return the oldest message or NULL. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_pop_wait_waits_on_an_empty_queue)
+{
+	///arrange
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create_concurrent(4);
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 100))
+		.IgnoreArgument(1)
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+
+	///act
+	MESSAGE_HANDLE mh = MESSAGE_QUEUE_pop_wait(mq, 100);
+
+	///assert
+	ASSERT_IS_NULL(mh);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
 ///arrange
 ///act
 ///assert
@@ -0,0 +1,978 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define GATEWAY_EXPORT_H
+#define GATEWAY_EXPORT
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/gballoc.h"
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pair.h>
+
+#include "message.h"
+#include "control_message.h"
+#include "multiplexed_frame.h"
+#include "module_loaders/outprocess_link.h"
+
+/*the link runs an I/O thread and a delivery thread per module, so nanomsg,
+the messages and the allocations are stood in for by plain functions guarded
+by one lock rather than by umock mocks, which are not thread safe. A fake
+socket signals its receive descriptor, a real eventfd, while it holds frames
+for the I/O thread*/
+
+#define TEST_CONTROL_URI        "ipc://link_ut_control"
+#define TEST_MESSAGE_URI        "ipc://link_ut_message"
+#define TEST_OTHER_URI          "ipc://link_ut_other"
+#define TEST_WAIT_MS            5000
+#define UNPARSABLE              0xFF
+
+static pthread_mutex_t g_fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_fake_cond = PTHREAD_COND_INITIALIZER;
+
+void* gballoc_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void* gballoc_calloc(size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
+
+void* gballoc_realloc(void* ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void gballoc_free(void* ptr)
+{
+    free(ptr);
+}
+
+/* nanomsg
+*/
+
+#define FAKE_SOCKET_COUNT       8
+
+typedef struct FAKE_FRAME_TAG
+{
+    struct FAKE_FRAME_TAG* next;
+    void* buffer;
+} FAKE_FRAME;
+
+typedef struct FAKE_SOCKET_TAG
+{
+    int open;
+    char uri[64];
+    int receive_fd;
+    FAKE_FRAME* received;
+    FAKE_FRAME* sent;
+    size_t sent_count;
+} FAKE_SOCKET;
+
+static FAKE_SOCKET g_sockets[FAKE_SOCKET_COUNT];
+static int g_refuse_sends;
+static int g_fail_connect;
+static __thread int g_nn_errno;
+
+/*a fake nanomsg buffer keeps its size in front of it*/
+void* nn_allocmsg(size_t size, int type)
+{
+    size_t* result = (size_t*)malloc(sizeof(size_t) + size);
+    (void)type;
+    if (result != NULL)
+    {
+        *result = size;
+        result++;
+    }
+    return result;
+}
+
+int nn_freemsg(void* msg)
+{
+    free((size_t*)msg - 1);
+    return 0;
+}
+
+static size_t fake_msg_size(const void* msg)
+{
+    return *((const size_t*)msg - 1);
+}
+
+static void free_fake_frames(FAKE_FRAME* frame)
+{
+    while (frame != NULL)
+    {
+        FAKE_FRAME* next = frame->next;
+        (void)nn_freemsg(frame->buffer);
+        free(frame);
+        frame = next;
+    }
+}
+
+static void append_fake_frame(FAKE_FRAME** list, void* buffer)
+{
+    FAKE_FRAME* frame = (FAKE_FRAME*)malloc(sizeof(FAKE_FRAME));
+    ASSERT_IS_NOT_NULL(frame);
+    frame->next = NULL;
+    frame->buffer = buffer;
+    while (*list != NULL)
+    {
+        list = &(*list)->next;
+    }
+    *list = frame;
+}
+
+int nn_errno(void)
+{
+    return g_nn_errno;
+}
+
+int nn_socket(int domain, int protocol)
+{
+    int result = -1;
+    int i;
+    (void)domain;
+    (void)protocol;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    for (i = 0; (result < 0) && (i < FAKE_SOCKET_COUNT); i++)
+    {
+        if (!g_sockets[i].open)
+        {
+            memset(&g_sockets[i], 0, sizeof(FAKE_SOCKET));
+            g_sockets[i].open = 1;
+            g_sockets[i].receive_fd = eventfd(0, EFD_NONBLOCK);
+            result = i;
+        }
+    }
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    if (result < 0)
+    {
+        g_nn_errno = EMFILE;
+    }
+    return result;
+}
+
+int nn_connect(int s, const char* addr)
+{
+    int result;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    if (g_fail_connect)
+    {
+        g_nn_errno = ECONNREFUSED;
+        result = -1;
+    }
+    else
+    {
+        (void)strncpy(g_sockets[s].uri, addr, sizeof(g_sockets[s].uri) - 1);
+        result = 1;
+    }
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    return result;
+}
+
+int nn_getsockopt(int s, int level, int option, void* optval, size_t* optvallen)
+{
+    (void)level;
+    (void)option;
+    (void)optvallen;
+    *(int*)optval = g_sockets[s].receive_fd;
+    return 0;
+}
+
+int nn_close(int s)
+{
+    (void)pthread_mutex_lock(&g_fake_lock);
+    /*closing the descriptor takes it out of the epoll set*/
+    (void)close(g_sockets[s].receive_fd);
+    free_fake_frames(g_sockets[s].received);
+    free_fake_frames(g_sockets[s].sent);
+    memset(&g_sockets[s], 0, sizeof(FAKE_SOCKET));
+    (void)pthread_cond_broadcast(&g_fake_cond);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    return 0;
+}
+
+int nn_send(int s, const void* buf, size_t len, int flags)
+{
+    int result;
+    (void)len;
+    (void)flags;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    if (g_refuse_sends)
+    {
+        g_nn_errno = EAGAIN;
+        result = -1;
+    }
+    else
+    {
+        void* buffer = *(void* const*)buf;
+        append_fake_frame(&g_sockets[s].sent, buffer);
+        g_sockets[s].sent_count++;
+        result = (int)fake_msg_size(buffer);
+        (void)pthread_cond_broadcast(&g_fake_cond);
+    }
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    return result;
+}
+
+int nn_recv(int s, void* buf, size_t len, int flags)
+{
+    int result;
+    (void)len;
+    (void)flags;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    if (g_sockets[s].received == NULL)
+    {
+        uint64_t count;
+        (void)read(g_sockets[s].receive_fd, &count, sizeof(count));
+        g_nn_errno = EAGAIN;
+        result = -1;
+    }
+    else
+    {
+        FAKE_FRAME* frame = g_sockets[s].received;
+        g_sockets[s].received = frame->next;
+        *(void**)buf = frame->buffer;
+        result = (int)fake_msg_size(frame->buffer);
+        free(frame);
+    }
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    return result;
+}
+
+/* messages, a fake message is its bytes and a fake control message its type
+*/
+
+typedef struct FAKE_MESSAGE_TAG
+{
+    int32_t size;
+    unsigned char bytes[16];
+} FAKE_MESSAGE;
+
+static size_t g_messages_created;
+static size_t g_messages_destroyed;
+static size_t g_controls_alive;
+
+MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t size)
+{
+    FAKE_MESSAGE* result;
+    if ((size < 1) || (size > (int32_t)sizeof(result->bytes)) || (source[0] == UNPARSABLE))
+    {
+        result = NULL;
+    }
+    else if ((result = (FAKE_MESSAGE*)malloc(sizeof(FAKE_MESSAGE))) != NULL)
+    {
+        result->size = size;
+        memcpy(result->bytes, source, (size_t)size);
+        (void)pthread_mutex_lock(&g_fake_lock);
+        g_messages_created++;
+        (void)pthread_cond_broadcast(&g_fake_cond);
+        (void)pthread_mutex_unlock(&g_fake_lock);
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+void Message_Destroy(MESSAGE_HANDLE message)
+{
+    (void)pthread_mutex_lock(&g_fake_lock);
+    g_messages_destroyed++;
+    (void)pthread_cond_broadcast(&g_fake_cond);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    free(message);
+}
+
+int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char* buf, int32_t size)
+{
+    const FAKE_MESSAGE* message = (const FAKE_MESSAGE*)messageHandle;
+    if ((buf != NULL) && (size >= message->size))
+    {
+        memcpy(buf, message->bytes, (size_t)message->size);
+    }
+    return message->size;
+}
+
+CONTROL_MESSAGE* ControlMessage_CreateFromByteArray(const unsigned char* source, size_t size)
+{
+    CONTROL_MESSAGE* result;
+    if (size < 1)
+    {
+        result = NULL;
+    }
+    else if ((result = (CONTROL_MESSAGE*)malloc(sizeof(CONTROL_MESSAGE))) != NULL)
+    {
+        result->version = CONTROL_MESSAGE_VERSION_CURRENT;
+        result->type = (CONTROL_MESSAGE_TYPE)source[0];
+        (void)pthread_mutex_lock(&g_fake_lock);
+        g_controls_alive++;
+        (void)pthread_mutex_unlock(&g_fake_lock);
+    }
+    return result;
+}
+
+void ControlMessage_Destroy(CONTROL_MESSAGE* message)
+{
+    (void)pthread_mutex_lock(&g_fake_lock);
+    g_controls_alive--;
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    free(message);
+}
+
+int32_t ControlMessage_ToByteArray(CONTROL_MESSAGE* message, unsigned char* buf, int32_t size)
+{
+    if ((buf != NULL) && (size >= 1))
+    {
+        buf[0] = (unsigned char)message->type;
+    }
+    return 1;
+}
+
+/* the modules
+*/
+
+#define RECEIVED_MAX    (OUTPROCESS_LINK_INBOUND_CAPACITY + 16)
+
+typedef struct TEST_MODULE_TAG
+{
+    OUTPROCESS_LINK_ENDPOINT_HANDLE endpoint;
+    size_t message_count;
+    unsigned char received[RECEIVED_MAX];
+    size_t control_count;
+    CONTROL_MESSAGE_TYPE control_type;
+    pthread_t message_thread;
+    pthread_t control_thread;
+    /*on_message waits while it is set*/
+    int block;
+    int blocked;
+} TEST_MODULE;
+
+static void on_test_message(void* context, MESSAGE_HANDLE message)
+{
+    TEST_MODULE* module = (TEST_MODULE*)context;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    if (module->message_count < RECEIVED_MAX)
+    {
+        module->received[module->message_count] = ((FAKE_MESSAGE*)message)->bytes[0];
+    }
+    module->message_count++;
+    module->message_thread = pthread_self();
+    module->blocked = module->block;
+    (void)pthread_cond_broadcast(&g_fake_cond);
+    while (module->block)
+    {
+        (void)pthread_cond_wait(&g_fake_cond, &g_fake_lock);
+    }
+    module->blocked = 0;
+    (void)pthread_mutex_unlock(&g_fake_lock);
+}
+
+static void on_test_control(void* context, CONTROL_MESSAGE* message)
+{
+    TEST_MODULE* module = (TEST_MODULE*)context;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    module->control_count++;
+    module->control_type = message->type;
+    module->control_thread = pthread_self();
+    (void)pthread_cond_broadcast(&g_fake_cond);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+}
+
+static void attach(TEST_MODULE* module)
+{
+    memset(module, 0, sizeof(TEST_MODULE));
+    module->endpoint = OutprocessLink_Attach(TEST_CONTROL_URI, TEST_MESSAGE_URI, on_test_message, on_test_control, module);
+    ASSERT_IS_NOT_NULL(module->endpoint);
+}
+
+static void set_block(TEST_MODULE* module, int block)
+{
+    (void)pthread_mutex_lock(&g_fake_lock);
+    module->block = block;
+    (void)pthread_cond_broadcast(&g_fake_cond);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+}
+
+/*returns the fake socket connected to uri, -1 if there is none*/
+static int find_socket(const char* uri)
+{
+    int result = -1;
+    int i;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    for (i = 0; i < FAKE_SOCKET_COUNT; i++)
+    {
+        if (g_sockets[i].open && (strcmp(g_sockets[i].uri, uri) == 0))
+        {
+            result = i;
+        }
+    }
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    return result;
+}
+
+static int count_open_sockets(void)
+{
+    int result = 0;
+    int i;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    for (i = 0; i < FAKE_SOCKET_COUNT; i++)
+    {
+        result += g_sockets[i].open;
+    }
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    return result;
+}
+
+/*the module host sends a frame of size bytes, the first one being first_byte*/
+static void host_sends(int s, uint32_t module_id, unsigned char first_byte, size_t size)
+{
+    unsigned char* buffer = (unsigned char*)nn_allocmsg(MULTIPLEXED_FRAME_HEADER_SIZE + size, 0);
+    uint64_t one = 1;
+    ASSERT_IS_NOT_NULL(buffer);
+    MultiplexedFrame_SetModuleId(buffer, module_id);
+    memset(buffer + MULTIPLEXED_FRAME_HEADER_SIZE, first_byte, size);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    append_fake_frame(&g_sockets[s].received, buffer);
+    ASSERT_ARE_EQUAL(int, (int)sizeof(one), (int)write(g_sockets[s].receive_fd, &one, sizeof(one)));
+    (void)pthread_mutex_unlock(&g_fake_lock);
+}
+
+/*waits, with g_fake_lock held, until *value reaches expected*/
+static void wait_for_count(const size_t* value, size_t expected)
+{
+    struct timespec deadline;
+    int timed_out = 0;
+    (void)clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TEST_WAIT_MS / 1000;
+    while ((*value < expected) && !timed_out)
+    {
+        timed_out = (pthread_cond_timedwait(&g_fake_cond, &g_fake_lock, &deadline) == ETIMEDOUT);
+    }
+    ASSERT_IS_TRUE(*value >= expected);
+}
+
+static void wait_for(const size_t* value, size_t expected)
+{
+    (void)pthread_mutex_lock(&g_fake_lock);
+    wait_for_count(value, expected);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+}
+
+static void wait_until_blocked(TEST_MODULE* module)
+{
+    struct timespec deadline;
+    (void)clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TEST_WAIT_MS / 1000;
+    (void)pthread_mutex_lock(&g_fake_lock);
+    while (!module->blocked && (pthread_cond_timedwait(&g_fake_cond, &g_fake_lock, &deadline) != ETIMEDOUT))
+    {
+    }
+    ASSERT_IS_TRUE(module->blocked);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+}
+
+/*the module id the link gave a module, read from a frame it sent*/
+static uint32_t module_id_of(TEST_MODULE* module)
+{
+    CONTROL_MESSAGE message = { CONTROL_MESSAGE_VERSION_CURRENT, CONTROL_MESSAGE_TYPE_MODULE_START };
+    int s = find_socket(TEST_CONTROL_URI);
+    FAKE_FRAME* frame;
+    size_t sent;
+    uint32_t result;
+    ASSERT_ARE_NOT_EQUAL(int, -1, s);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    sent = g_sockets[s].sent_count;
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(int, 0, OutprocessLink_SendControl(module->endpoint, &message));
+    (void)pthread_mutex_lock(&g_fake_lock);
+    wait_for_count(&g_sockets[s].sent_count, sent + 1);
+    frame = g_sockets[s].sent;
+    while (frame->next != NULL)
+    {
+        frame = frame->next;
+    }
+    result = MultiplexedFrame_GetModuleId((const unsigned char*)frame->buffer);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    return result;
+}
+
+static int unblock_later(void* context)
+{
+    ThreadAPI_Sleep(50);
+    set_block((TEST_MODULE*)context, 0);
+    return 0;
+}
+
+static TEST_MUTEX_HANDLE g_testByTest;
+static TEST_MUTEX_HANDLE g_dllByDll;
+
+BEGIN_TEST_SUITE(outprocess_link_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    TEST_INITIALIZE_MEMORY_DEBUG(g_dllByDll);
+    g_testByTest = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(g_testByTest);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    TEST_MUTEX_DESTROY(g_testByTest);
+    TEST_DEINITIALIZE_MEMORY_DEBUG(g_dllByDll);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(g_testByTest))
+    {
+        ASSERT_FAIL("our mutex is ABANDONED. Failure in test framework");
+    }
+
+    g_refuse_sends = 0;
+    g_fail_connect = 0;
+    g_messages_created = 0;
+    g_messages_destroyed = 0;
+    g_controls_alive = 0;
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    /*every test detaches its modules, which closes the links*/
+    ASSERT_ARE_EQUAL(int, 0, count_open_sockets());
+    TEST_MUTEX_RELEASE(g_testByTest);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_001: [ If control_uri, message_uri, on_message or on_control is NULL, OutprocessLink_Attach shall fail and return NULL. ]*/
+TEST_FUNCTION(OutprocessLink_Attach_with_a_NULL_argument_fails)
+{
+    ///arrange
+    TEST_MODULE module;
+    memset(&module, 0, sizeof(module));
+
+    ///act
+    ///assert
+    ASSERT_IS_NULL(OutprocessLink_Attach(NULL, TEST_MESSAGE_URI, on_test_message, on_test_control, &module));
+    ASSERT_IS_NULL(OutprocessLink_Attach(TEST_CONTROL_URI, NULL, on_test_message, on_test_control, &module));
+    ASSERT_IS_NULL(OutprocessLink_Attach(TEST_CONTROL_URI, TEST_MESSAGE_URI, NULL, on_test_control, &module));
+    ASSERT_IS_NULL(OutprocessLink_Attach(TEST_CONTROL_URI, TEST_MESSAGE_URI, on_test_message, NULL, &module));
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_003: [ OutprocessLink_Attach shall start the I/O thread if no link is open. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_004: [ If no link has control_uri, OutprocessLink_Attach shall open one with a pair socket connected to control_uri and one connected to message_uri, both watched by the I/O thread. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_010: [ When the last module of a link detaches, OutprocessLink_Detach shall send the queued frames the module host takes without waiting, drop the others and close the sockets of the link. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_011: [ When the last link is closed, OutprocessLink_Detach shall stop the I/O thread. ]*/
+TEST_FUNCTION(OutprocessLink_Attach_opens_a_link_to_the_module_host)
+{
+    ///arrange
+    TEST_MODULE module;
+
+    ///act
+    attach(&module);
+
+    ///assert
+    ASSERT_ARE_EQUAL(int, 2, count_open_sockets());
+    ASSERT_ARE_NOT_EQUAL(int, -1, find_socket(TEST_CONTROL_URI));
+    ASSERT_ARE_NOT_EQUAL(int, -1, find_socket(TEST_MESSAGE_URI));
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+    ASSERT_ARE_EQUAL(int, 0, count_open_sockets());
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_006: [ OutprocessLink_Attach shall give the module an id that no other module of the link has and that is not 0, and return a non-NULL handle. ]*/
+TEST_FUNCTION(OutprocessLink_Attach_shares_the_link_of_the_same_control_uri)
+{
+    ///arrange
+    TEST_MODULE first;
+    TEST_MODULE second;
+    uint32_t first_id;
+    uint32_t second_id;
+    attach(&first);
+
+    ///act
+    attach(&second);
+
+    ///assert
+    ASSERT_ARE_EQUAL(int, 2, count_open_sockets());
+    first_id = module_id_of(&first);
+    second_id = module_id_of(&second);
+    ASSERT_ARE_NOT_EQUAL(int, 0, (int)first_id);
+    ASSERT_ARE_NOT_EQUAL(int, 0, (int)second_id);
+    ASSERT_ARE_NOT_EQUAL(int, (int)first_id, (int)second_id);
+
+    ///cleanup
+    OutprocessLink_Detach(first.endpoint);
+    ASSERT_ARE_EQUAL(int, 2, count_open_sockets());
+    OutprocessLink_Detach(second.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_005: [ If the link of control_uri has another message URI than message_uri, OutprocessLink_Attach shall fail and return NULL. ]*/
+TEST_FUNCTION(OutprocessLink_Attach_with_another_message_uri_fails)
+{
+    ///arrange
+    TEST_MODULE first;
+    TEST_MODULE second;
+    attach(&first);
+
+    ///act
+    ///assert
+    ASSERT_IS_NULL(OutprocessLink_Attach(TEST_CONTROL_URI, TEST_OTHER_URI, on_test_message, on_test_control, &second));
+
+    ///cleanup
+    OutprocessLink_Detach(first.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_007: [ If any step fails, OutprocessLink_Attach shall release what it created and return NULL. ]*/
+TEST_FUNCTION(OutprocessLink_Attach_fails_when_the_module_host_cannot_be_connected)
+{
+    ///arrange
+    TEST_MODULE module;
+    memset(&module, 0, sizeof(module));
+    g_fail_connect = 1;
+
+    ///act
+    ///assert
+    ASSERT_IS_NULL(OutprocessLink_Attach(TEST_CONTROL_URI, TEST_MESSAGE_URI, on_test_message, on_test_control, &module));
+    ASSERT_ARE_EQUAL(int, 0, count_open_sockets());
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_008: [ If endpoint is NULL, OutprocessLink_Detach shall do nothing. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_012: [ If endpoint or message is NULL, OutprocessLink_SendMessage shall fail and return a non-zero value. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_015: [ If endpoint or message is NULL, OutprocessLink_SendControl shall fail and return a non-zero value. ]*/
+TEST_FUNCTION(OutprocessLink_with_a_NULL_argument_fails)
+{
+    ///arrange
+    TEST_MODULE module;
+    FAKE_MESSAGE message = { 1, { 1 } };
+    CONTROL_MESSAGE control = { CONTROL_MESSAGE_VERSION_CURRENT, CONTROL_MESSAGE_TYPE_MODULE_START };
+    attach(&module);
+
+    ///act
+    ///assert
+    OutprocessLink_Detach(NULL);
+    ASSERT_ARE_NOT_EQUAL(int, 0, OutprocessLink_SendMessage(NULL, (MESSAGE_HANDLE)&message));
+    ASSERT_ARE_NOT_EQUAL(int, 0, OutprocessLink_SendMessage(module.endpoint, NULL));
+    ASSERT_ARE_NOT_EQUAL(int, 0, OutprocessLink_SendControl(NULL, &control));
+    ASSERT_ARE_NOT_EQUAL(int, 0, OutprocessLink_SendControl(module.endpoint, NULL));
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_013: [ OutprocessLink_SendMessage shall serialize message after the module id in a frame, queue the frame for the message socket of the link and return 0. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_018: [ The I/O thread shall send the queued frames of every socket in the order they were queued, and try again every LINK_SEND_RETRY_MS milliseconds the frames the module host did not take. ]*/
+TEST_FUNCTION(OutprocessLink_SendMessage_sends_a_frame_tagged_with_the_module_id)
+{
+    ///arrange
+    TEST_MODULE module;
+    FAKE_MESSAGE messages[3] = { { 2, { 10, 11 } }, { 2, { 20, 21 } }, { 2, { 30, 31 } } };
+    uint32_t module_id;
+    int s;
+    int i;
+    attach(&module);
+    module_id = module_id_of(&module);
+    s = find_socket(TEST_MESSAGE_URI);
+
+    ///act
+    for (i = 0; i < 3; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, OutprocessLink_SendMessage(module.endpoint, (MESSAGE_HANDLE)&messages[i]));
+    }
+
+    ///assert
+    wait_for(&g_sockets[s].sent_count, 3);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    {
+        FAKE_FRAME* frame = g_sockets[s].sent;
+        for (i = 0; i < 3; i++)
+        {
+            const unsigned char* bytes = (const unsigned char*)frame->buffer;
+            ASSERT_ARE_EQUAL(int, MULTIPLEXED_FRAME_HEADER_SIZE + 2, (int)fake_msg_size(bytes));
+            ASSERT_ARE_EQUAL(int, (int)module_id, (int)MultiplexedFrame_GetModuleId(bytes));
+            ASSERT_ARE_EQUAL(int, (int)messages[i].bytes[0], (int)bytes[MULTIPLEXED_FRAME_HEADER_SIZE]);
+            ASSERT_ARE_EQUAL(int, (int)messages[i].bytes[1], (int)bytes[MULTIPLEXED_FRAME_HEADER_SIZE + 1]);
+            frame = frame->next;
+        }
+    }
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_014: [ If the message cannot be serialized or the frame cannot be allocated or queued, OutprocessLink_SendMessage shall fail and return a non-zero value. ]*/
+TEST_FUNCTION(OutprocessLink_SendMessage_fails_when_the_message_cannot_be_serialized)
+{
+    ///arrange
+    TEST_MODULE module;
+    FAKE_MESSAGE message = { -1, { 0 } };
+    attach(&module);
+
+    ///act
+    ///assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, OutprocessLink_SendMessage(module.endpoint, (MESSAGE_HANDLE)&message));
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_016: [ OutprocessLink_SendControl shall serialize message after the module id in a frame, queue the frame for the control socket of the link and return 0. ]*/
+TEST_FUNCTION(OutprocessLink_SendControl_sends_a_frame_on_the_control_socket)
+{
+    ///arrange
+    TEST_MODULE module;
+    CONTROL_MESSAGE message = { CONTROL_MESSAGE_VERSION_CURRENT, CONTROL_MESSAGE_TYPE_MODULE_DESTROY };
+    int s;
+    int message_socket;
+    attach(&module);
+    s = find_socket(TEST_CONTROL_URI);
+    message_socket = find_socket(TEST_MESSAGE_URI);
+
+    ///act
+    ASSERT_ARE_EQUAL(int, 0, OutprocessLink_SendControl(module.endpoint, &message));
+
+    ///assert
+    wait_for(&g_sockets[s].sent_count, 1);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(int, MULTIPLEXED_FRAME_HEADER_SIZE + 1, (int)fake_msg_size(g_sockets[s].sent->buffer));
+    ASSERT_ARE_EQUAL(int, (int)CONTROL_MESSAGE_TYPE_MODULE_DESTROY, (int)((unsigned char*)g_sockets[s].sent->buffer)[MULTIPLEXED_FRAME_HEADER_SIZE]);
+    ASSERT_ARE_EQUAL(size_t, 0, g_sockets[message_socket].sent_count);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_018: [ The I/O thread shall send the queued frames of every socket in the order they were queued, and try again every LINK_SEND_RETRY_MS milliseconds the frames the module host did not take. ]*/
+TEST_FUNCTION(OutprocessLink_sends_again_a_frame_the_module_host_did_not_take)
+{
+    ///arrange
+    TEST_MODULE module;
+    FAKE_MESSAGE message = { 1, { 40 } };
+    int s;
+    attach(&module);
+    s = find_socket(TEST_MESSAGE_URI);
+    g_refuse_sends = 1;
+    ASSERT_ARE_EQUAL(int, 0, OutprocessLink_SendMessage(module.endpoint, (MESSAGE_HANDLE)&message));
+    ThreadAPI_Sleep(50);
+
+    ///act
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(size_t, 0, g_sockets[s].sent_count);
+    g_refuse_sends = 0;
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///assert
+    wait_for(&g_sockets[s].sent_count, 1);
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_020: [ The I/O thread shall call on_control of the module with a control message received for it and destroy the message once on_control returns. ]*/
+TEST_FUNCTION(OutprocessLink_calls_on_control_with_a_control_message_for_the_module)
+{
+    ///arrange
+    TEST_MODULE module;
+    attach(&module);
+
+    ///act
+    host_sends(find_socket(TEST_CONTROL_URI), module_id_of(&module), (unsigned char)CONTROL_MESSAGE_TYPE_MODULE_REPLY, 1);
+
+    ///assert
+    wait_for(&module.control_count, 1);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(int, (int)CONTROL_MESSAGE_TYPE_MODULE_REPLY, (int)module.control_type);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+    ASSERT_ARE_EQUAL(size_t, 0, g_controls_alive);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_002: [ OutprocessLink_Attach shall start the delivery thread of the module. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_021: [ The I/O thread shall queue a gateway message received for a module for the delivery thread of the module. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_023: [ The delivery thread shall call on_message with the gateway messages of the module in the order they were received and destroy each message once on_message returns. ]*/
+TEST_FUNCTION(OutprocessLink_delivers_the_messages_of_a_module_in_order_on_its_own_thread)
+{
+    ///arrange
+    TEST_MODULE module;
+    uint32_t module_id;
+    int s;
+    attach(&module);
+    module_id = module_id_of(&module);
+    s = find_socket(TEST_MESSAGE_URI);
+
+    ///act
+    host_sends(s, module_id, 1, 3);
+    host_sends(s, module_id, 2, 3);
+    host_sends(s, module_id, 3, 3);
+    host_sends(find_socket(TEST_CONTROL_URI), module_id, (unsigned char)CONTROL_MESSAGE_TYPE_MODULE_REPLY, 1);
+
+    ///assert
+    wait_for(&module.message_count, 3);
+    wait_for(&module.control_count, 1);
+    wait_for(&g_messages_destroyed, 3);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(int, 1, (int)module.received[0]);
+    ASSERT_ARE_EQUAL(int, 2, (int)module.received[1]);
+    ASSERT_ARE_EQUAL(int, 3, (int)module.received[2]);
+    ASSERT_IS_FALSE(pthread_equal(module.message_thread, module.control_thread));
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_019: [ The I/O thread shall drop a received frame shorter than a module id, a frame for a module that is not attached and a frame whose message cannot be parsed. ]*/
+TEST_FUNCTION(OutprocessLink_drops_the_frames_it_cannot_deliver)
+{
+    ///arrange
+    TEST_MODULE module;
+    uint32_t module_id;
+    int s;
+    unsigned char* short_frame;
+    attach(&module);
+    module_id = module_id_of(&module);
+    s = find_socket(TEST_MESSAGE_URI);
+    short_frame = (unsigned char*)nn_allocmsg(MULTIPLEXED_FRAME_HEADER_SIZE - 1, 0);
+    ASSERT_IS_NOT_NULL(short_frame);
+    memset(short_frame, 0, MULTIPLEXED_FRAME_HEADER_SIZE - 1);
+
+    ///act
+    (void)pthread_mutex_lock(&g_fake_lock);
+    append_fake_frame(&g_sockets[s].received, short_frame);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    host_sends(s, module_id + 100, 1, 1);
+    host_sends(s, module_id, UNPARSABLE, 1);
+    host_sends(s, module_id, 2, 1);
+
+    ///assert
+    wait_for(&module.message_count, 1);
+    ThreadAPI_Sleep(20);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(size_t, 1, module.message_count);
+    ASSERT_ARE_EQUAL(int, 2, (int)module.received[0]);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_021: [ The I/O thread shall queue a gateway message received for a module for the delivery thread of the module. ]*/
+TEST_FUNCTION(OutprocessLink_a_module_that_is_slow_to_take_its_messages_only_holds_up_itself)
+{
+    ///arrange
+    TEST_MODULE slow;
+    TEST_MODULE other;
+    uint32_t slow_id;
+    uint32_t other_id;
+    int s;
+    attach(&slow);
+    attach(&other);
+    slow_id = module_id_of(&slow);
+    other_id = module_id_of(&other);
+    s = find_socket(TEST_MESSAGE_URI);
+    set_block(&slow, 1);
+    host_sends(s, slow_id, 1, 1);
+    wait_until_blocked(&slow);
+
+    ///act
+    host_sends(s, slow_id, 2, 1);
+    host_sends(s, other_id, 3, 1);
+    host_sends(find_socket(TEST_CONTROL_URI), slow_id, (unsigned char)CONTROL_MESSAGE_TYPE_MODULE_REPLY, 1);
+
+    ///assert
+    wait_for(&other.message_count, 1);
+    wait_for(&slow.control_count, 1);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(size_t, 1, slow.message_count);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+    OutprocessLink_Detach(other.endpoint);
+    set_block(&slow, 0);
+    wait_for(&slow.message_count, 2);
+
+    ///cleanup
+    OutprocessLink_Detach(slow.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_022: [ If OUTPROCESS_LINK_INBOUND_CAPACITY gateway messages wait for the module, the I/O thread shall destroy the message and count it as dropped. ]*/
+/*Tests_SRS_OUTPROCESS_LINK_30_024: [ The delivery thread shall log how many messages were dropped since it took the previous one. ]*/
+TEST_FUNCTION(OutprocessLink_drops_the_messages_received_while_the_queue_of_the_module_is_full)
+{
+    ///arrange
+    TEST_MODULE module;
+    uint32_t module_id;
+    int s;
+    size_t i;
+    attach(&module);
+    module_id = module_id_of(&module);
+    s = find_socket(TEST_MESSAGE_URI);
+    set_block(&module, 1);
+    host_sends(s, module_id, 1, 1);
+    wait_until_blocked(&module);
+
+    ///act
+    for (i = 0; i < OUTPROCESS_LINK_INBOUND_CAPACITY + 5; i++)
+    {
+        host_sends(s, module_id, 2, 1);
+    }
+
+    ///assert
+    wait_for(&g_messages_destroyed, 5);
+    set_block(&module, 0);
+    wait_for(&module.message_count, OUTPROCESS_LINK_INBOUND_CAPACITY + 1);
+    wait_for(&g_messages_destroyed, OUTPROCESS_LINK_INBOUND_CAPACITY + 6);
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(size_t, OUTPROCESS_LINK_INBOUND_CAPACITY + 1, module.message_count);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///cleanup
+    OutprocessLink_Detach(module.endpoint);
+}
+
+/*Tests_SRS_OUTPROCESS_LINK_30_009: [ OutprocessLink_Detach shall remove the module from its link, stop its delivery thread and destroy the gateway messages still waiting for it; no callback of the module shall run once it returns. ]*/
+TEST_FUNCTION(OutprocessLink_Detach_drops_the_messages_waiting_for_the_module)
+{
+    ///arrange
+    TEST_MODULE module;
+    THREAD_HANDLE unblocker;
+    uint32_t module_id;
+    int thread_result;
+    int s;
+    attach(&module);
+    module_id = module_id_of(&module);
+    s = find_socket(TEST_MESSAGE_URI);
+    set_block(&module, 1);
+    host_sends(s, module_id, 1, 1);
+    wait_until_blocked(&module);
+    host_sends(s, module_id, 2, 1);
+    host_sends(s, module_id, 3, 1);
+    wait_for(&g_messages_created, 3);
+    ASSERT_ARE_EQUAL(int, (int)THREADAPI_OK, (int)ThreadAPI_Create(&unblocker, unblock_later, &module));
+
+    ///act
+    OutprocessLink_Detach(module.endpoint);
+
+    ///assert
+    (void)pthread_mutex_lock(&g_fake_lock);
+    ASSERT_ARE_EQUAL(size_t, 1, module.message_count);
+    ASSERT_ARE_EQUAL(size_t, 3, g_messages_destroyed);
+    (void)pthread_mutex_unlock(&g_fake_lock);
+
+    ///cleanup
+    (void)ThreadAPI_Join(unblocker, &thread_result);
+}
+
+END_TEST_SUITE(outprocess_link_ut)
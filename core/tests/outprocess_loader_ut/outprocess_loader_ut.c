@@ -75,6 +75,7 @@ MOCKABLE_FUNCTION(, char*, json_serialize_to_string, const JSON_Value*, value);
 MOCKABLE_FUNCTION(, JSON_Value*, json_object_get_value, const JSON_Object*, object, const char*, name);
 MOCKABLE_FUNCTION(, const char*, json_object_get_string, const JSON_Object*, object, const char*, name);
 MOCKABLE_FUNCTION(, double, json_object_get_number, const JSON_Object*, object, const char*, name);
+MOCKABLE_FUNCTION(, int, json_object_get_boolean, const JSON_Object*, object, const char*, name);
 MOCKABLE_FUNCTION(, JSON_Object*, json_value_get_object, const JSON_Value *, value);
 MOCKABLE_FUNCTION(, JSON_Value_Type, json_value_get_type, const JSON_Value*, value);
 
@@ -131,6 +132,9 @@ MOCK_FUNCTION_END(str)
 MOCK_FUNCTION_WITH_CODE(, double, json_object_get_number, const JSON_Object*, object, const char*, name)
 MOCK_FUNCTION_END(0);
 
+MOCK_FUNCTION_WITH_CODE(, int, json_object_get_boolean, const JSON_Object*, object, const char*, name)
+MOCK_FUNCTION_END(-1);
+
 MOCK_FUNCTION_WITH_CODE(, JSON_Value*, json_object_get_value, const JSON_Object*, object, const char*, name)
     JSON_Value* value = NULL;
     if (object != NULL && name != NULL)
@@ -673,6 +677,52 @@ TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_succeeds)
 		.SetReturn(2000);
 	STRICT_EXPECTED_CALL(URL_EncodeString(control_id));
 	STRICT_EXPECTED_CALL(URL_EncodeString(NULL));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.type"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(json_object_get_boolean((JSON_Object*)0x43, "multiplexed"))
+		.SetReturn(-1);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.size"));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.linger"));
+
+	// act
+	void* result = OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
+
+	// assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(int, OUTPROCESS_MESSAGE_CHANNEL_IPC, ((OUTPROCESS_LOADER_ENTRYPOINT*)result)->message_channel);
+	ASSERT_IS_FALSE(((OUTPROCESS_LOADER_ENTRYPOINT*)result)->multiplexed);
+	OutprocessModuleLoader_FreeEntrypoint(NULL, result);
+}
+
+/*Tests_SRS_OUTPROCESS_LOADER_30_001: [ This function shall assign the entrypoint message_channel to OUTPROCESS_MESSAGE_CHANNEL_SHM if "message.type" in json is "shm", and to OUTPROCESS_MESSAGE_CHANNEL_IPC otherwise. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_succeeds_with_shm_message_type)
+{
+	// arrange
+	char * activation_type = "none";
+	char * control_id = "a url";
+
+	STRICT_EXPECTED_CALL(json_value_get_type((JSON_Value*)0x42))
+		.SetReturn(JSONObject);
+	STRICT_EXPECTED_CALL(json_value_get_object((JSON_Value*)0x42))
+		.SetReturn((JSON_Object*)0x43);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "activation.type"))
+		.SetReturn(activation_type);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "control.id"))
+		.SetReturn(control_id);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.id"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "timeout"))
+		.SetReturn(2000);
+	STRICT_EXPECTED_CALL(URL_EncodeString(control_id));
+	STRICT_EXPECTED_CALL(URL_EncodeString(NULL));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.type"))
+		.SetReturn("shm");
+	STRICT_EXPECTED_CALL(json_object_get_boolean((JSON_Object*)0x43, "multiplexed"))
+		.SetReturn(-1);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.size"));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.linger"));
 
 	// act
 	void* result = OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
@@ -680,6 +730,132 @@ TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_succeeds)
 	// assert
 	ASSERT_IS_NOT_NULL(result);
 	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(int, OUTPROCESS_MESSAGE_CHANNEL_SHM, ((OUTPROCESS_LOADER_ENTRYPOINT*)result)->message_channel);
+	OutprocessModuleLoader_FreeEntrypoint(NULL, result);
+}
+
+/*Tests_SRS_OUTPROCESS_LOADER_30_003: [ This function shall set the entrypoint multiplexed to true if "multiplexed" in json is true, and to false otherwise. ]*/
+/*Tests_SRS_OUTPROCESS_LOADER_30_004: [ If the entrypoint is multiplexed, the message_channel shall be OUTPROCESS_MESSAGE_CHANNEL_IPC. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_succeeds_multiplexed)
+{
+	// arrange
+	char * activation_type = "none";
+	char * control_id = "a url";
+
+	STRICT_EXPECTED_CALL(json_value_get_type((JSON_Value*)0x42))
+		.SetReturn(JSONObject);
+	STRICT_EXPECTED_CALL(json_value_get_object((JSON_Value*)0x42))
+		.SetReturn((JSON_Object*)0x43);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "activation.type"))
+		.SetReturn(activation_type);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "control.id"))
+		.SetReturn(control_id);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.id"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "timeout"))
+		.SetReturn(2000);
+	STRICT_EXPECTED_CALL(URL_EncodeString(control_id));
+	STRICT_EXPECTED_CALL(URL_EncodeString(NULL));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.type"))
+		.SetReturn("shm");
+	STRICT_EXPECTED_CALL(json_object_get_boolean((JSON_Object*)0x43, "multiplexed"))
+		.SetReturn(1);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.size"));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.linger"));
+
+	// act
+	void* result = OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
+
+	// assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_IS_TRUE(((OUTPROCESS_LOADER_ENTRYPOINT*)result)->multiplexed);
+	ASSERT_ARE_EQUAL(int, OUTPROCESS_MESSAGE_CHANNEL_IPC, ((OUTPROCESS_LOADER_ENTRYPOINT*)result)->message_channel);
+	OutprocessModuleLoader_FreeEntrypoint(NULL, result);
+}
+
+/*Tests_SRS_OUTPROCESS_LOADER_30_007: [ This function shall set the entrypoint max_batch_size to "message.batch.size" in json and max_batch_linger to "message.batch.linger" in json, or to 0 if they are not present. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_succeeds_with_message_batch)
+{
+	// arrange
+	char * activation_type = "none";
+	char * control_id = "a url";
+
+	STRICT_EXPECTED_CALL(json_value_get_type((JSON_Value*)0x42))
+		.SetReturn(JSONObject);
+	STRICT_EXPECTED_CALL(json_value_get_object((JSON_Value*)0x42))
+		.SetReturn((JSON_Object*)0x43);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "activation.type"))
+		.SetReturn(activation_type);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "control.id"))
+		.SetReturn(control_id);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.id"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "timeout"))
+		.SetReturn(2000);
+	STRICT_EXPECTED_CALL(URL_EncodeString(control_id));
+	STRICT_EXPECTED_CALL(URL_EncodeString(NULL));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.type"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(json_object_get_boolean((JSON_Object*)0x43, "multiplexed"))
+		.SetReturn(-1);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.size"))
+		.SetReturn(32);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.linger"))
+		.SetReturn(250);
+
+	// act
+	void* result = OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
+
+	// assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(int, 32, (int)((OUTPROCESS_LOADER_ENTRYPOINT*)result)->max_batch_size);
+	ASSERT_ARE_EQUAL(int, 250, (int)((OUTPROCESS_LOADER_ENTRYPOINT*)result)->max_batch_linger);
+	OutprocessModuleLoader_FreeEntrypoint(NULL, result);
+}
+
+/*Tests_SRS_OUTPROCESS_LOADER_30_008: [ If the entrypoint is multiplexed or its message_channel is not OUTPROCESS_MESSAGE_CHANNEL_IPC, max_batch_size and max_batch_linger shall be 0. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_ignores_message_batch_on_shm)
+{
+	// arrange
+	char * activation_type = "none";
+	char * control_id = "a url";
+
+	STRICT_EXPECTED_CALL(json_value_get_type((JSON_Value*)0x42))
+		.SetReturn(JSONObject);
+	STRICT_EXPECTED_CALL(json_value_get_object((JSON_Value*)0x42))
+		.SetReturn((JSON_Object*)0x43);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "activation.type"))
+		.SetReturn(activation_type);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "control.id"))
+		.SetReturn(control_id);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.id"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "timeout"))
+		.SetReturn(2000);
+	STRICT_EXPECTED_CALL(URL_EncodeString(control_id));
+	STRICT_EXPECTED_CALL(URL_EncodeString(NULL));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.type"))
+		.SetReturn("shm");
+	STRICT_EXPECTED_CALL(json_object_get_boolean((JSON_Object*)0x43, "multiplexed"))
+		.SetReturn(-1);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.size"))
+		.SetReturn(32);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.linger"))
+		.SetReturn(250);
+
+	// act
+	void* result = OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
+
+	// assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(int, 0, (int)((OUTPROCESS_LOADER_ENTRYPOINT*)result)->max_batch_size);
+	ASSERT_ARE_EQUAL(int, 0, (int)((OUTPROCESS_LOADER_ENTRYPOINT*)result)->max_batch_linger);
 	OutprocessModuleLoader_FreeEntrypoint(NULL, result);
 }
 
@@ -714,6 +890,12 @@ TEST_FUNCTION(OutprocessModuleLoader_FreeEntrypoint_frees_resources)
 	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
 	STRICT_EXPECTED_CALL(URL_EncodeString(control_id));
 	STRICT_EXPECTED_CALL(URL_EncodeString(message_id));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.type"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(json_object_get_boolean((JSON_Object*)0x43, "multiplexed"))
+		.SetReturn(-1);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.size"));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "message.batch.linger"));
 
 	void* entrypoint = OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
     ASSERT_IS_NOT_NULL(entrypoint);
@@ -779,6 +961,7 @@ TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_returns_null_on_nu
 	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 }
 
+/*Tests_SRS_OUTPROCESS_LOADER_30_009: [ This function shall copy the entrypoint max_batch_size and max_batch_linger to the module configuration. ]*/
 /*Tests_SRS_OUTPROCESS_LOADER_17_033: [ This function shall allocate and copy each string in OUTPROCESS_LOADER_ENTRYPOINT and assign them to the corresponding fields in OUTPROCESS_MODULE_CONFIG. ]*/
 /*Tests_SRS_OUTPROCESS_LOADER_17_034: [ This function shall allocate and copy the module_configuration string and assign it the OUTPROCESS_MODULE_CONFIG::outprocess_module_args field. ]*/
 /*Tests_SRS_OUTPROCESS_LOADER_17_035: [ Upon success, this function shall return a valid pointer to an OUTPROCESS_MODULE_CONFIG structure. ]*/
@@ -790,7 +973,12 @@ TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_with_msg_u
 	{
 		OUTPROCESS_LOADER_ACTIVATION_NONE,
 		STRING_construct("control_id"),
-		STRING_construct("message_id")
+		STRING_construct("message_id"),
+		1000,
+		OUTPROCESS_MESSAGE_CHANNEL_IPC,
+		false,
+		8,
+		100
 	};
 	STRING_HANDLE mc = STRING_construct("message config");
 
@@ -811,6 +999,47 @@ TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_with_msg_u
 	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->control_uri), "ipc://control_id.ipc");
 	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->message_uri), "ipc://message_id.ipc");
 	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->outprocess_module_args), STRING_c_str(mc));
+	ASSERT_ARE_EQUAL(int, 8, (int)omc->max_batch_size);
+	ASSERT_ARE_EQUAL(int, 100, (int)omc->max_batch_linger);
+
+	//cleanup
+	OutprocessModuleLoader_FreeModuleConfiguration(NULL, result);
+	STRING_delete(ep.control_id);
+	STRING_delete(ep.message_id);
+	STRING_delete(mc);
+}
+
+/*Tests_SRS_OUTPROCESS_LOADER_30_002: [ If the entrypoint's message_channel is OUTPROCESS_MESSAGE_CHANNEL_SHM, the message uri shall be composed of "shm://" + the message_id, or "shm://" + a unique id if message_id is NULL. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_with_shm_msg_url)
+{
+	//arrange
+	OUTPROCESS_LOADER_ENTRYPOINT ep =
+	{
+		OUTPROCESS_LOADER_ACTIVATION_NONE,
+		STRING_construct("control_id"),
+		STRING_construct("message_id"),
+		1000,
+		OUTPROCESS_MESSAGE_CHANNEL_SHM
+	};
+	STRING_HANDLE mc = STRING_construct("message config");
+
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_MODULE_CONFIG)));
+	STRICT_EXPECTED_CALL(STRING_c_str(ep.message_id));
+	STRICT_EXPECTED_CALL(STRING_c_str(ep.control_id));
+	STRICT_EXPECTED_CALL(STRING_clone(mc));
+
+	//act
+	void * result = OutprocessModuleLoader_BuildModuleConfiguration(NULL, &ep, mc);
+	OUTPROCESS_MODULE_CONFIG *omc = (OUTPROCESS_MODULE_CONFIG*)result;
+
+	//assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->control_uri), "ipc://control_id.ipc");
+	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->message_uri), "shm://message_id");
+	ASSERT_ARE_EQUAL(int, OUTPROCESS_MESSAGE_CHANNEL_SHM, omc->message_channel);
 
 	//cleanup
 	OutprocessModuleLoader_FreeModuleConfiguration(NULL, result);
@@ -819,6 +1048,46 @@ TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_with_msg_u
 	STRING_delete(mc);
 }
 
+/*Tests_SRS_OUTPROCESS_LOADER_30_005: [ If the entrypoint is multiplexed and its message_id is NULL, the message uri shall be composed of "ipc://" + the control_id + "_message.ipc", so every module of the link names the same message channel. ]*/
+/*Tests_SRS_OUTPROCESS_LOADER_30_006: [ This function shall copy the entrypoint multiplexed to the module configuration. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_multiplexed_with_no_msg_url)
+{
+	//arrange
+	OUTPROCESS_LOADER_ENTRYPOINT ep =
+	{
+		OUTPROCESS_LOADER_ACTIVATION_NONE,
+		STRING_construct("control_id"),
+		NULL,
+		1000,
+		OUTPROCESS_MESSAGE_CHANNEL_IPC,
+		true
+	};
+	STRING_HANDLE mc = STRING_construct("message config");
+
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_MODULE_CONFIG)));
+	STRICT_EXPECTED_CALL(STRING_c_str(ep.control_id));
+	STRICT_EXPECTED_CALL(STRING_c_str(ep.control_id));
+	STRICT_EXPECTED_CALL(STRING_clone(mc));
+
+	//act
+	void * result = OutprocessModuleLoader_BuildModuleConfiguration(NULL, &ep, mc);
+	OUTPROCESS_MODULE_CONFIG *omc = (OUTPROCESS_MODULE_CONFIG*)result;
+
+	//assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->message_uri), "ipc://control_id_message.ipc");
+	ASSERT_IS_TRUE(omc->multiplexed);
+	ASSERT_ARE_EQUAL(int, 0, (int)omc->max_batch_size);
+
+	//cleanup
+	OutprocessModuleLoader_FreeModuleConfiguration(NULL, result);
+	STRING_delete(ep.control_id);
+	STRING_delete(mc);
+}
+
 /*Tests_SRS_OUTPROCESS_LOADER_17_029: [ If the entrypoint's message_id is NULL, then the loader shall construct an IPC url. ]*/
 /*Tests_SRS_OUTPROCESS_LOADER_17_030: [ The loader shall create a unique id, if needed for URL constrution. ]*/
 /*Tests_SRS_OUTPROCESS_LOADER_17_032: [ The message url shall be composed of "ipc://" + unique id. ]*/
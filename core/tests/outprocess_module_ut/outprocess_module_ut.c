@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #define GATEWAY_EXPORT_H
 #define GATEWAY_EXPORT
@@ -56,12 +57,17 @@ void my_gballoc_free(void* ptr)
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/threadapi.h"
 #include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
 #include "broker.h"
 #include "module_loader.h"
 #include "message_queue.h"
+#include "shm_channel.h"
+#include "azure_c_shared_utility/tickcounter.h"
 
 #undef ENABLE_MOCKS
 #include "control_message.h"
+#include "batched_frame.h"
+#include "module_loaders/outprocess_link.h"
 
 #include "module_loaders/outprocess_module.h"
 
@@ -296,6 +302,8 @@ LOCK_RESULT my_Lock_Deinit(LOCK_HANDLE handle)
 
 CONTROL_MESSAGE_MODULE_CREATE global_control_msg;
 static int default_serialized_size;
+static uint8_t last_create_uri_type;
+static uint8_t last_create_gateway_message_version;
 
 MOCK_FUNCTION_WITH_CODE(, CONTROL_MESSAGE *, ControlMessage_CreateFromByteArray, const unsigned char*, source, size_t, size)
 MOCK_FUNCTION_END((CONTROL_MESSAGE*)&global_control_msg)
@@ -305,6 +313,11 @@ MOCK_FUNCTION_END()
 
 MOCK_FUNCTION_WITH_CODE(, int32_t, ControlMessage_ToByteArray, CONTROL_MESSAGE *, message, unsigned char*, buf, int32_t, size)
 	int32_t carray_size = default_serialized_size;
+	if (message != NULL && message->type == CONTROL_MESSAGE_TYPE_MODULE_CREATE)
+	{
+		last_create_uri_type = ((CONTROL_MESSAGE_MODULE_CREATE*)message)->uri.uri_type;
+		last_create_gateway_message_version = ((CONTROL_MESSAGE_MODULE_CREATE*)message)->gateway_message_version;
+	}
 MOCK_FUNCTION_END(carray_size)
 
 /*  Message mocks 
@@ -329,6 +342,13 @@ uint8_t *counter = (uint8_t*)m2;
 *counter = 1;
 MOCK_FUNCTION_END(m2)
 
+/*the message takes ownership of source, the last Message_Destroy frees it*/
+MOCK_FUNCTION_WITH_CODE(, MESSAGE_HANDLE, Message_CreateFromByteArrayNoCopy, unsigned char*, source, int32_t, size)
+MESSAGE_HANDLE m3 = (MESSAGE_HANDLE)source;
+uint8_t *counter = (uint8_t*)m3;
+*counter = 1;
+MOCK_FUNCTION_END(m3)
+
 MOCK_FUNCTION_WITH_CODE(, int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char*, buf, int32_t, size)
 int32_t array_size = default_serialized_size;
 MOCK_FUNCTION_END(array_size)
@@ -344,6 +364,33 @@ MOCK_FUNCTION_END()
 MOCK_FUNCTION_WITH_CODE(, BROKER_RESULT, Broker_Publish, BROKER_HANDLE, broker, MODULE_HANDLE, source, MESSAGE_HANDLE, message)
 MOCK_FUNCTION_END(BROKER_OK)
 
+/*limits Broker_GetModuleMailbox reports, unbounded unless a test sets them*/
+static BROKER_MAILBOX_OPTIONS test_mailbox_limits;
+
+MOCK_FUNCTION_WITH_CODE(, BROKER_RESULT, Broker_GetModuleMailbox, BROKER_HANDLE, broker, MODULE_HANDLE, module, BROKER_MAILBOX_OPTIONS*, options)
+*options = test_mailbox_limits;
+MOCK_FUNCTION_END(BROKER_OK)
+
+MOCK_FUNCTION_WITH_CODE(, const char*, Message_GetProperty, MESSAGE_HANDLE, message, const char*, key)
+MOCK_FUNCTION_END("device1")
+
+/*  Link mocks
+ */
+
+#define TEST_LINK_ENDPOINT ((OUTPROCESS_LINK_ENDPOINT_HANDLE)0x50)
+
+MOCK_FUNCTION_WITH_CODE(, OUTPROCESS_LINK_ENDPOINT_HANDLE, OutprocessLink_Attach, const char*, control_uri, const char*, message_uri, OUTPROCESS_LINK_ON_MESSAGE, on_message, OUTPROCESS_LINK_ON_CONTROL, on_control, void*, context)
+MOCK_FUNCTION_END(TEST_LINK_ENDPOINT)
+
+MOCK_FUNCTION_WITH_CODE(, void, OutprocessLink_Detach, OUTPROCESS_LINK_ENDPOINT_HANDLE, endpoint)
+MOCK_FUNCTION_END()
+
+MOCK_FUNCTION_WITH_CODE(, int, OutprocessLink_SendMessage, OUTPROCESS_LINK_ENDPOINT_HANDLE, endpoint, MESSAGE_HANDLE, message)
+MOCK_FUNCTION_END(0)
+
+MOCK_FUNCTION_WITH_CODE(, int, OutprocessLink_SendControl, OUTPROCESS_LINK_ENDPOINT_HANDLE, endpoint, CONTROL_MESSAGE*, message)
+MOCK_FUNCTION_END(0)
+
 BEGIN_TEST_SUITE(OutprocessModule_UnitTests)
 
 TEST_SUITE_INITIALIZE(TestClassInitialize)
@@ -362,8 +409,17 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
 	REGISTER_UMOCK_ALIAS_TYPE(BROKER_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_QUEUE_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_QUEUE_MATCH_FUNCTION, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(BROKER_MAILBOX_OPTIONS*, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(LOCK_RESULT, int);
+	REGISTER_UMOCK_ALIAS_TYPE(COND_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(COND_RESULT, int);
+	REGISTER_UMOCK_ALIAS_TYPE(SHM_CHANNEL_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(TICK_COUNTER_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(OUTPROCESS_LINK_ENDPOINT_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(OUTPROCESS_LINK_ON_MESSAGE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(OUTPROCESS_LINK_ON_CONTROL, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(THREAD_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(THREAD_START_FUNC, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(MODULE_API_VERSION, int);
@@ -391,6 +447,11 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
 	REGISTER_GLOBAL_MOCK_HOOK(Unlock, my_Unlock);
 	REGISTER_GLOBAL_MOCK_HOOK(Lock_Deinit, my_Lock_Deinit);
 
+	//Condition
+	REGISTER_GLOBAL_MOCK_RETURNS(Condition_Init, (COND_HANDLE)0x43, NULL);
+	REGISTER_GLOBAL_MOCK_RETURNS(Condition_Post, COND_OK, COND_ERROR);
+	REGISTER_GLOBAL_MOCK_RETURNS(Condition_Wait, COND_OK, COND_ERROR);
+
 	// message queue
 	REGISTER_GLOBAL_MOCK_RETURNS(MESSAGE_QUEUE_create, (MESSAGE_QUEUE_HANDLE)0x40, NULL);
 
@@ -422,6 +483,9 @@ TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
     malloc_will_fail = false;
     malloc_fail_count = 0;
     malloc_count = 0;
+	test_mailbox_limits.capacity = 0;
+	test_mailbox_limits.overflow = BROKER_OVERFLOW_BLOCK;
+	test_mailbox_limits.coalesce_key = NULL;
 	should_nn_send_fail = false;
 	should_nn_recv_fail = false;
 	current_nn_send_index = 0;
@@ -628,6 +692,79 @@ TEST_FUNCTION(Outprocess_Create_success)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
+
+	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
+
+	//create thread
+	STRICT_EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	call_thread_function_on_join[1] = 1;
+	STRICT_EXPECTED_CALL(ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+
+	//join on the create thread.
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	setup_create_create_message(&config);
+
+	STRICT_EXPECTED_CALL(nn_setsockopt(2, NN_SOL_SOCKET, NN_RCVTIMEO, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+		.IgnoreArgument(4).IgnoreArgument(5);
+	STRICT_EXPECTED_CALL(nn_send(2, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(nn_recv(2, IGNORED_PTR_ARG, NN_MSG, 0))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(ControlMessage_CreateFromByteArray(IGNORED_PTR_ARG, 8))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(ControlMessage_Destroy(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+
+	// act
+	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
+
+	// assert
+
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	Module_Destroy(result);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_021: [ The gateway_message_version of the Create Message shall be GATEWAY_MESSAGE_VERSION_BATCHED if the message channel is batched, and GATEWAY_MESSAGE_VERSION_CURRENT otherwise. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_026: [ This function shall batch the message channel if max_batch_size of the configuration is greater than 1 and the message channel is not a shared memory channel. ]*/
+TEST_FUNCTION(Outprocess_Create_with_batched_channel_success)
+{
+	// arrange
+	global_control_msg.base.type = CONTROL_MESSAGE_TYPE_MODULE_REPLY;
+	global_control_msg.base.version = CONTROL_MESSAGE_VERSION_CURRENT;
+	((CONTROL_MESSAGE_MODULE_REPLY*)&global_control_msg)->status = 0;
+
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	config.max_batch_size = 16;
+	config.max_batch_linger = 500;
+	last_create_gateway_message_version = 0;
+
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_create())
+		.SetReturn((MESSAGE_QUEUE_HANDLE)0x40);
+
+	setup_create_connections(&config);
+
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
@@ -665,6 +802,89 @@ TEST_FUNCTION(Outprocess_Create_success)
 
 	ASSERT_IS_NOT_NULL(result);
 	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(int, GATEWAY_MESSAGE_VERSION_BATCHED, (int)last_create_gateway_message_version);
+
+	// ablution
+	Module_Destroy(result);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_008: [ If the message_channel of the configuration is OUTPROCESS_MESSAGE_CHANNEL_SHM, this function shall create a shared memory channel named by the message_uri instead of the message channel pair socket. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_011: [ The uri_type of the Create Message shall be SHM_CHANNEL_URI_TYPE for a shared memory channel and NN_PAIR otherwise. ]*/
+TEST_FUNCTION(Outprocess_Create_with_shm_channel_success)
+{
+	// arrange
+	global_control_msg.base.type = CONTROL_MESSAGE_TYPE_MODULE_REPLY;
+	global_control_msg.base.version = CONTROL_MESSAGE_VERSION_CURRENT;
+	((CONTROL_MESSAGE_MODULE_REPLY*)&global_control_msg)->status = 0;
+
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	config.message_channel = OUTPROCESS_MESSAGE_CHANNEL_SHM;
+	const char * real_message_uri = real_STRING_c_str(config.message_uri);
+	const char * real_control_uri = real_STRING_c_str(config.control_uri);
+	last_create_uri_type = 0;
+
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_create())
+		.SetReturn((MESSAGE_QUEUE_HANDLE)0x40);
+
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(ShmChannel_Create(real_message_uri, SHM_CHANNEL_RING_SIZE_DEFAULT))
+		.SetReturn((SHM_CHANNEL_HANDLE)0x44);
+	// the control socket is the first nanomsg socket
+	STRICT_EXPECTED_CALL(nn_socket(AF_SP, NN_PAIR));
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(nn_connect(1, real_control_uri));
+
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
+
+	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
+
+	//create thread
+	STRICT_EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	call_thread_function_on_join[1] = 1;
+	STRICT_EXPECTED_CALL(ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+
+	//join on the create thread.
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	setup_create_create_message(&config);
+
+	STRICT_EXPECTED_CALL(nn_setsockopt(1, NN_SOL_SOCKET, NN_RCVTIMEO, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+		.IgnoreArgument(4).IgnoreArgument(5);
+	STRICT_EXPECTED_CALL(nn_send(1, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(nn_recv(1, IGNORED_PTR_ARG, NN_MSG, 0))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(ControlMessage_CreateFromByteArray(IGNORED_PTR_ARG, 8))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(ControlMessage_Destroy(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+
+	// act
+	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
+
+	// assert
+
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(int, SHM_CHANNEL_URI_TYPE, (int)last_create_uri_type);
 
 	// ablution
 	Module_Destroy(result);
@@ -694,6 +914,7 @@ TEST_FUNCTION(Outprocess_Create_success_on_2nd_recv)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
@@ -766,6 +987,7 @@ TEST_FUNCTION(Outprocess_Create_success_async)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -807,6 +1029,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_wrong_message_type_response)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -842,6 +1065,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_wrong_message_type_response)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -883,6 +1107,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_wrong_message_status_response)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -918,6 +1143,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_wrong_message_status_response)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -956,6 +1182,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_reponse_not_a_message)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -991,6 +1218,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_reponse_not_a_message)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1028,6 +1256,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_recv_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1062,6 +1291,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_recv_fails)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1100,6 +1330,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_thread_join_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1119,6 +1350,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_thread_join_fails)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1156,6 +1388,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_thread_create_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1172,6 +1405,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_thread_create_fails)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1209,6 +1443,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_send_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1239,6 +1474,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_send_fails)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1276,6 +1512,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_send_try_again)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1316,6 +1553,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_send_try_again)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1353,6 +1591,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_sockopt_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1379,6 +1618,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_sockopt_fails)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1416,6 +1656,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_allocmsg_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1453,6 +1694,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_nn_allocmsg_fails)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1489,6 +1731,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_Message_ToByteArray_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1523,6 +1766,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_Message_ToByteArray_fails)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1559,6 +1803,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_badargs_null)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1590,6 +1835,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_badargs_null)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1626,6 +1872,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_badargs_length)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1657,6 +1904,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_badargs_length)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1693,6 +1941,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_baduri_null)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1724,6 +1973,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_baduri_null)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1760,6 +2010,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_baduri_length)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
@@ -1791,6 +2042,51 @@ TEST_FUNCTION(Outprocess_Create_returns_null_baduri_length)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
+
+	// assert
+
+	ASSERT_IS_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_003: [ This function shall initialize a condition to signal the outgoing gateway message thread when a message is queued. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
+TEST_FUNCTION(Outprocess_Create_returns_null_condition_init_fail)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_create())
+		.SetReturn((MESSAGE_QUEUE_HANDLE)0x40);
+	setup_create_connections(&config);
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init())
+		.SetReturn(NULL);
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(nn_close(1));
+	STRICT_EXPECTED_CALL(nn_close(2));
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -1982,6 +2278,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_args_fail)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args))
@@ -1994,6 +2291,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_args_fail)
 	STRICT_EXPECTED_CALL(nn_close(2));
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -2002,7 +2300,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_args_fail)
 	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	umock_c_negative_tests_snapshot();
 
-	umock_c_negative_tests_fail_call(15);
+	umock_c_negative_tests_fail_call(16);
 
 	// act
 	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
@@ -2035,6 +2333,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_msg_uri_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
 	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri)).SetFailReturn(NULL);
 
@@ -2044,6 +2343,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_msg_uri_fails)
 	STRICT_EXPECTED_CALL(nn_close(2));
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -2052,7 +2352,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_msg_uri_fails)
 	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	umock_c_negative_tests_snapshot();
 
-	umock_c_negative_tests_fail_call(14);
+	umock_c_negative_tests_fail_call(15);
 
 	// act
 	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
@@ -2085,6 +2385,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_control_uri_fails)
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
 	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri)).SetFailReturn(NULL);
 
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -2092,6 +2393,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_control_uri_fails)
 	STRICT_EXPECTED_CALL(nn_close(2));
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -2100,7 +2402,7 @@ TEST_FUNCTION(Outprocess_Create_returns_null_clone_control_uri_fails)
 	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	umock_c_negative_tests_snapshot();
 
-	umock_c_negative_tests_fail_call(13);
+	umock_c_negative_tests_fail_call(14);
 
 	// act
 	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
@@ -2336,6 +2638,42 @@ TEST_FUNCTION(Outprocess_Create_returns_null_message_socket_fails)
 	cleanup_create_config(&config);
 }
 
+/*Tests_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
+TEST_FUNCTION(Outprocess_Create_returns_null_shm_channel_create_fails)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	config.message_channel = OUTPROCESS_MESSAGE_CHANNEL_SHM;
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_create())
+		.SetReturn((MESSAGE_QUEUE_HANDLE)0x40);
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(ShmChannel_Create(IGNORED_PTR_ARG, SHM_CHANNEL_RING_SIZE_DEFAULT))
+		.IgnoreArgument(1)
+		.SetReturn(NULL);
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_destroy((MESSAGE_QUEUE_HANDLE)0x40));
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
+
+	// assert
+
+	ASSERT_IS_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	cleanup_create_config(&config);
+}
+
 /*Tests_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
 TEST_FUNCTION(Outprocess_Create_returns_null_message_queue_fails)
 {
@@ -2412,34 +2750,193 @@ TEST_FUNCTION(Outprocess_Create_returns_null_malloc_fails)
 	cleanup_create_config(&config);
 }
 
-static void setup_start_or_destroy_message()
-{
-	STRICT_EXPECTED_CALL(ControlMessage_ToByteArray(IGNORED_PTR_ARG, NULL, 0))
-		.IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(nn_allocmsg(default_serialized_size, 0));
-	STRICT_EXPECTED_CALL(ControlMessage_ToByteArray(IGNORED_PTR_ARG, IGNORED_PTR_ARG, default_serialized_size))
-		.IgnoreArgument(1)
-		.IgnoreArgument(2);
-}
-
-/*Tests_SRS_OUTPROCESS_MODULE_17_020: [ This function shall do nothing if module is NULL. ]*/
-TEST_FUNCTION(Outprocess_Start_does_nothing_with_null)
+static MODULE_HANDLE create_multiplexed_module(OUTPROCESS_MODULE_CONFIG* config)
 {
-	///arrange
-	///act
-	Module_Start(NULL);
-	///assert
-	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-	///cleanup
+	setup_create_config(config);
+	config->lifecycle_model = OUTPROCESS_LIFECYCLE_ASYNC;
+	config->multiplexed = true;
+	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, config);
+	ASSERT_IS_NOT_NULL(result);
+	umock_c_reset_all_calls();
+	return result;
 }
 
-/*Tests_SRS_OUTPROCESS_MODULE_17_017: [ This function shall ensure thread safety on execution. ]*/
-/*Tests_SRS_OUTPROCESS_MODULE_17_018: [ This function shall create a thread to handle receiving messages from module host. ]*/
-/*Tests_SRS_OUTPROCESS_MODULE_17_043: [ This function shall create a thread to handle outgoing gateway messages to the module host. ]*/
-/*Tests_SRS_OUTPROCESS_MODULE_17_044: [ This function shall create a thread to handle receiving messages from module host. ]*/
-/*Tests_SRS_OUTPROCESS_MODULE_17_019: [ This function shall send a Start Message on the control channel. ]*/
-/*Tests_SRS_OUTPROCESS_MODULE_17_021: [ This function shall free any resources created. ]*/
-TEST_FUNCTION(Outprocess_Start_success)
+/*Tests_SRS_OUTPROCESS_MODULE_30_012: [ If the configuration is multiplexed, this function shall attach the module to the link of its control URI instead of creating sockets and threads of its own. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_013: [ This function shall send the Create Message on the link. ]*/
+TEST_FUNCTION(Outprocess_Create_multiplexed_success_async)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	config.lifecycle_model = OUTPROCESS_LIFECYCLE_ASYNC;
+	config.multiplexed = true;
+
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
+	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(OutprocessLink_Attach(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(STRING_length(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_length(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(OutprocessLink_SendControl(TEST_LINK_ENDPOINT, IGNORED_PTR_ARG))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
+
+	// assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	Module_Destroy(result);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
+TEST_FUNCTION(Outprocess_Create_multiplexed_returns_null_attach_fails)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	config.multiplexed = true;
+
+	STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock_Init());
+	STRICT_EXPECTED_CALL(Condition_Init());
+	STRICT_EXPECTED_CALL(STRING_clone(config.control_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.message_uri));
+	STRICT_EXPECTED_CALL(STRING_clone(config.outprocess_module_args));
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(OutprocessLink_Attach(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments()
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+
+	// act
+	MODULE_HANDLE result = Module_Create((BROKER_HANDLE)0x42, &config);
+
+	// assert
+	ASSERT_IS_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_019: [ For a multiplexed module, this function shall queue the message on the link, which serializes it before returning. ]*/
+TEST_FUNCTION(Outprocess_Receive_multiplexed_sends_on_link)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	MODULE_HANDLE module = create_multiplexed_module(&config);
+	MESSAGE_HANDLE message = (MESSAGE_HANDLE)0x51;
+
+	STRICT_EXPECTED_CALL(OutprocessLink_SendMessage(TEST_LINK_ENDPOINT, message));
+
+	// act
+	Module_Receive(module, message);
+
+	// assert
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_018: [ For a multiplexed module, this function shall send the Destroy Message on the link and detach the module from the link. ]*/
+TEST_FUNCTION(Outprocess_Destroy_multiplexed_detaches_from_link)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	MODULE_HANDLE module = create_multiplexed_module(&config);
+
+	STRICT_EXPECTED_CALL(OutprocessLink_SendControl(TEST_LINK_ENDPOINT, IGNORED_PTR_ARG))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(OutprocessLink_Detach(TEST_LINK_ENDPOINT));
+	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+
+	// act
+	Module_Destroy(module);
+
+	// assert
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	cleanup_create_config(&config);
+}
+
+static void setup_start_or_destroy_message()
+{
+	STRICT_EXPECTED_CALL(ControlMessage_ToByteArray(IGNORED_PTR_ARG, NULL, 0))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(nn_allocmsg(default_serialized_size, 0));
+	STRICT_EXPECTED_CALL(ControlMessage_ToByteArray(IGNORED_PTR_ARG, IGNORED_PTR_ARG, default_serialized_size))
+		.IgnoreArgument(1)
+		.IgnoreArgument(2);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_17_020: [ This function shall do nothing if module is NULL. ]*/
+TEST_FUNCTION(Outprocess_Start_does_nothing_with_null)
+{
+	///arrange
+	///act
+	Module_Start(NULL);
+	///assert
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	///cleanup
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_17_017: [ This function shall ensure thread safety on execution. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_17_018: [ This function shall create a thread to handle receiving messages from module host. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_17_043: [ This function shall create a thread to handle outgoing gateway messages to the module host. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_17_044: [ This function shall create a thread to handle receiving messages from module host. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_17_019: [ This function shall send a Start Message on the control channel. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_17_021: [ This function shall free any resources created. ]*/
+TEST_FUNCTION(Outprocess_Start_success)
 {
 	// arrange
 	OUTPROCESS_MODULE_CONFIG config;
@@ -2630,6 +3127,15 @@ static void teardown_a_thread(bool needs_join, bool lock_fail)
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 }
 
+static void stop_outgoing_thread(void)
+{
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Post(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+}
+
 /*Tests_SRS_OUTPROCESS_MODULE_17_027: [ This function shall ensure thread safety on execution. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_028: [ This function shall construct a Destroy Message. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_029: [ This function shall send the Destroy Message on the control channel. ]*/
@@ -2639,6 +3145,7 @@ static void teardown_a_thread(bool needs_join, bool lock_fail)
 /*Tests_SRS_OUTPROCESS_MODULE_17_033: [ This function shall wait for the messaging thread to complete. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_034: [ This function shall release all resources created by this module. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_049: [ This function shall signal the outgoing gateway message thread to close. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_005: [ This function shall signal the outgoing message condition so the outgoing gateway message thread stops waiting for messages. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_050: [ This function shall signal the control thread to close. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_051: [ This function shall wait for the outgoing gateway message thread to complete. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_052: [ This function shall wait for the control thread to complete. ]*/
@@ -2679,6 +3186,7 @@ TEST_FUNCTION(Outprocess_Destroy_success)
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	stop_outgoing_thread();
 	//teardown_a_thread(true, false);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -2686,6 +3194,8 @@ TEST_FUNCTION(Outprocess_Destroy_success)
 		.IgnoreArgument(1)
 		.IgnoreArgument(2);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	//teardown_a_thread(true, false);
@@ -2701,6 +3211,7 @@ TEST_FUNCTION(Outprocess_Destroy_success)
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
@@ -2756,12 +3267,14 @@ TEST_FUNCTION(Outprocess_Destroy_send_lock_join_fails)
 	thread_join_result[2] = THREADAPI_ERROR;
 	thread_join_result[3] = THREADAPI_ERROR;
 	teardown_a_thread(true, true);
+	stop_outgoing_thread();
 	teardown_a_thread(true, true);
 	teardown_a_thread(true, true);
 	teardown_a_thread(true, true); //async won't be closed.
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
@@ -2801,12 +3314,14 @@ TEST_FUNCTION(Outprocess_Destroy_destroy_message_alloc_fails)
 	STRICT_EXPECTED_CALL(nn_close(2));
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	teardown_a_thread(true, false);
+	stop_outgoing_thread();
 	teardown_a_thread(true, false);
 	teardown_a_thread(true, false);
 	teardown_a_thread(false, false);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
@@ -2843,12 +3358,14 @@ TEST_FUNCTION(Outprocess_Destroy_destroy_message_to_array_fails)
 	STRICT_EXPECTED_CALL(nn_close(2));
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	teardown_a_thread(true, false);
+	stop_outgoing_thread();
 	teardown_a_thread(true, false);
 	teardown_a_thread(true, false);
 	teardown_a_thread(false, false);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock_Deinit(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
@@ -2876,6 +3393,8 @@ TEST_FUNCTION(Outprocess_Receive_does_nothing_with_nothing)
 /*Tests_SRS_OUTPROCESS_MODULE_17_045: [ This function shall ensure thread safety for the module data. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_047: [ This function shall push the message onto the end of the outgoing gateway message queue. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_046: [ This function shall clone the message to ensure the message is kept allocated until forwarded to module host. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_004: [ This function shall signal the outgoing message condition once the message is queued. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_027: [ The first time it is called, this function shall read the limits of the mailbox of the module by calling Broker_GetModuleMailbox and apply them to the outgoing gateway message queue. ]*/
 TEST_FUNCTION(Outprocess_Receive_success)
 {
 	// arrange
@@ -2889,11 +3408,218 @@ TEST_FUNCTION(Outprocess_Receive_success)
 
 	STRICT_EXPECTED_CALL(Message_Clone(msg));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Broker_GetModuleMailbox((BROKER_HANDLE)0x42, module, IGNORED_PTR_ARG)).IgnoreArgument(3);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_push(IGNORED_PTR_ARG, msg)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Post(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_Clone(msg));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_push(IGNORED_PTR_ARG, msg)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Post(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	Module_Receive(module, msg);
+	Module_Receive(module, msg);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Message_Destroy(msg);
+	Message_Destroy(msg);
+	Message_Destroy(msg);
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_033: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_DROP_NEWEST, this function shall destroy the message and count it as dropped. ]*/
+TEST_FUNCTION(Outprocess_Receive_drops_the_newest_message_when_full)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	test_mailbox_limits.capacity = 1;
+	test_mailbox_limits.overflow = BROKER_OVERFLOW_DROP_NEWEST;
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	Module_Receive(module, msg);
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Message_Clone(msg));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_Destroy(msg));
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	Module_Receive(module, msg);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Message_Destroy(msg);
+	Message_Destroy(msg);
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_029: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_DROP_OLDEST, this function shall remove and destroy the oldest message of the queue and count it as dropped. ]*/
+TEST_FUNCTION(Outprocess_Receive_drops_the_oldest_message_when_full)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	test_mailbox_limits.capacity = 1;
+	test_mailbox_limits.overflow = BROKER_OVERFLOW_DROP_OLDEST;
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE older = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	MESSAGE_HANDLE newer = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	Module_Receive(module, older);
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Message_Clone(newer));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(older);
+	STRICT_EXPECTED_CALL(Message_Destroy(older));
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_push(IGNORED_PTR_ARG, newer)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Post(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	Module_Receive(module, newer);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Message_Destroy(older);
+	Message_Destroy(newer);
+	Message_Destroy(newer);
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_030: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_COALESCE, this function shall replace the oldest queued message that has the same value for the coalesce key property by calling MESSAGE_QUEUE_replace_if and destroy the replaced message, or destroy the message and count it as dropped if none matches. ]*/
+TEST_FUNCTION(Outprocess_Receive_coalesces_when_full)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	test_mailbox_limits.capacity = 1;
+	test_mailbox_limits.overflow = BROKER_OVERFLOW_COALESCE;
+	test_mailbox_limits.coalesce_key = "deviceName";
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE older = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	MESSAGE_HANDLE newer = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	Module_Receive(module, older);
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Message_Clone(newer));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_GetProperty(newer, "deviceName"));
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_replace_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, newer))
+		.IgnoreArgument(1)
+		.IgnoreArgument(2)
+		.IgnoreArgument(3)
+		.SetReturn(older);
+	STRICT_EXPECTED_CALL(Message_Destroy(older));
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	Module_Receive(module, newer);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Message_Destroy(older);
+	Message_Destroy(newer);
+	Message_Destroy(newer);
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_030: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_COALESCE, this function shall replace the oldest queued message that has the same value for the coalesce key property by calling MESSAGE_QUEUE_replace_if and destroy the replaced message, or destroy the message and count it as dropped if none matches. ]*/
+TEST_FUNCTION(Outprocess_Receive_drops_when_nothing_coalesces)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	test_mailbox_limits.capacity = 1;
+	test_mailbox_limits.overflow = BROKER_OVERFLOW_COALESCE;
+	test_mailbox_limits.coalesce_key = "deviceName";
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	Module_Receive(module, msg);
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Message_Clone(msg));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_GetProperty(msg, "deviceName"));
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_replace_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, msg))
+		.IgnoreArgument(1)
+		.IgnoreArgument(2)
+		.IgnoreArgument(3)
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(Message_Destroy(msg));
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	Module_Receive(module, msg);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Message_Destroy(msg);
+	Message_Destroy(msg);
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_028: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_BLOCK, this function shall wait up to OUTGOING_BLOCK_TIMEOUT_MS milliseconds for room, then destroy the message and count it as dropped. ]*/
+TEST_FUNCTION(Outprocess_Receive_waits_for_room_then_drops)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	test_mailbox_limits.capacity = 1;
+	test_mailbox_limits.overflow = BROKER_OVERFLOW_BLOCK;
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Message_Clone(msg));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Broker_GetModuleMailbox((BROKER_HANDLE)0x42, module, IGNORED_PTR_ARG)).IgnoreArgument(3);
+	STRICT_EXPECTED_CALL(Condition_Init());
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_push(IGNORED_PTR_ARG, msg)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Post(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_Clone(msg));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1000))
+		.IgnoreArgument(1)
+		.IgnoreArgument(2)
+		.SetReturn(COND_TIMEOUT);
+	STRICT_EXPECTED_CALL(Message_Destroy(msg));
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
 	// act
 	Module_Receive(module, msg);
+	Module_Receive(module, msg);
 
 	// assert 
 	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
@@ -2919,6 +3645,7 @@ TEST_FUNCTION(Outprocess_Receive_push_queue_fails)
 
 	STRICT_EXPECTED_CALL(Message_Clone(msg));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Broker_GetModuleMailbox((BROKER_HANDLE)0x42, module, IGNORED_PTR_ARG)).IgnoreArgument(3);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_push(IGNORED_PTR_ARG, msg)).IgnoreArgument(1).SetReturn(2620);
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -3029,8 +3756,8 @@ TEST_FUNCTION(Outprocess_outgoing_thread_success)
 	umock_c_reset_all_calls();
 
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(false);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
@@ -3042,7 +3769,6 @@ TEST_FUNCTION(Outprocess_outgoing_thread_success)
 		.IgnoreArgument(2);
 	STRICT_EXPECTED_CALL(nn_send(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
-	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(LOCK_ERROR);
 
@@ -3058,6 +3784,34 @@ TEST_FUNCTION(Outprocess_outgoing_thread_success)
 	cleanup_create_config(&config);
 }
 
+/*Tests_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
+TEST_FUNCTION(Outprocess_outgoing_thread_1st_lock_fails)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(LOCK_ERROR);
+
+	// act
+	//third thread created is outgoing message thread
+	thread_func_to_call[3](thread_func_args[3]);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Message_Destroy(msg);
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
 /*Tests_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
 TEST_FUNCTION(Outprocess_outgoing_thread_nn_send_1st_unlock_fails)
 {
@@ -3071,8 +3825,8 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_send_1st_unlock_fails)
 	umock_c_reset_all_calls();
 
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(false);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
@@ -3088,10 +3842,11 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_send_1st_unlock_fails)
 	STRICT_EXPECTED_CALL(nn_send(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
 	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
-	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(LOCK_ERROR);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
 	// act
 	//third thread created is outgoing message thread
@@ -3118,8 +3873,8 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_alloc_2nd_lock_fails)
 	umock_c_reset_all_calls();
 
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(false);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
@@ -3130,11 +3885,10 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_alloc_2nd_lock_fails)
 	malloc_fail_count = malloc_count + 1;
 	STRICT_EXPECTED_CALL(nn_allocmsg(default_serialized_size, 0));
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
-	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(LOCK_ERROR);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
 	// act
 	//third thread created is outgoing message thread
@@ -3149,7 +3903,7 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_alloc_2nd_lock_fails)
 }
 
 /*Tests_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
-TEST_FUNCTION(Outprocess_outgoing_thread_serialize_2nd_unlock_fails)
+TEST_FUNCTION(Outprocess_outgoing_thread_unlock_fails_still_sends)
 {
 	// arrange
 	OUTPROCESS_MODULE_CONFIG config;
@@ -3160,9 +3914,50 @@ TEST_FUNCTION(Outprocess_outgoing_thread_serialize_2nd_unlock_fails)
 	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
 	umock_c_reset_all_calls();
 
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(false);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(msg);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(LOCK_ERROR);
+	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, NULL, 0));
+	STRICT_EXPECTED_CALL(nn_allocmsg(default_serialized_size, 0));
+	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, IGNORED_PTR_ARG, default_serialized_size))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(nn_send(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(Message_Destroy(msg));
+
+	// act
+	//third thread created is outgoing message thread
+	thread_func_to_call[3](thread_func_args[3]);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_002: [ When the outgoing gateway message queue is empty, this thread shall wait on the outgoing message condition until a message is queued or the thread is signaled to close. ]*/
+TEST_FUNCTION(Outprocess_outgoing_thread_serialize_fails_then_wait_fails)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(false);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
@@ -3170,14 +3965,48 @@ TEST_FUNCTION(Outprocess_outgoing_thread_serialize_2nd_unlock_fails)
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, NULL, 0)).SetReturn(-1);
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
-	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(true);
+	STRICT_EXPECTED_CALL(Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0)).IgnoreArgument(1).IgnoreArgument(2)
+		.SetReturn(COND_ERROR);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+
+	// act
+	//third thread created is outgoing message thread
+	thread_func_to_call[3](thread_func_args[3]);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_002: [ When the outgoing gateway message queue is empty, this thread shall wait on the outgoing message condition until a message is queued or the thread is signaled to close. ]*/
+TEST_FUNCTION(Outprocess_outgoing_thread_waits_until_signaled_to_stop)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(true);
-	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1)
+	STRICT_EXPECTED_CALL(Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0)).IgnoreArgument(1).IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(LOCK_ERROR);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 
 	// act
 	//third thread created is outgoing message thread
@@ -3187,6 +4016,7 @@ TEST_FUNCTION(Outprocess_outgoing_thread_serialize_2nd_unlock_fails)
 	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
 	//ablution
+	Message_Destroy(msg);
 	Module_Destroy(module);
 	cleanup_create_config(&config);
 }
@@ -3204,8 +4034,8 @@ TEST_FUNCTION(Outprocess_outgoing_thread_queue_has_null_msg_fails)
 	umock_c_reset_all_calls();
 
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(false);
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
@@ -3367,7 +4197,6 @@ TEST_FUNCTION(Outprocess_incoming_thread_ends_nn_recv_fails)
 	should_nn_recv_fail = true;
 	STRICT_EXPECTED_CALL(nn_recv(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
 	STRICT_EXPECTED_CALL(nn_errno()).SetReturn(37);
-	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
 
 	int function_result = (*thread_func_to_call[2])(thread_func_args[2]);
 
@@ -3385,6 +4214,7 @@ TEST_FUNCTION(Outprocess_incoming_thread_ends_nn_recv_fails)
 /*Tests_SRS_OUTPROCESS_MODULE_17_038: [ This function shall read from the message channel for gateway messages from the module host. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_039: [ Upon successful receiving a gateway message, this function shall deserialize the message. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_040: [This function shall publish any successfully created gateway message to the broker.]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_001: [ After a message is received, this function shall keep receiving without blocking until no more messages are available on the message channel. ]*/
 TEST_FUNCTION(Outprocess_messaging_thread_ends_one_loop_then_fails)
 {
 	OUTPROCESS_MODULE_CONFIG config;
@@ -3400,13 +4230,14 @@ TEST_FUNCTION(Outprocess_messaging_thread_ends_one_loop_then_fails)
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(nn_recv(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
-	STRICT_EXPECTED_CALL(Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+	STRICT_EXPECTED_CALL(Message_CreateFromByteArrayNoCopy(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
 		.IgnoreAllArguments();
 	STRICT_EXPECTED_CALL(Broker_Publish(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreAllArguments();
 	STRICT_EXPECTED_CALL(Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
+	when_shall_nn_recv_fail = current_nn_recv_index + 2;
+	STRICT_EXPECTED_CALL(nn_recv(1, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT)).IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(nn_errno()).SetReturn(EAGAIN);
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1).SetReturn(LOCK_ERROR);
 
 	int function_result = (*thread_func_to_call[2])(thread_func_args[2]);
@@ -0,0 +1,587 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GATEWAY_EXPORT_H
+#define GATEWAY_EXPORT
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/gballoc.h"
+
+#include "shm_channel.h"
+
+/*the two ends of a channel are opened in the test process and exercised on
+real shared memory; the waits run on a second thread, so the allocations are
+stood in for by plain functions rather than by umock mocks*/
+
+/*a ring of 64 bytes holds two records of a 20 byte message and the 16 bytes
+left at its end are too few for a third one*/
+#define TEST_RING_SIZE          64
+#define TEST_MESSAGE_SIZE       20
+#define TEST_WAIT_MS            5000
+
+void* gballoc_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void* gballoc_calloc(size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
+
+void* gballoc_realloc(void* ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void gballoc_free(void* ptr)
+{
+    free(ptr);
+}
+
+static char g_uri[64];
+static char g_segment_name[64];
+static SHM_CHANNEL_HANDLE g_gateway;
+static SHM_CHANNEL_HANDLE g_module_host;
+
+static void open_channel(uint32_t ring_size)
+{
+    g_gateway = ShmChannel_Create(g_uri, ring_size);
+    ASSERT_IS_NOT_NULL(g_gateway);
+    g_module_host = ShmChannel_Open(g_uri);
+    ASSERT_IS_NOT_NULL(g_module_host);
+}
+
+static unsigned char* send_message(SHM_CHANNEL_HANDLE channel, unsigned char fill)
+{
+    unsigned char* result = ShmChannel_BeginSend(channel, TEST_MESSAGE_SIZE, 0);
+    ASSERT_IS_NOT_NULL(result);
+    (void)memset(result, fill, TEST_MESSAGE_SIZE);
+    ShmChannel_EndSend(channel);
+    return result;
+}
+
+static const unsigned char* receive_message(SHM_CHANNEL_HANDLE channel, unsigned char fill)
+{
+    const unsigned char* result = NULL;
+    ASSERT_ARE_EQUAL(int, TEST_MESSAGE_SIZE, ShmChannel_BeginReceive(channel, &result, 0));
+    ASSERT_ARE_EQUAL(int, fill, result[0]);
+    ASSERT_ARE_EQUAL(int, fill, result[TEST_MESSAGE_SIZE - 1]);
+    ShmChannel_EndReceive(channel);
+    return result;
+}
+
+static int is_readable(int fd, int timeout_ms)
+{
+    struct pollfd poll_fd;
+    poll_fd.fd = fd;
+    poll_fd.events = POLLIN;
+    poll_fd.revents = 0;
+    return (poll(&poll_fd, 1, timeout_ms) == 1) && ((poll_fd.revents & POLLIN) != 0);
+}
+
+static long elapsed_ms(const struct timespec* start)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+typedef struct WAITER_TAG
+{
+    SHM_CHANNEL_HANDLE channel;
+    int timeout_ms;
+    int32_t received;
+    unsigned char* reserved;
+} WAITER;
+
+static int wait_for_message(void* context)
+{
+    WAITER* waiter = (WAITER*)context;
+    const unsigned char* buf;
+    waiter->received = ShmChannel_BeginReceive(waiter->channel, &buf, waiter->timeout_ms);
+    if (waiter->received >= 0)
+    {
+        ShmChannel_EndReceive(waiter->channel);
+    }
+    return 0;
+}
+
+static int wait_for_room(void* context)
+{
+    WAITER* waiter = (WAITER*)context;
+    waiter->reserved = ShmChannel_BeginSend(waiter->channel, TEST_MESSAGE_SIZE, waiter->timeout_ms);
+    if (waiter->reserved != NULL)
+    {
+        ShmChannel_EndSend(waiter->channel);
+    }
+    return 0;
+}
+
+static THREAD_HANDLE start_waiter(THREAD_START_FUNC func, WAITER* waiter, SHM_CHANNEL_HANDLE channel)
+{
+    THREAD_HANDLE result;
+    waiter->channel = channel;
+    waiter->timeout_ms = -1;
+    waiter->received = 0;
+    waiter->reserved = NULL;
+    ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Create(&result, func, waiter));
+    /*long enough for the waiter to spin and fall asleep on the futex*/
+    ThreadAPI_Sleep(50);
+    return result;
+}
+
+static void join_waiter(THREAD_HANDLE thread)
+{
+    int thread_result;
+    ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Join(thread, &thread_result));
+}
+
+static TEST_MUTEX_HANDLE g_testByTest;
+static TEST_MUTEX_HANDLE g_dllByDll;
+
+BEGIN_TEST_SUITE(shm_channel_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    TEST_INITIALIZE_MEMORY_DEBUG(g_dllByDll);
+    g_testByTest = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(g_testByTest);
+
+    /*the segment names are global to the machine*/
+    (void)sprintf(g_uri, SHM_CHANNEL_URI_HEAD "shm_channel_ut_%d", (int)getpid());
+    (void)sprintf(g_segment_name, "/shm_channel_ut_%d", (int)getpid());
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    TEST_MUTEX_DESTROY(g_testByTest);
+    TEST_DEINITIALIZE_MEMORY_DEBUG(g_dllByDll);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(g_testByTest))
+    {
+        ASSERT_FAIL("our mutex is ABANDONED. Failure in test framework");
+    }
+
+    g_gateway = NULL;
+    g_module_host = NULL;
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    ShmChannel_Destroy(g_module_host);
+    ShmChannel_Destroy(g_gateway);
+    (void)shm_unlink(g_segment_name);
+    TEST_MUTEX_RELEASE(g_testByTest);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_001: [ If ring_size is less than 64 or is not a power of 2, ShmChannel_Create shall fail and return NULL. ]*/
+TEST_FUNCTION(ShmChannel_Create_with_an_invalid_ring_size_fails)
+{
+    ///arrange
+    ///act
+    ///assert
+    ASSERT_IS_NULL(ShmChannel_Create(g_uri, 0));
+    ASSERT_IS_NULL(ShmChannel_Create(g_uri, 32));
+    ASSERT_IS_NULL(ShmChannel_Create(g_uri, 96));
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_002: [ If uri is NULL, does not start with "shm://", names nothing, contains another '/' or names a segment longer than NAME_MAX, ShmChannel_Create and ShmChannel_Open shall fail and return NULL. ]*/
+TEST_FUNCTION(ShmChannel_with_an_invalid_uri_fails)
+{
+    ///arrange
+    char long_uri[SHM_CHANNEL_URI_HEAD_SIZE + 300];
+    (void)strcpy(long_uri, SHM_CHANNEL_URI_HEAD);
+    (void)memset(long_uri + SHM_CHANNEL_URI_HEAD_SIZE, 'a', 299);
+    long_uri[sizeof(long_uri) - 1] = '\0';
+
+    ///act
+    ///assert
+    ASSERT_IS_NULL(ShmChannel_Create(NULL, TEST_RING_SIZE));
+    ASSERT_IS_NULL(ShmChannel_Create("ipc://shm_channel_ut", TEST_RING_SIZE));
+    ASSERT_IS_NULL(ShmChannel_Create(SHM_CHANNEL_URI_HEAD, TEST_RING_SIZE));
+    ASSERT_IS_NULL(ShmChannel_Create(SHM_CHANNEL_URI_HEAD "a/b", TEST_RING_SIZE));
+    ASSERT_IS_NULL(ShmChannel_Create(long_uri, TEST_RING_SIZE));
+    ASSERT_IS_NULL(ShmChannel_Open(NULL));
+    ASSERT_IS_NULL(ShmChannel_Open("ipc://shm_channel_ut"));
+    ASSERT_IS_NULL(ShmChannel_Open(SHM_CHANNEL_URI_HEAD "a/b"));
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_003: [ ShmChannel_Create shall remove a segment left behind with the name of uri, create the segment, size it for the header and two rings of ring_size bytes, map it, write the magic number after the rest of the header and return a non-NULL handle whose send ring is the first ring. ]*/
+TEST_FUNCTION(ShmChannel_Create_replaces_a_segment_left_behind)
+{
+    ///arrange
+    int fd = shm_open(g_segment_name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    ASSERT_IS_TRUE(fd >= 0);
+    (void)close(fd);
+
+    ///act
+    g_gateway = ShmChannel_Create(g_uri, TEST_RING_SIZE);
+
+    ///assert
+    ASSERT_IS_NOT_NULL(g_gateway);
+    g_module_host = ShmChannel_Open(g_uri);
+    ASSERT_IS_NOT_NULL(g_module_host);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_006: [ If the segment does not exist, cannot be mapped, is smaller than its header, or its magic number, version, ring size or size are not those of a channel, ShmChannel_Open shall release what it created and return NULL. ]*/
+TEST_FUNCTION(ShmChannel_Open_of_a_segment_that_is_not_a_channel_fails)
+{
+    ///arrange
+    int fd;
+
+    ///act
+    ///assert
+    ASSERT_IS_NULL(ShmChannel_Open(g_uri));
+
+    fd = shm_open(g_segment_name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    ASSERT_IS_TRUE(fd >= 0);
+    ASSERT_IS_NULL(ShmChannel_Open(g_uri));
+
+    ASSERT_ARE_EQUAL(int, 0, ftruncate(fd, 4096));
+    (void)close(fd);
+    ASSERT_IS_NULL(ShmChannel_Open(g_uri));
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_005: [ ShmChannel_Open shall map the segment named by uri and return a non-NULL handle whose send ring is the second ring. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_012: [ ShmChannel_BeginSend shall write size in the length of the record and return a pointer to the size bytes that follow it. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_014: [ ShmChannel_EndSend shall publish the record reserved by ShmChannel_BeginSend and wake the peer if it waits for a message. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_019: [ ShmChannel_BeginReceive shall set *buf to the message of the oldest record and return its size. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_021: [ ShmChannel_EndReceive shall give the room of the record returned by ShmChannel_BeginReceive back to the peer and wake the peer if it waits for room. ]*/
+TEST_FUNCTION(ShmChannel_carries_messages_both_ways_in_order)
+{
+    ///arrange
+    int i;
+    open_channel(TEST_RING_SIZE);
+
+    ///act
+    ///assert
+    /*several laps of each ring*/
+    for (i = 0; i < 10; i++)
+    {
+        (void)send_message(g_gateway, (unsigned char)(2 * i));
+        (void)send_message(g_gateway, (unsigned char)(2 * i + 1));
+        (void)send_message(g_module_host, (unsigned char)(100 + i));
+        (void)receive_message(g_module_host, (unsigned char)(2 * i));
+        (void)receive_message(g_module_host, (unsigned char)(2 * i + 1));
+        (void)receive_message(g_gateway, (unsigned char)(100 + i));
+    }
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_007: [ If channel is NULL or size is negative, ShmChannel_BeginSend shall fail and return NULL. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_008: [ If the record of a message of size bytes is larger than the ring, ShmChannel_BeginSend shall fail and return NULL. ]*/
+TEST_FUNCTION(ShmChannel_BeginSend_of_a_message_that_does_not_fit_fails)
+{
+    ///arrange
+    open_channel(TEST_RING_SIZE);
+
+    ///act
+    ///assert
+    ASSERT_IS_NULL(ShmChannel_BeginSend(NULL, TEST_MESSAGE_SIZE, 0));
+    ASSERT_IS_NULL(ShmChannel_BeginSend(g_gateway, -1, 0));
+    ASSERT_IS_NULL(ShmChannel_BeginSend(g_gateway, TEST_RING_SIZE - 3, 0));
+    ASSERT_IS_NOT_NULL(ShmChannel_BeginSend(g_gateway, TEST_RING_SIZE - 4, 0));
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_010: [ If the record does not fit before the end of the ring, ShmChannel_BeginSend shall write a WRAP record over the rest of the ring, publish it and reserve the record at the start of the ring. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_017: [ ShmChannel_BeginReceive shall skip a WRAP record and give its room back to the peer. ]*/
+TEST_FUNCTION(ShmChannel_BeginSend_wraps_a_record_that_does_not_fit_before_the_end_of_the_ring)
+{
+    ///arrange
+    unsigned char* first_sent;
+    const unsigned char* first_received;
+    unsigned char* third_sent;
+    const unsigned char* received;
+    open_channel(TEST_RING_SIZE);
+    first_sent = send_message(g_gateway, 1);
+    (void)send_message(g_gateway, 2);
+    first_received = receive_message(g_module_host, 1);
+    (void)receive_message(g_module_host, 2);
+
+    ///act
+    third_sent = send_message(g_gateway, 3);
+
+    ///assert
+    /*each end maps the segment at its own address*/
+    ASSERT_IS_TRUE(third_sent == first_sent);
+    received = receive_message(g_module_host, 3);
+    ASSERT_IS_TRUE(received == first_received);
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_EMPTY, ShmChannel_BeginReceive(g_module_host, &received, 0));
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_011: [ If the ring has no room for the record, ShmChannel_BeginSend shall wait up to timeout_ms milliseconds, or until the channel is closed if timeout_ms is negative, for the peer to free enough room, and return NULL if it does not. ]*/
+TEST_FUNCTION(ShmChannel_BeginSend_on_a_full_ring_times_out)
+{
+    ///arrange
+    struct timespec start;
+    open_channel(TEST_RING_SIZE);
+    (void)send_message(g_gateway, 1);
+    (void)send_message(g_gateway, 2);
+
+    ///act
+    ///assert
+    ASSERT_IS_NULL(ShmChannel_BeginSend(g_gateway, TEST_MESSAGE_SIZE, 0));
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    ASSERT_IS_NULL(ShmChannel_BeginSend(g_gateway, TEST_MESSAGE_SIZE, 50));
+    ASSERT_IS_TRUE(elapsed_ms(&start) >= 50);
+
+    /*the full ring holds on to what was sent*/
+    (void)receive_message(g_module_host, 1);
+    (void)receive_message(g_module_host, 2);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_011: [ If the ring has no room for the record, ShmChannel_BeginSend shall wait up to timeout_ms milliseconds, or until the channel is closed if timeout_ms is negative, for the peer to free enough room, and return NULL if it does not. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_021: [ ShmChannel_EndReceive shall give the room of the record returned by ShmChannel_BeginReceive back to the peer and wake the peer if it waits for room. ]*/
+TEST_FUNCTION(ShmChannel_BeginSend_on_a_full_ring_waits_for_room)
+{
+    ///arrange
+    const unsigned char* buf;
+    WAITER waiter;
+    THREAD_HANDLE thread;
+    open_channel(TEST_RING_SIZE);
+    (void)send_message(g_gateway, 1);
+    (void)send_message(g_gateway, 2);
+    thread = start_waiter(wait_for_room, &waiter, g_gateway);
+
+    ///act
+    (void)receive_message(g_module_host, 1);
+    join_waiter(thread);
+
+    ///assert
+    ASSERT_IS_NOT_NULL(waiter.reserved);
+    (void)receive_message(g_module_host, 2);
+    ASSERT_ARE_EQUAL(int, TEST_MESSAGE_SIZE, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_016: [ If the ring holds no record, ShmChannel_BeginReceive shall return SHM_CHANNEL_EMPTY if timeout_ms is 0, otherwise wait up to timeout_ms milliseconds, or until the channel is closed if timeout_ms is negative, for the peer to publish one, and return SHM_CHANNEL_EMPTY if it does not or SHM_CHANNEL_CLOSED if the channel is closed. ]*/
+TEST_FUNCTION(ShmChannel_BeginReceive_on_an_empty_ring_times_out)
+{
+    ///arrange
+    const unsigned char* buf;
+    struct timespec start;
+    open_channel(TEST_RING_SIZE);
+
+    ///act
+    ///assert
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_EMPTY, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_EMPTY, ShmChannel_BeginReceive(g_module_host, &buf, 50));
+    ASSERT_IS_TRUE(elapsed_ms(&start) >= 50);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_014: [ ShmChannel_EndSend shall publish the record reserved by ShmChannel_BeginSend and wake the peer if it waits for a message. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_016: [ If the ring holds no record, ShmChannel_BeginReceive shall return SHM_CHANNEL_EMPTY if timeout_ms is 0, otherwise wait up to timeout_ms milliseconds, or until the channel is closed if timeout_ms is negative, for the peer to publish one, and return SHM_CHANNEL_EMPTY if it does not or SHM_CHANNEL_CLOSED if the channel is closed. ]*/
+TEST_FUNCTION(ShmChannel_BeginReceive_waits_for_a_message)
+{
+    ///arrange
+    WAITER waiter;
+    THREAD_HANDLE thread;
+    open_channel(TEST_RING_SIZE);
+    thread = start_waiter(wait_for_message, &waiter, g_module_host);
+
+    ///act
+    (void)send_message(g_gateway, 1);
+    join_waiter(thread);
+
+    ///assert
+    ASSERT_ARE_EQUAL(int, TEST_MESSAGE_SIZE, waiter.received);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_018: [ If the length of a record is larger than INT32_MAX, or the record runs past the end of the ring or past what the peer published, ShmChannel_BeginReceive shall return SHM_CHANNEL_CLOSED. ]*/
+TEST_FUNCTION(ShmChannel_BeginReceive_rejects_a_corrupted_record_length)
+{
+    ///arrange
+    const unsigned char* buf;
+    unsigned char* message;
+    uint32_t* length;
+    open_channel(TEST_RING_SIZE);
+    (void)send_message(g_gateway, 1);
+    message = send_message(g_gateway, 2);
+    (void)receive_message(g_module_host, 1);
+    length = (uint32_t*)(message - 4);
+
+    ///act
+    ///assert
+    /*past what the peer published*/
+    *length = TEST_MESSAGE_SIZE + 4;
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_CLOSED, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+    /*past the end of the ring*/
+    *length = TEST_RING_SIZE;
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_CLOSED, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+    /*larger than INT32_MAX*/
+    *length = 0x80000000;
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_CLOSED, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+
+    *length = TEST_MESSAGE_SIZE;
+    (void)receive_message(g_module_host, 2);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_027: [ If channel is NULL, ShmChannel_GetPollFd shall fail and return -1. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_028: [ ShmChannel_GetPollFd shall return the same descriptor on every call. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_029: [ The first time, ShmChannel_GetPollFd shall create a non blocking event descriptor and start the doorbell thread of this end; if either fails, it shall release what it created and return -1. ]*/
+TEST_FUNCTION(ShmChannel_GetPollFd_returns_the_same_descriptor_on_every_call)
+{
+    ///arrange
+    int fd;
+    open_channel(TEST_RING_SIZE);
+
+    ///act
+    fd = ShmChannel_GetPollFd(g_module_host);
+
+    ///assert
+    ASSERT_IS_TRUE(fd >= 0);
+    ASSERT_ARE_EQUAL(int, fd, ShmChannel_GetPollFd(g_module_host));
+    ASSERT_ARE_EQUAL(int, -1, ShmChannel_GetPollFd(NULL));
+    ASSERT_IS_FALSE(is_readable(fd, 0));
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_030: [ The doorbell thread shall signal the descriptor once the incoming ring holds a record, then wait for ShmChannel_BeginReceive to clear the descriptor before it watches the ring again, and stop when the channel is closed. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_031: [ If the ring holds no record and the doorbell was rung, ShmChannel_BeginReceive shall clear the descriptor, let the doorbell thread watch the ring again and look at the ring once more. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_032: [ ShmChannel_Destroy shall stop the doorbell thread, if any, and close its descriptor. ]*/
+TEST_FUNCTION(ShmChannel_GetPollFd_becomes_readable_until_the_ring_is_drained)
+{
+    ///arrange
+    const unsigned char* buf;
+    int fd;
+    open_channel(TEST_RING_SIZE);
+    fd = ShmChannel_GetPollFd(g_module_host);
+    ASSERT_IS_TRUE(fd >= 0);
+
+    ///act
+    (void)send_message(g_gateway, 1);
+
+    ///assert
+    ASSERT_IS_TRUE(is_readable(fd, TEST_WAIT_MS));
+    (void)send_message(g_gateway, 2);
+    (void)receive_message(g_module_host, 1);
+    ASSERT_IS_TRUE(is_readable(fd, 0));
+    (void)receive_message(g_module_host, 2);
+    ASSERT_IS_TRUE(is_readable(fd, 0));
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_EMPTY, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+    ASSERT_IS_FALSE(is_readable(fd, 0));
+
+    /*the doorbell watches the ring again*/
+    (void)send_message(g_gateway, 3);
+    ASSERT_IS_TRUE(is_readable(fd, TEST_WAIT_MS));
+    (void)receive_message(g_module_host, 3);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_031: [ If the ring holds no record and the doorbell was rung, ShmChannel_BeginReceive shall clear the descriptor, let the doorbell thread watch the ring again and look at the ring once more. ]*/
+TEST_FUNCTION(ShmChannel_GetPollFd_is_not_cleared_while_a_message_waits)
+{
+    ///arrange
+    const unsigned char* buf;
+    int fd;
+    int i;
+    open_channel(TEST_RING_SIZE);
+    fd = ShmChannel_GetPollFd(g_module_host);
+    ASSERT_IS_TRUE(fd >= 0);
+
+    ///act
+    ///assert
+    /*however the publications fall between the receives, a message never waits behind a clear descriptor*/
+    for (i = 0; i < 200; i++)
+    {
+        (void)send_message(g_gateway, (unsigned char)i);
+        ASSERT_IS_TRUE(is_readable(fd, TEST_WAIT_MS));
+        (void)receive_message(g_module_host, (unsigned char)i);
+        ASSERT_ARE_EQUAL(int, SHM_CHANNEL_EMPTY, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+    }
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_009: [ If the channel is closed, ShmChannel_BeginSend shall fail and return NULL. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_015: [ If channel or buf is NULL, or the channel is closed, ShmChannel_BeginReceive shall return SHM_CHANNEL_CLOSED. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_023: [ ShmChannel_Close shall mark the channel closed and wake the threads of this end waiting in ShmChannel_BeginSend or ShmChannel_BeginReceive, and the doorbell thread. ]*/
+TEST_FUNCTION(ShmChannel_Close_wakes_a_thread_waiting_for_a_message)
+{
+    ///arrange
+    const unsigned char* buf;
+    WAITER waiter;
+    THREAD_HANDLE thread;
+    struct timespec start;
+    open_channel(TEST_RING_SIZE);
+    thread = start_waiter(wait_for_message, &waiter, g_module_host);
+
+    ///act
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    ShmChannel_Close(g_module_host);
+    join_waiter(thread);
+
+    ///assert
+    ASSERT_IS_TRUE(elapsed_ms(&start) < TEST_WAIT_MS);
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_CLOSED, waiter.received);
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_CLOSED, ShmChannel_BeginReceive(g_module_host, &buf, 0));
+    ASSERT_IS_NULL(ShmChannel_BeginSend(g_module_host, TEST_MESSAGE_SIZE, 0));
+
+    /*the other end is still open*/
+    (void)send_message(g_gateway, 1);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_011: [ If the ring has no room for the record, ShmChannel_BeginSend shall wait up to timeout_ms milliseconds, or until the channel is closed if timeout_ms is negative, for the peer to free enough room, and return NULL if it does not. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_023: [ ShmChannel_Close shall mark the channel closed and wake the threads of this end waiting in ShmChannel_BeginSend or ShmChannel_BeginReceive, and the doorbell thread. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_025: [ ShmChannel_Destroy shall unmap the segment and free the handle, and the gateway end shall also remove the name of the segment. ]*/
+TEST_FUNCTION(ShmChannel_Close_wakes_a_thread_waiting_for_room_before_Destroy)
+{
+    ///arrange
+    WAITER waiter;
+    THREAD_HANDLE thread;
+    struct timespec start;
+    open_channel(TEST_RING_SIZE);
+    (void)send_message(g_gateway, 1);
+    (void)send_message(g_gateway, 2);
+    thread = start_waiter(wait_for_room, &waiter, g_gateway);
+
+    ///act
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    ShmChannel_Close(g_gateway);
+    join_waiter(thread);
+    ShmChannel_Destroy(g_gateway);
+    g_gateway = NULL;
+
+    ///assert
+    ASSERT_IS_TRUE(elapsed_ms(&start) < TEST_WAIT_MS);
+    ASSERT_IS_NULL(waiter.reserved);
+    ASSERT_IS_NULL(ShmChannel_Open(g_uri));
+
+    /*the module host end keeps its mapping*/
+    (void)receive_message(g_module_host, 1);
+}
+
+/*Tests_SRS_SHM_CHANNEL_30_013: [ If channel is NULL, ShmChannel_EndSend shall do nothing. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_015: [ If channel or buf is NULL, or the channel is closed, ShmChannel_BeginReceive shall return SHM_CHANNEL_CLOSED. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_020: [ If channel is NULL, ShmChannel_EndReceive shall do nothing. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_022: [ If channel is NULL, ShmChannel_Close shall do nothing. ]*/
+/*Tests_SRS_SHM_CHANNEL_30_024: [ If channel is NULL, ShmChannel_Destroy shall do nothing. ]*/
+TEST_FUNCTION(ShmChannel_with_a_NULL_argument_does_nothing)
+{
+    ///arrange
+    const unsigned char* buf;
+    open_channel(TEST_RING_SIZE);
+
+    ///act
+    ///assert
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_CLOSED, ShmChannel_BeginReceive(NULL, &buf, 0));
+    ASSERT_ARE_EQUAL(int, SHM_CHANNEL_CLOSED, ShmChannel_BeginReceive(g_module_host, NULL, 0));
+    ShmChannel_EndSend(NULL);
+    ShmChannel_EndReceive(NULL);
+    ShmChannel_Close(NULL);
+    ShmChannel_Destroy(NULL);
+}
+
+END_TEST_SUITE(shm_channel_ut)
@@ -4,6 +4,7 @@
 #ifndef IOTHUB_H
 #define IOTHUB_H
 
+#include <stdbool.h>
 #include "module.h"
 #include <iothub_client_ll.h>
 
@@ -17,6 +18,15 @@ typedef struct IOTHUB_CONFIG_TAG
     const char* IoTHubName;
     const char* IoTHubSuffix;
     IOTHUB_CLIENT_TRANSPORT_PROVIDER transportProvider;
+    size_t maxDevices; /*the most devices connected at once, the least recently used is disconnected first, giving up what it had not sent. 0 for no limit*/
+    unsigned int deviceIdleSeconds; /*disconnect the devices that sent nothing for that long, giving up what they had not sent. 0 to keep them*/
+    size_t mqttPoolSize; /*with MQTT_Protocol, the number of threads shared by the devices. 0 for a thread per device*/
+    size_t maxInFlight; /*the most messages sent and not yet confirmed, IotHub_Receive waits for a confirmation above it. 0 for no limit*/
+    bool batching; /*with HTTP_Protocol, send the waiting messages of a device in a single request*/
+    const char* spoolDirectory; /*keep the messages in this directory while IoT Hub cannot be reached, and send them in order once it can. NULL for no spool*/
+    size_t spoolMaxBytes; /*the most disk space the spool takes, the oldest messages are dropped first. 0 for no limit*/
+    unsigned int spoolMaxAgeSeconds; /*drop the spooled messages older than that. 0 to keep them*/
+    size_t shards; /*the number of threads sending the messages, a device always gets the same one so its messages stay in order. 0 to send from the thread calling IotHub_Receive*/
 }IOTHUB_CONFIG; /*this needs to be passed to the Module_Create function*/
 
 MODULE_EXPORT const MODULE_API* MODULE_STATIC_GETAPI(IOTHUB_MODULE)(MODULE_API_VERSION gateway_api_version);
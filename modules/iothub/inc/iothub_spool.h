@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef IOTHUB_SPOOL_H
+#define IOTHUB_SPOOL_H
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C"
+{
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#endif
+
+#include "message.h"
+
+/*a store-and-forward spool of gateway messages in a directory. The messages are
+appended, in their Message_ToByteArray form, to memory mapped segment files and
+read back in the same order. A read message stays in the spool until its
+position is committed, so the messages read and not committed are read again
+after IotHubSpool_Rewind or after the process restarts. The spool is not
+thread safe, and a directory can only be opened by one spool at a time.*/
+
+typedef struct IOTHUB_SPOOL_TAG* IOTHUB_SPOOL_HANDLE;
+
+typedef struct IOTHUB_SPOOL_CONFIG_TAG
+{
+    const char* directory; /*created if it does not exist*/
+    size_t segmentSize; /*the size of a segment file, a bigger message gets a segment of its own*/
+    size_t maxSize; /*the oldest segment is dropped before the segments go over it. 0 for no limit*/
+    unsigned int maxAgeSeconds; /*the messages spooled longer ago are dropped when read. 0 for no limit*/
+}IOTHUB_SPOOL_CONFIG;
+
+/*where a read message ends, committing it commits every message before it*/
+typedef struct IOTHUB_SPOOL_POSITION_TAG
+{
+    uint64_t segment;
+    size_t offset;
+}IOTHUB_SPOOL_POSITION;
+
+#define IOTHUB_SPOOL_SEGMENT_SIZE_DEFAULT (4 * 1024 * 1024)
+
+/*opens the spool in config->directory and recovers the messages it holds,
+up to the first one that was not completely written*/
+extern IOTHUB_SPOOL_HANDLE IotHubSpool_Open(const IOTHUB_SPOOL_CONFIG* config);
+
+/*closes the spool, the messages not committed stay in the directory*/
+extern void IotHubSpool_Close(IOTHUB_SPOOL_HANDLE spool);
+
+/*appends message to the spool. Returns 0 on success, non-zero otherwise*/
+extern int IotHubSpool_Append(IOTHUB_SPOOL_HANDLE spool, MESSAGE_HANDLE message);
+
+/*reads the next message. Returns non-zero when there is nothing left to read.
+Otherwise returns 0 and sets *position; *message is the message, or NULL when
+it was dropped because it is too old or cannot be decoded*/
+extern int IotHubSpool_Read(IOTHUB_SPOOL_HANDLE spool, MESSAGE_HANDLE* message, IOTHUB_SPOOL_POSITION* position);
+
+/*marks the messages up to position as delivered, the segments holding only
+delivered messages are removed*/
+extern void IotHubSpool_Commit(IOTHUB_SPOOL_HANDLE spool, const IOTHUB_SPOOL_POSITION* position);
+
+/*makes the next read start again at the first message not committed*/
+extern void IotHubSpool_Rewind(IOTHUB_SPOOL_HANDLE spool);
+
+/*returns true if the spool holds messages not committed yet*/
+extern bool IotHubSpool_HasPending(IOTHUB_SPOOL_HANDLE spool);
+
+/*starts writing the segments back to disk, so that the messages survive a
+power failure as well as a crash of the process*/
+extern void IotHubSpool_Flush(IOTHUB_SPOOL_HANDLE spool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*IOTHUB_SPOOL_H*/
@@ -5,10 +5,14 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <string.h>
+#include <time.h>
 #include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/agenttime.h"
 
 #include "iothub.h"
 #include "iothub_client.h"
+#include "iothub_client_ll.h"
 #include "iothubtransport.h"
 #include "iothubtransporthttp.h"
 #include "iothubtransportamqp.h"
@@ -17,32 +21,159 @@
 #include "azure_c_shared_utility/vector.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/strings.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/threadapi.h"
 #include "messageproperties.h"
 #include "broker.h"
+#include "iothub_spool.h"
 
 #include <parson.h>
 
+struct IOTHUB_LANE_TAG;
+
 typedef struct PERSONALITY_TAG
 {
     STRING_HANDLE deviceName;
     STRING_HANDLE deviceKey;
-    IOTHUB_CLIENT_HANDLE iothubHandle;
+    IOTHUB_CLIENT_HANDLE iothubHandle; /*NULL when the personality is in a lane*/
+    IOTHUB_CLIENT_LL_HANDLE iothubLLHandle; /*used instead of iothubHandle in a lane*/
+    struct IOTHUB_LANE_TAG* lane;
+    struct PERSONALITY_TAG* nextInLane;
+    struct PERSONALITY_TAG* previousInLane;
     BROKER_HANDLE broker;
     MODULE_HANDLE module;
+    size_t hash; /*of deviceName*/
+    size_t shard; /*picked by the hash, 0 without shards*/
+    size_t vectorIndex; /*where the personality is in IOTHUB_HANDLE_DATA::personalities*/
+    time_t lastUsed;
+    struct PERSONALITY_TAG* moreRecentlyUsed;
+    struct PERSONALITY_TAG* lessRecentlyUsed;
 }PERSONALITY;
 
 typedef PERSONALITY* PERSONALITY_PTR;
 
+/*open addressing index of the personalities by deviceName, with linear probing.
+Removed personalities leave a tombstone so that the probe sequences stay intact.*/
+typedef struct PERSONALITY_INDEX_TAG
+{
+    PERSONALITY_PTR* slots;
+    size_t mask; /*number of slots - 1, the number of slots is a power of 2*/
+    size_t used; /*slots holding a personality or a tombstone*/
+    size_t count; /*slots holding a personality*/
+}PERSONALITY_INDEX;
+
+/*a thread that calls IoTHubClient_LL_DoWork for the MQTT devices whose name hashes to it.
+Every call to the IoTHubClient_LL of these devices is made under the lock.*/
+typedef struct IOTHUB_LANE_TAG
+{
+    LOCK_HANDLE lock;
+    THREAD_HANDLE thread;
+    bool keepRunning;
+    PERSONALITY_PTR personalities; /*linked through nextInLane*/
+}IOTHUB_LANE;
+
+/*the most messages of the spool sent and not delivered yet*/
+#define IOTHUB_DRAIN_WINDOW 256
+
+/*a message of the spool sent to IoT Hub, committed once it and the ones before are delivered*/
+typedef struct IOTHUB_DRAIN_SENT_TAG
+{
+    IOTHUB_SPOOL_POSITION position;
+    bool delivered;
+}IOTHUB_DRAIN_SENT;
+
+/*the most messages waiting for the thread of a shard, IotHub_Receive waits above it*/
+#define IOTHUB_SHARD_QUEUE_SIZE 256
+
+struct IOTHUB_HANDLE_DATA_TAG;
+struct IOTHUB_DRAIN_CONFIRMATION_TAG;
+
+/*a message waiting for the thread of its shard*/
+typedef struct IOTHUB_SHARD_ITEM_TAG
+{
+    MESSAGE_HANDLE message;
+    CONSTMAP_HANDLE properties;
+    struct IOTHUB_DRAIN_CONFIRMATION_TAG* spoolConfirmation; /*NULL unless the message comes from the spool*/
+}IOTHUB_SHARD_ITEM;
+
+/*a thread that sends the messages of the devices whose name hashes to it, in the order they were
+queued. The personalities of these devices are only used and evicted by this thread.*/
+typedef struct IOTHUB_SHARD_TAG
+{
+    struct IOTHUB_HANDLE_DATA_TAG* module;
+    LOCK_HANDLE lock;
+    COND_HANDLE changed; /*posted when a message is queued or taken, and when the shard stops*/
+    THREAD_HANDLE thread;
+    bool keepRunning;
+    IOTHUB_SHARD_ITEM queue[IOTHUB_SHARD_QUEUE_SIZE]; /*a ring, count messages from first*/
+    size_t first;
+    size_t count;
+}IOTHUB_SHARD;
+
 typedef struct IOTHUB_HANDLE_DATA_TAG
 {
     VECTOR_HANDLE personalities; /*holds PERSONALITYs*/
+    PERSONALITY_INDEX index;
+    PERSONALITY_INDEX previousIndex; /*being moved into index, a few slots per new personality*/
+    size_t previousIndexPosition;
+    PERSONALITY_PTR mostRecentlyUsed;
+    PERSONALITY_PTR leastRecentlyUsed;
+    size_t maxDevices;
+    unsigned int deviceIdleSeconds;
     STRING_HANDLE IoTHubName;
     STRING_HANDLE IoTHubSuffix;
     IOTHUB_CLIENT_TRANSPORT_PROVIDER transportProvider;
     TRANSPORT_HANDLE transportHandle;
+    IOTHUB_LANE* lanes; /*NULL unless MQTT devices are pooled*/
+    size_t laneCount;
+    size_t maxInFlight;
+    size_t inFlight; /*messages sent and not yet confirmed, counted only when maxInFlight is not 0*/
+    LOCK_HANDLE inFlightLock;
+    COND_HANDLE inFlightConfirmed;
+    bool batching;
+    IOTHUB_SPOOL_HANDLE spool; /*NULL unless the messages are spooled while IoT Hub cannot be reached*/
+    LOCK_HANDLE spoolLock; /*for the spool and the state of its drain below, never held while calling IoTHubClient*/
+    LOCK_HANDLE receiveLock; /*for the personalities, shared by IotHub_Receive, the drain thread and the shards. NULL without a spool or shards*/
+    THREAD_HANDLE drainThread;
+    bool drainKeepRunning;
+    bool reachable; /*false from a failed delivery to the next successful one*/
+    time_t nextProbe; /*while IoT Hub cannot be reached, when the drain thread tries a message again*/
+    IOTHUB_DRAIN_SENT sent[IOTHUB_DRAIN_WINDOW]; /*by ticket modulo IOTHUB_DRAIN_WINDOW*/
+    size_t firstSent; /*ticket of the oldest message of the spool sent and not committed*/
+    size_t sentCount;
+    size_t generation; /*changes when the spool is read again, the confirmations of the earlier sends are ignored*/
+    IOTHUB_SHARD* shards; /*NULL unless the messages are sent by the threads of the shards*/
+    size_t shardCount;
     BROKER_HANDLE broker;
 }IOTHUB_HANDLE_DATA;
 
+/*the context of the confirmation of a message of the spool*/
+typedef struct IOTHUB_DRAIN_CONFIRMATION_TAG
+{
+    IOTHUB_HANDLE_DATA* moduleHandleData;
+    size_t generation;
+    size_t ticket;
+}IOTHUB_DRAIN_CONFIRMATION;
+
+#define PERSONALITY_INDEX_INITIAL_SIZE 16
+/*slots of the previous index moved with every new personality, a growth is
+over long before the index is full again*/
+#define PERSONALITY_INDEX_MOVE_STEP 8
+
+/*how long a lane waits between two rounds of IoTHubClient_LL_DoWork, as IoTHubClient does*/
+#define IOTHUB_LANE_DOWORK_PERIOD_MS 1
+
+/*how long the drain thread waits when the spool is empty or the window is full*/
+#define IOTHUB_DRAIN_PERIOD_MS 10
+/*while IoT Hub cannot be reached, how often the drain thread tries a message of the spool*/
+#define IOTHUB_DRAIN_RETRY_SECONDS 5
+/*with a limit on its size, the spool has at least that many segments so that it drops a fraction of its messages at once*/
+#define IOTHUB_DRAIN_SEGMENTS_MIN 4
+
+static PERSONALITY personalityIndexTombstone;
+#define PERSONALITY_INDEX_TOMBSTONE (&personalityIndexTombstone)
+
 #define SOURCE "source"
 #define MAPPING "mapping"
 #define DEVICENAME "deviceName"
@@ -50,6 +181,15 @@ typedef struct IOTHUB_HANDLE_DATA_TAG
 #define SUFFIX "IoTHubSuffix"
 #define HUBNAME "IoTHubName"
 #define TRANSPORT "Transport"
+#define MAXDEVICES "MaxDevices"
+#define DEVICEIDLESECONDS "DeviceIdleSeconds"
+#define MQTTPOOLSIZE "MqttPoolSize"
+#define MAXINFLIGHT "MaxInFlight"
+#define BATCHING "Batching"
+#define SPOOLDIRECTORY "SpoolDirectory"
+#define SPOOLMAXBYTES "SpoolMaxBytes"
+#define SPOOLMAXAGESECONDS "SpoolMaxAgeSeconds"
+#define SHARDS "Shards"
 
 static int strcmp_i(const char* lhs, const char* rhs)
 {
@@ -165,10 +305,91 @@ static void* IotHub_ParseConfigurationFromJson(const char* configuration)
 
                         if (config != NULL)
                         {
-                            strcpy(name, IoTHubName);
-                            strcpy(suffix, IoTHubSuffix);
-                            config->IoTHubName = name;
-                            config->IoTHubSuffix = suffix;
+                            /*Codes_SRS_IOTHUBMODULE_30_001: [ `IotHub_ParseConfigurationFromJson` shall read the optional numbers "MaxDevices" and "DeviceIdleSeconds", 0 if they are missing. ]*/
+                            double maxDevices = json_object_get_number(obj, MAXDEVICES);
+                            double deviceIdleSeconds = json_object_get_number(obj, DEVICEIDLESECONDS);
+                            /*Codes_SRS_IOTHUBMODULE_30_008: [ `IotHub_ParseConfigurationFromJson` shall read the optional number "MqttPoolSize", 0 if it is missing. ]*/
+                            double mqttPoolSize = json_object_get_number(obj, MQTTPOOLSIZE);
+                            /*Codes_SRS_IOTHUBMODULE_30_015: [ `IotHub_ParseConfigurationFromJson` shall read the optional number "MaxInFlight", 0 if it is missing. ]*/
+                            double maxInFlight = json_object_get_number(obj, MAXINFLIGHT);
+                            /*Codes_SRS_IOTHUBMODULE_30_023: [ `IotHub_ParseConfigurationFromJson` shall read the optional string "SpoolDirectory" and the optional numbers "SpoolMaxBytes" and "SpoolMaxAgeSeconds", NULL and 0 if they are missing. ]*/
+                            const char* spoolDirectory = json_object_get_string(obj, SPOOLDIRECTORY);
+                            double spoolMaxBytes = json_object_get_number(obj, SPOOLMAXBYTES);
+                            double spoolMaxAgeSeconds = json_object_get_number(obj, SPOOLMAXAGESECONDS);
+                            /*Codes_SRS_IOTHUBMODULE_30_037: [ `IotHub_ParseConfigurationFromJson` shall read the optional number "Shards", 0 if it is missing. ]*/
+                            double shards = json_object_get_number(obj, SHARDS);
+                            char* directory = NULL;
+                            if (maxDevices < 0 || deviceIdleSeconds < 0)
+                            {
+                                /*Codes_SRS_IOTHUBMODULE_30_002: [ If "MaxDevices" or "DeviceIdleSeconds" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+                                LogError("%s and %s cannot be negative", MAXDEVICES, DEVICEIDLESECONDS);
+                                free(name);
+                                free(suffix);
+                                free(config);
+                                config = NULL;
+                            }
+                            else if (mqttPoolSize < 0)
+                            {
+                                /*Codes_SRS_IOTHUBMODULE_30_009: [ If "MqttPoolSize" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+                                LogError("%s cannot be negative", MQTTPOOLSIZE);
+                                free(name);
+                                free(suffix);
+                                free(config);
+                                config = NULL;
+                            }
+                            else if (maxInFlight < 0)
+                            {
+                                /*Codes_SRS_IOTHUBMODULE_30_016: [ If "MaxInFlight" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+                                LogError("%s cannot be negative", MAXINFLIGHT);
+                                free(name);
+                                free(suffix);
+                                free(config);
+                                config = NULL;
+                            }
+                            else if (spoolMaxBytes < 0 || spoolMaxAgeSeconds < 0)
+                            {
+                                /*Codes_SRS_IOTHUBMODULE_30_024: [ If "SpoolMaxBytes" or "SpoolMaxAgeSeconds" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+                                LogError("%s and %s cannot be negative", SPOOLMAXBYTES, SPOOLMAXAGESECONDS);
+                                free(name);
+                                free(suffix);
+                                free(config);
+                                config = NULL;
+                            }
+                            else if (shards < 0)
+                            {
+                                /*Codes_SRS_IOTHUBMODULE_30_038: [ If "Shards" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+                                LogError("%s cannot be negative", SHARDS);
+                                free(name);
+                                free(suffix);
+                                free(config);
+                                config = NULL;
+                            }
+                            else if ((spoolDirectory != NULL) &&
+                                ((directory = malloc(strlen(spoolDirectory) + 1)) == NULL))
+                            {
+                                LogError("Could not allocate memory for %s", SPOOLDIRECTORY);
+                                free(name);
+                                free(suffix);
+                                free(config);
+                                config = NULL;
+                            }
+                            else
+                            {
+                                strcpy(name, IoTHubName);
+                                strcpy(suffix, IoTHubSuffix);
+                                config->IoTHubName = name;
+                                config->IoTHubSuffix = suffix;
+                                config->maxDevices = (size_t)maxDevices;
+                                config->deviceIdleSeconds = (unsigned int)deviceIdleSeconds;
+                                config->mqttPoolSize = (size_t)mqttPoolSize;
+                                config->maxInFlight = (size_t)maxInFlight;
+                                /*Codes_SRS_IOTHUBMODULE_30_017: [ `IotHub_ParseConfigurationFromJson` shall set `batching` if the optional boolean "Batching" is true. ]*/
+                                config->batching = (json_object_get_boolean(obj, BATCHING) == 1);
+                                config->spoolDirectory = (directory == NULL) ? NULL : strcpy(directory, spoolDirectory);
+                                config->spoolMaxBytes = (size_t)spoolMaxBytes;
+                                config->spoolMaxAgeSeconds = (unsigned int)spoolMaxAgeSeconds;
+                                config->shards = (size_t)shards;
+                            }
                         }
 
                         result = config;
@@ -191,171 +412,1001 @@ static void IotHub_FreeConfiguration(void* configuration)
         /*Codes_SRS_IOTHUBMODULE_05_015: [ `IotHub_FreeConfiguration` shall free the strings referenced by the `IoTHubName` and `IoTHubSuffix` data members, and then free the `IOTHUB_CONFIG` structure itself. ]*/
         free((void*)config->IoTHubName);
         free((void*)config->IoTHubSuffix);
+        if (config->spoolDirectory != NULL)
+        {
+            /*Codes_SRS_IOTHUBMODULE_30_025: [ `IotHub_FreeConfiguration` shall free the string referenced by the `spoolDirectory` data member. ]*/
+            free((void*)config->spoolDirectory);
+        }
         free(config);
     }
 }
 
-static MODULE_HANDLE IotHub_Create(BROKER_HANDLE broker, const void* configuration)
+static void IOTHUB_LANE_add(IOTHUB_LANE* lane, PERSONALITY_PTR personality)
 {
-    IOTHUB_HANDLE_DATA *result;
-    const IOTHUB_CONFIG* config = configuration;
-
-    /*Codes_SRS_IOTHUBMODULE_02_001: [ If `broker` is `NULL` then `IotHub_Create` shall fail and return `NULL`. ]*/
-    /*Codes_SRS_IOTHUBMODULE_02_002: [ If `configuration` is `NULL` then `IotHub_Create` shall fail and return `NULL`. ]*/
-    /*Codes_SRS_IOTHUBMODULE_02_003: [ If `configuration->IoTHubName` is `NULL` then `IotHub_Create` shall and return `NULL`. ]*/
-    /*Codes_SRS_IOTHUBMODULE_02_004: [ If `configuration->IoTHubSuffix` is `NULL` then `IotHub_Create` shall fail and return `NULL`. ]*/
-    if (
-        (broker == NULL) ||
-        (configuration == NULL)
-        )
+    personality->previousInLane = NULL;
+    personality->nextInLane = lane->personalities;
+    if (lane->personalities != NULL)
     {
-        LogError("invalid arg broker=%p, configuration=%p", broker, configuration);
-        result = NULL;
+        lane->personalities->previousInLane = personality;
     }
-    else if (
-        (config->IoTHubName == NULL) ||
-        (config->IoTHubSuffix == NULL) ||
-        (config->transportProvider == NULL)
-        )
+    lane->personalities = personality;
+}
+
+static void IOTHUB_LANE_remove(IOTHUB_LANE* lane, PERSONALITY_PTR personality)
+{
+    if (personality->previousInLane != NULL)
     {
-        LogError("invalid configuration IoTHubName=%s IoTHubSuffix=%s transportProvider=%p",
-            (config != NULL) ? config->IoTHubName : "<null>",
-            (config != NULL) ? config->IoTHubSuffix : "<null>",
-            (config != NULL) ? config->transportProvider : 0);
-        result = NULL;
+        personality->previousInLane->nextInLane = personality->nextInLane;
     }
     else
     {
-        result = malloc(sizeof(IOTHUB_HANDLE_DATA));
-        /*Codes_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
-        if (result == NULL)
+        lane->personalities = personality->nextInLane;
+    }
+    if (personality->nextInLane != NULL)
+    {
+        personality->nextInLane->previousInLane = personality->previousInLane;
+    }
+}
+
+static int IOTHUB_LANE_worker(void* context)
+{
+    IOTHUB_LANE* lane = (IOTHUB_LANE*)context;
+    bool keepRunning = true;
+    while (keepRunning)
+    {
+        if (Lock(lane->lock) != LOCK_OK)
         {
-            LogError("malloc returned NULL");
-            /*return as is*/
+            LogError("not able to Lock, the lane shall retry");
         }
         else
         {
-            /*Codes_SRS_IOTHUBMODULE_02_006: [ `IotHub_Create` shall create an empty `VECTOR` containing pointers to `PERSONALITY`s. ]*/
-            result->personalities = VECTOR_create(sizeof(PERSONALITY_PTR));
-            if (result->personalities == NULL)
+            PERSONALITY_PTR personality;
+            for (personality = lane->personalities; personality != NULL; personality = personality->nextInLane)
             {
-                /*Codes_SRS_IOTHUBMODULE_02_007: [ If creating the personality vector fails then `IotHub_Create` shall fail and return `NULL`. ]*/
-                free(result);
-                result = NULL;
-                LogError("VECTOR_create returned NULL");
+                IoTHubClient_LL_DoWork(personality->iothubLLHandle);
             }
-            else
-            {
-                result->transportProvider = config->transportProvider;
-                if (result->transportProvider == HTTP_Protocol ||
-                    result->transportProvider == AMQP_Protocol)
-                {
-                    /*Codes_SRS_IOTHUBMODULE_17_001: [ If `configuration->transportProvider` is `HTTP_Protocol` or `AMQP_Protocol`, `IotHub_Create` shall create a shared transport by calling `IoTHubTransport_Create`. ]*/
-                    result->transportHandle = IoTHubTransport_Create(config->transportProvider, config->IoTHubName, config->IoTHubSuffix);
-                    if (result->transportHandle == NULL)
-                    {
-                        /*Codes_SRS_IOTHUBMODULE_17_002: [ If creating the shared transport fails, `IotHub_Create` shall fail and return `NULL`. ]*/
-                        VECTOR_destroy(result->personalities);
-                        free(result);
-                        result = NULL;
-                        LogError("VECTOR_create returned NULL");
-                    }
-                }
-                else
-                {
-                    result->transportHandle = NULL;
-                }
+            keepRunning = lane->keepRunning;
+            (void)Unlock(lane->lock);
+        }
+        ThreadAPI_Sleep(IOTHUB_LANE_DOWORK_PERIOD_MS);
+    }
+    return 0;
+}
 
-                if (result != NULL)
-                {
-                    /*Codes_SRS_IOTHUBMODULE_02_028: [ `IotHub_Create` shall create a copy of `configuration->IoTHubName`. ]*/
-                    /*Codes_SRS_IOTHUBMODULE_02_029: [ `IotHub_Create` shall create a copy of `configuration->IoTHubSuffix`. ]*/
-                    if ((result->IoTHubName = STRING_construct(config->IoTHubName)) == NULL)
-                    {
-                        LogError("STRING_construct returned NULL");
-                        IoTHubTransport_Destroy(result->transportHandle);
-                        VECTOR_destroy(result->personalities);
-                        free(result);
-                        result = NULL;
-                    }
-                    else if ((result->IoTHubSuffix = STRING_construct(config->IoTHubSuffix)) == NULL)
-                    {
-                        LogError("STRING_construct returned NULL");
-                        STRING_delete(result->IoTHubName);
-                        IoTHubTransport_Destroy(result->transportHandle);
-                        VECTOR_destroy(result->personalities);
-                        free(result);
-                        result = NULL;
-                    }
-                    else
-                    {
-                        /*Codes_SRS_IOTHUBMODULE_17_004: [ `IotHub_Create` shall store the broker. ]*/
-                        result->broker = broker;
-                        /*Codes_SRS_IOTHUBMODULE_02_008: [ Otherwise, `IotHub_Create` shall return a non-`NULL` handle. ]*/
-                    }
-                }
+/*stops the threads of the first laneCount lanes and frees the lanes*/
+static void IOTHUB_LANES_destroy(IOTHUB_LANE* lanes, size_t laneCount)
+{
+    size_t i;
+    for (i = 0; i < laneCount; i++)
+    {
+        int notUsed;
+        if (Lock(lanes[i].lock) != LOCK_OK)
+        {
+            LogError("not able to Lock, still setting the lane to finish");
+            lanes[i].keepRunning = false;
+        }
+        else
+        {
+            lanes[i].keepRunning = false;
+            (void)Unlock(lanes[i].lock);
+        }
+
+        if (ThreadAPI_Join(lanes[i].thread, &notUsed) != THREADAPI_OK)
+        {
+            LogError("unable to ThreadAPI_Join lane %lu, still proceeding", (unsigned long)i);
+        }
+        (void)Lock_Deinit(lanes[i].lock);
+    }
+    free(lanes);
+}
+
+static IOTHUB_LANE* IOTHUB_LANES_create(size_t laneCount)
+{
+    IOTHUB_LANE* result = (IOTHUB_LANE*)malloc(laneCount * sizeof(IOTHUB_LANE));
+    if (result == NULL)
+    {
+        LogError("unable to allocate %lu lanes", (unsigned long)laneCount);
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < laneCount; i++)
+        {
+            result[i].keepRunning = true;
+            result[i].personalities = NULL;
+            if ((result[i].lock = Lock_Init()) == NULL)
+            {
+                LogError("Lock_Init for lane %lu failed", (unsigned long)i);
+                break;
             }
+            else if (ThreadAPI_Create(&(result[i].thread), IOTHUB_LANE_worker, &(result[i])) != THREADAPI_OK)
+            {
+                LogError("ThreadAPI_Create for lane %lu failed", (unsigned long)i);
+                (void)Lock_Deinit(result[i].lock);
+                break;
+            }
+        }
+
+        if (i < laneCount)
+        {
+            IOTHUB_LANES_destroy(result, i);
+            result = NULL;
         }
     }
     return result;
 }
 
-static void IotHub_Destroy(MODULE_HANDLE moduleHandle)
+static int IOTHUB_INFLIGHT_create(IOTHUB_HANDLE_DATA* moduleHandleData, size_t maxInFlight)
 {
-    /*Codes_SRS_IOTHUBMODULE_02_023: [ If `moduleHandle` is `NULL` then `IotHub_Destroy` shall return. ]*/
-    if (moduleHandle == NULL)
+    int result;
+    moduleHandleData->maxInFlight = maxInFlight;
+    moduleHandleData->inFlight = 0;
+    moduleHandleData->inFlightLock = NULL;
+    moduleHandleData->inFlightConfirmed = NULL;
+    if (maxInFlight == 0)
     {
-        LogError("moduleHandle parameter was NULL");
+        /*the messages are sent without a confirmation callback*/
+        result = 0;
+    }
+    else if ((moduleHandleData->inFlightLock = Lock_Init()) == NULL)
+    {
+        LogError("Lock_Init failed");
+        result = __LINE__;
+    }
+    else if ((moduleHandleData->inFlightConfirmed = Condition_Init()) == NULL)
+    {
+        LogError("Condition_Init failed");
+        (void)Lock_Deinit(moduleHandleData->inFlightLock);
+        moduleHandleData->inFlightLock = NULL;
+        result = __LINE__;
     }
     else
     {
-        /*Codes_SRS_IOTHUBMODULE_02_024: [ Otherwise `IotHub_Destroy` shall free all used resources. ]*/
-        IOTHUB_HANDLE_DATA * handleData = moduleHandle;
-        size_t vectorSize = VECTOR_size(handleData->personalities);
-        for (size_t i = 0; i < vectorSize; i++)
+        result = 0;
+    }
+    return result;
+}
+
+static void IOTHUB_INFLIGHT_destroy(IOTHUB_HANDLE_DATA* moduleHandleData)
+{
+    if (moduleHandleData->inFlightLock != NULL)
+    {
+        Condition_Deinit(moduleHandleData->inFlightConfirmed);
+        (void)Lock_Deinit(moduleHandleData->inFlightLock);
+    }
+}
+
+/*waits until fewer than maxInFlight messages are in flight and counts one more*/
+static void IOTHUB_INFLIGHT_acquire(IOTHUB_HANDLE_DATA* moduleHandleData)
+{
+    if (Lock(moduleHandleData->inFlightLock) != LOCK_OK)
+    {
+        LogError("not able to Lock, sending without waiting");
+    }
+    else
+    {
+        COND_RESULT waitResult = COND_OK;
+        while ((moduleHandleData->inFlight >= moduleHandleData->maxInFlight) &&
+            (waitResult == COND_OK))
         {
-            PERSONALITY_PTR* personality = VECTOR_element(handleData->personalities, i);
-            STRING_delete((*personality)->deviceKey);
-            STRING_delete((*personality)->deviceName);
-            IoTHubClient_Destroy((*personality)->iothubHandle);
-            free(*personality);
+            waitResult = Condition_Wait(moduleHandleData->inFlightConfirmed, moduleHandleData->inFlightLock, 0);
         }
-        IoTHubTransport_Destroy(handleData->transportHandle);
-        VECTOR_destroy(handleData->personalities);
-        STRING_delete(handleData->IoTHubName);
-        STRING_delete(handleData->IoTHubSuffix);
-        free(handleData);
+        if (waitResult != COND_OK)
+        {
+            LogError("Condition_Wait failed, sending over the limit of messages in flight");
+        }
+        moduleHandleData->inFlight++;
+        (void)Unlock(moduleHandleData->inFlightLock);
+    }
+}
+
+static void IOTHUB_INFLIGHT_release(IOTHUB_HANDLE_DATA* moduleHandleData)
+{
+    if (Lock(moduleHandleData->inFlightLock) != LOCK_OK)
+    {
+        LogError("not able to Lock, still counting the message out");
+        moduleHandleData->inFlight--;
+        (void)Condition_Post(moduleHandleData->inFlightConfirmed);
+    }
+    else
+    {
+        moduleHandleData->inFlight--;
+        (void)Condition_Post(moduleHandleData->inFlightConfirmed);
+        (void)Unlock(moduleHandleData->inFlightLock);
     }
 }
 
-static bool lookup_DeviceName(const void* element, const void* value)
+/*the spool lock is held*/
+static void IOTHUB_DRAIN_rewind(IOTHUB_HANDLE_DATA* moduleHandleData)
 {
-    return (strcmp(STRING_c_str((*(PERSONALITY_PTR*)element)->deviceName), value) == 0);
+    moduleHandleData->generation++;
+    moduleHandleData->firstSent += moduleHandleData->sentCount;
+    moduleHandleData->sentCount = 0;
+    IotHubSpool_Rewind(moduleHandleData->spool);
 }
 
-static IOTHUBMESSAGE_DISPOSITION_RESULT IotHub_ReceiveMessageCallback(IOTHUB_MESSAGE_HANDLE msg, void* userContextCallback)
+/*the spool lock is held*/
+static void IOTHUB_DRAIN_unreachable(IOTHUB_HANDLE_DATA* moduleHandleData)
 {
-    IOTHUBMESSAGE_DISPOSITION_RESULT result;
-    if (userContextCallback == NULL)
+    if (moduleHandleData->reachable)
     {
-        /*Codes_SRS_IOTHUBMODULE_17_005: [ If `userContextCallback` is `NULL`, then `IotHub_ReceiveMessageCallback` shall return `IOTHUBMESSAGE_ABANDONED`. ]*/
-        LogError("No context to associate message");
-        result = IOTHUBMESSAGE_ABANDONED;
+        LogError("IoT Hub cannot be reached, spooling the messages");
+        moduleHandleData->reachable = false;
+    }
+    moduleHandleData->nextProbe = get_time(NULL) + IOTHUB_DRAIN_RETRY_SECONDS;
+
+    /*Codes_SRS_IOTHUBMODULE_30_035: [ When IoT Hub cannot be reached, the messages of the spool sent and not delivered shall be read again. ]*/
+    IOTHUB_DRAIN_rewind(moduleHandleData);
+}
+
+/*the spool lock is held*/
+static void IOTHUB_DRAIN_delivered(IOTHUB_HANDLE_DATA* moduleHandleData, size_t ticket)
+{
+    IOTHUB_DRAIN_SENT* committed = NULL;
+    moduleHandleData->sent[ticket % IOTHUB_DRAIN_WINDOW].delivered = true;
+
+    /*Codes_SRS_IOTHUBMODULE_30_034: [ A message of the spool shall be committed once it and all the messages read before it are delivered. ]*/
+    while ((moduleHandleData->sentCount != 0) &&
+        (moduleHandleData->sent[moduleHandleData->firstSent % IOTHUB_DRAIN_WINDOW].delivered))
+    {
+        committed = &(moduleHandleData->sent[moduleHandleData->firstSent % IOTHUB_DRAIN_WINDOW]);
+        moduleHandleData->firstSent++;
+        moduleHandleData->sentCount--;
+    }
+    if (committed != NULL)
+    {
+        IotHubSpool_Commit(moduleHandleData->spool, &(committed->position));
+    }
+}
+
+/*the spool lock is held*/
+static void IOTHUB_DRAIN_confirm(IOTHUB_DRAIN_CONFIRMATION* confirmation, IOTHUB_CLIENT_CONFIRMATION_RESULT result)
+{
+    IOTHUB_HANDLE_DATA* moduleHandleData = confirmation->moduleHandleData;
+    if (confirmation->generation != moduleHandleData->generation)
+    {
+        /*sent before the spool was read again, the message has been read again too*/
+    }
+    else if (result == IOTHUB_CLIENT_CONFIRMATION_OK)
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_032: [ IoT Hub shall be considered reachable again when a client reports `IOTHUB_CLIENT_CONNECTION_AUTHENTICATED` or a message of the spool is delivered. ]*/
+        moduleHandleData->reachable = true;
+        IOTHUB_DRAIN_delivered(moduleHandleData, confirmation->ticket);
+    }
+    else if (result != IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY)
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_031: [ IoT Hub shall be considered unreachable when a message is confirmed with `IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT` or `IOTHUB_CLIENT_CONFIRMATION_ERROR`, or when a client reports `IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED` because of `IOTHUB_CLIENT_CONNECTION_NO_NETWORK`, `IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR` or `IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED`. ]*/
+        LogError("a message of the spool was not delivered to IoT Hub, confirmation result %d", (int)result);
+        IOTHUB_DRAIN_unreachable(moduleHandleData);
+    }
+    else if (moduleHandleData->drainKeepRunning)
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_047: [ When a message of the spool is confirmed with `IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY` while the module is not being destroyed, the messages of the spool sent and not delivered shall be read again, IoT Hub still being considered reachable. ]*/
+        /*its device was evicted, the drain would wait for the confirmation forever*/
+        IOTHUB_DRAIN_rewind(moduleHandleData);
     }
     else
     {
-        PERSONALITY_PTR personality = (PERSONALITY_PTR)userContextCallback;
-        IOTHUBMESSAGE_CONTENT_TYPE msgContentType = IoTHubMessage_GetContentType(msg);
-        if (msgContentType == IOTHUBMESSAGE_UNKNOWN)
+        /*the module is being destroyed, the message stays in the spool*/
+    }
+}
+
+/*called by IoTHubClient (or IoTHubClient_LL_DoWork in a lane) once a message of the spool is delivered or given up*/
+static void IotHub_SpoolConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* userContextCallback)
+{
+    IOTHUB_DRAIN_CONFIRMATION* confirmation = (IOTHUB_DRAIN_CONFIRMATION*)userContextCallback;
+    LOCK_HANDLE spoolLock = confirmation->moduleHandleData->spoolLock;
+    if (Lock(spoolLock) != LOCK_OK)
+    {
+        LogError("not able to Lock, still taking the confirmation of a message of the spool");
+        IOTHUB_DRAIN_confirm(confirmation, result);
+    }
+    else
+    {
+        IOTHUB_DRAIN_confirm(confirmation, result);
+        (void)Unlock(spoolLock);
+    }
+    free(confirmation);
+}
+
+static void IotHub_ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* userContextCallback)
+{
+    IOTHUB_HANDLE_DATA* moduleHandleData = (IOTHUB_HANDLE_DATA*)userContextCallback;
+    if ((result != IOTHUB_CLIENT_CONNECTION_AUTHENTICATED) &&
+        (reason != IOTHUB_CLIENT_CONNECTION_NO_NETWORK) &&
+        (reason != IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR) &&
+        (reason != IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED))
+    {
+        /*a problem of the device (its credentials, or it is disabled), not of the uplink*/
+        LogError("a device cannot connect to IoT Hub, reason %d", (int)reason);
+    }
+    else if (Lock(moduleHandleData->spoolLock) != LOCK_OK)
+    {
+        LogError("not able to Lock, the connection status %d is not taken", (int)result);
+    }
+    else
+    {
+        if (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED)
         {
-            /*Codes_SRS_IOTHUBMODULE_17_006: [ If Message Content type is `IOTHUBMESSAGE_UNKNOWN`, then `IotHub_ReceiveMessageCallback` shall return `IOTHUBMESSAGE_ABANDONED`. ]*/
-            LogError("Message content type is unknown");
-            result = IOTHUBMESSAGE_ABANDONED;
+            /*Codes_SRS_IOTHUBMODULE_30_032: [ IoT Hub shall be considered reachable again when a client reports `IOTHUB_CLIENT_CONNECTION_AUTHENTICATED` or a message of the spool is delivered. ]*/
+            moduleHandleData->reachable = true;
         }
         else
         {
-            /* Handle message content */
-            MESSAGE_CONFIG newMessageConfig;
+            /*Codes_SRS_IOTHUBMODULE_30_031: [ IoT Hub shall be considered unreachable when a message is confirmed with `IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT` or `IOTHUB_CLIENT_CONFIRMATION_ERROR`, or when a client reports `IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED` because of `IOTHUB_CLIENT_CONNECTION_NO_NETWORK`, `IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR` or `IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED`. ]*/
+            IOTHUB_DRAIN_unreachable(moduleHandleData);
+        }
+        (void)Unlock(moduleHandleData->spoolLock);
+    }
+}
+
+/*called by IoTHubClient (or IoTHubClient_LL_DoWork in a lane) once a message is delivered or given up*/
+static void IotHub_SendConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* userContextCallback)
+{
+    IOTHUB_HANDLE_DATA* moduleHandleData = (IOTHUB_HANDLE_DATA*)userContextCallback;
+    if (result != IOTHUB_CLIENT_CONFIRMATION_OK)
+    {
+        LogError("a message was not delivered to IoT Hub, confirmation result %d", (int)result);
+    }
+
+    if ((moduleHandleData->spool != NULL) &&
+        ((result == IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT) || (result == IOTHUB_CLIENT_CONFIRMATION_ERROR)))
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_031: [ IoT Hub shall be considered unreachable when a message is confirmed with `IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT` or `IOTHUB_CLIENT_CONFIRMATION_ERROR`, or when a client reports `IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED` because of `IOTHUB_CLIENT_CONNECTION_NO_NETWORK`, `IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR` or `IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED`. ]*/
+        if (Lock(moduleHandleData->spoolLock) != LOCK_OK)
+        {
+            LogError("not able to Lock, the spool does not know that IoT Hub cannot be reached");
+        }
+        else
+        {
+            IOTHUB_DRAIN_unreachable(moduleHandleData);
+            (void)Unlock(moduleHandleData->spoolLock);
+        }
+    }
+
+    if (moduleHandleData->maxInFlight != 0)
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_020: [ When a message is confirmed, whatever the result, it shall not be counted in flight anymore. ]*/
+        IOTHUB_INFLIGHT_release(moduleHandleData);
+    }
+}
+
+static int IOTHUB_DRAIN_worker(void* context);
+
+static int IOTHUB_DRAIN_create(IOTHUB_HANDLE_DATA* moduleHandleData, const IOTHUB_CONFIG* config)
+{
+    int result;
+    IOTHUB_SPOOL_CONFIG spoolConfig;
+    spoolConfig.directory = config->spoolDirectory;
+    spoolConfig.segmentSize = ((config->spoolMaxBytes != 0) && (config->spoolMaxBytes / IOTHUB_DRAIN_SEGMENTS_MIN < IOTHUB_SPOOL_SEGMENT_SIZE_DEFAULT))
+        ? config->spoolMaxBytes / IOTHUB_DRAIN_SEGMENTS_MIN
+        : IOTHUB_SPOOL_SEGMENT_SIZE_DEFAULT;
+    spoolConfig.maxSize = config->spoolMaxBytes;
+    spoolConfig.maxAgeSeconds = config->spoolMaxAgeSeconds;
+
+    moduleHandleData->drainKeepRunning = true;
+    moduleHandleData->reachable = true;
+    moduleHandleData->nextProbe = 0;
+    moduleHandleData->firstSent = 0;
+    moduleHandleData->sentCount = 0;
+    moduleHandleData->generation = 0;
+
+    if ((moduleHandleData->spool = IotHubSpool_Open(&spoolConfig)) == NULL)
+    {
+        LogError("unable to open the spool in %s", config->spoolDirectory);
+        result = __LINE__;
+    }
+    else if ((moduleHandleData->spoolLock = Lock_Init()) == NULL)
+    {
+        LogError("Lock_Init failed");
+        IotHubSpool_Close(moduleHandleData->spool);
+        moduleHandleData->spool = NULL;
+        result = __LINE__;
+    }
+    else if (ThreadAPI_Create(&(moduleHandleData->drainThread), IOTHUB_DRAIN_worker, moduleHandleData) != THREADAPI_OK)
+    {
+        LogError("ThreadAPI_Create for the drain of the spool failed");
+        (void)Lock_Deinit(moduleHandleData->spoolLock);
+        IotHubSpool_Close(moduleHandleData->spool);
+        moduleHandleData->spool = NULL;
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+/*stops the drain thread, the messages it sent can still be confirmed*/
+static void IOTHUB_DRAIN_stop(IOTHUB_HANDLE_DATA* moduleHandleData)
+{
+    int notUsed;
+    if (Lock(moduleHandleData->spoolLock) != LOCK_OK)
+    {
+        LogError("not able to Lock, still setting the drain to finish");
+        moduleHandleData->drainKeepRunning = false;
+    }
+    else
+    {
+        moduleHandleData->drainKeepRunning = false;
+        (void)Unlock(moduleHandleData->spoolLock);
+    }
+
+    if (ThreadAPI_Join(moduleHandleData->drainThread, &notUsed) != THREADAPI_OK)
+    {
+        LogError("unable to ThreadAPI_Join the drain of the spool, still proceeding");
+    }
+}
+
+/*the clients are destroyed, no confirmation can come anymore*/
+static void IOTHUB_DRAIN_destroy(IOTHUB_HANDLE_DATA* moduleHandleData)
+{
+    IotHubSpool_Close(moduleHandleData->spool);
+    (void)Lock_Deinit(moduleHandleData->spoolLock);
+}
+
+static size_t IOTHUB_SHARD_of(const IOTHUB_HANDLE_DATA* moduleHandleData, size_t hash)
+{
+    return (moduleHandleData->shardCount == 0) ? 0 : hash % moduleHandleData->shardCount;
+}
+
+static IOTHUB_CLIENT_RESULT IotHub_SendToDevice(IOTHUB_HANDLE_DATA* moduleHandleData, MESSAGE_HANDLE messageHandle, CONSTMAP_HANDLE properties, const char* deviceName, const char* deviceKey, IOTHUB_DRAIN_CONFIRMATION* spoolConfirmation);
+
+static void IOTHUB_SHARD_send(IOTHUB_SHARD* shard, IOTHUB_SHARD_ITEM* item)
+{
+    /*the message was checked by IotHub_Receive before it was queued*/
+    const char* deviceName = ConstMap_GetValue(item->properties, DEVICENAME);
+    const char* deviceKey = ConstMap_GetValue(item->properties, DEVICEKEY);
+    if (((deviceName == NULL) ||
+        (deviceKey == NULL) ||
+        (IotHub_SendToDevice(shard->module, item->message, item->properties, deviceName, deviceKey, item->spoolConfirmation) != IOTHUB_CLIENT_OK)) &&
+        (item->spoolConfirmation != NULL))
+    {
+        LogError("unable to send a message of the spool");
+        /*as if IoT Hub had not taken it, this frees the confirmation*/
+        IotHub_SpoolConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_ERROR, item->spoolConfirmation);
+    }
+    ConstMap_Destroy(item->properties);
+    Message_Destroy(item->message);
+}
+
+static int IOTHUB_SHARD_worker(void* context)
+{
+    IOTHUB_SHARD* shard = (IOTHUB_SHARD*)context;
+    bool keepRunning = true;
+    while (keepRunning)
+    {
+        IOTHUB_SHARD_ITEM item;
+        bool taken = false;
+        if (Lock(shard->lock) != LOCK_OK)
+        {
+            LogError("not able to Lock, the shard shall retry");
+        }
+        else
+        {
+            /*the messages queued before the shard is stopped are still sent*/
+            if ((shard->count == 0) &&
+                shard->keepRunning &&
+                (Condition_Wait(shard->changed, shard->lock, 0) != COND_OK))
+            {
+                LogError("Condition_Wait failed, the shard shall retry");
+            }
+
+            if (shard->count != 0)
+            {
+                item = shard->queue[shard->first];
+                shard->first = (shard->first + 1) % IOTHUB_SHARD_QUEUE_SIZE;
+                shard->count--;
+                taken = true;
+                (void)Condition_Post(shard->changed);
+            }
+            else
+            {
+                keepRunning = shard->keepRunning;
+            }
+            (void)Unlock(shard->lock);
+        }
+
+        if (taken)
+        {
+            /*Codes_SRS_IOTHUBMODULE_30_042: [ The thread of a shard shall send the messages of its queue in the order they were queued, the way `IotHub_Receive` sends them without shards. ]*/
+            IOTHUB_SHARD_send(shard, &item);
+        }
+        else if (keepRunning)
+        {
+            ThreadAPI_Sleep(IOTHUB_LANE_DOWORK_PERIOD_MS);
+        }
+    }
+    return 0;
+}
+
+/*queues a copy of the message for the thread of the shard*/
+static int IOTHUB_SHARD_push(IOTHUB_SHARD* shard, MESSAGE_HANDLE message, CONSTMAP_HANDLE properties, IOTHUB_DRAIN_CONFIRMATION* spoolConfirmation)
+{
+    int result;
+    if (Lock(shard->lock) != LOCK_OK)
+    {
+        LogError("not able to Lock the shard");
+        result = __LINE__;
+    }
+    else
+    {
+        COND_RESULT waitResult = COND_OK;
+        /*Codes_SRS_IOTHUBMODULE_30_043: [ If the queue of the shard holds `IOTHUB_SHARD_QUEUE_SIZE` messages, `IotHub_Receive` shall wait until the thread of the shard takes one. ]*/
+        while ((shard->count == IOTHUB_SHARD_QUEUE_SIZE) &&
+            (waitResult == COND_OK))
+        {
+            waitResult = Condition_Wait(shard->changed, shard->lock, 0);
+        }
+
+        if (waitResult != COND_OK)
+        {
+            LogError("Condition_Wait failed, the message is not queued");
+            result = __LINE__;
+        }
+        else
+        {
+            IOTHUB_SHARD_ITEM* item = &(shard->queue[(shard->first + shard->count) % IOTHUB_SHARD_QUEUE_SIZE]);
+            if ((item->message = Message_Clone(message)) == NULL)
+            {
+                LogError("unable to Message_Clone");
+                result = __LINE__;
+            }
+            else if ((item->properties = ConstMap_Clone(properties)) == NULL)
+            {
+                LogError("unable to ConstMap_Clone");
+                Message_Destroy(item->message);
+                result = __LINE__;
+            }
+            else
+            {
+                item->spoolConfirmation = spoolConfirmation;
+                shard->count++;
+                (void)Condition_Post(shard->changed);
+                result = 0;
+            }
+        }
+        (void)Unlock(shard->lock);
+    }
+    return result;
+}
+
+/*stops the threads of the first shardCount shards once they sent their queues, and frees the shards*/
+static void IOTHUB_SHARDS_destroy(IOTHUB_SHARD* shards, size_t shardCount)
+{
+    size_t i;
+    for (i = 0; i < shardCount; i++)
+    {
+        int notUsed;
+        if (Lock(shards[i].lock) != LOCK_OK)
+        {
+            LogError("not able to Lock, still setting the shard to finish");
+            shards[i].keepRunning = false;
+            (void)Condition_Post(shards[i].changed);
+        }
+        else
+        {
+            shards[i].keepRunning = false;
+            (void)Condition_Post(shards[i].changed);
+            (void)Unlock(shards[i].lock);
+        }
+
+        if (ThreadAPI_Join(shards[i].thread, &notUsed) != THREADAPI_OK)
+        {
+            LogError("unable to ThreadAPI_Join shard %lu, still proceeding", (unsigned long)i);
+        }
+
+        /*left by a thread that did not finish*/
+        while (shards[i].count != 0)
+        {
+            IOTHUB_SHARD_ITEM* item = &(shards[i].queue[shards[i].first]);
+            if (item->spoolConfirmation != NULL)
+            {
+                /*the message stays in the spool*/
+                IotHub_SpoolConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, item->spoolConfirmation);
+            }
+            ConstMap_Destroy(item->properties);
+            Message_Destroy(item->message);
+            shards[i].first = (shards[i].first + 1) % IOTHUB_SHARD_QUEUE_SIZE;
+            shards[i].count--;
+        }
+        Condition_Deinit(shards[i].changed);
+        (void)Lock_Deinit(shards[i].lock);
+    }
+    free(shards);
+}
+
+static IOTHUB_SHARD* IOTHUB_SHARDS_create(IOTHUB_HANDLE_DATA* moduleHandleData, size_t shardCount)
+{
+    IOTHUB_SHARD* result = (IOTHUB_SHARD*)malloc(shardCount * sizeof(IOTHUB_SHARD));
+    if (result == NULL)
+    {
+        LogError("unable to allocate %lu shards", (unsigned long)shardCount);
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < shardCount; i++)
+        {
+            result[i].module = moduleHandleData;
+            result[i].keepRunning = true;
+            result[i].first = 0;
+            result[i].count = 0;
+            if ((result[i].lock = Lock_Init()) == NULL)
+            {
+                LogError("Lock_Init for shard %lu failed", (unsigned long)i);
+                break;
+            }
+            else if ((result[i].changed = Condition_Init()) == NULL)
+            {
+                LogError("Condition_Init for shard %lu failed", (unsigned long)i);
+                (void)Lock_Deinit(result[i].lock);
+                break;
+            }
+            else if (ThreadAPI_Create(&(result[i].thread), IOTHUB_SHARD_worker, &(result[i])) != THREADAPI_OK)
+            {
+                LogError("ThreadAPI_Create for shard %lu failed", (unsigned long)i);
+                Condition_Deinit(result[i].changed);
+                (void)Lock_Deinit(result[i].lock);
+                break;
+            }
+        }
+
+        if (i < shardCount)
+        {
+            IOTHUB_SHARDS_destroy(result, i);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+static void PERSONALITY_destroy(PERSONALITY* personality)
+{
+    if (personality->lane == NULL)
+    {
+        IoTHubClient_Destroy(personality->iothubHandle);
+    }
+    else
+    {
+        /*out of the lane first, the thread of the lane uses the personality until then*/
+        if (Lock(personality->lane->lock) != LOCK_OK)
+        {
+            LogError("not able to Lock, still taking the device out of its lane");
+            IOTHUB_LANE_remove(personality->lane, personality);
+        }
+        else
+        {
+            IOTHUB_LANE_remove(personality->lane, personality);
+            (void)Unlock(personality->lane->lock);
+        }
+        IoTHubClient_LL_Destroy(personality->iothubLLHandle);
+    }
+    STRING_delete(personality->deviceName);
+    STRING_delete(personality->deviceKey);
+}
+
+static MODULE_HANDLE IotHub_Create(BROKER_HANDLE broker, const void* configuration)
+{
+    IOTHUB_HANDLE_DATA *result;
+    const IOTHUB_CONFIG* config = configuration;
+
+    /*Codes_SRS_IOTHUBMODULE_02_001: [ If `broker` is `NULL` then `IotHub_Create` shall fail and return `NULL`. ]*/
+    /*Codes_SRS_IOTHUBMODULE_02_002: [ If `configuration` is `NULL` then `IotHub_Create` shall fail and return `NULL`. ]*/
+    /*Codes_SRS_IOTHUBMODULE_02_003: [ If `configuration->IoTHubName` is `NULL` then `IotHub_Create` shall and return `NULL`. ]*/
+    /*Codes_SRS_IOTHUBMODULE_02_004: [ If `configuration->IoTHubSuffix` is `NULL` then `IotHub_Create` shall fail and return `NULL`. ]*/
+    if (
+        (broker == NULL) ||
+        (configuration == NULL)
+        )
+    {
+        LogError("invalid arg broker=%p, configuration=%p", broker, configuration);
+        result = NULL;
+    }
+    else if (
+        (config->IoTHubName == NULL) ||
+        (config->IoTHubSuffix == NULL) ||
+        (config->transportProvider == NULL)
+        )
+    {
+        LogError("invalid configuration IoTHubName=%s IoTHubSuffix=%s transportProvider=%p",
+            (config != NULL) ? config->IoTHubName : "<null>",
+            (config != NULL) ? config->IoTHubSuffix : "<null>",
+            (config != NULL) ? config->transportProvider : 0);
+        result = NULL;
+    }
+    else
+    {
+        result = malloc(sizeof(IOTHUB_HANDLE_DATA));
+        /*Codes_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
+        if (result == NULL)
+        {
+            LogError("malloc returned NULL");
+            /*return as is*/
+        }
+        else
+        {
+            /*Codes_SRS_IOTHUBMODULE_02_006: [ `IotHub_Create` shall create an empty `VECTOR` containing pointers to `PERSONALITY`s. ]*/
+            result->personalities = VECTOR_create(sizeof(PERSONALITY_PTR));
+            if (result->personalities == NULL)
+            {
+                /*Codes_SRS_IOTHUBMODULE_02_007: [ If creating the personality vector fails then `IotHub_Create` shall fail and return `NULL`. ]*/
+                free(result);
+                result = NULL;
+                LogError("VECTOR_create returned NULL");
+            }
+            /*Codes_SRS_IOTHUBMODULE_30_003: [ `IotHub_Create` shall create an empty index of the personalities by device ID. ]*/
+            else if ((result->index.slots = (PERSONALITY_PTR*)malloc(PERSONALITY_INDEX_INITIAL_SIZE * sizeof(PERSONALITY_PTR))) == NULL)
+            {
+                /*Codes_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
+                VECTOR_destroy(result->personalities);
+                free(result);
+                result = NULL;
+                LogError("unable to allocate the personality index");
+            }
+            else
+            {
+                memset(result->index.slots, 0, PERSONALITY_INDEX_INITIAL_SIZE * sizeof(PERSONALITY_PTR));
+                result->index.mask = PERSONALITY_INDEX_INITIAL_SIZE - 1;
+                result->index.used = 0;
+                result->index.count = 0;
+                memset(&(result->previousIndex), 0, sizeof(PERSONALITY_INDEX));
+                result->previousIndexPosition = 0;
+                result->mostRecentlyUsed = NULL;
+                result->leastRecentlyUsed = NULL;
+                /*Codes_SRS_IOTHUBMODULE_30_004: [ `IotHub_Create` shall store `configuration->maxDevices` and `configuration->deviceIdleSeconds`. ]*/
+                result->maxDevices = config->maxDevices;
+                result->deviceIdleSeconds = config->deviceIdleSeconds;
+                result->lanes = NULL;
+                result->laneCount = 0;
+                result->spool = NULL;
+                result->spoolLock = NULL;
+                result->receiveLock = NULL;
+                result->shards = NULL;
+                result->shardCount = 0;
+
+                result->transportProvider = config->transportProvider;
+                if (result->transportProvider == HTTP_Protocol ||
+                    result->transportProvider == AMQP_Protocol)
+                {
+                    /*Codes_SRS_IOTHUBMODULE_17_001: [ If `configuration->transportProvider` is `HTTP_Protocol` or `AMQP_Protocol`, `IotHub_Create` shall create a shared transport by calling `IoTHubTransport_Create`. ]*/
+                    result->transportHandle = IoTHubTransport_Create(config->transportProvider, config->IoTHubName, config->IoTHubSuffix);
+                    if (result->transportHandle == NULL)
+                    {
+                        /*Codes_SRS_IOTHUBMODULE_17_002: [ If creating the shared transport fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+                        free(result->index.slots);
+                        VECTOR_destroy(result->personalities);
+                        free(result);
+                        result = NULL;
+                        LogError("VECTOR_create returned NULL");
+                    }
+                }
+                else
+                {
+                    result->transportHandle = NULL;
+                }
+
+                if (result != NULL)
+                {
+                    /*Codes_SRS_IOTHUBMODULE_02_028: [ `IotHub_Create` shall create a copy of `configuration->IoTHubName`. ]*/
+                    /*Codes_SRS_IOTHUBMODULE_02_029: [ `IotHub_Create` shall create a copy of `configuration->IoTHubSuffix`. ]*/
+                    if ((result->IoTHubName = STRING_construct(config->IoTHubName)) == NULL)
+                    {
+                        LogError("STRING_construct returned NULL");
+                        IoTHubTransport_Destroy(result->transportHandle);
+                        free(result->index.slots);
+                        VECTOR_destroy(result->personalities);
+                        free(result);
+                        result = NULL;
+                    }
+                    else if ((result->IoTHubSuffix = STRING_construct(config->IoTHubSuffix)) == NULL)
+                    {
+                        LogError("STRING_construct returned NULL");
+                        STRING_delete(result->IoTHubName);
+                        IoTHubTransport_Destroy(result->transportHandle);
+                        free(result->index.slots);
+                        VECTOR_destroy(result->personalities);
+                        free(result);
+                        result = NULL;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_IOTHUBMODULE_17_004: [ `IotHub_Create` shall store the broker. ]*/
+                        result->broker = broker;
+                        result->batching = config->batching;
+
+                        /*Codes_SRS_IOTHUBMODULE_30_018: [ If `configuration->maxInFlight` is not 0, `IotHub_Create` shall create a lock and a condition to count the messages in flight. ]*/
+                        if (IOTHUB_INFLIGHT_create(result, config->maxInFlight) != 0)
+                        {
+                            /*Codes_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
+                            LogError("unable to count the messages in flight");
+                            STRING_delete(result->IoTHubSuffix);
+                            STRING_delete(result->IoTHubName);
+                            IoTHubTransport_Destroy(result->transportHandle);
+                            free(result->index.slots);
+                            VECTOR_destroy(result->personalities);
+                            free(result);
+                            result = NULL;
+                        }
+                        else if ((result->transportProvider == MQTT_Protocol) &&
+                            (config->mqttPoolSize != 0))
+                        {
+                            /*Codes_SRS_IOTHUBMODULE_30_010: [ If `configuration->transportProvider` is `MQTT_Protocol` and `configuration->mqttPoolSize` is not 0, `IotHub_Create` shall start `mqttPoolSize` lanes, each with a lock and a thread. ]*/
+                            result->laneCount = config->mqttPoolSize;
+                            if ((result->lanes = IOTHUB_LANES_create(result->laneCount)) == NULL)
+                            {
+                                /*Codes_SRS_IOTHUBMODULE_30_011: [ If starting the lanes fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+                                LogError("unable to start %lu lanes", (unsigned long)config->mqttPoolSize);
+                                IOTHUB_INFLIGHT_destroy(result);
+                                STRING_delete(result->IoTHubSuffix);
+                                STRING_delete(result->IoTHubName);
+                                IoTHubTransport_Destroy(result->transportHandle);
+                                free(result->index.slots);
+                                VECTOR_destroy(result->personalities);
+                                free(result);
+                                result = NULL;
+                            }
+                        }
+
+                        if ((result != NULL) &&
+                            ((config->spoolDirectory != NULL) || (config->shards != 0)) &&
+                            ((result->receiveLock = Lock_Init()) == NULL))
+                        {
+                            /*Codes_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
+                            LogError("Lock_Init failed");
+                            if (result->lanes != NULL)
+                            {
+                                IOTHUB_LANES_destroy(result->lanes, result->laneCount);
+                            }
+                            IOTHUB_INFLIGHT_destroy(result);
+                            STRING_delete(result->IoTHubSuffix);
+                            STRING_delete(result->IoTHubName);
+                            IoTHubTransport_Destroy(result->transportHandle);
+                            free(result->index.slots);
+                            VECTOR_destroy(result->personalities);
+                            free(result);
+                            result = NULL;
+                        }
+
+                        if ((result != NULL) &&
+                            (config->shards != 0))
+                        {
+                            /*Codes_SRS_IOTHUBMODULE_30_039: [ If `configuration->shards` is not 0, `IotHub_Create` shall start `shards` shards, each with a lock, a condition and a thread. ]*/
+                            result->shardCount = config->shards;
+                            if ((result->shards = IOTHUB_SHARDS_create(result, result->shardCount)) == NULL)
+                            {
+                                /*Codes_SRS_IOTHUBMODULE_30_040: [ If starting the shards fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+                                LogError("unable to start %lu shards", (unsigned long)config->shards);
+                                (void)Lock_Deinit(result->receiveLock);
+                                if (result->lanes != NULL)
+                                {
+                                    IOTHUB_LANES_destroy(result->lanes, result->laneCount);
+                                }
+                                IOTHUB_INFLIGHT_destroy(result);
+                                STRING_delete(result->IoTHubSuffix);
+                                STRING_delete(result->IoTHubName);
+                                IoTHubTransport_Destroy(result->transportHandle);
+                                free(result->index.slots);
+                                VECTOR_destroy(result->personalities);
+                                free(result);
+                                result = NULL;
+                            }
+                        }
+
+                        /*Codes_SRS_IOTHUBMODULE_30_026: [ If `configuration->spoolDirectory` is not NULL, `IotHub_Create` shall open the spool in it by calling `IotHubSpool_Open` and start a thread that drains it. ]*/
+                        if ((result != NULL) &&
+                            (config->spoolDirectory != NULL) &&
+                            (IOTHUB_DRAIN_create(result, config) != 0))
+                        {
+                            /*Codes_SRS_IOTHUBMODULE_30_027: [ If opening the spool or starting its thread fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+                            LogError("unable to spool the messages in %s", config->spoolDirectory);
+                            if (result->shards != NULL)
+                            {
+                                IOTHUB_SHARDS_destroy(result->shards, result->shardCount);
+                            }
+                            (void)Lock_Deinit(result->receiveLock);
+                            if (result->lanes != NULL)
+                            {
+                                IOTHUB_LANES_destroy(result->lanes, result->laneCount);
+                            }
+                            IOTHUB_INFLIGHT_destroy(result);
+                            STRING_delete(result->IoTHubSuffix);
+                            STRING_delete(result->IoTHubName);
+                            IoTHubTransport_Destroy(result->transportHandle);
+                            free(result->index.slots);
+                            VECTOR_destroy(result->personalities);
+                            free(result);
+                            result = NULL;
+                        }
+                        /*Codes_SRS_IOTHUBMODULE_02_008: [ Otherwise, `IotHub_Create` shall return a non-`NULL` handle. ]*/
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+static void IotHub_Destroy(MODULE_HANDLE moduleHandle)
+{
+    /*Codes_SRS_IOTHUBMODULE_02_023: [ If `moduleHandle` is `NULL` then `IotHub_Destroy` shall return. ]*/
+    if (moduleHandle == NULL)
+    {
+        LogError("moduleHandle parameter was NULL");
+    }
+    else
+    {
+        /*Codes_SRS_IOTHUBMODULE_02_024: [ Otherwise `IotHub_Destroy` shall free all used resources. ]*/
+        IOTHUB_HANDLE_DATA * handleData = moduleHandle;
+        size_t vectorSize;
+        if (handleData->spool != NULL)
+        {
+            /*Codes_SRS_IOTHUBMODULE_30_036: [ `IotHub_Destroy` shall stop the thread draining the spool before destroying the personalities, then close the spool. ]*/
+            IOTHUB_DRAIN_stop(handleData);
+        }
+        if (handleData->shards != NULL)
+        {
+            /*Codes_SRS_IOTHUBMODULE_30_045: [ `IotHub_Destroy` shall stop the shards once they sent the messages of their queues, before destroying the personalities. ]*/
+            IOTHUB_SHARDS_destroy(handleData->shards, handleData->shardCount);
+        }
+        vectorSize = VECTOR_size(handleData->personalities);
+        for (size_t i = 0; i < vectorSize; i++)
+        {
+            PERSONALITY_PTR* personality = VECTOR_element(handleData->personalities, i);
+            PERSONALITY_destroy(*personality);
+            free(*personality);
+        }
+        if (handleData->lanes != NULL)
+        {
+            IOTHUB_LANES_destroy(handleData->lanes, handleData->laneCount);
+        }
+        /*the clients are gone, and so are the confirmations they owed*/
+        IOTHUB_INFLIGHT_destroy(handleData);
+        if (handleData->spool != NULL)
+        {
+            IOTHUB_DRAIN_destroy(handleData);
+        }
+        if (handleData->receiveLock != NULL)
+        {
+            (void)Lock_Deinit(handleData->receiveLock);
+        }
+        IoTHubTransport_Destroy(handleData->transportHandle);
+        VECTOR_destroy(handleData->personalities);
+        free(handleData->index.slots);
+        if (handleData->previousIndex.slots != NULL)
+        {
+            free(handleData->previousIndex.slots);
+        }
+        STRING_delete(handleData->IoTHubName);
+        STRING_delete(handleData->IoTHubSuffix);
+        free(handleData);
+    }
+}
+
+static IOTHUBMESSAGE_DISPOSITION_RESULT IotHub_ReceiveMessageCallback(IOTHUB_MESSAGE_HANDLE msg, void* userContextCallback)
+{
+    IOTHUBMESSAGE_DISPOSITION_RESULT result;
+    if (userContextCallback == NULL)
+    {
+        /*Codes_SRS_IOTHUBMODULE_17_005: [ If `userContextCallback` is `NULL`, then `IotHub_ReceiveMessageCallback` shall return `IOTHUBMESSAGE_ABANDONED`. ]*/
+        LogError("No context to associate message");
+        result = IOTHUBMESSAGE_ABANDONED;
+    }
+    else
+    {
+        PERSONALITY_PTR personality = (PERSONALITY_PTR)userContextCallback;
+        IOTHUBMESSAGE_CONTENT_TYPE msgContentType = IoTHubMessage_GetContentType(msg);
+        if (msgContentType == IOTHUBMESSAGE_UNKNOWN)
+        {
+            /*Codes_SRS_IOTHUBMODULE_17_006: [ If Message Content type is `IOTHUBMESSAGE_UNKNOWN`, then `IotHub_ReceiveMessageCallback` shall return `IOTHUBMESSAGE_ABANDONED`. ]*/
+            LogError("Message content type is unknown");
+            result = IOTHUBMESSAGE_ABANDONED;
+        }
+        else
+        {
+            /* Handle message content */
+            MESSAGE_CONFIG newMessageConfig;
             IOTHUB_MESSAGE_RESULT msgResult;
             if (msgContentType == IOTHUBMESSAGE_STRING)
             {
@@ -443,95 +1494,429 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT IotHub_ReceiveMessageCallback(IOTHUB_MES
     return result;
 }
 
-/*returns non-null if PERSONALITY has been properly populated*/
-static PERSONALITY_PTR PERSONALITY_create(const char* deviceName, const char* deviceKey, IOTHUB_HANDLE_DATA* moduleHandleData)
+/*returns non-null if PERSONALITY has been properly populated*/
+static PERSONALITY_PTR PERSONALITY_create(const char* deviceName, size_t hash, const char* deviceKey, IOTHUB_HANDLE_DATA* moduleHandleData)
+{
+    PERSONALITY_PTR result = (PERSONALITY_PTR)malloc(sizeof(PERSONALITY));
+    if (result == NULL)
+    {
+        LogError("unable to allocate a personality for the device %s", deviceName);
+    }
+    else
+    {
+        if ((result->deviceName = STRING_construct(deviceName)) == NULL)
+        {
+            LogError("unable to STRING_construct");
+            free(result);
+            result = NULL;
+        }
+        else if ((result->deviceKey = STRING_construct(deviceKey)) == NULL)
+        {
+            LogError("unable to STRING_construct");
+            STRING_delete(result->deviceName);
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            IOTHUB_CLIENT_CONFIG temp;
+            temp.protocol = moduleHandleData->transportProvider;
+            temp.deviceId = deviceName;
+            temp.deviceKey = deviceKey;
+            temp.deviceSasToken = NULL;
+            temp.iotHubName = STRING_c_str(moduleHandleData->IoTHubName);
+            temp.iotHubSuffix = STRING_c_str(moduleHandleData->IoTHubSuffix);
+            temp.protocolGatewayHostName = NULL;
+
+            result->hash = hash;
+            result->shard = IOTHUB_SHARD_of(moduleHandleData, hash);
+            result->broker = moduleHandleData->broker;
+            result->module = moduleHandleData;
+
+            if (moduleHandleData->lanes != NULL)
+            {
+                /*Codes_SRS_IOTHUBMODULE_30_012: [ If the module has lanes, the new personality shall go to the lane picked by the hash of its device ID and an `IOTHUB_CLIENT_LL_HANDLE` will be added to it by a call to `IoTHubClient_LL_Create`. ]*/
+                result->lane = &(moduleHandleData->lanes[hash % moduleHandleData->laneCount]);
+                result->iothubHandle = NULL;
+                if ((result->iothubLLHandle = IoTHubClient_LL_Create(&temp)) == NULL)
+                {
+                    LogError("unable to create IoTHubClient_LL");
+                    STRING_delete(result->deviceName);
+                    STRING_delete(result->deviceKey);
+                    free(result);
+                    result = NULL;
+                }
+                /*Codes_SRS_IOTHUBMODULE_30_013: [ The IoTHubClient_LL of a personality in a lane shall be set to receive messages by calling `IoTHubClient_LL_SetMessageCallback` with callback function `IotHub_ReceiveMessageCallback`, and the personality as context. ]*/
+                else if (IoTHubClient_LL_SetMessageCallback(result->iothubLLHandle, IotHub_ReceiveMessageCallback, result) != IOTHUB_CLIENT_OK)
+                {
+                    LogError("unable to IoTHubClient_LL_SetMessageCallback");
+                    IoTHubClient_LL_Destroy(result->iothubLLHandle);
+                    STRING_delete(result->deviceName);
+                    STRING_delete(result->deviceKey);
+                    free(result);
+                    result = NULL;
+                }
+                else if (Lock(result->lane->lock) != LOCK_OK)
+                {
+                    LogError("not able to Lock the lane of the device %s", deviceName);
+                    IoTHubClient_LL_Destroy(result->iothubLLHandle);
+                    STRING_delete(result->deviceName);
+                    STRING_delete(result->deviceKey);
+                    free(result);
+                    result = NULL;
+                }
+                else
+                {
+                    if ((moduleHandleData->spool != NULL) &&
+                        (IoTHubClient_LL_SetConnectionStatusCallback(result->iothubLLHandle, IotHub_ConnectionStatusCallback, moduleHandleData) != IOTHUB_CLIENT_OK))
+                    {
+                        /*Codes_SRS_IOTHUBMODULE_30_030: [ If the module has a spool, a new IoTHubClient shall be given `IotHub_ConnectionStatusCallback` by a call to `IoTHubClient_SetConnectionStatusCallback` (`IoTHubClient_LL_SetConnectionStatusCallback` in a lane); if that fails the personality shall be created anyway. ]*/
+                        LogError("unable to IoTHubClient_LL_SetConnectionStatusCallback, only failed messages tell that IoT Hub cannot be reached");
+                    }
+                    /*from now on the thread of the lane calls IoTHubClient_LL_DoWork for the device*/
+                    IOTHUB_LANE_add(result->lane, result);
+                    (void)Unlock(result->lane->lock);
+                }
+            }
+            else
+            {
+                result->lane = NULL;
+                result->iothubLLHandle = NULL;
+
+                /*Codes_SRS_IOTHUBMODULE_05_013: [ If a new personality is created and the module's transport has already been created (in `IotHub_Create`), an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_CreateWithTransport`. ]*/
+                /*Codes_SRS_IOTHUBMODULE_05_003: [ If a new personality is created and the module's transport has not already been created, an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_Create` with the corresponding transport provider. ]*/
+                result->iothubHandle = (moduleHandleData->transportHandle != NULL)
+                    ? IoTHubClient_CreateWithTransport(moduleHandleData->transportHandle, &temp)
+                    : IoTHubClient_Create(&temp);
+
+                if (result->iothubHandle == NULL)
+                {
+                    LogError("unable to create IoTHubClient");
+                    STRING_delete(result->deviceName);
+                    STRING_delete(result->deviceKey);
+                    free(result);
+                    result = NULL;
+                }
+                else
+                {
+                    /*Codes_SRS_IOTHUBMODULE_17_003: [ If a new personality is created, then the associated IoTHubClient will be set to receive messages by calling `IoTHubClient_SetMessageCallback` with callback function `IotHub_ReceiveMessageCallback`, and the personality as context. ]*/
+                    if (IoTHubClient_SetMessageCallback(result->iothubHandle, IotHub_ReceiveMessageCallback, result) != IOTHUB_CLIENT_OK)
+                    {
+                        LogError("unable to IoTHubClient_SetMessageCallback");
+                        IoTHubClient_Destroy(result->iothubHandle);
+                        STRING_delete(result->deviceName);
+                        STRING_delete(result->deviceKey);
+                        free(result);
+                        result = NULL;
+                    }
+                    else
+                    {
+                        if ((moduleHandleData->batching) &&
+                            (moduleHandleData->transportProvider == HTTP_Protocol))
+                        {
+                            /*Codes_SRS_IOTHUBMODULE_30_019: [ If `batching` is set and the transport is `HTTP_Protocol`, the new IoTHubClient shall be given the option "Batching" by a call to `IoTHubClient_SetOption`; if that fails the personality shall be created anyway. ]*/
+                            bool batching = true;
+                            if (IoTHubClient_SetOption(result->iothubHandle, BATCHING, &batching) != IOTHUB_CLIENT_OK)
+                            {
+                                LogError("unable to IoTHubClient_SetOption %s, the device %s sends one message per request", BATCHING, deviceName);
+                            }
+                        }
+                        if ((moduleHandleData->spool != NULL) &&
+                            (IoTHubClient_SetConnectionStatusCallback(result->iothubHandle, IotHub_ConnectionStatusCallback, moduleHandleData) != IOTHUB_CLIENT_OK))
+                        {
+                            /*Codes_SRS_IOTHUBMODULE_30_030: [ If the module has a spool, a new IoTHubClient shall be given `IotHub_ConnectionStatusCallback` by a call to `IoTHubClient_SetConnectionStatusCallback` (`IoTHubClient_LL_SetConnectionStatusCallback` in a lane); if that fails the personality shall be created anyway. ]*/
+                            LogError("unable to IoTHubClient_SetConnectionStatusCallback, only failed messages tell that IoT Hub cannot be reached");
+                        }
+                        /*it is all fine*/
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/*FNV-1a*/
+static size_t PERSONALITY_hash(const char* deviceName)
+{
+    size_t result = (size_t)2166136261u;
+    while (*deviceName != '\0')
+    {
+        result = (result ^ (unsigned char)*deviceName++) * (size_t)16777619u;
+    }
+    return result;
+}
+
+/*returns the slot of the personality or NULL*/
+static PERSONALITY_PTR* PERSONALITY_INDEX_find(const PERSONALITY_INDEX* index, const char* deviceName, size_t hash)
+{
+    PERSONALITY_PTR* result = NULL;
+    if (index->slots != NULL)
+    {
+        size_t i = hash & index->mask;
+        while (index->slots[i] != NULL)
+        {
+            if ((index->slots[i] != PERSONALITY_INDEX_TOMBSTONE) &&
+                (index->slots[i]->hash == hash) &&
+                (strcmp(STRING_c_str(index->slots[i]->deviceName), deviceName) == 0))
+            {
+                result = &(index->slots[i]);
+                break;
+            }
+            i = (i + 1) & index->mask;
+        }
+    }
+    return result;
+}
+
+/*the index has to have a free slot*/
+static void PERSONALITY_INDEX_insert(PERSONALITY_INDEX* index, PERSONALITY_PTR personality)
 {
-    PERSONALITY_PTR result = (PERSONALITY_PTR)malloc(sizeof(PERSONALITY));
-    if (result == NULL)
+    size_t i = personality->hash & index->mask;
+    while ((index->slots[i] != NULL) && (index->slots[i] != PERSONALITY_INDEX_TOMBSTONE))
     {
-        LogError("unable to allocate a personality for the device %s", deviceName);
+        i = (i + 1) & index->mask;
+    }
+    if (index->slots[i] == NULL)
+    {
+        index->used++;
+    }
+    index->slots[i] = personality;
+    index->count++;
+}
+
+/*moves up to PERSONALITY_INDEX_MOVE_STEP slots of the previous index, all of them if step is 0*/
+static void PERSONALITY_INDEX_move(IOTHUB_HANDLE_DATA* moduleHandleData, size_t step)
+{
+    PERSONALITY_INDEX* previousIndex = &(moduleHandleData->previousIndex);
+    if (previousIndex->slots != NULL)
+    {
+        size_t moved = 0;
+        while ((moduleHandleData->previousIndexPosition <= previousIndex->mask) &&
+            ((step == 0) || (moved < step)))
+        {
+            PERSONALITY_PTR* slot = &(previousIndex->slots[moduleHandleData->previousIndexPosition]);
+            if ((*slot != NULL) && (*slot != PERSONALITY_INDEX_TOMBSTONE))
+            {
+                PERSONALITY_INDEX_insert(&(moduleHandleData->index), *slot);
+                /*a tombstone keeps the probe sequences of the slots not moved yet*/
+                *slot = PERSONALITY_INDEX_TOMBSTONE;
+                previousIndex->count--;
+            }
+            moduleHandleData->previousIndexPosition++;
+            moved++;
+        }
+
+        if (moduleHandleData->previousIndexPosition > previousIndex->mask)
+        {
+            free(previousIndex->slots);
+            memset(previousIndex, 0, sizeof(PERSONALITY_INDEX));
+            moduleHandleData->previousIndexPosition = 0;
+        }
+    }
+}
+
+/*makes room in the index for one more personality. Growing allocates the new
+slots and leaves the personalities in the previous ones, they are moved a few
+at a time by the next insertions so that no insertion pays for a full rehash.*/
+static int PERSONALITY_INDEX_reserve(IOTHUB_HANDLE_DATA* moduleHandleData)
+{
+    int result;
+    PERSONALITY_INDEX* index = &(moduleHandleData->index);
+
+    /*the previous index moves in here, keep the load under one half*/
+    if ((index->used + moduleHandleData->previousIndex.count + 1) * 2 < index->mask + 1)
+    {
+        result = 0;
     }
     else
     {
-        if ((result->deviceName = STRING_construct(deviceName)) == NULL)
+        size_t count;
+        size_t size = PERSONALITY_INDEX_INITIAL_SIZE;
+        PERSONALITY_PTR* slots;
+
+        /*a growth is over long before the next one, unless tombstones filled the index*/
+        PERSONALITY_INDEX_move(moduleHandleData, 0);
+
+        count = index->count + 1;
+        while (size < count * 4)
         {
-            LogError("unable to STRING_construct");
-            free(result);
-            result = NULL;
+            size *= 2;
         }
-        else if ((result->deviceKey = STRING_construct(deviceKey)) == NULL)
+
+        if ((slots = (PERSONALITY_PTR*)malloc(size * sizeof(PERSONALITY_PTR))) == NULL)
         {
-            LogError("unable to STRING_construct");
-            STRING_delete(result->deviceName);
-            free(result);
-            result = NULL;
+            LogError("unable to grow the personality index to %lu slots", (unsigned long)size);
+            result = __LINE__;
         }
         else
         {
-            IOTHUB_CLIENT_CONFIG temp;
-            temp.protocol = moduleHandleData->transportProvider;
-            temp.deviceId = deviceName;
-            temp.deviceKey = deviceKey;
-            temp.deviceSasToken = NULL;
-            temp.iotHubName = STRING_c_str(moduleHandleData->IoTHubName);
-            temp.iotHubSuffix = STRING_c_str(moduleHandleData->IoTHubSuffix);
-            temp.protocolGatewayHostName = NULL;
+            memset(slots, 0, size * sizeof(PERSONALITY_PTR));
+            moduleHandleData->previousIndex = *index;
+            moduleHandleData->previousIndexPosition = 0;
+            index->slots = slots;
+            index->mask = size - 1;
+            index->used = 0;
+            index->count = 0;
+            result = 0;
+        }
+    }
+    return result;
+}
 
-            /*Codes_SRS_IOTHUBMODULE_05_013: [ If a new personality is created and the module's transport has already been created (in `IotHub_Create`), an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_CreateWithTransport`. ]*/
-            /*Codes_SRS_IOTHUBMODULE_05_003: [ If a new personality is created and the module's transport has not already been created, an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_Create` with the corresponding transport provider. ]*/
-            result->iothubHandle = (moduleHandleData->transportHandle != NULL)
-                ? IoTHubClient_CreateWithTransport(moduleHandleData->transportHandle, &temp)
-                : IoTHubClient_Create(&temp);
+static void PERSONALITY_touch(IOTHUB_HANDLE_DATA* moduleHandleData, PERSONALITY_PTR personality, time_t now)
+{
+    personality->lastUsed = now;
+    if (moduleHandleData->mostRecentlyUsed != personality)
+    {
+        /*unlink*/
+        if (personality->moreRecentlyUsed != NULL)
+        {
+            personality->moreRecentlyUsed->lessRecentlyUsed = personality->lessRecentlyUsed;
+        }
+        if (personality->lessRecentlyUsed != NULL)
+        {
+            personality->lessRecentlyUsed->moreRecentlyUsed = personality->moreRecentlyUsed;
+        }
+        else if (moduleHandleData->leastRecentlyUsed == personality)
+        {
+            moduleHandleData->leastRecentlyUsed = personality->moreRecentlyUsed;
+        }
 
-            if (result->iothubHandle == NULL)
-            {
-                LogError("unable to create IoTHubClient");
-                STRING_delete(result->deviceName);
-                STRING_delete(result->deviceKey);
-                free(result);
-                result = NULL;
-            }
-            else
-            {
-                /*Codes_SRS_IOTHUBMODULE_17_003: [ If a new personality is created, then the associated IoTHubClient will be set to receive messages by calling `IoTHubClient_SetMessageCallback` with callback function `IotHub_ReceiveMessageCallback`, and the personality as context. ]*/
-                if (IoTHubClient_SetMessageCallback(result->iothubHandle, IotHub_ReceiveMessageCallback, result) != IOTHUB_CLIENT_OK)
-                {
-                    LogError("unable to IoTHubClient_SetMessageCallback");
-                    IoTHubClient_Destroy(result->iothubHandle);
-                    STRING_delete(result->deviceName);
-                    STRING_delete(result->deviceKey);
-                    free(result);
-                    result = NULL;
-                }
-                else
-                {
-                    /*it is all fine*/
-                    result->broker = moduleHandleData->broker;
-                    result->module = moduleHandleData;
-                }
-            }
+        /*and put in front*/
+        personality->moreRecentlyUsed = NULL;
+        personality->lessRecentlyUsed = moduleHandleData->mostRecentlyUsed;
+        if (moduleHandleData->mostRecentlyUsed != NULL)
+        {
+            moduleHandleData->mostRecentlyUsed->moreRecentlyUsed = personality;
+        }
+        moduleHandleData->mostRecentlyUsed = personality;
+        if (moduleHandleData->leastRecentlyUsed == NULL)
+        {
+            moduleHandleData->leastRecentlyUsed = personality;
         }
     }
-    return result;
 }
 
-static void PERSONALITY_destroy(PERSONALITY* personality)
+/*removes the personality from the index, the LRU list and the vector, then destroys it*/
+static void PERSONALITY_evict(IOTHUB_HANDLE_DATA* moduleHandleData, PERSONALITY_PTR personality)
 {
-    STRING_delete(personality->deviceName);
-    STRING_delete(personality->deviceKey);
-    IoTHubClient_Destroy(personality->iothubHandle);
+    PERSONALITY_PTR* slot;
+    PERSONALITY_PTR* vectorSlot;
+    PERSONALITY_PTR* lastVectorSlot;
+    const char* deviceName = STRING_c_str(personality->deviceName);
+
+    if ((slot = PERSONALITY_INDEX_find(&(moduleHandleData->index), deviceName, personality->hash)) != NULL)
+    {
+        *slot = PERSONALITY_INDEX_TOMBSTONE;
+        moduleHandleData->index.count--;
+    }
+    else if ((slot = PERSONALITY_INDEX_find(&(moduleHandleData->previousIndex), deviceName, personality->hash)) != NULL)
+    {
+        *slot = PERSONALITY_INDEX_TOMBSTONE;
+        moduleHandleData->previousIndex.count--;
+    }
+
+    if (personality->moreRecentlyUsed != NULL)
+    {
+        personality->moreRecentlyUsed->lessRecentlyUsed = personality->lessRecentlyUsed;
+    }
+    else
+    {
+        moduleHandleData->mostRecentlyUsed = personality->lessRecentlyUsed;
+    }
+    if (personality->lessRecentlyUsed != NULL)
+    {
+        personality->lessRecentlyUsed->moreRecentlyUsed = personality->moreRecentlyUsed;
+    }
+    else
+    {
+        moduleHandleData->leastRecentlyUsed = personality->moreRecentlyUsed;
+    }
+
+    /*the last personality of the vector takes the place of the evicted one*/
+    vectorSlot = (PERSONALITY_PTR*)VECTOR_element(moduleHandleData->personalities, personality->vectorIndex);
+    lastVectorSlot = (PERSONALITY_PTR*)VECTOR_back(moduleHandleData->personalities);
+    if (vectorSlot != lastVectorSlot)
+    {
+        *vectorSlot = *lastVectorSlot;
+        (*vectorSlot)->vectorIndex = personality->vectorIndex;
+    }
+    VECTOR_erase(moduleHandleData->personalities, lastVectorSlot, 1);
+
+    LogInfo("evicting the personality of the device %s", deviceName);
+    PERSONALITY_destroy(personality);
+    free(personality);
 }
 
 static PERSONALITY* PERSONALITY_find_or_create(IOTHUB_HANDLE_DATA* moduleHandleData, const char* deviceName, const char* deviceKey)
 {
     /*Codes_SRS_IOTHUBMODULE_02_017: [ Otherwise `IotHub_Receive` shall not create a new personality. ]*/
     PERSONALITY* result;
-    PERSONALITY_PTR* resultPtr = VECTOR_find_if(moduleHandleData->personalities, lookup_DeviceName, deviceName);
+    size_t hash = PERSONALITY_hash(deviceName);
+    /*Codes_SRS_IOTHUBMODULE_30_044: [ With shards, `IotHub_Receive` shall only destroy the personalities of the shard of the device. ]*/
+    size_t shard = IOTHUB_SHARD_of(moduleHandleData, hash);
+    time_t now = 0;
+    PERSONALITY_PTR* resultPtr;
+
+    if (moduleHandleData->deviceIdleSeconds != 0)
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_007: [ If `deviceIdleSeconds` is not 0, `IotHub_Receive` shall destroy the personalities that were not used for `deviceIdleSeconds` seconds. ]*/
+        PERSONALITY_PTR candidate = moduleHandleData->leastRecentlyUsed;
+        now = get_time(NULL);
+        while ((candidate != NULL) &&
+            (difftime(now, candidate->lastUsed) >= (double)moduleHandleData->deviceIdleSeconds))
+        {
+            PERSONALITY_PTR next = candidate->moreRecentlyUsed;
+            if (candidate->shard == shard)
+            {
+                PERSONALITY_evict(moduleHandleData, candidate);
+            }
+            candidate = next;
+        }
+    }
+
+    /*Codes_SRS_IOTHUBMODULE_30_005: [ `IotHub_Receive` shall look for the personality of the device in the index, in constant time. ]*/
+    if (((resultPtr = PERSONALITY_INDEX_find(&(moduleHandleData->index), deviceName, hash)) == NULL) &&
+        (moduleHandleData->previousIndex.slots != NULL))
+    {
+        resultPtr = PERSONALITY_INDEX_find(&(moduleHandleData->previousIndex), deviceName, hash);
+    }
+
     if (resultPtr == NULL)
     {
         /*a new device has arrived!*/
         PERSONALITY_PTR personality;
-        if ((personality = PERSONALITY_create(deviceName, deviceKey, moduleHandleData)) == NULL)
+        size_t personalityCount = moduleHandleData->index.count + moduleHandleData->previousIndex.count;
+
+        if ((moduleHandleData->maxDevices != 0) &&
+            (personalityCount >= moduleHandleData->maxDevices))
+        {
+            /*Codes_SRS_IOTHUBMODULE_30_006: [ If `maxDevices` personalities exist already, `IotHub_Receive` shall destroy the least recently used one before creating a new one. ]*/
+            PERSONALITY_PTR candidate = moduleHandleData->leastRecentlyUsed;
+            while ((candidate != NULL) &&
+                (candidate->shard != shard))
+            {
+                candidate = candidate->moreRecentlyUsed;
+            }
+
+            if (candidate != NULL)
+            {
+                PERSONALITY_evict(moduleHandleData, candidate);
+                personalityCount--;
+            }
+            else
+            {
+                /*the other shards own all of them, maxDevices is exceeded until they give some up*/
+            }
+        }
+
+        if (PERSONALITY_INDEX_reserve(moduleHandleData) != 0)
+        {
+            /*Codes_SRS_IOTHUBMODULE_02_014: [ If creating the personality fails then `IotHub_Receive` shall return. ]*/
+            result = NULL;
+        }
+        else if ((personality = PERSONALITY_create(deviceName, hash, deviceKey, moduleHandleData)) == NULL)
         {
             LogError("unable to create a personality for the device %s", deviceName);
             result = NULL;
@@ -548,19 +1933,79 @@ static PERSONALITY* PERSONALITY_find_or_create(IOTHUB_HANDLE_DATA* moduleHandleD
             }
             else
             {
-                resultPtr = VECTOR_back(moduleHandleData->personalities);
-                result = *resultPtr;
-            }
+                personality->vectorIndex = personalityCount;
+                personality->moreRecentlyUsed = NULL;
+                personality->lessRecentlyUsed = NULL;
+                PERSONALITY_INDEX_insert(&(moduleHandleData->index), personality);
+                PERSONALITY_INDEX_move(moduleHandleData, PERSONALITY_INDEX_MOVE_STEP);
+                PERSONALITY_touch(moduleHandleData, personality, now);
+                result = personality;
             }
         }
+    }
     else
     {
         result = *resultPtr;
+        PERSONALITY_touch(moduleHandleData, result, now);
+    }
+    return result;
+}
+
+/*spoolConfirmation is NULL unless the message comes from the spool*/
+static IOTHUB_CLIENT_RESULT PERSONALITY_sendEvent(PERSONALITY_PTR personality, IOTHUB_MESSAGE_HANDLE message, IOTHUB_DRAIN_CONFIRMATION* spoolConfirmation)
+{
+    IOTHUB_CLIENT_RESULT result;
+    IOTHUB_HANDLE_DATA* moduleHandleData = (IOTHUB_HANDLE_DATA*)personality->module;
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK confirmationCallback = NULL;
+    void* confirmationContext = NULL;
+
+    if (spoolConfirmation != NULL)
+    {
+        /*the window of the drain limits these, not maxInFlight*/
+        confirmationCallback = IotHub_SpoolConfirmationCallback;
+        confirmationContext = spoolConfirmation;
+    }
+    else if ((moduleHandleData->maxInFlight != 0) ||
+        (moduleHandleData->spool != NULL))
+    {
+        if (moduleHandleData->maxInFlight != 0)
+        {
+            /*Codes_SRS_IOTHUBMODULE_30_021: [ If `maxInFlight` is not 0, `IotHub_Receive` shall wait until fewer than `maxInFlight` messages are in flight, then send the message with a confirmation callback. ]*/
+            IOTHUB_INFLIGHT_acquire(moduleHandleData);
+        }
+        /*with a spool, a failed confirmation tells that IoT Hub cannot be reached*/
+        confirmationCallback = IotHub_SendConfirmationCallback;
+        confirmationContext = moduleHandleData;
+    }
+
+    if (personality->lane == NULL)
+    {
+        result = IoTHubClient_SendEventAsync(personality->iothubHandle, message, confirmationCallback, confirmationContext);
+    }
+    else if (Lock(personality->lane->lock) != LOCK_OK)
+    {
+        LogError("not able to Lock the lane of the device %s", STRING_c_str(personality->deviceName));
+        result = IOTHUB_CLIENT_ERROR;
+    }
+    else
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_014: [ If the personality is in a lane, `IotHub_Receive` shall call `IoTHubClient_LL_SendEventAsync` under the lock of the lane instead. ]*/
+        result = IoTHubClient_LL_SendEventAsync(personality->iothubLLHandle, message, confirmationCallback, confirmationContext);
+        (void)Unlock(personality->lane->lock);
+    }
+
+    if ((result != IOTHUB_CLIENT_OK) &&
+        (spoolConfirmation == NULL) &&
+        (moduleHandleData->maxInFlight != 0))
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_022: [ If the message cannot be sent, it shall not be counted in flight. ]*/
+        IOTHUB_INFLIGHT_release(moduleHandleData);
     }
     return result;
 }
 
-static IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromGWMessage(MESSAGE_HANDLE message)
+/*the IoTHubMessage owns a copy of the content, the properties are the ones IotHub_Receive already has*/
+static IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromGWMessage(MESSAGE_HANDLE message, CONSTMAP_HANDLE gwMessageProperties)
 {
     IOTHUB_MESSAGE_HANDLE result;
     const CONSTBUFFER* content = Message_GetContent(message);
@@ -574,7 +2019,6 @@ static IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromGWMessage(MESSAGE_HANDLE me
     else
     {
         MAP_HANDLE iothubMessageProperties = IoTHubMessage_Properties(result);
-        CONSTMAP_HANDLE gwMessageProperties = Message_GetProperties(message);
         const char* const* keys;
         const char* const* values;
         size_t nProperties;
@@ -617,11 +2061,199 @@ static IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromGWMessage(MESSAGE_HANDLE me
                 result = NULL;
             }
         }
-        ConstMap_Destroy(gwMessageProperties);
     }
     return result;
 }
 
+/*sends a message as the device named by its properties. spoolConfirmation is NULL unless the message comes from the spool*/
+static IOTHUB_CLIENT_RESULT IotHub_SendToDevice(IOTHUB_HANDLE_DATA* moduleHandleData, MESSAGE_HANDLE messageHandle, CONSTMAP_HANDLE properties, const char* deviceName, const char* deviceKey, IOTHUB_DRAIN_CONFIRMATION* spoolConfirmation)
+{
+    IOTHUB_CLIENT_RESULT result;
+    /*a personality is only used by the thread of its shard, so the shards hold the lock only while looking it up*/
+    bool lockWhileSending = (moduleHandleData->shards == NULL);
+    if ((moduleHandleData->receiveLock != NULL) &&
+        (Lock(moduleHandleData->receiveLock) != LOCK_OK))
+    {
+        LogError("not able to Lock the personalities");
+        result = IOTHUB_CLIENT_ERROR;
+    }
+    else
+    {
+        /*Codes_SRS_IOTHUBMODULE_02_013: [ If no personality exists with a device ID equal to the value of the `deviceName` property of the message, then `IotHub_Receive` shall create a new `PERSONALITY` with the ID and key values from the message. ]*/
+        PERSONALITY* whereIsIt = PERSONALITY_find_or_create(moduleHandleData, deviceName, deviceKey);
+        if ((moduleHandleData->receiveLock != NULL) &&
+            !lockWhileSending)
+        {
+            (void)Unlock(moduleHandleData->receiveLock);
+        }
+
+        if (whereIsIt == NULL)
+        {
+            /*Codes_SRS_IOTHUBMODULE_02_014: [ If creating the personality fails then `IotHub_Receive` shall return. ]*/
+            /*do nothing, device was not added to the GW*/
+            LogError("unable to PERSONALITY_find_or_create");
+            result = IOTHUB_CLIENT_ERROR;
+        }
+        else
+        {
+            IOTHUB_MESSAGE_HANDLE iotHubMessage = IoTHubMessage_CreateFromGWMessage(messageHandle, properties);
+            if(iotHubMessage == NULL)
+            {
+                LogError("unable to IoTHubMessage_CreateFromGWMessage (internal)");
+                result = IOTHUB_CLIENT_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_IOTHUBMODULE_02_020: [ `IotHub_Receive` shall call IoTHubClient_SendEventAsync passing the IOTHUB_MESSAGE_HANDLE. ]*/
+                if ((result = PERSONALITY_sendEvent(whereIsIt, iotHubMessage, spoolConfirmation)) != IOTHUB_CLIENT_OK)
+                {
+                    /*Codes_SRS_IOTHUBMODULE_02_021: [ If `IoTHubClient_SendEventAsync` fails then `IotHub_Receive` shall return. ]*/
+                    LogError("unable to IoTHubClient_SendEventAsync");
+                }
+                else
+                {
+                    /*all is fine, message has been accepted for delivery*/
+                }
+                IoTHubMessage_Destroy(iotHubMessage);
+            }
+        }
+
+        if ((moduleHandleData->receiveLock != NULL) &&
+            lockWhileSending)
+        {
+            (void)Unlock(moduleHandleData->receiveLock);
+        }
+    }
+    return result;
+}
+
+/*sends the message, or with shards queues it to the shard of the device. spoolConfirmation is NULL unless the message comes from the spool*/
+static IOTHUB_CLIENT_RESULT IotHub_Dispatch(IOTHUB_HANDLE_DATA* moduleHandleData, MESSAGE_HANDLE messageHandle, CONSTMAP_HANDLE properties, const char* deviceName, const char* deviceKey, IOTHUB_DRAIN_CONFIRMATION* spoolConfirmation)
+{
+    IOTHUB_CLIENT_RESULT result;
+    if (moduleHandleData->shards == NULL)
+    {
+        result = IotHub_SendToDevice(moduleHandleData, messageHandle, properties, deviceName, deviceKey, spoolConfirmation);
+    }
+    else
+    {
+        /*Codes_SRS_IOTHUBMODULE_30_041: [ If the module has shards, `IotHub_Receive` shall queue the message to the shard picked by the hash of `deviceName` instead of sending it. ]*/
+        IOTHUB_SHARD* shard = &(moduleHandleData->shards[IOTHUB_SHARD_of(moduleHandleData, PERSONALITY_hash(deviceName))]);
+        if (IOTHUB_SHARD_push(shard, messageHandle, properties, spoolConfirmation) != 0)
+        {
+            LogError("unable to queue the message of the device %s", deviceName);
+            result = IOTHUB_CLIENT_ERROR;
+        }
+        else
+        {
+            result = IOTHUB_CLIENT_OK;
+        }
+    }
+    return result;
+}
+
+/*sends the messages of the spool in order, a window of them while IoT Hub can
+be reached and one every IOTHUB_DRAIN_RETRY_SECONDS while it cannot*/
+static int IOTHUB_DRAIN_worker(void* context)
+{
+    IOTHUB_HANDLE_DATA* moduleHandleData = (IOTHUB_HANDLE_DATA*)context;
+    bool keepRunning = true;
+    time_t lastFlush = get_time(NULL);
+    while (keepRunning)
+    {
+        bool idle = true;
+        MESSAGE_HANDLE message = NULL;
+        IOTHUB_DRAIN_CONFIRMATION* confirmation = NULL;
+
+        if (Lock(moduleHandleData->spoolLock) != LOCK_OK)
+        {
+            LogError("not able to Lock, the drain shall retry");
+        }
+        else
+        {
+            time_t now = get_time(NULL);
+            keepRunning = moduleHandleData->drainKeepRunning;
+
+            /*Codes_SRS_IOTHUBMODULE_30_033: [ The drain thread shall read the spool in order and send up to `IOTHUB_DRAIN_WINDOW` messages while IoT Hub can be reached, and one message every `IOTHUB_DRAIN_RETRY_SECONDS` while it cannot. ]*/
+            if (keepRunning &&
+                (moduleHandleData->reachable
+                    ? (moduleHandleData->sentCount < IOTHUB_DRAIN_WINDOW)
+                    : ((moduleHandleData->sentCount == 0) && (difftime(now, moduleHandleData->nextProbe) >= 0))))
+            {
+                IOTHUB_SPOOL_POSITION position;
+                if (IotHubSpool_Read(moduleHandleData->spool, &message, &position) == 0)
+                {
+                    size_t ticket = moduleHandleData->firstSent + moduleHandleData->sentCount;
+                    IOTHUB_DRAIN_SENT* sent = &(moduleHandleData->sent[ticket % IOTHUB_DRAIN_WINDOW]);
+                    sent->position = position;
+                    sent->delivered = false;
+                    moduleHandleData->sentCount++;
+                    idle = false;
+
+                    if (message == NULL)
+                    {
+                        /*dropped by the spool, there is nothing to wait for*/
+                        IOTHUB_DRAIN_delivered(moduleHandleData, ticket);
+                    }
+                    else if ((confirmation = (IOTHUB_DRAIN_CONFIRMATION*)malloc(sizeof(IOTHUB_DRAIN_CONFIRMATION))) == NULL)
+                    {
+                        LogError("unable to allocate the confirmation of a message of the spool, trying again later");
+                        Message_Destroy(message);
+                        message = NULL;
+                        IOTHUB_DRAIN_unreachable(moduleHandleData);
+                    }
+                    else
+                    {
+                        confirmation->moduleHandleData = moduleHandleData;
+                        confirmation->generation = moduleHandleData->generation;
+                        confirmation->ticket = ticket;
+                        if (!moduleHandleData->reachable)
+                        {
+                            /*the confirmation of this one tells whether IoT Hub can be reached again*/
+                            moduleHandleData->nextProbe = now + IOTHUB_DRAIN_RETRY_SECONDS;
+                        }
+                    }
+                }
+            }
+
+            if (difftime(now, lastFlush) >= 1.0)
+            {
+                IotHubSpool_Flush(moduleHandleData->spool);
+                lastFlush = now;
+            }
+            (void)Unlock(moduleHandleData->spoolLock);
+        }
+
+        if (message != NULL)
+        {
+            /*the message was checked by IotHub_Receive before it was spooled*/
+            const char* deviceName = Message_GetProperty(message, DEVICENAME);
+            const char* deviceKey = Message_GetProperty(message, DEVICEKEY);
+            CONSTMAP_HANDLE properties = NULL;
+            if ((deviceName == NULL) ||
+                (deviceKey == NULL) ||
+                ((properties = Message_GetProperties(message)) == NULL) ||
+                /*Codes_SRS_IOTHUBMODULE_30_046: [ If the module has shards, the drain thread shall queue the messages of the spool to the shard of their device. ]*/
+                (IotHub_Dispatch(moduleHandleData, message, properties, deviceName, deviceKey, confirmation) != IOTHUB_CLIENT_OK))
+            {
+                LogError("unable to send a message of the spool");
+                /*as if IoT Hub had not taken it, this frees the confirmation*/
+                IotHub_SpoolConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_ERROR, confirmation);
+            }
+            if (properties != NULL)
+            {
+                ConstMap_Destroy(properties);
+            }
+            Message_Destroy(message);
+        }
+        else if (idle)
+        {
+            ThreadAPI_Sleep(IOTHUB_DRAIN_PERIOD_MS);
+        }
+    }
+    return 0;
+}
+
 static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
 {
     /*Codes_SRS_IOTHUBMODULE_02_009: [ If `moduleHandle` or `messageHandle` is `NULL` then `IotHub_Receive` shall do nothing. ]*/
@@ -635,8 +2267,7 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
     }
     else
     {
-        CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
-        const char* source = ConstMap_GetValue(properties, SOURCE); /*properties is !=NULL by contract of Message*/
+        const char* source = Message_GetProperty(messageHandle, SOURCE);
 
         /*Codes_SRS_IOTHUBMODULE_02_010: [ If message properties do not contain a property called "source" having the value set to "mapping" then `IotHub_Receive` shall do nothing. ]*/
         if (
@@ -649,7 +2280,7 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
         else
         {
             /*Codes_SRS_IOTHUBMODULE_02_011: [ If message properties do not contain a property called "deviceName" having a non-`NULL` value then `IotHub_Receive` shall do nothing. ]*/
-            const char* deviceName = ConstMap_GetValue(properties, DEVICENAME);
+            const char* deviceName = Message_GetProperty(messageHandle, DEVICENAME);
             if (deviceName == NULL)
             {
                 /*do nothing, not a message for this module*/
@@ -657,7 +2288,7 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
             else
             {
                 /*Codes_SRS_IOTHUBMODULE_02_012: [ If message properties do not contain a property called "deviceKey" having a non-`NULL` value then `IotHub_Receive` shall do nothing. ]*/
-                const char* deviceKey = ConstMap_GetValue(properties, DEVICEKEY);
+                const char* deviceKey = Message_GetProperty(messageHandle, DEVICEKEY);
                 if (deviceKey == NULL)
                 {
                     /*do nothing, missing device key*/
@@ -665,41 +2296,50 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
                 else
                 {
                     IOTHUB_HANDLE_DATA* moduleHandleData = moduleHandle;
-                    /*Codes_SRS_IOTHUBMODULE_02_013: [ If no personality exists with a device ID equal to the value of the `deviceName` property of the message, then `IotHub_Receive` shall create a new `PERSONALITY` with the ID and key values from the message. ]*/
-
-                    PERSONALITY* whereIsIt = PERSONALITY_find_or_create(moduleHandleData, deviceName, deviceKey);
-                    if (whereIsIt == NULL)
-                    {
-                        /*Codes_SRS_IOTHUBMODULE_02_014: [ If creating the personality fails then `IotHub_Receive` shall return. ]*/
-                        /*do nothing, device was not added to the GW*/
-                        LogError("unable to PERSONALITY_find_or_create");
-                    }
-                    else
+                    bool spooled = false;
+                    if (moduleHandleData->spool != NULL)
                     {
-                        IOTHUB_MESSAGE_HANDLE iotHubMessage = IoTHubMessage_CreateFromGWMessage(messageHandle);
-                        if(iotHubMessage == NULL)
+                        if (Lock(moduleHandleData->spoolLock) != LOCK_OK)
                         {
-                            LogError("unable to IoTHubMessage_CreateFromGWMessage (internal)");
+                            LogError("not able to Lock the spool, sending the message");
                         }
                         else
                         {
-                            /*Codes_SRS_IOTHUBMODULE_02_020: [ `IotHub_Receive` shall call IoTHubClient_SendEventAsync passing the IOTHUB_MESSAGE_HANDLE. ]*/
-                            if (IoTHubClient_SendEventAsync(whereIsIt->iothubHandle, iotHubMessage, NULL, NULL) != IOTHUB_CLIENT_OK)
-                            {
-                                /*Codes_SRS_IOTHUBMODULE_02_021: [ If `IoTHubClient_SendEventAsync` fails then `IotHub_Receive` shall return. ]*/
-                                LogError("unable to IoTHubClient_SendEventAsync");
-                            }
-                            else
+                            if ((!moduleHandleData->reachable) ||
+                                IotHubSpool_HasPending(moduleHandleData->spool))
                             {
-                                /*all is fine, message has been accepted for delivery*/
+                                /*Codes_SRS_IOTHUBMODULE_30_028: [ If the module has a spool, and IoT Hub cannot be reached or the spool holds messages not delivered yet, `IotHub_Receive` shall append the message to the spool by calling `IotHubSpool_Append` instead of sending it. ]*/
+                                if (IotHubSpool_Append(moduleHandleData->spool, messageHandle) != 0)
+                                {
+                                    /*Codes_SRS_IOTHUBMODULE_30_029: [ If appending to the spool fails, `IotHub_Receive` shall send the message. ]*/
+                                    LogError("unable to spool the message, sending it");
+                                }
+                                else
+                                {
+                                    spooled = true;
+                                }
                             }
-                            IoTHubMessage_Destroy(iotHubMessage);
+                            (void)Unlock(moduleHandleData->spoolLock);
+                        }
+                    }
+
+                    if (!spooled)
+                    {
+                        /*only a message that is sent needs the copy of its properties*/
+                        CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
+                        if (properties == NULL)
+                        {
+                            LogError("unable to get properties of the GW message");
+                        }
+                        else
+                        {
+                            (void)IotHub_Dispatch(moduleHandleData, messageHandle, properties, deviceName, deviceKey, NULL);
+                            ConstMap_Destroy(properties);
                         }
                     }
                 }
             }
         }
-        ConstMap_Destroy(properties);
     }
     /*Codes_SRS_IOTHUBMODULE_02_022: [ If `IoTHubClient_SendEventAsync` succeeds then `IotHub_Receive` shall return. ]*/
 }
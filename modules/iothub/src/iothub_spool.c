@@ -0,0 +1,775 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+#include "iothub_spool.h"
+
+#ifndef WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SPOOL_SEGMENT_MAGIC         0xA16C5350 /*(A)zure (I)oT (G)ateway (C)ontrol, "SP"ool*/
+#define SPOOL_SEGMENT_VERSION       1
+#define SPOOL_SEGMENT_SUFFIX        ".spool"
+#define SPOOL_SEGMENT_NAME_LENGTH   (16 + sizeof(SPOOL_SEGMENT_SUFFIX) - 1) /*the sequence in hexadecimal, then the suffix*/
+#define SPOOL_LOCK_FILE             "spool.lock"
+#define SPOOL_RECORD_SIZE(size)     (sizeof(SPOOL_RECORD_HEADER) + (((size_t)(size) + 7) & ~(size_t)7))
+
+/*a segment is this header followed by records, the file is created full of
+zeros and a record with a size of 0 ends the segment*/
+typedef struct SPOOL_SEGMENT_HEADER_TAG
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sequence;
+    uint64_t committed; /*offset of the first record not delivered yet*/
+    uint8_t padding[40];
+} SPOOL_SEGMENT_HEADER;
+
+/*a torn record, whatever part of it reached the file, fails the checksum*/
+typedef struct SPOOL_RECORD_HEADER_TAG
+{
+    uint32_t size; /*of the serialized message*/
+    uint32_t checksum; /*FNV-1a of the time and the serialized message*/
+    int64_t time; /*when the message was spooled*/
+} SPOOL_RECORD_HEADER;
+
+typedef struct SPOOL_SEGMENT_TAG
+{
+    uint64_t sequence;
+    char* path;
+    unsigned char* base;
+    size_t size;
+    size_t end; /*offset past the last record*/
+    struct SPOOL_SEGMENT_TAG* next;
+} SPOOL_SEGMENT;
+
+typedef struct IOTHUB_SPOOL_TAG
+{
+    char* directory;
+    int lockFd;
+    size_t segmentSize;
+    size_t maxSize;
+    unsigned int maxAgeSeconds;
+    size_t totalSize; /*of all the segments*/
+    uint64_t nextSequence;
+    SPOOL_SEGMENT* oldest;
+    SPOOL_SEGMENT* newest; /*the one appended to*/
+    SPOOL_SEGMENT* reading;
+    size_t readOffset;
+    size_t expired; /*messages dropped by the reads since the last one returned*/
+} IOTHUB_SPOOL;
+
+#define SEGMENT_HEADER(segment) ((SPOOL_SEGMENT_HEADER*)((segment)->base))
+#define SEGMENT_RECORD(segment, offset) ((SPOOL_RECORD_HEADER*)((segment)->base + (offset)))
+
+static uint32_t spool_checksum(int64_t time, const unsigned char* data, uint32_t size)
+{
+    uint32_t result = 2166136261u;
+    const unsigned char* timeBytes = (const unsigned char*)&time;
+    uint32_t i;
+    for (i = 0; i < sizeof(time); i++)
+    {
+        result = (result ^ timeBytes[i]) * 16777619u;
+    }
+    for (i = 0; i < size; i++)
+    {
+        result = (result ^ data[i]) * 16777619u;
+    }
+    return result;
+}
+
+static char* spool_path(const char* directory, const char* name)
+{
+    size_t length = strlen(directory) + 1 + strlen(name) + 1;
+    char* result = (char*)malloc(length);
+    if (result == NULL)
+    {
+        LogError("unable to allocate the path of %s", name);
+    }
+    else
+    {
+        (void)snprintf(result, length, "%s/%s", directory, name);
+    }
+    return result;
+}
+
+/*maps the file of a segment, creating it with size bytes when create is true*/
+static SPOOL_SEGMENT* segment_map(const char* directory, uint64_t sequence, size_t size, bool create)
+{
+    char name[SPOOL_SEGMENT_NAME_LENGTH + 1];
+    SPOOL_SEGMENT* result = (SPOOL_SEGMENT*)malloc(sizeof(SPOOL_SEGMENT));
+    (void)snprintf(name, sizeof(name), "%016llx" SPOOL_SEGMENT_SUFFIX, (unsigned long long)sequence);
+    if (result == NULL)
+    {
+        LogError("unable to allocate the segment %s", name);
+    }
+    else if ((result->path = spool_path(directory, name)) == NULL)
+    {
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        struct stat status;
+        int fd = open(result->path, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            LogError("unable to open %s, errno=%d", result->path, errno);
+            free(result->path);
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            int error = 0;
+            /*the blocks are reserved now: writing to a sparse file through
+            the mapping raises SIGBUS once the disk is full*/
+            if (create && ((error = posix_fallocate(fd, 0, (off_t)size)) != 0))
+            {
+                LogError("unable to reserve %lu bytes for %s, error=%d", (unsigned long)size, result->path, error);
+                (void)unlink(result->path);
+                free(result->path);
+                free(result);
+                result = NULL;
+            }
+            else if (!create && ((fstat(fd, &status) != 0) || ((size = (size_t)status.st_size) < sizeof(SPOOL_SEGMENT_HEADER))))
+            {
+                LogError("%s is not a spool segment", result->path);
+                free(result->path);
+                free(result);
+                result = NULL;
+            }
+            else if ((result->base = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+            {
+                LogError("unable to map %s, errno=%d", result->path, errno);
+                if (create)
+                {
+                    (void)unlink(result->path);
+                }
+                free(result->path);
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                result->sequence = sequence;
+                result->size = size;
+                result->end = sizeof(SPOOL_SEGMENT_HEADER);
+                result->next = NULL;
+            }
+            /*the mapping keeps the file*/
+            (void)close(fd);
+        }
+    }
+    return result;
+}
+
+static void segment_unmap(SPOOL_SEGMENT* segment, bool remove)
+{
+    if (remove)
+    {
+        (void)unlink(segment->path);
+    }
+    (void)munmap(segment->base, segment->size);
+    free(segment->path);
+    free(segment);
+}
+
+/*finds the end of the records of a recovered segment, and makes sure that the
+committed offset is that of a record*/
+static int segment_recover(SPOOL_SEGMENT* segment)
+{
+    int result;
+    SPOOL_SEGMENT_HEADER* header = SEGMENT_HEADER(segment);
+    if ((header->magic != SPOOL_SEGMENT_MAGIC) ||
+        (header->version != SPOOL_SEGMENT_VERSION) ||
+        (header->sequence != segment->sequence))
+    {
+        LogError("%s is not a spool segment", segment->path);
+        result = __LINE__;
+    }
+    else
+    {
+        size_t committed = sizeof(SPOOL_SEGMENT_HEADER);
+        segment->end = sizeof(SPOOL_SEGMENT_HEADER);
+        while (segment->end + sizeof(SPOOL_RECORD_HEADER) <= segment->size)
+        {
+            SPOOL_RECORD_HEADER* record = SEGMENT_RECORD(segment, segment->end);
+            if ((record->size == 0) ||
+                (SPOOL_RECORD_SIZE(record->size) > segment->size - segment->end) ||
+                (record->checksum != spool_checksum(record->time, (const unsigned char*)(record + 1), record->size)))
+            {
+                /*the process stopped while writing this one*/
+                break;
+            }
+            else
+            {
+                if (segment->end <= header->committed)
+                {
+                    committed = segment->end;
+                }
+                segment->end += SPOOL_RECORD_SIZE(record->size);
+            }
+        }
+
+        if (header->committed >= segment->end)
+        {
+            header->committed = segment->end;
+        }
+        else if (header->committed != committed)
+        {
+            /*the message is sent again rather than lost*/
+            LogError("%s was committed in the middle of a message", segment->path);
+            header->committed = committed;
+        }
+        result = 0;
+    }
+    return result;
+}
+
+static size_t segment_count_pending(const SPOOL_SEGMENT* segment)
+{
+    size_t result = 0;
+    size_t offset = (size_t)SEGMENT_HEADER(segment)->committed;
+    while (offset < segment->end)
+    {
+        offset += SPOOL_RECORD_SIZE(SEGMENT_RECORD(segment, offset)->size);
+        result++;
+    }
+    return result;
+}
+
+static void spool_link(IOTHUB_SPOOL* spool, SPOOL_SEGMENT* segment)
+{
+    if (spool->newest == NULL)
+    {
+        spool->oldest = segment;
+    }
+    else
+    {
+        spool->newest->next = segment;
+    }
+    spool->newest = segment;
+    spool->totalSize += segment->size;
+    if (spool->reading == NULL)
+    {
+        spool->reading = segment;
+        spool->readOffset = (size_t)SEGMENT_HEADER(segment)->committed;
+    }
+}
+
+static void spool_remove_oldest(IOTHUB_SPOOL* spool)
+{
+    SPOOL_SEGMENT* oldest = spool->oldest;
+    spool->oldest = oldest->next;
+    if (spool->oldest == NULL)
+    {
+        spool->newest = NULL;
+    }
+    if (spool->reading == oldest)
+    {
+        spool->reading = oldest->next;
+        spool->readOffset = (spool->reading == NULL) ? 0 : (size_t)SEGMENT_HEADER(spool->reading)->committed;
+    }
+    spool->totalSize -= oldest->size;
+    segment_unmap(oldest, true);
+}
+
+/*removes the segments holding only delivered messages, but the one appended to*/
+static void spool_remove_delivered(IOTHUB_SPOOL* spool)
+{
+    while ((spool->oldest != spool->newest) &&
+        (SEGMENT_HEADER(spool->oldest)->committed == spool->oldest->end))
+    {
+        spool_remove_oldest(spool);
+    }
+}
+
+/*starts a new segment to append to, big enough for recordSize*/
+static int spool_add_segment(IOTHUB_SPOOL* spool, size_t recordSize)
+{
+    int result;
+    SPOOL_SEGMENT* segment;
+    size_t size = sizeof(SPOOL_SEGMENT_HEADER) + recordSize;
+    if (size < spool->segmentSize)
+    {
+        size = spool->segmentSize;
+    }
+
+    /*the limit always leaves room for the new segment*/
+    while ((spool->maxSize != 0) &&
+        (spool->oldest != NULL) &&
+        (spool->totalSize + size > spool->maxSize))
+    {
+        size_t dropped = segment_count_pending(spool->oldest);
+        if (dropped != 0)
+        {
+            LogError("the spool is full, dropping the %lu oldest messages", (unsigned long)dropped);
+        }
+        spool_remove_oldest(spool);
+    }
+
+    if ((segment = segment_map(spool->directory, spool->nextSequence, size, true)) == NULL)
+    {
+        LogError("unable to add a segment to the spool");
+        result = __LINE__;
+    }
+    else
+    {
+        SPOOL_SEGMENT_HEADER* header = SEGMENT_HEADER(segment);
+        header->magic = SPOOL_SEGMENT_MAGIC;
+        header->version = SPOOL_SEGMENT_VERSION;
+        header->sequence = segment->sequence;
+        header->committed = sizeof(SPOOL_SEGMENT_HEADER);
+        if (spool->newest != NULL)
+        {
+            /*the previous segment is not written anymore*/
+            (void)msync(spool->newest->base, spool->newest->size, MS_ASYNC);
+        }
+        spool->nextSequence++;
+        spool_link(spool, segment);
+        spool_remove_delivered(spool);
+        result = 0;
+    }
+    return result;
+}
+
+static int compare_sequences(const void* lhs, const void* rhs)
+{
+    uint64_t l = *(const uint64_t*)lhs;
+    uint64_t r = *(const uint64_t*)rhs;
+    return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+/*returns the sequences of the segment files of the directory, sorted*/
+static uint64_t* spool_list_segments(const char* directory, size_t* count)
+{
+    uint64_t* result = NULL;
+    DIR* dir = opendir(directory);
+    *count = 0;
+    if (dir == NULL)
+    {
+        LogError("unable to open the directory %s, errno=%d", directory, errno);
+    }
+    else
+    {
+        size_t capacity = 16;
+        struct dirent* entry;
+        if ((result = (uint64_t*)malloc(capacity * sizeof(uint64_t))) == NULL)
+        {
+            LogError("unable to allocate the list of the segments");
+        }
+        else
+        {
+            while ((entry = readdir(dir)) != NULL)
+            {
+                unsigned long long sequence;
+                char* end;
+                if ((strlen(entry->d_name) == SPOOL_SEGMENT_NAME_LENGTH) &&
+                    (strcmp(entry->d_name + 16, SPOOL_SEGMENT_SUFFIX) == 0) &&
+                    ((sequence = strtoull(entry->d_name, &end, 16)), (end == entry->d_name + 16)))
+                {
+                    if (*count == capacity)
+                    {
+                        uint64_t* grown = (uint64_t*)realloc(result, 2 * capacity * sizeof(uint64_t));
+                        if (grown == NULL)
+                        {
+                            LogError("unable to grow the list of the segments");
+                            free(result);
+                            result = NULL;
+                            break;
+                        }
+                        result = grown;
+                        capacity *= 2;
+                    }
+                    result[(*count)++] = (uint64_t)sequence;
+                }
+            }
+            if (result != NULL)
+            {
+                qsort(result, *count, sizeof(uint64_t), compare_sequences);
+            }
+        }
+        (void)closedir(dir);
+    }
+    return result;
+}
+
+static void spool_destroy(IOTHUB_SPOOL* spool)
+{
+    while (spool->oldest != NULL)
+    {
+        SPOOL_SEGMENT* next = spool->oldest->next;
+        bool delivered = (SEGMENT_HEADER(spool->oldest)->committed == spool->oldest->end);
+        (void)msync(spool->oldest->base, spool->oldest->size, MS_SYNC);
+        segment_unmap(spool->oldest, delivered);
+        spool->oldest = next;
+    }
+    if (spool->lockFd != -1)
+    {
+        (void)close(spool->lockFd);
+    }
+    free(spool->directory);
+    free(spool);
+}
+
+IOTHUB_SPOOL_HANDLE IotHubSpool_Open(const IOTHUB_SPOOL_CONFIG* config)
+{
+    IOTHUB_SPOOL* result;
+    if ((config == NULL) ||
+        (config->directory == NULL))
+    {
+        LogError("invalid arg config=%p", config);
+        result = NULL;
+    }
+    else if ((result = (IOTHUB_SPOOL*)malloc(sizeof(IOTHUB_SPOOL))) == NULL)
+    {
+        LogError("unable to allocate the spool");
+    }
+    else
+    {
+        char* lockPath;
+        memset(result, 0, sizeof(IOTHUB_SPOOL));
+        result->lockFd = -1;
+        result->segmentSize = (config->segmentSize == 0) ? IOTHUB_SPOOL_SEGMENT_SIZE_DEFAULT : config->segmentSize;
+        result->maxSize = config->maxSize;
+        result->maxAgeSeconds = config->maxAgeSeconds;
+
+        if ((result->directory = (char*)malloc(strlen(config->directory) + 1)) == NULL)
+        {
+            LogError("unable to allocate the name of the directory");
+            free(result);
+            result = NULL;
+        }
+        else if ((mkdir(strcpy(result->directory, config->directory), S_IRWXU) != 0) &&
+            (errno != EEXIST))
+        {
+            LogError("unable to create the directory %s, errno=%d", config->directory, errno);
+            spool_destroy(result);
+            result = NULL;
+        }
+        else if ((lockPath = spool_path(result->directory, SPOOL_LOCK_FILE)) == NULL)
+        {
+            spool_destroy(result);
+            result = NULL;
+        }
+        else
+        {
+            /*the lock goes away with the process, however it ends*/
+            result->lockFd = open(lockPath, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+            free(lockPath);
+            if ((result->lockFd == -1) ||
+                (flock(result->lockFd, LOCK_EX | LOCK_NB) != 0))
+            {
+                LogError("unable to lock the spool in %s, is it used by another module? errno=%d", config->directory, errno);
+                spool_destroy(result);
+                result = NULL;
+            }
+            else
+            {
+                size_t count;
+                uint64_t* sequences = spool_list_segments(result->directory, &count);
+                if (sequences == NULL)
+                {
+                    spool_destroy(result);
+                    result = NULL;
+                }
+                else
+                {
+                    size_t i;
+                    size_t pending = 0;
+                    for (i = 0; i < count; i++)
+                    {
+                        SPOOL_SEGMENT* segment = segment_map(result->directory, sequences[i], 0, false);
+                        if (segment == NULL)
+                        {
+                            LogError("leaving out the segment %llx", (unsigned long long)sequences[i]);
+                        }
+                        else if (segment_recover(segment) != 0)
+                        {
+                            segment_unmap(segment, false);
+                        }
+                        else
+                        {
+                            pending += segment_count_pending(segment);
+                            spool_link(result, segment);
+                        }
+                        result->nextSequence = sequences[i] + 1;
+                    }
+                    free(sequences);
+
+                    if (pending != 0)
+                    {
+                        LogInfo("recovered %lu messages from the spool in %s", (unsigned long)pending, config->directory);
+                    }
+
+                    /*the recovered segments are only read, the next messages go to a new one*/
+                    if (spool_add_segment(result, 0) != 0)
+                    {
+                        spool_destroy(result);
+                        result = NULL;
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void IotHubSpool_Close(IOTHUB_SPOOL_HANDLE spool)
+{
+    if (spool == NULL)
+    {
+        LogError("invalid arg spool=NULL");
+    }
+    else
+    {
+        spool_destroy(spool);
+    }
+}
+
+int IotHubSpool_Append(IOTHUB_SPOOL_HANDLE spool, MESSAGE_HANDLE message)
+{
+    int result;
+    int32_t size;
+    if ((spool == NULL) ||
+        (message == NULL))
+    {
+        LogError("invalid arg spool=%p, message=%p", spool, message);
+        result = __LINE__;
+    }
+    else if ((size = Message_ToByteArray(message, NULL, 0)) <= 0)
+    {
+        LogError("unable to get the size of the serialized message");
+        result = __LINE__;
+    }
+    else if ((spool->newest->end + SPOOL_RECORD_SIZE(size) > spool->newest->size) &&
+        (spool_add_segment(spool, SPOOL_RECORD_SIZE(size)) != 0))
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        SPOOL_SEGMENT* segment = spool->newest;
+        SPOOL_RECORD_HEADER* record = SEGMENT_RECORD(segment, segment->end);
+        unsigned char* data = (unsigned char*)(record + 1);
+
+        /*serialized in place, the record only counts once its checksum is right*/
+        if (Message_ToByteArray(message, data, size) != size)
+        {
+            LogError("unable to serialize the message");
+            memset(data, 0, (size_t)size);
+            result = __LINE__;
+        }
+        else
+        {
+            record->time = (int64_t)time(NULL);
+            record->checksum = spool_checksum(record->time, data, (uint32_t)size);
+            record->size = (uint32_t)size;
+            segment->end += SPOOL_RECORD_SIZE(size);
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int IotHubSpool_Read(IOTHUB_SPOOL_HANDLE spool, MESSAGE_HANDLE* message, IOTHUB_SPOOL_POSITION* position)
+{
+    int result;
+    if ((spool == NULL) ||
+        (message == NULL) ||
+        (position == NULL))
+    {
+        LogError("invalid arg spool=%p, message=%p, position=%p", spool, message, position);
+        result = __LINE__;
+    }
+    else
+    {
+        /*past the end of a segment that is not appended to anymore, go to the next one*/
+        while ((spool->reading != NULL) &&
+            (spool->readOffset >= spool->reading->end) &&
+            (spool->reading != spool->newest))
+        {
+            spool->reading = spool->reading->next;
+            spool->readOffset = (size_t)SEGMENT_HEADER(spool->reading)->committed;
+        }
+
+        if ((spool->reading == NULL) ||
+            (spool->readOffset >= spool->reading->end))
+        {
+            if (spool->expired != 0)
+            {
+                LogError("dropped %lu messages older than %u seconds from the spool", (unsigned long)spool->expired, spool->maxAgeSeconds);
+                spool->expired = 0;
+            }
+            result = __LINE__;
+        }
+        else
+        {
+            SPOOL_RECORD_HEADER* record = SEGMENT_RECORD(spool->reading, spool->readOffset);
+            spool->readOffset += SPOOL_RECORD_SIZE(record->size);
+            position->segment = spool->reading->sequence;
+            position->offset = spool->readOffset;
+
+            if ((spool->maxAgeSeconds != 0) &&
+                (difftime(time(NULL), (time_t)record->time) > (double)spool->maxAgeSeconds))
+            {
+                spool->expired++;
+                *message = NULL;
+            }
+            else
+            {
+                if (spool->expired != 0)
+                {
+                    LogError("dropped %lu messages older than %u seconds from the spool", (unsigned long)spool->expired, spool->maxAgeSeconds);
+                    spool->expired = 0;
+                }
+                if ((*message = Message_CreateFromByteArray((const unsigned char*)(record + 1), (int32_t)record->size)) == NULL)
+                {
+                    LogError("unable to decode a message of the spool, dropping it");
+                }
+            }
+            result = 0;
+        }
+    }
+    return result;
+}
+
+void IotHubSpool_Commit(IOTHUB_SPOOL_HANDLE spool, const IOTHUB_SPOOL_POSITION* position)
+{
+    if ((spool == NULL) ||
+        (position == NULL))
+    {
+        LogError("invalid arg spool=%p, position=%p", spool, position);
+    }
+    else
+    {
+        SPOOL_SEGMENT* segment;
+        for (segment = spool->oldest; (segment != NULL) && (segment->sequence <= position->segment); segment = segment->next)
+        {
+            SPOOL_SEGMENT_HEADER* header = SEGMENT_HEADER(segment);
+            size_t committed = (segment->sequence < position->segment) ? segment->end : position->offset;
+            if (header->committed < committed)
+            {
+                header->committed = committed;
+            }
+        }
+        spool_remove_delivered(spool);
+    }
+}
+
+void IotHubSpool_Rewind(IOTHUB_SPOOL_HANDLE spool)
+{
+    if (spool == NULL)
+    {
+        LogError("invalid arg spool=NULL");
+    }
+    else
+    {
+        spool->reading = spool->oldest;
+        spool->readOffset = (spool->reading == NULL) ? 0 : (size_t)SEGMENT_HEADER(spool->reading)->committed;
+    }
+}
+
+bool IotHubSpool_HasPending(IOTHUB_SPOOL_HANDLE spool)
+{
+    bool result;
+    if (spool == NULL)
+    {
+        LogError("invalid arg spool=NULL");
+        result = false;
+    }
+    else
+    {
+        /*only the segment appended to can be left with nothing to deliver*/
+        result = (spool->oldest != spool->newest) ||
+            ((spool->newest != NULL) && (SEGMENT_HEADER(spool->newest)->committed != spool->newest->end));
+    }
+    return result;
+}
+
+void IotHubSpool_Flush(IOTHUB_SPOOL_HANDLE spool)
+{
+    if (spool == NULL)
+    {
+        LogError("invalid arg spool=NULL");
+    }
+    else
+    {
+        /*the older segments only see their committed offset change*/
+        if (spool->oldest != spool->newest)
+        {
+            (void)msync(spool->oldest->base, sizeof(SPOOL_SEGMENT_HEADER), MS_ASYNC);
+        }
+        if (spool->newest != NULL)
+        {
+            (void)msync(spool->newest->base, spool->newest->end, MS_ASYNC);
+        }
+    }
+}
+
+#else /*WIN32*/
+
+IOTHUB_SPOOL_HANDLE IotHubSpool_Open(const IOTHUB_SPOOL_CONFIG* config)
+{
+    (void)config;
+    LogError("the spool is not supported on this platform");
+    return NULL;
+}
+
+void IotHubSpool_Close(IOTHUB_SPOOL_HANDLE spool)
+{
+    (void)spool;
+}
+
+int IotHubSpool_Append(IOTHUB_SPOOL_HANDLE spool, MESSAGE_HANDLE message)
+{
+    (void)spool;
+    (void)message;
+    return __LINE__;
+}
+
+int IotHubSpool_Read(IOTHUB_SPOOL_HANDLE spool, MESSAGE_HANDLE* message, IOTHUB_SPOOL_POSITION* position)
+{
+    (void)spool;
+    (void)message;
+    (void)position;
+    return __LINE__;
+}
+
+void IotHubSpool_Commit(IOTHUB_SPOOL_HANDLE spool, const IOTHUB_SPOOL_POSITION* position)
+{
+    (void)spool;
+    (void)position;
+}
+
+void IotHubSpool_Rewind(IOTHUB_SPOOL_HANDLE spool)
+{
+    (void)spool;
+}
+
+bool IotHubSpool_HasPending(IOTHUB_SPOOL_HANDLE spool)
+{
+    (void)spool;
+    return false;
+}
+
+void IotHubSpool_Flush(IOTHUB_SPOOL_HANDLE spool)
+{
+    (void)spool;
+}
+
+#endif /*WIN32*/
@@ -0,0 +1,517 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*benchmark of the MQTT pool of the IoT Hub module. The module is linked with a
+stand-in of an MQTT broker: every IoTHubClient_LL is a connection of its own,
+as IoT Hub authenticates one device per MQTT connection, and confirms the
+messages it was given each time IoTHubClient_LL_DoWork is called. The stand-in
+of IoTHubClient drives an IoTHubClient_LL from a thread of its own, as
+IoTHubClient does.
+
+Every case sends the messages round robin to DEVICE_COUNT devices and prints
+one JSON object on its own line: the pool size (0 for a thread per device), the
+throughput, the connections opened, the threads that drove them and the
+messages a device got out of order. A case fails when a message is not
+delivered, when a device gets its messages out of order or when more threads
+than the pool size drive the devices. The argument is the number of messages
+of a case.*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "azure_c_shared_utility/map.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "iothub_client.h"
+#include "iothub_client_ll.h"
+#include "iothub_message.h"
+#include "iothubtransport.h"
+#include "broker.h"
+#include "message.h"
+#include "module.h"
+#include "module_access.h"
+#include "gateway_atomic.h"
+#include "iothub.h"
+
+#define DEFAULT_MESSAGES_PER_CASE 100000
+#define DEVICE_COUNT 256
+#define CASE_TIMEOUT_MS 120000
+
+static const size_t pool_sizes[] = { 0, 1, 4, 16 };
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*the stand-in of the MQTT broker*/
+
+typedef struct STANDIN_SEND_TAG
+{
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback;
+    void* context;
+}STANDIN_SEND;
+
+/*an IoTHubClient_LL and its connection. The module calls it under the lock of
+its lane, the stand-in of IoTHubClient under the lock of the client*/
+typedef struct STANDIN_CONNECTION_TAG
+{
+    STANDIN_SEND* queue; /*oldest first*/
+    size_t count;
+    size_t capacity;
+    unsigned long lastSequence;
+    bool sequenced;
+}STANDIN_CONNECTION;
+
+/*an IoTHubClient: a connection driven by a thread of its own*/
+typedef struct STANDIN_CLIENT_TAG
+{
+    STANDIN_CONNECTION* connection;
+    LOCK_HANDLE lock;
+    THREAD_HANDLE thread;
+    bool keepRunning;
+}STANDIN_CLIENT;
+
+typedef struct STANDIN_BROKER_TAG
+{
+    LOCK_HANDLE lock;
+    pthread_t threads[DEVICE_COUNT]; /*the threads that called IoTHubClient_LL_DoWork*/
+    size_t threadCount;
+    volatile long connections;
+    volatile long delivered;
+    volatile long outOfOrder;
+}STANDIN_BROKER;
+
+static STANDIN_BROKER standin;
+
+static void standin_saw_thread(void)
+{
+    pthread_t self = pthread_self();
+    size_t i;
+    (void)Lock(standin.lock);
+    for (i = 0; i < standin.threadCount; i++)
+    {
+        if (pthread_equal(standin.threads[i], self))
+        {
+            break;
+        }
+    }
+    if ((i == standin.threadCount) && (standin.threadCount < DEVICE_COUNT))
+    {
+        standin.threads[standin.threadCount++] = self;
+    }
+    (void)Unlock(standin.lock);
+}
+
+/*gives the messages not confirmed yet to their callbacks with result*/
+static void standin_confirm(STANDIN_CONNECTION* connection, IOTHUB_CLIENT_CONFIRMATION_RESULT result)
+{
+    size_t i;
+    for (i = 0; i < connection->count; i++)
+    {
+        if (connection->queue[i].callback != NULL)
+        {
+            connection->queue[i].callback(result, connection->queue[i].context);
+        }
+    }
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK)
+    {
+        (void)ATOMIC_ADD(standin.delivered, (long)connection->count);
+    }
+    connection->count = 0;
+}
+
+const TRANSPORT_PROVIDER* HTTP_Protocol(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER* AMQP_Protocol(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER* MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+TRANSPORT_HANDLE IoTHubTransport_Create(IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol, const char* iotHubName, const char* iotHubSuffix)
+{
+    (void)protocol;
+    (void)iotHubName;
+    (void)iotHubSuffix;
+    return NULL;
+}
+
+void IoTHubTransport_Destroy(TRANSPORT_HANDLE transportHandle)
+{
+    (void)transportHandle;
+}
+
+IOTHUB_CLIENT_LL_HANDLE IoTHubClient_LL_Create(const IOTHUB_CLIENT_CONFIG* config)
+{
+    STANDIN_CONNECTION* result = (STANDIN_CONNECTION*)calloc(1, sizeof(STANDIN_CONNECTION));
+    (void)config;
+    if (result != NULL)
+    {
+        (void)ATOMIC_INCREMENT(standin.connections);
+    }
+    return (IOTHUB_CLIENT_LL_HANDLE)result;
+}
+
+void IoTHubClient_LL_Destroy(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    STANDIN_CONNECTION* connection = (STANDIN_CONNECTION*)iotHubClientHandle;
+    standin_confirm(connection, IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY);
+    free(connection->queue);
+    free(connection);
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SendEventAsync(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_MESSAGE_HANDLE eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback, void* userContextCallback)
+{
+    IOTHUB_CLIENT_RESULT result;
+    STANDIN_CONNECTION* connection = (STANDIN_CONNECTION*)iotHubClientHandle;
+    const unsigned char* content;
+    size_t size;
+    char text[32];
+
+    if (connection->count == connection->capacity)
+    {
+        size_t capacity = (connection->capacity == 0) ? 64 : connection->capacity * 2;
+        STANDIN_SEND* queue = (STANDIN_SEND*)realloc(connection->queue, capacity * sizeof(STANDIN_SEND));
+        if (queue != NULL)
+        {
+            connection->queue = queue;
+            connection->capacity = capacity;
+        }
+    }
+
+    if ((connection->count == connection->capacity) ||
+        (IoTHubMessage_GetByteArray(eventMessageHandle, &content, &size) != IOTHUB_MESSAGE_OK) ||
+        (size >= sizeof(text)))
+    {
+        result = IOTHUB_CLIENT_ERROR;
+    }
+    else
+    {
+        /*the content of a message is its sequence number, a device has to get them in order*/
+        unsigned long sequence;
+        memcpy(text, content, size);
+        text[size] = '\0';
+        sequence = strtoul(text, NULL, 10);
+        if (connection->sequenced && (sequence <= connection->lastSequence))
+        {
+            (void)ATOMIC_INCREMENT(standin.outOfOrder);
+        }
+        connection->lastSequence = sequence;
+        connection->sequenced = true;
+
+        connection->queue[connection->count].callback = eventConfirmationCallback;
+        connection->queue[connection->count].context = userContextCallback;
+        connection->count++;
+        result = IOTHUB_CLIENT_OK;
+    }
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetMessageCallback(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)messageCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetConnectionStatusCallback(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)connectionStatusCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+void IoTHubClient_LL_DoWork(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    standin_saw_thread();
+    standin_confirm((STANDIN_CONNECTION*)iotHubClientHandle, IOTHUB_CLIENT_CONFIRMATION_OK);
+}
+
+/*the stand-in of IoTHubClient, without a pool every device gets one*/
+
+static int standin_client_worker(void* context)
+{
+    STANDIN_CLIENT* client = (STANDIN_CLIENT*)context;
+    bool keepRunning = true;
+    while (keepRunning)
+    {
+        (void)Lock(client->lock);
+        IoTHubClient_LL_DoWork((IOTHUB_CLIENT_LL_HANDLE)client->connection);
+        keepRunning = client->keepRunning;
+        (void)Unlock(client->lock);
+        ThreadAPI_Sleep(1);
+    }
+    return 0;
+}
+
+IOTHUB_CLIENT_HANDLE IoTHubClient_Create(const IOTHUB_CLIENT_CONFIG* config)
+{
+    STANDIN_CLIENT* result = (STANDIN_CLIENT*)malloc(sizeof(STANDIN_CLIENT));
+    if (result != NULL)
+    {
+        result->keepRunning = true;
+        if ((result->connection = (STANDIN_CONNECTION*)IoTHubClient_LL_Create(config)) == NULL)
+        {
+            free(result);
+            result = NULL;
+        }
+        else if ((result->lock = Lock_Init()) == NULL)
+        {
+            IoTHubClient_LL_Destroy((IOTHUB_CLIENT_LL_HANDLE)result->connection);
+            free(result);
+            result = NULL;
+        }
+        else if (ThreadAPI_Create(&(result->thread), standin_client_worker, result) != THREADAPI_OK)
+        {
+            (void)Lock_Deinit(result->lock);
+            IoTHubClient_LL_Destroy((IOTHUB_CLIENT_LL_HANDLE)result->connection);
+            free(result);
+            result = NULL;
+        }
+    }
+    return (IOTHUB_CLIENT_HANDLE)result;
+}
+
+IOTHUB_CLIENT_HANDLE IoTHubClient_CreateWithTransport(TRANSPORT_HANDLE transportHandle, const IOTHUB_CLIENT_CONFIG* config)
+{
+    (void)transportHandle;
+    return IoTHubClient_Create(config);
+}
+
+void IoTHubClient_Destroy(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
+{
+    STANDIN_CLIENT* client = (STANDIN_CLIENT*)iotHubClientHandle;
+    int notUsed;
+    (void)Lock(client->lock);
+    client->keepRunning = false;
+    (void)Unlock(client->lock);
+    (void)ThreadAPI_Join(client->thread, &notUsed);
+    (void)Lock_Deinit(client->lock);
+    IoTHubClient_LL_Destroy((IOTHUB_CLIENT_LL_HANDLE)client->connection);
+    free(client);
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SendEventAsync(IOTHUB_CLIENT_HANDLE iotHubClientHandle, IOTHUB_MESSAGE_HANDLE eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback, void* userContextCallback)
+{
+    IOTHUB_CLIENT_RESULT result;
+    STANDIN_CLIENT* client = (STANDIN_CLIENT*)iotHubClientHandle;
+    (void)Lock(client->lock);
+    result = IoTHubClient_LL_SendEventAsync((IOTHUB_CLIENT_LL_HANDLE)client->connection, eventMessageHandle, eventConfirmationCallback, userContextCallback);
+    (void)Unlock(client->lock);
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SetMessageCallback(IOTHUB_CLIENT_HANDLE iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)messageCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SetOption(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const char* optionName, const void* value)
+{
+    (void)iotHubClientHandle;
+    (void)optionName;
+    (void)value;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SetConnectionStatusCallback(IOTHUB_CLIENT_HANDLE iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)connectionStatusCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+/*the benchmark*/
+
+static MESSAGE_HANDLE* create_messages(size_t count)
+{
+    MESSAGE_HANDLE* result = (MESSAGE_HANDLE*)calloc(count, sizeof(MESSAGE_HANDLE));
+    if (result != NULL)
+    {
+        size_t i;
+        for (i = 0; i < count; i++)
+        {
+            char deviceName[32];
+            char sequence[32];
+            MESSAGE_CONFIG config;
+            MAP_HANDLE properties = Map_Create(NULL);
+            (void)sprintf(deviceName, "device-%u", (unsigned int)(i % DEVICE_COUNT));
+            (void)sprintf(sequence, "%lu", (unsigned long)i);
+            if ((properties == NULL) ||
+                (Map_Add(properties, "source", "mapping") != MAP_OK) ||
+                (Map_Add(properties, "deviceName", deviceName) != MAP_OK) ||
+                (Map_Add(properties, "deviceKey", "c3BlY2lhbCBrZXk=") != MAP_OK))
+            {
+                result[i] = NULL;
+            }
+            else
+            {
+                config.size = strlen(sequence);
+                config.source = (const unsigned char*)sequence;
+                config.sourceProperties = properties;
+                result[i] = Message_Create(&config);
+            }
+            Map_Destroy(properties);
+            if (result[i] == NULL)
+            {
+                size_t j;
+                for (j = 0; j < i; j++)
+                {
+                    Message_Destroy(result[j]);
+                }
+                free(result);
+                result = NULL;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+static int wait_for_deliveries(long expected)
+{
+    int result = __LINE__;
+    uint64_t deadline = now_ns() + (uint64_t)CASE_TIMEOUT_MS * 1000000u;
+    for (;;)
+    {
+        long done = ATOMIC_READ(standin.delivered);
+        if (done >= expected)
+        {
+            result = 0;
+            break;
+        }
+        else if (now_ns() > deadline)
+        {
+            (void)fprintf(stderr, "timed out with %ld of %ld messages delivered\n", done, expected);
+            break;
+        }
+        else
+        {
+            ThreadAPI_Sleep(1);
+        }
+    }
+    return result;
+}
+
+static int run_case(const MESSAGE_HANDLE* batch, size_t messages, size_t poolSize)
+{
+    int result;
+    const MODULE_API* api = Module_GetApi(MODULE_API_VERSION_1);
+    IOTHUB_CONFIG config;
+    BROKER_HANDLE broker = Broker_Create();
+    MODULE_HANDLE module;
+
+    memset(&standin, 0, sizeof(standin));
+    memset(&config, 0, sizeof(config));
+    config.IoTHubName = "standin";
+    config.IoTHubSuffix = "azure-devices.net";
+    config.transportProvider = MQTT_Protocol;
+    config.mqttPoolSize = poolSize;
+
+    if ((broker == NULL) ||
+        ((standin.lock = Lock_Init()) == NULL))
+    {
+        (void)fprintf(stderr, "unable to set up the case\n");
+        result = __LINE__;
+    }
+    else if ((module = MODULE_CREATE(api)(broker, &config)) == NULL)
+    {
+        (void)fprintf(stderr, "unable to create the module\n");
+        result = __LINE__;
+    }
+    else
+    {
+        uint64_t start = now_ns();
+        double seconds;
+        size_t i;
+
+        for (i = 0; i < messages; i++)
+        {
+            MODULE_RECEIVE(api)(module, batch[i]);
+        }
+        result = wait_for_deliveries((long)messages);
+        seconds = (double)(now_ns() - start) / 1e9;
+
+        (void)Lock(standin.lock);
+        (void)printf("{\"pool\":%u,\"devices\":%u,\"messages\":%u,\"seconds\":%.3f,\"messages_per_second\":%.0f,\"connections\":%ld,\"threads\":%u,\"delivered\":%ld,\"out_of_order\":%ld}\n",
+            (unsigned int)poolSize, (unsigned int)DEVICE_COUNT, (unsigned int)messages, seconds,
+            (seconds > 0) ? (double)messages / seconds : 0.0,
+            ATOMIC_READ(standin.connections), (unsigned int)standin.threadCount,
+            ATOMIC_READ(standin.delivered), ATOMIC_READ(standin.outOfOrder));
+        (void)fflush(stdout);
+        if (ATOMIC_READ(standin.outOfOrder) != 0)
+        {
+            (void)fprintf(stderr, "a device got its messages out of order\n");
+            result = __LINE__;
+        }
+        else if ((poolSize != 0) && (standin.threadCount > poolSize))
+        {
+            (void)fprintf(stderr, "%u threads drove a pool of %u\n", (unsigned int)standin.threadCount, (unsigned int)poolSize);
+            result = __LINE__;
+        }
+        (void)Unlock(standin.lock);
+
+        MODULE_DESTROY(api)(module);
+    }
+
+    if (standin.lock != NULL)
+    {
+        (void)Lock_Deinit(standin.lock);
+    }
+    if (broker != NULL)
+    {
+        Broker_Destroy(broker);
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int result = 0;
+    size_t messages = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES_PER_CASE;
+    MESSAGE_HANDLE* batch = (messages != 0) ? create_messages(messages) : NULL;
+    if (batch == NULL)
+    {
+        (void)fprintf(stderr, "usage: %s [messages per case]\n", argv[0]);
+        result = 1;
+    }
+    else
+    {
+        size_t p;
+        size_t i;
+        for (p = 0; (result == 0) && (p < sizeof(pool_sizes) / sizeof(pool_sizes[0])); p++)
+        {
+            if (run_case(batch, messages, pool_sizes[p]) != 0)
+            {
+                result = 1;
+            }
+        }
+        for (i = 0; i < messages; i++)
+        {
+            Message_Destroy(batch[i]);
+        }
+        free(batch);
+    }
+    return result;
+}
@@ -0,0 +1,606 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/*throughput benchmark of the spool of the IoT Hub module. The module is linked
+with a stand-in of IoTHubClient that confirms the messages from a thread of its
+own, and that can be paused: while it is paused it reports that the network is
+gone and times out the messages it is given, as IoTHubClient does when the
+uplink is down.
+
+Every case runs three phases, each printed as one JSON object on its own line:
+"online" sends the messages while the stand-in is running, "spool" appends them
+while it is paused and "drain" is the time the spool takes to empty once the
+stand-in is resumed. The arguments are the number of messages of a phase and
+the directory the spools are created in (a new one in /tmp by default).*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "azure_c_shared_utility/map.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "iothub_client.h"
+#include "iothub_client_ll.h"
+#include "iothubtransport.h"
+#include "broker.h"
+#include "message.h"
+#include "module.h"
+#include "module_access.h"
+#include "gateway_atomic.h"
+#include "iothub.h"
+
+#define DEFAULT_MESSAGES_PER_PHASE 20000
+#define DEVICE_COUNT 4
+#define STANDIN_TIMEOUT_MS 100
+#define PHASE_TIMEOUT_MS 120000
+
+static const size_t payload_sizes[] = { 64, 1024, 16384 };
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/*the stand-in of IoT Hub*/
+
+typedef struct STANDIN_CLIENT_TAG
+{
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK statusCallback;
+    void* statusContext;
+}STANDIN_CLIENT;
+
+typedef struct STANDIN_SEND_TAG
+{
+    STANDIN_CLIENT* client;
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback;
+    void* context;
+    uint64_t sent;
+}STANDIN_SEND;
+
+typedef struct STANDIN_HUB_TAG
+{
+    LOCK_HANDLE lock;
+    THREAD_HANDLE thread;
+    bool keepRunning;
+    bool paused;
+    STANDIN_SEND* queue; /*oldest first*/
+    size_t count;
+    size_t capacity;
+    STANDIN_CLIENT* clients[DEVICE_COUNT];
+    size_t clientCount;
+    volatile long delivered;
+    volatile long timedOut;
+}STANDIN_HUB;
+
+static STANDIN_HUB hub;
+
+/*takes the first count sends of the queue, the lock is held*/
+static STANDIN_SEND* standin_take(size_t count)
+{
+    STANDIN_SEND* result = (STANDIN_SEND*)malloc(count * sizeof(STANDIN_SEND));
+    if (result != NULL)
+    {
+        memcpy(result, hub.queue, count * sizeof(STANDIN_SEND));
+        memmove(hub.queue, hub.queue + count, (hub.count - count) * sizeof(STANDIN_SEND));
+        hub.count -= count;
+    }
+    return result;
+}
+
+static int standin_worker(void* context)
+{
+    bool keepRunning = true;
+    (void)context;
+    while (keepRunning)
+    {
+        STANDIN_SEND* sends = NULL;
+        size_t count = 0;
+        IOTHUB_CLIENT_CONFIRMATION_RESULT result = IOTHUB_CLIENT_CONFIRMATION_OK;
+
+        (void)Lock(hub.lock);
+        keepRunning = hub.keepRunning;
+        if (!hub.paused)
+        {
+            count = hub.count;
+        }
+        else
+        {
+            uint64_t expired = now_ns() - (uint64_t)STANDIN_TIMEOUT_MS * 1000000u;
+            while ((count < hub.count) && (hub.queue[count].sent < expired))
+            {
+                count++;
+            }
+            result = IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT;
+        }
+        if (count != 0)
+        {
+            sends = standin_take(count);
+        }
+        (void)Unlock(hub.lock);
+
+        if (sends != NULL)
+        {
+            size_t i;
+            for (i = 0; i < count; i++)
+            {
+                if (sends[i].callback != NULL)
+                {
+                    sends[i].callback(result, sends[i].context);
+                }
+            }
+            if (result == IOTHUB_CLIENT_CONFIRMATION_OK)
+            {
+                (void)ATOMIC_ADD(hub.delivered, (long)count);
+            }
+            else
+            {
+                (void)ATOMIC_ADD(hub.timedOut, (long)count);
+            }
+            free(sends);
+        }
+        else
+        {
+            ThreadAPI_Sleep(1);
+        }
+    }
+    return 0;
+}
+
+static void standin_set_paused(bool paused)
+{
+    STANDIN_CLIENT* clients[DEVICE_COUNT];
+    size_t clientCount;
+    size_t i;
+    (void)Lock(hub.lock);
+    hub.paused = paused;
+    clientCount = hub.clientCount;
+    memcpy(clients, hub.clients, sizeof(clients));
+    (void)Unlock(hub.lock);
+
+    for (i = 0; i < clientCount; i++)
+    {
+        if (clients[i]->statusCallback != NULL)
+        {
+            if (paused)
+            {
+                clients[i]->statusCallback(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, IOTHUB_CLIENT_CONNECTION_NO_NETWORK, clients[i]->statusContext);
+            }
+            else
+            {
+                clients[i]->statusCallback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, clients[i]->statusContext);
+            }
+        }
+    }
+}
+
+const TRANSPORT_PROVIDER* HTTP_Protocol(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER* AMQP_Protocol(void)
+{
+    return NULL;
+}
+
+const TRANSPORT_PROVIDER* MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+TRANSPORT_HANDLE IoTHubTransport_Create(IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol, const char* iotHubName, const char* iotHubSuffix)
+{
+    (void)protocol;
+    (void)iotHubName;
+    (void)iotHubSuffix;
+    return (TRANSPORT_HANDLE)&hub;
+}
+
+void IoTHubTransport_Destroy(TRANSPORT_HANDLE transportHandle)
+{
+    (void)transportHandle;
+}
+
+IOTHUB_CLIENT_HANDLE IoTHubClient_CreateWithTransport(TRANSPORT_HANDLE transportHandle, const IOTHUB_CLIENT_CONFIG* config)
+{
+    STANDIN_CLIENT* result = NULL;
+    (void)transportHandle;
+    (void)config;
+    (void)Lock(hub.lock);
+    if ((hub.clientCount < DEVICE_COUNT) &&
+        ((result = (STANDIN_CLIENT*)malloc(sizeof(STANDIN_CLIENT))) != NULL))
+    {
+        result->statusCallback = NULL;
+        result->statusContext = NULL;
+        hub.clients[hub.clientCount++] = result;
+    }
+    (void)Unlock(hub.lock);
+    return (IOTHUB_CLIENT_HANDLE)result;
+}
+
+IOTHUB_CLIENT_HANDLE IoTHubClient_Create(const IOTHUB_CLIENT_CONFIG* config)
+{
+    return IoTHubClient_CreateWithTransport(NULL, config);
+}
+
+void IoTHubClient_Destroy(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
+{
+    STANDIN_CLIENT* client = (STANDIN_CLIENT*)iotHubClientHandle;
+    STANDIN_SEND* destroyed;
+    size_t count = 0;
+    size_t kept = 0;
+    size_t i;
+
+    /*the messages not confirmed yet are confirmed now, as IoTHubClient does*/
+    (void)Lock(hub.lock);
+    destroyed = (STANDIN_SEND*)malloc((hub.count + 1) * sizeof(STANDIN_SEND));
+    for (i = 0; i < hub.count; i++)
+    {
+        if ((hub.queue[i].client == client) && (destroyed != NULL))
+        {
+            destroyed[count++] = hub.queue[i];
+        }
+        else
+        {
+            hub.queue[kept++] = hub.queue[i];
+        }
+    }
+    hub.count = kept;
+    for (i = 0; i < hub.clientCount; i++)
+    {
+        if (hub.clients[i] == client)
+        {
+            hub.clients[i] = hub.clients[--hub.clientCount];
+            break;
+        }
+    }
+    (void)Unlock(hub.lock);
+
+    for (i = 0; i < count; i++)
+    {
+        if (destroyed[i].callback != NULL)
+        {
+            destroyed[i].callback(IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, destroyed[i].context);
+        }
+    }
+    free(destroyed);
+    free(client);
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SendEventAsync(IOTHUB_CLIENT_HANDLE iotHubClientHandle, IOTHUB_MESSAGE_HANDLE eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback, void* userContextCallback)
+{
+    IOTHUB_CLIENT_RESULT result;
+    (void)eventMessageHandle;
+    (void)Lock(hub.lock);
+    if (hub.count == hub.capacity)
+    {
+        size_t capacity = (hub.capacity == 0) ? 1024 : hub.capacity * 2;
+        STANDIN_SEND* queue = (STANDIN_SEND*)realloc(hub.queue, capacity * sizeof(STANDIN_SEND));
+        if (queue != NULL)
+        {
+            hub.queue = queue;
+            hub.capacity = capacity;
+        }
+    }
+    if (hub.count == hub.capacity)
+    {
+        result = IOTHUB_CLIENT_ERROR;
+    }
+    else
+    {
+        STANDIN_SEND* send = &(hub.queue[hub.count++]);
+        send->client = (STANDIN_CLIENT*)iotHubClientHandle;
+        send->callback = eventConfirmationCallback;
+        send->context = userContextCallback;
+        send->sent = now_ns();
+        result = IOTHUB_CLIENT_OK;
+    }
+    (void)Unlock(hub.lock);
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SetMessageCallback(IOTHUB_CLIENT_HANDLE iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)messageCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SetOption(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const char* optionName, const void* value)
+{
+    (void)iotHubClientHandle;
+    (void)optionName;
+    (void)value;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_SetConnectionStatusCallback(IOTHUB_CLIENT_HANDLE iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback, void* userContextCallback)
+{
+    STANDIN_CLIENT* client = (STANDIN_CLIENT*)iotHubClientHandle;
+    (void)Lock(hub.lock);
+    client->statusCallback = connectionStatusCallback;
+    client->statusContext = userContextCallback;
+    (void)Unlock(hub.lock);
+    return IOTHUB_CLIENT_OK;
+}
+
+/*the benchmark does not use the lanes of the MQTT pool*/
+
+IOTHUB_CLIENT_LL_HANDLE IoTHubClient_LL_Create(const IOTHUB_CLIENT_CONFIG* config)
+{
+    (void)config;
+    return NULL;
+}
+
+void IoTHubClient_LL_Destroy(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    (void)iotHubClientHandle;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SendEventAsync(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_MESSAGE_HANDLE eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)eventMessageHandle;
+    (void)eventConfirmationCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_ERROR;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetMessageCallback(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC messageCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)messageCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_ERROR;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClient_LL_SetConnectionStatusCallback(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback, void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)connectionStatusCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_ERROR;
+}
+
+void IoTHubClient_LL_DoWork(IOTHUB_CLIENT_LL_HANDLE iotHubClientHandle)
+{
+    (void)iotHubClientHandle;
+}
+
+/*the benchmark*/
+
+typedef struct PHASE_RESULT_TAG
+{
+    const char* phase;
+    size_t messages;
+    double seconds;
+    long delivered;
+    long timedOut;
+}PHASE_RESULT;
+
+static MESSAGE_HANDLE* create_messages(size_t count, size_t payload_size)
+{
+    MESSAGE_HANDLE* result = (MESSAGE_HANDLE*)calloc(count, sizeof(MESSAGE_HANDLE));
+    unsigned char* payload = (unsigned char*)malloc(payload_size);
+    if ((result == NULL) || (payload == NULL))
+    {
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        size_t i;
+        memset(payload, 'x', payload_size);
+        for (i = 0; i < count; i++)
+        {
+            char deviceName[32];
+            MESSAGE_CONFIG config;
+            MAP_HANDLE properties = Map_Create(NULL);
+            (void)sprintf(deviceName, "device-%u", (unsigned int)(i % DEVICE_COUNT));
+            if ((properties == NULL) ||
+                (Map_Add(properties, "source", "mapping") != MAP_OK) ||
+                (Map_Add(properties, "deviceName", deviceName) != MAP_OK) ||
+                (Map_Add(properties, "deviceKey", "c3BlY2lhbCBrZXk=") != MAP_OK))
+            {
+                result[i] = NULL;
+            }
+            else
+            {
+                config.size = payload_size;
+                config.source = payload;
+                config.sourceProperties = properties;
+                result[i] = Message_Create(&config);
+            }
+            Map_Destroy(properties);
+            if (result[i] == NULL)
+            {
+                size_t j;
+                for (j = 0; j < i; j++)
+                {
+                    Message_Destroy(result[j]);
+                }
+                free(result);
+                result = NULL;
+                break;
+            }
+        }
+    }
+    free(payload);
+    return result;
+}
+
+static int wait_for_deliveries(long expected)
+{
+    int result = __LINE__;
+    uint64_t deadline = now_ns() + (uint64_t)PHASE_TIMEOUT_MS * 1000000u;
+    for (;;)
+    {
+        long done = ATOMIC_READ(hub.delivered);
+        if (done >= expected)
+        {
+            result = 0;
+            break;
+        }
+        else if (now_ns() > deadline)
+        {
+            (void)fprintf(stderr, "timed out with %ld of %ld messages delivered\n", done, expected);
+            break;
+        }
+        else
+        {
+            ThreadAPI_Sleep(1);
+        }
+    }
+    return result;
+}
+
+static void print_result(size_t payload_size, const PHASE_RESULT* phase)
+{
+    (void)printf("{\"phase\":\"%s\",\"payload\":%u,\"messages\":%u,\"seconds\":%.3f,\"messages_per_second\":%.0f,\"delivered\":%ld,\"timed_out\":%ld}\n",
+        phase->phase, (unsigned int)payload_size, (unsigned int)phase->messages, phase->seconds,
+        (phase->seconds > 0) ? (double)phase->messages / phase->seconds : 0.0,
+        phase->delivered, phase->timedOut);
+    (void)fflush(stdout);
+}
+
+static int run_case(const char* directory, size_t messages, size_t payload_size)
+{
+    int result;
+    const MODULE_API* api = Module_GetApi(MODULE_API_VERSION_1);
+    IOTHUB_CONFIG config;
+    BROKER_HANDLE broker = Broker_Create();
+    MESSAGE_HANDLE* batch = create_messages(messages, payload_size);
+    MODULE_HANDLE module = NULL;
+
+    memset(&hub, 0, sizeof(hub));
+    hub.keepRunning = true;
+    memset(&config, 0, sizeof(config));
+    config.IoTHubName = "standin";
+    config.IoTHubSuffix = "azure-devices.net";
+    config.transportProvider = HTTP_Protocol;
+    config.spoolDirectory = directory;
+
+    if ((broker == NULL) ||
+        (batch == NULL) ||
+        ((hub.lock = Lock_Init()) == NULL) ||
+        (ThreadAPI_Create(&hub.thread, standin_worker, NULL) != THREADAPI_OK))
+    {
+        (void)fprintf(stderr, "unable to set up the case\n");
+        result = __LINE__;
+    }
+    else
+    {
+        if ((module = MODULE_CREATE(api)(broker, &config)) == NULL)
+        {
+            (void)fprintf(stderr, "unable to create the module\n");
+            result = __LINE__;
+        }
+        else
+        {
+            PHASE_RESULT phase;
+            uint64_t start;
+            size_t i;
+
+            /*online: the messages go straight to the stand-in*/
+            start = now_ns();
+            for (i = 0; i < messages; i++)
+            {
+                MODULE_RECEIVE(api)(module, batch[i]);
+            }
+            result = wait_for_deliveries((long)messages);
+            phase.phase = "online";
+            phase.messages = messages;
+            phase.seconds = (double)(now_ns() - start) / 1e9;
+            phase.delivered = ATOMIC_READ(hub.delivered);
+            phase.timedOut = ATOMIC_READ(hub.timedOut);
+            print_result(payload_size, &phase);
+
+            /*spool: the stand-in is paused, the messages go to disk*/
+            if (result == 0)
+            {
+                standin_set_paused(true);
+                start = now_ns();
+                for (i = 0; i < messages; i++)
+                {
+                    MODULE_RECEIVE(api)(module, batch[i]);
+                }
+                phase.phase = "spool";
+                phase.seconds = (double)(now_ns() - start) / 1e9;
+                phase.delivered = ATOMIC_READ(hub.delivered);
+                phase.timedOut = ATOMIC_READ(hub.timedOut);
+                print_result(payload_size, &phase);
+
+                /*drain: the stand-in is back, the spool empties in order*/
+                start = now_ns();
+                standin_set_paused(false);
+                result = wait_for_deliveries((long)(2 * messages));
+                phase.phase = "drain";
+                phase.seconds = (double)(now_ns() - start) / 1e9;
+                phase.delivered = ATOMIC_READ(hub.delivered);
+                phase.timedOut = ATOMIC_READ(hub.timedOut);
+                print_result(payload_size, &phase);
+            }
+            MODULE_DESTROY(api)(module);
+        }
+
+        (void)Lock(hub.lock);
+        hub.keepRunning = false;
+        (void)Unlock(hub.lock);
+        (void)ThreadAPI_Join(hub.thread, NULL);
+    }
+
+    if (batch != NULL)
+    {
+        size_t i;
+        for (i = 0; i < messages; i++)
+        {
+            Message_Destroy(batch[i]);
+        }
+        free(batch);
+    }
+    if (hub.lock != NULL)
+    {
+        (void)Lock_Deinit(hub.lock);
+    }
+    free(hub.queue);
+    if (broker != NULL)
+    {
+        Broker_Destroy(broker);
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int result = 0;
+    size_t messages = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES_PER_PHASE;
+    char temporary[] = "/tmp/iothub_spool_bench_XXXXXX";
+    const char* root = (argc > 2) ? argv[2] : mkdtemp(temporary);
+    if ((messages == 0) || (root == NULL))
+    {
+        (void)fprintf(stderr, "usage: %s [messages per phase] [directory]\n", argv[0]);
+        result = 1;
+    }
+    else
+    {
+        size_t z;
+        for (z = 0; (result == 0) && (z < sizeof(payload_sizes) / sizeof(payload_sizes[0])); z++)
+        {
+            char directory[512];
+            (void)snprintf(directory, sizeof(directory), "%s/spool-%u", root, (unsigned int)payload_sizes[z]);
+            if (run_case(directory, messages, payload_sizes[z]) != 0)
+            {
+                result = 1;
+            }
+        }
+    }
+    return result;
+}
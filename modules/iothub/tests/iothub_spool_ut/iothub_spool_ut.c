@@ -0,0 +1,533 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umocktypes_stdint.h"
+
+/*the spool works on real files in a directory of its own for every test, only
+the serialization of the messages and the allocations are stood in for*/
+
+static void* my_gballoc_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void* my_gballoc_realloc(void* ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static void my_gballoc_free(void* ptr)
+{
+    free(ptr);
+}
+
+#define GATEWAY_EXPORT_H
+#define GATEWAY_EXPORT
+
+#define ENABLE_MOCKS
+#include "message.h"
+#include "azure_c_shared_utility/gballoc.h"
+#undef ENABLE_MOCKS
+
+#include "iothub_spool.h"
+
+/*a message is its text, the terminating zero included, and serializes to it*/
+typedef struct FAKE_MESSAGE_TAG
+{
+    int32_t size;
+    char text[64];
+} FAKE_MESSAGE;
+
+static MESSAGE_HANDLE my_Message_CreateFromByteArray(const unsigned char* source, int32_t size)
+{
+    FAKE_MESSAGE* result = (FAKE_MESSAGE*)malloc(sizeof(FAKE_MESSAGE));
+    if (result != NULL)
+    {
+        result->size = size;
+        memcpy(result->text, source, (size_t)size);
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+static int32_t my_Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char* buf, int32_t size)
+{
+    const FAKE_MESSAGE* message = (const FAKE_MESSAGE*)messageHandle;
+    int32_t result;
+    if (buf == NULL)
+    {
+        result = message->size;
+    }
+    else if (size < message->size)
+    {
+        result = -1;
+    }
+    else
+    {
+        memcpy(buf, message->text, (size_t)message->size);
+        result = message->size;
+    }
+    return result;
+}
+
+static void my_Message_Destroy(MESSAGE_HANDLE message)
+{
+    free(message);
+}
+
+/*the layout of the segment files, see iothub_spool.c*/
+#define SEGMENT_HEADER_SIZE         64
+#define SEGMENT_COMMITTED_OFFSET    16
+#define RECORD_HEADER_SIZE          16
+#define RECORD_TIME_OFFSET          8
+#define RECORD_SIZE(text)           (RECORD_HEADER_SIZE + ((strlen(text) + 1 + 7) & ~(size_t)7))
+
+/*a segment of this size holds two of the messages of the tests*/
+#define SMALL_SEGMENT_SIZE          (SEGMENT_HEADER_SIZE + 2 * RECORD_SIZE("message 0") + 8)
+
+static TEST_MUTEX_HANDLE g_testByTest;
+static TEST_MUTEX_HANDLE g_dllByDll;
+static char spoolDirectory[] = "/tmp/iothub_spool_ut_XXXXXX";
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+static IOTHUB_SPOOL_HANDLE open_spool(size_t segmentSize, size_t maxSize, unsigned int maxAgeSeconds)
+{
+    IOTHUB_SPOOL_CONFIG config;
+    IOTHUB_SPOOL_HANDLE result;
+    config.directory = spoolDirectory;
+    config.segmentSize = segmentSize;
+    config.maxSize = maxSize;
+    config.maxAgeSeconds = maxAgeSeconds;
+    result = IotHubSpool_Open(&config);
+    ASSERT_IS_NOT_NULL(result);
+    return result;
+}
+
+static void append_messages(IOTHUB_SPOOL_HANDLE spool, int first, int count)
+{
+    int i;
+    for (i = first; i < first + count; i++)
+    {
+        FAKE_MESSAGE message;
+        (void)snprintf(message.text, sizeof(message.text), "message %d", i);
+        message.size = (int32_t)strlen(message.text) + 1;
+        ASSERT_ARE_EQUAL(int, 0, IotHubSpool_Append(spool, (MESSAGE_HANDLE)&message));
+    }
+}
+
+/*reads the next message and checks it is "message <expected>"*/
+static void read_message(IOTHUB_SPOOL_HANDLE spool, int expected, IOTHUB_SPOOL_POSITION* position)
+{
+    char text[64];
+    MESSAGE_HANDLE message = NULL;
+    (void)snprintf(text, sizeof(text), "message %d", expected);
+    ASSERT_ARE_EQUAL(int, 0, IotHubSpool_Read(spool, &message, position));
+    ASSERT_IS_NOT_NULL(message);
+    ASSERT_ARE_EQUAL(char_ptr, text, ((FAKE_MESSAGE*)message)->text);
+    my_Message_Destroy(message);
+}
+
+static void read_nothing(IOTHUB_SPOOL_HANDLE spool)
+{
+    MESSAGE_HANDLE message = NULL;
+    IOTHUB_SPOOL_POSITION position;
+    ASSERT_ARE_NOT_EQUAL(int, 0, IotHubSpool_Read(spool, &message, &position));
+}
+
+static char* segment_path(uint64_t sequence)
+{
+    static char result[sizeof(spoolDirectory) + 32];
+    (void)snprintf(result, sizeof(result), "%s/%016llx.spool", spoolDirectory, (unsigned long long)sequence);
+    return result;
+}
+
+/*overwrites bytes of a segment file, the spool maps the files shared so it
+sees the change even while it is open*/
+static void write_segment(uint64_t sequence, size_t offset, const void* bytes, size_t size)
+{
+    int fd = open(segment_path(sequence), O_RDWR);
+    ASSERT_ARE_NOT_EQUAL(int, -1, fd);
+    ASSERT_ARE_EQUAL(int, (int)size, (int)pwrite(fd, bytes, size, (off_t)offset));
+    (void)close(fd);
+}
+
+static void remove_directory(const char* directory)
+{
+    DIR* dir = opendir(directory);
+    if (dir != NULL)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if ((strcmp(entry->d_name, ".") != 0) &&
+                (strcmp(entry->d_name, "..") != 0))
+            {
+                char path[sizeof(spoolDirectory) + 256];
+                (void)snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+                (void)unlink(path);
+            }
+        }
+        (void)closedir(dir);
+        (void)rmdir(directory);
+    }
+}
+
+BEGIN_TEST_SUITE(iothub_spool_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    TEST_INITIALIZE_MEMORY_DEBUG(g_dllByDll);
+    g_testByTest = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(g_testByTest);
+
+    umock_c_init(on_umock_c_error);
+    umocktypes_stdint_register_types();
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_realloc, my_gballoc_realloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+
+    REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(const unsigned char*, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(unsigned char*, void*);
+
+    REGISTER_GLOBAL_MOCK_HOOK(Message_CreateFromByteArray, my_Message_CreateFromByteArray);
+    REGISTER_GLOBAL_MOCK_HOOK(Message_ToByteArray, my_Message_ToByteArray);
+    REGISTER_GLOBAL_MOCK_HOOK(Message_Destroy, my_Message_Destroy);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+    TEST_MUTEX_DESTROY(g_testByTest);
+    TEST_DEINITIALIZE_MEMORY_DEBUG(g_dllByDll);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(g_testByTest))
+    {
+        ASSERT_FAIL("our mutex is ABANDONED. Failure in test framework");
+    }
+
+    umock_c_reset_all_calls();
+    (void)strcpy(spoolDirectory, "/tmp/iothub_spool_ut_XXXXXX");
+    ASSERT_IS_NOT_NULL(mkdtemp(spoolDirectory));
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    remove_directory(spoolDirectory);
+    TEST_MUTEX_RELEASE(g_testByTest);
+}
+
+TEST_FUNCTION(IotHubSpool_Read_returns_the_messages_in_the_order_they_were_appended)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 0);
+    ASSERT_IS_FALSE(IotHubSpool_HasPending(spool));
+    append_messages(spool, 0, 3);
+
+    ///act
+    ///assert
+    ASSERT_IS_TRUE(IotHubSpool_HasPending(spool));
+    read_message(spool, 0, &position);
+    read_message(spool, 1, &position);
+    read_message(spool, 2, &position);
+    read_nothing(spool);
+    /*read is not delivered*/
+    ASSERT_IS_TRUE(IotHubSpool_HasPending(spool));
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Commit_of_the_last_message_leaves_nothing_pending)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION first;
+    IOTHUB_SPOOL_POSITION last;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 0);
+    append_messages(spool, 0, 2);
+    read_message(spool, 0, &first);
+    read_message(spool, 1, &last);
+
+    ///act
+    IotHubSpool_Commit(spool, &first);
+
+    ///assert
+    ASSERT_IS_TRUE(IotHubSpool_HasPending(spool));
+    IotHubSpool_Commit(spool, &last);
+    ASSERT_IS_FALSE(IotHubSpool_HasPending(spool));
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Open_recovers_the_messages_not_committed)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 0);
+    append_messages(spool, 0, 3);
+    read_message(spool, 0, &position);
+    IotHubSpool_Commit(spool, &position);
+    /*read but not committed, so read again*/
+    read_message(spool, 1, &position);
+    IotHubSpool_Close(spool);
+
+    ///act
+    spool = open_spool(0, 0, 0);
+
+    ///assert
+    ASSERT_IS_TRUE(IotHubSpool_HasPending(spool));
+    read_message(spool, 1, &position);
+    read_message(spool, 2, &position);
+    read_nothing(spool);
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+/*a spool opened again appends to a new segment, the recovered one is segment 0*/
+TEST_FUNCTION(IotHubSpool_Open_stops_at_a_torn_record)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    /*only the size of the second record reached the file*/
+    uint32_t tornSize = 0x7FFFFFFF;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 0);
+    append_messages(spool, 0, 3);
+    IotHubSpool_Close(spool);
+    write_segment(0, SEGMENT_HEADER_SIZE + RECORD_SIZE("message 0"), &tornSize, sizeof(tornSize));
+
+    ///act
+    spool = open_spool(0, 0, 0);
+
+    ///assert
+    read_message(spool, 0, &position);
+    read_nothing(spool);
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Open_stops_at_a_record_with_a_bad_checksum)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    char garbled = 'X';
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 0);
+    append_messages(spool, 0, 3);
+    IotHubSpool_Close(spool);
+    write_segment(0, SEGMENT_HEADER_SIZE + RECORD_SIZE("message 0") + RECORD_HEADER_SIZE, &garbled, sizeof(garbled));
+
+    ///act
+    spool = open_spool(0, 0, 0);
+
+    ///assert
+    read_message(spool, 0, &position);
+    read_nothing(spool);
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Open_moves_a_commit_in_the_middle_of_a_record_to_its_start)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    uint64_t committed = SEGMENT_HEADER_SIZE + RECORD_SIZE("message 0") + 4;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 0);
+    append_messages(spool, 0, 2);
+    IotHubSpool_Close(spool);
+    write_segment(0, SEGMENT_COMMITTED_OFFSET, &committed, sizeof(committed));
+
+    ///act
+    spool = open_spool(0, 0, 0);
+
+    ///assert
+    /*sent again rather than lost*/
+    read_message(spool, 1, &position);
+    read_nothing(spool);
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Open_moves_a_commit_past_the_end_to_the_end)
+{
+    ///arrange
+    uint64_t committed = 0x10000000;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 0);
+    append_messages(spool, 0, 2);
+    IotHubSpool_Close(spool);
+    write_segment(0, SEGMENT_COMMITTED_OFFSET, &committed, sizeof(committed));
+
+    ///act
+    spool = open_spool(0, 0, 0);
+
+    ///assert
+    ASSERT_IS_FALSE(IotHubSpool_HasPending(spool));
+    read_nothing(spool);
+    /*the recovered segment holds only delivered messages*/
+    ASSERT_ARE_NOT_EQUAL(int, 0, access(segment_path(0), F_OK));
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Append_drops_the_oldest_segment_over_maxSize)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(SMALL_SEGMENT_SIZE, 2 * SMALL_SEGMENT_SIZE, 0);
+    append_messages(spool, 0, 4);
+
+    ///act
+    /*the third segment does not fit with the first two*/
+    append_messages(spool, 4, 1);
+
+    ///assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, access(segment_path(0), F_OK));
+    read_message(spool, 2, &position);
+    read_message(spool, 3, &position);
+    read_message(spool, 4, &position);
+    read_nothing(spool);
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Read_drops_the_messages_older_than_maxAgeSeconds)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION expired;
+    IOTHUB_SPOOL_POSITION position;
+    MESSAGE_HANDLE message = (MESSAGE_HANDLE)0x42;
+    int64_t anHourAgo = (int64_t)time(NULL) - 3600;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(0, 0, 60);
+    append_messages(spool, 0, 2);
+    write_segment(0, SEGMENT_HEADER_SIZE + RECORD_TIME_OFFSET, &anHourAgo, sizeof(anHourAgo));
+
+    ///act
+    int result = IotHubSpool_Read(spool, &message, &expired);
+
+    ///assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_NULL(message);
+    read_message(spool, 1, &position);
+    /*the dropped message is committed with the ones after it*/
+    IotHubSpool_Commit(spool, &position);
+    ASSERT_IS_FALSE(IotHubSpool_HasPending(spool));
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Rewind_reads_again_from_the_first_message_not_committed_across_segments)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    IOTHUB_SPOOL_POSITION third;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(SMALL_SEGMENT_SIZE, 0, 0);
+    append_messages(spool, 0, 5);
+    read_message(spool, 0, &position);
+    read_message(spool, 1, &position);
+    read_message(spool, 2, &third);
+    read_message(spool, 3, &position);
+
+    ///act
+    IotHubSpool_Rewind(spool);
+
+    ///assert
+    read_message(spool, 0, &position);
+    IotHubSpool_Commit(spool, &third);
+    IotHubSpool_Rewind(spool);
+    read_message(spool, 3, &position);
+    read_message(spool, 4, &position);
+    read_nothing(spool);
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Commit_removes_the_segments_holding_only_delivered_messages)
+{
+    ///arrange
+    IOTHUB_SPOOL_POSITION position;
+    IOTHUB_SPOOL_POSITION third;
+    IOTHUB_SPOOL_HANDLE spool = open_spool(SMALL_SEGMENT_SIZE, 0, 0);
+    append_messages(spool, 0, 5);
+    read_message(spool, 0, &position);
+    read_message(spool, 1, &position);
+    read_message(spool, 2, &third);
+
+    ///act
+    IotHubSpool_Commit(spool, &third);
+
+    ///assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, access(segment_path(0), F_OK));
+    ASSERT_ARE_EQUAL(int, 0, access(segment_path(1), F_OK));
+    ASSERT_IS_TRUE(IotHubSpool_HasPending(spool));
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+TEST_FUNCTION(IotHubSpool_Append_fails_when_the_blocks_of_a_new_segment_cannot_be_reserved)
+{
+    ///arrange
+    struct rlimit saved;
+    struct rlimit limit;
+    void(*savedHandler)(int);
+    IOTHUB_SPOOL_HANDLE spool = open_spool(SMALL_SEGMENT_SIZE, 0, 0);
+    append_messages(spool, 0, 2);
+    ASSERT_ARE_EQUAL(int, 0, getrlimit(RLIMIT_FSIZE, &saved));
+    limit = saved;
+    limit.rlim_cur = SMALL_SEGMENT_SIZE / 2;
+    savedHandler = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_ARE_EQUAL(int, 0, setrlimit(RLIMIT_FSIZE, &limit));
+    {
+        FAKE_MESSAGE message;
+        int result;
+        (void)strcpy(message.text, "message 2");
+        message.size = (int32_t)strlen(message.text) + 1;
+
+        ///act
+        result = IotHubSpool_Append(spool, (MESSAGE_HANDLE)&message);
+
+        ///assert
+        (void)setrlimit(RLIMIT_FSIZE, &saved);
+        (void)signal(SIGXFSZ, savedHandler);
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_NOT_EQUAL(int, 0, access(segment_path(1), F_OK));
+    }
+
+    ///cleanup
+    IotHubSpool_Close(spool);
+}
+
+END_TEST_SUITE(iothub_spool_ut)
@@ -3,6 +3,10 @@
 
 #include <cstdlib>
 #include <cstddef>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "testrunnerswitcher.h"
 #include "micromock.h"
 #include "micromockcharstararenullterminatedstrings.h"
@@ -47,9 +51,14 @@ namespace BASEIMPLEMENTATION
 
 #include "iothub.h"
 #include "iothub_client.h"
+#include "iothub_client_ll.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/agenttime.h"
 #include "message.h"
 #include "azure_c_shared_utility/constmap.h"
 #include "azure_c_shared_utility/map.h"
+#include "iothub_spool.h"
 
 DEFINE_MICROMOCK_ENUM_TO_STRING(IOTHUBMESSAGE_DISPOSITION_RESULT, IOTHUBMESSAGE_DISPOSITION_RESULT_VALUES);
 
@@ -69,7 +78,46 @@ static size_t whenShallIoTHubMessage_CreateFromByteArray_fail;
 static size_t currentIoTHubClient_Create_call;
 static size_t whenShallIoTHubClient_Create_fail;
 
+static size_t currentIotHubSpool_Open_call;
+static size_t whenShallIotHubSpool_Open_fail;
+
+static IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK IotHub_ConnectionStatus_callback;
+static void* IotHub_ConnectionStatus_context;
+
+static size_t currentThreadAPI_Create_call;
+static size_t whenShallThreadAPI_Create_fail;
+static THREAD_START_FUNC lastThreadAPI_Create_func;
+static void* lastThreadAPI_Create_arg;
+
+/*a test can run the drain of the spool on a thread of its own. The first time
+it has nothing to do the drain calls onDrainIdle, the second time it waits in
+ThreadAPI_Sleep until IotHub_Destroy joins it. Only one thread calls the mocks
+at any time*/
+static bool drainRunning;
+static std::thread* drainThread;
+static std::mutex drainMutex;
+static std::condition_variable drainChanged;
+static size_t drainIdleCount;
+static bool drainParked;
+static bool drainMayFinish;
+static void(*onDrainIdle)(void);
+
+/*the spool holds spooledMessage until a commit, IotHubSpool_Rewind makes it readable again*/
+static MESSAGE_HANDLE spooledMessage;
+static bool spooledMessageRead;
+
+/*IoTHubClient_Destroy gives up the last message sent, as IoTHubClient does*/
+static bool confirmOnIoTHubClient_Destroy;
+
+/*when set, the "deviceName" of MESSAGE_HANDLE_VALID_1*/
+static const char* testDeviceName;
+
+/*when not 0, the time given by get_time*/
+static time_t fakeTime;
+
 static IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC IotHub_Receive_message_callback_function;
+static IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK IotHub_SendEventAsync_confirmation_callback;
+static void * IotHub_SendEventAsync_confirmation_context;
 static void * IotHub_Receive_message_userContext;
 static const char * IotHub_Receive_message_content;
 static size_t IotHub_Receive_message_size;
@@ -262,6 +310,10 @@ public:
     MOCK_STATIC_METHOD_1(, void*, VECTOR_back, VECTOR_HANDLE, handle)
     MOCK_METHOD_END(void*, BASEIMPLEMENTATION::VECTOR_back(handle))
 
+    MOCK_STATIC_METHOD_3(, void, VECTOR_erase, VECTOR_HANDLE, handle, void*, elements, size_t, numElements)
+        BASEIMPLEMENTATION::VECTOR_erase(handle, elements, numElements);
+    MOCK_VOID_METHOD_END()
+
     MOCK_STATIC_METHOD_1(, void, STRING_delete, STRING_HANDLE, s)
         BASEIMPLEMENTATION::STRING_delete(s);
     MOCK_VOID_METHOD_END()
@@ -325,6 +377,12 @@ public:
     MOCK_METHOD_END(IOTHUB_CLIENT_HANDLE, result2)
 
     MOCK_STATIC_METHOD_1(, void, IoTHubClient_Destroy, IOTHUB_CLIENT_HANDLE, iotHubClientHandle)
+        if (confirmOnIoTHubClient_Destroy && (IotHub_SendEventAsync_confirmation_callback != NULL))
+        {
+            IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback = IotHub_SendEventAsync_confirmation_callback;
+            IotHub_SendEventAsync_confirmation_callback = NULL;
+            callback(IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, IotHub_SendEventAsync_confirmation_context);
+        }
         BASEIMPLEMENTATION::gballoc_free(iotHubClientHandle);
     MOCK_VOID_METHOD_END()
 
@@ -352,6 +410,45 @@ public:
         }
     MOCK_METHOD_END(CONSTMAP_HANDLE, result2)
 
+    MOCK_STATIC_METHOD_2(, const char*, Message_GetProperty, MESSAGE_HANDLE, message, const char*, key)
+        const char* result2 = NULL;
+        if (message == MESSAGE_HANDLE_WITH_SOURCE_NOT_SET_TO_MAPPING)
+        {
+            if (strcmp(key, "source") == 0)
+            {
+                result2 = "notMapping";
+            }
+        }
+        else if ((message == MESSAGE_HANDLE_VALID_1) && (testDeviceName != NULL) && (strcmp(key, "deviceName") == 0))
+        {
+            result2 = testDeviceName;
+        }
+        else if (message == MESSAGE_HANDLE_VALID_1)
+        {
+            size_t i;
+            for (i = 0; i < sizeof(CONSTMAP_KEYS_VALID_1)/sizeof(CONSTMAP_KEYS_VALID_1[0]); i++)
+            {
+                if (strcmp(CONSTMAP_KEYS_VALID_1[i], key) == 0)
+                {
+                    result2 = CONSTMAP_VALUES_VALID_1[i];
+                    break;
+                }
+            }
+        }
+        else if (message == MESSAGE_HANDLE_VALID_2)
+        {
+            size_t i;
+            for (i = 0; i < sizeof(CONSTMAP_KEYS_VALID_2)/sizeof(CONSTMAP_KEYS_VALID_2[0]); i++)
+            {
+                if (strcmp(CONSTMAP_KEYS_VALID_2[i], key) == 0)
+                {
+                    result2 = CONSTMAP_VALUES_VALID_2[i];
+                    break;
+                }
+            }
+        }
+    MOCK_METHOD_END(const char*, result2)
+
     MOCK_STATIC_METHOD_2(, const char*, ConstMap_GetValue, CONSTMAP_HANDLE, handle, const char*, key)
         const char* result2;
         if (handle == CONSTMAP_HANDLE_WITHOUT_SOURCE)
@@ -408,6 +505,11 @@ public:
     MOCK_METHOD_END(MAP_RESULT, MAP_OK)
 
     MOCK_STATIC_METHOD_4(, IOTHUB_CLIENT_RESULT, IoTHubClient_SendEventAsync, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, IOTHUB_MESSAGE_HANDLE, eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK, eventConfirmationCallback, void*, userContextCallback)
+        IotHub_SendEventAsync_confirmation_callback = eventConfirmationCallback;
+        IotHub_SendEventAsync_confirmation_context = userContextCallback;
+    MOCK_METHOD_END(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_OK)
+
+    MOCK_STATIC_METHOD_3(, IOTHUB_CLIENT_RESULT, IoTHubClient_SetOption, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, const char*, optionName, const void*, value)
     MOCK_METHOD_END(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_OK)
 
     MOCK_STATIC_METHOD_3(, IOTHUB_CLIENT_RESULT, IoTHubClient_SetMessageCallback, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC, messageCallback, void*, userContextCallback)
@@ -415,11 +517,190 @@ public:
         IotHub_Receive_message_userContext = userContextCallback;
         MOCK_METHOD_END(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_OK)
 
+    MOCK_STATIC_METHOD_1(, IOTHUB_CLIENT_LL_HANDLE, IoTHubClient_LL_Create, const IOTHUB_CLIENT_CONFIG*, config)
+        IOTHUB_CLIENT_LL_HANDLE result2 = (IOTHUB_CLIENT_LL_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1);
+    MOCK_METHOD_END(IOTHUB_CLIENT_LL_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, void, IoTHubClient_LL_Destroy, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle)
+        BASEIMPLEMENTATION::gballoc_free(iotHubClientHandle);
+    MOCK_VOID_METHOD_END()
+
+    MOCK_STATIC_METHOD_4(, IOTHUB_CLIENT_RESULT, IoTHubClient_LL_SendEventAsync, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle, IOTHUB_MESSAGE_HANDLE, eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK, eventConfirmationCallback, void*, userContextCallback)
+    MOCK_METHOD_END(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_OK)
+
+    MOCK_STATIC_METHOD_3(, IOTHUB_CLIENT_RESULT, IoTHubClient_LL_SetMessageCallback, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC, messageCallback, void*, userContextCallback)
+        IotHub_Receive_message_callback_function = messageCallback;
+        IotHub_Receive_message_userContext = userContextCallback;
+    MOCK_METHOD_END(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_OK)
+
+    MOCK_STATIC_METHOD_1(, void, IoTHubClient_LL_DoWork, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle)
+    MOCK_VOID_METHOD_END()
+
+    // lanes
+    MOCK_STATIC_METHOD_0(, LOCK_HANDLE, Lock_Init)
+        LOCK_HANDLE result2 = (LOCK_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1);
+    MOCK_METHOD_END(LOCK_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, LOCK_RESULT, Lock, LOCK_HANDLE, lock)
+    MOCK_METHOD_END(LOCK_RESULT, LOCK_OK)
+
+    MOCK_STATIC_METHOD_1(, LOCK_RESULT, Unlock, LOCK_HANDLE, lock)
+    MOCK_METHOD_END(LOCK_RESULT, LOCK_OK)
+
+    MOCK_STATIC_METHOD_1(, LOCK_RESULT, Lock_Deinit, LOCK_HANDLE, lock)
+        BASEIMPLEMENTATION::gballoc_free(lock);
+    MOCK_METHOD_END(LOCK_RESULT, LOCK_OK)
+
+    /*the lanes do not run in the tests*/
+    MOCK_STATIC_METHOD_3(, THREADAPI_RESULT, ThreadAPI_Create, THREAD_HANDLE*, threadHandle, THREAD_START_FUNC, func, void*, arg)
+        THREADAPI_RESULT result2;
+        currentThreadAPI_Create_call++;
+        if (whenShallThreadAPI_Create_fail == currentThreadAPI_Create_call)
+        {
+            result2 = THREADAPI_ERROR;
+        }
+        else
+        {
+            *threadHandle = (THREAD_HANDLE)0x42;
+            lastThreadAPI_Create_func = func;
+            lastThreadAPI_Create_arg = arg;
+            result2 = THREADAPI_OK;
+        }
+    MOCK_METHOD_END(THREADAPI_RESULT, result2)
+
+    MOCK_STATIC_METHOD_2(, THREADAPI_RESULT, ThreadAPI_Join, THREAD_HANDLE, threadHandle, int*, res)
+        if (drainThread != NULL)
+        {
+            {
+                std::lock_guard<std::mutex> guard(drainMutex);
+                drainMayFinish = true;
+            }
+            drainChanged.notify_all();
+            drainThread->join();
+            delete drainThread;
+            drainThread = NULL;
+            drainRunning = false;
+        }
+    MOCK_METHOD_END(THREADAPI_RESULT, THREADAPI_OK)
+
+    MOCK_STATIC_METHOD_1(, time_t, get_time, time_t*, currentTime)
+        time_t result2 = (fakeTime != 0) ? fakeTime : time(currentTime);
+    MOCK_METHOD_END(time_t, result2)
+
+    MOCK_STATIC_METHOD_1(, void, ThreadAPI_Sleep, unsigned int, milliseconds)
+        if (drainRunning)
+        {
+            drainIdleCount++;
+            if ((drainIdleCount == 1) && (onDrainIdle != NULL))
+            {
+                onDrainIdle();
+            }
+            else
+            {
+                std::unique_lock<std::mutex> guard(drainMutex);
+                drainParked = true;
+                drainChanged.notify_all();
+                drainChanged.wait(guard, [] { return drainMayFinish; });
+            }
+        }
+    MOCK_VOID_METHOD_END()
+
+    // messages in flight
+    MOCK_STATIC_METHOD_0(, COND_HANDLE, Condition_Init)
+        COND_HANDLE result2 = (COND_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1);
+    MOCK_METHOD_END(COND_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, COND_RESULT, Condition_Post, COND_HANDLE, handle)
+    MOCK_METHOD_END(COND_RESULT, COND_OK)
+
+    /*IoT Hub confirms the last message sent while the module waits*/
+    MOCK_STATIC_METHOD_3(, COND_RESULT, Condition_Wait, COND_HANDLE, handle, LOCK_HANDLE, lock, int, timeout_milliseconds)
+        COND_RESULT result2;
+        if (IotHub_SendEventAsync_confirmation_callback != NULL)
+        {
+            IotHub_SendEventAsync_confirmation_callback(IOTHUB_CLIENT_CONFIRMATION_OK, IotHub_SendEventAsync_confirmation_context);
+            result2 = COND_OK;
+        }
+        else
+        {
+            result2 = COND_ERROR;
+        }
+    MOCK_METHOD_END(COND_RESULT, result2)
+
+    MOCK_STATIC_METHOD_1(, void, Condition_Deinit, COND_HANDLE, handle)
+        BASEIMPLEMENTATION::gballoc_free(handle);
+    MOCK_VOID_METHOD_END()
+
+    // spool
+    MOCK_STATIC_METHOD_1(, IOTHUB_SPOOL_HANDLE, IotHubSpool_Open, const IOTHUB_SPOOL_CONFIG*, config)
+        IOTHUB_SPOOL_HANDLE result2;
+        currentIotHubSpool_Open_call++;
+        if (whenShallIotHubSpool_Open_fail == currentIotHubSpool_Open_call)
+        {
+            result2 = NULL;
+        }
+        else
+        {
+            result2 = (IOTHUB_SPOOL_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1);
+        }
+    MOCK_METHOD_END(IOTHUB_SPOOL_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, void, IotHubSpool_Close, IOTHUB_SPOOL_HANDLE, spool)
+        BASEIMPLEMENTATION::gballoc_free(spool);
+    MOCK_VOID_METHOD_END()
+
+    MOCK_STATIC_METHOD_2(, int, IotHubSpool_Append, IOTHUB_SPOOL_HANDLE, spool, MESSAGE_HANDLE, message)
+    MOCK_METHOD_END(int, 0)
+
+    /*the spool is empty unless a test spooled a message*/
+    MOCK_STATIC_METHOD_3(, int, IotHubSpool_Read, IOTHUB_SPOOL_HANDLE, spool, MESSAGE_HANDLE*, message, IOTHUB_SPOOL_POSITION*, position)
+        int result2;
+        if ((spooledMessage == NULL) || spooledMessageRead)
+        {
+            result2 = __LINE__;
+        }
+        else
+        {
+            spooledMessageRead = true;
+            *message = spooledMessage;
+            position->segment = 0;
+            position->offset = 1;
+            result2 = 0;
+        }
+    MOCK_METHOD_END(int, result2)
+
+    MOCK_STATIC_METHOD_2(, void, IotHubSpool_Commit, IOTHUB_SPOOL_HANDLE, spool, const IOTHUB_SPOOL_POSITION*, position)
+        spooledMessage = NULL;
+    MOCK_VOID_METHOD_END()
+
+    MOCK_STATIC_METHOD_1(, void, IotHubSpool_Rewind, IOTHUB_SPOOL_HANDLE, spool)
+        spooledMessageRead = false;
+    MOCK_VOID_METHOD_END()
+
+    MOCK_STATIC_METHOD_1(, bool, IotHubSpool_HasPending, IOTHUB_SPOOL_HANDLE, spool)
+    MOCK_METHOD_END(bool, false)
+
+    MOCK_STATIC_METHOD_1(, void, IotHubSpool_Flush, IOTHUB_SPOOL_HANDLE, spool)
+    MOCK_VOID_METHOD_END()
+
+    MOCK_STATIC_METHOD_3(, IOTHUB_CLIENT_RESULT, IoTHubClient_SetConnectionStatusCallback, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK, connectionStatusCallback, void*, userContextCallback)
+        IotHub_ConnectionStatus_callback = connectionStatusCallback;
+        IotHub_ConnectionStatus_context = userContextCallback;
+    MOCK_METHOD_END(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_OK)
+
+    MOCK_STATIC_METHOD_3(, IOTHUB_CLIENT_RESULT, IoTHubClient_LL_SetConnectionStatusCallback, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK, connectionStatusCallback, void*, userContextCallback)
+        IotHub_ConnectionStatus_callback = connectionStatusCallback;
+        IotHub_ConnectionStatus_context = userContextCallback;
+    MOCK_METHOD_END(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_OK)
+
 
     //// GW Message
     MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG*, cfg)
     MOCK_METHOD_END(MESSAGE_HANDLE, (MESSAGE_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1))
 
+    MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE, message)
+    MOCK_METHOD_END(MESSAGE_HANDLE, (MESSAGE_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1))
+
     MOCK_STATIC_METHOD_1(, void, Message_Destroy, MESSAGE_HANDLE, message)
         BASEIMPLEMENTATION::gballoc_free(message);
     MOCK_VOID_METHOD_END()
@@ -540,6 +821,12 @@ public:
         }
     MOCK_METHOD_END(const char*, result2);
 
+    MOCK_STATIC_METHOD_2(, double, json_object_get_number, const JSON_Object*, object, const char*, name)
+    MOCK_METHOD_END(double, 0);
+
+    MOCK_STATIC_METHOD_2(, int, json_object_get_boolean, const JSON_Object*, object, const char*, name)
+    MOCK_METHOD_END(int, -1);
+
     MOCK_STATIC_METHOD_1(, void, json_value_free, JSON_Value*, value)
         free(value);
     MOCK_VOID_METHOD_END();
@@ -565,7 +852,9 @@ DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , IOTHUB_CLIENT_HANDLE, IoTHubClient_C
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , IOTHUB_CLIENT_HANDLE, IoTHubClient_Create, const IOTHUB_CLIENT_CONFIG*, config)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IoTHubClient_Destroy, IOTHUB_CLIENT_HANDLE, iotHubClientHandle)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , CONSTMAP_HANDLE, Message_GetProperties, MESSAGE_HANDLE, message)
+DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , const char*, Message_GetProperty, MESSAGE_HANDLE, message, const char*, key)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG*, cfg)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE, message)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, Message_Destroy, MESSAGE_HANDLE, message)
 DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , const char*, ConstMap_GetValue, CONSTMAP_HANDLE, handle, const char*, key)
 DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , MAP_RESULT, Map_AddOrUpdate, MAP_HANDLE, handle, const char*, key, const char*, value);
@@ -573,6 +862,34 @@ DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , MAP_RESULT, Map_Add, MAP_HANDLE, han
 DECLARE_GLOBAL_MOCK_METHOD_4(IotHubMocks, , CONSTMAP_RESULT, ConstMap_GetInternals, CONSTMAP_HANDLE, handle, const char*const**, keys, const char*const**, values, size_t*, count)
 DECLARE_GLOBAL_MOCK_METHOD_4(IotHubMocks, ,IOTHUB_CLIENT_RESULT, IoTHubClient_SendEventAsync, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, IOTHUB_MESSAGE_HANDLE, eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK, eventConfirmationCallback, void*, userContextCallback)
 DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , IOTHUB_CLIENT_RESULT, IoTHubClient_SetMessageCallback, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC, messageCallback, void*, userContextCallback)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , IOTHUB_CLIENT_RESULT, IoTHubClient_SetOption, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, const char*, optionName, const void*, value)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , IOTHUB_CLIENT_LL_HANDLE, IoTHubClient_LL_Create, const IOTHUB_CLIENT_CONFIG*, config)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IoTHubClient_LL_Destroy, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle)
+DECLARE_GLOBAL_MOCK_METHOD_4(IotHubMocks, , IOTHUB_CLIENT_RESULT, IoTHubClient_LL_SendEventAsync, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle, IOTHUB_MESSAGE_HANDLE, eventMessageHandle, IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK, eventConfirmationCallback, void*, userContextCallback)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , IOTHUB_CLIENT_RESULT, IoTHubClient_LL_SetMessageCallback, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC, messageCallback, void*, userContextCallback)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IoTHubClient_LL_DoWork, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle)
+DECLARE_GLOBAL_MOCK_METHOD_0(IotHubMocks, , LOCK_HANDLE, Lock_Init)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , LOCK_RESULT, Lock, LOCK_HANDLE, lock)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , LOCK_RESULT, Unlock, LOCK_HANDLE, lock)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , LOCK_RESULT, Lock_Deinit, LOCK_HANDLE, lock)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , THREADAPI_RESULT, ThreadAPI_Create, THREAD_HANDLE*, threadHandle, THREAD_START_FUNC, func, void*, arg)
+DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , THREADAPI_RESULT, ThreadAPI_Join, THREAD_HANDLE, threadHandle, int*, res)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , time_t, get_time, time_t*, currentTime)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, ThreadAPI_Sleep, unsigned int, milliseconds)
+DECLARE_GLOBAL_MOCK_METHOD_0(IotHubMocks, , COND_HANDLE, Condition_Init)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , COND_RESULT, Condition_Post, COND_HANDLE, handle)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , COND_RESULT, Condition_Wait, COND_HANDLE, handle, LOCK_HANDLE, lock, int, timeout_milliseconds)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, Condition_Deinit, COND_HANDLE, handle)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , IOTHUB_SPOOL_HANDLE, IotHubSpool_Open, const IOTHUB_SPOOL_CONFIG*, config)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IotHubSpool_Close, IOTHUB_SPOOL_HANDLE, spool)
+DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , int, IotHubSpool_Append, IOTHUB_SPOOL_HANDLE, spool, MESSAGE_HANDLE, message)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , int, IotHubSpool_Read, IOTHUB_SPOOL_HANDLE, spool, MESSAGE_HANDLE*, message, IOTHUB_SPOOL_POSITION*, position)
+DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , void, IotHubSpool_Commit, IOTHUB_SPOOL_HANDLE, spool, const IOTHUB_SPOOL_POSITION*, position)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IotHubSpool_Rewind, IOTHUB_SPOOL_HANDLE, spool)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , bool, IotHubSpool_HasPending, IOTHUB_SPOOL_HANDLE, spool)
+DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IotHubSpool_Flush, IOTHUB_SPOOL_HANDLE, spool)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , IOTHUB_CLIENT_RESULT, IoTHubClient_SetConnectionStatusCallback, IOTHUB_CLIENT_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK, connectionStatusCallback, void*, userContextCallback)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , IOTHUB_CLIENT_RESULT, IoTHubClient_LL_SetConnectionStatusCallback, IOTHUB_CLIENT_LL_HANDLE, iotHubClientHandle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK, connectionStatusCallback, void*, userContextCallback)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , const CONSTBUFFER *, Message_GetContent, MESSAGE_HANDLE, message)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IoTHubMessage_Destroy, IOTHUB_MESSAGE_HANDLE, iotHubMessageHandle)
 DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , IOTHUB_MESSAGE_HANDLE, IoTHubMessage_CreateFromByteArray, const unsigned char*, byteArray, size_t, size)
@@ -581,14 +898,42 @@ DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , IOTHUB_MESSAGE_RESULT, IoTHubMessage
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , const char*, IoTHubMessage_GetString, IOTHUB_MESSAGE_HANDLE, iotHubMessageHandle)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , IOTHUBMESSAGE_CONTENT_TYPE, IoTHubMessage_GetContentType, IOTHUB_MESSAGE_HANDLE, iotHubMessageHandle)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void*, VECTOR_back, VECTOR_HANDLE, handle)
+DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , void, VECTOR_erase, VECTOR_HANDLE, handle, void*, elements, size_t, numElements)
 DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , TRANSPORT_HANDLE, IoTHubTransport_Create, IOTHUB_CLIENT_TRANSPORT_PROVIDER, protocol, const char*, iotHubName, const char*, iotHubSuffix)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IoTHubTransport_Destroy, TRANSPORT_HANDLE, transportHlHandle)
 DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , BROKER_RESULT, Broker_Publish, BROKER_HANDLE, broker, MODULE_HANDLE, source, MESSAGE_HANDLE, message)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , JSON_Value*, json_parse_string, const char *, filename);
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , JSON_Object*, json_value_get_object, const JSON_Value*, value);
 DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , const char*, json_object_get_string, const JSON_Object*, object, const char*, name);
+DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , double, json_object_get_number, const JSON_Object*, object, const char*, name);
+DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , int, json_object_get_boolean, const JSON_Object*, object, const char*, name);
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, json_value_free, JSON_Value*, value);
 
+static MODULE_HANDLE drainModule;
+
+/*while the drain has nothing to do, a message of the second device comes in*/
+static void Receive_from_the_second_device(void)
+{
+    Module_Receive(drainModule, MESSAGE_HANDLE_VALID_2);
+}
+
+/*a message of MESSAGE_HANDLE_VALID_1 comes in on behalf of deviceName*/
+static void Receive_from_device(MODULE_HANDLE module, const char* deviceName)
+{
+    testDeviceName = deviceName;
+    Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+    testDeviceName = NULL;
+}
+
+/*runs the drain of the module created last until it waits in ThreadAPI_Sleep for the second time*/
+static void start_drain(void)
+{
+    drainRunning = true;
+    drainThread = new std::thread(lastThreadAPI_Create_func, lastThreadAPI_Create_arg);
+    std::unique_lock<std::mutex> guard(drainMutex);
+    drainChanged.wait(guard, [] { return drainParked; });
+}
+
 BEGIN_TEST_SUITE(iothub_ut)
 
     TEST_SUITE_INITIALIZE(TestClassInitialize)
@@ -630,6 +975,31 @@ BEGIN_TEST_SUITE(iothub_ut)
         currentIoTHubClient_Create_call = 0;
         whenShallIoTHubClient_Create_fail = 0;
 
+        currentThreadAPI_Create_call = 0;
+        whenShallThreadAPI_Create_fail = 0;
+        lastThreadAPI_Create_func = NULL;
+        lastThreadAPI_Create_arg = NULL;
+
+        drainRunning = false;
+        drainThread = NULL;
+        drainIdleCount = 0;
+        drainParked = false;
+        drainMayFinish = false;
+        onDrainIdle = NULL;
+        spooledMessage = NULL;
+        spooledMessageRead = false;
+        confirmOnIoTHubClient_Destroy = false;
+        testDeviceName = NULL;
+        fakeTime = 0;
+
+        currentIotHubSpool_Open_call = 0;
+        whenShallIotHubSpool_Open_fail = 0;
+
+        IotHub_SendEventAsync_confirmation_callback = NULL;
+        IotHub_SendEventAsync_confirmation_context = NULL;
+        IotHub_ConnectionStatus_callback = NULL;
+        IotHub_ConnectionStatus_context = NULL;
+
     }
 
     TEST_FUNCTION_CLEANUP(TestMethodCleanup)
@@ -683,6 +1053,24 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(strlen("aHubName") + 1));
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(strlen("suffix.name") + 1));
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(IOTHUB_CONFIG)));
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "MaxDevices"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "DeviceIdleSeconds"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "MqttPoolSize"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "MaxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "SpoolDirectory"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "SpoolMaxBytes"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "SpoolMaxAgeSeconds"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "Shards"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_boolean(IGNORED_PTR_ARG, "Batching"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -917,132 +1305,332 @@ BEGIN_TEST_SUITE(iothub_ut)
         ///cleanup
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_011: [ If the JSON object does not contain a value named "Transport" then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
-    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_returns_null_when_Transport_is_missing)
+    /*Tests_SRS_IOTHUBMODULE_30_002: [ If "MaxDevices" or "DeviceIdleSeconds" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_returns_null_when_MaxDevices_is_negative)
     {
         ///arrange
-        IotHubMocks mocks;
-        const char * validJsonString = "calling it valid makes it so";
+        CNiceCallComparer<IotHubMocks> mocks;
 
-        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
-        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubName"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubSuffix"))
-            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
             .IgnoreArgument(1)
-            .SetFailReturn((const char *)NULL);
-        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+            .SetReturn("HTTP");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "MaxDevices"))
+            .IgnoreArgument(1)
+            .SetReturn(-1.0);
 
         ///act
-        auto result = Module_ParseConfigurationFromJson(validJsonString);
-        ///assert
+        auto result = Module_ParseConfigurationFromJson("don't care");
 
+        ///assert
         ASSERT_IS_NULL(result);
+        mocks.AssertActualAndExpectedCalls();
 
         ///cleanup
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_007: [ If the JSON object does not contain a value named "IoTHubSuffix" then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
-    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_IoTHubSuffix_not_found_returns_null)
+    /*Tests_SRS_IOTHUBMODULE_30_009: [ If "MqttPoolSize" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_returns_null_when_MqttPoolSize_is_negative)
     {
         ///arrange
-        IotHubMocks mocks;
-        const char * validJsonString = "calling it valid makes it so";
+        CNiceCallComparer<IotHubMocks> mocks;
 
-        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
-        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubName"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubSuffix"))
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
             .IgnoreArgument(1)
-            .SetFailReturn((const char *)NULL);
-        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+            .SetReturn("MQTT");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "MqttPoolSize"))
+            .IgnoreArgument(1)
+            .SetReturn(-1.0);
 
         ///act
-        auto result = Module_ParseConfigurationFromJson(validJsonString);
-        ///assert
+        auto result = Module_ParseConfigurationFromJson("don't care");
 
+        ///assert
         ASSERT_IS_NULL(result);
+        mocks.AssertActualAndExpectedCalls();
 
         ///cleanup
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_006: [ If the JSON object does not contain a value named "IoTHubName" then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
-    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_IoTHubName_not_found_returns_null)
+    /*Tests_SRS_IOTHUBMODULE_30_016: [ If "MaxInFlight" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_returns_null_when_MaxInFlight_is_negative)
     {
         ///arrange
-        IotHubMocks mocks;
-        const char * validJsonString = "calling it valid makes it so";
+        CNiceCallComparer<IotHubMocks> mocks;
 
-        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
-        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubName"))
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
             .IgnoreArgument(1)
-            .SetFailReturn((const char *)NULL);
-        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+            .SetReturn("AMQP");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "MaxInFlight"))
+            .IgnoreArgument(1)
+            .SetReturn(-1.0);
 
         ///act
-        auto result = Module_ParseConfigurationFromJson(validJsonString);
-        ///assert
+        auto result = Module_ParseConfigurationFromJson("don't care");
 
+        ///assert
         ASSERT_IS_NULL(result);
+        mocks.AssertActualAndExpectedCalls();
 
         ///cleanup
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_005: [ If parsing of `configuration` fails, `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
-    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_get_object_null_returns_null)
+    /*Tests_SRS_IOTHUBMODULE_30_017: [ `IotHub_ParseConfigurationFromJson` shall set `batching` if the optional boolean "Batching" is true. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_sets_batching_when_Batching_is_true)
     {
         ///arrange
-        IotHubMocks mocks;
-        const char * validJsonString = "calling it valid makes it so";
+        CNiceCallComparer<IotHubMocks> mocks;
 
-        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
-        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
             .IgnoreArgument(1)
-            .SetFailReturn((JSON_Object*)NULL);
-        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+            .SetReturn("HTTP");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_boolean(IGNORED_PTR_ARG, "Batching"))
+            .IgnoreArgument(1)
+            .SetReturn(1);
 
         ///act
-        auto result = Module_ParseConfigurationFromJson(validJsonString);
+        auto result = (IOTHUB_CONFIG*)Module_ParseConfigurationFromJson("don't care");
+
         ///assert
+        ASSERT_IS_NOT_NULL(result);
+        ASSERT_IS_TRUE(result->batching);
+        mocks.AssertActualAndExpectedCalls();
 
-        ASSERT_IS_NULL(result);
+        ///cleanup
+        Module_FreeConfiguration(result);
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_005: [ If parsing of `configuration` fails, `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
-    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_parse_string_null_returns_null)
+    /*Tests_SRS_IOTHUBMODULE_30_024: [ If "SpoolMaxBytes" or "SpoolMaxAgeSeconds" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_returns_null_when_SpoolMaxBytes_is_negative)
     {
         ///arrange
-        IotHubMocks mocks;
-        const char * invalidJsonString = "calling it invalid has the same effect";
+        CNiceCallComparer<IotHubMocks> mocks;
 
-        STRICT_EXPECTED_CALL(mocks, json_parse_string(invalidJsonString))
-            .SetFailReturn((JSON_Value*)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
+            .IgnoreArgument(1)
+            .SetReturn("HTTP");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "SpoolMaxBytes"))
+            .IgnoreArgument(1)
+            .SetReturn(-1.0);
 
         ///act
-        auto result = Module_ParseConfigurationFromJson(invalidJsonString);
-        ///assert
+        auto result = Module_ParseConfigurationFromJson("don't care");
 
+        ///assert
         ASSERT_IS_NULL(result);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_002: [ If `configuration` is NULL then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
-    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_config_null_returns_null)
+    /*Tests_SRS_IOTHUBMODULE_30_038: [ If "Shards" is negative then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_returns_null_when_Shards_is_negative)
     {
         ///arrange
-        IotHubMocks mocks;
+        CNiceCallComparer<IotHubMocks> mocks;
 
-        ///act
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
+            .IgnoreArgument(1)
+            .SetReturn("HTTP");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "Shards"))
+            .IgnoreArgument(1)
+            .SetReturn(-1.0);
+
+        ///act
+        auto result = Module_ParseConfigurationFromJson("don't care");
+
+        ///assert
+        ASSERT_IS_NULL(result);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_037: [ `IotHub_ParseConfigurationFromJson` shall read the optional number "Shards", 0 if it is missing. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_reads_Shards)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
+            .IgnoreArgument(1)
+            .SetReturn("HTTP");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "Shards"))
+            .IgnoreArgument(1)
+            .SetReturn(4.0);
+
+        ///act
+        auto result = (IOTHUB_CONFIG*)Module_ParseConfigurationFromJson("don't care");
+
+        ///assert
+        ASSERT_IS_NOT_NULL(result);
+        ASSERT_ARE_EQUAL(size_t, (size_t)4, result->shards);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_FreeConfiguration(result);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_023: [ `IotHub_ParseConfigurationFromJson` shall read the optional string "SpoolDirectory" and the optional numbers "SpoolMaxBytes" and "SpoolMaxAgeSeconds", NULL and 0 if they are missing. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_025: [ `IotHub_FreeConfiguration` shall free the string referenced by the `spoolDirectory` data member. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_copies_SpoolDirectory)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
+            .IgnoreArgument(1)
+            .SetReturn("HTTP");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "SpoolDirectory"))
+            .IgnoreArgument(1)
+            .SetReturn("/var/spool/iothub");
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "SpoolMaxBytes"))
+            .IgnoreArgument(1)
+            .SetReturn(1048576.0);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "SpoolMaxAgeSeconds"))
+            .IgnoreArgument(1)
+            .SetReturn(3600.0);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(strlen("/var/spool/iothub") + 1));
+
+        ///act
+        auto result = (IOTHUB_CONFIG*)Module_ParseConfigurationFromJson("don't care");
+
+        ///assert
+        ASSERT_IS_NOT_NULL(result);
+        ASSERT_ARE_EQUAL(char_ptr, "/var/spool/iothub", result->spoolDirectory);
+        ASSERT_ARE_EQUAL(size_t, (size_t)1048576, result->spoolMaxBytes);
+        ASSERT_ARE_EQUAL(int, 3600, (int)result->spoolMaxAgeSeconds);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_FreeConfiguration(result);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_05_011: [ If the JSON object does not contain a value named "Transport" then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_returns_null_when_Transport_is_missing)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        const char * validJsonString = "calling it valid makes it so";
+
+        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
+        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubName"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubSuffix"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "Transport"))
+            .IgnoreArgument(1)
+            .SetFailReturn((const char *)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        auto result = Module_ParseConfigurationFromJson(validJsonString);
+        ///assert
+
+        ASSERT_IS_NULL(result);
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_05_007: [ If the JSON object does not contain a value named "IoTHubSuffix" then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_IoTHubSuffix_not_found_returns_null)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        const char * validJsonString = "calling it valid makes it so";
+
+        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
+        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubName"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubSuffix"))
+            .IgnoreArgument(1)
+            .SetFailReturn((const char *)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        auto result = Module_ParseConfigurationFromJson(validJsonString);
+        ///assert
+
+        ASSERT_IS_NULL(result);
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_05_006: [ If the JSON object does not contain a value named "IoTHubName" then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_IoTHubName_not_found_returns_null)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        const char * validJsonString = "calling it valid makes it so";
+
+        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
+        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "IoTHubName"))
+            .IgnoreArgument(1)
+            .SetFailReturn((const char *)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        auto result = Module_ParseConfigurationFromJson(validJsonString);
+        ///assert
+
+        ASSERT_IS_NULL(result);
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_05_005: [ If parsing of `configuration` fails, `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_get_object_null_returns_null)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        const char * validJsonString = "calling it valid makes it so";
+
+        STRICT_EXPECTED_CALL(mocks, json_parse_string(validJsonString));
+        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetFailReturn((JSON_Object*)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        auto result = Module_ParseConfigurationFromJson(validJsonString);
+        ///assert
+
+        ASSERT_IS_NULL(result);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_05_005: [ If parsing of `configuration` fails, `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_parse_string_null_returns_null)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        const char * invalidJsonString = "calling it invalid has the same effect";
+
+        STRICT_EXPECTED_CALL(mocks, json_parse_string(invalidJsonString))
+            .SetFailReturn((JSON_Value*)NULL);
+
+        ///act
+        auto result = Module_ParseConfigurationFromJson(invalidJsonString);
+        ///assert
+
+        ASSERT_IS_NULL(result);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_05_002: [ If `configuration` is NULL then `IotHub_ParseConfigurationFromJson` shall fail and return NULL. ]*/
+    TEST_FUNCTION(IotHub_ParseConfigurationFromJson_config_null_returns_null)
+    {
+        ///arrange
+        IotHubMocks mocks;
+
+        ///act
         auto result = Module_ParseConfigurationFromJson(NULL);
 
         ///assert
@@ -1170,6 +1758,7 @@ BEGIN_TEST_SUITE(iothub_ut)
     /*Tests_SRS_IOTHUBMODULE_02_029: [ `IotHub_Create` shall create a copy of `configuration->IoTHubSuffix`. ]*/
     /*Tests_SRS_IOTHUBMODULE_02_028: [ `IotHub_Create` shall create a copy of `configuration->IoTHubName`. ]*/
     /*Tests_SRS_IOTHUBMODULE_17_004: [ `IotHub_Create` shall store the broker. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_003: [ `IotHub_Create` shall create an empty index of the personalities by device ID. ]*/
     TEST_FUNCTION(IotHub_Create_succeeds)
     {
         ///arrange
@@ -1183,6 +1772,10 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
             .IgnoreArgument(1);
 
+        /*the personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+
         STRICT_EXPECTED_CALL(mocks, STRING_construct(name));
 
         STRICT_EXPECTED_CALL(mocks, STRING_construct(suffix));
@@ -1211,6 +1804,8 @@ BEGIN_TEST_SUITE(iothub_ut)
 
         EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG));
 
+        EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
+
         EXPECTED_CALL(mocks, STRING_construct(name));
 
         EXPECTED_CALL(mocks, STRING_construct(suffix));
@@ -1239,6 +1834,8 @@ BEGIN_TEST_SUITE(iothub_ut)
 
         EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG));
 
+        EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
+
         EXPECTED_CALL(mocks, STRING_construct(name));
 
         EXPECTED_CALL(mocks, STRING_construct(suffix));
@@ -1257,26 +1854,23 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Destroy(module);
     }
 
-    TEST_FUNCTION(IotHub_Create_does_not_create_an_unrecognized_transport)
+    /*Tests_SRS_IOTHUBMODULE_30_010: [ If `configuration->transportProvider` is `MQTT_Protocol` and `configuration->mqttPoolSize` is not 0, `IotHub_Create` shall start `mqttPoolSize` lanes, each with a lock and a thread. ]*/
+    TEST_FUNCTION(IotHub_Create_starts_the_lanes_of_an_MQTT_pool)
     {
         ///arrange
-        IotHubMocks mocks;
-        AutoConfig config((IOTHUB_CLIENT_TRANSPORT_PROVIDER)0x42);
-        mocks.ResetAllCalls();
-
-        EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
-
-        EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG));
-
-        EXPECTED_CALL(mocks, STRING_construct(name));
-
-        EXPECTED_CALL(mocks, STRING_construct(suffix));
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, MQTT_Protocol, 0, 0, 2 };
 
+        STRICT_EXPECTED_CALL(mocks, Lock_Init())
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(2);
         EXPECTED_CALL(mocks, IoTHubTransport_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .NeverInvoked();
 
         ///act
-        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
 
         ///assert
         ASSERT_IS_NOT_NULL(module);
@@ -1286,65 +1880,311 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Destroy(module);
     }
 
-    /*Tests_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
-    TEST_FUNCTION(IotHub_Create_fails_when_STRING_construct_fails_1)
+    /*Tests_SRS_IOTHUBMODULE_30_011: [ If starting the lanes fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+    TEST_FUNCTION(IotHub_Create_fails_when_a_lane_fails_to_start)
     {
         ///arrange
-        IotHubMocks mocks;
-        AutoConfig config;
-        mocks.ResetAllCalls();
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, MQTT_Protocol, 0, 0, 2 };
+        whenShallThreadAPI_Create_fail = 2;
 
-        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(2);
 
-        STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        /*the lane that started is stopped*/
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
 
-        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Create(HTTP_Protocol, name, suffix));
-        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
 
-        STRICT_EXPECTED_CALL(mocks, STRING_construct(name));
-        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        ///assert
+        ASSERT_IS_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
 
-        whenShallSTRING_construct_fail = currentSTRING_construct_call + 2;
-        STRICT_EXPECTED_CALL(mocks, STRING_construct(suffix));
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_018: [ If `configuration->maxInFlight` is not 0, `IotHub_Create` shall create a lock and a condition to count the messages in flight. ]*/
+    TEST_FUNCTION(IotHub_Create_with_maxInFlight_creates_a_lock_and_a_condition)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 10, false };
+
+        STRICT_EXPECTED_CALL(mocks, Lock_Init());
+        STRICT_EXPECTED_CALL(mocks, Condition_Init());
 
         ///act
-        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
 
         ///assert
-        ASSERT_IS_NULL(module);
+        ASSERT_IS_NOT_NULL(module);
         mocks.AssertActualAndExpectedCalls();
 
         ///cleanup
         Module_Destroy(module);
     }
 
-    /*Tests_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
-    TEST_FUNCTION(IotHub_Create_fails_when_STRING_construct_fails_2)
+    /*Tests_SRS_IOTHUBMODULE_30_026: [ If `configuration->spoolDirectory` is not NULL, `IotHub_Create` shall open the spool in it by calling `IotHubSpool_Open` and start a thread that drains it. ]*/
+    TEST_FUNCTION(IotHub_Create_with_spoolDirectory_opens_the_spool_and_starts_its_drain)
     {
         ///arrange
-        IotHubMocks mocks;
-        AutoConfig config;
-        mocks.ResetAllCalls();
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
 
-        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Open(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Lock_Init())
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
 
-        STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
 
-        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Create(HTTP_Protocol, name, suffix))
+        ///assert
+        ASSERT_IS_NOT_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_027: [ If opening the spool or starting its thread fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+    TEST_FUNCTION(IotHub_Create_fails_when_IotHubSpool_Open_fails)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        whenShallIotHubSpool_Open_fail = 1;
+
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Open(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
+
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+
+        ///assert
+        ASSERT_IS_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_027: [ If opening the spool or starting its thread fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+    TEST_FUNCTION(IotHub_Create_fails_when_the_drain_of_the_spool_fails_to_start)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        whenShallThreadAPI_Create_fail = 1;
+
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Close(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+
+        ///assert
+        ASSERT_IS_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_039: [ If `configuration->shards` is not 0, `IotHub_Create` shall start `shards` shards, each with a lock, a condition and a thread. ]*/
+    TEST_FUNCTION(IotHub_Create_with_shards_starts_the_shards)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, NULL, 0, 0, 2 };
+
+        /*the lock of the personalities and one per shard*/
+        STRICT_EXPECTED_CALL(mocks, Lock_Init())
+            .ExpectedTimesExactly(3);
+        STRICT_EXPECTED_CALL(mocks, Condition_Init())
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(2);
+
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_040: [ If starting the shards fails, `IotHub_Create` shall fail and return `NULL`. ]*/
+    TEST_FUNCTION(IotHub_Create_fails_when_a_shard_fails_to_start)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, NULL, 0, 0, 2 };
+        whenShallThreadAPI_Create_fail = 2;
+
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(2);
+
+        /*the shard that started is stopped*/
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(3);
+
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+
+        ///assert
+        ASSERT_IS_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
+    TEST_FUNCTION(IotHub_Create_fails_when_Condition_Init_fails)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 10, false };
+
+        STRICT_EXPECTED_CALL(mocks, Condition_Init())
+            .SetReturn((COND_HANDLE)NULL);
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+
+        ///assert
+        ASSERT_IS_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+    }
+
+    TEST_FUNCTION(IotHub_Create_does_not_create_an_unrecognized_transport)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        AutoConfig config((IOTHUB_CLIENT_TRANSPORT_PROVIDER)0x42);
+        mocks.ResetAllCalls();
+
+        EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
+
+        EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG));
+
+        EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
+
+        EXPECTED_CALL(mocks, STRING_construct(name));
+
+        EXPECTED_CALL(mocks, STRING_construct(suffix));
+
+        EXPECTED_CALL(mocks, IoTHubTransport_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
+
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
+    TEST_FUNCTION(IotHub_Create_fails_when_STRING_construct_fails_1)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        AutoConfig config;
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*the personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Create(HTTP_Protocol, name, suffix));
+        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, STRING_construct(name));
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        whenShallSTRING_construct_fail = currentSTRING_construct_call + 2;
+        STRICT_EXPECTED_CALL(mocks, STRING_construct(suffix));
+
+        ///act
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+
+        ///assert
+        ASSERT_IS_NULL(module);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_027: [ When `IotHub_Create` encounters an internal failure it shall fail and return `NULL`. ]*/
+    TEST_FUNCTION(IotHub_Create_fails_when_STRING_construct_fails_2)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        AutoConfig config;
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*the personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Create(HTTP_Protocol, name, suffix))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
@@ -1381,6 +2221,12 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
+        /*the personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
         STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Create(HTTP_Protocol, name, suffix))
             .SetFailReturn((TRANSPORT_HANDLE)NULL);
 
@@ -1478,6 +2324,10 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
+        /*personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
         /*IoTHubName cache*/
         STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
@@ -1525,6 +2375,10 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
+        /*this is the personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
         /* transport handle */
         STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
@@ -1583,6 +2437,10 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
+        /*this is the personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
         /*this is allocated memory*/
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
@@ -1597,62 +2455,17 @@ BEGIN_TEST_SUITE(iothub_ut)
     }
 
     /*Tests_SRS_IOTHUBMODULE_02_024: [ Otherwise `IotHub_Destroy` shall free all used resources. ]*/
-    TEST_FUNCTION(IotHub_Destroy_module_with_2_identity)
+    TEST_FUNCTION(IotHub_Destroy_destroys_the_lock_and_the_condition_of_the_messages_in_flight)
     {
         ///arrange
-        IotHubMocks mocks;
-        AutoConfig config;
-        auto module = Module_Create(BROKER_HANDLE_VALID, config);
-        (void)Module_Receive(module, MESSAGE_HANDLE_VALID_1);
-        (void)Module_Receive(module, MESSAGE_HANDLE_VALID_2);
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 10, false };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
         mocks.ResetAllCalls();
 
-        /*this is IoTHubName*/
-        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        /*this is IoTHubSuffix*/
-        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        /*this is the loop trying to dispose of all personalities*/
-        /*1 for this case*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        /*first element*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        /*second element*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        /* transport handle */
-        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        /*this is VECTOR<PERSONALITY>*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
-
-        /*this is allocated memory*/
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
         ///act
@@ -1664,7 +2477,169 @@ BEGIN_TEST_SUITE(iothub_ut)
         ///cleanup - nothing
     }
 
-    /*Tests_SRS_IOTHUBMODULE_02_009: [ If `moduleHandle` or `messageHandle` is `NULL` then `IotHub_Receive` shall do nothing. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_036: [ `IotHub_Destroy` shall stop the thread draining the spool before destroying the personalities, then close the spool. ]*/
+    TEST_FUNCTION(IotHub_Destroy_stops_the_drain_and_closes_the_spool)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Close(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+
+        ///act
+        Module_Destroy(module);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup - nothing
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_045: [ `IotHub_Destroy` shall stop the shards once they sent the messages of their queues, before destroying the personalities. ]*/
+    TEST_FUNCTION(IotHub_Destroy_stops_the_shards_and_releases_what_they_did_not_send)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, NULL, 0, 0, 2 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(2);
+        /*the thread of the shard did not run, the copy of the message is released*/
+        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(3);
+
+        ///act
+        Module_Destroy(module);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup - nothing
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_024: [ Otherwise `IotHub_Destroy` shall free all used resources. ]*/
+    TEST_FUNCTION(IotHub_Destroy_stops_the_lanes_of_the_MQTT_pool)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, MQTT_Protocol, 0, 0, 2 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        (void)Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        /*the device leaves its lane before the lanes stop*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_LL_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+
+        ///act
+        Module_Destroy(module);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup - nothing
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_024: [ Otherwise `IotHub_Destroy` shall free all used resources. ]*/
+    TEST_FUNCTION(IotHub_Destroy_module_with_2_identity)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        AutoConfig config;
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        (void)Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        (void)Module_Receive(module, MESSAGE_HANDLE_VALID_2);
+        mocks.ResetAllCalls();
+
+        /*this is IoTHubName*/
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*this is IoTHubSuffix*/
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*this is the loop trying to dispose of all personalities*/
+        /*1 for this case*/
+        STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        /*first element*/
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*second element*/
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /* transport handle */
+        STRICT_EXPECTED_CALL(mocks, IoTHubTransport_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*this is VECTOR<PERSONALITY>*/
+        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*this is the personality index*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        /*this is allocated memory*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        Module_Destroy(module);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup - nothing
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_009: [ If `moduleHandle` or `messageHandle` is `NULL` then `IotHub_Receive` shall do nothing. ]*/
     TEST_FUNCTION(IotHub_Receive_with_NULL_moduleHandle_returns)
     {
         ///arrange
@@ -1717,15 +2692,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
-
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -1761,10 +2732,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
-        /*getting the location of the personality in the VECTOR*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
 
             /*gettng the GW message content*/
@@ -1782,11 +2749,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
                 .IgnoreArgument(1);
 
-            /*getting the GW message properties*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetProperties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
 
             /*getting the GW keys and values*/
             STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_1, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -1843,18 +2805,708 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Destroy(module);
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_003: [ If a new personality is created and the module's transport has not already been created, an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_Create` with the corresponding transport provider. ]*/
-    TEST_FUNCTION(IotHub_Receive_creates_a_client_with_MQTT_transport)
+    /*Tests_SRS_IOTHUBMODULE_05_003: [ If a new personality is created and the module's transport has not already been created, an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_Create` with the corresponding transport provider. ]*/
+    TEST_FUNCTION(IotHub_Receive_creates_a_client_with_MQTT_transport)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CLIENT_TRANSPORT_PROVIDER transport = MQTT_Protocol;
+        AutoConfig config(transport);
+
+        EXPECTED_CALL(mocks, IoTHubClient_Create(IGNORED_PTR_ARG))
+            .ValidateArgumentBuffer(1, &transport, sizeof(IOTHUB_CLIENT_TRANSPORT_PROVIDER), 0);
+
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_012: [ If the module has lanes, the new personality shall go to the lane picked by the hash of its device ID and an `IOTHUB_CLIENT_LL_HANDLE` will be added to it by a call to `IoTHubClient_LL_Create`. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_013: [ The IoTHubClient_LL of a personality in a lane shall be set to receive messages by calling `IoTHubClient_LL_SetMessageCallback` with callback function `IotHub_ReceiveMessageCallback`, and the personality as context. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_014: [ If the personality is in a lane, `IotHub_Receive` shall call `IoTHubClient_LL_SendEventAsync` under the lock of the lane instead. ]*/
+    TEST_FUNCTION(IotHub_Receive_adds_the_device_to_a_lane_of_the_MQTT_pool)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CLIENT_TRANSPORT_PROVIDER transport = MQTT_Protocol;
+        IOTHUB_CONFIG config = { name, suffix, MQTT_Protocol, 0, 0, 2 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_LL_Create(IGNORED_PTR_ARG))
+            .ValidateArgumentBuffer(1, &transport, sizeof(IOTHUB_CLIENT_TRANSPORT_PROVIDER), 0);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_LL_SetMessageCallback(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_LL_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        EXPECTED_CALL(mocks, IoTHubClient_Create(IGNORED_PTR_ARG))
+            .NeverInvoked();
+        EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_05_003: [ If a new personality is created and the module's transport has not already been created, an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_Create` with the corresponding transport provider. ]*/
+    TEST_FUNCTION(IotHub_Receive_creates_a_client_with_custom_transport)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CLIENT_TRANSPORT_PROVIDER transport = ABCD_Protocol;
+        AutoConfig config(transport);
+
+        EXPECTED_CALL(mocks, IoTHubClient_Create(IGNORED_PTR_ARG))
+            .ValidateArgumentBuffer(1, &transport, sizeof(IOTHUB_CLIENT_TRANSPORT_PROVIDER));
+
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_017: [ Otherwise `IotHub_Receive` shall not create a new personality. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_005: [ `IotHub_Receive` shall look for the personality of the device in the index, in constant time. ]*/
+    /*Tests_SRS_IOTHUBMODULE_02_020: [ `IotHub_Receive` shall call IoTHubClient_SendEventAsync passing the IOTHUB_MESSAGE_HANDLE. ]*/
+    /*Tests_SRS_IOTHUBMODULE_02_022: [ If `IoTHubClient_SendEventAsync` succeeds then `IotHub_Receive` shall return. ]*/
+    TEST_FUNCTION(IotHub_Receive_after_receive_succeeds)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        AutoConfig config;
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
+        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
+
+        /*the index compares the deviceName of the personality with the same hash*/
+        STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
+
+          /*gettng the GW message content*/
+            STRICT_EXPECTED_CALL(mocks, Message_GetContent(MESSAGE_HANDLE_VALID_1));
+
+            /*creating a new IOTHUB_MESSAGE*/
+            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_CreateFromByteArray(IGNORED_PTR_ARG, 1))
+                .ValidateArgumentBuffer(1, CONSTBUFFER_VALID_CONTENT1.buffer, 1);
+
+            /*every creation has its destruction - this one actually happens AFTER SendEventAsync*/
+            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Destroy(IGNORED_PTR_ARG))
+                .IgnoreArgument(1);
+
+            /*getting the IOTHUBMESSAGE properties*/
+            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
+                .IgnoreArgument(1);
+
+
+            /*getting the GW keys and values*/
+            STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_1, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+                .IgnoreArgument(2)
+                .IgnoreArgument(3)
+                .IgnoreArgument(4);
+
+            /*add "source"*/
+            STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "source", "mapping"))
+                .IgnoreArgument(1);
+
+            /*add "somethingExtra"*/
+            STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "somethingExtra", "blue"))
+                .IgnoreArgument(1);
+        }
+
+        /*finally, send the message*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_02_013: [ If no personality exists with a device ID equal to the value of the `deviceName` property of the message, then `IotHub_Receive` shall create a new `PERSONALITY` with the ID and key values from the message. ]*/
+    /*Tests_SRS_IOTHUBMODULE_02_018: [ `IotHub_Receive` shall create a new IOTHUB_MESSAGE_HANDLE having the same content as `messageHandle`, and the same properties with the exception of `deviceName` and `deviceKey`. ]*/
+    /*Tests_SRS_IOTHUBMODULE_02_020: [ `IotHub_Receive` shall call IoTHubClient_SendEventAsync passing the IOTHUB_MESSAGE_HANDLE. ]*/
+    /*Tests_SRS_IOTHUBMODULE_02_022: [ If `IoTHubClient_SendEventAsync` succeeds then `IotHub_Receive` shall return. ]*/
+    TEST_FUNCTION(IotHub_Receive_after_Receive_a_new_device_succeeds)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        AutoConfig config;
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_2));
+        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_2, "source"));
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_2, "deviceName"));
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_2, "deviceKey"));
+
+        /*because the deviceName is brand new, it will be added as a new personality*/
+        {/*separate scope for personality building*/
+         /* create a new PERSONALITY */
+            STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+                .IgnoreArgument(1);
+
+         /*making a copy of the deviceName*/
+            STRICT_EXPECTED_CALL(mocks, STRING_construct("secondDevice"));
+            /*making a copy of the deviceKey*/
+            STRICT_EXPECTED_CALL(mocks, STRING_construct("red"));
+
+            /*getting the stored IoTHubName*/
+            STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+                .IgnoreArgument(1);
+            /*getting the stored IoTHubSuffix*/
+            STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+                .IgnoreArgument(1);
+
+            /*creating the IOTHUB_CLIENT_HANDLE associated with the device*/
+            STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+                .IgnoreArgument(1)
+                .IgnoreArgument(2);
+
+            STRICT_EXPECTED_CALL(mocks, IoTHubClient_SetMessageCallback(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+                .IgnoreArgument(1)
+                .IgnoreArgument(2)
+                .IgnoreArgument(3);
+        }
+
+        /*adding the personality to the VECTOR or personalities*/
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
+
+          /*gettng the GW message content*/
+            STRICT_EXPECTED_CALL(mocks, Message_GetContent(MESSAGE_HANDLE_VALID_2));
+
+            /*creating a new IOTHUB_MESSAGE*/
+            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_CreateFromByteArray(IGNORED_PTR_ARG, 0))
+                ;
+
+            /*every creation has its destruction - this one actually happens AFTER SendEventAsync*/
+            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Destroy(IGNORED_PTR_ARG))
+                .IgnoreArgument(1);
+
+            /*getting the IOTHUBMESSAGE properties*/
+            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
+                .IgnoreArgument(1);
+
+
+            /*getting the GW keys and values*/
+            STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_2, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+                .IgnoreArgument(2)
+                .IgnoreArgument(3)
+                .IgnoreArgument(4);
+
+            /*add "source"*/
+            STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "source", "mapping"))
+                .IgnoreArgument(1);
+        }
+
+        /*finally, send the message*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_2);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_004: [ `IotHub_Create` shall store `configuration->maxDevices` and `configuration->deviceIdleSeconds`. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_006: [ If `maxDevices` personalities exist already, `IotHub_Receive` shall destroy the least recently used one before creating a new one. ]*/
+    TEST_FUNCTION(IotHub_Receive_destroys_the_least_recently_used_personality_when_maxDevices_is_reached)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 1, 0 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        /*the personality of "firstDevice" goes*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        /*to make room for "secondDevice"*/
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("secondDevice"));
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_2);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_005: [ `IotHub_Receive` shall look for the personality of the device in the index, in constant time. ]*/
+    TEST_FUNCTION(IotHub_Receive_grows_the_index_of_the_personalities_at_the_8th_device)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0 };
+        const char* deviceNames[] = { "device0", "device1", "device2", "device3", "device4", "device5", "device6" };
+        size_t i;
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        for (i = 0; i < sizeof(deviceNames) / sizeof(deviceNames[0]); i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+        mocks.ResetAllCalls();
+
+        /*7 personalities and the new one would fill half of the 16 slots*/
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(32 * sizeof(void*)))
+            .ExpectedTimesExactly(1);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(1);
+
+        ///act
+        Receive_from_device(module, "device7");
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_005: [ `IotHub_Receive` shall look for the personality of the device in the index, in constant time. ]*/
+    TEST_FUNCTION(IotHub_Receive_finds_the_personalities_not_moved_yet_to_the_grown_index)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0 };
+        const char* deviceNames[] = { "device0", "device1", "device2", "device3", "device4", "device5", "device6", "device7" };
+        size_t i;
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        for (i = 0; i < sizeof(deviceNames) / sizeof(deviceNames[0]); i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+        mocks.ResetAllCalls();
+
+        /*"device7" grew the index and only moved the first 8 of the 16 previous slots. "device0" and "device6" hash
+        to the slots 9 and 15, so they are only found in the previous index*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .NeverInvoked();
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(8);
+
+        ///act
+        for (i = 0; i < sizeof(deviceNames) / sizeof(deviceNames[0]); i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_006: [ If `maxDevices` personalities exist already, `IotHub_Receive` shall destroy the least recently used one before creating a new one. ]*/
+    TEST_FUNCTION(IotHub_Receive_reuses_the_slots_of_the_destroyed_personalities)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 10, 0 };
+        const char* deviceNames[] = { "device0", "device1", "device2", "device3", "device4", "device5", "device6", "device7", "device8", "device9", "device10" };
+        size_t i;
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        for (i = 0; i < 10; i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+        mocks.ResetAllCalls();
+
+        /*each device destroys the one that comes next, whose slot it takes back later. Without that the 32 slots
+        would fill up with tombstones and the index would be allocated again*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(110);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(110);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(32 * sizeof(void*)))
+            .NeverInvoked();
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(64 * sizeof(void*)))
+            .NeverInvoked();
+
+        ///act
+        for (i = 0; i < 110; i++)
+        {
+            Receive_from_device(module, deviceNames[(10 + i) % 11]);
+        }
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_007: [ If `deviceIdleSeconds` is not 0, `IotHub_Receive` shall destroy the personalities that were not used for `deviceIdleSeconds` seconds. ]*/
+    TEST_FUNCTION(IotHub_Receive_destroys_the_personalities_idle_for_deviceIdleSeconds)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 10 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        fakeTime = 1000;
+        Receive_from_device(module, "device0");
+        Receive_from_device(module, "device1");
+        fakeTime = 1005;
+        Receive_from_device(module, "device1");
+        mocks.ResetAllCalls();
+
+        /*"device0" is idle for 12 seconds and goes, "device1" is idle for 7 seconds and stays*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(1);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(1);
+        fakeTime = 1012;
+
+        ///act
+        Receive_from_device(module, "device2");
+        Receive_from_device(module, "device1");
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_005: [ `IotHub_Receive` shall look for the personality of the device in the index, in constant time. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_006: [ If `maxDevices` personalities exist already, `IotHub_Receive` shall destroy the least recently used one before creating a new one. ]*/
+    TEST_FUNCTION(IotHub_Receive_finds_each_of_40_devices_once_while_destroying_the_least_recently_used)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 24, 0 };
+        char deviceNames[40][16];
+        size_t i;
+        for (i = 0; i < 40; i++)
+        {
+            (void)sprintf(deviceNames[i], "device%lu", (unsigned long)i);
+        }
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        mocks.ResetAllCalls();
+
+        /*40 devices, then the 16 destroyed first come back and destroy the next 16 least recently used. The 24
+        devices left are found, and destroyed once with the module*/
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(56);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_Destroy(IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .ExpectedTimesExactly(56);
+
+        ///act
+        for (i = 0; i < 40; i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+        for (i = 0; i < 16; i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+        for (i = 32; i < 40; i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+        for (i = 0; i < 16; i++)
+        {
+            Receive_from_device(module, deviceNames[i]);
+        }
+        Module_Destroy(module);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_021: [ If `maxInFlight` is not 0, `IotHub_Receive` shall wait until fewer than `maxInFlight` messages are in flight, then send the message with a confirmation callback. ]*/
+    TEST_FUNCTION(IotHub_Receive_sends_with_a_confirmation_callback_when_maxInFlight_is_set)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 10, false };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+        EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+            .NeverInvoked();
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        ASSERT_IS_NOT_NULL((void*)IotHub_SendEventAsync_confirmation_callback);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)module, IotHub_SendEventAsync_confirmation_context);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_021: [ If `maxInFlight` is not 0, `IotHub_Receive` shall wait until fewer than `maxInFlight` messages are in flight, then send the message with a confirmation callback. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_020: [ When a message is confirmed, whatever the result, it shall not be counted in flight anymore. ]*/
+    TEST_FUNCTION(IotHub_Receive_waits_for_a_confirmation_when_maxInFlight_messages_are_in_flight)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 1, false };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        /*the mock confirms the first message*/
+        STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_022: [ If the message cannot be sent, it shall not be counted in flight. ]*/
+    TEST_FUNCTION(IotHub_Receive_does_not_count_a_message_that_cannot_be_sent)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 1, false };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .SetReturn(IOTHUB_CLIENT_ERROR);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        mocks.ResetAllCalls();
+
+        EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+            .NeverInvoked();
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_019: [ If `batching` is set and the transport is `HTTP_Protocol`, the new IoTHubClient shall be given the option "Batching" by a call to `IoTHubClient_SetOption`; if that fails the personality shall be created anyway. ]*/
+    TEST_FUNCTION(IotHub_Receive_sets_the_Batching_option_of_an_HTTP_client)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, true };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SetOption(IGNORED_PTR_ARG, "Batching", IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .IgnoreArgument(3)
+            .SetReturn(IOTHUB_CLIENT_ERROR);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_030: [ If the module has a spool, a new IoTHubClient shall be given `IotHub_ConnectionStatusCallback` by a call to `IoTHubClient_SetConnectionStatusCallback` (`IoTHubClient_LL_SetConnectionStatusCallback` in a lane); if that fails the personality shall be created anyway. ]*/
+    TEST_FUNCTION(IotHub_Receive_sets_the_connection_status_callback_when_there_is_a_spool)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SetConnectionStatusCallback(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .SetReturn(IOTHUB_CLIENT_ERROR);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        ASSERT_IS_NOT_NULL((void*)IotHub_ConnectionStatus_callback);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)module, IotHub_ConnectionStatus_context);
+        /*a failed confirmation tells that IoT Hub cannot be reached*/
+        ASSERT_IS_NOT_NULL((void*)IotHub_SendEventAsync_confirmation_callback);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_028: [ If the module has a spool, and IoT Hub cannot be reached or the spool holds messages not delivered yet, `IotHub_Receive` shall append the message to the spool by calling `IotHubSpool_Append` instead of sending it. ]*/
+    TEST_FUNCTION(IotHub_Receive_appends_to_the_spool_when_it_holds_messages)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_HasPending(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetReturn(true);
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Append(IGNORED_PTR_ARG, MESSAGE_HANDLE_VALID_1))
+            .IgnoreArgument(1);
+        EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_031: [ IoT Hub shall be considered unreachable when a message is confirmed with `IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT` or `IOTHUB_CLIENT_CONFIRMATION_ERROR`, or when a client reports `IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED` because of `IOTHUB_CLIENT_CONNECTION_NO_NETWORK`, `IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR` or `IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED`. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_028: [ If the module has a spool, and IoT Hub cannot be reached or the spool holds messages not delivered yet, `IotHub_Receive` shall append the message to the spool by calling `IotHubSpool_Append` instead of sending it. ]*/
+    TEST_FUNCTION(IotHub_Receive_appends_to_the_spool_after_a_message_times_out)
+    {
+        ///arrange
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        IotHub_SendEventAsync_confirmation_callback(IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT, IotHub_SendEventAsync_confirmation_context);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Append(IGNORED_PTR_ARG, MESSAGE_HANDLE_VALID_1))
+            .IgnoreArgument(1);
+        EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
+    /*Tests_SRS_IOTHUBMODULE_30_031: [ IoT Hub shall be considered unreachable when a message is confirmed with `IOTHUB_CLIENT_CONFIRMATION_MESSAGE_TIMEOUT` or `IOTHUB_CLIENT_CONFIRMATION_ERROR`, or when a client reports `IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED` because of `IOTHUB_CLIENT_CONNECTION_NO_NETWORK`, `IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR` or `IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED`. ]*/
+    /*Tests_SRS_IOTHUBMODULE_30_032: [ IoT Hub shall be considered reachable again when a client reports `IOTHUB_CLIENT_CONNECTION_AUTHENTICATED` or a message of the spool is delivered. ]*/
+    TEST_FUNCTION(IotHub_Receive_sends_again_once_the_connection_is_back)
     {
         ///arrange
         CNiceCallComparer<IotHubMocks> mocks;
-        IOTHUB_CLIENT_TRANSPORT_PROVIDER transport = MQTT_Protocol;
-        AutoConfig config(transport);
-
-        EXPECTED_CALL(mocks, IoTHubClient_Create(IGNORED_PTR_ARG))
-            .ValidateArgumentBuffer(1, &transport, sizeof(IOTHUB_CLIENT_TRANSPORT_PROVIDER), 0);
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        IotHub_ConnectionStatus_callback(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, IOTHUB_CLIENT_CONNECTION_NO_NETWORK, IotHub_ConnectionStatus_context);
+        IotHub_ConnectionStatus_callback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, IotHub_ConnectionStatus_context);
+        mocks.ResetAllCalls();
 
-        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        EXPECTED_CALL(mocks, IotHubSpool_Append(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
 
         ///act
         Module_Receive(module, MESSAGE_HANDLE_VALID_1);
@@ -1866,18 +3518,23 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Destroy(module);
     }
 
-    /*Tests_SRS_IOTHUBMODULE_05_003: [ If a new personality is created and the module's transport has not already been created, an `IOTHUB_CLIENT_HANDLE` will be added to the personality by a call to `IoTHubClient_Create` with the corresponding transport provider. ]*/
-    TEST_FUNCTION(IotHub_Receive_creates_a_client_with_custom_transport)
+    /*Tests_SRS_IOTHUBMODULE_30_029: [ If appending to the spool fails, `IotHub_Receive` shall send the message. ]*/
+    TEST_FUNCTION(IotHub_Receive_sends_the_message_when_the_spool_cannot_take_it)
     {
         ///arrange
         CNiceCallComparer<IotHubMocks> mocks;
-        IOTHUB_CLIENT_TRANSPORT_PROVIDER transport = ABCD_Protocol;
-        AutoConfig config(transport);
-
-        EXPECTED_CALL(mocks, IoTHubClient_Create(IGNORED_PTR_ARG))
-            .ValidateArgumentBuffer(1, &transport, sizeof(IOTHUB_CLIENT_TRANSPORT_PROVIDER));
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, "spool", 0, 0 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
+        mocks.ResetAllCalls();
 
-        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_HasPending(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetReturn(true);
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Append(IGNORED_PTR_ARG, MESSAGE_HANDLE_VALID_1))
+            .IgnoreArgument(1)
+            .SetReturn(__LINE__);
+        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
 
         ///act
         Module_Receive(module, MESSAGE_HANDLE_VALID_1);
@@ -1889,205 +3546,63 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Destroy(module);
     }
 
-    /*Tests_SRS_IOTHUBMODULE_02_017: [ Otherwise `IotHub_Receive` shall not create a new personality. ]*/
-    /*Tests_SRS_IOTHUBMODULE_02_020: [ `IotHub_Receive` shall call IoTHubClient_SendEventAsync passing the IOTHUB_MESSAGE_HANDLE. ]*/
-    /*Tests_SRS_IOTHUBMODULE_02_022: [ If `IoTHubClient_SendEventAsync` succeeds then `IotHub_Receive` shall return. ]*/
-    TEST_FUNCTION(IotHub_Receive_after_receive_succeeds)
+    /*Tests_SRS_IOTHUBMODULE_30_047: [ When a message of the spool is confirmed with `IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY` while the module is not being destroyed, the messages of the spool sent and not delivered shall be read again, IoT Hub still being considered reachable. ]*/
+    TEST_FUNCTION(IotHub_drain_sends_again_the_message_of_the_spool_of_an_evicted_device)
     {
         ///arrange
-        IotHubMocks mocks;
-        AutoConfig config;
-        auto module = Module_Create(BROKER_HANDLE_VALID, config);
-        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 1, 0, 0, 0, false, "spool", 0, 0 };
+        drainModule = Module_Create(BROKER_HANDLE_VALID, &config);
+        /*the second device evicts the first one while its message of the spool is not confirmed*/
+        spooledMessage = MESSAGE_HANDLE_VALID_1;
+        onDrainIdle = Receive_from_the_second_device;
+        confirmOnIoTHubClient_Destroy = true;
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
-
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. One in this test*/
-        STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, IotHubSpool_Rewind(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-
-        { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
-
-          /*gettng the GW message content*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetContent(MESSAGE_HANDLE_VALID_1));
-
-            /*creating a new IOTHUB_MESSAGE*/
-            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_CreateFromByteArray(IGNORED_PTR_ARG, 1))
-                .ValidateArgumentBuffer(1, CONSTBUFFER_VALID_CONTENT1.buffer, 1);
-
-            /*every creation has its destruction - this one actually happens AFTER SendEventAsync*/
-            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-
-            /*getting the IOTHUBMESSAGE properties*/
-            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-
-            /*getting the GW message properties*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetProperties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-
-            /*getting the GW keys and values*/
-            STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_1, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-                .IgnoreArgument(2)
-                .IgnoreArgument(3)
-                .IgnoreArgument(4);
-
-            /*add "source"*/
-            STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "source", "mapping"))
-                .IgnoreArgument(1);
-
-            /*add "somethingExtra"*/
-            STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "somethingExtra", "blue"))
-                .IgnoreArgument(1);
-        }
-
-        /*finally, send the message*/
-        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
-            .IgnoreArgument(1)
-            .IgnoreArgument(2);
+        /*the message of the spool, the message of the second device and the message of the spool again*/
+        EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .ExpectedTimesExactly(3);
 
         ///act
-        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        start_drain();
 
         ///assert
         mocks.AssertActualAndExpectedCalls();
 
         ///cleanup
-        Module_Destroy(module);
-
+        Module_Destroy(drainModule);
     }
 
-    /*Tests_SRS_IOTHUBMODULE_02_013: [ If no personality exists with a device ID equal to the value of the `deviceName` property of the message, then `IotHub_Receive` shall create a new `PERSONALITY` with the ID and key values from the message. ]*/
-    /*Tests_SRS_IOTHUBMODULE_02_018: [ `IotHub_Receive` shall create a new IOTHUB_MESSAGE_HANDLE having the same content as `messageHandle`, and the same properties with the exception of `deviceName` and `deviceKey`. ]*/
-    /*Tests_SRS_IOTHUBMODULE_02_020: [ `IotHub_Receive` shall call IoTHubClient_SendEventAsync passing the IOTHUB_MESSAGE_HANDLE. ]*/
-    /*Tests_SRS_IOTHUBMODULE_02_022: [ If `IoTHubClient_SendEventAsync` succeeds then `IotHub_Receive` shall return. ]*/
-    TEST_FUNCTION(IotHub_Receive_after_Receive_a_new_device_succeeds)
+    /*Tests_SRS_IOTHUBMODULE_30_041: [ If the module has shards, `IotHub_Receive` shall queue the message to the shard picked by the hash of `deviceName` instead of sending it. ]*/
+    TEST_FUNCTION(IotHub_Receive_queues_the_message_to_a_shard_when_there_are_shards)
     {
         ///arrange
-        IotHubMocks mocks;
-        AutoConfig config;
-        auto module = Module_Create(BROKER_HANDLE_VALID, config);
-        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+        CNiceCallComparer<IotHubMocks> mocks;
+        IOTHUB_CONFIG config = { name, suffix, HTTP_Protocol, 0, 0, 0, 0, false, NULL, 0, 0, 2 };
+        auto module = Module_Create(BROKER_HANDLE_VALID, &config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_2));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_2, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_2, "deviceName"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_2, "deviceKey"));
-
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. One in this test*/
-        STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Message_Clone(MESSAGE_HANDLE_VALID_1));
+        STRICT_EXPECTED_CALL(mocks, ConstMap_Clone(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-
-        /*because the deviceName is brand new, it will be added as a new personality*/
-        {/*separate scope for personality building*/
-         /* create a new PERSONALITY */
-            STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
-                .IgnoreArgument(1);
-
-         /*making a copy of the deviceName*/
-            STRICT_EXPECTED_CALL(mocks, STRING_construct("secondDevice"));
-            /*making a copy of the deviceKey*/
-            STRICT_EXPECTED_CALL(mocks, STRING_construct("red"));
-
-            /*getting the stored IoTHubName*/
-            STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            /*getting the stored IoTHubSuffix*/
-            STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-
-            /*creating the IOTHUB_CLIENT_HANDLE associated with the device*/
-            STRICT_EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-                .IgnoreArgument(1)
-                .IgnoreArgument(2);
-
-            STRICT_EXPECTED_CALL(mocks, IoTHubClient_SetMessageCallback(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-                .IgnoreArgument(1)
-                .IgnoreArgument(2)
-                .IgnoreArgument(3);
-        }
-
-        /*adding the personality to the VECTOR or personalities*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
-            .IgnoreArgument(1)
-            .IgnoreArgument(2);
-
-        /*getting the location of the personality in the VECTOR*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
-
-        { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
-
-          /*gettng the GW message content*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetContent(MESSAGE_HANDLE_VALID_2));
-
-            /*creating a new IOTHUB_MESSAGE*/
-            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_CreateFromByteArray(IGNORED_PTR_ARG, 0))
-                ;
-
-            /*every creation has its destruction - this one actually happens AFTER SendEventAsync*/
-            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-
-            /*getting the IOTHUBMESSAGE properties*/
-            STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-
-            /*getting the GW message properties*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetProperties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-
-            /*getting the GW keys and values*/
-            STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_2, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-                .IgnoreArgument(2)
-                .IgnoreArgument(3)
-                .IgnoreArgument(4);
-
-            /*add "source"*/
-            STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "source", "mapping"))
-                .IgnoreArgument(1);
-        }
-
-        /*finally, send the message*/
-        STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
-            .IgnoreArgument(1)
-            .IgnoreArgument(2);
+        /*the thread of the shard sends it*/
+        EXPECTED_CALL(mocks, IoTHubClient_CreateWithTransport(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
+        EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .NeverInvoked();
 
         ///act
-        Module_Receive(module, MESSAGE_HANDLE_VALID_2);
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
 
         ///assert
         mocks.AssertActualAndExpectedCalls();
 
         ///cleanup
         Module_Destroy(module);
-
     }
 
     /*Tests_SRS_IOTHUBMODULE_02_021: [ If `IoTHubClient_SendEventAsync` fails then `IotHub_Receive` shall return. ]*/
@@ -2103,15 +3618,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2147,10 +3658,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
-        /*getting the location of the personality in the VECTOR*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
 
           /*gettng the GW message content*/
@@ -2168,11 +3675,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
                 .IgnoreArgument(1);
 
-            /*getting the GW message properties*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetProperties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
 
             /*getting the GW keys and values*/
             STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_1, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -2219,15 +3721,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2264,10 +3762,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
-        /*getting the location of the personality in the VECTOR*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
 
           /*gettng the GW message content*/
@@ -2285,11 +3779,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
                 .IgnoreArgument(1);
 
-            /*getting the GW message properties*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetProperties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
 
             /*getting the GW keys and values*/
             STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_1, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -2331,15 +3820,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2376,10 +3861,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
-        /*getting the location of the personality in the VECTOR*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
 
           /*gettng the GW message content*/
@@ -2397,11 +3878,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
                 .IgnoreArgument(1);
 
-            /*getting the GW message properties*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetProperties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
 
             /*getting the GW keys and values*/
             STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_1, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -2439,15 +3915,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2482,10 +3954,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
-        /*getting the location of the personality in the VECTOR*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
 
           /*gettng the GW message content*/
@@ -2503,11 +3971,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             STRICT_EXPECTED_CALL(mocks, IoTHubMessage_Properties(IGNORED_PTR_ARG))
                 .IgnoreArgument(1);
 
-            /*getting the GW message properties*/
-            STRICT_EXPECTED_CALL(mocks, Message_GetProperties(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
-            STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-                .IgnoreArgument(1);
 
             /*getting the GW keys and values*/
             STRICT_EXPECTED_CALL(mocks, ConstMap_GetInternals(CONSTMAP_HANDLE_VALID_1, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -2541,15 +4004,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2584,10 +4043,6 @@ BEGIN_TEST_SUITE(iothub_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
-        /*getting the location of the personality in the VECTOR*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
         { /*scope for creating the IOTHUBMESSAGE from GWMESSAGE*/
 
           /*gettng the GW message content*/
@@ -2623,15 +4078,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2700,15 +4151,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2747,15 +4194,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2813,15 +4256,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2885,15 +4324,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2936,15 +4371,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
-        STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
 
         /*because the deviceName is brand new, it will be added as a new personality*/
         {/*separate scope for personality building*/
@@ -2973,15 +4404,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"))
             .SetReturn((const char*)NULL);
 
         ///act
@@ -3003,13 +4430,9 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"))
             .SetReturn((const char*)NULL);
 
         ///act
@@ -3031,11 +4454,7 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"))
             .SetReturn((const char*)NULL);
 
         ///act
@@ -3048,6 +4467,33 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Destroy(module);
     }
 
+    TEST_FUNCTION(IotHub_Receive_when_Message_GetProperties_fails_returns)
+    {
+        ///arrange
+        IotHubMocks mocks;
+        AutoConfig config;
+        auto module = Module_Create(BROKER_HANDLE_VALID, config);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "source"));
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceName"));
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperty(MESSAGE_HANDLE_VALID_1, "deviceKey"));
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1))
+            .SetReturn((CONSTMAP_HANDLE)NULL);
+
+        ///act
+        Module_Receive(module, MESSAGE_HANDLE_VALID_1);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Module_Destroy(module);
+    }
+
     /*Tests_SRS_IOTHUBMODULE_17_007: [ `IotHub_ReceiveMessageCallback` shall get properties from message by calling `IoTHubMessage_Properties`. ]*/
     /*Tests_SRS_IOTHUBMODULE_17_009: [ `IotHub_ReceiveMessageCallback` shall define a property "source" as "iothub". ]*/
     /*Tests_SRS_IOTHUBMODULE_17_010: [ `IotHub_ReceiveMessageCallback` shall define a property "deviceName" as the `PERSONALITY`'s deviceName. ]*/
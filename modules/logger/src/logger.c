@@ -375,6 +375,125 @@ static void Logger_Destroy(MODULE_HANDLE module)
     }
 }
 
+/*prints the current local time in timetemp, returns 0 if success, otherwise __LINE__*/
+static int get_log_time(char* timetemp, size_t timetempSize)
+{
+    int result;
+    time_t temp = time(NULL);
+    if (temp == (time_t)-1)
+    {
+        LogError("time function failed");
+        result = __LINE__;
+    }
+    else
+    {
+        struct tm* t = localtime(&temp);
+        if (t == NULL)
+        {
+            LogError("localtime failed");
+            result = __LINE__;
+        }
+        else
+        {
+            if (strftime(timetemp, timetempSize, "%c", t) == 0)
+            {
+                LogError("unable to strftime");
+                result = __LINE__;
+            }
+            else
+            {
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+/*produces the JSON object of one message, preceded by a comma and followed by
+closing. Returns NULL if it fails.*/
+static STRING_HANDLE message_to_json(const char* timetemp, MESSAGE_HANDLE messageHandle, const char* closing)
+{
+    STRING_HANDLE result = NULL;
+
+    /*getting the properties*/
+    /*getting the constmap*/
+    CONSTMAP_HANDLE originalProperties = Message_GetProperties(messageHandle); /*by contract this is never NULL*/
+    MAP_HANDLE propertiesAsMap = ConstMap_CloneWriteable(originalProperties); /*sigh, if only there'd be a constmap_tojson*/
+    if (propertiesAsMap == NULL)
+    {
+        LogError("ConstMap_CloneWriteable failed");
+    }
+    else
+    {
+        STRING_HANDLE jsonProperties = Map_ToJSON(propertiesAsMap);
+        if (jsonProperties == NULL)
+        {
+            LogError("unable to Map_ToJSON");
+        }
+        else
+        {
+            /*getting the base64 encode of the message*/
+            const CONSTBUFFER * content = Message_GetContent(messageHandle); /*by contract, this is never NULL*/
+            STRING_HANDLE contentAsJSON;
+            if (content == NULL)
+            {
+                contentAsJSON = NULL;
+            }
+            else
+            {
+                if (content->buffer == NULL)
+                {
+                    contentAsJSON = STRING_construct_n("", 0);
+                }
+                else
+                {
+                    contentAsJSON = Base64_Encode_Bytes(content->buffer, content->size);
+                }
+            }
+
+            /* NULL value here will be an error.*/
+            if (contentAsJSON == NULL)
+            {
+                LogError("unable to Base64_Encode_Bytes");
+            }
+            else
+            {
+                STRING_HANDLE jsonToBeAppended = STRING_construct(",{\"time\":\"");
+                if (jsonToBeAppended == NULL)
+                {
+                    LogError("unable to STRING_construct");
+                }
+                else
+                {
+
+                    if (!(
+                        (STRING_concat(jsonToBeAppended, timetemp) == 0) &&
+                        (STRING_concat(jsonToBeAppended, "\",\"properties\":") == 0) &&
+                        (STRING_concat_with_STRING(jsonToBeAppended, jsonProperties) == 0) &&
+                        (STRING_concat(jsonToBeAppended, ",\"content\":\"") == 0) &&
+                        (STRING_concat_with_STRING(jsonToBeAppended, contentAsJSON) == 0) &&
+                        (STRING_concat(jsonToBeAppended, closing) == 0)
+                        ))
+                    {
+                        LogError("STRING concatenation error");
+                        STRING_delete(jsonToBeAppended);
+                    }
+                    else
+                    {
+                        result = jsonToBeAppended;
+                    }
+                }
+                STRING_delete(contentAsJSON);
+            }
+            STRING_delete(jsonProperties);
+        }
+        Map_Destroy(propertiesAsMap);
+    }
+    ConstMap_Destroy(originalProperties);
+
+    return result;
+}
+
 static void Logger_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
 {
     /*Codes_SRS_LOGGER_02_009: [If moduleHandle is NULL then Logger_Receive shall fail and return.]*/
@@ -402,125 +521,125 @@ static void Logger_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
         */
 
         /*the function will gather first all the values then will dump them into a STRING_HANDLE that is JSON*/
-
-        /*getting the time*/
-        time_t temp = time(NULL);
-        if (temp == (time_t)-1)
+        char timetemp[80] = { 0 };
+        if (get_log_time(timetemp, sizeof(timetemp) / sizeof(timetemp[0])) != 0)
         {
-            LogError("time function failed");
+            /*Codes_SRS_LOGGER_02_012: [If producing the JSON format or writing it to the file fails, then Logger_Receive shall fail and return.]*/
+            /*just return*/
         }
         else
         {
-            struct tm* t = localtime(&temp);
-            if (t == NULL)
+            STRING_HANDLE jsonToBeAppended = message_to_json(timetemp, messageHandle, "\"}]");
+            if (jsonToBeAppended == NULL)
             {
-                LogError("localtime failed");
+                LogError("unable to produce the JSON of the message");
             }
             else
             {
-                char timetemp[80] = { 0 };
-                if (strftime(timetemp, sizeof(timetemp) / sizeof(timetemp[0]), "%c", t) == 0)
+                LOGGER_HANDLE_DATA *handleData = (LOGGER_HANDLE_DATA *)moduleHandle;
+                if (addJSONString(handleData->fout, STRING_c_str(jsonToBeAppended)) != 0)
                 {
-                    LogError("unable to strftime");
-                    /*Codes_SRS_LOGGER_02_012: [If producing the JSON format or writing it to the file fails, then Logger_Receive shall fail and return.]*/
-                    /*just return*/
+                    LogError("failed top add a json string to the output file");
                 }
                 else
                 {
-                    /*getting the properties*/
-                    /*getting the constmap*/
-                    CONSTMAP_HANDLE originalProperties = Message_GetProperties(messageHandle); /*by contract this is never NULL*/
-                    MAP_HANDLE propertiesAsMap = ConstMap_CloneWriteable(originalProperties); /*sigh, if only there'd be a constmap_tojson*/
-                    if (propertiesAsMap == NULL)
+                    /*all seems fine*/
+                }
+                STRING_delete(jsonToBeAppended);
+            }
+        }
+    }
+    /*Codes_SRS_LOGGER_02_013: [Logger_Receive shall return.]*/
+}
+
+static void Logger_ReceiveBatch(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE* messageHandles, size_t messageCount)
+{
+    /*Codes_SRS_LOGGER_30_001: [If moduleHandle or messageHandles is NULL or messageCount is 0 then Logger_ReceiveBatch shall fail and return.]*/
+    if (
+        (moduleHandle == NULL) ||
+        (messageHandles == NULL) ||
+        (messageCount == 0)
+        )
+    {
+        LogError("invalid arg moduleHandle = %p, messageHandles = %p", moduleHandle, messageHandles);
+    }
+    else
+    {
+        char timetemp[80] = { 0 };
+        if (get_log_time(timetemp, sizeof(timetemp) / sizeof(timetemp[0])) != 0)
+        {
+            /*Codes_SRS_LOGGER_30_004: [If getting the time, producing the JSON or writing it to the file fails, then Logger_ReceiveBatch shall fail and return.]*/
+            /*just return*/
+        }
+        else
+        {
+            /*Codes_SRS_LOGGER_30_002: [Logger_ReceiveBatch shall produce for every message the same JSON object as Logger_Receive, all with the same time, and skip the messages it cannot produce a JSON object for.]*/
+            STRING_HANDLE jsonToBeAppended = NULL;
+            size_t i;
+            for (i = 0; i < messageCount; i++)
+            {
+                STRING_HANDLE messageJson = (messageHandles[i] == NULL) ? NULL : message_to_json(timetemp, messageHandles[i], "\"}");
+                if (messageJson == NULL)
+                {
+                    LogError("unable to produce the JSON of message %d of the batch", (int)i);
+                }
+                else if (jsonToBeAppended == NULL)
+                {
+                    jsonToBeAppended = messageJson;
+                }
+                else
+                {
+                    if (STRING_concat_with_STRING(jsonToBeAppended, messageJson) != 0)
                     {
-                        LogError("ConstMap_CloneWriteable failed");
+                        LogError("STRING concatenation error");
                     }
-                    else
-                    {
-                        STRING_HANDLE jsonProperties = Map_ToJSON(propertiesAsMap);
-                        if (jsonProperties == NULL)
-                        {
-                            LogError("unable to Map_ToJSON");
-                        }
-                        else
-                        {
-                            /*getting the base64 encode of the message*/
-                            const CONSTBUFFER * content = Message_GetContent(messageHandle); /*by contract, this is never NULL*/
-							STRING_HANDLE contentAsJSON;
-							if (content == NULL)
-							{
-								contentAsJSON = NULL;
-							}
-							else
-							{
-								if (content->buffer == NULL)
-								{
-									contentAsJSON = STRING_construct_n("", 0);
-								}
-								else
-								{
-									contentAsJSON = Base64_Encode_Bytes(content->buffer, content->size);
-								}
-							}
-
-							/* NULL value here will be an error.*/
-                            if (contentAsJSON == NULL)
-                            {
-                                LogError("unable to Base64_Encode_Bytes");
-                            }
-                            else
-                            {
-                                STRING_HANDLE jsonToBeAppended = STRING_construct(",{\"time\":\"");
-                                if (jsonToBeAppended == NULL)
-                                {
-                                    LogError("unable to STRING_construct");
-                                }
-                                else
-                                {
+                    STRING_delete(messageJson);
+                }
+            }
 
-                                    if (!(
-                                        (STRING_concat(jsonToBeAppended, timetemp) == 0) &&
-                                        (STRING_concat(jsonToBeAppended, "\",\"properties\":") == 0) &&
-                                        (STRING_concat_with_STRING(jsonToBeAppended, jsonProperties) == 0) &&
-                                        (STRING_concat(jsonToBeAppended, ",\"content\":\"") == 0) &&
-                                        (STRING_concat_with_STRING(jsonToBeAppended, contentAsJSON) == 0) &&
-                                        (STRING_concat(jsonToBeAppended, "\"}]") == 0)
-                                        ))
-                                    {
-                                        LogError("STRING concatenation error");
-                                    }
-                                    else
-                                    {
-                                        LOGGER_HANDLE_DATA *handleData = (LOGGER_HANDLE_DATA *)moduleHandle;
-                                        if (addJSONString(handleData->fout, STRING_c_str(jsonToBeAppended)) != 0)
-                                        {
-                                            LogError("failed top add a json string to the output file");
-                                        }
-                                        else
-                                        {
-                                            /*all seems fine*/
-                                        }
-                                    }
-                                    STRING_delete(jsonToBeAppended);
-                                }
-                                STRING_delete(contentAsJSON);
-                            }
-                            STRING_delete(jsonProperties);
-                        }
-                        Map_Destroy(propertiesAsMap);
-                    }
-                    ConstMap_Destroy(originalProperties);
+            if (jsonToBeAppended == NULL)
+            {
+                LogError("no message of the batch can be logged");
+            }
+            else
+            {
+                /*Codes_SRS_LOGGER_30_003: [Logger_ReceiveBatch shall append all the JSON objects to the fout FILE with a single write.]*/
+                LOGGER_HANDLE_DATA *handleData = (LOGGER_HANDLE_DATA *)moduleHandle;
+                if (STRING_concat(jsonToBeAppended, "]") != 0)
+                {
+                    LogError("STRING concatenation error");
+                }
+                else if (addJSONString(handleData->fout, STRING_c_str(jsonToBeAppended)) != 0)
+                {
+                    LogError("failed to add the json strings to the output file");
                 }
+                else
+                {
+                    /*all seems fine*/
+                }
+                STRING_delete(jsonToBeAppended);
             }
         }
     }
-    /*Codes_SRS_LOGGER_02_013: [Logger_Receive shall return.]*/
 }
 
 /*
  *    Required for all modules:  the public API and the designated implementation functions.
  */
-static const MODULE_API_1 Logger_APIS_all =
+static const MODULE_API_2 Logger_APIS_all =
+{
+    {MODULE_API_VERSION_2},
+
+    Logger_ParseConfigurationFromJson,
+    Logger_FreeConfiguration,
+    Logger_Create,
+    Logger_Destroy,
+    Logger_Receive,
+    NULL,
+    Logger_ReceiveBatch
+};
+
+static const MODULE_API_1 Logger_APIS_1 =
 {
     {MODULE_API_VERSION_1},
 
@@ -540,6 +659,15 @@ MODULE_EXPORT const MODULE_API* Module_GetApi(MODULE_API_VERSION gateway_api_ver
 #endif
 {
     /*Codes_SRS_LOGGER_26_001: [ Module_GetApi shall return a pointer to a MODULE_API structure with the required function pointers. */
-    (void)gateway_api_version;
-    return (const MODULE_API *)&Logger_APIS_all;
+    /*Codes_SRS_LOGGER_30_005: [ Module_GetApi shall return the MODULE_API_2 functions, which include Logger_ReceiveBatch, if gateway_api_version is MODULE_API_VERSION_2 or later, and the MODULE_API_1 functions otherwise. ]*/
+    const MODULE_API* result;
+    if (gateway_api_version >= MODULE_API_VERSION_2)
+    {
+        result = (const MODULE_API *)&Logger_APIS_all;
+    }
+    else
+    {
+        result = (const MODULE_API *)&Logger_APIS_1;
+    }
+    return result;
 }
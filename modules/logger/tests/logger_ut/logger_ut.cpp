@@ -144,6 +144,7 @@ static pfModule_FreeConfiguration Logger_FreeConfiguration = NULL; /*gets assign
 static pfModule_Create  Logger_Create = NULL; /*gets assigned in TEST_SUITE_INITIALIZE*/
 static pfModule_Destroy Logger_Destroy = NULL; /*gets assigned in TEST_SUITE_INITIALIZE*/
 static pfModule_Receive Logger_Receive = NULL; /*gets assigned in TEST_SUITE_INITIALIZE*/
+static pfModule_ReceiveBatch Logger_ReceiveBatch = NULL; /*gets assigned in TEST_SUITE_INITIALIZE*/
 
 static LOGGER_CONFIG validConfig =
 {
@@ -367,6 +368,7 @@ BEGIN_TEST_SUITE(logger_ut)
         Logger_Create = MODULE_CREATE(apis);
         Logger_Destroy = MODULE_DESTROY(apis);
         Logger_Receive = MODULE_RECEIVE(apis);
+        Logger_ReceiveBatch = MODULE_RECEIVE_BATCH(Module_GetApi(MODULE_API_VERSION_2));
     }
 
     TEST_SUITE_CLEANUP(TestClassCleanup)
@@ -2384,6 +2386,86 @@ BEGIN_TEST_SUITE(logger_ut)
         ///cleanup
     }
 
+    /*Tests_SRS_LOGGER_30_001: [If moduleHandle or messageHandles is NULL or messageCount is 0 then Logger_ReceiveBatch shall fail and return.]*/
+    TEST_FUNCTION(Logger_ReceiveBatch_with_invalid_arguments_fails)
+    {
+        ///arrange
+        CLoggerMocks mocks;
+        auto moduleHandle = Logger_Create(validBrokerHandle, &validConfig);
+        MESSAGE_HANDLE messageHandles[1] = { validMessageHandle };
+        mocks.ResetAllCalls();
+
+        ///act
+        Logger_ReceiveBatch(NULL, messageHandles, 1);
+        Logger_ReceiveBatch(moduleHandle, NULL, 1);
+        Logger_ReceiveBatch(moduleHandle, messageHandles, 0);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        Logger_Destroy(moduleHandle);
+    }
+
+    /*Tests_SRS_LOGGER_30_002: [Logger_ReceiveBatch shall produce for every message the same JSON object as Logger_Receive, all with the same time, and skip the messages it cannot produce a JSON object for.]*/
+    /*Tests_SRS_LOGGER_30_003: [Logger_ReceiveBatch shall append all the JSON objects to the fout FILE with a single write.]*/
+    TEST_FUNCTION(Logger_ReceiveBatch_happy_path)
+    {
+        ///arrange
+        CLoggerMocks mocks;
+        auto moduleHandle = Logger_Create(validBrokerHandle, &validConfig);
+        MESSAGE_HANDLE messageHandles[2] = { validMessageHandle, validMessageHandle };
+        mocks.ResetAllCalls();
+        mocks_ResetAllCounters();
+
+        STRICT_EXPECTED_CALL(mocks, gb_time(NULL)); /*the time is taken once for the batch*/
+        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(validMessageHandle))
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, "\"}")) /*this closes every JSON object*/
+            .IgnoreArgument(1)
+            .ExpectedTimesExactly(2);
+        STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, "]")) /*this closes the array*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gb_fseek(IGNORED_PTR_ARG, -1, SEEK_END)) /*the file is rewound once for the batch*/
+            .IgnoreArgument(1);
+        mocks.SetIgnoreUnexpectedCalls(true);
+
+        ///act
+        Logger_ReceiveBatch(moduleHandle, messageHandles, 2);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+        ASSERT_ARE_EQUAL(size_t, 1, CURRENT_API_CALL(gb_fprintf));
+
+        ///cleanup
+        mocks.SetIgnoreUnexpectedCalls(false);
+        Logger_Destroy(moduleHandle);
+    }
+
+    /*Tests_SRS_LOGGER_30_004: [If getting the time, producing the JSON or writing it to the file fails, then Logger_ReceiveBatch shall fail and return.]*/
+    TEST_FUNCTION(Logger_ReceiveBatch_fails_when_gb_time_fails)
+    {
+        ///arrange
+        CLoggerMocks mocks;
+        auto moduleHandle = Logger_Create(validBrokerHandle, &validConfig);
+        MESSAGE_HANDLE messageHandles[2] = { validMessageHandle, validMessageHandle };
+        mocks.ResetAllCalls();
+        mocks_ResetAllCounters();
+
+        STRICT_EXPECTED_CALL(mocks, gb_time(NULL))
+            .SetFailReturn((time_t)-1);
+
+        ///act
+        Logger_ReceiveBatch(moduleHandle, messageHandles, 2);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+        ASSERT_ARE_EQUAL(size_t, 0, CURRENT_API_CALL(gb_fprintf));
+
+        ///cleanup
+        Logger_Destroy(moduleHandle);
+    }
+
     /*Tests_SRS_LOGGER_26_001: [ `Module_GetApi` shall return a pointer to a  `MODULE_API` structure with the required function pointers. ]*/
     TEST_FUNCTION(Module_GetApi_returns_non_NULL_and_non_NULL_fields)
     {
@@ -2400,5 +2482,21 @@ BEGIN_TEST_SUITE(logger_ut)
         ASSERT_IS_TRUE(MODULE_CREATE(result) != NULL);
         ASSERT_IS_TRUE(MODULE_DESTROY(result) != NULL);
         ASSERT_IS_TRUE(MODULE_RECEIVE(result) != NULL);
+        ASSERT_IS_NULL(MODULE_RECEIVE_BATCH(result));
+    }
+
+    /*Tests_SRS_LOGGER_30_005: [ `Module_GetApi` shall return the `MODULE_API_2` functions, which include `Logger_ReceiveBatch`, if `gateway_api_version` is `MODULE_API_VERSION_2` or later, and the `MODULE_API_1` functions otherwise. ]*/
+    TEST_FUNCTION(Module_GetApi_returns_the_batch_receive_for_version_2)
+    {
+        ///arrrange
+
+        ///act
+        const MODULE_API* result = Module_GetApi(MODULE_API_VERSION_2);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(result);
+        ASSERT_ARE_EQUAL(int, MODULE_API_VERSION_2, result->version);
+        ASSERT_IS_TRUE(MODULE_RECEIVE(result) != NULL);
+        ASSERT_IS_TRUE(MODULE_RECEIVE_BATCH(result) != NULL);
     }
 END_TEST_SUITE(logger_ut)
@@ -31,16 +31,16 @@ typedef struct SIMULATEDDEVICE_CONFIG_TAG
 
 static void SimulatedDevice_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
 {
-    // Print the properties & content of the received message
-    CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
-    if (properties != NULL)
-    {
-        const char* addr = ((SIMULATEDDEVICE_DATA*)moduleHandle)->fakeMacAddress;
+    const char* addr = ((SIMULATEDDEVICE_DATA*)moduleHandle)->fakeMacAddress;
+    const char* macAddress = Message_GetProperty(messageHandle, GW_MAC_ADDRESS_PROPERTY);
 
-        // We're only interested in cloud-to-device (C2D) messages addressed to
-        // this device
-        if (ConstMap_ContainsKey(properties, GW_MAC_ADDRESS_PROPERTY) == true &&
-            strcmp(addr, ConstMap_GetValue(properties, GW_MAC_ADDRESS_PROPERTY)) == 0)
+    // We're only interested in cloud-to-device (C2D) messages addressed to
+    // this device
+    if (macAddress != NULL && strcmp(addr, macAddress) == 0)
+    {
+        // Print the properties & content of the received message
+        CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
+        if (properties != NULL)
         {
             const char* const * keys;
             const char* const * values;
@@ -66,9 +66,8 @@ static void SimulatedDevice_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE m
                     (void)fflush(stdout);
                 }
             }
+            ConstMap_Destroy(properties);
         }
-
-        ConstMap_Destroy(properties);
     }
 
     return;
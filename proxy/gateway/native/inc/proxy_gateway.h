@@ -38,6 +38,26 @@ typedef struct REMOTE_MODULE_TAG * REMOTE_MODULE_HANDLE;
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT REMOTE_MODULE_HANDLE, ProxyGateway_Attach, const MODULE_API *, module_apis, const char *, connection_id);
 
+/*!
+ * \brief Attach to the Proxy Gateway as a host for many modules
+ *
+ * `ProxyGateway_AttachMultiplexed` behaves as `ProxyGateway_Attach`, except the
+ * connection serves every outprocess module the gateway configures as
+ * "multiplexed" with this connection id. Each create message received creates
+ * another instance of the module, and every message on the connection is
+ * tagged with the instance it belongs to, so a single process and a single
+ * pair of sockets host all of them.
+ *
+ * \param module_apis [in] A structure providing the standard Module API set.
+ *                         Only Module_Create, Module_Destroy and Module_Receive
+ *                         are mandatory.
+ * \param connection_id [in] The unique identifier specified as "control.id" in
+ *                           the Azure IoT Gateway JSON configuration
+ *
+ * \return A handle to a remote module
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT REMOTE_MODULE_HANDLE, ProxyGateway_AttachMultiplexed, const MODULE_API *, module_apis, const char *, connection_id);
+
 /*!
  * \brief Detach from the Proxy Gateway
  *
@@ -69,6 +89,41 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, ProxyGateway_Detach, REMOTE_MODULE_HAND
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, ProxyGateway_DoWork, REMOTE_MODULE_HANDLE, remote_module);
 
+/*!
+ * \brief Process the pending transactions for a given remote module, waiting for one if idle.
+ *
+ * `ProxyGateway_DoWorkEx` handles the messages of the command and message channels as
+ * `ProxyGateway_DoWork` does, but keeps going until neither channel holds a message or
+ * `max_messages` messages have been handled. If no message is pending when it is called,
+ * it waits up to `timeout_ms` milliseconds for one to arrive, so a remote module driving
+ * its own loop neither sleeps through new messages nor spins on an idle gateway.
+ *
+ * \param remote_module [in] The handle of the remote module.
+ * \param max_messages [in] The most messages handled by this call, at least 1.
+ * \param timeout_ms [in] How long to wait for a message when none is pending, 0 not to
+ *                        wait, negative to wait until one arrives.
+ *
+ * \return A result value. 0 indicating success or failure otherwise
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT int, ProxyGateway_DoWorkEx, REMOTE_MODULE_HANDLE, remote_module, size_t, max_messages, int, timeout_ms);
+
+/*!
+ * \brief Get a descriptor that becomes readable when the remote module has work to do
+ *
+ * `ProxyGateway_GetPollFd` lets a remote module service the Azure IoT Gateway from its own
+ * event loop (epoll, libuv, ...) instead of a worker thread. The descriptor is readable
+ * (level-triggered) while a message is pending on the command or message channel, be it a
+ * socket or a shared memory ring; the caller then calls `ProxyGateway_DoWorkEx` with a
+ * `timeout_ms` of 0. The descriptor stays
+ * the same for the life of the remote module, follows the message channel as the gateway
+ * creates and destroys the module, and is closed by `ProxyGateway_Detach`.
+ *
+ * \param remote_module [in] The handle of the remote module.
+ *
+ * \return The descriptor, or -1 upon failure or on platforms other than Linux
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT int, ProxyGateway_GetPollFd, REMOTE_MODULE_HANDLE, remote_module);
+
 /*!
  * \brief Halt the worker thread for a given remote module
  * 
@@ -11,14 +11,30 @@
 #include <nanomsg/nn.h>
 #include <nanomsg/pair.h>
 
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
+
 #include <azure_c_shared_utility/gballoc.h>
 #include <azure_c_shared_utility/lock.h>
 #include <azure_c_shared_utility/threadapi.h>
 #include <azure_c_shared_utility/xlogging.h>
 
+#include "batched_frame.h"
 #include "control_message.h"
 #include "gateway.h"
 #include "message.h"
+#include "multiplexed_frame.h"
+#include "shm_channel.h"
+
+/* Upper bound of the messages the worker thread handles between two checks of the halt signal */
+#define WORKER_THREAD_MAX_MESSAGES 64
+
+/* How long the worker thread waits for a message before checking the halt signal again */
+#define WORKER_THREAD_WAIT_MS 100
 
 typedef enum REMOTE_MODULE_RESULT_TAG {
     REMOTE_MODULE_DETACH = -1,
@@ -28,6 +44,7 @@ typedef enum REMOTE_MODULE_RESULT_TAG {
 } REMOTE_MODULE_RESULT;
 
 typedef struct MESSAGE_THREAD_TAG * MESSAGE_THREAD_HANDLE;
+typedef struct REMOTE_MODULE_INSTANCE_TAG * REMOTE_MODULE_INSTANCE_HANDLE;
 
 int
 connect_to_message_channel (
@@ -40,6 +57,76 @@ disconnect_from_message_channel (
     REMOTE_MODULE_HANDLE remote_module
 );
 
+int
+connect_to_message_ring (
+    REMOTE_MODULE_HANDLE remote_module,
+    const MESSAGE_URI * channel_uri
+);
+
+void
+disconnect_from_message_ring (
+    REMOTE_MODULE_HANDLE remote_module
+);
+
+MODULE_HANDLE
+create_module (
+    REMOTE_MODULE_HANDLE remote_module,
+    BROKER_HANDLE broker,
+    const char * json_config
+);
+
+static
+int
+receive_control_message (
+    REMOTE_MODULE_HANDLE remote_module
+);
+
+static
+int
+receive_module_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    int timeout_ms
+);
+
+static
+int
+wait_for_messages (
+    REMOTE_MODULE_HANDLE remote_module,
+    int timeout_ms
+);
+
+static
+int
+watch_socket (
+    int poll_fd,
+    int socket,
+    bool watch
+);
+
+static
+int
+watch_descriptor (
+    int poll_fd,
+    int fd,
+    bool watch
+);
+
+static
+int
+publish_message_batch (
+    REMOTE_MODULE_HANDLE remote_module,
+    MESSAGE_HANDLE * messages,
+    size_t count
+);
+
+static
+void
+receive_message_batch (
+    REMOTE_MODULE_HANDLE remote_module,
+    const unsigned char * frame,
+    int32_t frame_size
+);
+
 int
 invoke_add_module_procedure (
     REMOTE_MODULE_HANDLE remote_module,
@@ -58,6 +145,40 @@ send_control_reply (
     uint8_t response
 );
 
+int
+send_control_reply_to (
+    REMOTE_MODULE_HANDLE remote_module,
+    uint32_t module_id,
+    uint8_t response
+);
+
+int
+process_multiplexed_control_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    const unsigned char * frame,
+    int32_t size
+);
+
+int
+process_multiplexed_create_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    uint32_t module_id,
+    const CONTROL_MESSAGE_MODULE_CREATE * message
+);
+
+void
+process_multiplexed_module_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    const unsigned char * frame,
+    int32_t size
+);
+
+void
+destroy_module_instance (
+    REMOTE_MODULE_HANDLE remote_module,
+    REMOTE_MODULE_INSTANCE_HANDLE instance
+);
+
 int
 worker_thread(
     void * thread_arg
@@ -69,13 +190,33 @@ typedef struct MESSAGE_THREAD_TAG {
     THREAD_HANDLE thread;
 } MESSAGE_THREAD;
 
+/* The broker handle given to a module, which tells Broker_Publish which module published */
+typedef struct PROXY_BROKER_TAG {
+    REMOTE_MODULE_HANDLE remote_module;
+    uint32_t module_id;
+} PROXY_BROKER;
+
+/* One of the modules hosted over a multiplexed connection */
+typedef struct REMOTE_MODULE_INSTANCE_TAG {
+    PROXY_BROKER broker;
+    MODULE_HANDLE module_handle;
+    REMOTE_MODULE_INSTANCE_HANDLE next;
+} REMOTE_MODULE_INSTANCE;
+
 typedef struct REMOTE_MODULE_TAG {
+    PROXY_BROKER broker;  // must remain the first member, the remote module is its own broker handle
 	int control_endpoint;
 	int control_socket;
     int message_endpoint;
     int message_socket;
+    SHM_CHANNEL_HANDLE message_channel;
+    LOCK_HANDLE message_channel_lock;
     MESSAGE_THREAD_HANDLE message_thread;
     MODULE module;
+    bool multiplexed;
+    REMOTE_MODULE_INSTANCE_HANDLE instances;
+    uint8_t message_version;
+    int poll_fd;
 } REMOTE_MODULE;
 
 
@@ -164,6 +305,7 @@ ProxyGateway_Attach (
                 // Initialize remaining fields
                 remote_module->message_socket = -1;
                 remote_module->message_endpoint = -1;
+                remote_module->poll_fd = -1;
             }
         }
         /* Codes_SRS_PROXY_GATEWAY_027_015: [`ProxyGateway_Attach` shall release the memory required to formulate the connection string] */
@@ -175,6 +317,23 @@ ProxyGateway_Attach (
 }
 
 
+REMOTE_MODULE_HANDLE
+ProxyGateway_AttachMultiplexed (
+    const MODULE_API * module_apis,
+    const char * connection_id
+) {
+    /* Codes_SRS_PROXY_GATEWAY_30_015: [`ProxyGateway_AttachMultiplexed` shall attach to the Azure IoT Gateway as `ProxyGateway_Attach` does and return `NULL` under the same conditions] */
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach(module_apis, connection_id);
+
+    if (NULL != remote_module) {
+        /* Codes_SRS_PROXY_GATEWAY_30_016: [`ProxyGateway_AttachMultiplexed` shall mark the connection as multiplexed, so every create message received on it creates another module instance] */
+        remote_module->multiplexed = true;
+    }
+
+    return remote_module;
+}
+
+
 void
 ProxyGateway_Detach (
     REMOTE_MODULE_HANDLE remote_module
@@ -196,17 +355,39 @@ ProxyGateway_Detach (
         }
 
         /* Codes_SRS_PROXY_GATEWAY_027_061: [`ProxyGateway_Detach` shall attempt to notify the Azure IoT Gateway of the detachment] */
-        (void)send_control_reply(remote_module, (uint8_t)REMOTE_MODULE_DETACH);
+        if (remote_module->multiplexed) {
+            REMOTE_MODULE_INSTANCE_HANDLE instance;
+            /* Codes_SRS_PROXY_GATEWAY_30_021: [If the connection is multiplexed, `ProxyGateway_Detach` shall notify the Azure IoT Gateway of the detachment of each module instance] */
+            for (instance = remote_module->instances; NULL != instance; instance = instance->next) {
+                (void)send_control_reply_to(remote_module, instance->broker.module_id, (uint8_t)REMOTE_MODULE_DETACH);
+            }
+        } else {
+            (void)send_control_reply(remote_module, (uint8_t)REMOTE_MODULE_DETACH);
+        }
 		ThreadAPI_Sleep(1000);
 
-        /* Codes_SRS_PROXY_GATEWAY_027_062: [`ProxyGateway_Detach` shall disconnect from the Azure IoT Gateway message channels] */
-        disconnect_from_message_channel(remote_module);
+        if (remote_module->multiplexed) {
+            /* Codes_SRS_PROXY_GATEWAY_30_022: [If the connection is multiplexed, `ProxyGateway_Detach` shall destroy each module instance, which disconnects from the message channel once the last one is gone] */
+            while (NULL != remote_module->instances) {
+                destroy_module_instance(remote_module, remote_module->instances);
+            }
+        } else {
+            /* Codes_SRS_PROXY_GATEWAY_027_062: [`ProxyGateway_Detach` shall disconnect from the Azure IoT Gateway message channels] */
+            disconnect_from_message_channel(remote_module);
+        }
         /* Codes_SRS_PROXY_GATEWAY_027_063: [`ProxyGateway_Detach` shall shutdown the Azure IoT Gateway control channel by calling `int nn_shutdown(int s, int how)`] */
         (void)nn_shutdown(remote_module->control_socket, remote_module->control_endpoint);
         remote_module->control_endpoint = 0;
         /* Codes_SRS_PROXY_GATEWAY_027_064: [`ProxyGateway_Detach` shall close the Azure IoT Gateway control socket by calling `int nn_close(int s)`] */
         (void)nn_close(remote_module->control_socket);
         remote_module->control_socket = 0;
+#ifdef __linux__
+        if (0 <= remote_module->poll_fd) {
+            /* Codes_SRS_PROXY_GATEWAY_30_037: [`ProxyGateway_Detach` shall close the descriptor returned by `ProxyGateway_GetPollFd`, if any] */
+            (void)close(remote_module->poll_fd);
+            remote_module->poll_fd = -1;
+        }
+#endif
         /* Codes_SRS_PROXY_GATEWAY_027_065: [`ProxyGateway_Detach` shall free the remaining memory dedicated to its instance data] */
         free(remote_module);
         remote_module = NULL;
@@ -224,91 +405,96 @@ ProxyGateway_DoWork (
         /* Codes_SRS_PROXY_GATEWAY_027_026: [Prerequisite Check - If the `remote_module` parameter is `NULL`, then `ProxyGateway_DoWork` shall do nothing] */
         LogError("%s: NULL parameter - remote_module!", __FUNCTION__);
     } else {
-        int32_t bytes_received;
-        void * control_message = NULL;
+        (void)receive_control_message(remote_module);
+        (void)receive_module_message(remote_module, 0);
+    }
 
-        /* Codes_SRS_PROXY_GATEWAY_027_027: [Control Channel - `ProxyGateway_DoWork` shall poll the gateway control channel by calling `int nn_recv(int s, void * buf, size_t len, int flags)` with the control socket for `s`, `NULL` for `buf`, `NN_MSG` for `len` and NN_DONTWAIT for `flags`] */
-        if (0 > (bytes_received = nn_recv(remote_module->control_socket, &control_message, NN_MSG, NN_DONTWAIT))) {
-            if (EAGAIN == nn_errno()) {
-                /* Codes_SRS_PROXY_GATEWAY_027_028: [Control Channel - If no message is available, then `ProxyGateway_DoWork` shall abandon the control channel request] */
-            } else {
-                /* Codes_SRS_PROXY_GATEWAY_027_066: [Control Channel - If an error occurred when polling the gateway, then `ProxyGateway_DoWork` shall signal the gateway abandon the control channel request] */
-                LogError("%s: Unexpected error received from the control channel!", __FUNCTION__);
-                (void)send_control_reply(remote_module, (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
-            }
-        } else {
-            CONTROL_MESSAGE * structured_control_message;
+    return;
+}
 
-            /* Codes_SRS_PROXY_GATEWAY_027_029: [Control Channel - If a control message was received, then `ProxyGateway_DoWork` will parse that message by calling `CONTROL_MESSAGE * ControlMessage_CreateFromByteArray(const unsigned char * source, size_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
-            if (NULL == (structured_control_message = ControlMessage_CreateFromByteArray((const unsigned char *)control_message, bytes_received))) {
-                /* Codes_SRS_PROXY_GATEWAY_027_030: [Control Channel - If unable to parse the control message, then `ProxyGateway_DoWork` shall signal the gateway, free any previously allocated memory and abandon the control channel request] */
-                LogError("%s: Unable to parse control message!", __FUNCTION__);
-                (void)send_control_reply(remote_module, (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
+
+int
+ProxyGateway_DoWorkEx (
+    REMOTE_MODULE_HANDLE remote_module,
+    size_t max_messages,
+    int timeout_ms
+) {
+    int result;
+
+    if (NULL == remote_module) {
+        /* Codes_SRS_PROXY_GATEWAY_30_031: [Prerequisite Check - If the `remote_module` parameter is `NULL`, then `ProxyGateway_DoWorkEx` shall do nothing and return a non-zero value] */
+        LogError("%s: NULL parameter - remote_module!", __FUNCTION__);
+        result = __LINE__;
+    } else if (0 == max_messages) {
+        /* Codes_SRS_PROXY_GATEWAY_30_032: [Prerequisite Check - If the `max_messages` parameter is `0`, then `ProxyGateway_DoWorkEx` shall do nothing and return a non-zero value] */
+        LogError("%s: max_messages must be greater than zero!", __FUNCTION__);
+        result = __LINE__;
+    } else {
+        size_t message_count = 0;
+        bool waited = (0 == timeout_ms);
+
+        result = 0;
+        while (message_count < max_messages) {
+            /* Codes_SRS_PROXY_GATEWAY_30_033: [`ProxyGateway_DoWorkEx` shall handle the control and module messages as `ProxyGateway_DoWork` does, until neither channel holds a message or it has handled `max_messages` messages] */
+            int received = receive_control_message(remote_module);
+            received += receive_module_message(remote_module, 0);
+
+            if (0 != received) {
+                message_count += (size_t)received;
+            } else if (0 != message_count || waited) {
+                break;
+            } else if (0 != wait_for_messages(remote_module, timeout_ms)) {
+                result = __LINE__;
+                break;
             } else {
-                // Route control channel messages to appropriate functions
-                switch (structured_control_message->type) {
-                  case CONTROL_MESSAGE_TYPE_MODULE_CREATE:
-                    /* Codes_SRS_PROXY_GATEWAY_027_031: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_CREATE, then `ProxyGateway_DoWork` shall process the create message] */
-                    if (0 != process_module_create_message(remote_module, (const CONTROL_MESSAGE_MODULE_CREATE *)structured_control_message)) {
-                        LogError("%s: Unable to process create message!", __FUNCTION__);
-                    }
-                    break;
-                  case CONTROL_MESSAGE_TYPE_MODULE_START:
-                    /* Codes_SRS_PROXY_GATEWAY_027_032: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_START and `Module_Start` was provided, then `ProxyGateway_DoWork` shall call `void Module_Start(MODULE_HANDLE moduleHandle)`] */
-                    if (((MODULE_API_1 *)remote_module->module.module_apis)->Module_Start) {
-                        ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Start(remote_module->module.module_handle);
-                    }
-                    break;
-                  case CONTROL_MESSAGE_TYPE_MODULE_DESTROY:
-                    /* Codes_SRS_PROXY_GATEWAY_027_033: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_DESTROY, then `ProxyGateway_DoWork` shall call `void Module_Destroy(MODULE_HANDLE moduleHandle)`] */
-                    ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Destroy(remote_module->module.module_handle);
-                    remote_module->module.module_handle = NULL;
-                    /* Codes_SRS_PROXY_GATEWAY_027_034: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_DESTROY, then `ProxyGateway_DoWork` shall disconnect from the message channel] */
-                    disconnect_from_message_channel(remote_module);
-                    break;
-                  default: LogError("ERROR: REMOTE_MODULE - Received unsupported message type! [%d]\n", structured_control_message->type); break;
-                }
-                /* Codes_SRS_PROXY_GATEWAY_027_035: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed control message by calling `void ControlMessage_Destroy(CONTROL_MESSAGE * message)` using the parsed control message as `message`] */
-                ControlMessage_Destroy(structured_control_message);
+                // check both channels once more, a message arrived or the wait timed out
+                waited = true;
             }
-            /* Codes_SRS_PROXY_GATEWAY_027_036: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
-            (void)nn_freemsg(control_message);
         }
+    }
 
-        /* Codes_SRS_PROXY_GATEWAY_027_037: [Message Channel - `ProxyGateway_DoWork` shall not check for messages, if the message socket is not available] */
-        if ( 0 > remote_module->message_socket ) {
-            // not connected to message channel
-        } else {
-            void * module_message = NULL;
+    return result;
+}
 
-            /* Codes_SRS_PROXY_GATEWAY_027_038: [Message Channel - `ProxyGateway_DoWork` shall poll the gateway message channel by calling `int nn_recv(int s, void * buf, size_t len, int flags)` with each message socket for `s`, `NULL` for `buf`, `NN_MSG` for `len` and NN_DONTWAIT for `flags`] */
-            if (0 > (bytes_received = nn_recv(remote_module->message_socket, &module_message, NN_MSG, NN_DONTWAIT))) {
-                /* Codes_SRS_PROXY_GATEWAY_027_039: [Message Channel - If no message is available or an error occurred, then `ProxyGateway_DoWork` shall abandon the message channel request] */
-                if (EAGAIN == nn_errno()) {
-                    // no messages available at this time
-                } else {
-                    LogError("%s: Unexpected error received from the message channel!", __FUNCTION__);
-                }
-            } else {
-                MESSAGE_HANDLE structured_module_message;
 
-                /* Codes_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char * source, int32_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
-                if (NULL == (structured_module_message = Message_CreateFromByteArray((const unsigned char *)module_message, bytes_received))) {
-                    /* Codes_SRS_PROXY_GATEWAY_027_041: [Message Channel - If unable to parse the module message, then `ProxyGateway_DoWork` shall free any previously allocated memory and abandon the message channel request] */
-                    LogError("%s: Unable to parse control message!", __FUNCTION__);
-                } else {
-                    /* Codes_SRS_PROXY_GATEWAY_027_042: [Message Channel - `ProxyGateway_DoWork` shall pass the structured message to the module by calling `void Module_Receive(MODULE_HANDLE moduleHandle)` using the parsed message as `moduleHandle`] */
-                    ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Receive(remote_module->module.module_handle, structured_module_message);
-                    /* Codes_SRS_PROXY_GATEWAY_027_043: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed module message by calling `void Message_Destroy(MESSAGE_HANDLE * message)` using the parsed module message as `message`] */
-                    Message_Destroy(structured_module_message);
-                }
-                /* Codes_SRS_PROXY_GATEWAY_027_044: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
-                (void)nn_freemsg(module_message);
-            }
+int
+ProxyGateway_GetPollFd (
+    REMOTE_MODULE_HANDLE remote_module
+) {
+    int result;
+
+    if (NULL == remote_module) {
+        /* Codes_SRS_PROXY_GATEWAY_30_038: [Prerequisite Check - If the `remote_module` parameter is `NULL`, then `ProxyGateway_GetPollFd` shall return -1] */
+        LogError("%s: NULL parameter - remote_module!", __FUNCTION__);
+        result = -1;
+    } else if (0 <= remote_module->poll_fd) {
+        /* Codes_SRS_PROXY_GATEWAY_30_039: [`ProxyGateway_GetPollFd` shall return the same descriptor on every call] */
+        result = remote_module->poll_fd;
+    } else {
+#ifdef __linux__
+        /* Codes_SRS_PROXY_GATEWAY_30_040: [`ProxyGateway_GetPollFd` shall create an epoll descriptor watching the receive descriptor of the control socket and, once connected, the receive descriptor of the message socket or the descriptor returned by `int ShmChannel_GetPollFd(SHM_CHANNEL_HANDLE channel)` for the shared memory channel] */
+        if (0 > (remote_module->poll_fd = epoll_create1(EPOLL_CLOEXEC))) {
+            /* Codes_SRS_PROXY_GATEWAY_30_041: [If unable to create or populate the descriptor, `ProxyGateway_GetPollFd` shall return -1] */
+            LogError("%s: epoll_create1 failed, errno = %d", __FUNCTION__, errno);
+            result = -1;
+        } else if (0 != watch_socket(remote_module->poll_fd, remote_module->control_socket, true)
+            || (0 <= remote_module->message_socket && 0 != watch_socket(remote_module->poll_fd, remote_module->message_socket, true))
+            || (NULL != remote_module->message_channel && 0 != watch_descriptor(remote_module->poll_fd, ShmChannel_GetPollFd(remote_module->message_channel), true))) {
+            LogError("%s: Unable to watch the gateway channels!", __FUNCTION__);
+            (void)close(remote_module->poll_fd);
+            remote_module->poll_fd = -1;
+            result = -1;
+        } else {
+            result = remote_module->poll_fd;
         }
+#else
+        /* Codes_SRS_PROXY_GATEWAY_30_042: [`ProxyGateway_GetPollFd` shall return -1 on platforms other than Linux] */
+        LogError("%s: Not supported on this platform!", __FUNCTION__);
+        result = -1;
+#endif
     }
 
-    return;
+    return result;
 }
 
 
@@ -422,7 +608,8 @@ Broker_Publish (
     MESSAGE_HANDLE message
 ) {
     (void)source;
-    REMOTE_MODULE_HANDLE remote_module = (REMOTE_MODULE_HANDLE)broker;
+    const PROXY_BROKER * proxy_broker = (const PROXY_BROKER *)broker;
+    REMOTE_MODULE_HANDLE remote_module;
     BROKER_RESULT result;
 
     /* Codes_SRS_BROKER_13_030: [If broker or message is NULL the function shall return BROKER_INVALIDARG.] */
@@ -436,6 +623,13 @@ Broker_Publish (
         // Send message_ to nanomsg
         int32_t msg_size;
         int32_t buf_size;
+        /* Codes_SRS_PROXY_GATEWAY_30_019: [`Broker_Publish` shall start the message with the module id of the publishing module instance if the connection is multiplexed] */
+        int32_t header_size = (0 == proxy_broker->module_id) ? 0 : MULTIPLEXED_FRAME_HEADER_SIZE;
+        remote_module = (0 == proxy_broker->module_id) ? (REMOTE_MODULE_HANDLE)broker : proxy_broker->remote_module;
+        /* Codes_SRS_PROXY_GATEWAY_30_027: [If the message channel is batched, `Broker_Publish` shall send the message as a batch of one message] */
+        if (GATEWAY_MESSAGE_VERSION_BATCHED == remote_module->message_version) {
+            header_size += BATCHED_FRAME_HEADER_SIZE;
+        }
         /* Codes_SRS_BROKER_17_007: [ Broker_Publish shall clone the message. ] */
         MESSAGE_HANDLE msg = Message_Clone(message);
         /* Codes_SRS_BROKER_17_008: [ Broker_Publish shall serialize the message. ] */
@@ -447,10 +641,36 @@ Broker_Publish (
             Message_Destroy(msg);
             result = BROKER_ERROR;
         }
+        else if (NULL != remote_module->message_channel)
+        {
+            /* Codes_SRS_PROXY_GATEWAY_30_005: [If the message channel is a shared memory channel, `Broker_Publish` shall serialize the message directly into the room returned by `unsigned char * ShmChannel_BeginSend(SHM_CHANNEL_HANDLE channel, int32_t size, int timeout_ms)` and publish it by calling `void ShmChannel_EndSend(SHM_CHANNEL_HANDLE channel)`, holding the message channel lock so concurrent publishers take turns] */
+            if (LOCK_OK != Lock(remote_module->message_channel_lock))
+            {
+                LogError("unable to lock the message channel");
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                unsigned char * ring_bytes = ShmChannel_BeginSend(remote_module->message_channel, msg_size, -1);
+                if (NULL == ring_bytes)
+                {
+                    LogError("unable to send a message [%p]", msg);
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    Message_ToByteArray(message, ring_bytes, msg_size);
+                    ShmChannel_EndSend(remote_module->message_channel);
+                    result = BROKER_OK;
+                }
+                (void)Unlock(remote_module->message_channel_lock);
+            }
+            Message_Destroy(msg);
+        }
         else
         {
             /* Codes_SRS_BROKER_17_025: [ Broker_Publish shall allocate a nanomsg buffer the size of the serialized message + sizeof(MODULE_HANDLE). ] */
-            buf_size = msg_size;
+            buf_size = header_size + msg_size;
             void* nn_msg = nn_allocmsg(buf_size, 0);
             if (nn_msg == NULL)
             {
@@ -461,8 +681,16 @@ Broker_Publish (
             else
             {
                 unsigned char *nn_msg_bytes = (unsigned char *)nn_msg;
+                if (0 != proxy_broker->module_id)
+                {
+                    MultiplexedFrame_SetModuleId(nn_msg_bytes, proxy_broker->module_id);
+                }
+                if (GATEWAY_MESSAGE_VERSION_BATCHED == remote_module->message_version)
+                {
+                    BatchedFrame_SetSize(nn_msg_bytes + header_size - BATCHED_FRAME_HEADER_SIZE, msg_size);
+                }
                 /* Codes_SRS_BROKER_17_027: [ Broker_Publish shall serialize the message into the remainder of the nanomsg buffer. ] */
-                Message_ToByteArray(message, nn_msg_bytes, msg_size);
+                Message_ToByteArray(message, nn_msg_bytes + header_size, msg_size);
 
                 /* Codes_SRS_BROKER_17_010: [ Broker_Publish shall send a message on the publish_socket. ] */
                 int nbytes = nn_send(remote_module->message_socket, &nn_msg, NN_MSG, 0);
@@ -491,6 +719,47 @@ Broker_Publish (
 }
 
 
+BROKER_RESULT
+Broker_PublishBatch (
+    BROKER_HANDLE broker,
+    MODULE_HANDLE source,
+    MESSAGE_HANDLE * messages,
+    size_t count
+) {
+    BROKER_RESULT result;
+
+    /* Codes_SRS_PROXY_GATEWAY_30_001: [If `broker` or `messages` is `NULL` or `count` is 0, `Broker_PublishBatch` shall return `BROKER_INVALIDARG`] */
+    if (broker == NULL || messages == NULL || count == 0)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("Broker handle and/or messages is NULL");
+    }
+    else if (0 == ((const PROXY_BROKER *)broker)->module_id
+        && GATEWAY_MESSAGE_VERSION_BATCHED == ((REMOTE_MODULE_HANDLE)broker)->message_version
+        && NULL == ((REMOTE_MODULE_HANDLE)broker)->message_channel)
+    {
+        /* Codes_SRS_PROXY_GATEWAY_30_028: [If the message channel is batched, `Broker_PublishBatch` shall send all the messages in one frame] */
+        (void)source;
+        result = (0 == publish_message_batch((REMOTE_MODULE_HANDLE)broker, messages, count)) ? BROKER_OK : BROKER_ERROR;
+    }
+    else
+    {
+        size_t i;
+        result = BROKER_OK;
+        /* Codes_SRS_PROXY_GATEWAY_30_002: [`Broker_PublishBatch` shall send every message to the gateway, in order, as `Broker_Publish` does, and return `BROKER_ERROR` if any of them could not be sent] */
+        for (i = 0; i < count; i++)
+        {
+            if (Broker_Publish(broker, source, messages[i]) != BROKER_OK)
+            {
+                result = BROKER_ERROR;
+            }
+        }
+    }
+
+    return result;
+}
+
+
 int
 connect_to_message_channel (
     REMOTE_MODULE_HANDLE remote_module,
@@ -498,8 +767,11 @@ connect_to_message_channel (
 ) {
     int result;
 
+    if (SHM_CHANNEL_URI_TYPE == channel_uri->uri_type) {
+        /* Codes_SRS_PROXY_GATEWAY_30_006: [If `MESSAGE_URI::uri_type` is `SHM_CHANNEL_URI_TYPE`, then `connect_to_message_channel` shall attach to the shared memory channel instead of creating a socket] */
+        result = connect_to_message_ring(remote_module, channel_uri);
     /* SRS_PROXY_GATEWAY_027_0xx: [`connect_to_message_channel` shall create a socket for the Azure IoT Gateway message channel by calling `int nn_socket(int domain, int protocol)` with `AF_SP` as `domain` and `MESSAGE_URI::uri_type` as `protocol`] */
-    if (-1 == (remote_module->message_socket = nn_socket(AF_SP, channel_uri->uri_type))) {
+    } else if (-1 == (remote_module->message_socket = nn_socket(AF_SP, channel_uri->uri_type))) {
         /* SRS_PROXY_GATEWAY_027_0xx: [If a call to `nn_socket` returns -1, then `connect_to_message_channel` shall free any previously allocated memory, abandon the control message and prepare for the next create message] */
         LogError("%s: Unable to create the gateway socket!", __FUNCTION__);
         result = __LINE__;
@@ -511,6 +783,10 @@ connect_to_message_channel (
         (void)nn_close(remote_module->message_socket);
         remote_module->message_socket = -1;
     } else {
+        if (0 <= remote_module->poll_fd && 0 != watch_socket(remote_module->poll_fd, remote_module->message_socket, true)) {
+            /* Codes_SRS_PROXY_GATEWAY_30_043: [`connect_to_message_channel` shall add the message socket to the descriptor returned by `ProxyGateway_GetPollFd`, if any] */
+            LogError("%s: Unable to watch the gateway message channel!", __FUNCTION__);
+        }
         /* SRS_PROXY_GATEWAY_027_0xx: [If no errors are encountered, then `connect_to_message_channel` shall return zero] */
         result = 0;
     }
@@ -523,23 +799,102 @@ void
 disconnect_from_message_channel (
     REMOTE_MODULE_HANDLE remote_module
 ) {
-    /* SRS_PROXY_GATEWAY_027_0xx: [`disconnect_from_message_channel` shall shutdown the Azure IoT Gateway message channel by calling `int nn_shutdown(int s, int how)`] */
-    (void)nn_shutdown(remote_module->message_socket, remote_module->message_endpoint);
-    remote_module->message_endpoint = -1;
-    /* SRS_PROXY_GATEWAY_027_0xx: [`disconnect_from_message_channel` shall close the Azure IoT Gateway message socket by calling `int nn_close(int s)`] */
-    (void)nn_close(remote_module->message_socket);
-    remote_module->message_socket = -1;
+    if (NULL != remote_module->message_channel) {
+        disconnect_from_message_ring(remote_module);
+    } else {
+        if (0 <= remote_module->poll_fd) {
+            /* Codes_SRS_PROXY_GATEWAY_30_044: [`disconnect_from_message_channel` shall remove the message socket from the descriptor returned by `ProxyGateway_GetPollFd`, if any] */
+            (void)watch_socket(remote_module->poll_fd, remote_module->message_socket, false);
+        }
+        /* SRS_PROXY_GATEWAY_027_0xx: [`disconnect_from_message_channel` shall shutdown the Azure IoT Gateway message channel by calling `int nn_shutdown(int s, int how)`] */
+        (void)nn_shutdown(remote_module->message_socket, remote_module->message_endpoint);
+        remote_module->message_endpoint = -1;
+        /* SRS_PROXY_GATEWAY_027_0xx: [`disconnect_from_message_channel` shall close the Azure IoT Gateway message socket by calling `int nn_close(int s)`] */
+        (void)nn_close(remote_module->message_socket);
+        remote_module->message_socket = -1;
+    }
 
     return;
 }
 
 
 int
-invoke_add_module_procedure (
+connect_to_message_ring (
     REMOTE_MODULE_HANDLE remote_module,
-    const char * json_config
+    const MESSAGE_URI * channel_uri
 ) {
     int result;
+    int ring_fd;
+
+    /* Codes_SRS_PROXY_GATEWAY_30_007: [`connect_to_message_ring` shall create the lock serializing the publishers by calling `LOCK_HANDLE Lock_Init(void)`] */
+    if (NULL == (remote_module->message_channel_lock = Lock_Init())) {
+        /* Codes_SRS_PROXY_GATEWAY_30_008: [If unable to create the lock, then `connect_to_message_ring` shall return a non-zero value] */
+        LogError("%s: Unable to create the message channel lock!", __FUNCTION__);
+        result = __LINE__;
+    /* Codes_SRS_PROXY_GATEWAY_30_009: [`connect_to_message_ring` shall attach to the shared memory channel the gateway created by calling `SHM_CHANNEL_HANDLE ShmChannel_Open(const char * uri)` with `MESSAGE_URI::uri` as `uri`] */
+    } else if (NULL == (remote_module->message_channel = ShmChannel_Open(channel_uri->uri))) {
+        /* Codes_SRS_PROXY_GATEWAY_30_010: [If unable to attach to the shared memory channel, then `connect_to_message_ring` shall free the lock and return a non-zero value] */
+        LogError("%s: Unable to attach to the gateway message ring!", __FUNCTION__);
+        result = __LINE__;
+        (void)Lock_Deinit(remote_module->message_channel_lock);
+        remote_module->message_channel_lock = NULL;
+    /* Codes_SRS_PROXY_GATEWAY_30_045: [`connect_to_message_ring` shall start the doorbell of the shared memory channel by calling `int ShmChannel_GetPollFd(SHM_CHANNEL_HANDLE channel)`] */
+    } else if (0 > (ring_fd = ShmChannel_GetPollFd(remote_module->message_channel))) {
+        /* Codes_SRS_PROXY_GATEWAY_30_046: [If unable to start the doorbell, then `connect_to_message_ring` shall detach from the shared memory channel by calling `void ShmChannel_Destroy(SHM_CHANNEL_HANDLE channel)`, free the lock and return a non-zero value] */
+        LogError("%s: Unable to watch the gateway message ring!", __FUNCTION__);
+        result = __LINE__;
+        ShmChannel_Destroy(remote_module->message_channel);
+        remote_module->message_channel = NULL;
+        (void)Lock_Deinit(remote_module->message_channel_lock);
+        remote_module->message_channel_lock = NULL;
+    } else {
+        if (0 <= remote_module->poll_fd && 0 != watch_descriptor(remote_module->poll_fd, ring_fd, true)) {
+            /* Codes_SRS_PROXY_GATEWAY_30_047: [`connect_to_message_ring` shall add the descriptor returned by `ShmChannel_GetPollFd` to the descriptor returned by `ProxyGateway_GetPollFd`, if any] */
+            LogError("%s: Unable to watch the gateway message ring!", __FUNCTION__);
+        }
+        /* Codes_SRS_PROXY_GATEWAY_30_011: [If no errors are encountered, then `connect_to_message_ring` shall return zero] */
+        result = 0;
+    }
+
+    return result;
+}
+
+
+void
+disconnect_from_message_ring (
+    REMOTE_MODULE_HANDLE remote_module
+) {
+    if (0 <= remote_module->poll_fd) {
+        /* Codes_SRS_PROXY_GATEWAY_30_048: [`disconnect_from_message_ring` shall remove the descriptor returned by `ShmChannel_GetPollFd` from the descriptor returned by `ProxyGateway_GetPollFd`, if any] */
+        (void)watch_descriptor(remote_module->poll_fd, ShmChannel_GetPollFd(remote_module->message_channel), false);
+    }
+    /* Codes_SRS_PROXY_GATEWAY_30_012: [`disconnect_from_message_ring` shall close the shared memory channel by calling `void ShmChannel_Close(SHM_CHANNEL_HANDLE channel)`, so a publisher waiting for room returns] */
+    ShmChannel_Close(remote_module->message_channel);
+    /* Codes_SRS_PROXY_GATEWAY_30_013: [`disconnect_from_message_ring` shall wait for the publishers to leave the channel by calling `LOCK_RESULT Lock(LOCK_HANDLE handle)` before it detaches from the channel by calling `void ShmChannel_Destroy(SHM_CHANNEL_HANDLE channel)`] */
+    if (LOCK_OK != Lock(remote_module->message_channel_lock)) {
+        LogError("%s: Unable to acquire the message channel lock!", __FUNCTION__);
+        ShmChannel_Destroy(remote_module->message_channel);
+        remote_module->message_channel = NULL;
+    } else {
+        ShmChannel_Destroy(remote_module->message_channel);
+        remote_module->message_channel = NULL;
+        (void)Unlock(remote_module->message_channel_lock);
+    }
+    /* Codes_SRS_PROXY_GATEWAY_30_014: [`disconnect_from_message_ring` shall free the lock by calling `LOCK_RESULT Lock_Deinit(LOCK_HANDLE handle)`] */
+    (void)Lock_Deinit(remote_module->message_channel_lock);
+    remote_module->message_channel_lock = NULL;
+
+    return;
+}
+
+
+MODULE_HANDLE
+create_module (
+    REMOTE_MODULE_HANDLE remote_module,
+    BROKER_HANDLE broker,
+    const char * json_config
+) {
+    MODULE_HANDLE module_handle;
     void * create_parameters = NULL;
 
     /* SRS_PROXY_GATEWAY_027_0xx: [If `Module_ParseConfigurationFromJson` was provided, `invoke_add_module_procedure` shall parse the configuration by calling `void * Module_ParseConfigurationFromJson(const char * configuration)` using the `CONTROL_MESSAGE_MODULE_CREATE::args` as `configuration`] */
@@ -550,12 +905,7 @@ invoke_add_module_procedure (
     }
 
     /* SRS_PROXY_GATEWAY_027_0xx: [`invoke_add_module_procedure` shall create the remote module by calling `MODULE_HANDLE Module_Create(BROKER_HANDLE broker, const void * configuration)` using the `remote_module_handle` as `broker` and the parsed configuration value or `CONTROL_MESSAGE_MODULE_CREATE::args` as `configuration`] */
-    if (NULL == (remote_module->module.module_handle = ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Create((BROKER_HANDLE)remote_module, create_parameters))) {
-        result = __LINE__;
-    } else {
-        /* SRS_PROXY_GATEWAY_027_0xx: [If no errors are encountered, `invoke_add_module_procedure` shall return zero] */
-        result = 0;
-    }
+    module_handle = ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Create(broker, create_parameters);
     
     // Call Module_FreeConfiguration function
     if (((MODULE_API_1 *)remote_module->module.module_apis)->Module_FreeConfiguration && ((MODULE_API_1 *)remote_module->module.module_apis)->Module_ParseConfigurationFromJson) {
@@ -564,6 +914,24 @@ invoke_add_module_procedure (
         ((MODULE_API_1 *)remote_module->module.module_apis)->Module_FreeConfiguration(create_parameters);
     }
 
+    return module_handle;
+}
+
+
+int
+invoke_add_module_procedure (
+    REMOTE_MODULE_HANDLE remote_module,
+    const char * json_config
+) {
+    int result;
+
+    if (NULL == (remote_module->module.module_handle = create_module(remote_module, (BROKER_HANDLE)&remote_module->broker, json_config))) {
+        result = __LINE__;
+    } else {
+        /* SRS_PROXY_GATEWAY_027_0xx: [If no errors are encountered, `invoke_add_module_procedure` shall return zero] */
+        result = 0;
+    }
+
     return result;
 }
 
@@ -576,7 +944,8 @@ process_module_create_message (
     int result;
 
     /* SRS_PROXY_GATEWAY_027_0xx: [Prerequisite Check - If the `gateway_message_version` is greater than 1, then `process_module_create_message` shall do nothing and return a non-zero value] */
-    if (1 < message->gateway_message_version) {
+    /* Codes_SRS_PROXY_GATEWAY_30_029: [Prerequisite Check - `process_module_create_message` shall also accept a `gateway_message_version` of `GATEWAY_MESSAGE_VERSION_BATCHED`] */
+    if (GATEWAY_MESSAGE_VERSION_BATCHED < message->gateway_message_version) {
         LogError("%s: Incompatible create message version: %u!", __FUNCTION__, message->gateway_message_version);
         result = __LINE__;
         (void)send_control_reply(remote_module, (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
@@ -589,6 +958,9 @@ process_module_create_message (
             disconnect_from_message_channel(remote_module);
         }
 
+        /* Codes_SRS_PROXY_GATEWAY_30_030: [`process_module_create_message` shall frame the module messages of the new module by the `gateway_message_version` of the create message] */
+        remote_module->message_version = message->gateway_message_version;
+
         /* SRS_PROXY_GATEWAY_027_0xx: [`process_module_create_message` shall connect to the message channels] */
         if (0 != connect_to_message_channel(remote_module, &message->uri)) {
             /* SRS_PROXY_GATEWAY_027_0xx: [If unable to connect to the message channels, `process_module_create_message` shall attempt to reply to the gateway with a connection error status and return a non-zero value] */
@@ -618,12 +990,566 @@ process_module_create_message (
 }
 
 
+static
+int
+publish_message_batch (
+    REMOTE_MODULE_HANDLE remote_module,
+    MESSAGE_HANDLE * messages,
+    size_t count
+) {
+    int result;
+    int32_t * sizes;
+
+    if (NULL == (sizes = (int32_t *)malloc(count * sizeof(int32_t)))) {
+        LogError("%s: Unable to allocate memory!", __FUNCTION__);
+        result = __LINE__;
+    } else {
+        size_t i;
+        int32_t frame_size = 0;
+
+        for (i = 0; i < count; ++i) {
+            if (NULL == messages[i] || 0 > (sizes[i] = Message_ToByteArray(messages[i], NULL, 0))) {
+                LogError("%s: Unable to serialize message [%p]!", __FUNCTION__, messages[i]);
+                break;
+            }
+            frame_size += BATCHED_FRAME_HEADER_SIZE + sizes[i];
+        }
+
+        if (i != count) {
+            result = __LINE__;
+        } else {
+            void * nn_msg;
+
+            if (NULL == (nn_msg = nn_allocmsg(frame_size, 0))) {
+                LogError("%s: Unable to allocate a batch of %d bytes!", __FUNCTION__, frame_size);
+                result = __LINE__;
+            } else {
+                unsigned char * nn_msg_bytes = (unsigned char *)nn_msg;
+                int32_t position = 0;
+
+                for (i = 0; i < count; ++i) {
+                    BatchedFrame_SetSize(nn_msg_bytes + position, sizes[i]);
+                    position += BATCHED_FRAME_HEADER_SIZE;
+                    (void)Message_ToByteArray(messages[i], nn_msg_bytes + position, sizes[i]);
+                    position += sizes[i];
+                }
+
+                if (frame_size != nn_send(remote_module->message_socket, &nn_msg, NN_MSG, 0)) {
+                    LogError("%s: Unable to send a batch of messages!", __FUNCTION__);
+                    (void)nn_freemsg(nn_msg);
+                    result = __LINE__;
+                } else {
+                    result = 0;
+                }
+            }
+        }
+        free(sizes);
+    }
+
+    return result;
+}
+
+
+static
+void
+receive_message_batch (
+    REMOTE_MODULE_HANDLE remote_module,
+    const unsigned char * frame,
+    int32_t frame_size
+) {
+    int32_t position = 0;
+    const unsigned char * message_bytes;
+    int32_t message_size;
+    int next;
+
+    while (1 == (next = BatchedFrame_Next(frame, frame_size, &position, &message_bytes, &message_size))) {
+        MESSAGE_HANDLE structured_module_message;
+
+        if (NULL == (structured_module_message = Message_CreateFromByteArray(message_bytes, message_size))) {
+            LogError("%s: Unable to parse module message!", __FUNCTION__);
+        } else {
+            ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Receive(remote_module->module.module_handle, structured_module_message);
+            Message_Destroy(structured_module_message);
+        }
+    }
+    if (0 > next) {
+        LogError("%s: Malformed message batch!", __FUNCTION__);
+    }
+}
+
+
+static
+int
+receive_control_message (
+    REMOTE_MODULE_HANDLE remote_module
+) {
+    int result;
+    int32_t bytes_received;
+    void * control_message = NULL;
+
+    /* Codes_SRS_PROXY_GATEWAY_027_027: [Control Channel - `ProxyGateway_DoWork` shall poll the gateway control channel by calling `int nn_recv(int s, void * buf, size_t len, int flags)` with the control socket for `s`, `NULL` for `buf`, `NN_MSG` for `len` and NN_DONTWAIT for `flags`] */
+    if (0 > (bytes_received = nn_recv(remote_module->control_socket, &control_message, NN_MSG, NN_DONTWAIT))) {
+        result = 0;
+        if (EAGAIN == nn_errno()) {
+            /* Codes_SRS_PROXY_GATEWAY_027_028: [Control Channel - If no message is available, then `ProxyGateway_DoWork` shall abandon the control channel request] */
+        } else {
+            /* Codes_SRS_PROXY_GATEWAY_027_066: [Control Channel - If an error occurred when polling the gateway, then `ProxyGateway_DoWork` shall signal the gateway abandon the control channel request] */
+            LogError("%s: Unexpected error received from the control channel!", __FUNCTION__);
+            if (!remote_module->multiplexed) {
+                (void)send_control_reply(remote_module, (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
+            }
+        }
+    } else if (remote_module->multiplexed) {
+        result = 1;
+        /* Codes_SRS_PROXY_GATEWAY_30_017: [Control Channel - If the connection is multiplexed, `ProxyGateway_DoWork` shall route the control message to the module instance named by the module id that starts the frame] */
+        if (0 != process_multiplexed_control_message(remote_module, (const unsigned char *)control_message, bytes_received)) {
+            LogError("%s: Unable to process multiplexed control message!", __FUNCTION__);
+        }
+        (void)nn_freemsg(control_message);
+    } else {
+        CONTROL_MESSAGE * structured_control_message;
+        result = 1;
+
+        /* Codes_SRS_PROXY_GATEWAY_027_029: [Control Channel - If a control message was received, then `ProxyGateway_DoWork` will parse that message by calling `CONTROL_MESSAGE * ControlMessage_CreateFromByteArray(const unsigned char * source, size_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
+        if (NULL == (structured_control_message = ControlMessage_CreateFromByteArray((const unsigned char *)control_message, bytes_received))) {
+            /* Codes_SRS_PROXY_GATEWAY_027_030: [Control Channel - If unable to parse the control message, then `ProxyGateway_DoWork` shall signal the gateway, free any previously allocated memory and abandon the control channel request] */
+            LogError("%s: Unable to parse control message!", __FUNCTION__);
+            (void)send_control_reply(remote_module, (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
+        } else {
+            // Route control channel messages to appropriate functions
+            switch (structured_control_message->type) {
+              case CONTROL_MESSAGE_TYPE_MODULE_CREATE:
+                /* Codes_SRS_PROXY_GATEWAY_027_031: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_CREATE, then `ProxyGateway_DoWork` shall process the create message] */
+                if (0 != process_module_create_message(remote_module, (const CONTROL_MESSAGE_MODULE_CREATE *)structured_control_message)) {
+                    LogError("%s: Unable to process create message!", __FUNCTION__);
+                }
+                break;
+              case CONTROL_MESSAGE_TYPE_MODULE_START:
+                /* Codes_SRS_PROXY_GATEWAY_027_032: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_START and `Module_Start` was provided, then `ProxyGateway_DoWork` shall call `void Module_Start(MODULE_HANDLE moduleHandle)`] */
+                if (((MODULE_API_1 *)remote_module->module.module_apis)->Module_Start) {
+                    ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Start(remote_module->module.module_handle);
+                }
+                break;
+              case CONTROL_MESSAGE_TYPE_MODULE_DESTROY:
+                /* Codes_SRS_PROXY_GATEWAY_027_033: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_DESTROY, then `ProxyGateway_DoWork` shall call `void Module_Destroy(MODULE_HANDLE moduleHandle)`] */
+                ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Destroy(remote_module->module.module_handle);
+                remote_module->module.module_handle = NULL;
+                /* Codes_SRS_PROXY_GATEWAY_027_034: [Control Channel - If the message type is CONTROL_MESSAGE_TYPE_MODULE_DESTROY, then `ProxyGateway_DoWork` shall disconnect from the message channel] */
+                disconnect_from_message_channel(remote_module);
+                break;
+              default: LogError("ERROR: REMOTE_MODULE - Received unsupported message type! [%d]\n", structured_control_message->type); break;
+            }
+            /* Codes_SRS_PROXY_GATEWAY_027_035: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed control message by calling `void ControlMessage_Destroy(CONTROL_MESSAGE * message)` using the parsed control message as `message`] */
+            ControlMessage_Destroy(structured_control_message);
+        }
+        /* Codes_SRS_PROXY_GATEWAY_027_036: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
+        (void)nn_freemsg(control_message);
+    }
+
+    return result;
+}
+
+
+static
+int
+receive_module_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    int timeout_ms
+) {
+    int result;
+    int32_t bytes_received;
+
+    if (NULL != remote_module->message_channel) {
+        const unsigned char * ring_message = NULL;
+
+        /* Codes_SRS_PROXY_GATEWAY_30_003: [Message Channel - If the message channel is a shared memory channel, `ProxyGateway_DoWork` shall poll it by calling `int32_t ShmChannel_BeginReceive(SHM_CHANNEL_HANDLE channel, const unsigned char ** buf, int timeout_ms)` with `0` for `timeout_ms`] */
+        if (0 > (bytes_received = ShmChannel_BeginReceive(remote_module->message_channel, &ring_message, timeout_ms))) {
+            // no messages available at this time
+            result = 0;
+        } else {
+            MESSAGE_HANDLE structured_module_message;
+            result = 1;
+
+            /* Codes_SRS_PROXY_GATEWAY_30_004: [Message Channel - `ProxyGateway_DoWork` shall parse the message in place by calling `MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char * source, int32_t size)`, then release the ring space by calling `void ShmChannel_EndReceive(SHM_CHANNEL_HANDLE channel)`] */
+            structured_module_message = Message_CreateFromByteArray(ring_message, bytes_received);
+            ShmChannel_EndReceive(remote_module->message_channel);
+            if (NULL == structured_module_message) {
+                LogError("%s: Unable to parse module message!", __FUNCTION__);
+            } else {
+                ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Receive(remote_module->module.module_handle, structured_module_message);
+                Message_Destroy(structured_module_message);
+            }
+        }
+    /* Codes_SRS_PROXY_GATEWAY_027_037: [Message Channel - `ProxyGateway_DoWork` shall not check for messages, if the message socket is not available] */
+    } else if ( 0 > remote_module->message_socket ) {
+        // not connected to message channel
+        result = 0;
+    } else {
+        void * module_message = NULL;
+
+        /* Codes_SRS_PROXY_GATEWAY_027_038: [Message Channel - `ProxyGateway_DoWork` shall poll the gateway message channel by calling `int nn_recv(int s, void * buf, size_t len, int flags)` with each message socket for `s`, `NULL` for `buf`, `NN_MSG` for `len` and NN_DONTWAIT for `flags`] */
+        if (0 > (bytes_received = nn_recv(remote_module->message_socket, &module_message, NN_MSG, NN_DONTWAIT))) {
+            /* Codes_SRS_PROXY_GATEWAY_027_039: [Message Channel - If no message is available or an error occurred, then `ProxyGateway_DoWork` shall abandon the message channel request] */
+            result = 0;
+            if (EAGAIN == nn_errno()) {
+                // no messages available at this time
+            } else {
+                LogError("%s: Unexpected error received from the message channel!", __FUNCTION__);
+            }
+        } else if (GATEWAY_MESSAGE_VERSION_BATCHED == remote_module->message_version) {
+            result = 1;
+            /* Codes_SRS_PROXY_GATEWAY_30_026: [Message Channel - If the message channel is batched, `ProxyGateway_DoWork` shall pass every module message of the received frame to the module, in order] */
+            receive_message_batch(remote_module, (const unsigned char *)module_message, bytes_received);
+            (void)nn_freemsg(module_message);
+        } else if (remote_module->multiplexed) {
+            result = 1;
+            /* Codes_SRS_PROXY_GATEWAY_30_018: [Message Channel - If the connection is multiplexed, `ProxyGateway_DoWork` shall pass the module message to the module instance named by the module id that starts the frame] */
+            process_multiplexed_module_message(remote_module, (const unsigned char *)module_message, bytes_received);
+            (void)nn_freemsg(module_message);
+        } else {
+            MESSAGE_HANDLE structured_module_message;
+            result = 1;
+
+            /* Codes_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArrayNoCopy(unsigned char * source, int32_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
+            if (NULL == (structured_module_message = Message_CreateFromByteArrayNoCopy((unsigned char *)module_message, bytes_received))) {
+                /* Codes_SRS_PROXY_GATEWAY_027_041: [Message Channel - If unable to parse the module message, then `ProxyGateway_DoWork` shall free any previously allocated memory and abandon the message channel request] */
+                LogError("%s: Unable to parse control message!", __FUNCTION__);
+                /* Codes_SRS_PROXY_GATEWAY_027_044: [Message Channel - If unable to parse the module message, `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
+                (void)nn_freemsg(module_message);
+            } else {
+                /* Codes_SRS_PROXY_GATEWAY_027_042: [Message Channel - `ProxyGateway_DoWork` shall pass the structured message to the module by calling `void Module_Receive(MODULE_HANDLE moduleHandle)` using the parsed message as `moduleHandle`] */
+                ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Receive(remote_module->module.module_handle, structured_module_message);
+                /* Codes_SRS_PROXY_GATEWAY_027_043: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed module message by calling `void Message_Destroy(MESSAGE_HANDLE * message)` using the parsed module message as `message`, which releases the buffer received from `nn_recv` once the module has dropped its references] */
+                Message_Destroy(structured_module_message);
+            }
+        }
+    }
+
+    return result;
+}
+
+
+static
+int
+wait_for_messages (
+    REMOTE_MODULE_HANDLE remote_module,
+    int timeout_ms
+) {
+    int result;
+
+    if (NULL != remote_module->message_channel) {
+#ifdef __linux__
+        struct pollfd poll_fds[2];
+        size_t receive_fd_size = sizeof(poll_fds[0].fd);
+
+        // the ring is waited on through its doorbell, so a control message still ends the wait
+        if (0 != nn_getsockopt(remote_module->control_socket, NN_SOL_SOCKET, NN_RCVFD, &poll_fds[0].fd, &receive_fd_size)) {
+            /* Codes_SRS_PROXY_GATEWAY_30_049: [If unable to get the receive descriptor of the control socket, or if `poll` fails for any reason other than an interrupted wait, then `ProxyGateway_DoWorkEx` shall return a non-zero value] */
+            LogError("%s: Unable to get the receive descriptor of the control socket!", __FUNCTION__);
+            result = __LINE__;
+        } else {
+            poll_fds[0].events = POLLIN;
+            poll_fds[0].revents = 0;
+            poll_fds[1].fd = ShmChannel_GetPollFd(remote_module->message_channel);
+            poll_fds[1].events = POLLIN;
+            poll_fds[1].revents = 0;
+
+            /* Codes_SRS_PROXY_GATEWAY_30_034: [If no message was pending and `timeout_ms` is not `0`, and the message channel is a shared memory channel, `ProxyGateway_DoWorkEx` shall wait for the receive descriptor of the control socket or the descriptor returned by `int ShmChannel_GetPollFd(SHM_CHANNEL_HANDLE channel)` to become readable by calling `int poll(struct pollfd * fds, nfds_t nfds, int timeout)` with `timeout_ms` for `timeout`, then check both channels once more] */
+            if (0 > poll(poll_fds, 2, timeout_ms) && EINTR != errno) {
+                /* Codes_SRS_PROXY_GATEWAY_30_049: [If unable to get the receive descriptor of the control socket, or if `poll` fails for any reason other than an interrupted wait, then `ProxyGateway_DoWorkEx` shall return a non-zero value] */
+                LogError("%s: Unable to wait for the gateway channels, errno = %d", __FUNCTION__, errno);
+                result = __LINE__;
+            } else {
+                result = 0;
+            }
+        }
+#else
+        // shared memory channels only exist on Linux
+        LogError("%s: Not supported on this platform!", __FUNCTION__);
+        result = __LINE__;
+#endif
+    } else {
+        struct nn_pollfd poll_fds[2];
+        int poll_fd_count = 1;
+
+        poll_fds[0].fd = remote_module->control_socket;
+        poll_fds[0].events = NN_POLLIN;
+        poll_fds[0].revents = 0;
+        if (0 <= remote_module->message_socket) {
+            poll_fds[1].fd = remote_module->message_socket;
+            poll_fds[1].events = NN_POLLIN;
+            poll_fds[1].revents = 0;
+            ++poll_fd_count;
+        }
+
+        /* Codes_SRS_PROXY_GATEWAY_30_035: [Otherwise `ProxyGateway_DoWorkEx` shall wait for the control socket or the message socket to become readable by calling `int nn_poll(struct nn_pollfd * fds, int nfds, int timeout)` with `timeout_ms` for `timeout`, then check both channels once more] */
+        if (0 > nn_poll(poll_fds, poll_fd_count, timeout_ms) && EINTR != nn_errno()) {
+            /* Codes_SRS_PROXY_GATEWAY_30_036: [If `nn_poll` fails for any reason other than an interrupted wait, then `ProxyGateway_DoWorkEx` shall return a non-zero value] */
+            LogError("%s: Unable to wait for the gateway channels!", __FUNCTION__);
+            result = __LINE__;
+        } else {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+
+static
+int
+watch_socket (
+    int poll_fd,
+    int socket,
+    bool watch
+) {
+    int result;
+#ifdef __linux__
+    int receive_fd;
+    size_t receive_fd_size = sizeof(receive_fd);
+
+    // nanomsg signals a readable socket on a file descriptor of its own, that is the one to watch
+    if (0 != nn_getsockopt(socket, NN_SOL_SOCKET, NN_RCVFD, &receive_fd, &receive_fd_size)) {
+        LogError("%s: Unable to get the receive descriptor of the socket!", __FUNCTION__);
+        result = __LINE__;
+    } else {
+        result = watch_descriptor(poll_fd, receive_fd, watch);
+    }
+#else
+    (void)poll_fd;
+    (void)socket;
+    (void)watch;
+    result = __LINE__;
+#endif
+
+    return result;
+}
+
+
+static
+int
+watch_descriptor (
+    int poll_fd,
+    int fd,
+    bool watch
+) {
+    int result;
+#ifdef __linux__
+    struct epoll_event event;
+
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (0 != epoll_ctl(poll_fd, (watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL), fd, &event)) {
+        LogError("%s: epoll_ctl failed, errno = %d", __FUNCTION__, errno);
+        result = __LINE__;
+    } else {
+        result = 0;
+    }
+#else
+    (void)poll_fd;
+    (void)fd;
+    (void)watch;
+    result = __LINE__;
+#endif
+
+    return result;
+}
+
+
+static
+REMOTE_MODULE_INSTANCE_HANDLE
+find_module_instance (
+    REMOTE_MODULE_HANDLE remote_module,
+    uint32_t module_id
+) {
+    REMOTE_MODULE_INSTANCE_HANDLE instance = remote_module->instances;
+
+    while (NULL != instance && module_id != instance->broker.module_id) {
+        instance = instance->next;
+    }
+
+    return instance;
+}
+
+
+void
+destroy_module_instance (
+    REMOTE_MODULE_HANDLE remote_module,
+    REMOTE_MODULE_INSTANCE_HANDLE instance
+) {
+    REMOTE_MODULE_INSTANCE_HANDLE * previous = &remote_module->instances;
+
+    while (*previous != instance) {
+        previous = &(*previous)->next;
+    }
+    *previous = instance->next;
+
+    ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Destroy(instance->module_handle);
+    free(instance);
+
+    // The message channel is shared by the module instances, keep it until the last one is gone
+    if (NULL == remote_module->instances) {
+        disconnect_from_message_channel(remote_module);
+    }
+
+    return;
+}
+
+
+int
+process_multiplexed_create_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    uint32_t module_id,
+    const CONTROL_MESSAGE_MODULE_CREATE * message
+) {
+    int result;
+    REMOTE_MODULE_INSTANCE_HANDLE instance;
+
+    if (1 < message->gateway_message_version) {
+        LogError("%s: Incompatible create message version: %u!", __FUNCTION__, message->gateway_message_version);
+        result = __LINE__;
+        (void)send_control_reply_to(remote_module, module_id, (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
+    } else {
+        // A repeated create message replaces the module instance, as it does for a single module
+        if (NULL != (instance = find_module_instance(remote_module, module_id))) {
+            destroy_module_instance(remote_module, instance);
+        }
+
+        /* Codes_SRS_PROXY_GATEWAY_30_023: [`process_multiplexed_create_message` shall connect to the message channel, unless another module instance already did] */
+        if (0 > remote_module->message_socket && 0 != connect_to_message_channel(remote_module, &message->uri)) {
+            LogError("%s: Cannot connect to message channels!", __FUNCTION__);
+            result = __LINE__;
+            (void)send_control_reply_to(remote_module, module_id, (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
+        } else if (NULL == (instance = (REMOTE_MODULE_INSTANCE_HANDLE)calloc(1, sizeof(REMOTE_MODULE_INSTANCE)))) {
+            LogError("%s: Unable to allocate memory!", __FUNCTION__);
+            result = __LINE__;
+            if (NULL == remote_module->instances) {
+                disconnect_from_message_channel(remote_module);
+            }
+            (void)send_control_reply_to(remote_module, module_id, (uint8_t)REMOTE_MODULE_MODULE_CREATION_ERROR);
+        } else {
+            instance->broker.remote_module = remote_module;
+            instance->broker.module_id = module_id;
+
+            /* Codes_SRS_PROXY_GATEWAY_30_024: [`process_multiplexed_create_message` shall create a module instance whose broker handle identifies it to `Broker_Publish`] */
+            if (NULL == (instance->module_handle = create_module(remote_module, (BROKER_HANDLE)&instance->broker, message->args))) {
+                LogError("%s: Cannot create module!", __FUNCTION__);
+                result = __LINE__;
+                free(instance);
+                if (NULL == remote_module->instances) {
+                    disconnect_from_message_channel(remote_module);
+                }
+                (void)send_control_reply_to(remote_module, module_id, (uint8_t)REMOTE_MODULE_MODULE_CREATION_ERROR);
+            } else {
+                instance->next = remote_module->instances;
+                remote_module->instances = instance;
+
+                /* Codes_SRS_PROXY_GATEWAY_30_025: [`process_multiplexed_create_message` shall reply to the module instance with a success status] */
+                if (0 != send_control_reply_to(remote_module, module_id, (uint8_t)REMOTE_MODULE_OK)) {
+                    LogError("%s: Unable to contact gateway!", __FUNCTION__);
+                    result = __LINE__;
+                    destroy_module_instance(remote_module, instance);
+                } else {
+                    result = 0;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+
+int
+process_multiplexed_control_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    const unsigned char * frame,
+    int32_t size
+) {
+    int result;
+    CONTROL_MESSAGE * structured_control_message;
+
+    if (MULTIPLEXED_FRAME_HEADER_SIZE > size) {
+        LogError("%s: Control message is too short to hold a module id!", __FUNCTION__);
+        result = __LINE__;
+    } else if (NULL == (structured_control_message = ControlMessage_CreateFromByteArray(frame + MULTIPLEXED_FRAME_HEADER_SIZE, (size - MULTIPLEXED_FRAME_HEADER_SIZE)))) {
+        LogError("%s: Unable to parse control message!", __FUNCTION__);
+        result = __LINE__;
+        (void)send_control_reply_to(remote_module, MultiplexedFrame_GetModuleId(frame), (uint8_t)REMOTE_MODULE_GATEWAY_CONNECTION_ERROR);
+    } else {
+        uint32_t module_id = MultiplexedFrame_GetModuleId(frame);
+        REMOTE_MODULE_INSTANCE_HANDLE instance = find_module_instance(remote_module, module_id);
+
+        switch (structured_control_message->type) {
+          case CONTROL_MESSAGE_TYPE_MODULE_CREATE:
+            result = process_multiplexed_create_message(remote_module, module_id, (const CONTROL_MESSAGE_MODULE_CREATE *)structured_control_message);
+            break;
+          case CONTROL_MESSAGE_TYPE_MODULE_START:
+            if (NULL != instance && ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Start) {
+                ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Start(instance->module_handle);
+            }
+            result = 0;
+            break;
+          case CONTROL_MESSAGE_TYPE_MODULE_DESTROY:
+            if (NULL != instance) {
+                destroy_module_instance(remote_module, instance);
+            }
+            result = 0;
+            break;
+          default:
+            LogError("ERROR: REMOTE_MODULE - Received unsupported message type! [%d]\n", structured_control_message->type);
+            result = __LINE__;
+            break;
+        }
+        ControlMessage_Destroy(structured_control_message);
+    }
+
+    return result;
+}
+
+
+void
+process_multiplexed_module_message (
+    REMOTE_MODULE_HANDLE remote_module,
+    const unsigned char * frame,
+    int32_t size
+) {
+    REMOTE_MODULE_INSTANCE_HANDLE instance;
+    MESSAGE_HANDLE structured_module_message;
+
+    if (MULTIPLEXED_FRAME_HEADER_SIZE > size) {
+        LogError("%s: Module message is too short to hold a module id!", __FUNCTION__);
+    } else if (NULL == (instance = find_module_instance(remote_module, MultiplexedFrame_GetModuleId(frame)))) {
+        // the module instance is already gone
+    } else if (NULL == (structured_module_message = Message_CreateFromByteArray(frame + MULTIPLEXED_FRAME_HEADER_SIZE, (size - MULTIPLEXED_FRAME_HEADER_SIZE)))) {
+        LogError("%s: Unable to parse module message!", __FUNCTION__);
+    } else {
+        ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Receive(instance->module_handle, structured_module_message);
+        Message_Destroy(structured_module_message);
+    }
+
+    return;
+}
+
+
 int
 send_control_reply (
     REMOTE_MODULE_HANDLE remote_module,
     uint8_t response
+) {
+    return send_control_reply_to(remote_module, 0, response);
+}
+
+
+int
+send_control_reply_to (
+    REMOTE_MODULE_HANDLE remote_module,
+    uint32_t module_id,
+    uint8_t response
 ) {
     int result;
+    /* Codes_SRS_PROXY_GATEWAY_30_020: [`send_control_reply_to` shall start the reply with `module_id` if it is not 0, so the reply reaches that module instance over a multiplexed connection] */
+    int32_t header_size = (0 == module_id) ? 0 : MULTIPLEXED_FRAME_HEADER_SIZE;
     CONTROL_MESSAGE_MODULE_REPLY reply = {
         .base = {
             .type = CONTROL_MESSAGE_TYPE_MODULE_REPLY,
@@ -641,24 +1567,29 @@ send_control_reply (
         result = __LINE__;
     } else {
         /* SRS_PROXY_GATEWAY_027_0xx: [`send_control_reply` allocate the necessary space for the nano message, by calling `void * nn_allocmsg(size_t size, int type)` using the previously acquired message size for `size` and `0` for `type`] */
-        if (NULL == (message_buffer = nn_allocmsg(message_size, 0))) {
+        if (NULL == (message_buffer = nn_allocmsg(header_size + message_size, 0))) {
             /* SRS_PROXY_GATEWAY_027_0xx: [If unable to allocate memory, `send_control_reply` shall return a non-zero value] */
             LogError("%s: Unable to allocate message!", __FUNCTION__);
             result = __LINE__;
         /* SRS_PROXY_GATEWAY_027_0xx: [`send_control_reply` shall serialize a creation reply indicating the creation status by calling `size_t ControlMessage_ToByteArray(CONTROL MESSAGE * message, unsigned char * buf, size_t size)`] */
-        } else if (0 > ControlMessage_ToByteArray((CONTROL_MESSAGE *)&reply, message_buffer, message_size)) {
+        } else if (0 > ControlMessage_ToByteArray((CONTROL_MESSAGE *)&reply, message_buffer + header_size, message_size)) {
             /* SRS_PROXY_GATEWAY_027_0xx: [If unable to serialize the creation message reply, `send_control_reply` shall return a non-zero value] */
             LogError("%s: Unable to serialize message!", __FUNCTION__);
             result = __LINE__;
-        /* SRS_PROXY_GATEWAY_027_0xx: [`send_control_reply` shall send the serialized message by calling `int nn_send(int s, const void * buf, size_t len, int flags)` using the serialized message as the `buf` parameter and the value returned from `ControlMessage_ToByteArray` as `len`] */
-        } else if (0 > (message_size = nn_send(remote_module->control_socket, &message_buffer, NN_MSG, NN_DONTWAIT))) {
-            /* SRS_PROXY_GATEWAY_027_0xx: [If unable to send the serialized message, `send_control_reply` shall release the nano message by calling `int nn_freemsg(void * msg)` using the previously acquired nano message pointer as `msg` and return a non-zero value] */
-            LogError("%s: Unable to send message to gateway process!", __FUNCTION__);
-            result = __LINE__;
-            nn_freemsg(message_buffer);
         } else {
-            /* SRS_PROXY_GATEWAY_027_0xx: [If no errors are encountered, `send_control_reply` shall return zero] */
-            result = 0;
+            if (0 != header_size) {
+                MultiplexedFrame_SetModuleId(message_buffer, module_id);
+            }
+            /* SRS_PROXY_GATEWAY_027_0xx: [`send_control_reply` shall send the serialized message by calling `int nn_send(int s, const void * buf, size_t len, int flags)` using the serialized message as the `buf` parameter and the value returned from `ControlMessage_ToByteArray` as `len`] */
+            if (0 > (message_size = nn_send(remote_module->control_socket, &message_buffer, NN_MSG, NN_DONTWAIT))) {
+                /* SRS_PROXY_GATEWAY_027_0xx: [If unable to send the serialized message, `send_control_reply` shall release the nano message by calling `int nn_freemsg(void * msg)` using the previously acquired nano message pointer as `msg` and return a non-zero value] */
+                LogError("%s: Unable to send message to gateway process!", __FUNCTION__);
+                result = __LINE__;
+                nn_freemsg(message_buffer);
+            } else {
+                /* SRS_PROXY_GATEWAY_027_0xx: [If no errors are encountered, `send_control_reply` shall return zero] */
+                result = 0;
+            }
         }
     }
 
@@ -670,8 +1601,8 @@ send_control_reply (
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to obtain the mutex, then `worker_thread` shall return a non-zero value] */
 /* SRS_PROXY_GATEWAY_027_0xx: [`worker_thread` shall release the thread mutex upon entering the loop by calling `LOCK_RESULT Unlock(LOCK_HANDLE handle)`] */
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to release the mutex, then `worker_thread` shall exit the thread and return a non-zero value] */
-/* SRS_PROXY_GATEWAY_027_0xx: [`worker_thread` shall invoke asynchronous processing by calling `void ProxyGateway_DoWork(REMOTE_MODULE_HANDLE remote_module)`] */
-/* SRS_PROXY_GATEWAY_027_0xx: [`worker_thread` shall yield its remaining quantum by calling `void THREADAPI_Sleep(unsigned int milliseconds)`] */
+/* SRS_PROXY_GATEWAY_027_0xx: [`worker_thread` shall invoke asynchronous processing by calling `int ProxyGateway_DoWorkEx(REMOTE_MODULE_HANDLE remote_module, size_t max_messages, int timeout_ms)`, which waits for messages instead of spinning] */
+/* SRS_PROXY_GATEWAY_027_0xx: [If `ProxyGateway_DoWorkEx` fails, `worker_thread` shall back off by calling `void THREADAPI_Sleep(unsigned int milliseconds)`] */
 /* SRS_PROXY_GATEWAY_027_0xx: [`worker_thread` shall obtain the thread mutex in order to check for a halt signal by calling `LOCK_RESULT Lock(LOCK_HANDLE handle)`] */
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to obtain the mutex, then `worker_thread` shall exit the thread return a non-zero value] */
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to obtain the mutex, then `worker_thread` shall exit the thread return a non-zero value] */
@@ -700,8 +1631,9 @@ worker_thread (
                 break;
             }
             else {
-                ProxyGateway_DoWork(remote_module);
-                ThreadAPI_Sleep(0);  // Release the CPU
+                if (0 != ProxyGateway_DoWorkEx(remote_module, WORKER_THREAD_MAX_MESSAGES, WORKER_THREAD_WAIT_MS)) {
+                    ThreadAPI_Sleep(WORKER_THREAD_WAIT_MS);  // Do not spin on a broken channel
+                }
                 if (LOCK_ERROR == Lock(remote_module->message_thread->mutex)) {
                     LogError("%s: Failed to obtain mutex!", __FUNCTION__);
                     result = __LINE__;
@@ -36,6 +36,11 @@ static uint64_t negative_tests_to_skip;
 #include <nanomsg/nn.h>
 #include <nanomsg/pair.h>
 
+#ifdef __linux__
+  #include <unistd.h>
+  #include <sys/eventfd.h>
+#endif
+
 static TEST_MUTEX_HANDLE g_testByTest;
 static TEST_MUTEX_HANDLE g_dllByDll;
 
@@ -73,6 +78,7 @@ non_mocked_free(
   #include "control_message.h"
   #include "message.h"
   #include "module.h"
+  #include "shm_channel.h"
 #undef ENABLE_MOCKS
 
 // Under test #includes
@@ -80,6 +86,7 @@ non_mocked_free(
 #include "gateway.h"
 
 #include "proxy_gateway.h"
+#include "batched_frame.h"
 
 #define MOCK_LOCK (LOCK_HANDLE)0x17091979
 #define MOCK_MODULE (MODULE_HANDLE)0x09171979
@@ -401,6 +408,12 @@ MOCK_FUNCTION_END(0)
 MOCK_FUNCTION_WITH_CODE(, int, nn_freemsg, void *, msg)
 MOCK_FUNCTION_END(0)
 
+MOCK_FUNCTION_WITH_CODE(, int, nn_getsockopt, int, s, int, level, int, option, void *, optval, size_t *, optvallen)
+MOCK_FUNCTION_END(0)
+
+MOCK_FUNCTION_WITH_CODE(, int, nn_poll, struct nn_pollfd *, fds, int, nfds, int, timeout)
+MOCK_FUNCTION_END(0)
+
 MOCK_FUNCTION_WITH_CODE(, int, nn_recv, int, s, void *, buf, size_t, len, int, flags)
 MOCK_FUNCTION_END(0)
 
@@ -568,6 +581,7 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_HANDLE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(MODULE_HANDLE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(REMOTE_MODULE_HANDLE, void *);
+    REGISTER_UMOCK_ALIAS_TYPE(SHM_CHANNEL_HANDLE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(THREAD_HANDLE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(THREAD_START_FUNC, void *);
     REGISTER_UMOCK_ALIAS_TYPE(THREADAPI_RESULT, int);
@@ -834,6 +848,68 @@ TEST_FUNCTION(attach_SCENARIO_success)
     ProxyGateway_Detach(remote_module);
 }
 
+/* Tests_SRS_PROXY_GATEWAY_30_015: [`ProxyGateway_AttachMultiplexed` shall attach to the Azure IoT Gateway as `ProxyGateway_Attach` does and return `NULL` under the same conditions] */
+/* Tests_SRS_PROXY_GATEWAY_30_016: [`ProxyGateway_AttachMultiplexed` shall mark the connection as multiplexed, so every create message received on it creates another module instance] */
+TEST_FUNCTION(attachMultiplexed_SCENARIO_success)
+{
+    // Arrange
+    static const int COMMAND_ENDPOINT = 917;
+    static const int COMMAND_SOCKET = 1979;
+    static const char CONTROL_CHANNEL_URI[] = "ipc://proxy_gateway_ut.ipc";
+    const MODULE_API_1 module_apis = {
+        { MODULE_API_VERSION_1 },
+        mock_parseConfigurationFromJson,
+        mock_freeConfiguration,
+        mock_create,
+        mock_destroy,
+        mock_receive,
+        mock_start
+    };
+
+    REMOTE_MODULE_HANDLE remote_module;
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(gballoc_calloc(IGNORED_NUM_ARG, IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(CONTROL_CHANNEL_URI)));
+    STRICT_EXPECTED_CALL(nn_socket(AF_SP, NN_PAIR))
+        .SetReturn(COMMAND_SOCKET);
+    STRICT_EXPECTED_CALL(nn_bind(COMMAND_SOCKET, IGNORED_PTR_ARG))
+        .IgnoreArgument(2)
+        .SetReturn(COMMAND_ENDPOINT)
+        .ValidateArgumentBuffer(2, CONTROL_CHANNEL_URI, (sizeof(CONTROL_CHANNEL_URI) - 1));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // Act
+    remote_module = ProxyGateway_AttachMultiplexed((MODULE_API *)&module_apis, "proxy_gateway_ut");
+
+    // Assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
+/* Tests_SRS_PROXY_GATEWAY_30_015: [`ProxyGateway_AttachMultiplexed` shall attach to the Azure IoT Gateway as `ProxyGateway_Attach` does and return `NULL` under the same conditions] */
+TEST_FUNCTION(attachMultiplexed_SCENARIO_NULL_connection_id)
+{
+    // Arrange
+    REMOTE_MODULE_HANDLE remote_module;
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+
+    // Act
+    remote_module = ProxyGateway_AttachMultiplexed((MODULE_API *)&MOCK_MODULE_APIS, (const char *)NULL);
+
+    // Assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(remote_module);
+
+    // Cleanup
+}
+
 /* Tests_SRS_PROXY_GATEWAY_027_008: [If memory allocation fails for the instance data, then `ProxyGateway_Attach` shall return `NULL`] */
 /* Tests_SRS_PROXY_GATEWAY_027_010: [If memory allocation fails for the connection string, then `ProxyGateway_Attach` shall free any previously allocated memory and return `NULL`] */
 /* Tests_SRS_PROXY_GATEWAY_027_012: [If the call to `nn_socket` returns -1, then `ProxyGateway_Attach` shall free any previously allocated memory and return `NULL`] */
@@ -1056,10 +1132,10 @@ TEST_FUNCTION(doWork_SCENARIO_NULL_handle)
 /* Tests_SRS_PROXY_GATEWAY_027_035: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed control message by calling `void ControlMessage_Destroy(CONTROL_MESSAGE * message)` using the parsed control message as `message`] */
 /* Tests_SRS_PROXY_GATEWAY_027_036: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
 /* Tests_SRS_PROXY_GATEWAY_027_038: [Message Channel - `ProxyGateway_DoWork` shall poll the gateway message channel by calling `int nn_recv(int s, void * buf, size_t len, int flags)` with each message socket for `s`, `NULL` for `buf`, `NN_MSG` for `len` and NN_DONTWAIT for `flags`] */
-/* Tests_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char * source, int32_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
+/* Tests_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArrayNoCopy(unsigned char * source, int32_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
 /* Tests_SRS_PROXY_GATEWAY_027_042: [Message Channel - `ProxyGateway_DoWork` shall pass the structured message to the module by calling `void Module_Receive(MODULE_HANDLE moduleHandle)` using the parsed message as `moduleHandle`] */
-/* Tests_SRS_PROXY_GATEWAY_027_043: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed module message by calling `void Message_Destroy(MESSAGE_HANDLE * message)` using the parsed module message as `message`] */
-/* Tests_SRS_PROXY_GATEWAY_027_044: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
+/* Tests_SRS_PROXY_GATEWAY_027_043: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed module message by calling `void Message_Destroy(MESSAGE_HANDLE * message)` using the parsed module message as `message`, which releases the buffer received from `nn_recv` once the module has dropped its references] */
+/* Tests_SRS_PROXY_GATEWAY_027_044: [Message Channel - If unable to parse the module message, `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
 TEST_FUNCTION(doWork_SCENARIO_create_message_success)
 {
     // Arrange
@@ -1114,12 +1190,11 @@ TEST_FUNCTION(doWork_SCENARIO_create_message_success)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayNoCopy((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
         .IgnoreArgument(2)
         .SetReturn((MESSAGE_HANDLE)&CREATE_MESSAGE);
     STRICT_EXPECTED_CALL(mock_receive(MOCK_MODULE, (MESSAGE_HANDLE)&CREATE_MESSAGE));
     STRICT_EXPECTED_CALL(Message_Destroy((MESSAGE_HANDLE)&CREATE_MESSAGE));
-    STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
 
     // Act
     ProxyGateway_DoWork(remote_module);
@@ -1203,13 +1278,12 @@ TEST_FUNCTION(doWork_SCENARIO_start_message_success)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayNoCopy((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
         .IgnoreArgument(2)
         .SetReturn((MESSAGE_HANDLE)&START_MESSAGE);
     STRICT_EXPECTED_CALL(mock_receive(IGNORED_PTR_ARG, (MESSAGE_HANDLE)&START_MESSAGE))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(Message_Destroy((MESSAGE_HANDLE)&START_MESSAGE));
-    STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
 
     // Act
     ProxyGateway_DoWork(remote_module);
@@ -1485,7 +1559,7 @@ TEST_FUNCTION(doWork_SCENARIO_gateway_message_bad_parse)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayNoCopy((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
         .IgnoreArgument(2)
         .SetReturn(NULL);
     STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
@@ -1500,6 +1574,270 @@ TEST_FUNCTION(doWork_SCENARIO_gateway_message_bad_parse)
     ProxyGateway_Detach(remote_module);
 }
 
+/* Tests_SRS_PROXY_GATEWAY_30_031: [Prerequisite Check - If the `remote_module` parameter is `NULL`, then `ProxyGateway_DoWorkEx` shall do nothing and return a non-zero value] */
+TEST_FUNCTION(doWorkEx_SCENARIO_NULL_handle)
+{
+    // Arrange
+    int result;
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+
+    // Act
+    result = ProxyGateway_DoWorkEx(NULL, 1, 0);
+
+    // Assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+}
+
+/* Tests_SRS_PROXY_GATEWAY_30_032: [Prerequisite Check - If the `max_messages` parameter is `0`, then `ProxyGateway_DoWorkEx` shall do nothing and return a non-zero value] */
+TEST_FUNCTION(doWorkEx_SCENARIO_zero_max_messages)
+{
+    // Arrange
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+
+    // Act
+    result = ProxyGateway_DoWorkEx(remote_module, 0, 0);
+
+    // Assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
+/* Tests_SRS_PROXY_GATEWAY_30_033: [`ProxyGateway_DoWorkEx` shall handle the control and module messages as `ProxyGateway_DoWork` does, until neither channel holds a message or it has handled `max_messages` messages] */
+/* Tests_SRS_PROXY_GATEWAY_30_035: [Otherwise `ProxyGateway_DoWorkEx` shall wait for the control socket or the message socket to become readable by calling `int nn_poll(struct nn_pollfd * fds, int nfds, int timeout)` with `timeout_ms` for `timeout`, then check both channels once more] */
+TEST_FUNCTION(doWorkEx_SCENARIO_waits_when_idle)
+{
+    // Arrange
+    static const int TIMEOUT_MS = 50;
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(nn_errno())
+        .SetReturn(EAGAIN);
+    STRICT_EXPECTED_CALL(nn_poll(IGNORED_PTR_ARG, 1, TIMEOUT_MS))
+        .IgnoreArgument(1)
+        .SetReturn(0);
+    STRICT_EXPECTED_CALL(nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(nn_errno())
+        .SetReturn(EAGAIN);
+
+    // Act
+    result = ProxyGateway_DoWorkEx(remote_module, 8, TIMEOUT_MS);
+
+    // Assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
+/* Tests_SRS_PROXY_GATEWAY_30_036: [If `nn_poll` fails for any reason other than an interrupted wait, then `ProxyGateway_DoWorkEx` shall return a non-zero value] */
+TEST_FUNCTION(doWorkEx_SCENARIO_poll_error)
+{
+    // Arrange
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(nn_errno())
+        .SetReturn(EAGAIN);
+    STRICT_EXPECTED_CALL(nn_poll(IGNORED_PTR_ARG, 1, -1))
+        .IgnoreArgument(1)
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(nn_errno())
+        .SetReturn(EBADF);
+
+    // Act
+    result = ProxyGateway_DoWorkEx(remote_module, 8, -1);
+
+    // Assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
+#ifdef __linux__
+/* Tests_SRS_PROXY_GATEWAY_30_034: [If no message was pending and `timeout_ms` is not `0`, and the message channel is a shared memory channel, `ProxyGateway_DoWorkEx` shall wait for the receive descriptor of the control socket or the descriptor returned by `int ShmChannel_GetPollFd(SHM_CHANNEL_HANDLE channel)` to become readable by calling `int poll(struct pollfd * fds, nfds_t nfds, int timeout)` with `timeout_ms` for `timeout`, then check both channels once more] */
+TEST_FUNCTION(doWorkEx_SCENARIO_shm_waits_on_the_control_socket_and_the_ring)
+{
+    // Arrange
+    static const MESSAGE_URI MESSAGE = {
+        sizeof("shm://proxy_gateway_ut"),
+        SHM_CHANNEL_URI_TYPE,
+        "shm://proxy_gateway_ut"
+    };
+    static const uint64_t RING = 1;
+    REMOTE_MODULE_HANDLE remote_module;
+    int result;
+    int control_fd;
+    int ring_fd;
+
+    // a message waits on the ring, so waiting forever returns at once
+    control_fd = eventfd(0, 0);
+    ASSERT_IS_TRUE(0 <= control_fd);
+    ring_fd = eventfd(0, 0);
+    ASSERT_IS_TRUE(0 <= ring_fd);
+    ASSERT_ARE_EQUAL(int, (int)sizeof(RING), (int)write(ring_fd, &RING, sizeof(RING)));
+
+    remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+    EXPECTED_CALL(Lock_Init())
+        .SetReturn((LOCK_HANDLE)0x09171979);
+    STRICT_EXPECTED_CALL(ShmChannel_Open(MESSAGE.uri))
+        .SetReturn((SHM_CHANNEL_HANDLE)0x19790917);
+    STRICT_EXPECTED_CALL(ShmChannel_GetPollFd((SHM_CHANNEL_HANDLE)0x19790917))
+        .SetReturn(ring_fd);
+    ASSERT_ARE_EQUAL(int, 0, connect_to_message_channel(remote_module, &MESSAGE));
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(nn_errno())
+        .SetReturn(EAGAIN);
+    STRICT_EXPECTED_CALL(ShmChannel_BeginReceive(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(SHM_CHANNEL_EMPTY);
+    STRICT_EXPECTED_CALL(nn_getsockopt(IGNORED_NUM_ARG, NN_SOL_SOCKET, NN_RCVFD, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(4)
+        .IgnoreArgument(5)
+        .CopyOutArgumentBuffer(4, &control_fd, sizeof(control_fd))
+        .SetReturn(0);
+    STRICT_EXPECTED_CALL(ShmChannel_GetPollFd(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetReturn(ring_fd);
+    STRICT_EXPECTED_CALL(nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(nn_errno())
+        .SetReturn(EAGAIN);
+    STRICT_EXPECTED_CALL(ShmChannel_BeginReceive(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(SHM_CHANNEL_EMPTY);
+
+    // Act
+    result = ProxyGateway_DoWorkEx(remote_module, 8, -1);
+
+    // Assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+    (void)close(ring_fd);
+    (void)close(control_fd);
+}
+
+/* Tests_SRS_PROXY_GATEWAY_30_049: [If unable to get the receive descriptor of the control socket, or if `poll` fails for any reason other than an interrupted wait, then `ProxyGateway_DoWorkEx` shall return a non-zero value] */
+TEST_FUNCTION(doWorkEx_SCENARIO_shm_control_descriptor_unavailable)
+{
+    // Arrange
+    static const MESSAGE_URI MESSAGE = {
+        sizeof("shm://proxy_gateway_ut"),
+        SHM_CHANNEL_URI_TYPE,
+        "shm://proxy_gateway_ut"
+    };
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+    EXPECTED_CALL(Lock_Init())
+        .SetReturn((LOCK_HANDLE)0x09171979);
+    STRICT_EXPECTED_CALL(ShmChannel_Open(MESSAGE.uri))
+        .SetReturn((SHM_CHANNEL_HANDLE)0x19790917);
+    STRICT_EXPECTED_CALL(ShmChannel_GetPollFd((SHM_CHANNEL_HANDLE)0x19790917))
+        .SetReturn(1979);
+    ASSERT_ARE_EQUAL(int, 0, connect_to_message_channel(remote_module, &MESSAGE));
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, NN_DONTWAIT))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(nn_errno())
+        .SetReturn(EAGAIN);
+    STRICT_EXPECTED_CALL(ShmChannel_BeginReceive(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .SetReturn(SHM_CHANNEL_EMPTY);
+    STRICT_EXPECTED_CALL(nn_getsockopt(IGNORED_NUM_ARG, NN_SOL_SOCKET, NN_RCVFD, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(4)
+        .IgnoreArgument(5)
+        .SetReturn(-1);
+
+    // Act
+    result = ProxyGateway_DoWorkEx(remote_module, 8, -1);
+
+    // Assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+#endif
+
+/* Tests_SRS_PROXY_GATEWAY_30_038: [Prerequisite Check - If the `remote_module` parameter is `NULL`, then `ProxyGateway_GetPollFd` shall return -1] */
+TEST_FUNCTION(getPollFd_SCENARIO_NULL_handle)
+{
+    // Arrange
+    int result;
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+
+    // Act
+    result = ProxyGateway_GetPollFd(NULL);
+
+    // Assert
+    ASSERT_ARE_EQUAL(int, -1, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+}
+
 /* Tests_SRS_PROXY_GATEWAY_027_045: [Prerequisite Check - If the `remote_module` parameter is `NULL`, then `ProxyGateway_HaltWorkerThread` shall return a non-zero value] */
 TEST_FUNCTION(haltWorkerThread_SCENARIO_NULL_handle)
 {
@@ -2052,6 +2390,116 @@ TEST_FUNCTION(connect_to_message_channel_SCENARIO_negative_tests)
     umock_c_negative_tests_deinit();
 }
 
+/* Tests_SRS_PROXY_GATEWAY_30_006: [If `MESSAGE_URI::uri_type` is `SHM_CHANNEL_URI_TYPE`, then `connect_to_message_channel` shall attach to the shared memory channel instead of creating a socket] */
+/* Tests_SRS_PROXY_GATEWAY_30_007: [`connect_to_message_ring` shall create the lock serializing the publishers by calling `LOCK_HANDLE Lock_Init(void)`] */
+/* Tests_SRS_PROXY_GATEWAY_30_009: [`connect_to_message_ring` shall attach to the shared memory channel the gateway created by calling `SHM_CHANNEL_HANDLE ShmChannel_Open(const char * uri)` with `MESSAGE_URI::uri` as `uri`] */
+/* Tests_SRS_PROXY_GATEWAY_30_011: [If no errors are encountered, then `connect_to_message_ring` shall return zero] */
+/* Tests_SRS_PROXY_GATEWAY_30_045: [`connect_to_message_ring` shall start the doorbell of the shared memory channel by calling `int ShmChannel_GetPollFd(SHM_CHANNEL_HANDLE channel)`] */
+TEST_FUNCTION(connect_to_message_channel_SCENARIO_shm_success)
+{
+    // Arrange
+    static const MESSAGE_URI MESSAGE = {
+        sizeof("shm://proxy_gateway_ut"),
+        SHM_CHANNEL_URI_TYPE,
+        "shm://proxy_gateway_ut"
+    };
+
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(Lock_Init())
+        .SetReturn((LOCK_HANDLE)0x09171979);
+    STRICT_EXPECTED_CALL(ShmChannel_Open(MESSAGE.uri))
+        .SetReturn((SHM_CHANNEL_HANDLE)0x19790917);
+    STRICT_EXPECTED_CALL(ShmChannel_GetPollFd((SHM_CHANNEL_HANDLE)0x19790917))
+        .SetReturn(1979);
+
+    // Act
+    result = connect_to_message_channel(remote_module, &MESSAGE);
+
+    // Assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, result);
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
+/* Tests_SRS_PROXY_GATEWAY_30_010: [If unable to attach to the shared memory channel, then `connect_to_message_ring` shall free the lock and return a non-zero value] */
+TEST_FUNCTION(connect_to_message_channel_SCENARIO_shm_open_fails)
+{
+    // Arrange
+    static const MESSAGE_URI MESSAGE = {
+        sizeof("shm://proxy_gateway_ut"),
+        SHM_CHANNEL_URI_TYPE,
+        "shm://proxy_gateway_ut"
+    };
+
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(Lock_Init())
+        .SetReturn((LOCK_HANDLE)0x09171979);
+    STRICT_EXPECTED_CALL(ShmChannel_Open(MESSAGE.uri))
+        .SetReturn(NULL);
+    STRICT_EXPECTED_CALL(Lock_Deinit((LOCK_HANDLE)0x09171979));
+
+    // Act
+    result = connect_to_message_channel(remote_module, &MESSAGE);
+
+    // Assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
+/* Tests_SRS_PROXY_GATEWAY_30_046: [If unable to start the doorbell, then `connect_to_message_ring` shall detach from the shared memory channel by calling `void ShmChannel_Destroy(SHM_CHANNEL_HANDLE channel)`, free the lock and return a non-zero value] */
+TEST_FUNCTION(connect_to_message_channel_SCENARIO_shm_doorbell_fails)
+{
+    // Arrange
+    static const MESSAGE_URI MESSAGE = {
+        sizeof("shm://proxy_gateway_ut"),
+        SHM_CHANNEL_URI_TYPE,
+        "shm://proxy_gateway_ut"
+    };
+
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(Lock_Init())
+        .SetReturn((LOCK_HANDLE)0x09171979);
+    STRICT_EXPECTED_CALL(ShmChannel_Open(MESSAGE.uri))
+        .SetReturn((SHM_CHANNEL_HANDLE)0x19790917);
+    STRICT_EXPECTED_CALL(ShmChannel_GetPollFd((SHM_CHANNEL_HANDLE)0x19790917))
+        .SetReturn(-1);
+    STRICT_EXPECTED_CALL(ShmChannel_Destroy((SHM_CHANNEL_HANDLE)0x19790917));
+    STRICT_EXPECTED_CALL(Lock_Deinit((LOCK_HANDLE)0x09171979));
+
+    // Act
+    result = connect_to_message_channel(remote_module, &MESSAGE);
+
+    // Assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
 /* SRS_PROXY_GATEWAY_027_0xx: [`disconnect_from_message_channel` shall shutdown the Azure IoT Gateway message channel by calling `int nn_shutdown(int s, int how)`] */
 /* SRS_PROXY_GATEWAY_027_0xx: [`disconnect_from_message_channel` shall close the Azure IoT Gateway message socket by calling `int nn_close(int s)`] */
 TEST_FUNCTION(disconnect_from_message_channel_SCENARIO_success)
@@ -2228,7 +2676,7 @@ TEST_FUNCTION(process_module_create_message_SCENARIO_bad_version)
             CONTROL_MESSAGE_VERSION_CURRENT,
             CONTROL_MESSAGE_TYPE_MODULE_CREATE
         },
-        (GATEWAY_MESSAGE_VERSION_CURRENT + 1), // GATEWAY_MESSAGE_VERSION_NEXT
+        (GATEWAY_MESSAGE_VERSION_BATCHED + 1), // GATEWAY_MESSAGE_VERSION_NEXT
         {
             sizeof("ipc://message_channel"),
             NN_PAIR,
@@ -2365,6 +2813,53 @@ TEST_FUNCTION(process_module_create_message_SCENARIO_success)
     ProxyGateway_Detach(remote_module);
 }
 
+/* Tests_SRS_PROXY_GATEWAY_30_029: [Prerequisite Check - `process_module_create_message` shall also accept a `gateway_message_version` of `GATEWAY_MESSAGE_VERSION_BATCHED`] */
+/* Tests_SRS_PROXY_GATEWAY_30_030: [`process_module_create_message` shall frame the module messages of the new module by the `gateway_message_version` of the create message] */
+TEST_FUNCTION(process_module_create_message_SCENARIO_batched_version)
+{
+    // Arrange
+    static const CONTROL_MESSAGE_MODULE_CREATE CREATE_MESSAGE = {
+        {
+            CONTROL_MESSAGE_VERSION_CURRENT,
+            CONTROL_MESSAGE_TYPE_MODULE_CREATE
+        },
+        GATEWAY_MESSAGE_VERSION_BATCHED,
+        {
+            sizeof("ipc://message_channel"),
+            NN_PAIR,
+            "ipc://message_channel"
+        },
+        sizeof("json_encoded_remote_module_parameters"),
+        "json_encoded_remote_module_parameters"
+    };
+    static const CONTROL_MESSAGE_MODULE_REPLY REPLY = {
+        {
+            CONTROL_MESSAGE_VERSION_1,
+            CONTROL_MESSAGE_TYPE_MODULE_REPLY
+        },
+        0
+    };
+
+    int result;
+
+    REMOTE_MODULE_HANDLE remote_module = ProxyGateway_Attach((MODULE_API *)&MOCK_MODULE_APIS, "proxy_gateway_ut");
+    ASSERT_IS_NOT_NULL(remote_module);
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+    expected_calls_process_module_create_message(remote_module, &CREATE_MESSAGE, &REPLY);
+
+    // Act
+    result = process_module_create_message(remote_module, &CREATE_MESSAGE);
+
+    // Assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, result);
+
+    // Cleanup
+    ProxyGateway_Detach(remote_module);
+}
+
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to connect to the message channels, `process_module_create_message` shall attempt to reply to the gateway with a connection error status and return a non-zero value] */
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to complete the "add module" process, `process_module_create_message` shall disconnect from the message channels, attempt to reply to the gateway with a module creation error status and return a non-zero value] */
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to contact the gateway, `process_module_create_message` disconnect from the message channels and return a non-zero value] */
@@ -2574,12 +3069,11 @@ TEST_FUNCTION(publish_SCENARIO_create_message_success)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayNoCopy((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
         .IgnoreArgument(2)
         .SetReturn((MESSAGE_HANDLE)&CREATE_MESSAGE);
     STRICT_EXPECTED_CALL(mock_receive(MOCK_MODULE, (MESSAGE_HANDLE)&CREATE_MESSAGE));
     STRICT_EXPECTED_CALL(Message_Destroy((MESSAGE_HANDLE)&CREATE_MESSAGE));
-    STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
 
     // Act
     ProxyGateway_DoWork(remote_module);
@@ -2591,6 +3085,30 @@ TEST_FUNCTION(publish_SCENARIO_create_message_success)
     ProxyGateway_Detach(remote_module);
 }
 
+/* Tests_SRS_PROXY_GATEWAY_30_001: [If `broker` or `messages` is `NULL` or `count` is 0, `Broker_PublishBatch` shall return `BROKER_INVALIDARG`] */
+TEST_FUNCTION(Broker_PublishBatch_SCENARIO_invalid_arguments)
+{
+    // Arrange
+    MESSAGE_HANDLE messages[1] = { (MESSAGE_HANDLE)0x42 };
+    BROKER_RESULT result1, result2, result3;
+
+    // Expected call listing
+    umock_c_reset_all_calls();
+
+    // Act
+    result1 = Broker_PublishBatch(NULL, NULL, messages, 1);
+    result2 = Broker_PublishBatch((BROKER_HANDLE)0x42, NULL, NULL, 1);
+    result3 = Broker_PublishBatch((BROKER_HANDLE)0x42, NULL, messages, 0);
+
+    // Assert
+    ASSERT_ARE_EQUAL(int, BROKER_INVALIDARG, result1);
+    ASSERT_ARE_EQUAL(int, BROKER_INVALIDARG, result2);
+    ASSERT_ARE_EQUAL(int, BROKER_INVALIDARG, result3);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // Cleanup
+}
+
 
 /* SRS_PROXY_GATEWAY_027_0xx: [`worker_thread` shall obtain the thread mutex in order to initialize the thread by calling `LOCK_RESULT Lock(LOCK_HANDLE handle)`] */
 /* SRS_PROXY_GATEWAY_027_0xx: [If unable to obtain the mutex, then `worker_thread` shall return a non-zero value] */
@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/** @file       batched_frame.h
+ *
+ *  @brief      Framing of a batched message channel.
+ *
+ *  @details    When the Create Message of a module carries the
+ *              #GATEWAY_MESSAGE_VERSION_BATCHED gateway message version,
+ *              every frame sent on its message channel, in either direction,
+ *              is a batch of one or more serialized gateway messages. Each
+ *              message in the batch is preceded by its size in bytes, in
+ *              network byte order, so many small messages cross the process
+ *              boundary in a single nanomsg send.
+ */
+
+#ifndef BATCHED_FRAME_H
+#define BATCHED_FRAME_H
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C"
+{
+#else
+#include <stdint.h>
+#endif
+
+/** @brief  Gateway message version of a message channel carrying batches. */
+#define GATEWAY_MESSAGE_VERSION_BATCHED 0x02
+
+/** @brief  Size in bytes of the size that precedes every message of a batch. */
+#define BATCHED_FRAME_HEADER_SIZE       4
+
+/** @brief  Writes the @c size of the next message at the start of @c frame. */
+static inline void BatchedFrame_SetSize(unsigned char* frame, int32_t size)
+{
+    frame[0] = (unsigned char)((uint32_t)size >> 24);
+    frame[1] = (unsigned char)((uint32_t)size >> 16);
+    frame[2] = (unsigned char)((uint32_t)size >> 8);
+    frame[3] = (unsigned char)((uint32_t)size);
+}
+
+/** @brief      Finds the next message of a batch.
+ *
+ *  @param      frame       The batch.
+ *  @param      frame_size  The size of the batch in bytes.
+ *  @param      position    The offset of the next message in the batch, 0 to
+ *                          begin, advanced past the message found.
+ *  @param      message     Receives the start of the message found.
+ *  @param      message_size Receives the size of the message found.
+ *
+ *  @return     1 if a message was found, 0 at the end of the batch, or -1 if
+ *              the batch is malformed.
+ */
+static inline int BatchedFrame_Next(const unsigned char* frame, int32_t frame_size, int32_t* position, const unsigned char** message, int32_t* message_size)
+{
+    int result;
+    int32_t remaining = frame_size - *position;
+    if (remaining == 0)
+    {
+        result = 0;
+    }
+    else if (remaining < BATCHED_FRAME_HEADER_SIZE)
+    {
+        result = -1;
+    }
+    else
+    {
+        const unsigned char* header = frame + *position;
+        uint32_t size = ((uint32_t)header[0] << 24) |
+            ((uint32_t)header[1] << 16) |
+            ((uint32_t)header[2] << 8) |
+            (uint32_t)header[3];
+        if (size > (uint32_t)(remaining - BATCHED_FRAME_HEADER_SIZE))
+        {
+            result = -1;
+        }
+        else
+        {
+            *message = header + BATCHED_FRAME_HEADER_SIZE;
+            *message_size = (int32_t)size;
+            *position += BATCHED_FRAME_HEADER_SIZE + (int32_t)size;
+            result = 1;
+        }
+    }
+    return result;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*BATCHED_FRAME_H*/
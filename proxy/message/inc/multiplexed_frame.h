@@ -0,0 +1,52 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/** @file       multiplexed_frame.h
+ *
+ *  @brief      Framing of a multiplexed module host link.
+ *
+ *  @details    A multiplexed link carries the control and gateway messages
+ *              of many modules over one control socket and one message
+ *              socket. Every frame sent on such a link starts with the id of
+ *              the module it belongs to, in network byte order, followed by
+ *              the serialized control or gateway message. Module ids are
+ *              assigned by the gateway and are never 0.
+ */
+
+#ifndef MULTIPLEXED_FRAME_H
+#define MULTIPLEXED_FRAME_H
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C"
+{
+#else
+#include <stdint.h>
+#endif
+
+/** @brief  Size in bytes of the module id that starts every frame. */
+#define MULTIPLEXED_FRAME_HEADER_SIZE   4
+
+/** @brief  Writes @c module_id at the start of @c frame. */
+static inline void MultiplexedFrame_SetModuleId(unsigned char* frame, uint32_t module_id)
+{
+    frame[0] = (unsigned char)(module_id >> 24);
+    frame[1] = (unsigned char)(module_id >> 16);
+    frame[2] = (unsigned char)(module_id >> 8);
+    frame[3] = (unsigned char)(module_id);
+}
+
+/** @brief  Reads the module id at the start of @c frame. */
+static inline uint32_t MultiplexedFrame_GetModuleId(const unsigned char* frame)
+{
+    return ((uint32_t)frame[0] << 24) |
+        ((uint32_t)frame[1] << 16) |
+        ((uint32_t)frame[2] << 8) |
+        (uint32_t)frame[3];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*MULTIPLEXED_FRAME_H*/
@@ -0,0 +1,162 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/** @file       shm_channel.h
+ *
+ *  @brief      Shared memory message channel between a gateway and a module
+ *              host running on the same machine.
+ *
+ *  @details    The channel is a memory mapped segment holding one single
+ *              producer, single consumer ring per direction. A sender reserves
+ *              room for a serialized message with #ShmChannel_BeginSend,
+ *              writes the message in place and publishes it with
+ *              #ShmChannel_EndSend; a receiver reads the message in place
+ *              between #ShmChannel_BeginReceive and #ShmChannel_EndReceive.
+ *              An idle receiver (or a sender waiting for room) sleeps on a
+ *              futex, so a message costs no system call while both sides
+ *              are busy. The gateway creates the segment, the module host
+ *              opens it once it receives the create message. Each side must
+ *              have a single sending thread and a single receiving thread.
+ *              The channel is only available on Linux, everywhere else
+ *              #ShmChannel_Create and #ShmChannel_Open fail.
+ */
+
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C"
+{
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#include "gateway_export.h"
+
+/** @brief  Value of MESSAGE_URI::uri_type for a shared memory message channel.
+ *          It is not a nanomsg protocol number.
+ */
+#define SHM_CHANNEL_URI_TYPE        0xF0
+
+/** @brief  Scheme of the URI of a shared memory message channel, the rest of
+ *          the URI names the segment.
+ */
+#define SHM_CHANNEL_URI_HEAD        "shm://"
+#define SHM_CHANNEL_URI_HEAD_SIZE   6
+
+/** @brief  Size in bytes of each ring of a channel created by the gateway. */
+#define SHM_CHANNEL_RING_SIZE_DEFAULT   (1 << 20)
+
+/** @brief  #ShmChannel_BeginReceive found no message before the timeout. */
+#define SHM_CHANNEL_EMPTY           (-1)
+/** @brief  The channel has been closed or is unusable. */
+#define SHM_CHANNEL_CLOSED          (-2)
+
+typedef struct SHM_CHANNEL_TAG* SHM_CHANNEL_HANDLE;
+
+/** @brief      Creates the shared memory segment named by @c uri and maps it.
+ *              This is the gateway end of the channel.
+ *
+ *  @param      uri         A URI starting with "shm://".
+ *  @param      ring_size   Size in bytes of each ring, a power of 2.
+ *
+ *  @return     A non-NULL #SHM_CHANNEL_HANDLE, or @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT SHM_CHANNEL_HANDLE, ShmChannel_Create, const char*, uri, uint32_t, ring_size);
+
+/** @brief      Maps the shared memory segment named by @c uri, which the
+ *              gateway must have created. This is the module host end of the
+ *              channel.
+ *
+ *  @param      uri         A URI starting with "shm://".
+ *
+ *  @return     A non-NULL #SHM_CHANNEL_HANDLE, or @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT SHM_CHANNEL_HANDLE, ShmChannel_Open, const char*, uri);
+
+/** @brief      Reserves room for a message of @c size bytes in the outgoing
+ *              ring, waiting up to @c timeout_ms milliseconds for the peer to
+ *              free enough room.
+ *
+ *  @param      channel     The #SHM_CHANNEL_HANDLE.
+ *  @param      size        Size in bytes of the message.
+ *  @param      timeout_ms  How long to wait for room, negative to wait until
+ *                          the channel is closed.
+ *
+ *  @return     A pointer to @c size bytes the message is written to, or
+ *              @c NULL if the ring stayed full, the message does not fit in
+ *              the ring or the channel is closed.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT unsigned char*, ShmChannel_BeginSend, SHM_CHANNEL_HANDLE, channel, int32_t, size, int, timeout_ms);
+
+/** @brief      Publishes the message reserved by the last successful call to
+ *              #ShmChannel_BeginSend and wakes the peer if it is waiting.
+ *
+ *  @param      channel     The #SHM_CHANNEL_HANDLE.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, ShmChannel_EndSend, SHM_CHANNEL_HANDLE, channel);
+
+/** @brief      Gets the oldest message of the incoming ring, waiting up to
+ *              @c timeout_ms milliseconds for one to arrive.
+ *
+ *  @param      channel     The #SHM_CHANNEL_HANDLE.
+ *  @param      buf         Receives a pointer to the message, which stays
+ *                          valid until #ShmChannel_EndReceive is called.
+ *  @param      timeout_ms  How long to wait for a message, 0 to poll,
+ *                          negative to wait until the channel is closed.
+ *
+ *  @return     The size of the message, #SHM_CHANNEL_EMPTY if no message
+ *              arrived or #SHM_CHANNEL_CLOSED.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT int32_t, ShmChannel_BeginReceive, SHM_CHANNEL_HANDLE, channel, const unsigned char**, buf, int, timeout_ms);
+
+/** @brief      Gives the room of the message returned by the last successful
+ *              call to #ShmChannel_BeginReceive back to the peer.
+ *
+ *  @param      channel     The #SHM_CHANNEL_HANDLE.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, ShmChannel_EndReceive, SHM_CHANNEL_HANDLE, channel);
+
+/** @brief      Gets a descriptor that becomes readable when the incoming ring
+ *              holds a message, so the channel can be waited on together
+ *              with other descriptors by @c poll or @c epoll.
+ *
+ *  @details    The first call starts a thread of this end that signals the
+ *              descriptor when the peer publishes into an empty ring. The
+ *              descriptor stays readable until #ShmChannel_BeginReceive
+ *              finds the ring empty, so a message costs no system call while
+ *              the receiver keeps up. Call it from the receiving thread.
+ *
+ *  @param      channel     The #SHM_CHANNEL_HANDLE.
+ *
+ *  @return     The descriptor, which stays open until #ShmChannel_Destroy,
+ *              or -1 upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT int, ShmChannel_GetPollFd, SHM_CHANNEL_HANDLE, channel);
+
+/** @brief      Closes this end of the channel: threads waiting in the channel
+ *              return and every later call fails. The segment stays mapped
+ *              until #ShmChannel_Destroy, so it is safe to call while other
+ *              threads use the channel.
+ *
+ *  @param      channel     The #SHM_CHANNEL_HANDLE.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, ShmChannel_Close, SHM_CHANNEL_HANDLE, channel);
+
+/** @brief      Unmaps the segment and frees the handle. The gateway end also
+ *              removes the segment name.
+ *
+ *  @param      channel     The #SHM_CHANNEL_HANDLE.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, ShmChannel_Destroy, SHM_CHANNEL_HANDLE, channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*SHM_CHANNEL_H*/
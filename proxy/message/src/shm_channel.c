@@ -0,0 +1,722 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "shm_channel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_SEGMENT_MAGIC       0xA16C5348 /*(A)zure (I)oT (G)ateway (C)ontrol, "SH"ared*/
+#define SHM_SEGMENT_VERSION     1
+#define SHM_RING_SIZE_MIN       64
+#define SHM_RECORD_HEADER_SIZE  4
+#define SHM_RECORD_WRAP         0xFFFFFFFF
+#define SHM_RECORD_SIZE(size)   (SHM_RECORD_HEADER_SIZE + (((uint32_t)(size) + 3) & ~(uint32_t)3))
+#define SHM_SPIN_COUNT          256
+/*a sleeper can miss the wake up of ShmChannel_Close, it never sleeps longer than this before it looks again*/
+#define SHM_WAIT_SLICE_MS       100
+
+/*head and tail only grow (modulo 2^32), the offset in the ring is the position masked by ring_size - 1*/
+typedef struct SHM_RING_TAG
+{
+    /*written by the producer*/
+    uint32_t head;
+    uint32_t head_waiters;
+    uint8_t head_padding[56];
+    /*written by the consumer*/
+    uint32_t tail;
+    uint32_t tail_waiters;
+    uint8_t tail_padding[56];
+} SHM_RING;
+
+/*the segment is this header followed by the data of both rings*/
+typedef struct SHM_SEGMENT_TAG
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint8_t padding[52];
+    /*rings[0] carries messages from the gateway to the module host, rings[1] the other way*/
+    SHM_RING rings[2];
+} SHM_SEGMENT;
+
+typedef struct SHM_CHANNEL_TAG
+{
+    SHM_SEGMENT* segment;
+    size_t segment_size;
+    /*only the gateway end keeps the name, it removes the segment when destroyed*/
+    char* name;
+    uint32_t ring_size;
+    SHM_RING* send_ring;
+    unsigned char* send_data;
+    uint32_t send_pending;
+    SHM_RING* receive_ring;
+    unsigned char* receive_data;
+    uint32_t receive_pending;
+    int closed;
+    /*the doorbell signals doorbell_fd when the incoming ring stops being empty, it only exists once ShmChannel_GetPollFd is called*/
+    int doorbell_fd;
+    uint32_t doorbell_armed;
+    uint32_t doorbell_waiters;
+    THREAD_HANDLE doorbell_thread;
+} SHM_CHANNEL;
+
+static char* segment_name_from_uri(const char* uri)
+{
+    char* result;
+    /*Codes_SRS_SHM_CHANNEL_30_002: [ If uri is NULL, does not start with "shm://", names nothing, contains another '/' or names a segment longer than NAME_MAX, ShmChannel_Create and ShmChannel_Open shall fail and return NULL. ]*/
+    if ((uri == NULL) ||
+        (strncmp(uri, SHM_CHANNEL_URI_HEAD, SHM_CHANNEL_URI_HEAD_SIZE) != 0) ||
+        (uri[SHM_CHANNEL_URI_HEAD_SIZE] == '\0') ||
+        (strchr(uri + SHM_CHANNEL_URI_HEAD_SIZE, '/') != NULL) ||
+        (strlen(uri + SHM_CHANNEL_URI_HEAD_SIZE) >= NAME_MAX))
+    {
+        LogError("invalid shared memory channel uri [%s]", (uri == NULL) ? "NULL" : uri);
+        result = NULL;
+    }
+    else
+    {
+        size_t name_length = strlen(uri + SHM_CHANNEL_URI_HEAD_SIZE);
+        result = (char*)malloc(name_length + 2);
+        if (result == NULL)
+        {
+            LogError("unable to allocate the segment name");
+        }
+        else
+        {
+            result[0] = '/';
+            (void)memcpy(result + 1, uri + SHM_CHANNEL_URI_HEAD_SIZE, name_length + 1);
+        }
+    }
+    return result;
+}
+
+static void attach_rings(SHM_CHANNEL* channel, int send_ring_index)
+{
+    unsigned char* data = (unsigned char*)channel->segment + sizeof(SHM_SEGMENT);
+    channel->send_ring = &channel->segment->rings[send_ring_index];
+    channel->send_data = data + (send_ring_index * channel->ring_size);
+    channel->receive_ring = &channel->segment->rings[1 - send_ring_index];
+    channel->receive_data = data + ((1 - send_ring_index) * channel->ring_size);
+    channel->send_pending = 0;
+    channel->receive_pending = 0;
+    channel->closed = 0;
+    channel->doorbell_fd = -1;
+    channel->doorbell_armed = 1;
+    channel->doorbell_waiters = 0;
+    channel->doorbell_thread = NULL;
+}
+
+static void make_deadline(int timeout_ms, struct timespec* deadline)
+{
+    (void)clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static void wake(uint32_t* word, uint32_t* waiters)
+{
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) != 0)
+    {
+        (void)syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*waits until *word is no longer value; returns 0, SHM_CHANNEL_EMPTY on timeout or SHM_CHANNEL_CLOSED*/
+static int wait_for_change(SHM_CHANNEL* channel, uint32_t* word, uint32_t value, uint32_t* waiters, const struct timespec* deadline)
+{
+    int result;
+    int spin = 0;
+
+    /*the peer is usually busy, spinning a little avoids a system call on each side*/
+    while ((spin < SHM_SPIN_COUNT) && (__atomic_load_n(word, __ATOMIC_ACQUIRE) == value))
+    {
+        spin++;
+    }
+
+    for (;;)
+    {
+        struct timespec now;
+        struct timespec slice;
+
+        if (__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE))
+        {
+            result = SHM_CHANNEL_CLOSED;
+            break;
+        }
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != value)
+        {
+            result = 0;
+            break;
+        }
+
+        slice.tv_sec = 0;
+        slice.tv_nsec = SHM_WAIT_SLICE_MS * 1000000L;
+        if (deadline != NULL)
+        {
+            (void)clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec > deadline->tv_sec) ||
+                ((now.tv_sec == deadline->tv_sec) && (now.tv_nsec >= deadline->tv_nsec)))
+            {
+                result = SHM_CHANNEL_EMPTY;
+                break;
+            }
+            else if ((deadline->tv_sec - now.tv_sec) < 1)
+            {
+                long remaining = (deadline->tv_sec - now.tv_sec) * 1000000000L + (deadline->tv_nsec - now.tv_nsec);
+                if (remaining < slice.tv_nsec)
+                {
+                    slice.tv_nsec = remaining;
+                }
+            }
+        }
+
+        /*the waiter count is raised before the value is checked again, the peer raises the value before it reads the count*/
+        (void)__atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == value)
+        {
+            (void)syscall(SYS_futex, word, FUTEX_WAIT, value, &slice, NULL, 0);
+        }
+        (void)__atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    return result;
+}
+
+/*rings the doorbell once the incoming ring holds a message, then waits for the receiver to find the ring empty before it watches the ring again, so a busy ring costs it nothing*/
+static int doorbell_thread(void* context)
+{
+    SHM_CHANNEL* channel = (SHM_CHANNEL*)context;
+    SHM_RING* ring = channel->receive_ring;
+    /*Codes_SRS_SHM_CHANNEL_30_030: [ The doorbell thread shall signal the descriptor once the incoming ring holds a record, then wait for ShmChannel_BeginReceive to clear the descriptor before it watches the ring again, and stop when the channel is closed. ]*/
+    for (;;)
+    {
+        uint32_t head;
+        if (__atomic_load_n(&channel->doorbell_armed, __ATOMIC_ACQUIRE) == 0)
+        {
+            if (wait_for_change(channel, &channel->doorbell_armed, 0, &channel->doorbell_waiters, NULL) != 0)
+            {
+                break;
+            }
+        }
+        else if ((head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        {
+            if (wait_for_change(channel, &ring->head, head, &ring->head_waiters, NULL) != 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            uint64_t one = 1;
+            __atomic_store_n(&channel->doorbell_armed, 0, __ATOMIC_SEQ_CST);
+            if (write(channel->doorbell_fd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+            {
+                LogError("unable to ring the doorbell of the shared memory channel, errno=[%d]", errno);
+            }
+        }
+    }
+    return 0;
+}
+
+static void rearm_doorbell(SHM_CHANNEL* channel)
+{
+    uint64_t count;
+    /*the descriptor is non blocking, it may already be clear*/
+    (void)read(channel->doorbell_fd, &count, sizeof(count));
+    __atomic_store_n(&channel->doorbell_armed, 1, __ATOMIC_SEQ_CST);
+    wake(&channel->doorbell_armed, &channel->doorbell_waiters);
+}
+
+SHM_CHANNEL_HANDLE ShmChannel_Create(const char* uri, uint32_t ring_size)
+{
+    SHM_CHANNEL* result;
+    /*Codes_SRS_SHM_CHANNEL_30_001: [ If ring_size is less than 64 or is not a power of 2, ShmChannel_Create shall fail and return NULL. ]*/
+    if ((ring_size < SHM_RING_SIZE_MIN) || ((ring_size & (ring_size - 1)) != 0))
+    {
+        LogError("ring size must be a power of 2 no less than %d, ring_size=[%u]", SHM_RING_SIZE_MIN, (unsigned int)ring_size);
+        result = NULL;
+    }
+    else if ((result = (SHM_CHANNEL*)malloc(sizeof(SHM_CHANNEL))) == NULL)
+    {
+        LogError("unable to allocate the shared memory channel");
+    }
+    else if ((result->name = segment_name_from_uri(uri)) == NULL)
+    {
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        int fd;
+        /*Codes_SRS_SHM_CHANNEL_30_003: [ ShmChannel_Create shall remove a segment left behind with the name of uri, create the segment, size it for the header and two rings of ring_size bytes, map it, write the magic number after the rest of the header and return a non-NULL handle whose send ring is the first ring. ]*/
+        /*a gateway that crashed may have left the segment behind*/
+        (void)shm_unlink(result->name);
+        fd = shm_open(result->name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+        /*Codes_SRS_SHM_CHANNEL_30_004: [ If the segment cannot be created, sized or mapped, ShmChannel_Create shall release what it created and return NULL. ]*/
+        if (fd < 0)
+        {
+            LogError("unable to create shared memory segment [%s], errno=[%d]", result->name, errno);
+            free(result->name);
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            result->ring_size = ring_size;
+            result->segment_size = sizeof(SHM_SEGMENT) + (2 * (size_t)ring_size);
+            if (ftruncate(fd, (off_t)result->segment_size) != 0)
+            {
+                LogError("unable to size shared memory segment [%s], errno=[%d]", result->name, errno);
+                (void)close(fd);
+                (void)shm_unlink(result->name);
+                free(result->name);
+                free(result);
+                result = NULL;
+            }
+            else if ((result->segment = (SHM_SEGMENT*)mmap(NULL, result->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+            {
+                LogError("unable to map shared memory segment [%s], errno=[%d]", result->name, errno);
+                (void)close(fd);
+                (void)shm_unlink(result->name);
+                free(result->name);
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                (void)close(fd);
+                /*the segment starts zeroed, the magic is written last so the module host never sees a half initialized header*/
+                result->segment->version = SHM_SEGMENT_VERSION;
+                result->segment->ring_size = ring_size;
+                __atomic_store_n(&result->segment->magic, SHM_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+                attach_rings(result, 0);
+            }
+        }
+    }
+    return result;
+}
+
+SHM_CHANNEL_HANDLE ShmChannel_Open(const char* uri)
+{
+    SHM_CHANNEL* result;
+    char* name = segment_name_from_uri(uri);
+    if (name == NULL)
+    {
+        result = NULL;
+    }
+    else
+    {
+        int fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0)
+        {
+            LogError("unable to open shared memory segment [%s], errno=[%d]", name, errno);
+            result = NULL;
+        }
+        else
+        {
+            struct stat segment_stat;
+            /*Codes_SRS_SHM_CHANNEL_30_006: [ If the segment does not exist, cannot be mapped, is smaller than its header, or its magic number, version, ring size or size are not those of a channel, ShmChannel_Open shall release what it created and return NULL. ]*/
+            if ((fstat(fd, &segment_stat) != 0) || (segment_stat.st_size < (off_t)sizeof(SHM_SEGMENT)))
+            {
+                LogError("shared memory segment [%s] is too small", name);
+                result = NULL;
+            }
+            else if ((result = (SHM_CHANNEL*)malloc(sizeof(SHM_CHANNEL))) == NULL)
+            {
+                LogError("unable to allocate the shared memory channel");
+            }
+            else
+            {
+                result->name = NULL;
+                result->segment_size = (size_t)segment_stat.st_size;
+                result->segment = (SHM_SEGMENT*)mmap(NULL, result->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (result->segment == MAP_FAILED)
+                {
+                    LogError("unable to map shared memory segment [%s], errno=[%d]", name, errno);
+                    free(result);
+                    result = NULL;
+                }
+                else
+                {
+                    result->ring_size = result->segment->ring_size;
+                    if ((__atomic_load_n(&result->segment->magic, __ATOMIC_ACQUIRE) != SHM_SEGMENT_MAGIC) ||
+                        (result->segment->version != SHM_SEGMENT_VERSION) ||
+                        (result->ring_size < SHM_RING_SIZE_MIN) ||
+                        ((result->ring_size & (result->ring_size - 1)) != 0) ||
+                        (result->segment_size != sizeof(SHM_SEGMENT) + (2 * (size_t)result->ring_size)))
+                    {
+                        LogError("shared memory segment [%s] is not a message channel", name);
+                        (void)munmap(result->segment, result->segment_size);
+                        free(result);
+                        result = NULL;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_SHM_CHANNEL_30_005: [ ShmChannel_Open shall map the segment named by uri and return a non-NULL handle whose send ring is the second ring. ]*/
+                        attach_rings(result, 1);
+                    }
+                }
+            }
+            (void)close(fd);
+        }
+        free(name);
+    }
+    return result;
+}
+
+unsigned char* ShmChannel_BeginSend(SHM_CHANNEL_HANDLE channel, int32_t size, int timeout_ms)
+{
+    unsigned char* result;
+    /*Codes_SRS_SHM_CHANNEL_30_007: [ If channel is NULL or size is negative, ShmChannel_BeginSend shall fail and return NULL. ]*/
+    if ((channel == NULL) || (size < 0))
+    {
+        LogError("invalid arguments channel=[%p], size=[%d]", channel, (int)size);
+        result = NULL;
+    }
+    /*Codes_SRS_SHM_CHANNEL_30_008: [ If the record of a message of size bytes is larger than the ring, ShmChannel_BeginSend shall fail and return NULL. ]*/
+    else if (SHM_RECORD_SIZE(size) > channel->ring_size)
+    {
+        LogError("a message of %d bytes does not fit in the ring", (int)size);
+        result = NULL;
+    }
+    /*Codes_SRS_SHM_CHANNEL_30_009: [ If the channel is closed, ShmChannel_BeginSend shall fail and return NULL. ]*/
+    else if (__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE))
+    {
+        result = NULL;
+    }
+    else
+    {
+        SHM_RING* ring = channel->send_ring;
+        uint32_t needed = SHM_RECORD_SIZE(size);
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        struct timespec deadline;
+        int wait_result = 0;
+
+        if (timeout_ms >= 0)
+        {
+            make_deadline(timeout_ms, &deadline);
+        }
+
+        for (;;)
+        {
+            uint32_t offset = head & (channel->ring_size - 1);
+            uint32_t contiguous = channel->ring_size - offset;
+            /*a record never wraps: when it does not fit before the end of the ring, the end is skipped first*/
+            uint32_t required = (contiguous < needed) ? contiguous : needed;
+            uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+            /*Codes_SRS_SHM_CHANNEL_30_011: [ If the ring has no room for the record, ShmChannel_BeginSend shall wait up to timeout_ms milliseconds, or until the channel is closed if timeout_ms is negative, for the peer to free enough room, and return NULL if it does not. ]*/
+            if (channel->ring_size - (head - tail) < required)
+            {
+                wait_result = wait_for_change(channel, &ring->tail, tail, &ring->tail_waiters, (timeout_ms >= 0) ? &deadline : NULL);
+                if (wait_result != 0)
+                {
+                    break;
+                }
+            }
+            else if (contiguous < needed)
+            {
+                /*Codes_SRS_SHM_CHANNEL_30_010: [ If the record does not fit before the end of the ring, ShmChannel_BeginSend shall write a WRAP record over the rest of the ring, publish it and reserve the record at the start of the ring. ]*/
+                *(uint32_t*)(channel->send_data + offset) = SHM_RECORD_WRAP;
+                head += contiguous;
+                __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+            }
+            else
+            {
+                /*Codes_SRS_SHM_CHANNEL_30_012: [ ShmChannel_BeginSend shall write size in the length of the record and return a pointer to the size bytes that follow it. ]*/
+                *(uint32_t*)(channel->send_data + offset) = (uint32_t)size;
+                channel->send_pending = needed;
+                break;
+            }
+        }
+
+        if (wait_result != 0)
+        {
+            result = NULL;
+        }
+        else
+        {
+            result = channel->send_data + (head & (channel->ring_size - 1)) + SHM_RECORD_HEADER_SIZE;
+        }
+    }
+    return result;
+}
+
+void ShmChannel_EndSend(SHM_CHANNEL_HANDLE channel)
+{
+    /*Codes_SRS_SHM_CHANNEL_30_013: [ If channel is NULL, ShmChannel_EndSend shall do nothing. ]*/
+    if (channel == NULL)
+    {
+        LogError("channel is NULL");
+    }
+    else
+    {
+        /*Codes_SRS_SHM_CHANNEL_30_014: [ ShmChannel_EndSend shall publish the record reserved by ShmChannel_BeginSend and wake the peer if it waits for a message. ]*/
+        SHM_RING* ring = channel->send_ring;
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) + channel->send_pending;
+        channel->send_pending = 0;
+        __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+        wake(&ring->head, &ring->head_waiters);
+    }
+}
+
+int32_t ShmChannel_BeginReceive(SHM_CHANNEL_HANDLE channel, const unsigned char** buf, int timeout_ms)
+{
+    int32_t result;
+    /*Codes_SRS_SHM_CHANNEL_30_015: [ If channel or buf is NULL, or the channel is closed, ShmChannel_BeginReceive shall return SHM_CHANNEL_CLOSED. ]*/
+    if ((channel == NULL) || (buf == NULL))
+    {
+        LogError("invalid arguments channel=[%p], buf=[%p]", channel, buf);
+        result = SHM_CHANNEL_CLOSED;
+    }
+    else if (__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE))
+    {
+        result = SHM_CHANNEL_CLOSED;
+    }
+    else
+    {
+        SHM_RING* ring = channel->receive_ring;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        struct timespec deadline;
+
+        if (timeout_ms > 0)
+        {
+            make_deadline(timeout_ms, &deadline);
+        }
+
+        for (;;)
+        {
+            uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            /*Codes_SRS_SHM_CHANNEL_30_016: [ If the ring holds no record, ShmChannel_BeginReceive shall return SHM_CHANNEL_EMPTY if timeout_ms is 0, otherwise wait up to timeout_ms milliseconds, or until the channel is closed if timeout_ms is negative, for the peer to publish one, and return SHM_CHANNEL_EMPTY if it does not or SHM_CHANNEL_CLOSED if the channel is closed. ]*/
+            if (head == tail)
+            {
+                /*Codes_SRS_SHM_CHANNEL_30_031: [ If the ring holds no record and the doorbell was rung, ShmChannel_BeginReceive shall clear the descriptor, let the doorbell thread watch the ring again and look at the ring once more. ]*/
+                if ((channel->doorbell_fd >= 0) && (__atomic_load_n(&channel->doorbell_armed, __ATOMIC_ACQUIRE) == 0))
+                {
+                    /*a message published before the descriptor was cleared is found by looking again*/
+                    rearm_doorbell(channel);
+                }
+                else if (timeout_ms == 0)
+                {
+                    result = SHM_CHANNEL_EMPTY;
+                    break;
+                }
+                else if ((result = wait_for_change(channel, &ring->head, tail, &ring->head_waiters, (timeout_ms > 0) ? &deadline : NULL)) != 0)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                uint32_t offset = tail & (channel->ring_size - 1);
+                uint32_t size = *(const uint32_t*)(channel->receive_data + offset);
+                /*Codes_SRS_SHM_CHANNEL_30_017: [ ShmChannel_BeginReceive shall skip a WRAP record and give its room back to the peer. ]*/
+                if (size == SHM_RECORD_WRAP)
+                {
+                    tail += channel->ring_size - offset;
+                    __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+                    wake(&ring->tail, &ring->tail_waiters);
+                }
+                /*Codes_SRS_SHM_CHANNEL_30_018: [ If the length of a record is larger than INT32_MAX, or the record runs past the end of the ring or past what the peer published, ShmChannel_BeginReceive shall return SHM_CHANNEL_CLOSED. ]*/
+                else if ((size > INT32_MAX) || (SHM_RECORD_SIZE(size) > channel->ring_size - offset) || (SHM_RECORD_SIZE(size) > head - tail))
+                {
+                    LogError("corrupted record in the shared memory ring");
+                    result = SHM_CHANNEL_CLOSED;
+                    break;
+                }
+                else
+                {
+                    /*Codes_SRS_SHM_CHANNEL_30_019: [ ShmChannel_BeginReceive shall set *buf to the message of the oldest record and return its size. ]*/
+                    *buf = channel->receive_data + offset + SHM_RECORD_HEADER_SIZE;
+                    channel->receive_pending = SHM_RECORD_SIZE(size);
+                    result = (int32_t)size;
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void ShmChannel_EndReceive(SHM_CHANNEL_HANDLE channel)
+{
+    /*Codes_SRS_SHM_CHANNEL_30_020: [ If channel is NULL, ShmChannel_EndReceive shall do nothing. ]*/
+    if (channel == NULL)
+    {
+        LogError("channel is NULL");
+    }
+    else
+    {
+        /*Codes_SRS_SHM_CHANNEL_30_021: [ ShmChannel_EndReceive shall give the room of the record returned by ShmChannel_BeginReceive back to the peer and wake the peer if it waits for room. ]*/
+        SHM_RING* ring = channel->receive_ring;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) + channel->receive_pending;
+        channel->receive_pending = 0;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+        wake(&ring->tail, &ring->tail_waiters);
+    }
+}
+
+int ShmChannel_GetPollFd(SHM_CHANNEL_HANDLE channel)
+{
+    int result;
+    /*Codes_SRS_SHM_CHANNEL_30_027: [ If channel is NULL, ShmChannel_GetPollFd shall fail and return -1. ]*/
+    if (channel == NULL)
+    {
+        LogError("channel is NULL");
+        result = -1;
+    }
+    /*Codes_SRS_SHM_CHANNEL_30_028: [ ShmChannel_GetPollFd shall return the same descriptor on every call. ]*/
+    else if (channel->doorbell_fd >= 0)
+    {
+        result = channel->doorbell_fd;
+    }
+    /*Codes_SRS_SHM_CHANNEL_30_029: [ The first time, ShmChannel_GetPollFd shall create a non blocking event descriptor and start the doorbell thread of this end; if either fails, it shall release what it created and return -1. ]*/
+    else if ((channel->doorbell_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+    {
+        LogError("unable to create the doorbell of the shared memory channel, errno=[%d]", errno);
+        result = -1;
+    }
+    else if (ThreadAPI_Create(&channel->doorbell_thread, doorbell_thread, channel) != THREADAPI_OK)
+    {
+        LogError("unable to start the doorbell thread of the shared memory channel");
+        (void)close(channel->doorbell_fd);
+        channel->doorbell_fd = -1;
+        channel->doorbell_thread = NULL;
+        result = -1;
+    }
+    else
+    {
+        result = channel->doorbell_fd;
+    }
+    return result;
+}
+
+void ShmChannel_Close(SHM_CHANNEL_HANDLE channel)
+{
+    /*Codes_SRS_SHM_CHANNEL_30_022: [ If channel is NULL, ShmChannel_Close shall do nothing. ]*/
+    if (channel == NULL)
+    {
+        LogError("channel is NULL");
+    }
+    else
+    {
+        /*Codes_SRS_SHM_CHANNEL_30_023: [ ShmChannel_Close shall mark the channel closed and wake the threads of this end waiting in ShmChannel_BeginSend or ShmChannel_BeginReceive, and the doorbell thread. ]*/
+        __atomic_store_n(&channel->closed, 1, __ATOMIC_SEQ_CST);
+        /*this also wakes the peer, which only finds its ring unchanged and goes back to sleep*/
+        (void)syscall(SYS_futex, &channel->receive_ring->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        (void)syscall(SYS_futex, &channel->send_ring->tail, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        (void)syscall(SYS_futex, &channel->doorbell_armed, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+void ShmChannel_Destroy(SHM_CHANNEL_HANDLE channel)
+{
+    /*Codes_SRS_SHM_CHANNEL_30_024: [ If channel is NULL, ShmChannel_Destroy shall do nothing. ]*/
+    if (channel == NULL)
+    {
+        LogError("channel is NULL");
+    }
+    else
+    {
+        /*Codes_SRS_SHM_CHANNEL_30_032: [ ShmChannel_Destroy shall stop the doorbell thread, if any, and close its descriptor. ]*/
+        if (channel->doorbell_thread != NULL)
+        {
+            int thread_result;
+            ShmChannel_Close(channel);
+            (void)ThreadAPI_Join(channel->doorbell_thread, &thread_result);
+            (void)close(channel->doorbell_fd);
+        }
+        /*Codes_SRS_SHM_CHANNEL_30_025: [ ShmChannel_Destroy shall unmap the segment and free the handle, and the gateway end shall also remove the name of the segment. ]*/
+        (void)munmap(channel->segment, channel->segment_size);
+        if (channel->name != NULL)
+        {
+            (void)shm_unlink(channel->name);
+            free(channel->name);
+        }
+        free(channel);
+    }
+}
+
+#else /*__linux__*/
+
+/*Codes_SRS_SHM_CHANNEL_30_026: [ On platforms other than Linux, ShmChannel_Create, ShmChannel_Open and ShmChannel_BeginSend shall return NULL, ShmChannel_BeginReceive shall return SHM_CHANNEL_CLOSED, ShmChannel_GetPollFd shall return -1 and the other functions shall do nothing. ]*/
+SHM_CHANNEL_HANDLE ShmChannel_Create(const char* uri, uint32_t ring_size)
+{
+    (void)uri;
+    (void)ring_size;
+    LogError("shared memory message channels are not supported on this platform");
+    return NULL;
+}
+
+SHM_CHANNEL_HANDLE ShmChannel_Open(const char* uri)
+{
+    (void)uri;
+    LogError("shared memory message channels are not supported on this platform");
+    return NULL;
+}
+
+unsigned char* ShmChannel_BeginSend(SHM_CHANNEL_HANDLE channel, int32_t size, int timeout_ms)
+{
+    (void)channel;
+    (void)size;
+    (void)timeout_ms;
+    return NULL;
+}
+
+void ShmChannel_EndSend(SHM_CHANNEL_HANDLE channel)
+{
+    (void)channel;
+}
+
+int32_t ShmChannel_BeginReceive(SHM_CHANNEL_HANDLE channel, const unsigned char** buf, int timeout_ms)
+{
+    (void)channel;
+    (void)buf;
+    (void)timeout_ms;
+    return SHM_CHANNEL_CLOSED;
+}
+
+void ShmChannel_EndReceive(SHM_CHANNEL_HANDLE channel)
+{
+    (void)channel;
+}
+
+int ShmChannel_GetPollFd(SHM_CHANNEL_HANDLE channel)
+{
+    (void)channel;
+    return -1;
+}
+
+void ShmChannel_Close(SHM_CHANNEL_HANDLE channel)
+{
+    (void)channel;
+}
+
+void ShmChannel_Destroy(SHM_CHANNEL_HANDLE channel)
+{
+    (void)channel;
+}
+
+#endif /*__linux__*/
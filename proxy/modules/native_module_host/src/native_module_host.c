@@ -28,6 +28,9 @@ typedef struct MODULE_HOST_TAG
     BROKER_HANDLE module_host_broker;
 } MODULE_HOST;
 
+/*a multiplexed module host process creates many module hosts, which share the module loader*/
+static size_t g_module_host_count = 0;
+
 static void* NativeModuleHost_ParseConfigurationFromJson(const char* configuration)
 {
     char* config_str;
@@ -192,8 +195,8 @@ static MODULE_HANDLE NativeModuleHost_Create(BROKER_HANDLE broker, const void* c
     }
     else
     {
-        /*Codes_SRS_NATIVEMODULEHOST_17_010: [ NativeModuleHost_Create shall intialize the Module_Loader. ]*/
-        if (ModuleLoader_Initialize() != MODULE_LOADER_SUCCESS)
+        /*Codes_SRS_NATIVEMODULEHOST_17_010: [ NativeModuleHost_Create shall intialize the Module_Loader, unless another module host already did. ]*/
+        if ((g_module_host_count == 0) && (ModuleLoader_Initialize() != MODULE_LOADER_SUCCESS))
         {
             /*Codes_SRS_NATIVEMODULEHOST_17_026: [ If any step above fails, then NativeModuleHost_Create shall free all resources allocated and return NULL. ]*/
             LogError("ModuleLoader_Initialize failed");
@@ -278,7 +281,14 @@ static MODULE_HANDLE NativeModuleHost_Create(BROKER_HANDLE broker, const void* c
             {
                 // failed to create a module, give up entirely.
                 /*Codes_SRS_NATIVEMODULEHOST_17_026: [ If any step above fails, then NativeModuleHost_Create shall free all resources allocated and return NULL. ]*/
-                ModuleLoader_Destroy();
+                if (g_module_host_count == 0)
+                {
+                    ModuleLoader_Destroy();
+                }
+            }
+            else
+            {
+                g_module_host_count++;
             }
         }
     }
@@ -290,6 +300,10 @@ static void NativeModuleHost_Destroy(MODULE_HANDLE moduleHandle)
     if (moduleHandle != NULL)
     {
         MODULE_HOST* module_host = (MODULE_HOST*)moduleHandle;
+        if (g_module_host_count > 0)
+        {
+            g_module_host_count--;
+        }
         if (module_host->module != NULL)
         {
             MODULE module;
@@ -320,8 +334,11 @@ static void NativeModuleHost_Destroy(MODULE_HANDLE moduleHandle)
             free(module_host);
         }
     }
-    /*Codes_SRS_NATIVEMODULEHOST_17_027: [ NativeModuleHost_Destroy shall always destroy the module loader. ]*/
-    ModuleLoader_Destroy();
+    /*Codes_SRS_NATIVEMODULEHOST_17_027: [ NativeModuleHost_Destroy shall destroy the module loader once no other module host uses it. ]*/
+    if (g_module_host_count == 0)
+    {
+        ModuleLoader_Destroy();
+    }
 }
 
 static void NativeModuleHost_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
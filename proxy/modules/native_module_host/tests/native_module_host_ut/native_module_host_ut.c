@@ -1115,6 +1115,35 @@ TEST_FUNCTION(NativeModuleHost_Destroy_success)
 	///ablution
 }
 
+/*Tests_SRS_NATIVEMODULEHOST_17_027: [ NativeModuleHost_Destroy shall destroy the module loader once no other module host uses it. ]*/
+TEST_FUNCTION(NativeModuleHost_Destroy_keeps_loader_for_other_module_hosts)
+{
+	///arrange
+	const MODULE_API* apis = Module_GetApi(MODULE_API_VERSION_1);
+
+	MODULE_HANDLE m1 = create_a_module(apis);
+	MODULE_HANDLE m2 = create_a_module(apis);
+
+	STRICT_EXPECTED_CALL(mock_ModuleLoader_GetApi(&dummyModuleLoader, IGNORED_PTR_ARG))
+		.IgnoreArgument(2).SetReturn((const MODULE_API*)&dummyAPIs);
+	STRICT_EXPECTED_CALL(mock_Module_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mock_ModuleLoader_Unload(&dummyModuleLoader, IGNORED_PTR_ARG))
+		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+
+	///act
+	MODULE_DESTROY(apis)(m1);
+
+	///assert
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	///ablution
+	umock_c_reset_all_calls();
+	EXPECTED_CALL(mock_ModuleLoader_GetApi(&dummyModuleLoader, IGNORED_PTR_ARG))
+		.IgnoreArgument(2).SetReturn((const MODULE_API*)&dummyAPIs);
+	MODULE_DESTROY(apis)(m2);
+}
+
 /*Tests_SRS_NATIVEMODULEHOST_17_029: [ NativeModuleHost_Receive shall do nothing if moduleHandle is NULL. ]*/
 TEST_FUNCTION(NativeModuleHost_Receive_does_nothing_with_nothing)
 {
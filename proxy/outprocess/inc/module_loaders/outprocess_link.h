@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/** @file       outprocess_link.h
+ *  @brief      Multiplexed links between the gateway and module host processes.
+ *
+ *  @details    Outprocess modules configured as multiplexed do not own any
+ *              socket. Every multiplexed module naming the same
+ *              control URI attaches to one link, which owns a single control
+ *              socket and a single message socket to the module host, and
+ *              tags every frame with the id of the module it belongs to (see
+ *              multiplexed_frame.h). All the links of the process are serviced
+ *              by one I/O thread that waits on the sockets with epoll: it sends
+ *              the queued frames and hands the received frames to the module
+ *              they are tagged with. The thread starts with the first link and
+ *              stops with the last one. The gateway messages of a module are
+ *              queued for a delivery thread of its own, so a module that is
+ *              slow to take them only holds up itself; once
+ *              #OUTPROCESS_LINK_INBOUND_CAPACITY messages wait, the new ones
+ *              are dropped. Links are only available on Linux, everywhere
+ *              else #OutprocessLink_Attach fails.
+ */
+#ifndef OUTPROCESS_LINK_H
+#define OUTPROCESS_LINK_H
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#include "message.h"
+#include "control_message.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C"
+{
+#else
+#include <stdint.h>
+#endif
+
+/** @brief  The number of gateway messages that can wait for a module before
+ *          the new ones are dropped.
+ */
+#define OUTPROCESS_LINK_INBOUND_CAPACITY    1024
+
+typedef struct OUTPROCESS_LINK_ENDPOINT_TAG* OUTPROCESS_LINK_ENDPOINT_HANDLE;
+
+/** @brief  Called on the delivery thread of the module with a gateway message
+ *          the module host sent to it, in the order they were received. The
+ *          message is destroyed once it returns.
+ */
+typedef void(*OUTPROCESS_LINK_ON_MESSAGE)(void* context, MESSAGE_HANDLE message);
+
+/** @brief  Called on the I/O thread with a control message the module host
+ *          sent to the module. The message is destroyed once it returns.
+ */
+typedef void(*OUTPROCESS_LINK_ON_CONTROL)(void* context, CONTROL_MESSAGE* message);
+
+/** @brief      Attaches a module to the link of @c control_uri, creating and
+ *              connecting the link if this is its first module.
+ *
+ *  @param      control_uri The URI of the module host control channel.
+ *  @param      message_uri The URI of the module host message channel, which
+ *                          must be the same for every module of the link.
+ *  @param      on_message  Receives the gateway messages for the module.
+ *  @param      on_control  Receives the control messages for the module.
+ *  @param      context     Passed to @c on_message and @c on_control.
+ *
+ *  @return     A non-NULL #OUTPROCESS_LINK_ENDPOINT_HANDLE, or @c NULL upon
+ *              failure.
+ */
+MOCKABLE_FUNCTION(, OUTPROCESS_LINK_ENDPOINT_HANDLE, OutprocessLink_Attach, const char*, control_uri, const char*, message_uri, OUTPROCESS_LINK_ON_MESSAGE, on_message, OUTPROCESS_LINK_ON_CONTROL, on_control, void*, context);
+
+/** @brief      Detaches a module from its link. No callback runs for the module
+ *              once this function returns, and the gateway messages still
+ *              waiting for it are dropped, so it must not be called from the
+ *              callbacks of the module. When the last module detaches, the
+ *              frames still queued on the link are sent if the module host
+ *              can take them without waiting, then the link is closed.
+ *
+ *  @param      endpoint    The #OUTPROCESS_LINK_ENDPOINT_HANDLE.
+ */
+MOCKABLE_FUNCTION(, void, OutprocessLink_Detach, OUTPROCESS_LINK_ENDPOINT_HANDLE, endpoint);
+
+/** @brief      Serializes @c message and queues it for the module host on the
+ *              message channel of the link. The function does not wait for the
+ *              message to be sent.
+ *
+ *  @param      endpoint    The #OUTPROCESS_LINK_ENDPOINT_HANDLE.
+ *  @param      message     The gateway message.
+ *
+ *  @return     0 if the message is queued, non-zero otherwise.
+ */
+MOCKABLE_FUNCTION(, int, OutprocessLink_SendMessage, OUTPROCESS_LINK_ENDPOINT_HANDLE, endpoint, MESSAGE_HANDLE, message);
+
+/** @brief      Serializes @c message and queues it for the module host on the
+ *              control channel of the link. The function does not wait for the
+ *              message to be sent.
+ *
+ *  @param      endpoint    The #OUTPROCESS_LINK_ENDPOINT_HANDLE.
+ *  @param      message     The control message.
+ *
+ *  @return     0 if the message is queued, non-zero otherwise.
+ */
+MOCKABLE_FUNCTION(, int, OutprocessLink_SendControl, OUTPROCESS_LINK_ENDPOINT_HANDLE, endpoint, CONTROL_MESSAGE*, message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*OUTPROCESS_LINK_H*/
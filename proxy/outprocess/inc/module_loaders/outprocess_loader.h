@@ -16,6 +16,7 @@
 
 #include "module.h"
 #include "module_loader.h"
+#include "module_loaders/outprocess_module.h"
 #include "gateway_export.h"
 
 #ifdef __cplusplus
@@ -47,6 +48,14 @@ typedef struct OUTPROCESS_LOADER_ENTRYPOINT_TAG
     STRING_HANDLE message_id;
 	/** @brief controls timeout for ipc retries. */
 	unsigned int remote_message_wait;
+	/** @brief The transport of the gateway message channel. */
+	OUTPROCESS_MESSAGE_CHANNEL message_channel;
+	/** @brief Share one connection to the module host with the other multiplexed modules of the same control.id. */
+	bool multiplexed;
+	/** @brief The most gateway messages sent in one frame of the message channel, 0 to send each message in its own frame. */
+	unsigned int max_batch_size;
+	/** @brief How long, in microseconds, a frame waits for more messages before it is sent with less than max_batch_size of them. */
+	unsigned int max_batch_linger;
 } OUTPROCESS_LOADER_ENTRYPOINT;
 
 /** @brief      The API for the out of process proxy module loader. */
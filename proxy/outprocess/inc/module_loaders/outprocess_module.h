@@ -13,8 +13,11 @@
 #include "azure_c_shared_utility/macro_utils.h"
 
 #ifdef __cplusplus
+#include <cstdbool>
 extern "C"
 {
+#else
+#include <stdbool.h>
 #endif
 
 #define OUTPROCESS_MODULE_LIFECYCLE_VALUES \
@@ -23,6 +26,17 @@ extern "C"
 
 DEFINE_ENUM(OUTPROCESS_MODULE_LIFECYCLE, OUTPROCESS_MODULE_LIFECYCLE_VALUES);
 
+#define OUTPROCESS_MESSAGE_CHANNEL_VALUES \
+	OUTPROCESS_MESSAGE_CHANNEL_IPC, \
+	OUTPROCESS_MESSAGE_CHANNEL_SHM
+
+/**
+ * @brief Enumeration listing the transports of the gateway message channel:
+ * a nanomsg pair socket, or a shared memory ring for a module host running
+ * on the same machine.
+ */
+DEFINE_ENUM(OUTPROCESS_MESSAGE_CHANNEL, OUTPROCESS_MESSAGE_CHANNEL_VALUES);
+
 /** @brief Structure to configure an out of process proxy module */
 typedef struct OUTPROCESS_MODULE_CONFIG_DATA
 {
@@ -35,6 +49,14 @@ typedef struct OUTPROCESS_MODULE_CONFIG_DATA
     STRING_HANDLE outprocess_module_args;
 	/** @brief controls timeout for ipc retries. */
 	unsigned int remote_message_wait;
+	/** @brief The transport of the gateway message channel. */
+	OUTPROCESS_MESSAGE_CHANNEL message_channel;
+	/** @brief Share the connection to the module host with the other multiplexed modules of the same control URI. */
+	bool multiplexed;
+	/** @brief The most gateway messages sent in one frame of the message channel, 0 to send each message in its own frame. */
+	unsigned int max_batch_size;
+	/** @brief How long, in microseconds, a frame waits for more messages before it is sent with less than max_batch_size of them. */
+	unsigned int max_batch_linger;
 } OUTPROCESS_MODULE_CONFIG;
 
 /** @brief the API fr this module */
@@ -0,0 +1,972 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "module_loaders/outprocess_link.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <nanomsg/nn.h>
+#include <nanomsg/pair.h>
+
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "multiplexed_frame.h"
+
+#define LINK_EVENTS_MAX         32
+/*frames received from one socket before the other sockets get their turn*/
+#define LINK_RECEIVE_BATCH      64
+/*how long the I/O thread waits before it tries again to send to a module host that did not take a frame*/
+#define LINK_SEND_RETRY_MS      10
+
+typedef struct LINK_FRAME_TAG
+{
+    struct LINK_FRAME_TAG* next;
+    void* buffer;
+} LINK_FRAME;
+
+/*a gateway message waiting for the delivery thread of its module*/
+typedef struct LINK_INBOUND_TAG
+{
+    struct LINK_INBOUND_TAG* next;
+    MESSAGE_HANDLE message;
+} LINK_INBOUND;
+
+struct OUTPROCESS_LINK_TAG;
+
+typedef struct LINK_SOCKET_TAG
+{
+    struct OUTPROCESS_LINK_TAG* link;
+    int socket;
+    int is_control;
+    /*frames waiting to be sent, guarded by the outgoing lock of the link*/
+    LINK_FRAME* outgoing_first;
+    LINK_FRAME* outgoing_last;
+} LINK_SOCKET;
+
+typedef struct OUTPROCESS_LINK_TAG
+{
+    struct OUTPROCESS_LINK_TAG* next;
+    struct LINK_REACTOR_TAG* reactor;
+    char* control_uri;
+    char* message_uri;
+    LINK_SOCKET control;
+    LINK_SOCKET message;
+    LOCK_HANDLE outgoing_lock;
+    struct OUTPROCESS_LINK_ENDPOINT_TAG* endpoints;
+    uint32_t next_module_id;
+} OUTPROCESS_LINK;
+
+typedef struct OUTPROCESS_LINK_ENDPOINT_TAG
+{
+    struct OUTPROCESS_LINK_ENDPOINT_TAG* next;
+    OUTPROCESS_LINK* link;
+    uint32_t module_id;
+    OUTPROCESS_LINK_ON_MESSAGE on_message;
+    OUTPROCESS_LINK_ON_CONTROL on_control;
+    void* context;
+    /*the gateway messages received for the module wait here for its delivery
+    thread, so a module that is slow to take them does not hold up the I/O
+    thread and the other modules; guarded by inbound_lock*/
+    LOCK_HANDLE inbound_lock;
+    COND_HANDLE inbound_cond;
+    LINK_INBOUND* inbound_first;
+    LINK_INBOUND* inbound_last;
+    size_t inbound_count;
+    size_t inbound_dropped;
+    int stop;
+    THREAD_HANDLE delivery_thread;
+} OUTPROCESS_LINK_ENDPOINT;
+
+typedef struct LINK_REACTOR_TAG
+{
+    int epoll_fd;
+    int wake_fd;
+    int stop;
+    THREAD_HANDLE thread;
+    OUTPROCESS_LINK* links;
+} LINK_REACTOR;
+
+/*the links, their endpoints and the reactor only change while g_links_lock is held, and the I/O thread holds it while it services the links*/
+static pthread_mutex_t g_links_lock = PTHREAD_MUTEX_INITIALIZER;
+static LINK_REACTOR* g_reactor = NULL;
+
+static void wake_reactor(LINK_REACTOR* reactor)
+{
+    uint64_t one = 1;
+    if (write(reactor->wake_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+    {
+        LogError("unable to wake the link I/O thread, errno = %d", errno);
+    }
+}
+
+static OUTPROCESS_LINK_ENDPOINT* find_endpoint(OUTPROCESS_LINK* link, uint32_t module_id)
+{
+    OUTPROCESS_LINK_ENDPOINT* endpoint = link->endpoints;
+    while (endpoint != NULL && endpoint->module_id != module_id)
+    {
+        endpoint = endpoint->next;
+    }
+    return endpoint;
+}
+
+/*called on the I/O thread, takes message over*/
+static void queue_inbound(OUTPROCESS_LINK_ENDPOINT* endpoint, MESSAGE_HANDLE message)
+{
+    LINK_INBOUND* inbound = (LINK_INBOUND*)malloc(sizeof(LINK_INBOUND));
+    if (inbound == NULL)
+    {
+        LogError("unable to allocate a queue entry for module %u", (unsigned int)endpoint->module_id);
+        Message_Destroy(message);
+    }
+    else if (Lock(endpoint->inbound_lock) != LOCK_OK)
+    {
+        LogError("unable to lock the queue of module %u", (unsigned int)endpoint->module_id);
+        Message_Destroy(message);
+        free(inbound);
+    }
+    else
+    {
+        /*Codes_SRS_OUTPROCESS_LINK_30_022: [ If OUTPROCESS_LINK_INBOUND_CAPACITY gateway messages wait for the module, the I/O thread shall destroy the message and count it as dropped. ]*/
+        if (endpoint->inbound_count >= OUTPROCESS_LINK_INBOUND_CAPACITY)
+        {
+            /*the delivery thread logs how many were dropped once it catches up*/
+            if (endpoint->inbound_dropped++ == 0)
+            {
+                LogError("the queue of module %u is full, dropping its messages", (unsigned int)endpoint->module_id);
+            }
+            Message_Destroy(message);
+            free(inbound);
+        }
+        else
+        {
+            /*Codes_SRS_OUTPROCESS_LINK_30_021: [ The I/O thread shall queue a gateway message received for a module for the delivery thread of the module. ]*/
+            inbound->next = NULL;
+            inbound->message = message;
+            if (endpoint->inbound_first == NULL)
+            {
+                endpoint->inbound_first = inbound;
+            }
+            else
+            {
+                endpoint->inbound_last->next = inbound;
+            }
+            endpoint->inbound_last = inbound;
+            endpoint->inbound_count++;
+            (void)Condition_Post(endpoint->inbound_cond);
+        }
+        (void)Unlock(endpoint->inbound_lock);
+    }
+}
+
+static int endpoint_delivery_thread(void* param)
+{
+    OUTPROCESS_LINK_ENDPOINT* endpoint = (OUTPROCESS_LINK_ENDPOINT*)param;
+    int should_continue = 1;
+
+    while (should_continue)
+    {
+        LINK_INBOUND* inbound = NULL;
+        size_t dropped = 0;
+
+        if (Lock(endpoint->inbound_lock) != LOCK_OK)
+        {
+            LogError("unable to lock the queue of module %u", (unsigned int)endpoint->module_id);
+            should_continue = 0;
+        }
+        else
+        {
+            while (endpoint->inbound_first == NULL && endpoint->stop == 0)
+            {
+                (void)Condition_Wait(endpoint->inbound_cond, endpoint->inbound_lock, 0);
+            }
+
+            if (endpoint->stop != 0)
+            {
+                should_continue = 0;
+            }
+            else
+            {
+                inbound = endpoint->inbound_first;
+                endpoint->inbound_first = inbound->next;
+                if (endpoint->inbound_first == NULL)
+                {
+                    endpoint->inbound_last = NULL;
+                }
+                endpoint->inbound_count--;
+                /*Codes_SRS_OUTPROCESS_LINK_30_024: [ The delivery thread shall log how many messages were dropped since it took the previous one. ]*/
+                dropped = endpoint->inbound_dropped;
+                endpoint->inbound_dropped = 0;
+            }
+            (void)Unlock(endpoint->inbound_lock);
+        }
+
+        if (dropped != 0)
+        {
+            LogError("%lu messages for module %u were dropped while its queue was full", (unsigned long)dropped, (unsigned int)endpoint->module_id);
+        }
+        if (inbound != NULL)
+        {
+            /*Codes_SRS_OUTPROCESS_LINK_30_023: [ The delivery thread shall call on_message with the gateway messages of the module in the order they were received and destroy each message once on_message returns. ]*/
+            endpoint->on_message(endpoint->context, inbound->message);
+            Message_Destroy(inbound->message);
+            free(inbound);
+        }
+    }
+    return 0;
+}
+
+static void dispatch_frame(LINK_SOCKET* link_socket, const unsigned char* frame, int size)
+{
+    OUTPROCESS_LINK_ENDPOINT* endpoint;
+    /*Codes_SRS_OUTPROCESS_LINK_30_019: [ The I/O thread shall drop a received frame shorter than a module id, a frame for a module that is not attached and a frame whose message cannot be parsed. ]*/
+    if (size < MULTIPLEXED_FRAME_HEADER_SIZE)
+    {
+        LogError("dropping a frame too short to hold a module id");
+    }
+    /*frames for a module that already detached are dropped*/
+    else if ((endpoint = find_endpoint(link_socket->link, MultiplexedFrame_GetModuleId(frame))) != NULL)
+    {
+        const unsigned char* payload = frame + MULTIPLEXED_FRAME_HEADER_SIZE;
+        size_t payload_size = (size_t)(size - MULTIPLEXED_FRAME_HEADER_SIZE);
+        if (link_socket->is_control)
+        {
+            CONTROL_MESSAGE* message = ControlMessage_CreateFromByteArray(payload, payload_size);
+            if (message == NULL)
+            {
+                LogError("unable to parse a control message for module %u", (unsigned int)endpoint->module_id);
+            }
+            else
+            {
+                /*Codes_SRS_OUTPROCESS_LINK_30_020: [ The I/O thread shall call on_control of the module with a control message received for it and destroy the message once on_control returns. ]*/
+                endpoint->on_control(endpoint->context, message);
+                ControlMessage_Destroy(message);
+            }
+        }
+        else
+        {
+            MESSAGE_HANDLE message = Message_CreateFromByteArray(payload, (int32_t)payload_size);
+            if (message == NULL)
+            {
+                LogError("unable to parse a gateway message for module %u", (unsigned int)endpoint->module_id);
+            }
+            else
+            {
+                queue_inbound(endpoint, message);
+            }
+        }
+    }
+}
+
+static void receive_frames(LINK_SOCKET* link_socket)
+{
+    int count;
+    for (count = 0; count < LINK_RECEIVE_BATCH; count++)
+    {
+        unsigned char* frame = NULL;
+        int nbytes = nn_recv(link_socket->socket, (void*)&frame, NN_MSG, NN_DONTWAIT);
+        if (nbytes < 0)
+        {
+            if (nn_errno() != EAGAIN)
+            {
+                LogError("unable to receive from the module host, errno = %d", nn_errno());
+            }
+            break;
+        }
+        else
+        {
+            dispatch_frame(link_socket, frame, nbytes);
+            nn_freemsg(frame);
+        }
+    }
+}
+
+/*returns non-zero if the module host did not take every frame*/
+static int send_frames(LINK_SOCKET* link_socket)
+{
+    int result;
+    LINK_FRAME* frame;
+
+    if (Lock(link_socket->link->outgoing_lock) != LOCK_OK)
+    {
+        LogError("unable to lock the outgoing frames");
+        result = 1;
+    }
+    else
+    {
+        frame = link_socket->outgoing_first;
+        link_socket->outgoing_first = NULL;
+        link_socket->outgoing_last = NULL;
+        (void)Unlock(link_socket->link->outgoing_lock);
+
+        while (frame != NULL)
+        {
+            LINK_FRAME* next = frame->next;
+            if (nn_send(link_socket->socket, &frame->buffer, NN_MSG, NN_DONTWAIT) < 0)
+            {
+                if (nn_errno() == EAGAIN)
+                {
+                    break;
+                }
+                LogError("unable to send a frame to the module host, errno = %d", nn_errno());
+                nn_freemsg(frame->buffer);
+            }
+            free(frame);
+            frame = next;
+        }
+
+        if (frame == NULL)
+        {
+            result = 0;
+        }
+        else
+        {
+            /*put the frames back in front of the ones queued in the meantime*/
+            LINK_FRAME* last = frame;
+            while (last->next != NULL)
+            {
+                last = last->next;
+            }
+            if (Lock(link_socket->link->outgoing_lock) != LOCK_OK)
+            {
+                LogError("unable to lock the outgoing frames, dropping them");
+                while (frame != NULL)
+                {
+                    LINK_FRAME* next = frame->next;
+                    nn_freemsg(frame->buffer);
+                    free(frame);
+                    frame = next;
+                }
+                result = 0;
+            }
+            else
+            {
+                last->next = link_socket->outgoing_first;
+                if (link_socket->outgoing_first == NULL)
+                {
+                    link_socket->outgoing_last = last;
+                }
+                link_socket->outgoing_first = frame;
+                (void)Unlock(link_socket->link->outgoing_lock);
+                result = 1;
+            }
+        }
+    }
+    return result;
+}
+
+static int link_io_thread(void* param)
+{
+    LINK_REACTOR* reactor = (LINK_REACTOR*)param;
+    int frames_pending = 0;
+    int should_continue = 1;
+
+    while (should_continue)
+    {
+        struct epoll_event events[LINK_EVENTS_MAX];
+        int count = epoll_wait(reactor->epoll_fd, events, LINK_EVENTS_MAX, frames_pending ? LINK_SEND_RETRY_MS : -1);
+        if (count < 0 && errno != EINTR)
+        {
+            LogError("epoll_wait failed, errno = %d", errno);
+        }
+
+        (void)pthread_mutex_lock(&g_links_lock);
+        if (reactor->stop)
+        {
+            should_continue = 0;
+        }
+        else
+        {
+            int i;
+            OUTPROCESS_LINK* link;
+            for (i = 0; i < count; i++)
+            {
+                if (events[i].data.ptr == NULL)
+                {
+                    uint64_t wakes;
+                    (void)read(reactor->wake_fd, &wakes, sizeof(wakes));
+                }
+                else
+                {
+                    receive_frames((LINK_SOCKET*)events[i].data.ptr);
+                }
+            }
+
+            /*Codes_SRS_OUTPROCESS_LINK_30_018: [ The I/O thread shall send the queued frames of every socket in the order they were queued, and try again every LINK_SEND_RETRY_MS milliseconds the frames the module host did not take. ]*/
+            frames_pending = 0;
+            for (link = reactor->links; link != NULL; link = link->next)
+            {
+                frames_pending |= send_frames(&link->control);
+                frames_pending |= send_frames(&link->message);
+            }
+        }
+        (void)pthread_mutex_unlock(&g_links_lock);
+    }
+    return 0;
+}
+
+static void reactor_destroy(LINK_REACTOR* reactor)
+{
+    if (reactor->thread != NULL)
+    {
+        int notUsed;
+        if (ThreadAPI_Join(reactor->thread, &notUsed) != THREADAPI_OK)
+        {
+            LogError("unable to join the link I/O thread");
+        }
+    }
+    if (reactor->wake_fd >= 0)
+    {
+        (void)close(reactor->wake_fd);
+    }
+    if (reactor->epoll_fd >= 0)
+    {
+        (void)close(reactor->epoll_fd);
+    }
+    free(reactor);
+}
+
+static LINK_REACTOR* reactor_create(void)
+{
+    LINK_REACTOR* reactor = (LINK_REACTOR*)calloc(1, sizeof(LINK_REACTOR));
+    if (reactor == NULL)
+    {
+        LogError("unable to allocate the link I/O thread data");
+    }
+    else
+    {
+        struct epoll_event wake_event;
+        memset(&wake_event, 0, sizeof(wake_event));
+        wake_event.events = EPOLLIN;
+        wake_event.data.ptr = NULL;
+
+        reactor->wake_fd = -1;
+        if ((reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        {
+            LogError("epoll_create1 failed, errno = %d", errno);
+            reactor_destroy(reactor);
+            reactor = NULL;
+        }
+        else if ((reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        {
+            LogError("eventfd failed, errno = %d", errno);
+            reactor_destroy(reactor);
+            reactor = NULL;
+        }
+        else if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &wake_event) != 0)
+        {
+            LogError("unable to watch the wake up event, errno = %d", errno);
+            reactor_destroy(reactor);
+            reactor = NULL;
+        }
+        else if (ThreadAPI_Create(&reactor->thread, link_io_thread, reactor) != THREADAPI_OK)
+        {
+            LogError("unable to start the link I/O thread");
+            reactor->thread = NULL;
+            reactor_destroy(reactor);
+            reactor = NULL;
+        }
+    }
+    return reactor;
+}
+
+/*called with g_links_lock held; the returned reactor is destroyed once the lock is released*/
+static LINK_REACTOR* take_idle_reactor(void)
+{
+    LINK_REACTOR* reactor = NULL;
+    if (g_reactor != NULL && g_reactor->links == NULL)
+    {
+        reactor = g_reactor;
+        g_reactor = NULL;
+        reactor->stop = 1;
+        wake_reactor(reactor);
+    }
+    return reactor;
+}
+
+static void free_frames(LINK_SOCKET* link_socket)
+{
+    LINK_FRAME* frame = link_socket->outgoing_first;
+    while (frame != NULL)
+    {
+        LINK_FRAME* next = frame->next;
+        nn_freemsg(frame->buffer);
+        free(frame);
+        frame = next;
+    }
+    link_socket->outgoing_first = NULL;
+    link_socket->outgoing_last = NULL;
+}
+
+static void link_free(OUTPROCESS_LINK* link)
+{
+    if (link->control.socket >= 0)
+    {
+        (void)nn_close(link->control.socket);
+    }
+    if (link->message.socket >= 0)
+    {
+        (void)nn_close(link->message.socket);
+    }
+    free_frames(&link->control);
+    free_frames(&link->message);
+    if (link->outgoing_lock != NULL)
+    {
+        (void)Lock_Deinit(link->outgoing_lock);
+    }
+    free(link->control_uri);
+    free(link->message_uri);
+    free(link);
+}
+
+static int link_socket_open(LINK_SOCKET* link_socket, const char* uri, int epoll_fd)
+{
+    int result;
+    int receive_fd;
+    size_t receive_fd_size = sizeof(receive_fd);
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = link_socket;
+
+    if ((link_socket->socket = nn_socket(AF_SP, NN_PAIR)) < 0)
+    {
+        LogError("unable to create a link socket, errno = %d", nn_errno());
+        result = __LINE__;
+    }
+    else if (nn_connect(link_socket->socket, uri) < 0)
+    {
+        LogError("unable to connect the link socket to %s, errno = %d", uri, nn_errno());
+        result = __LINE__;
+    }
+    /*nanomsg signals a readable socket on a file descriptor of its own, that is what epoll waits on*/
+    else if (nn_getsockopt(link_socket->socket, NN_SOL_SOCKET, NN_RCVFD, &receive_fd, &receive_fd_size) < 0)
+    {
+        LogError("unable to get the receive descriptor of the link socket, errno = %d", nn_errno());
+        result = __LINE__;
+    }
+    else if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, receive_fd, &event) != 0)
+    {
+        LogError("unable to watch the link socket, errno = %d", errno);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static OUTPROCESS_LINK* link_create(LINK_REACTOR* reactor, const char* control_uri, const char* message_uri)
+{
+    OUTPROCESS_LINK* link = (OUTPROCESS_LINK*)calloc(1, sizeof(OUTPROCESS_LINK));
+    if (link == NULL)
+    {
+        LogError("unable to allocate a link");
+    }
+    else
+    {
+        link->control.link = link;
+        link->control.socket = -1;
+        link->control.is_control = 1;
+        link->message.link = link;
+        link->message.socket = -1;
+        link->next_module_id = 1;
+        link->reactor = reactor;
+
+        if (mallocAndStrcpy_s(&link->control_uri, control_uri) != 0 ||
+            mallocAndStrcpy_s(&link->message_uri, message_uri) != 0)
+        {
+            LogError("unable to copy the link URIs");
+            link_free(link);
+            link = NULL;
+        }
+        else if ((link->outgoing_lock = Lock_Init()) == NULL)
+        {
+            LogError("unable to create the link lock");
+            link_free(link);
+            link = NULL;
+        }
+        else if (link_socket_open(&link->control, control_uri, reactor->epoll_fd) != 0 ||
+            link_socket_open(&link->message, message_uri, reactor->epoll_fd) != 0)
+        {
+            /*closing a socket also removes its descriptor from epoll*/
+            link_free(link);
+            link = NULL;
+        }
+        else
+        {
+            link->next = reactor->links;
+            reactor->links = link;
+        }
+    }
+    return link;
+}
+
+/*called with g_links_lock held, so the I/O thread is not using the link*/
+static void link_destroy(OUTPROCESS_LINK* link)
+{
+    OUTPROCESS_LINK** previous = &link->reactor->links;
+    while (*previous != link)
+    {
+        previous = &(*previous)->next;
+    }
+    *previous = link->next;
+
+    /*Codes_SRS_OUTPROCESS_LINK_30_010: [ When the last module of a link detaches, OutprocessLink_Detach shall send the queued frames the module host takes without waiting, drop the others and close the sockets of the link. ]*/
+    /*best effort: whatever the module host does not take right away is dropped*/
+    (void)send_frames(&link->control);
+    (void)send_frames(&link->message);
+    link_free(link);
+}
+
+/*stops the delivery thread, drops the messages it did not deliver and frees the endpoint*/
+static void endpoint_destroy(OUTPROCESS_LINK_ENDPOINT* endpoint)
+{
+    if (endpoint->delivery_thread != NULL)
+    {
+        int notUsed;
+        if (Lock(endpoint->inbound_lock) != LOCK_OK)
+        {
+            LogError("unable to lock the queue of module %u", (unsigned int)endpoint->module_id);
+        }
+        else
+        {
+            endpoint->stop = 1;
+            (void)Condition_Post(endpoint->inbound_cond);
+            (void)Unlock(endpoint->inbound_lock);
+        }
+        if (ThreadAPI_Join(endpoint->delivery_thread, &notUsed) != THREADAPI_OK)
+        {
+            LogError("unable to join the delivery thread of module %u", (unsigned int)endpoint->module_id);
+        }
+    }
+    while (endpoint->inbound_first != NULL)
+    {
+        LINK_INBOUND* next = endpoint->inbound_first->next;
+        Message_Destroy(endpoint->inbound_first->message);
+        free(endpoint->inbound_first);
+        endpoint->inbound_first = next;
+    }
+    if (endpoint->inbound_cond != NULL)
+    {
+        Condition_Deinit(endpoint->inbound_cond);
+    }
+    if (endpoint->inbound_lock != NULL)
+    {
+        (void)Lock_Deinit(endpoint->inbound_lock);
+    }
+    free(endpoint);
+}
+
+static OUTPROCESS_LINK_ENDPOINT* endpoint_create(OUTPROCESS_LINK_ON_MESSAGE on_message, OUTPROCESS_LINK_ON_CONTROL on_control, void* context)
+{
+    OUTPROCESS_LINK_ENDPOINT* endpoint = (OUTPROCESS_LINK_ENDPOINT*)calloc(1, sizeof(OUTPROCESS_LINK_ENDPOINT));
+    if (endpoint == NULL)
+    {
+        LogError("unable to allocate a link endpoint");
+    }
+    else
+    {
+        endpoint->on_message = on_message;
+        endpoint->on_control = on_control;
+        endpoint->context = context;
+        if ((endpoint->inbound_lock = Lock_Init()) == NULL)
+        {
+            LogError("unable to create the lock of a link endpoint");
+            endpoint_destroy(endpoint);
+            endpoint = NULL;
+        }
+        else if ((endpoint->inbound_cond = Condition_Init()) == NULL)
+        {
+            LogError("unable to create the condition of a link endpoint");
+            endpoint_destroy(endpoint);
+            endpoint = NULL;
+        }
+        else if (ThreadAPI_Create(&endpoint->delivery_thread, endpoint_delivery_thread, endpoint) != THREADAPI_OK)
+        {
+            LogError("unable to start the delivery thread of a link endpoint");
+            endpoint->delivery_thread = NULL;
+            endpoint_destroy(endpoint);
+            endpoint = NULL;
+        }
+    }
+    return endpoint;
+}
+
+OUTPROCESS_LINK_ENDPOINT_HANDLE OutprocessLink_Attach(const char* control_uri, const char* message_uri, OUTPROCESS_LINK_ON_MESSAGE on_message, OUTPROCESS_LINK_ON_CONTROL on_control, void* context)
+{
+    OUTPROCESS_LINK_ENDPOINT* endpoint;
+    if (control_uri == NULL || message_uri == NULL || on_message == NULL || on_control == NULL)
+    {
+        /*Codes_SRS_OUTPROCESS_LINK_30_001: [ If control_uri, message_uri, on_message or on_control is NULL, OutprocessLink_Attach shall fail and return NULL. ]*/
+        LogError("invalid arguments control_uri=[%p], message_uri=[%p], on_message=[%p], on_control=[%p]",
+            control_uri, message_uri, on_message, on_control);
+        endpoint = NULL;
+    }
+    /*Codes_SRS_OUTPROCESS_LINK_30_002: [ OutprocessLink_Attach shall start the delivery thread of the module. ]*/
+    else if ((endpoint = endpoint_create(on_message, on_control, context)) == NULL)
+    {
+        LogError("unable to create a link endpoint");
+    }
+    else
+    {
+        LINK_REACTOR* idle_reactor = NULL;
+        OUTPROCESS_LINK* link = NULL;
+
+        (void)pthread_mutex_lock(&g_links_lock);
+        /*Codes_SRS_OUTPROCESS_LINK_30_003: [ OutprocessLink_Attach shall start the I/O thread if no link is open. ]*/
+        if (g_reactor == NULL && (g_reactor = reactor_create()) == NULL)
+        {
+            LogError("unable to start the link I/O thread");
+        }
+        else
+        {
+            link = g_reactor->links;
+            while (link != NULL && strcmp(link->control_uri, control_uri) != 0)
+            {
+                link = link->next;
+            }
+
+            if (link == NULL)
+            {
+                /*Codes_SRS_OUTPROCESS_LINK_30_004: [ If no link has control_uri, OutprocessLink_Attach shall open one with a pair socket connected to control_uri and one connected to message_uri, both watched by the I/O thread. ]*/
+                link = link_create(g_reactor, control_uri, message_uri);
+            }
+            else if (strcmp(link->message_uri, message_uri) != 0)
+            {
+                /*Codes_SRS_OUTPROCESS_LINK_30_005: [ If the link of control_uri has another message URI than message_uri, OutprocessLink_Attach shall fail and return NULL. ]*/
+                LogError("the modules of the link %s must share the message channel %s, not %s", control_uri, link->message_uri, message_uri);
+                link = NULL;
+            }
+
+            if (link != NULL)
+            {
+                /*Codes_SRS_OUTPROCESS_LINK_30_006: [ OutprocessLink_Attach shall give the module an id that no other module of the link has and that is not 0, and return a non-NULL handle. ]*/
+                endpoint->link = link;
+                endpoint->module_id = link->next_module_id++;
+                if (link->next_module_id == 0)
+                {
+                    link->next_module_id = 1;
+                }
+                endpoint->next = link->endpoints;
+                link->endpoints = endpoint;
+            }
+            idle_reactor = take_idle_reactor();
+        }
+        (void)pthread_mutex_unlock(&g_links_lock);
+
+        if (idle_reactor != NULL)
+        {
+            reactor_destroy(idle_reactor);
+        }
+        if (link == NULL)
+        {
+            /*Codes_SRS_OUTPROCESS_LINK_30_007: [ If any step fails, OutprocessLink_Attach shall release what it created and return NULL. ]*/
+            endpoint_destroy(endpoint);
+            endpoint = NULL;
+        }
+    }
+    return endpoint;
+}
+
+void OutprocessLink_Detach(OUTPROCESS_LINK_ENDPOINT_HANDLE endpoint)
+{
+    if (endpoint == NULL)
+    {
+        /*Codes_SRS_OUTPROCESS_LINK_30_008: [ If endpoint is NULL, OutprocessLink_Detach shall do nothing. ]*/
+        LogError("endpoint is NULL");
+    }
+    else
+    {
+        LINK_REACTOR* idle_reactor;
+        OUTPROCESS_LINK* link = endpoint->link;
+        OUTPROCESS_LINK_ENDPOINT** previous = &link->endpoints;
+
+        /*Codes_SRS_OUTPROCESS_LINK_30_009: [ OutprocessLink_Detach shall remove the module from its link, stop its delivery thread and destroy the gateway messages still waiting for it; no callback of the module shall run once it returns. ]*/
+        (void)pthread_mutex_lock(&g_links_lock);
+        while (*previous != endpoint)
+        {
+            previous = &(*previous)->next;
+        }
+        *previous = endpoint->next;
+        if (link->endpoints == NULL)
+        {
+            link_destroy(link);
+        }
+        /*Codes_SRS_OUTPROCESS_LINK_30_011: [ When the last link is closed, OutprocessLink_Detach shall stop the I/O thread. ]*/
+        idle_reactor = take_idle_reactor();
+        (void)pthread_mutex_unlock(&g_links_lock);
+
+        if (idle_reactor != NULL)
+        {
+            reactor_destroy(idle_reactor);
+        }
+        /*the I/O thread no longer sees the endpoint, its delivery thread can stop*/
+        endpoint_destroy(endpoint);
+    }
+}
+
+static int queue_frame(OUTPROCESS_LINK_ENDPOINT* endpoint, LINK_SOCKET* link_socket, void* buffer)
+{
+    int result;
+    LINK_FRAME* frame = (LINK_FRAME*)malloc(sizeof(LINK_FRAME));
+    if (frame == NULL)
+    {
+        LogError("unable to allocate a frame");
+        result = __LINE__;
+    }
+    else if (Lock(endpoint->link->outgoing_lock) != LOCK_OK)
+    {
+        LogError("unable to lock the outgoing frames");
+        free(frame);
+        result = __LINE__;
+    }
+    else
+    {
+        int was_empty = (link_socket->outgoing_first == NULL);
+        frame->next = NULL;
+        frame->buffer = buffer;
+        if (was_empty)
+        {
+            link_socket->outgoing_first = frame;
+        }
+        else
+        {
+            link_socket->outgoing_last->next = frame;
+        }
+        link_socket->outgoing_last = frame;
+        (void)Unlock(endpoint->link->outgoing_lock);
+
+        /*the I/O thread empties the queue every time it wakes up, it only needs a nudge for the first frame*/
+        if (was_empty)
+        {
+            wake_reactor(endpoint->link->reactor);
+        }
+        result = 0;
+    }
+    return result;
+}
+
+int OutprocessLink_SendMessage(OUTPROCESS_LINK_ENDPOINT_HANDLE endpoint, MESSAGE_HANDLE message)
+{
+    int result;
+    int32_t message_size;
+    if (endpoint == NULL || message == NULL)
+    {
+        /*Codes_SRS_OUTPROCESS_LINK_30_012: [ If endpoint or message is NULL, OutprocessLink_SendMessage shall fail and return a non-zero value. ]*/
+        LogError("invalid arguments endpoint=[%p], message=[%p]", endpoint, message);
+        result = __LINE__;
+    }
+    else if ((message_size = Message_ToByteArray(message, NULL, 0)) < 0)
+    {
+        /*Codes_SRS_OUTPROCESS_LINK_30_014: [ If the message cannot be serialized or the frame cannot be allocated or queued, OutprocessLink_SendMessage shall fail and return a non-zero value. ]*/
+        LogError("unable to serialize message [%p]", message);
+        result = __LINE__;
+    }
+    else
+    {
+        unsigned char* frame = (unsigned char*)nn_allocmsg(MULTIPLEXED_FRAME_HEADER_SIZE + (size_t)message_size, 0);
+        if (frame == NULL)
+        {
+            LogError("unable to allocate a frame for message [%p]", message);
+            result = __LINE__;
+        }
+        else
+        {
+            /*Codes_SRS_OUTPROCESS_LINK_30_013: [ OutprocessLink_SendMessage shall serialize message after the module id in a frame, queue the frame for the message socket of the link and return 0. ]*/
+            MultiplexedFrame_SetModuleId(frame, endpoint->module_id);
+            (void)Message_ToByteArray(message, frame + MULTIPLEXED_FRAME_HEADER_SIZE, message_size);
+            if ((result = queue_frame(endpoint, &endpoint->link->message, frame)) != 0)
+            {
+                nn_freemsg(frame);
+            }
+        }
+    }
+    return result;
+}
+
+int OutprocessLink_SendControl(OUTPROCESS_LINK_ENDPOINT_HANDLE endpoint, CONTROL_MESSAGE* message)
+{
+    int result;
+    int32_t message_size;
+    if (endpoint == NULL || message == NULL)
+    {
+        /*Codes_SRS_OUTPROCESS_LINK_30_015: [ If endpoint or message is NULL, OutprocessLink_SendControl shall fail and return a non-zero value. ]*/
+        LogError("invalid arguments endpoint=[%p], message=[%p]", endpoint, message);
+        result = __LINE__;
+    }
+    else if ((message_size = ControlMessage_ToByteArray(message, NULL, 0)) < 0)
+    {
+        /*Codes_SRS_OUTPROCESS_LINK_30_017: [ If the message cannot be serialized or the frame cannot be allocated or queued, OutprocessLink_SendControl shall fail and return a non-zero value. ]*/
+        LogError("unable to serialize a control message");
+        result = __LINE__;
+    }
+    else
+    {
+        unsigned char* frame = (unsigned char*)nn_allocmsg(MULTIPLEXED_FRAME_HEADER_SIZE + (size_t)message_size, 0);
+        if (frame == NULL)
+        {
+            LogError("unable to allocate a frame for a control message");
+            result = __LINE__;
+        }
+        else
+        {
+            /*Codes_SRS_OUTPROCESS_LINK_30_016: [ OutprocessLink_SendControl shall serialize message after the module id in a frame, queue the frame for the control socket of the link and return 0. ]*/
+            MultiplexedFrame_SetModuleId(frame, endpoint->module_id);
+            (void)ControlMessage_ToByteArray(message, frame + MULTIPLEXED_FRAME_HEADER_SIZE, message_size);
+            if ((result = queue_frame(endpoint, &endpoint->link->control, frame)) != 0)
+            {
+                nn_freemsg(frame);
+            }
+        }
+    }
+    return result;
+}
+
+#else /*__linux__*/
+
+OUTPROCESS_LINK_ENDPOINT_HANDLE OutprocessLink_Attach(const char* control_uri, const char* message_uri, OUTPROCESS_LINK_ON_MESSAGE on_message, OUTPROCESS_LINK_ON_CONTROL on_control, void* context)
+{
+    (void)control_uri;
+    (void)message_uri;
+    (void)on_message;
+    (void)on_control;
+    (void)context;
+    /*Codes_SRS_OUTPROCESS_LINK_30_025: [ On platforms other than Linux, OutprocessLink_Attach shall return NULL, OutprocessLink_SendMessage and OutprocessLink_SendControl shall return a non-zero value and OutprocessLink_Detach shall do nothing. ]*/
+    LogError("multiplexed module host links are only supported on Linux");
+    return NULL;
+}
+
+void OutprocessLink_Detach(OUTPROCESS_LINK_ENDPOINT_HANDLE endpoint)
+{
+    (void)endpoint;
+}
+
+int OutprocessLink_SendMessage(OUTPROCESS_LINK_ENDPOINT_HANDLE endpoint, MESSAGE_HANDLE message)
+{
+    (void)endpoint;
+    (void)message;
+    return __LINE__;
+}
+
+int OutprocessLink_SendControl(OUTPROCESS_LINK_ENDPOINT_HANDLE endpoint, CONTROL_MESSAGE* message)
+{
+    (void)endpoint;
+    (void)message;
+    return __LINE__;
+}
+
+#endif /*__linux__*/
@@ -12,6 +12,7 @@
 #include "module_loader.h"
 #include "module_loaders/outprocess_loader.h"
 #include "module_loaders/outprocess_module.h"
+#include "shm_channel.h"
 
 DEFINE_ENUM_STRINGS(OUTPROCESS_LOADER_ACTIVATION_TYPE, OUTPROCESS_LOADER_ACTIVATION_TYPE_VALUES);
 
@@ -127,6 +128,10 @@ static void* OutprocessModuleLoader_ParseEntrypointFromJson(const struct MODULE_
 	//		"activation.type" : "none",
 	//		"control.id" : "outproc_module_control", 
 	//		"message.id" : "outproc_module_message", (optional)
+	//		"message.type" : "ipc" or "shm", (optional, default "ipc")
+	//		"multiplexed" : true or false, (optional, default false)
+	//		"message.batch.size" : numeric, (optional, default 0, no batching)
+	//		"message.batch.linger" : numeric, (optional, default 0 us)
 	//		"timeout" : numeric, (optional, default 250 ms)
 	//		}
 	//  }
@@ -207,6 +212,39 @@ static void* OutprocessModuleLoader_ParseEntrypointFromJson(const struct MODULE_
 						{
 							/*Codes_SRS_OUTPROCESS_LOADER_17_019: [ This function shall assign the entrypoint message_id to the string value of "message.id" in json, NULL if not present. ] */
 							config->message_id = URL_EncodeString(messageId);
+							/*Codes_SRS_OUTPROCESS_LOADER_30_001: [ This function shall assign the entrypoint message_channel to OUTPROCESS_MESSAGE_CHANNEL_SHM if "message.type" in json is "shm", and to OUTPROCESS_MESSAGE_CHANNEL_IPC otherwise. ]*/
+							const char* messageType = json_object_get_string(entrypoint, "message.type");
+							if ((messageType != NULL) && (strcmp(messageType, "shm") == 0))
+							{
+								config->message_channel = OUTPROCESS_MESSAGE_CHANNEL_SHM;
+							}
+							else
+							{
+								if ((messageType != NULL) && (strcmp(messageType, "ipc") != 0))
+								{
+									LogError("unknown message.type [%s], using ipc", messageType);
+								}
+								config->message_channel = OUTPROCESS_MESSAGE_CHANNEL_IPC;
+							}
+							/*Codes_SRS_OUTPROCESS_LOADER_30_003: [ This function shall set the entrypoint multiplexed to true if "multiplexed" in json is true, and to false otherwise. ]*/
+							config->multiplexed = (json_object_get_boolean(entrypoint, "multiplexed") == 1);
+							if (config->multiplexed && config->message_channel == OUTPROCESS_MESSAGE_CHANNEL_SHM)
+							{
+								/*Codes_SRS_OUTPROCESS_LOADER_30_004: [ If the entrypoint is multiplexed, the message_channel shall be OUTPROCESS_MESSAGE_CHANNEL_IPC. ]*/
+								LogError("a multiplexed module cannot use a shared memory channel, using ipc");
+								config->message_channel = OUTPROCESS_MESSAGE_CHANNEL_IPC;
+							}
+							/*Codes_SRS_OUTPROCESS_LOADER_30_007: [ This function shall set the entrypoint max_batch_size to "message.batch.size" in json and max_batch_linger to "message.batch.linger" in json, or to 0 if they are not present. ]*/
+							double batchSize = json_object_get_number(entrypoint, "message.batch.size");
+							double batchLinger = json_object_get_number(entrypoint, "message.batch.linger");
+							if (batchSize > 1 && (config->multiplexed || config->message_channel != OUTPROCESS_MESSAGE_CHANNEL_IPC))
+							{
+								/*Codes_SRS_OUTPROCESS_LOADER_30_008: [ If the entrypoint is multiplexed or its message_channel is not OUTPROCESS_MESSAGE_CHANNEL_IPC, max_batch_size and max_batch_linger shall be 0. ]*/
+								LogError("message batching needs a non multiplexed ipc message channel, not batching");
+								batchSize = 0;
+							}
+							config->max_batch_size = (batchSize > 1) ? (unsigned int)batchSize : 0;
+							config->max_batch_linger = (config->max_batch_size != 0 && batchLinger > 0) ? (unsigned int)batchLinger : 0;
 							/*Codes_SRS_OUTPROCESS_LOADER_17_022: [ This function shall return a valid pointer to an OUTPROCESS_LOADER_ENTRYPOINT on success. ]*/
 						}
 					}
@@ -278,7 +316,34 @@ static void* OutprocessModuleLoader_BuildModuleConfiguration(
 			OUTPROCESS_LOADER_ENTRYPOINT* ep = (OUTPROCESS_LOADER_ENTRYPOINT*)entrypoint;
 			char uuid[LOADER_GUID_SIZE];
 			UNIQUEID_RESULT uuid_result = UNIQUEID_OK;
-			if (ep->message_id == NULL)
+			if (ep->message_channel == OUTPROCESS_MESSAGE_CHANNEL_SHM)
+			{
+				/*Codes_SRS_OUTPROCESS_LOADER_30_002: [ If the entrypoint's message_channel is OUTPROCESS_MESSAGE_CHANNEL_SHM, the message uri shall be composed of "shm://" + the message_id, or "shm://" + a unique id if message_id is NULL. ]*/
+				if (ep->message_id == NULL)
+				{
+					memset(uuid, 0, LOADER_GUID_SIZE);
+					uuid_result = UniqueId_Generate(uuid, LOADER_GUID_SIZE);
+					if (uuid_result != UNIQUEID_OK)
+					{
+						LogError("Unable to generate unique Id.");
+						fullModuleConfiguration->message_uri = NULL;
+					}
+					else
+					{
+						fullModuleConfiguration->message_uri = STRING_construct_sprintf("%s%s", SHM_CHANNEL_URI_HEAD, uuid);
+					}
+				}
+				else
+				{
+					fullModuleConfiguration->message_uri = STRING_construct_sprintf("%s%s", SHM_CHANNEL_URI_HEAD, STRING_c_str(ep->message_id));
+				}
+			}
+			else if (ep->message_id == NULL && ep->multiplexed)
+			{
+				/*Codes_SRS_OUTPROCESS_LOADER_30_005: [ If the entrypoint is multiplexed and its message_id is NULL, the message uri shall be composed of "ipc://" + the control_id + "_message.ipc", so every module of the link names the same message channel. ]*/
+				fullModuleConfiguration->message_uri = STRING_construct_sprintf("%s%s%s", IPC_URI_HEAD, STRING_c_str(ep->control_id), "_message.ipc");
+			}
+			else if (ep->message_id == NULL)
 			{
 				/*Codes_SRS_OUTPROCESS_LOADER_17_029: [ If the entrypoint's message_id is NULL, then the loader shall construct an IPC uri. ]*/
 				memset(uuid, 0, LOADER_GUID_SIZE);
@@ -339,6 +404,12 @@ static void* OutprocessModuleLoader_BuildModuleConfiguration(
 						/*Codes_SRS_OUTPROCESS_LOADER_17_035: [ Upon success, this function shall return a valid pointer to an OUTPROCESS_MODULE_CONFIG structure. ]*/
 						fullModuleConfiguration->remote_message_wait = ep->remote_message_wait;
 						fullModuleConfiguration->lifecycle_model = OUTPROCESS_LIFECYCLE_SYNC;
+						fullModuleConfiguration->message_channel = ep->message_channel;
+						/*Codes_SRS_OUTPROCESS_LOADER_30_006: [ This function shall copy the entrypoint multiplexed to the module configuration. ]*/
+						fullModuleConfiguration->multiplexed = ep->multiplexed;
+						/*Codes_SRS_OUTPROCESS_LOADER_30_009: [ This function shall copy the entrypoint max_batch_size and max_batch_linger to the module configuration. ]*/
+						fullModuleConfiguration->max_batch_size = ep->max_batch_size;
+						fullModuleConfiguration->max_batch_linger = ep->max_batch_linger;
 					}
 				}
 			}
@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <nanomsg/nn.h>
 #include <nanomsg/pair.h>
@@ -11,12 +12,18 @@
 #include "message.h"
 #include "message_queue.h"
 #include "control_message.h"
+#include "batched_frame.h"
+#include "shm_channel.h"
+#include "gateway_trace.h"
 #include "module_loaders/outprocess_module.h"
+#include "module_loaders/outprocess_link.h"
 #include "azure_c_shared_utility/strings.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/threadapi.h"
 #include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/tickcounter.h"
 
 typedef struct THREAD_CONTROL_TAG
 {
@@ -27,18 +34,39 @@ typedef struct THREAD_CONTROL_TAG
 
 #define THREAD_FLAG_STOP 1
 
+/*as long as the broker waits for room in a blocking mailbox*/
+#define OUTGOING_BLOCK_TIMEOUT_MS 1000
+
 typedef struct OUTPROCESS_HANDLE_DATA_TAG
 {
 	LOCK_HANDLE handle_lock;
 	int message_socket;
 	int control_socket;
+	SHM_CHANNEL_HANDLE message_channel;
 	MESSAGE_QUEUE_HANDLE outgoing_messages;
+	COND_HANDLE outgoing_messages_cond;
 	STRING_HANDLE control_uri;
 	STRING_HANDLE message_uri;
 	STRING_HANDLE module_args;
 	OUTPROCESS_MODULE_LIFECYCLE lifecyle_model;
 	BROKER_HANDLE broker;
 	unsigned int remote_message_wait;
+	/*set for a multiplexed module, which owns no socket and no thread*/
+	OUTPROCESS_LINK_ENDPOINT_HANDLE link_endpoint;
+	/*status of the Module Reply to the Create Message of a multiplexed module, guarded by handle_lock*/
+	int link_create_status;
+	/*the most gateway messages per frame of the message channel, 0 when the channel is not batched*/
+	unsigned int max_batch_size;
+	/*microseconds a frame waits for more messages before it is sent short*/
+	unsigned int max_batch_linger;
+	/*limits of the mailbox of the module in the broker, read by the first Outprocess_Receive and applied to outgoing_messages*/
+	int outgoing_limits_known;
+	BROKER_MAILBOX_OPTIONS outgoing_limits;
+	/*signaled when a message leaves a full outgoing queue, only created for BROKER_OVERFLOW_BLOCK*/
+	COND_HANDLE outgoing_space_cond;
+	/*number of messages in outgoing_messages and number discarded by the overflow policy since the send thread last logged them*/
+	size_t outgoing_depth;
+	size_t outgoing_dropped;
 
 	THREAD_CONTROL message_receive_thread;
 	THREAD_CONTROL message_send_thread;
@@ -46,10 +74,70 @@ typedef struct OUTPROCESS_HANDLE_DATA_TAG
 	THREAD_CONTROL control_thread;
 } OUTPROCESS_HANDLE_DATA;
 
+typedef struct BATCH_ENTRY_TAG
+{
+	MESSAGE_HANDLE message;
+	int32_t size;
+} BATCH_ENTRY;
+
 // forward definitions
 static void* construct_create_message(OUTPROCESS_HANDLE_DATA* handleData, int32_t * creationMessageSize);
 static void send_start_message(OUTPROCESS_HANDLE_DATA* handleData);
 
+static int receive_from_message_ring(OUTPROCESS_HANDLE_DATA * handleData, SHM_CHANNEL_HANDLE channel)
+{
+	int should_continue = 1;
+	int timeout = (int)handleData->remote_message_wait;
+	int32_t nbytes;
+	do
+	{
+		const unsigned char *buf = NULL;
+		/*Codes_SRS_OUTPROCESS_MODULE_30_006: [ If the message channel is a shared memory channel, this function shall read the gateway message in place from the incoming ring and release the ring space once the message is created. ]*/
+		nbytes = ShmChannel_BeginReceive(channel, &buf, timeout);
+		if (nbytes == SHM_CHANNEL_CLOSED)
+		{
+			should_continue = 0;
+		}
+		else if (nbytes >= 0)
+		{
+			MESSAGE_HANDLE msg = Message_CreateFromByteArray(buf, nbytes);
+			ShmChannel_EndReceive(channel);
+			if (msg != NULL)
+			{
+				/*Codes_SRS_OUTPROCESS_MODULE_17_040: [ This function shall publish any successfully created gateway message to the broker. ]*/
+				Broker_Publish(handleData->broker, (MODULE_HANDLE)handleData, msg);
+				Message_Destroy(msg);
+			}
+		}
+		/*Codes_SRS_OUTPROCESS_MODULE_30_001: [ After a message is received, this function shall keep receiving without blocking until no more messages are available on the message channel. ]*/
+		timeout = 0;
+	} while (nbytes >= 0);
+	return should_continue;
+}
+
+
+static void publish_message_batch(OUTPROCESS_HANDLE_DATA * handleData, const unsigned char * frame, int32_t frame_size)
+{
+	int32_t position = 0;
+	const unsigned char * message_bytes;
+	int32_t message_size;
+	int next;
+	/*Codes_SRS_OUTPROCESS_MODULE_30_023: [ If the message channel is batched, this function shall deserialize and publish every gateway message of the received frame, in order. ]*/
+	while ((next = BatchedFrame_Next(frame, frame_size, &position, &message_bytes, &message_size)) == 1)
+	{
+		MESSAGE_HANDLE msg = Message_CreateFromByteArray(message_bytes, message_size);
+		if (msg != NULL)
+		{
+			/*Codes_SRS_OUTPROCESS_MODULE_17_040: [ This function shall publish any successfully created gateway message to the broker. ]*/
+			Broker_Publish(handleData->broker, (MODULE_HANDLE)handleData, msg);
+			Message_Destroy(msg);
+		}
+	}
+	if (next < 0)
+	{
+		LogError("malformed message batch, dropping the rest of the frame");
+	}
+}
 
 int outprocessIncomingMessageThread(void *param)
 {
@@ -73,6 +161,7 @@ int outprocessIncomingMessageThread(void *param)
 				break;
 			}
 			int nn_fd = handleData->message_socket;
+			SHM_CHANNEL_HANDLE channel = handleData->message_channel;
 			if (Unlock(handleData->handle_lock) != LOCK_OK)
 			{
 				should_continue = 0;
@@ -98,134 +187,372 @@ int outprocessIncomingMessageThread(void *param)
 				break;
 			}
 
+			if (channel != NULL)
+			{
+				should_continue = receive_from_message_ring(handleData, channel);
+				continue;
+			}
+
 			int nbytes;
-			unsigned char *buf = NULL;
-			errno = 0;
-			/*Codes_SRS_OUTPROCESS_MODULE_17_038: [ This function shall read from the message channel for gateway messages from the module host. ]*/
-			nbytes = nn_recv(nn_fd, (void *)&buf, NN_MSG, 0);
-			if (nbytes < 0)
+			int flags = 0;
+			do
 			{
-				int receive_error = nn_errno();
-				if (receive_error != ETIMEDOUT)
-					should_continue = 0;
+				unsigned char *buf = NULL;
+				errno = 0;
+				/*Codes_SRS_OUTPROCESS_MODULE_17_038: [ This function shall read from the message channel for gateway messages from the module host. ]*/
+				nbytes = nn_recv(nn_fd, (void *)&buf, NN_MSG, flags);
+				if (nbytes < 0)
+				{
+					int receive_error = nn_errno();
+					if ((receive_error != ETIMEDOUT) && (receive_error != EAGAIN))
+						should_continue = 0;
+				}
+				else
+				{
+					if (handleData->max_batch_size != 0)
+					{
+						publish_message_batch(handleData, buf, nbytes);
+						nn_freemsg(buf);
+						/*Codes_SRS_OUTPROCESS_MODULE_30_001: [ After a message is received, this function shall keep receiving without blocking until no more messages are available on the message channel. ]*/
+						flags = NN_DONTWAIT;
+						continue;
+					}
+					/*Codes_SRS_OUTPROCESS_MODULE_17_039: [ Upon successful receiving a gateway message, this function shall deserialize the message. ]*/
+					/*the message keeps buf and releases it with nn_freemsg when the last module is done with it*/
+					MESSAGE_HANDLE msg = Message_CreateFromByteArrayNoCopy(buf, nbytes);
+					if (msg != NULL)
+					{
+						/*Codes_SRS_OUTPROCESS_MODULE_17_040: [ This function shall publish any successfully created gateway message to the broker. ]*/
+						Broker_Publish(handleData->broker, (MODULE_HANDLE)handleData, msg);
+						Message_Destroy(msg);
+					}
+					else
+					{
+						nn_freemsg(buf);
+					}
+				}
+				/*Codes_SRS_OUTPROCESS_MODULE_30_001: [ After a message is received, this function shall keep receiving without blocking until no more messages are available on the message channel. ]*/
+				flags = NN_DONTWAIT;
+			} while (nbytes >= 0);
+		}
+	}
+	return 0;
+}
+
+static int outgoing_thread_should_stop(OUTPROCESS_HANDLE_DATA * handleData)
+{
+	int result;
+	if (Lock(handleData->message_send_thread.thread_lock) != LOCK_OK)
+	{
+		LogError("unable to Lock");
+		result = 1;
+	}
+	else
+	{
+		result = (handleData->message_send_thread.thread_flag == THREAD_FLAG_STOP);
+		if (Unlock(handleData->message_send_thread.thread_lock) != LOCK_OK)
+		{
+			result = 1;
+		}
+	}
+	return result;
+}
+
+/*called with the handle lock held, moves the dropped count to dropped so the caller logs it without the lock*/
+static MESSAGE_HANDLE pop_outgoing_message(OUTPROCESS_HANDLE_DATA * handleData, size_t * dropped)
+{
+	MESSAGE_HANDLE message = MESSAGE_QUEUE_pop(handleData->outgoing_messages);
+	if (message != NULL)
+	{
+		handleData->outgoing_depth--;
+		if (handleData->outgoing_space_cond != NULL)
+		{
+			/*Codes_SRS_OUTPROCESS_MODULE_30_031: [ This thread shall signal Outprocess_Receive every time it removes a message from an outgoing gateway message queue bounded with BROKER_OVERFLOW_BLOCK. ]*/
+			(void)Condition_Post(handleData->outgoing_space_cond);
+		}
+	}
+	*dropped += handleData->outgoing_dropped;
+	handleData->outgoing_dropped = 0;
+	return message;
+}
+
+/*called with the handle lock held and the first message of the batch in batch[0]*/
+static size_t collect_message_batch(OUTPROCESS_HANDLE_DATA * handleData, BATCH_ENTRY * batch, TICK_COUNTER_HANDLE tick_counter, size_t * dropped)
+{
+	size_t count = 1;
+	tickcounter_ms_t linger_ms = (handleData->max_batch_linger + 999) / 1000;
+	tickcounter_ms_t start_ms = 0;
+	if (tick_counter == NULL || tickcounter_get_current_ms(tick_counter, &start_ms) != 0)
+	{
+		linger_ms = 0;
+	}
+	while (count < handleData->max_batch_size)
+	{
+		if (!MESSAGE_QUEUE_is_empty(handleData->outgoing_messages))
+		{
+			batch[count].message = pop_outgoing_message(handleData, dropped);
+			if (batch[count].message != NULL)
+			{
+				count++;
+			}
+		}
+		else
+		{
+			/*Codes_SRS_OUTPROCESS_MODULE_30_025: [ If the outgoing gateway message queue empties before the batch is full, this thread shall wait up to max_batch_linger microseconds from the first message of the batch for more messages. ]*/
+			tickcounter_ms_t now_ms;
+			if (linger_ms == 0 ||
+				outgoing_thread_should_stop(handleData) ||
+				tickcounter_get_current_ms(tick_counter, &now_ms) != 0 ||
+				now_ms - start_ms >= linger_ms)
+			{
+				break;
 			}
 			else
 			{
-				/*Codes_SRS_OUTPROCESS_MODULE_17_039: [ Upon successful receiving a gateway message, this function shall deserialize the message. ]*/
-				const unsigned char*buf_bytes = (const unsigned char*)buf;
-				MESSAGE_HANDLE msg = Message_CreateFromByteArray(buf_bytes, nbytes);
-				if (msg != NULL)
+				COND_RESULT wait_result = Condition_Wait(handleData->outgoing_messages_cond, handleData->handle_lock, (int)(linger_ms - (now_ms - start_ms)));
+				if (wait_result != COND_OK && wait_result != COND_TIMEOUT)
 				{
-					/*Codes_SRS_OUTPROCESS_MODULE_17_040: [ This function shall publish any successfully created gateway message to the broker. ]*/
-					Broker_Publish(handleData->broker, (MODULE_HANDLE)handleData, msg);
-					Message_Destroy(msg);
+					break;
 				}
-				nn_freemsg(buf);
 			}
-			ThreadAPI_Sleep(1);
 		}
 	}
-	return 0;
+	return count;
+}
+
+static void log_dropped_messages(size_t dropped)
+{
+	if (dropped != 0)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_30_032: [ This thread shall log how many messages the overflow policy discarded since it removed the previous message. ]*/
+		LogError("%lu gateway messages were dropped while the outgoing queue was full", (unsigned long)dropped);
+	}
+}
+
+/*called without the handle lock, destroys the messages of the batch*/
+static void send_message_batch(OUTPROCESS_HANDLE_DATA * handleData, BATCH_ENTRY * batch, size_t count)
+{
+	size_t i;
+	int32_t frame_size = 0;
+	for (i = 0; i < count; i++)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_17_023: [ This function shall serialize the message for transmission on the message channel. ]*/
+		batch[i].size = Message_ToByteArray(batch[i].message, NULL, 0);
+		if (batch[i].size < 0)
+		{
+			LogError("unable to serialize outgoing message [%p]", batch[i].message);
+		}
+		else
+		{
+			frame_size += BATCHED_FRAME_HEADER_SIZE + batch[i].size;
+		}
+	}
+	if (frame_size != 0)
+	{
+		void* frame = nn_allocmsg(frame_size, 0);
+		if (frame == NULL)
+		{
+			LogError("unable to allocate buffer for a batch of outgoing messages");
+		}
+		else
+		{
+			unsigned char *frame_bytes = (unsigned char *)frame;
+			int32_t position = 0;
+			for (i = 0; i < count; i++)
+			{
+				if (batch[i].size >= 0)
+				{
+					BatchedFrame_SetSize(frame_bytes + position, batch[i].size);
+					position += BATCHED_FRAME_HEADER_SIZE;
+					Message_ToByteArray(batch[i].message, frame_bytes + position, batch[i].size);
+					position += batch[i].size;
+				}
+			}
+			/*Codes_SRS_OUTPROCESS_MODULE_17_024: [ This function shall send the message on the message channel. ]*/
+			GATEWAY_TRACE(GATEWAY_TRACE_SEND_BEGIN, batch[0].message, handleData);
+			int nbytes = nn_send(handleData->message_socket, &frame, NN_MSG, 0);
+			GATEWAY_TRACE(GATEWAY_TRACE_SEND_END, batch[0].message, handleData);
+			if (nbytes != frame_size)
+			{
+				LogError("unable to send a batch of messages to remote");
+				/*Codes_SRS_OUTPROCESS_MODULE_17_025: [ This function shall free any resources created. ]*/
+				nn_freemsg(frame);
+			}
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_17_055: [ This function shall Destroy the message once successfully transmitted. ]*/
+		Message_Destroy(batch[i].message);
+	}
 }
 
 static int outprocessOutgoingMessagesThread(void * param)
 {
 	OUTPROCESS_HANDLE_DATA * handleData = (OUTPROCESS_HANDLE_DATA*)param;
+	BATCH_ENTRY * batch = NULL;
+	TICK_COUNTER_HANDLE tick_counter = NULL;
 	if (handleData == NULL)
 	{
 		LogError("outprocess send message thread: parameter is NULL");
 	}
+	else if (handleData->max_batch_size != 0 &&
+		(batch = (BATCH_ENTRY*)malloc(handleData->max_batch_size * sizeof(BATCH_ENTRY))) == NULL)
+	{
+		LogError("unable to allocate a batch of %u messages", handleData->max_batch_size);
+	}
+	else if (handleData->max_batch_linger != 0 &&
+		(tick_counter = tickcounter_create()) == NULL)
+	{
+		LogError("unable to create a tick counter for the batch linger");
+	}
+	/*Codes_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
+	else if (Lock(handleData->handle_lock) != LOCK_OK)
+	{
+		LogError("unable to Lock");
+	}
 	else
 	{
+		int is_locked = 1;
 		int should_continue = 1;
 
 		while (should_continue)
 		{
-			/*Codes_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
-			if (Lock(handleData->message_send_thread.thread_lock) != LOCK_OK)
+			if (outgoing_thread_should_stop(handleData))
 			{
-				LogError("unable to Lock");
 				should_continue = 0;
-				break;
 			}
-			if (handleData->message_send_thread.thread_flag == THREAD_FLAG_STOP)
+			else if (MESSAGE_QUEUE_is_empty(handleData->outgoing_messages))
 			{
-				should_continue = 0;
-				(void)Unlock(handleData->message_send_thread.thread_lock);
-				break;
-			}
-			if (Unlock(handleData->message_send_thread.thread_lock) != LOCK_OK)
-			{
-				should_continue = 0;
-				break;
-			}
-			MESSAGE_HANDLE messageHandle;
-			/*Codes_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
-			if (Lock(handleData->handle_lock) != LOCK_OK)
-			{
-				LogError("unable to Lock");
-				should_continue = 0;
-				break;
-			}
-			
-			if (MESSAGE_QUEUE_is_empty(handleData->outgoing_messages))
-			{
-				messageHandle = NULL;
+				/*Codes_SRS_OUTPROCESS_MODULE_30_002: [ When the outgoing gateway message queue is empty, this thread shall wait on the outgoing message condition until a message is queued or the thread is signaled to close. ]*/
+				if (Condition_Wait(handleData->outgoing_messages_cond, handleData->handle_lock, 0) != COND_OK)
+				{
+					LogError("unable to wait for outgoing messages");
+					should_continue = 0;
+				}
 			}
 			else
 			{
+				size_t dropped = 0;
 				/*Codes_SRS_OUTPROCESS_MODULE_17_054: [ This function shall remove the oldest message from the outgoing gateway message queue. ]*/
-				messageHandle = MESSAGE_QUEUE_pop(handleData->outgoing_messages);
+				MESSAGE_HANDLE messageHandle = pop_outgoing_message(handleData, &dropped);
 				if (messageHandle == NULL)
 				{
 					LogError("bad condition: message handle in queue is NULL");
-					(void)Unlock(handleData->handle_lock);
 					should_continue = 0;
-					break;
 				}
-			}
-			if (Unlock(handleData->handle_lock) != LOCK_OK)
-			{
-				should_continue = 0;
-				break;
-			}
-
-			/* forward message to remote */
-			if (messageHandle != NULL)
-			{
-				/*Codes_SRS_OUTPROCESS_MODULE_17_023: [ This function shall serialize the message for transmission on the message channel. ]*/
-				int32_t msg_size = Message_ToByteArray(messageHandle, NULL, 0);
-				if (msg_size < 0)
+				else if (batch != NULL)
 				{
-					LogError("unable to serialize outgoing message [%p]", messageHandle);
+					/*Codes_SRS_OUTPROCESS_MODULE_30_024: [ If the message channel is batched, this thread shall remove up to max_batch_size messages from the outgoing gateway message queue and send them in one frame. ]*/
+					batch[0].message = messageHandle;
+					size_t count = collect_message_batch(handleData, batch, tick_counter, &dropped);
+					if (Unlock(handleData->handle_lock) != LOCK_OK)
+					{
+						should_continue = 0;
+					}
+					is_locked = 0;
+					log_dropped_messages(dropped);
+
+					send_message_batch(handleData, batch, count);
+
+					if (should_continue)
+					{
+						if (Lock(handleData->handle_lock) != LOCK_OK)
+						{
+							LogError("unable to Lock");
+							should_continue = 0;
+						}
+						else
+						{
+							is_locked = 1;
+						}
+					}
 				}
 				else
 				{
-					void* result = nn_allocmsg(msg_size, 0);
-					if (result == NULL)
+					/*the socket is written without the lock so Outprocess_Receive can keep queueing*/
+					if (Unlock(handleData->handle_lock) != LOCK_OK)
+					{
+						should_continue = 0;
+					}
+					is_locked = 0;
+					log_dropped_messages(dropped);
+
+					/* forward message to remote */
+					/*Codes_SRS_OUTPROCESS_MODULE_17_023: [ This function shall serialize the message for transmission on the message channel. ]*/
+					int32_t msg_size = Message_ToByteArray(messageHandle, NULL, 0);
+					if (msg_size < 0)
+					{
+						LogError("unable to serialize outgoing message [%p]", messageHandle);
+					}
+					else if (handleData->message_channel != NULL)
 					{
-						LogError("unable to allocate buffer for outgoing message [%p]", messageHandle);
+						/*Codes_SRS_OUTPROCESS_MODULE_30_007: [ If the message channel is a shared memory channel, this function shall serialize the message directly into the outgoing ring, waiting for room until the channel is closed. ]*/
+						GATEWAY_TRACE(GATEWAY_TRACE_SEND_BEGIN, messageHandle, handleData);
+						unsigned char *ring_bytes = ShmChannel_BeginSend(handleData->message_channel, msg_size, -1);
+						if (ring_bytes == NULL)
+						{
+							LogError("unable to send message [%p] on the shared memory channel", messageHandle);
+						}
+						else
+						{
+							Message_ToByteArray(messageHandle, ring_bytes, msg_size);
+							ShmChannel_EndSend(handleData->message_channel);
+						}
+						GATEWAY_TRACE(GATEWAY_TRACE_SEND_END, messageHandle, handleData);
 					}
 					else
 					{
-						unsigned char *nn_msg_bytes = (unsigned char *)result;
-						Message_ToByteArray(messageHandle, nn_msg_bytes, msg_size);
-						/*Codes_SRS_OUTPROCESS_MODULE_17_024: [ This function shall send the message on the message channel. ]*/
-						int nbytes = nn_send(handleData->message_socket, &result, NN_MSG, 0);
-						if (nbytes != msg_size)
+						void* result = nn_allocmsg(msg_size, 0);
+						if (result == NULL)
 						{
-							LogError("unable to send buffer to remote for message [%p]", messageHandle);
-							/*Codes_SRS_OUTPROCESS_MODULE_17_025: [ This function shall free any resources created. ]*/
-							nn_freemsg(result);
+							LogError("unable to allocate buffer for outgoing message [%p]", messageHandle);
+						}
+						else
+						{
+							unsigned char *nn_msg_bytes = (unsigned char *)result;
+							Message_ToByteArray(messageHandle, nn_msg_bytes, msg_size);
+							/*Codes_SRS_OUTPROCESS_MODULE_17_024: [ This function shall send the message on the message channel. ]*/
+							GATEWAY_TRACE(GATEWAY_TRACE_SEND_BEGIN, messageHandle, handleData);
+							int nbytes = nn_send(handleData->message_socket, &result, NN_MSG, 0);
+							GATEWAY_TRACE(GATEWAY_TRACE_SEND_END, messageHandle, handleData);
+							if (nbytes != msg_size)
+							{
+								LogError("unable to send buffer to remote for message [%p]", messageHandle);
+								/*Codes_SRS_OUTPROCESS_MODULE_17_025: [ This function shall free any resources created. ]*/
+								nn_freemsg(result);
+							}
+						}
+					}
+					// We are finally finished with this message
+					/*Codes_SRS_OUTPROCESS_MODULE_17_055: [ This function shall Destroy the message once successfully transmitted. ]*/
+					Message_Destroy(messageHandle);
+
+					if (should_continue)
+					{
+						if (Lock(handleData->handle_lock) != LOCK_OK)
+						{
+							LogError("unable to Lock");
+							should_continue = 0;
+						}
+						else
+						{
+							is_locked = 1;
 						}
 					}
 				}
-				// We are finally finished with this message
-				/*Codes_SRS_OUTPROCESS_MODULE_17_055: [ This function shall Destroy the message once successfully transmitted. ]*/
-				Message_Destroy(messageHandle);
 			}
-			ThreadAPI_Sleep(1);
 		}
+
+		if (is_locked)
+		{
+			(void)Unlock(handleData->handle_lock);
+		}
+	}
+	free(batch);
+	if (tick_counter != NULL)
+	{
+		tickcounter_destroy(tick_counter);
 	}
 	return 0;
 }
@@ -459,50 +786,74 @@ static int connection_setup(OUTPROCESS_HANDLE_DATA* handleData, OUTPROCESS_MODUL
 {
 	int result;
 	handleData->control_socket = -1;
+	handleData->message_channel = NULL;
 	/*
 	* Start with messaging socket.
 	*/
-	/*Codes_SRS_OUTPROCESS_MODULE_17_008: [ This function shall create a pair socket for sending gateway messages to the module host. ]*/
-	handleData->message_socket = nn_socket(AF_SP, NN_PAIR);
-	if (handleData->message_socket < 0)
+	if (config->message_channel == OUTPROCESS_MESSAGE_CHANNEL_SHM)
 	{
-		result = handleData->message_socket;
-		LogError("message socket failed to create, result = %d, errno = %d", result, nn_errno());
+		/*Codes_SRS_OUTPROCESS_MODULE_30_008: [ If the message_channel of the configuration is OUTPROCESS_MESSAGE_CHANNEL_SHM, this function shall create a shared memory channel named by the message_uri instead of the message channel pair socket. ]*/
+		handleData->message_socket = -1;
+		handleData->message_channel = ShmChannel_Create(STRING_c_str(config->message_uri), SHM_CHANNEL_RING_SIZE_DEFAULT);
+		if (handleData->message_channel == NULL)
+		{
+			result = -1;
+			LogError("unable to create the shared memory message channel");
+		}
+		else
+		{
+			result = 0;
+		}
 	}
 	else
 	{
-		/*Codes_SRS_OUTPROCESS_MODULE_17_009: [ This function shall bind and connect the pair socket to the message_uri. ]*/
-		int message_bind_id = nn_connect(handleData->message_socket, STRING_c_str(config->message_uri));
-		if (message_bind_id < 0)
+		/*Codes_SRS_OUTPROCESS_MODULE_17_008: [ This function shall create a pair socket for sending gateway messages to the module host. ]*/
+		handleData->message_socket = nn_socket(AF_SP, NN_PAIR);
+		if (handleData->message_socket < 0)
+		{
+			result = handleData->message_socket;
+			LogError("message socket failed to create, result = %d, errno = %d", result, nn_errno());
+		}
+		else
+		{
+			/*Codes_SRS_OUTPROCESS_MODULE_17_009: [ This function shall bind and connect the pair socket to the message_uri. ]*/
+			int message_bind_id = nn_connect(handleData->message_socket, STRING_c_str(config->message_uri));
+			if (message_bind_id < 0)
+			{
+				result = message_bind_id;
+				LogError("remote socket failed to bind to message URL, result = %d, errno = %d", result, nn_errno());
+			}
+			else
+			{
+				result = 0;
+			}
+		}
+	}
+
+	if (result == 0)
+	{
+		/*
+		* Now, the control socket.
+		*/
+		/*Codes_SRS_OUTPROCESS_MODULE_17_010: [ This function shall create a request/reply socket for sending control messages to the module host. ]*/
+		handleData->control_socket = nn_socket(AF_SP, NN_PAIR);
+		if (handleData->control_socket < 0)
 		{
-			result = message_bind_id;
-			LogError("remote socket failed to bind to message URL, result = %d, errno = %d", result, nn_errno());
+			result = handleData->control_socket;
+			LogError("remote socket failed to connect to control URL, result = %d, errno = %d", result, nn_errno());
 		}
 		else
 		{
-			/*
-			* Now, the control socket.
-			*/
-			/*Codes_SRS_OUTPROCESS_MODULE_17_010: [ This function shall create a request/reply socket for sending control messages to the module host. ]*/
-			handleData->control_socket = nn_socket(AF_SP, NN_PAIR);
-			if (handleData->control_socket < 0)
+			/*Codes_SRS_OUTPROCESS_MODULE_17_011: [ This function shall connect the request/reply socket to the control_id. ]*/
+			int control_connect_id = nn_connect(handleData->control_socket, STRING_c_str(config->control_uri));
+			if (control_connect_id < 0)
 			{
-				result = handleData->control_socket;
+				result = control_connect_id;
 				LogError("remote socket failed to connect to control URL, result = %d, errno = %d", result, nn_errno());
 			}
 			else
 			{
-				/*Codes_SRS_OUTPROCESS_MODULE_17_011: [ This function shall connect the request/reply socket to the control_id. ]*/
-				int control_connect_id = nn_connect(handleData->control_socket, STRING_c_str(config->control_uri));
-				if (control_connect_id < 0)
-				{
-					result = control_connect_id;
-					LogError("remote socket failed to connect to control URL, result = %d, errno = %d", result, nn_errno());
-				}
-				else
-				{
-					result = 0;
-				}
+				result = 0;
 			}
 		}
 	}
@@ -519,9 +870,22 @@ static void connection_teardown(OUTPROCESS_HANDLE_DATA* handleData)
 		(void)nn_close(handleData->message_socket);
 	if (handleData->control_socket >= 0)
 		(void)nn_close(handleData->control_socket);
+	/*Codes_SRS_OUTPROCESS_MODULE_30_009: [ This function shall close the shared memory channel, if any, so the message threads stop waiting on it. ]*/
+	if (handleData->message_channel != NULL)
+		ShmChannel_Close(handleData->message_channel);
 	(void)Unlock(handleData->handle_lock);
 }
 
+/*the shared memory channel stays mapped until no thread can use it anymore*/
+static void connection_release(OUTPROCESS_HANDLE_DATA* handleData)
+{
+	if (handleData->message_channel != NULL)
+	{
+		ShmChannel_Destroy(handleData->message_channel);
+		handleData->message_channel = NULL;
+	}
+}
+
 
 
 /**/
@@ -555,9 +919,9 @@ static void* serialize_control_message(CONTROL_MESSAGE * msg, int32_t * theMessa
 	return result;
 }
 
-static void* construct_create_message(OUTPROCESS_HANDLE_DATA* handleData, int32_t * creationMessageSize)
+static int fill_create_message(OUTPROCESS_HANDLE_DATA* handleData, CONTROL_MESSAGE_MODULE_CREATE * create_msg)
 {
-	void * result;
+	int result;
 	uint32_t uri_length = STRING_length(handleData->message_uri);
 	char * uri_string = (char*)STRING_c_str(handleData->message_uri);
 	uint32_t args_length = STRING_length(handleData->module_args);
@@ -565,27 +929,36 @@ static void* construct_create_message(OUTPROCESS_HANDLE_DATA* handleData, int32_
 	if (uri_length == 0 || uri_string == NULL || 
 		args_length == 0 || args_string == NULL)
 	{
-		result = NULL;
+		result = __LINE__;
 	}
 	else
 	{
 		/*Codes_SRS_OUTPROCESS_MODULE_17_012: [ This function shall construct a Create Message from configuration. ]*/
+		create_msg->base.version = CONTROL_MESSAGE_VERSION_CURRENT;
+		create_msg->base.type = CONTROL_MESSAGE_TYPE_MODULE_CREATE;
+		/*Codes_SRS_OUTPROCESS_MODULE_30_021: [ The gateway_message_version of the Create Message shall be GATEWAY_MESSAGE_VERSION_BATCHED if the message channel is batched, and GATEWAY_MESSAGE_VERSION_CURRENT otherwise. ]*/
+		create_msg->gateway_message_version = (handleData->max_batch_size != 0) ? GATEWAY_MESSAGE_VERSION_BATCHED : GATEWAY_MESSAGE_VERSION_CURRENT;
+		create_msg->uri.uri_size = uri_length + 1;	/*(+1 for null)*/
+		/*Codes_SRS_OUTPROCESS_MODULE_30_011: [ The uri_type of the Create Message shall be SHM_CHANNEL_URI_TYPE for a shared memory channel and NN_PAIR otherwise. ]*/
+		create_msg->uri.uri_type = (uint8_t)((handleData->message_channel != NULL) ? SHM_CHANNEL_URI_TYPE : NN_PAIR);
+		create_msg->uri.uri = uri_string;
+		create_msg->args_size = args_length + 1;	/*(+1 for null)*/
+		create_msg->args = args_string;
+		result = 0;
+	}
+	return result;
+}
 
-		CONTROL_MESSAGE_MODULE_CREATE create_msg =
-		{
-			{
-				CONTROL_MESSAGE_VERSION_CURRENT,	/*version*/
-				CONTROL_MESSAGE_TYPE_MODULE_CREATE	/*type*/
-			},
-			GATEWAY_MESSAGE_VERSION_CURRENT,		/*gateway_message_version*/
-			{
-				uri_length + 1,						/*uri_size (+1 for null)*/
-				(uint8_t)NN_PAIR,					/*uri_type*/
-				uri_string							/*uri*/
-			},
-			args_length + 1,	/*args_size;(+1 for null)*/
-			args_string			/*args;*/
-		};
+static void* construct_create_message(OUTPROCESS_HANDLE_DATA* handleData, int32_t * creationMessageSize)
+{
+	void * result;
+	CONTROL_MESSAGE_MODULE_CREATE create_msg;
+	if (fill_create_message(handleData, &create_msg) != 0)
+	{
+		result = NULL;
+	}
+	else
+	{
 		result = serialize_control_message((CONTROL_MESSAGE *)&create_msg, creationMessageSize);
 	}
 	return result;
@@ -693,6 +1066,198 @@ static void delete_strings(OUTPROCESS_HANDLE_DATA * handleData)
 	STRING_delete(handleData->module_args);
 }
 
+/* Multiplexed modules
+*/
+
+#define LINK_CREATE_PENDING -1
+
+static int send_link_create_and_start(OUTPROCESS_HANDLE_DATA* handleData, int send_start)
+{
+	int result;
+	CONTROL_MESSAGE_MODULE_CREATE create_msg;
+	CONTROL_MESSAGE start_msg =
+	{
+		CONTROL_MESSAGE_VERSION_CURRENT,	/*version*/
+		CONTROL_MESSAGE_TYPE_MODULE_START	/*type*/
+	};
+	if (fill_create_message(handleData, &create_msg) != 0)
+	{
+		LogError("Unable to create create control message");
+		result = __LINE__;
+	}
+	/*Codes_SRS_OUTPROCESS_MODULE_30_013: [ This function shall send the Create Message on the link. ]*/
+	else if (OutprocessLink_SendControl(handleData->link_endpoint, (CONTROL_MESSAGE*)&create_msg) != 0)
+	{
+		LogError("unable to send create message on the link");
+		result = __LINE__;
+	}
+	else if (send_start && OutprocessLink_SendControl(handleData->link_endpoint, &start_msg) != 0)
+	{
+		LogError("unable to send start message on the link");
+		result = __LINE__;
+	}
+	else
+	{
+		result = 0;
+	}
+	return result;
+}
+
+static void on_link_message(void* context, MESSAGE_HANDLE message)
+{
+	OUTPROCESS_HANDLE_DATA* handleData = (OUTPROCESS_HANDLE_DATA*)context;
+	/*Codes_SRS_OUTPROCESS_MODULE_30_016: [ A gateway message received on the link shall be published to the broker. ]*/
+	if (Broker_Publish(handleData->broker, (MODULE_HANDLE)handleData, message) != BROKER_OK)
+	{
+		LogError("unable to publish message [%p] from the module host", message);
+	}
+}
+
+static void on_link_control(void* context, CONTROL_MESSAGE* message)
+{
+	OUTPROCESS_HANDLE_DATA* handleData = (OUTPROCESS_HANDLE_DATA*)context;
+	if (message->type == CONTROL_MESSAGE_TYPE_MODULE_REPLY)
+	{
+		CONTROL_MESSAGE_MODULE_REPLY * resp_msg = (CONTROL_MESSAGE_MODULE_REPLY*)message;
+		if (Lock(handleData->handle_lock) != LOCK_OK)
+		{
+			LogError("unable to Lock handle data");
+		}
+		else
+		{
+			if (handleData->link_create_status == LINK_CREATE_PENDING)
+			{
+				/*Codes_SRS_OUTPROCESS_MODULE_30_014: [ The first Module Reply received on the link shall complete the creation, which succeeds if its status is 0. ]*/
+				handleData->link_create_status = resp_msg->status;
+				(void)Condition_Post(handleData->outgoing_messages_cond);
+			}
+			else if (resp_msg->status != 0)
+			{
+				/*Codes_SRS_OUTPROCESS_MODULE_30_017: [ If a later Module Reply indicates the module has failed or has been terminated, the module shall send a Create Message and a Start Message on the link again. ]*/
+				if (send_link_create_and_start(handleData, 1) != 0)
+				{
+					LogError("attempting to reattach to remote failed");
+				}
+			}
+			(void)Unlock(handleData->handle_lock);
+		}
+	}
+}
+
+static void free_link_module(OUTPROCESS_HANDLE_DATA* handleData)
+{
+	delete_strings(handleData);
+	Condition_Deinit(handleData->outgoing_messages_cond);
+	(void)Lock_Deinit(handleData->handle_lock);
+	free(handleData);
+}
+
+static MODULE_HANDLE Outprocess_CreateMultiplexed(BROKER_HANDLE broker, OUTPROCESS_MODULE_CONFIG * config)
+{
+	OUTPROCESS_HANDLE_DATA * module = (OUTPROCESS_HANDLE_DATA*)malloc(sizeof(OUTPROCESS_HANDLE_DATA));
+	if (module == NULL)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
+		LogError("allocation for module failed.");
+	}
+	else
+	{
+		memset(module, 0, sizeof(OUTPROCESS_HANDLE_DATA));
+		module->message_socket = -1;
+		module->control_socket = -1;
+		module->broker = broker;
+		module->remote_message_wait = config->remote_message_wait;
+		module->lifecyle_model = config->lifecycle_model;
+		module->link_create_status = LINK_CREATE_PENDING;
+
+		if ((module->handle_lock = Lock_Init()) == NULL)
+		{
+			LogError("unable to intialize module lock");
+			free(module);
+			module = NULL;
+		}
+		else if ((module->outgoing_messages_cond = Condition_Init()) == NULL)
+		{
+			LogError("unable to intialize the create reply condition");
+			Lock_Deinit(module->handle_lock);
+			free(module);
+			module = NULL;
+		}
+		else if (save_strings(module, config) != 0)
+		{
+			LogError("unable to save the module configuration");
+			Condition_Deinit(module->outgoing_messages_cond);
+			Lock_Deinit(module->handle_lock);
+			free(module);
+			module = NULL;
+		}
+		/*Codes_SRS_OUTPROCESS_MODULE_30_012: [ If the configuration is multiplexed, this function shall attach the module to the link of its control URI instead of creating sockets and threads of its own. ]*/
+		else if ((module->link_endpoint = OutprocessLink_Attach(STRING_c_str(module->control_uri), STRING_c_str(module->message_uri), on_link_message, on_link_control, module)) == NULL)
+		{
+			LogError("unable to attach to the module host link");
+			free_link_module(module);
+			module = NULL;
+		}
+		else if (Lock(module->handle_lock) != LOCK_OK)
+		{
+			LogError("unable to Lock handle data");
+			OutprocessLink_Detach(module->link_endpoint);
+			free_link_module(module);
+			module = NULL;
+		}
+		else
+		{
+			int create_status;
+			if (send_link_create_and_start(module, 0) != 0)
+			{
+				create_status = -1;
+			}
+			else if (module->lifecyle_model == OUTPROCESS_LIFECYCLE_SYNC)
+			{
+				/*Codes_SRS_OUTPROCESS_MODULE_30_015: [ If the lifecycle model is synchronous, this function shall wait for the Module Reply to the Create Message. ]*/
+				while (module->link_create_status == LINK_CREATE_PENDING)
+				{
+					(void)Condition_Wait(module->outgoing_messages_cond, module->handle_lock, (int)module->remote_message_wait);
+				}
+				create_status = module->link_create_status;
+			}
+			else
+			{
+				create_status = 0;
+			}
+			(void)Unlock(module->handle_lock);
+
+			if (create_status != 0)
+			{
+				/*Codes_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
+				LogError("module host failed to create the module");
+				OutprocessLink_Detach(module->link_endpoint);
+				free_link_module(module);
+				module = NULL;
+			}
+		}
+	}
+	return module;
+}
+
+static void Outprocess_DestroyMultiplexed(OUTPROCESS_HANDLE_DATA* handleData)
+{
+	CONTROL_MESSAGE destroy_msg =
+	{
+		CONTROL_MESSAGE_VERSION_CURRENT,	/*version*/
+		CONTROL_MESSAGE_TYPE_MODULE_DESTROY	/*type*/
+	};
+	/*Codes_SRS_OUTPROCESS_MODULE_30_018: [ For a multiplexed module, this function shall send the Destroy Message on the link and detach the module from the link. ]*/
+	if (OutprocessLink_SendControl(handleData->link_endpoint, &destroy_msg) != 0)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_17_048: [ There is a possibility the module host process is no longer operational, therefore sending the destroy the Destroy Message shall be a best effort attempt. ]*/
+		LogError("unable to send destroy control message, continuing with module destroy");
+	}
+	OutprocessLink_Detach(handleData->link_endpoint);
+	/*Codes_SRS_OUTPROCESS_MODULE_17_034: [ This function shall release all resources created by this module. ]*/
+	free_link_module(handleData);
+}
+
 static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configuration)
 {
 	OUTPROCESS_HANDLE_DATA * module;
@@ -705,6 +1270,10 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 		LogError("invalid arguments for outprcess module. broker=[%p], configuration = [%p]", broker, configuration);
 		module = NULL;
 	}
+	else if (((OUTPROCESS_MODULE_CONFIG*)configuration)->multiplexed)
+	{
+		module = Outprocess_CreateMultiplexed(broker, (OUTPROCESS_MODULE_CONFIG*)configuration);
+	}
 	else
 	{
 		OUTPROCESS_MODULE_CONFIG * config = (OUTPROCESS_MODULE_CONFIG*)configuration;
@@ -744,6 +1313,7 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 						/*Codes_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
 						LogError("unable to set up connections");
 						connection_teardown(module);
+						connection_release(module);
 						MESSAGE_QUEUE_destroy(module->outgoing_messages);
 						Lock_Deinit(module->handle_lock);
 						free(module);
@@ -759,6 +1329,17 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 						};
 						module->broker = broker;
 						module->remote_message_wait = config->remote_message_wait;
+						module->link_endpoint = NULL;
+						/*Codes_SRS_OUTPROCESS_MODULE_30_026: [ This function shall batch the message channel if max_batch_size of the configuration is greater than 1 and the message channel is not a shared memory channel. ]*/
+						module->max_batch_size = (config->max_batch_size > 1 && module->message_channel == NULL) ? config->max_batch_size : 0;
+						module->max_batch_linger = (module->max_batch_size != 0) ? config->max_batch_linger : 0;
+						module->outgoing_limits_known = 0;
+						module->outgoing_limits.capacity = 0;
+						module->outgoing_limits.overflow = BROKER_OVERFLOW_BLOCK;
+						module->outgoing_limits.coalesce_key = NULL;
+						module->outgoing_space_cond = NULL;
+						module->outgoing_depth = 0;
+						module->outgoing_dropped = 0;
 						module->message_receive_thread = default_thread;
 						module->message_send_thread = default_thread;
 						module->control_thread = default_thread;
@@ -769,6 +1350,7 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 						if ((module->message_receive_thread.thread_lock = Lock_Init()) == NULL)
 						{
 							connection_teardown(module);
+							connection_release(module);
 							MESSAGE_QUEUE_destroy(module->outgoing_messages);
 							Lock_Deinit(module->handle_lock);
 							free(module);
@@ -777,6 +1359,7 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 						else if ((module->control_thread.thread_lock = Lock_Init()) == NULL)
 						{
 							connection_teardown(module);
+							connection_release(module);
 							MESSAGE_QUEUE_destroy(module->outgoing_messages);
 							Lock_Deinit(module->message_receive_thread.thread_lock);
 							Lock_Deinit(module->handle_lock);
@@ -786,6 +1369,7 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 						else if ((module->async_create_thread.thread_lock = Lock_Init()) == NULL)
 						{
 							connection_teardown(module);
+							connection_release(module);
 							MESSAGE_QUEUE_destroy(module->outgoing_messages);
 							Lock_Deinit(module->control_thread.thread_lock);
 							Lock_Deinit(module->message_receive_thread.thread_lock);
@@ -796,6 +1380,7 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 						else if ((module->message_send_thread.thread_lock = Lock_Init()) == NULL)
 						{
 							connection_teardown(module);
+							connection_release(module);
 							MESSAGE_QUEUE_destroy(module->outgoing_messages);
 							Lock_Deinit(module->async_create_thread.thread_lock);
 							Lock_Deinit(module->control_thread.thread_lock);
@@ -804,10 +1389,27 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 							free(module);
 							module = NULL;
 						}
+						/*Codes_SRS_OUTPROCESS_MODULE_30_003: [ This function shall initialize a condition to signal the outgoing gateway message thread when a message is queued. ]*/
+						else if ((module->outgoing_messages_cond = Condition_Init()) == NULL)
+						{
+							LogError("unable to intialize outgoing message condition");
+							connection_teardown(module);
+							connection_release(module);
+							MESSAGE_QUEUE_destroy(module->outgoing_messages);
+							Lock_Deinit(module->async_create_thread.thread_lock);
+							Lock_Deinit(module->control_thread.thread_lock);
+							Lock_Deinit(module->message_receive_thread.thread_lock);
+							Lock_Deinit(module->message_send_thread.thread_lock);
+							Lock_Deinit(module->handle_lock);
+							free(module);
+							module = NULL;
+						}
 						else if (save_strings(module, config) != 0)
 						{
 							connection_teardown(module);
+							connection_release(module);
 							MESSAGE_QUEUE_destroy(module->outgoing_messages);
+							Condition_Deinit(module->outgoing_messages_cond);
 							Lock_Deinit(module->async_create_thread.thread_lock);
 							Lock_Deinit(module->control_thread.thread_lock);
 							Lock_Deinit(module->message_receive_thread.thread_lock);
@@ -826,8 +1428,10 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 								LogError("failed to spawn a thread");
 								module->async_create_thread.thread_handle = NULL;
 								connection_teardown(module);
+								connection_release(module);
 								delete_strings(module);
 								MESSAGE_QUEUE_destroy(module->outgoing_messages);
+								Condition_Deinit(module->outgoing_messages_cond);
 								Lock_Deinit(module->async_create_thread.thread_lock);
 								Lock_Deinit(module->control_thread.thread_lock);
 								Lock_Deinit(module->message_receive_thread.thread_lock);
@@ -862,8 +1466,10 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 								{
 									/*Codes_SRS_OUTPROCESS_MODULE_17_016: [ If any step in the creation fails, this function shall deallocate all resources and return NULL. ]*/
 									connection_teardown(module);
+									connection_release(module);
 									delete_strings(module);
 									MESSAGE_QUEUE_destroy(module->outgoing_messages);
+									Condition_Deinit(module->outgoing_messages_cond);
 									Lock_Deinit(module->async_create_thread.thread_lock);
 									Lock_Deinit(module->control_thread.thread_lock);
 									Lock_Deinit(module->message_receive_thread.thread_lock);
@@ -918,11 +1524,39 @@ static void shutdown_a_thread(THREAD_CONTROL * theThreadControl)
 	(void)Lock_Deinit(theThreadControl->thread_lock);
 }
 
+static void stop_outgoing_thread(OUTPROCESS_HANDLE_DATA* handleData)
+{
+	/*the flag is set under the handle lock, so the thread either sees it before it waits or is waiting when the condition is signaled*/
+	if (Lock(handleData->handle_lock) != LOCK_OK)
+	{
+		LogError("unable to Lock handle data");
+	}
+	else
+	{
+		if (Lock(handleData->message_send_thread.thread_lock) != LOCK_OK)
+		{
+			LogError("unable to Lock");
+		}
+		else
+		{
+			handleData->message_send_thread.thread_flag = THREAD_FLAG_STOP;
+			(void)Unlock(handleData->message_send_thread.thread_lock);
+		}
+		/*Codes_SRS_OUTPROCESS_MODULE_30_005: [ This function shall signal the outgoing message condition so the outgoing gateway message thread stops waiting for messages. ]*/
+		(void)Condition_Post(handleData->outgoing_messages_cond);
+		(void)Unlock(handleData->handle_lock);
+	}
+}
+
 static void Outprocess_Destroy(MODULE_HANDLE moduleHandle)
 {
 	OUTPROCESS_HANDLE_DATA* handleData = moduleHandle;
 	/*Codes_SRS_OUTPROCESS_MODULE_17_026: [ If module is NULL, this function shall do nothing. ]*/
-	if (handleData != NULL)
+	if (handleData != NULL && handleData->link_endpoint != NULL)
+	{
+		Outprocess_DestroyMultiplexed(handleData);
+	}
+	else if (handleData != NULL)
 	{
 		/*tell remote module to stop*/
 		int32_t messageSize = 0;
@@ -967,24 +1601,146 @@ static void Outprocess_Destroy(MODULE_HANDLE moduleHandle)
 		/*Codes_SRS_OUTPROCESS_MODULE_17_032: [ This function shall signal the messaging thread to close. ]*/
 		shutdown_a_thread(&(handleData->message_receive_thread));
 		/*Codes_SRS_OUTPROCESS_MODULE_17_049: [ This function shall signal the outgoing gateway message thread to close. ]*/
+		stop_outgoing_thread(handleData);
 		shutdown_a_thread(&(handleData->message_send_thread));
 		/*Codes_SRS_OUTPROCESS_MODULE_17_050: [ This function shall signal the control thread to close. ]*/
 		shutdown_a_thread(&(handleData->control_thread));
 		shutdown_a_thread(&(handleData->async_create_thread));
+		/*Codes_SRS_OUTPROCESS_MODULE_30_010: [ This function shall unmap the shared memory channel, if any, once the threads have completed. ]*/
+		connection_release(handleData);
 
 		/* Free remaining resources */
 		/*Codes_SRS_OUTPROCESS_MODULE_17_034: [ This function shall release all resources created by this module. ]*/
 		delete_strings(handleData);
+		Condition_Deinit(handleData->outgoing_messages_cond);
+		if (handleData->outgoing_space_cond != NULL)
+		{
+			Condition_Deinit(handleData->outgoing_space_cond);
+		}
 		(void)Lock_Deinit(handleData->handle_lock);
 		free(handleData);
 	}
 }
 
+/*what BROKER_OVERFLOW_COALESCE looks for in a full outgoing queue*/
+typedef struct OUTGOING_COALESCE_MATCH_TAG
+{
+	const char* key;
+	const char* value;
+} OUTGOING_COALESCE_MATCH;
+
+static bool outgoing_coalesce_match(MESSAGE_HANDLE message, const void* match_context)
+{
+	const OUTGOING_COALESCE_MATCH* match = (const OUTGOING_COALESCE_MATCH*)match_context;
+	const char* value = Message_GetProperty(message, match->key);
+	return (value != NULL) && (strcmp(value, match->value) == 0);
+}
+
+/*called with the handle lock held, the module is attached to the broker by the time it receives a message*/
+static void read_outgoing_limits(OUTPROCESS_HANDLE_DATA* handleData)
+{
+	BROKER_MAILBOX_OPTIONS limits = { 0, BROKER_OVERFLOW_BLOCK, NULL };
+	/*Codes_SRS_OUTPROCESS_MODULE_30_027: [ The first time it is called, this function shall read the limits of the mailbox of the module by calling Broker_GetModuleMailbox and apply them to the outgoing gateway message queue. ]*/
+	if (Broker_GetModuleMailbox(handleData->broker, (MODULE_HANDLE)handleData, &limits) != BROKER_OK)
+	{
+		LogError("unable to read the mailbox limits of the module, the outgoing queue is unbounded for now");
+	}
+	else if (limits.capacity != 0 &&
+		limits.overflow == BROKER_OVERFLOW_BLOCK &&
+		(handleData->outgoing_space_cond = Condition_Init()) == NULL)
+	{
+		LogError("unable to create the outgoing space condition, the outgoing queue is unbounded for now");
+	}
+	else
+	{
+		handleData->outgoing_limits = limits;
+		handleData->outgoing_limits_known = 1;
+	}
+}
+
+/*called with the handle lock held, takes ownership of message*/
+static void queue_outgoing_message(OUTPROCESS_HANDLE_DATA* handleData, MESSAGE_HANDLE message)
+{
+	size_t capacity = handleData->outgoing_limits.capacity;
+	BROKER_OVERFLOW_POLICY overflow = handleData->outgoing_limits.overflow;
+
+	if (capacity != 0 && handleData->outgoing_depth >= capacity && overflow == BROKER_OVERFLOW_BLOCK)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_30_028: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_BLOCK, this function shall wait up to OUTGOING_BLOCK_TIMEOUT_MS milliseconds for room, then destroy the message and count it as dropped. ]*/
+		COND_RESULT wait_result = COND_OK;
+		while (handleData->outgoing_depth >= capacity && wait_result == COND_OK)
+		{
+			wait_result = Condition_Wait(handleData->outgoing_space_cond, handleData->handle_lock, OUTGOING_BLOCK_TIMEOUT_MS);
+		}
+	}
+
+	if (capacity != 0 && handleData->outgoing_depth >= capacity && overflow == BROKER_OVERFLOW_DROP_OLDEST)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_30_029: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_DROP_OLDEST, this function shall remove and destroy the oldest message of the queue and count it as dropped. ]*/
+		MESSAGE_HANDLE oldest = MESSAGE_QUEUE_pop(handleData->outgoing_messages);
+		if (oldest != NULL)
+		{
+			Message_Destroy(oldest);
+			handleData->outgoing_depth--;
+			handleData->outgoing_dropped++;
+		}
+	}
+
+	if (capacity != 0 && handleData->outgoing_depth >= capacity && overflow == BROKER_OVERFLOW_COALESCE)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_30_030: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_COALESCE, this function shall replace the oldest queued message that has the same value for the coalesce key property by calling MESSAGE_QUEUE_replace_if and destroy the replaced message, or destroy the message and count it as dropped if none matches. ]*/
+		OUTGOING_COALESCE_MATCH match;
+		MESSAGE_HANDLE replaced = NULL;
+		match.key = handleData->outgoing_limits.coalesce_key;
+		match.value = Message_GetProperty(message, match.key);
+		if (match.value != NULL)
+		{
+			replaced = MESSAGE_QUEUE_replace_if(handleData->outgoing_messages, outgoing_coalesce_match, &match, message);
+		}
+		if (replaced != NULL)
+		{
+			Message_Destroy(replaced);
+		}
+		else
+		{
+			Message_Destroy(message);
+			handleData->outgoing_dropped++;
+		}
+	}
+	else if (capacity != 0 && handleData->outgoing_depth >= capacity)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_30_028: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_BLOCK, this function shall wait up to OUTGOING_BLOCK_TIMEOUT_MS milliseconds for room, then destroy the message and count it as dropped. ]*/
+		/*Codes_SRS_OUTPROCESS_MODULE_30_033: [ If the outgoing gateway message queue is full and the overflow policy is BROKER_OVERFLOW_DROP_NEWEST, this function shall destroy the message and count it as dropped. ]*/
+		Message_Destroy(message);
+		handleData->outgoing_dropped++;
+	}
+	/*Codes_SRS_OUTPROCESS_MODULE_17_047: [ This function shall push the message onto the end of the outgoing gateway message queue. ]*/
+	else if (MESSAGE_QUEUE_push(handleData->outgoing_messages, message) != 0)
+	{
+		LogError("unable to queue the message");
+		Message_Destroy(message);
+	}
+	else
+	{
+		handleData->outgoing_depth++;
+		/*Codes_SRS_OUTPROCESS_MODULE_30_004: [ This function shall signal the outgoing message condition once the message is queued. ]*/
+		(void)Condition_Post(handleData->outgoing_messages_cond);
+	}
+}
+
 static void Outprocess_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
 {
 	OUTPROCESS_HANDLE_DATA* handleData = moduleHandle;
 	/*Codes_SRS_OUTPROCESS_MODULE_17_022: [ If module or message_handle is NULL, this function shall do nothing. ]*/
-	if (handleData != NULL && messageHandle != NULL)
+	if (handleData != NULL && messageHandle != NULL && handleData->link_endpoint != NULL)
+	{
+		/*Codes_SRS_OUTPROCESS_MODULE_30_019: [ For a multiplexed module, this function shall queue the message on the link, which serializes it before returning. ]*/
+		if (OutprocessLink_SendMessage(handleData->link_endpoint, messageHandle) != 0)
+		{
+			LogError("unable to send the message on the link");
+		}
+	}
+	else if (handleData != NULL && messageHandle != NULL)
 	{
 		/*Codes_SRS_OUTPROCESS_MODULE_17_046: [ This function shall clone the message to ensure the message is kept allocated until forwarded to module host. ]*/
 		MESSAGE_HANDLE queued_message = Message_Clone(messageHandle);
@@ -1002,12 +1758,11 @@ static void Outprocess_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messag
 			}
 			else
 			{
-				/*Codes_SRS_OUTPROCESS_MODULE_17_047: [ This function shall push the message onto the end of the outgoing gateway message queue. ]*/
-				if (MESSAGE_QUEUE_push(handleData->outgoing_messages, queued_message) != 0)
+				if (handleData->outgoing_limits_known == 0)
 				{
-					LogError("unable to queue the message");
-					Message_Destroy(queued_message);
+					read_outgoing_limits(handleData);
 				}
+				queue_outgoing_message(handleData, queued_message);
 				(void)Unlock(handleData->handle_lock);
 			}
 		}
@@ -1018,7 +1773,20 @@ static void Outprocess_Start(MODULE_HANDLE moduleHandle)
 {
 	OUTPROCESS_HANDLE_DATA* handleData = moduleHandle;
 	/*Codes_SRS_OUTPROCESS_MODULE_17_020: [ This function shall do nothing if module is NULL. ]*/
-	if (handleData != NULL)
+	if (handleData != NULL && handleData->link_endpoint != NULL)
+	{
+		CONTROL_MESSAGE start_msg =
+		{
+			CONTROL_MESSAGE_VERSION_CURRENT,	/*version*/
+			CONTROL_MESSAGE_TYPE_MODULE_START	/*type*/
+		};
+		/*Codes_SRS_OUTPROCESS_MODULE_30_020: [ For a multiplexed module, this function shall send the Start Message on the link and shall not create any thread. ]*/
+		if (OutprocessLink_SendControl(handleData->link_endpoint, &start_msg) != 0)
+		{
+			LogError("unable to send start message on the link");
+		}
+	}
+	else if (handleData != NULL)
 	{
 		/*Codes_SRS_OUTPROCESS_MODULE_17_017: [ This function shall ensure thread safety on execution. ]*/
 		/*Codes_SRS_OUTPROCESS_MODULE_17_018: [ This function shall create a thread to handle receiving messages from module host. ]*/
@@ -2,20 +2,24 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdio.h>
+#include <string.h>
 #include "proxy_gateway.h"
 #include "native_module_host.h"
 
 int main(int argc, char** argv)
 {
     REMOTE_MODULE_HANDLE remote_module;
-    if (argc != 2)
+    if ((argc != 2) && ((argc != 3) || (strcmp(argv[2], "--multiplexed") != 0)))
     {
-        printf("usage: native_host_sample control_channel_id\n");
+        printf("usage: native_host_sample control_channel_id [--multiplexed]\n");
         printf("where control_channel_id is the name of the control channel (used in URI).\n");
+        printf("With --multiplexed, the process hosts every module configured as multiplexed on this control channel.\n");
     }
     else
     {
-        if ((remote_module = ProxyGateway_Attach(Module_GetApi(MODULE_API_VERSION_1), argv[1])) == NULL)
+        if ((remote_module = (argc == 3) ?
+            ProxyGateway_AttachMultiplexed(Module_GetApi(MODULE_API_VERSION_1), argv[1]) :
+            ProxyGateway_Attach(Module_GetApi(MODULE_API_VERSION_1), argv[1])) == NULL)
         {
             printf("failed to attach remote module from JSON\n");
         }
@@ -11,6 +11,8 @@ CORES=0
 rebuild_deps=OFF
 run_unittests=OFF
 run_e2e_tests=OFF
+build_perf_tests=OFF
+enable_gateway_trace=OFF
 run_valgrind=0
 enable_java_binding=OFF
 enable_dotnet_core_binding=OFF
@@ -42,6 +44,8 @@ usage ()
     echo "                                (JAVA_HOME must be defined in your environment)"
     echo " --rebuild-deps                 Force rebuild of dependencies"
     echo " --run-e2e-tests                Build/run end-to-end tests"
+    echo " --build-perf-tests             Build the micro benchmarks"
+    echo " --enable-trace                 Compile the message path trace points"
     echo " --run-unittests                Build/run unit tests"
     echo " -rv,  --run-valgrind           Execute ctest with valgrind"
     echo " --system-deps-path             Search for dependencies in a system-level location,"
@@ -80,6 +84,8 @@ process_args ()
               "-x" | "--xtrace" ) set -x;;
               "--run-unittests" ) run_unittests=ON;;
               "--run-e2e-tests" ) run_e2e_tests=ON;;
+              "--build-perf-tests" ) build_perf_tests=ON;;
+              "--enable-trace" ) enable_gateway_trace=ON;;
               "--rebuild-deps" ) rebuild_deps=ON;;
               "-cl" | "--compileoption" ) save_next_arg=1;;
               "-rv" | "--run-valgrind" ) run_valgrind=1;;
@@ -173,6 +179,8 @@ cmake $toolchainfile \
       -DCMAKE_BUILD_TYPE="$build_config" \
       -Drun_unittests:BOOL=$run_unittests \
       -Drun_e2e_tests:BOOL=$run_e2e_tests \
+      -Dbuild_perf_tests:BOOL=$build_perf_tests \
+      -Denable_gateway_trace:BOOL=$enable_gateway_trace \
       -Denable_java_binding:BOOL=$enable_java_binding \
       -Denable_dotnet_core_binding:BOOL=$enable_dotnet_core_binding \
       -Denable_nodejs_binding:BOOL=$enable_nodejs_binding \